@@ -41,8 +41,34 @@
 #define	API_H
 
 #define API __attribute__((visibility("default")))
-#define IPFIXCOL_API_VERSION_NUMBER 1
+#define IPFIXCOL_API_VERSION_NUMBER 2
 #define IPFIXCOL_API_VERSION unsigned int ipfixcol_api_version API __attribute__((used)) = IPFIXCOL_API_VERSION_NUMBER;
 
+/**
+ * \defgroup metadataFlags Metadata required by a plugin
+ *
+ * Intermediate and storage plugins declare which parts of the per-record
+ * metadata (struct metadata) they read by IPFIXCOL_METADATA(). When at least
+ * one running plugin requires any part, the preprocessor builds the whole
+ * metadata array: record pointers are filled and all other parts are zeroed
+ * for the plugins that set them (e.g. geoip, profiler). When no plugin needs
+ * metadata, the array is not built at all (ipfix_message::metadata is then
+ * NULL) and the records are only counted. Plugins without the declaration
+ * are treated as requiring everything (MDATA_ALL).
+ *
+ * The declaration is read when the plugin is loaded; a plugin whose needs
+ * depend on its configuration declares everything it may read.
+ *
+ * @{
+ */
+#define MDATA_NONE     0x0 /**< No metadata */
+#define MDATA_RECORDS  0x1 /**< Record pointers, lengths and templates */
+#define MDATA_ENRICH   0x2 /**< Countries, AS numbers and names */
+#define MDATA_CHANNELS 0x4 /**< List of channels */
+#define MDATA_ALL      (MDATA_RECORDS | MDATA_ENRICH | MDATA_CHANNELS)
+/**@}*/
+
+#define IPFIXCOL_METADATA(flags) unsigned int ipfixcol_metadata API __attribute__((used)) = (flags)
+
 #endif	/* API_H */
 
@@ -133,6 +133,13 @@ typedef struct {
  * \brief Get a description of the IPFIX element with given Elemenent ID and
  * Enterprise ID
  *
+ * The lookup takes constant time (direct index of IANA elements, perfect hash
+ * table of enterprise elements).
+ *
+ * The returned pointer is a handle which stays valid after a reload of the
+ * description of elements (previous descriptions are kept for several
+ * reloads). Therefore, it can be resolved once per template field and reused
+ * for all records of the template.
  * \param[in] id Element ID
  * \param[in] en Enterprise ID
  * \return On success returns pointer to the element. If the element is unknown,
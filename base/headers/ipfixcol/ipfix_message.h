@@ -48,6 +48,7 @@
 #ifndef IPFIX_MESSAGE_H_
 #define IPFIX_MESSAGE_H_
 
+#include <stdbool.h>
 #include "api.h"
 #include "input.h"
 #include "templates.h"
@@ -60,6 +61,14 @@ struct __attribute__((__packed__)) ipfix_template_row {
 	uint16_t id, length;
 };
 
+/**
+ * \brief Part of an IPFIX message
+ */
+struct message_range {
+	uint16_t start;          /**< Offset from the message header */
+	uint16_t length;         /**< Length in bytes */
+};
+
 /**
  * \brief Create ipfix_message structure from data in memory
  *
@@ -291,6 +300,16 @@ API int template_set_process_records(struct ipfix_template_set *tset, int type,
  */
 API void message_free_metadata(struct ipfix_message *msg);
 
+/**
+ * \brief Dispose IPFIX message with its metadata and references of templates
+ *
+ * Unlike message_free(), the references of the templates of the Data Sets
+ * are released too, as done for messages leaving the storage queue.
+ *
+ * \param[in] msg IPFIX message
+ */
+API void message_release(struct ipfix_message *msg);
+
 /**
  * \brief Create copy of metadata structure
  *
@@ -299,6 +318,59 @@ API void message_free_metadata(struct ipfix_message *msg);
  */
 API struct metadata *message_copy_metadata(struct ipfix_message *src);
 
+/**
+ * \brief Remove parts of IPFIX message
+ *
+ * Remaining parts are moved so that the message stays contiguous and all
+ * pointers into it (sets, metadata) are updated. Data couples starting in
+ * a removed range are dropped together with their template references and
+ * metadata of records in removed ranges are dropped.
+ *
+ * \param[in,out] msg IPFIX message
+ * \param[in] ranges Removed ranges, sorted and not overlapping
+ * \param[in] count Number of ranges
+ * \param[in] records Number of removed data records
+ */
+API void message_remove_ranges(struct ipfix_message *msg, const struct message_range *ranges,
+		uint32_t count, uint16_t records);
+
+/**
+ * \brief Remove Data Sets from IPFIX message
+ *
+ * \param[in,out] msg IPFIX message
+ * \param[in] removed Flags of removed data couples
+ * \param[in] records Number of removed data records
+ */
+API void message_remove_data_sets(struct ipfix_message *msg, const bool *removed, uint16_t records);
+
+/**
+ * \brief Build Template Record in network byte order from template
+ *
+ * \param[in] templ Template
+ * \param[out] length Length of the record
+ * \return Template Record (to be freed by caller) or NULL
+ */
+API uint8_t *template_create_record(struct ipfix_template *templ, uint16_t *length);
+
+/**
+ * \brief Read unsigned integer in network byte order
+ *
+ * \param[in] data Field value
+ * \param[in] length Length of the field (up to 8 bytes)
+ * \return Value of the field
+ */
+static inline uint64_t data_read_uint(const uint8_t *data, uint16_t length)
+{
+	uint64_t value = 0;
+	uint16_t i;
+
+	for (i = 0; i < length; ++i) {
+		value = (value << 8) | data[i];
+	}
+
+	return value;
+}
+
 #endif /* IPFIX_MESSAGE_H_ */
 
 /**@}*/
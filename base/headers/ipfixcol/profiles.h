@@ -150,6 +150,10 @@ API void *profile_get_channel(void *profile, uint16_t index);
  * Profiles are NOT stored (they're accessible by calling
  * channel_get_profile on matched channel)
  *
+ * Each channel is listed at most once. Lists are shared by all records
+ * that match the same set of channels and are owned by the profile tree,
+ * so the caller must NOT free them.
+ *
  * \param[in] profile
  * \param[in] msg IPFIX message
  * \param[in] mdata Data record's metadata
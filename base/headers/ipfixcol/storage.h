@@ -40,6 +40,11 @@
 #ifndef IPFIXCOL_STORAGE_H_
 #define IPFIXCOL_STORAGE_H_
 
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include "ipfix.h"
 #include "input.h"
 #include "templates.h"
@@ -132,8 +137,13 @@ struct __attribute__((__packed__)) ipfix_message {
 	struct data_template_couple       data_couple[MSG_MAX_DATA_COUPLES];
 	/** Pointer to the live profile */
 	void *live_profile;
-	/** List of metadata structures */
+	/** List of metadata structures (NULL when no plugin requires them,
+	 *  see IPFIXCOL_METADATA) */
 	struct metadata *metadata;
+	/** Event time watermark in milliseconds since the epoch: all records of
+	 *  the ODID that start before it have been delivered by an ordering stage
+	 *  (0 = not ordered) */
+	uint64_t                          watermark;
 };
 
 /**
@@ -197,4 +207,276 @@ API int storage_close (void **config);
 
 /**@}*/
 
+/**
+ * \defgroup storageWindow Storage time windows
+ * \ingroup storageAPI
+ *
+ * Helper for storage plugins that rotate their output in time windows.
+ * The directory tree and files of the next window are prepared on a background
+ * thread shortly before the window boundary. At the boundary the storage
+ * thread only swaps the prepared resources instead of creating directories
+ * and opening files synchronously.
+ *
+ * Resources of a window are prepared only after the plugin switched into the
+ * previous one, so an idle plugin does not leave a trail of unused windows.
+ *
+ * Behind an ordering stage (order intermediate plugin) windows can be switched
+ * by event time instead: once storage_window_watermark() receives a watermark,
+ * a window is switched when the watermark passes its end, i.e. when all its
+ * records have been delivered. Windows of the plugin should then be aligned
+ * and of the same size as windows of the ordering stage.
+ *
+ * @{
+ */
+
+/** Default number of seconds the next window is prepared before its start */
+#define STORAGE_WINDOW_LEAD 5
+
+/**
+ * \brief Prepare resources of a time window
+ *
+ * Called from the background thread of the helper. The callback must not
+ * touch plugin structures that are modified by the storage thread without
+ * a lock.
+ *
+ * \param[in] start Start of the time window
+ * \param[in] user User data passed to storage_window_create()
+ * \return Prepared resources (e.g. opened files) or NULL
+ */
+typedef void *(*storage_window_prepare_cb)(time_t start, void *user);
+
+/**
+ * \brief Release resources that were prepared but never used
+ *
+ * \param[in] prepared Resources returned by the prepare callback
+ * \param[in] user User data passed to storage_window_create()
+ */
+typedef void (*storage_window_release_cb)(void *prepared, void *user);
+
+/** Time window helper (opaque) */
+struct storage_window;
+
+/**
+ * \brief Start preparing time windows
+ *
+ * \param[in] start Start of the current window (already prepared by the plugin)
+ * \param[in] size Size of the window in seconds
+ * \param[in] lead Number of seconds the next window is prepared in advance
+ * \param[in] prepare Callback preparing resources of a window
+ * \param[in] release Callback releasing unused resources (can be NULL)
+ * \param[in] user User data passed to the callbacks
+ * \return Pointer to the helper or NULL on error
+ */
+API struct storage_window *storage_window_create(time_t start, uint32_t size,
+		uint32_t lead, storage_window_prepare_cb prepare,
+		storage_window_release_cb release, void *user);
+
+/**
+ * \brief Switch to the next time window if its boundary has passed
+ *
+ * Cheap enough to be called for every record. When the plugin was idle for
+ * more than one window, prepared resources are released and the start of the
+ * current window is returned without them.
+ *
+ * \param[in] win Time window helper
+ * \param[out] start Start of the new window
+ * \param[out] prepared Resources of the new window or NULL when they have to
+ * be created synchronously by the plugin
+ * \return 1 when the window has changed, 0 otherwise
+ */
+API int storage_window_switch(struct storage_window *win, time_t *start,
+		void **prepared);
+
+/**
+ * \brief Pass watermark of a message to the helper
+ *
+ * The first watermark turns on switching by event time; the current window
+ * may then move back once to the window of the watermark. Messages without
+ * watermark (0) are ignored.
+ *
+ * \param[in] win Time window helper (can be NULL)
+ * \param[in] watermark Watermark of the message (ipfix_message::watermark)
+ */
+API void storage_window_watermark(struct storage_window *win, uint64_t watermark);
+
+/**
+ * \brief Stop the background thread and release unused resources
+ *
+ * \param[in] win Time window helper
+ */
+API void storage_window_destroy(struct storage_window *win);
+
+/**
+ * \brief Create all directories on the path
+ *
+ * Only directories before the last '/' are created; the rest of the path is
+ * considered a file name. Existing directories are not an error.
+ *
+ * \param[in] path File or directory path
+ * \return 0 on success, nonzero else.
+ */
+API int storage_mkdir(const char *path);
+
+/**@}*/
+
+/**
+ * \defgroup storageIO Asynchronous file writes
+ * \ingroup storageAPI
+ *
+ * Shared layer that lets storage plugins hand off buffers and continue instead
+ * of blocking their storage thread (and the data manager's ring buffer) on a
+ * slow disk. Requests are executed via io_uring when the kernel supports it,
+ * otherwise by a small pool of threads.
+ *
+ * Requests are buffered and submitted together when \c batch of them are
+ * waiting, or by storage_io_submit() and storage_io_flush(). At most \c depth
+ * requests are buffered or in flight; further requests block until an older
+ * one completes. Buffers must stay untouched until the completion callback of
+ * their request has been called.
+ *
+ * Writes are not reordered with respect to fsync: an fsync completes only
+ * after all writes to the descriptor that were requested before it. An fsync
+ * requested while the previous request for the same descriptor is a buffered
+ * fsync is merged into it.
+ *
+ * The layer is used by plugins that write their files through plain
+ * descriptors (ipfix and the file output of json). Plugins whose files are
+ * written by an external library (fastbit, nfdump, lnfstore, ...) and plugins
+ * sending data over the network or shared memory do not use it.
+ *
+ * @{
+ */
+
+/** Default maximal number of requests buffered or in flight */
+#define STORAGE_IO_DEPTH 64
+/** Default number of requests buffered before they are submitted */
+#define STORAGE_IO_BATCH 8
+
+/** Do not use io_uring even if available (flag of storage_io_create()) */
+#define STORAGE_IO_NO_URING 0x1
+
+/** Backend executing requests */
+enum storage_io_backend {
+	STORAGE_IO_BACKEND_URING,            /**< io_uring */
+	STORAGE_IO_BACKEND_THREADS           /**< Pool of threads */
+};
+
+/**
+ * \brief Completion callback
+ *
+ * Called exactly once per request from a thread of the layer. The callback
+ * must be short and must not issue or wait for requests of the same layer.
+ *
+ * \param[in] result Number of bytes written (the whole buffer; short writes
+ * are continued internally), 0 for a successful fsync or a negative errno value
+ * \param[in] user User data of the request
+ */
+typedef void (*storage_io_cb)(int result, void *user);
+
+/** Asynchronous write layer (opaque) */
+struct storage_io;
+
+/**
+ * \brief Create asynchronous write layer
+ *
+ * \param[in] depth Maximal number of requests buffered or in flight (0 for default)
+ * \param[in] batch Number of requests buffered before submission (0 for default)
+ * \param[in] flags STORAGE_IO_NO_URING or 0
+ * \return Pointer to the layer or NULL on error
+ */
+API struct storage_io *storage_io_create(unsigned int depth, unsigned int batch,
+		int flags);
+
+/**
+ * \brief Get backend of the layer
+ *
+ * \param[in] io Asynchronous write layer
+ * \return Backend (enum storage_io_backend)
+ */
+API int storage_io_backend(const struct storage_io *io);
+
+/**
+ * \brief Register buffers for storage_io_write_fixed()
+ *
+ * With io_uring the pages of the buffers are pinned once, so they are not
+ * mapped by the kernel for every request. Can be called only once and only
+ * when there are no requests in flight.
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] iov Buffers
+ * \param[in] count Number of buffers
+ * \return 0 on success, nonzero else.
+ */
+API int storage_io_register_buffers(struct storage_io *io,
+		const struct iovec *iov, unsigned int count);
+
+/**
+ * \brief Request a write at a given file offset
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] fd File descriptor
+ * \param[in] buf Data
+ * \param[in] len Length of the data
+ * \param[in] offset File offset
+ * \param[in] cb Completion callback (can be NULL)
+ * \param[in] user User data of the callback
+ * \return 0 on success, nonzero else.
+ */
+API int storage_io_write(struct storage_io *io, int fd, const void *buf,
+		size_t len, off_t offset, storage_io_cb cb, void *user);
+
+/**
+ * \brief Request a write from a registered buffer
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] fd File descriptor
+ * \param[in] index Index of the registered buffer
+ * \param[in] buf Data (must lie in the registered buffer)
+ * \param[in] len Length of the data
+ * \param[in] offset File offset
+ * \param[in] cb Completion callback (can be NULL)
+ * \param[in] user User data of the callback
+ * \return 0 on success, nonzero else.
+ */
+API int storage_io_write_fixed(struct storage_io *io, int fd,
+		unsigned int index, const void *buf, size_t len, off_t offset,
+		storage_io_cb cb, void *user);
+
+/**
+ * \brief Request fsync of a file descriptor
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] fd File descriptor
+ * \param[in] cb Completion callback (can be NULL)
+ * \param[in] user User data of the callback
+ * \return 0 on success, nonzero else.
+ */
+API int storage_io_fsync(struct storage_io *io, int fd, storage_io_cb cb,
+		void *user);
+
+/**
+ * \brief Submit buffered requests
+ *
+ * \param[in] io Asynchronous write layer
+ * \return 0 on success, nonzero else.
+ */
+API int storage_io_submit(struct storage_io *io);
+
+/**
+ * \brief Submit buffered requests and wait until all requests complete
+ *
+ * \param[in] io Asynchronous write layer
+ * \return 0 on success, nonzero else.
+ */
+API int storage_io_flush(struct storage_io *io);
+
+/**
+ * \brief Complete all requests and destroy the layer
+ *
+ * \param[in] io Asynchronous write layer
+ */
+API void storage_io_destroy(struct storage_io *io);
+
+/**@}*/
+
 #endif /* IPFIXCOL_STORAGE_H_ */
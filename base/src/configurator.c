@@ -139,6 +139,7 @@ configurator *config_init(const char *internal, const char *startup)
 	config->startup_file = startup;
 	config->ip_id = 1; /* 0 == ALL */
 	config->sp_id = 1; /* 0 == ALL */
+	config->metadata = MDATA_ALL;
 
 	/* Open startup.xml */
 	config->act_doc = config_open_xml(startup);
@@ -431,6 +432,10 @@ int config_add_inter(configurator *config, struct plugin_config *plugin, int ind
 		goto err;
 	}
 
+	/* Metadata required by the plugin (all when not declared) */
+	unsigned int *plugin_metadata = (unsigned int *) dlsym(im_plugin->dll_handler, "ipfixcol_metadata");
+	im_plugin->metadata = (plugin_metadata) ? (*plugin_metadata & MDATA_ALL) : MDATA_ALL;
+
 	/* Prepare Input API routines */
 	im_plugin->intermediate_process_message = dlsym(im_plugin->dll_handler, "intermediate_process_message");
 	if (!im_plugin->intermediate_process_message) {
@@ -549,6 +554,10 @@ int config_add_storage(configurator *config, struct plugin_config *plugin, int i
 		goto err;
 	}
 
+	/* Metadata required by the plugin (all when not declared) */
+	unsigned int *plugin_metadata = (unsigned int *) dlsym(st_plugin->dll_handler, "ipfixcol_metadata");
+	st_plugin->metadata = (plugin_metadata) ? (*plugin_metadata & MDATA_ALL) : MDATA_ALL;
+
 	/* Prepare Input API routines */
 	st_plugin->init = dlsym(st_plugin->dll_handler, "storage_init");
 	if (!st_plugin->init) {
@@ -1149,6 +1158,48 @@ void *config_get_current_profiles(configurator *config)
 	return config->profiles[config->current_profiles];
 }
 
+/**
+ * Get metadata required by running plugins
+ */
+unsigned int config_get_metadata(configurator *config)
+{
+	return config->metadata;
+}
+
+/**
+ * \brief Update union of metadata required by running plugins
+ *
+ * \param[in] config configurator
+ */
+void config_update_metadata(configurator *config)
+{
+	unsigned int flags = MDATA_NONE;
+	unsigned int i;
+
+	if (!config->startup) {
+		config->metadata = MDATA_ALL;
+		return;
+	}
+
+	for (i = 0; i < sizeof(config->startup->inter) / sizeof(config->startup->inter[0]); ++i) {
+		if (config->startup->inter[i] && config->startup->inter[i]->inter) {
+			flags |= config->startup->inter[i]->inter->metadata;
+		}
+	}
+
+	for (i = 0; i < sizeof(config->startup->storage) / sizeof(config->startup->storage[0]); ++i) {
+		if (config->startup->storage[i] && config->startup->storage[i]->storage) {
+			flags |= config->startup->storage[i]->storage->metadata;
+		}
+	}
+
+	if (flags != config->metadata) {
+		MSG_INFO(msg_module, "[%d] Required metadata changed to 0x%x", config->proc_id, flags);
+	}
+
+	config->metadata = flags;
+}
+
 /**
  * \brief Process profiles configuration
  *
@@ -1232,6 +1283,7 @@ int config_reconf(configurator *config)
 
 	/* Process changes */
 	ret = config_process_new_startup(config, new_startup);
+	config_update_metadata(config);
 
 	/* Process profiles configuration */
 	config_process_profiles(config);
@@ -100,6 +100,7 @@ typedef struct ipfix_config {
 	int proc_id;                    /**< process ID */
 	int ip_id;                      /**< Internal process ID */
 	int sp_id;                      /**< Storage plugin ID */
+	unsigned int metadata;          /**< Metadata required by plugins */
 } configurator;
 
 /**
@@ -127,6 +128,14 @@ int config_reconf(configurator *config);
  */
 void *config_get_current_profiles(configurator *config);
 
+/**
+ * \brief Get metadata required by running intermediate and storage plugins
+ *
+ * \param[in] config
+ * \return union of MDATA_* flags declared by the plugins
+ */
+unsigned int config_get_metadata(configurator *config);
+
 /**
  * \brief Stop all intermediate plugins and flush their buffers
  * 
@@ -122,15 +122,6 @@ DWORD updateCRC32(unsigned char ch, DWORD crc)
 
 DWORD crc32(char *buf, size_t len)
 {
-      register DWORD oldcrc32;
-
-      oldcrc32 = 0xFFFFFFFF;
-
-      for ( ; len; --len, ++buf)
-      {
-            oldcrc32 = UPDC32(*buf, oldcrc32);
-      }
-
-      return ~oldcrc32;
-
+      /* Same result as the byte-at-a-time loop with the table above */
+      return crc32_ieee(0, buf, len);
 }
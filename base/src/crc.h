@@ -6,6 +6,7 @@
 #define CRC__H
 
 #include <stdlib.h>           /* For size_t                 */
+#include <stdint.h>
 
 typedef enum {Error_ = -1, Success_, False_ = 0, True_} Boolean_T;
 typedef unsigned char BYTE;
@@ -18,4 +19,35 @@ typedef unsigned short WORD;
 DWORD updateCRC32(unsigned char ch, DWORD crc);
 DWORD crc32(char *buf, size_t len);
 
+/*
+** Accelerated CRC functions (crc_fast.c)
+**
+** The fastest implementation usable on the CPU (SSE4.2 / PCLMULQDQ on x86,
+** CRC32 instructions on ARMv8, slicing-by-8 otherwise) is selected on the
+** first call. A CRC of data split into several buffers is computed by
+** passing the result for the previous buffer as "crc" (0 for the first one).
+*/
+
+/** CRC variants */
+enum crc_type {
+	CRC_IEEE,          /**< CRC-32 (IEEE 802.3), same as crc32()        */
+	CRC_CASTAGNOLI,    /**< CRC-32C (Castagnoli, iSCSI)                 */
+	CRC_TYPE_COUNT
+};
+
+/** Implementation of a CRC function */
+struct crc_impl {
+	const char *name;  /**< Name of the implementation (NULL = end)     */
+	uint32_t (*func)(uint32_t crc, const void *buf, size_t len);
+};
+
+/* CRC-32 (IEEE 802.3) */
+uint32_t crc32_ieee(uint32_t crc, const void *buf, size_t len);
+
+/* CRC-32C (Castagnoli), preferred for new code and on-disk structures */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* Implementations usable on this CPU, the selected (fastest) one first */
+const struct crc_impl *crc_implementations(enum crc_type type);
+
 #endif /* CRC__H */
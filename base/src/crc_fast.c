@@ -0,0 +1,467 @@
+/**
+ * \file crc_fast.c
+ * \brief CRC-32 and CRC-32C with runtime selection of hardware acceleration
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC_X86
+#include <cpuid.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#include <smmintrin.h>
+#elif defined(__aarch64__)
+#define CRC_ARM
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/** Reflected polynomials */
+#define CRC_POLY_IEEE       0xEDB88320U
+#define CRC_POLY_CASTAGNOLI 0x82F63B78U
+
+/** Tables for the slicing-by-8 algorithm */
+static uint32_t crc_tables[CRC_TYPE_COUNT][8][256];
+
+/** Available implementations (the fastest first, NULL terminated) */
+static struct crc_impl crc_impls[CRC_TYPE_COUNT][4];
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \brief Generate tables for the slicing-by-8 algorithm
+ * \param[out] table Tables
+ * \param[in]  poly  Reflected polynomial
+ */
+static void crc_make_tables(uint32_t table[8][256], uint32_t poly)
+{
+	for (unsigned int i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int k = 0; k < 8; ++k) {
+			crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+		}
+		table[0][i] = crc;
+	}
+
+	for (unsigned int i = 0; i < 256; ++i) {
+		for (int k = 1; k < 8; ++k) {
+			table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+		}
+	}
+}
+
+/**
+ * \brief Update a CRC register (not inverted) by slicing-by-8
+ */
+static uint32_t crc_slice8(const uint32_t table[8][256], uint32_t crc,
+	const uint8_t *ptr, size_t len)
+{
+	/* Align the pointer */
+	while (len > 0 && ((uintptr_t) ptr & 7) != 0) {
+		crc = table[0][(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, ptr, sizeof(word));
+		word ^= crc;
+
+		crc = table[7][word & 0xFF]
+			^ table[6][(word >> 8) & 0xFF]
+			^ table[5][(word >> 16) & 0xFF]
+			^ table[4][(word >> 24) & 0xFF]
+			^ table[3][(word >> 32) & 0xFF]
+			^ table[2][(word >> 40) & 0xFF]
+			^ table[1][(word >> 48) & 0xFF]
+			^ table[0][word >> 56];
+
+		ptr += 8;
+		len -= 8;
+	}
+#endif
+
+	while (len-- > 0) {
+		crc = table[0][(crc ^ *ptr++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+static uint32_t crc32_ieee_sw(uint32_t crc, const void *buf, size_t len)
+{
+	return ~crc_slice8(crc_tables[CRC_IEEE], ~crc, buf, len);
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	return ~crc_slice8(crc_tables[CRC_CASTAGNOLI], ~crc, buf, len);
+}
+
+#ifdef CRC_X86
+
+/**
+ * \brief CRC-32C by the SSE4.2 CRC32 instruction
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+	crc = ~crc;
+
+	while (len > 0 && ((uintptr_t) ptr & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *ptr++);
+		len--;
+	}
+
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, ptr, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		ptr += 8;
+		len -= 8;
+	}
+	crc = (uint32_t) crc64;
+#endif
+
+	while (len >= 4) {
+		uint32_t word;
+		memcpy(&word, ptr, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+		ptr += 4;
+		len -= 4;
+	}
+
+	while (len-- > 0) {
+		crc = _mm_crc32_u8(crc, *ptr++);
+	}
+
+	return ~crc;
+}
+
+/**
+ * \brief Constants of PCLMULQDQ folding (bit-reflected)
+ */
+struct crc_fold_consts {
+	int64_t k1, k2;   /**< x^(4*128+32) mod P, x^(4*128-32) mod P */
+	int64_t k3, k4;   /**< x^(128+32) mod P, x^(128-32) mod P     */
+	int64_t k5;       /**< x^64 mod P                             */
+	int64_t p, u;     /**< P(x) and floor(x^64 / P(x))            */
+};
+
+static const struct crc_fold_consts crc_fold_ieee = {
+	0x0154442BD4LL, 0x01C6E41596LL, 0x01751997D0LL, 0x00CCAA009ELL,
+	0x0163CD6124LL, 0x01DB710641LL, 0x01F7011641LL
+};
+
+static const struct crc_fold_consts crc_fold_castagnoli = {
+	0x00740EEF02LL, 0x009E4ADDF8LL, 0x00F20C0DFELL, 0x014CD00BD6LL,
+	0x00DD45AAB8LL, 0x0105EC76F1LL, 0x00DEA713F1LL
+};
+
+/**
+ * \brief Update a CRC register (not inverted) by PCLMULQDQ folding
+ *
+ * Based on "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" (Intel). Four 128-bit lanes are folded by 64 bytes, then into
+ * a single lane and finally reduced by Barrett reduction.
+ * \warning The length must be at least 64 and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc_fold_pclmul(const struct crc_fold_consts *c, uint32_t crc,
+	const uint8_t *buf, size_t len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(c->k2, c->k1);
+	const __m128i k3k4 = _mm_set_epi64x(c->k4, c->k3);
+	const __m128i k5k0 = _mm_set_epi64x(0, c->k5);
+	const __m128i poly = _mm_set_epi64x(c->u, c->p);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	buf += 64;
+	len -= 64;
+
+	/* Fold 4 lanes by 64 bytes */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const __m128i *) (buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+			_mm_loadu_si128((const __m128i *) (buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+			_mm_loadu_si128((const __m128i *) (buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+			_mm_loadu_si128((const __m128i *) (buf + 0x30)));
+
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold 4 lanes into 1 */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Fold remaining blocks of 16 bytes */
+	while (len >= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const __m128i *) buf));
+		buf += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+/**
+ * \brief CRC-32 by PCLMULQDQ folding (short buffers and tails by software)
+ */
+static uint32_t crc32_ieee_pclmul(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+	crc = ~crc;
+
+	if (len >= 64) {
+		size_t chunk = len & ~(size_t) 15;
+		crc = crc_fold_pclmul(&crc_fold_ieee, crc, ptr, chunk);
+		ptr += chunk;
+		len -= chunk;
+	}
+
+	return ~crc_slice8(crc_tables[CRC_IEEE], crc, ptr, len);
+}
+
+/**
+ * \brief CRC-32C by PCLMULQDQ folding (short buffers and tails by SSE4.2)
+ */
+static uint32_t crc32c_pclmul(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+
+	if (len >= 64) {
+		size_t chunk = len & ~(size_t) 15;
+		crc = ~crc_fold_pclmul(&crc_fold_castagnoli, ~crc, ptr, chunk);
+		ptr += chunk;
+		len -= chunk;
+	}
+
+	return crc32c_sse42(crc, ptr, len);
+}
+
+#endif /* CRC_X86 */
+
+#ifdef CRC_ARM
+
+/**
+ * \brief CRC-32 by ARMv8 CRC32 instructions
+ */
+__attribute__((target("arch=armv8-a+crc")))
+static uint32_t crc32_ieee_armv8(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+	crc = ~crc;
+
+	while (len > 0 && ((uintptr_t) ptr & 7) != 0) {
+		crc = __crc32b(crc, *ptr++);
+		len--;
+	}
+
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, ptr, sizeof(word));
+		crc = __crc32d(crc, word);
+		ptr += 8;
+		len -= 8;
+	}
+
+	while (len-- > 0) {
+		crc = __crc32b(crc, *ptr++);
+	}
+
+	return ~crc;
+}
+
+/**
+ * \brief CRC-32C by ARMv8 CRC32C instructions
+ */
+__attribute__((target("arch=armv8-a+crc")))
+static uint32_t crc32c_armv8(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+	crc = ~crc;
+
+	while (len > 0 && ((uintptr_t) ptr & 7) != 0) {
+		crc = __crc32cb(crc, *ptr++);
+		len--;
+	}
+
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, ptr, sizeof(word));
+		crc = __crc32cd(crc, word);
+		ptr += 8;
+		len -= 8;
+	}
+
+	while (len-- > 0) {
+		crc = __crc32cb(crc, *ptr++);
+	}
+
+	return ~crc;
+}
+
+#endif /* CRC_ARM */
+
+/**
+ * \brief Generate tables and select the fastest implementations
+ */
+static void crc_init()
+{
+	unsigned int ieee = 0, castagnoli = 0;
+
+	crc_make_tables(crc_tables[CRC_IEEE], CRC_POLY_IEEE);
+	crc_make_tables(crc_tables[CRC_CASTAGNOLI], CRC_POLY_CASTAGNOLI);
+
+#if defined(CRC_X86)
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		const bool sse42 = (ecx & bit_SSE4_2) != 0;
+		const bool pclmul = (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+
+		if (pclmul && sse42) {
+			crc_impls[CRC_CASTAGNOLI][castagnoli++] =
+				(struct crc_impl) {"pclmul", crc32c_pclmul};
+		}
+
+		if (sse42) {
+			crc_impls[CRC_CASTAGNOLI][castagnoli++] =
+				(struct crc_impl) {"sse4.2", crc32c_sse42};
+		}
+
+		if (pclmul) {
+			crc_impls[CRC_IEEE][ieee++] =
+				(struct crc_impl) {"pclmul", crc32_ieee_pclmul};
+		}
+	}
+#elif defined(CRC_ARM)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		crc_impls[CRC_IEEE][ieee++] =
+			(struct crc_impl) {"armv8", crc32_ieee_armv8};
+		crc_impls[CRC_CASTAGNOLI][castagnoli++] =
+			(struct crc_impl) {"armv8", crc32c_armv8};
+	}
+#endif
+
+	crc_impls[CRC_IEEE][ieee] = (struct crc_impl) {"slice8", crc32_ieee_sw};
+	crc_impls[CRC_CASTAGNOLI][castagnoli] = (struct crc_impl) {"slice8", crc32c_sw};
+}
+
+/**
+ * \brief Get implementations usable on this CPU
+ */
+const struct crc_impl *crc_implementations(enum crc_type type)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc_impls[type];
+}
+
+/**
+ * \brief Compute CRC-32 (IEEE 802.3)
+ */
+uint32_t crc32_ieee(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc_impls[CRC_IEEE][0].func(crc, buf, len);
+}
+
+/**
+ * \brief Compute CRC-32C (Castagnoli)
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc_impls[CRC_CASTAGNOLI][0].func(crc, buf, len);
+}
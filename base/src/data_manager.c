@@ -40,6 +40,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <pthread.h>
 #include <libxml/tree.h>
 #include <sys/prctl.h>
@@ -54,6 +55,15 @@ static char *msg_module = "data manager";
 /** Ring buffer size */
 extern int ring_buffer_size;
 
+/** Spool directory (NULL = spool disabled) */
+extern char *spool_dir;
+
+/** Maximal size of the spool of a Data Manager */
+extern uint64_t spool_max_size;
+
+/** Configurator (current profiles for replayed messages) */
+extern configurator *global_config;
+
 /**
  * \brief Deallocate Data manager's configuration structure.
  *
@@ -84,6 +94,13 @@ static inline void data_manager_free (struct data_manager_config* config)
 		if (config->store_queue) {
 			rbuffer_free(config->store_queue);
 		}
+
+		/* Close spool (replayed templates are not used anymore) */
+		if (config->spool) {
+			spool_close(config->spool);
+			pthread_cond_destroy(&(config->spool_cond));
+			pthread_mutex_destroy(&(config->spool_mutex));
+		}
 		
 		/* Free DM config */
 		free(config);
@@ -151,6 +168,123 @@ static void* storage_plugin_thread(void *cfg)
 	return (NULL);
 }
 
+/**
+ * \brief Thread replaying spooled messages
+ */
+static void *spool_replay_thread(void *cfg)
+{
+	struct data_manager_config *config = (struct data_manager_config *) cfg;
+	struct ipfix_message *msg;
+	char thread_name[16];
+
+	snprintf(thread_name, 16, "ipfixcol SP %u", config->observation_domain_id);
+	prctl(PR_SET_NAME, thread_name, 0, 0, 0);
+
+	pthread_mutex_lock(&(config->spool_mutex));
+	while (1) {
+		while (!config->spool_stop && spool_empty(config->spool)) {
+			pthread_cond_wait(&(config->spool_cond), &(config->spool_mutex));
+		}
+
+		/* Leave the rest on the disk when the collector terminates */
+		if (config->spool_stop && (terminating || spool_empty(config->spool))) {
+			break;
+		}
+
+		msg = spool_read(config->spool, (global_config) ? config_get_current_profiles(global_config) : NULL);
+		if (!msg) {
+			continue;
+		}
+
+		/* Messages must not overtake the one being written */
+		config->spool_replaying = 1;
+		pthread_cond_broadcast(&(config->spool_cond));
+		pthread_mutex_unlock(&(config->spool_mutex));
+
+		if (rbuffer_write(config->store_queue, msg, config->plugins_count) != 0) {
+			MSG_WARNING(msg_module, "[%u] Unable to write into Data Manager input queue; skipping data...",
+					config->observation_domain_id);
+			message_release(msg);
+		}
+
+		pthread_mutex_lock(&(config->spool_mutex));
+		config->spool_replaying = 0;
+		pthread_cond_broadcast(&(config->spool_cond));
+	}
+	pthread_mutex_unlock(&(config->spool_mutex));
+
+	MSG_INFO(msg_module, "[%u] Closing spool thread", config->observation_domain_id);
+	return NULL;
+}
+
+/**
+ * \brief Pass message to storage plugins
+ */
+int data_manager_write(struct data_manager_config *config, struct ipfix_message *msg)
+{
+	int ret;
+
+	if (!config->spool) {
+		return rbuffer_write(config->store_queue, msg, config->plugins_count);
+	}
+
+	pthread_mutex_lock(&(config->spool_mutex));
+
+	/* Nothing spooled and the plugins keep up */
+	if (spool_empty(config->spool) && !config->spool_replaying
+			&& rbuffer_try_write(config->store_queue, msg, config->plugins_count) == 0) {
+		pthread_mutex_unlock(&(config->spool_mutex));
+		return 0;
+	}
+
+	while ((ret = spool_append(config->spool, msg)) == SPOOL_FULL) {
+		pthread_cond_wait(&(config->spool_cond), &(config->spool_mutex));
+	}
+
+	if (ret == 0) {
+		pthread_cond_broadcast(&(config->spool_cond));
+		pthread_mutex_unlock(&(config->spool_mutex));
+		return 0;
+	}
+
+	/* Message cannot be spooled, wait until older messages are replayed */
+	MSG_DEBUG(msg_module, "[%u] Unable to spool message; waiting for storage plugins...",
+			config->observation_domain_id);
+	while (!spool_empty(config->spool) || config->spool_replaying) {
+		pthread_cond_wait(&(config->spool_cond), &(config->spool_mutex));
+	}
+	pthread_mutex_unlock(&(config->spool_mutex));
+
+	return rbuffer_write(config->store_queue, msg, config->plugins_count);
+}
+
+/**
+ * \brief Open spool of the Data Manager and start replaying its content
+ */
+static void data_manager_spool_init(struct data_manager_config *config)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, "%s/%u", spool_dir, config->observation_domain_id);
+	config->spool = spool_open(path, spool_max_size);
+	if (!config->spool) {
+		MSG_WARNING(msg_module, "[%u] Unable to open spool '%s'; continuing without it",
+				config->observation_domain_id, path);
+		return;
+	}
+
+	pthread_mutex_init(&(config->spool_mutex), NULL);
+	pthread_cond_init(&(config->spool_cond), NULL);
+
+	if (pthread_create(&(config->spool_thread), NULL, &spool_replay_thread, (void *) config) != 0) {
+		MSG_ERROR(msg_module, "[%u] Unable to create spool thread", config->observation_domain_id);
+		spool_close(config->spool);
+		pthread_cond_destroy(&(config->spool_cond));
+		pthread_mutex_destroy(&(config->spool_mutex));
+		config->spool = NULL;
+	}
+}
+
 /**
  * \brief Add storage plugin instance
  */
@@ -273,6 +407,15 @@ void data_manager_close (struct data_manager_config **config)
 {
 	unsigned int i;
 
+	/* stop spool thread, it replays the rest of the spool unless terminating */
+	if ((*config)->spool) {
+		pthread_mutex_lock(&((*config)->spool_mutex));
+		(*config)->spool_stop = 1;
+		pthread_cond_broadcast(&((*config)->spool_cond));
+		pthread_mutex_unlock(&((*config)->spool_mutex));
+		pthread_join((*config)->spool_thread, NULL);
+	}
+
 	/* close all storage plugins */
 	rbuffer_write ((*config)->store_queue, NULL, (*config)->plugins_count);
 	for (i = 0; i < (*config)->plugins_count; ++i) {
@@ -328,6 +471,11 @@ struct data_manager_config *data_manager_create(uint32_t observation_domain_id,
 		MSG_WARNING(msg_module, "[%u] No storage plugin for the Data Manager initiated", config->observation_domain_id);
 		goto err;
 	}
+
+	/* spool messages when storage plugins do not keep up */
+	if (spool_dir) {
+		data_manager_spool_init(config);
+	}
 	
 	return (config);
 	
@@ -48,6 +48,7 @@
 #include "config.h"
 #include "queues.h"
 #include "preprocessor.h"
+#include "spool.h"
 
 /**
  * \brief Data manager configuration
@@ -64,6 +65,12 @@ struct data_manager_config {
 	struct storage *storage_plugins[8]; /**< Storage plugins */
 	struct data_manager_config *next;   /**< Next DM */
 	int oid_specific_plugins;           /**< Number of ODID specific plugins */
+	struct spool *spool;                /**< Spool for the input queue (NULL = disabled) */
+	pthread_t spool_thread;             /**< Thread replaying the spool */
+	pthread_mutex_t spool_mutex;        /**< Lock of the spool */
+	pthread_cond_t spool_cond;          /**< Spool changed (data appended or read) */
+	int spool_replaying;                /**< Message read from the spool is being written */
+	int spool_stop;                     /**< Stop replaying */
 };
 
 /**
@@ -83,6 +90,19 @@ struct data_manager_config* data_manager_create(uint32_t observation_domain_id,
  */
 void data_manager_close (struct data_manager_config **config);
 
+/**
+ * \brief Pass message to storage plugins
+ *
+ * When the input queue of storage plugins is full and the spool is enabled,
+ * the message is appended to the spool and it is passed to the plugins
+ * later. Order of messages is preserved.
+ *
+ * @param[in] config Data Manager's config
+ * @param[in] msg IPFIX message
+ * @return 0 on success, nonzero else
+ */
+int data_manager_write(struct data_manager_config *config, struct ipfix_message *msg);
+
 /**
  * \brief Add new storage plugin
  * 
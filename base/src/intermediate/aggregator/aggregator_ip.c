@@ -0,0 +1,1223 @@
+/**
+ * \file aggregator_ip.c
+ * \brief Intermediate Process aggregating and sampling flow records
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+/**
+ * \defgroup aggregatorInter Aggregator Intermediate Process
+ * \ingroup intermediatePlugins
+ *
+ * This plugin aggregates data records by a configurable flow key. Counters are
+ * summed, flow start and end timestamps are kept as minimum and maximum.
+ * Aggregated records are emitted with a generated template when the active or
+ * inactive timeout expires (or at the end of a fixed time window). Optionally,
+ * records are sampled deterministically by a hash of their flow key.
+ *
+ * Records whose template does not contain all key fields are passed unchanged.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <endian.h>
+
+#include <ipfixcol.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+/* API version constant */
+IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
+/* module name for MSG_* */
+static const char *msg_module = "aggregator";
+
+/** Maximal number of key and counter fields */
+#define AGGR_MAX_FIELDS     32
+/** Number of shards of the flow table */
+#define AGGR_SHARDS         16
+/** Initial number of slots in one shard */
+#define AGGR_SHARD_INIT     1024
+/** Number of slots checked for expiration per processed message */
+#define AGGR_EXPIRE_BUDGET  4096
+/** Default Template ID of aggregated records */
+#define AGGR_TEMPLATE_ID    65280
+
+/* Fields added to aggregated records */
+#define AGGR_FLOWS_FIELD     3   /* deltaFlowCount */
+#define AGGR_SAMPLING_FIELD  34  /* samplingInterval */
+#define AGGR_START_SEC       150 /* flowStartSeconds */
+#define AGGR_END_SEC         151 /* flowEndSeconds */
+#define AGGR_START_MSEC      152 /* flowStartMilliseconds */
+#define AGGR_END_MSEC        153 /* flowEndMilliseconds */
+
+/* Field of the flow key or a counter */
+struct aggr_field {
+	uint16_t id;             /* Field ID */
+	uint32_t en;             /* Enterprise number */
+	uint16_t length;         /* Length in aggregated record */
+	bool integer;            /* Unsigned integer (reduced size encoding allowed) */
+};
+
+/* Location of a field in data records of one template */
+struct aggr_loc {
+	int offset;              /* Offset in the record (-1 = missing) */
+	uint16_t length;         /* Length in the record */
+};
+
+/* Processing plan for data records of one template */
+struct aggr_plan {
+	struct ipfix_template *templ;
+	bool variable;           /* Template has variable-length fields */
+	struct aggr_loc keys[AGGR_MAX_FIELDS];
+	struct aggr_loc counters[AGGR_MAX_FIELDS];
+	struct aggr_loc start, end;
+	int time_mult;           /* 1000 for seconds, 1 for milliseconds */
+};
+
+/*
+ * Flow table entry. Entries are stored inline in shards; values are followed
+ * by the flow key in network byte order.
+ */
+struct aggr_entry {
+	uint64_t hash;           /* Hash of the key (0 = empty slot) */
+	uint32_t odid;           /* Observation Domain ID */
+	uint32_t reserved;
+	time_t first;            /* Time of the first record */
+	time_t last;             /* Time of the last record */
+	uint64_t values[];       /* Counters, flows, start, end, key */
+};
+
+/* Shard of the flow table (open addressing, linear probing) */
+struct aggr_shard {
+	uint8_t *slots;          /* Entries */
+	uint32_t mask;           /* Number of slots - 1 */
+	uint32_t count;          /* Number of used slots */
+};
+
+/* Message with aggregated records being built for one ODID */
+struct aggr_output {
+	uint32_t odid;                  /* Observation Domain ID */
+	struct input_info *input_info;  /* Input info of generated messages */
+	uint8_t *buffer;                /* Message being built */
+	uint16_t offset;                /* Used part of the buffer */
+	uint16_t records;               /* Number of records in the buffer */
+	struct aggr_output *next;
+};
+
+/* plugin's configuration structure */
+struct aggregator_ip_config {
+	void *ip_config;                /* internal process configuration */
+	struct aggr_field keys[AGGR_MAX_FIELDS];
+	struct aggr_field counters[AGGR_MAX_FIELDS];
+	int key_count;
+	int counter_count;
+	uint16_t key_length;            /* Length of the flow key */
+	uint16_t rec_length;            /* Length of aggregated record */
+	size_t stride;                  /* Size of one flow table entry */
+
+	uint32_t active;                /* Active timeout */
+	uint32_t inactive;              /* Inactive timeout */
+	uint32_t window;                /* Fixed window (0 = timeouts) */
+	uint32_t sampling;              /* Sampling interval (1 = no sampling) */
+	uint32_t shard_limit;           /* Maximal number of flows in one shard */
+
+	uint16_t template_id;           /* Template ID of aggregated records */
+	uint8_t *tmpl_set;              /* Template Set of aggregated records */
+	uint16_t tmpl_set_length;
+	struct ipfix_template *templ;   /* Template of aggregated records */
+
+	struct aggr_shard shards[AGGR_SHARDS];
+	struct aggr_output *outputs;    /* Messages being built */
+	struct aggr_entry *scratch;     /* Entry for building keys */
+
+	time_t now;                     /* Time of processed message */
+	time_t round;                   /* Start of the last expiration round */
+	bool scanning;                  /* Expiration round in progress */
+	int scan_shard;                 /* Position of the expiration round */
+	uint32_t scan_slot;
+	uint64_t sampled_out;           /* Number of records not selected */
+};
+
+/* struct for data records processing */
+struct aggr_processor {
+	struct aggregator_ip_config *conf;
+	struct aggr_plan *plan;
+	uint32_t odid;
+};
+
+/**
+ * \brief Get entry in shard
+ */
+static inline struct aggr_entry *aggr_slot(struct aggregator_ip_config *conf,
+	struct aggr_shard *shard, uint32_t idx)
+{
+	return (struct aggr_entry *) (shard->slots + (size_t) idx * conf->stride);
+}
+
+/**
+ * \brief Get flow key of entry
+ */
+static inline uint8_t *aggr_key(struct aggregator_ip_config *conf, struct aggr_entry *entry)
+{
+	return (uint8_t *) &entry->values[conf->counter_count + 3];
+}
+
+/**
+ * \brief Mix bits of hash (used for sampling decision)
+ */
+static inline uint64_t aggr_mix(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/**
+ * \brief Parse element name from configuration
+ *
+ * \param[in] name Element name
+ * \param[out] field Field description
+ * \return 0 on success
+ */
+static int aggr_parse_field(const char *name, struct aggr_field *field)
+{
+	ipfix_element_result_t res = get_element_by_name(name, false);
+
+	if (res.count != 1) {
+		MSG_ERROR(msg_module, "Unknown or ambiguous element '%s'", name);
+		return 1;
+	}
+
+	field->id = res.result->id;
+	field->en = res.result->en;
+	field->integer = false;
+
+	switch (res.result->type) {
+	case ET_UNSIGNED_8:
+		field->integer = true;
+		/* fall through */
+	case ET_SIGNED_8:
+	case ET_BOOLEAN:
+		field->length = 1;
+		break;
+	case ET_UNSIGNED_16:
+		field->integer = true;
+		/* fall through */
+	case ET_SIGNED_16:
+		field->length = 2;
+		break;
+	case ET_UNSIGNED_32:
+		field->integer = true;
+		/* fall through */
+	case ET_SIGNED_32:
+	case ET_FLOAT_32:
+	case ET_IPV4_ADDRESS:
+	case ET_DATE_TIME_SECONDS:
+		field->length = 4;
+		break;
+	case ET_UNSIGNED_64:
+		field->integer = true;
+		/* fall through */
+	case ET_SIGNED_64:
+	case ET_FLOAT_64:
+	case ET_DATE_TIME_MILLISECONDS:
+	case ET_DATE_TIME_MICROSECONDS:
+	case ET_DATE_TIME_NANOSECONDS:
+		field->length = 8;
+		break;
+	case ET_MAC_ADDRESS:
+		field->length = 6;
+		break;
+	case ET_IPV6_ADDRESS:
+		field->length = 16;
+		break;
+	default:
+		MSG_ERROR(msg_module, "Element '%s' does not have fixed length", name);
+		return 1;
+	}
+
+	if (field->id == AGGR_FLOWS_FIELD || field->id == AGGR_SAMPLING_FIELD
+			|| (field->id >= AGGR_START_SEC && field->id <= AGGR_END_MSEC)) {
+		if (field->en == 0) {
+			MSG_ERROR(msg_module, "Element '%s' is added to aggregated records automatically", name);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Add field into template record
+ */
+static uint8_t *aggr_template_field(uint8_t *ptr, uint16_t id, uint32_t en, uint16_t length)
+{
+	uint16_t val;
+
+	val = htons(en ? (id | 0x8000) : id);
+	memcpy(ptr, &val, 2);
+	val = htons(length);
+	memcpy(ptr + 2, &val, 2);
+	ptr += 4;
+
+	if (en) {
+		uint32_t en_n = htonl(en);
+		memcpy(ptr, &en_n, 4);
+		ptr += 4;
+	}
+
+	return ptr;
+}
+
+/**
+ * \brief Create template of aggregated records
+ *
+ * \param[in,out] conf Plugin configuration
+ * \return 0 on success
+ */
+static int aggr_create_template(struct aggregator_ip_config *conf)
+{
+	uint16_t count = conf->key_count + conf->counter_count + 3 + (conf->sampling > 1);
+	uint8_t *ptr;
+	int i;
+
+	/* Set header + template record header + fields with enterprise numbers */
+	conf->tmpl_set = calloc(1, 8 + count * 8);
+	if (!conf->tmpl_set) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	ptr = conf->tmpl_set + 8;
+	conf->rec_length = 0;
+
+	for (i = 0; i < conf->key_count; ++i) {
+		ptr = aggr_template_field(ptr, conf->keys[i].id, conf->keys[i].en, conf->keys[i].length);
+		conf->rec_length += conf->keys[i].length;
+	}
+
+	for (i = 0; i < conf->counter_count; ++i) {
+		ptr = aggr_template_field(ptr, conf->counters[i].id, conf->counters[i].en, 8);
+		conf->rec_length += 8;
+	}
+
+	ptr = aggr_template_field(ptr, AGGR_FLOWS_FIELD, 0, 8);
+	ptr = aggr_template_field(ptr, AGGR_START_MSEC, 0, 8);
+	ptr = aggr_template_field(ptr, AGGR_END_MSEC, 0, 8);
+	conf->rec_length += 24;
+
+	if (conf->sampling > 1) {
+		ptr = aggr_template_field(ptr, AGGR_SAMPLING_FIELD, 0, 4);
+		conf->rec_length += 4;
+	}
+
+	conf->tmpl_set_length = ptr - conf->tmpl_set;
+
+	struct ipfix_template_set *set = (struct ipfix_template_set *) conf->tmpl_set;
+	set->header.flowset_id = htons(IPFIX_TEMPLATE_FLOWSET_ID);
+	set->header.length = htons(conf->tmpl_set_length);
+	set->first_record.template_id = htons(conf->template_id);
+	set->first_record.count = htons(count);
+
+	conf->templ = tm_create_template(&set->first_record, conf->tmpl_set_length - 4, TM_TEMPLATE, 0);
+	if (!conf->templ) {
+		MSG_ERROR(msg_module, "Unable to create template of aggregated records");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Initialize flow table
+ *
+ * \param[in,out] conf Plugin configuration
+ * \return 0 on success
+ */
+static int aggr_init_table(struct aggregator_ip_config *conf)
+{
+	int i;
+
+	conf->stride = sizeof(struct aggr_entry) + (conf->counter_count + 3) * 8 + conf->key_length;
+	conf->stride = (conf->stride + 7) & ~((size_t) 7);
+
+	conf->scratch = calloc(1, conf->stride);
+	if (!conf->scratch) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	for (i = 0; i < AGGR_SHARDS; ++i) {
+		conf->shards[i].slots = calloc(AGGR_SHARD_INIT, conf->stride);
+		if (!conf->shards[i].slots) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+		conf->shards[i].mask = AGGR_SHARD_INIT - 1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Parse plugin configuration
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] params XML configuration
+ * \return 0 on success
+ */
+static int aggr_parse_config(struct aggregator_ip_config *conf, char *params)
+{
+	xmlDoc *doc = NULL;
+	xmlNode *root = NULL, *curr = NULL;
+	uint32_t max_flows = 0;
+	int ret = 0;
+
+	doc = xmlParseDoc(BAD_CAST params);
+	if (!doc) {
+		MSG_ERROR(msg_module, "Cannot parse config xml!");
+		return 1;
+	}
+
+	root = xmlDocGetRootElement(doc);
+	if (!root) {
+		MSG_ERROR(msg_module, "Cannot get document root element!");
+		xmlFreeDoc(doc);
+		return 1;
+	}
+
+	for (curr = root->children; curr != NULL && ret == 0; curr = curr->next) {
+		if (curr->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		char *value = (char *) xmlNodeGetContent(curr);
+		if (!value) {
+			continue;
+		}
+
+		if (!xmlStrcmp(curr->name, (const xmlChar *) "key")) {
+			if (conf->key_count == AGGR_MAX_FIELDS) {
+				MSG_ERROR(msg_module, "Too many key fields");
+				ret = 1;
+			} else {
+				ret = aggr_parse_field(value, &conf->keys[conf->key_count]);
+				conf->key_length += conf->keys[conf->key_count++].length;
+			}
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "counter")) {
+			if (conf->counter_count == AGGR_MAX_FIELDS) {
+				MSG_ERROR(msg_module, "Too many counter fields");
+				ret = 1;
+			} else {
+				ret = aggr_parse_field(value, &conf->counters[conf->counter_count]);
+				if (ret == 0 && !conf->counters[conf->counter_count].integer) {
+					MSG_ERROR(msg_module, "Counter '%s' is not an unsigned integer", value);
+					ret = 1;
+				}
+				conf->counter_count++;
+			}
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "activeTimeout")) {
+			conf->active = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "inactiveTimeout")) {
+			conf->inactive = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "window")) {
+			conf->window = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "samplingInterval")) {
+			conf->sampling = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "maxFlows")) {
+			max_flows = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "templateId")) {
+			conf->template_id = strtoul(value, NULL, 10);
+		}
+
+		xmlFree(value);
+	}
+
+	xmlFreeDoc(doc);
+
+	if (ret) {
+		return ret;
+	}
+
+	if (conf->key_count == 0) {
+		MSG_ERROR(msg_module, "No flow key configured");
+		return 1;
+	}
+
+	if (conf->counter_count == 0) {
+		/* octetDeltaCount and packetDeltaCount */
+		conf->counters[0] = (struct aggr_field) {1, 0, 8, true};
+		conf->counters[1] = (struct aggr_field) {2, 0, 8, true};
+		conf->counter_count = 2;
+	}
+
+	if (conf->template_id < 256) {
+		MSG_ERROR(msg_module, "Invalid template ID %u", conf->template_id);
+		return 1;
+	}
+
+	if (conf->sampling == 0) {
+		conf->sampling = 1;
+	}
+
+	if (max_flows) {
+		conf->shard_limit = max_flows / AGGR_SHARDS + 1;
+	}
+
+	if (conf->window) {
+		MSG_INFO(msg_module, "Aggregating records in windows of %u seconds", conf->window);
+	} else {
+		MSG_INFO(msg_module, "Aggregating records with active timeout %u s, inactive timeout %u s",
+			conf->active, conf->inactive);
+	}
+
+	if (conf->sampling > 1) {
+		MSG_INFO(msg_module, "Sampling flows with interval %u", conf->sampling);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Initialize aggregator plugin
+ *
+ * \param[in] params Plugin parameters
+ * \param[in] ip_config Internal process configuration
+ * \param[in] ip_id Source ID into Template Manager
+ * \param[in] template_mgr Template Manager
+ * \param[out] config Plugin configuration
+ * \return 0 if everything OK
+ */
+int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfix_template_mgr *template_mgr, void **config)
+{
+	(void) ip_id;
+	(void) template_mgr;
+	struct aggregator_ip_config *conf;
+
+	if (!params) {
+		MSG_ERROR(msg_module, "Missing plugin configuration!");
+		return -1;
+	}
+
+	conf = (struct aggregator_ip_config *) calloc(1, sizeof(*conf));
+	if (!conf) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	conf->ip_config = ip_config;
+	conf->active = 300;
+	conf->inactive = 30;
+	conf->template_id = AGGR_TEMPLATE_ID;
+
+	if (aggr_parse_config(conf, params) || aggr_create_template(conf) || aggr_init_table(conf)) {
+		intermediate_close(conf);
+		return -1;
+	}
+
+	conf->round = time(NULL);
+	*config = conf;
+	MSG_INFO(msg_module, "Plugin initialization completed successfully");
+	return 0;
+}
+
+/**
+ * \brief Locate field in template
+ *
+ * \param[in] templ Template
+ * \param[in] en Enterprise number
+ * \param[in] id Field ID
+ * \param[out] loc Location of the field
+ * \return true if field is present and has fixed length
+ */
+static bool aggr_locate(struct ipfix_template *templ, uint32_t en, uint16_t id, struct aggr_loc *loc)
+{
+	struct ipfix_template_row *row;
+	int offset;
+
+	loc->offset = -1;
+	row = template_get_field(templ, en, id, &offset);
+	if (!row || row->length == VAR_IE_LENGTH) {
+		return false;
+	}
+
+	loc->offset = offset;
+	loc->length = row->length;
+	return true;
+}
+
+/**
+ * \brief Prepare processing of records of given template
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] templ Template
+ * \param[out] plan Processing plan
+ * \return 0 if records can be aggregated
+ */
+static int aggr_make_plan(struct aggregator_ip_config *conf, struct ipfix_template *templ, struct aggr_plan *plan)
+{
+	int i;
+
+	plan->templ = templ;
+	plan->variable = (templ->data_length & 0x80000000);
+
+	for (i = 0; i < conf->key_count; ++i) {
+		struct aggr_field *key = &conf->keys[i];
+
+		if (!aggr_locate(templ, key->en, key->id, &plan->keys[i])) {
+			return 1;
+		}
+
+		if (plan->keys[i].length != key->length
+				&& (!key->integer || plan->keys[i].length > key->length)) {
+			return 1;
+		}
+	}
+
+	for (i = 0; i < conf->counter_count; ++i) {
+		if (aggr_locate(templ, conf->counters[i].en, conf->counters[i].id, &plan->counters[i])
+				&& plan->counters[i].length > 8) {
+			plan->counters[i].offset = -1;
+		}
+	}
+
+	plan->time_mult = 1;
+	if (!aggr_locate(templ, 0, AGGR_START_MSEC, &plan->start) || plan->start.length != 8
+			|| !aggr_locate(templ, 0, AGGR_END_MSEC, &plan->end) || plan->end.length != 8) {
+		plan->time_mult = 1000;
+		if (!aggr_locate(templ, 0, AGGR_START_SEC, &plan->start) || plan->start.length != 4
+				|| !aggr_locate(templ, 0, AGGR_END_SEC, &plan->end) || plan->end.length != 4) {
+			plan->start.offset = -1;
+			plan->end.offset = -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Get offset of field in data record
+ */
+static inline int aggr_offset(struct aggr_plan *plan, struct aggr_field *field,
+	struct aggr_loc *loc, uint8_t *rec)
+{
+	if (loc->offset < 0 || !plan->variable) {
+		return loc->offset;
+	}
+
+	/* Offsets differ record to record */
+	return data_record_field_offset(rec, plan->templ, field->en, field->id, NULL);
+}
+
+/**
+ * \brief Find output for ODID, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] odid ODID
+ * \param[in] input_info Input info used as a base for generated messages
+ * \return Output or NULL
+ */
+static struct aggr_output *aggr_get_output(struct aggregator_ip_config *conf,
+	uint32_t odid, struct input_info *input_info)
+{
+	struct aggr_output *out;
+	size_t size;
+
+	for (out = conf->outputs; out; out = out->next) {
+		if (out->odid == odid) {
+			return out;
+		}
+	}
+
+	if (!input_info) {
+		return NULL;
+	}
+
+	out = calloc(1, sizeof(*out));
+	if (!out) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	size = (input_info->type == SOURCE_TYPE_IPFIX_FILE)
+		? sizeof(struct input_info_file) : sizeof(struct input_info_network);
+	out->input_info = calloc(1, size);
+	if (!out->input_info) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(out);
+		return NULL;
+	}
+
+	memcpy(out->input_info, input_info, size);
+	out->input_info->odid = odid;
+	out->input_info->sequence_number = 0;
+	out->odid = odid;
+	out->next = conf->outputs;
+	conf->outputs = out;
+	return out;
+}
+
+/**
+ * \brief Pass message with aggregated records built for one ODID
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] out Output
+ */
+static void aggr_output_flush(struct aggregator_ip_config *conf, struct aggr_output *out)
+{
+	struct ipfix_message *msg;
+	struct ipfix_data_set *set;
+	uint8_t *rec;
+	uint16_t i;
+
+	if (out->records == 0) {
+		return;
+	}
+
+	msg = calloc(1, sizeof(struct ipfix_message));
+	if (!msg) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return;
+	}
+
+	msg->metadata = calloc(out->records, sizeof(struct metadata));
+	if (!msg->metadata) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(msg);
+		return;
+	}
+
+	msg->pkt_header = (struct ipfix_header *) out->buffer;
+	msg->pkt_header->version = htons(IPFIX_VERSION);
+	msg->pkt_header->length = htons(out->offset);
+	msg->pkt_header->export_time = htonl(conf->now);
+	msg->pkt_header->sequence_number = htonl(out->input_info->sequence_number);
+	msg->pkt_header->observation_domain_id = htonl(out->odid);
+
+	msg->templ_set[0] = (struct ipfix_template_set *) (out->buffer + IPFIX_HEADER_LENGTH);
+	set = (struct ipfix_data_set *) (out->buffer + IPFIX_HEADER_LENGTH + conf->tmpl_set_length);
+	set->header.flowset_id = htons(conf->template_id);
+	set->header.length = htons(out->offset - IPFIX_HEADER_LENGTH - conf->tmpl_set_length);
+	msg->data_couple[0].data_set = set;
+	msg->data_couple[0].data_template = conf->templ;
+	tm_template_reference_inc(conf->templ);
+
+	rec = set->records;
+	for (i = 0; i < out->records; ++i, rec += conf->rec_length) {
+		msg->metadata[i].record.record = rec;
+		msg->metadata[i].record.length = conf->rec_length;
+		msg->metadata[i].record.templ = conf->templ;
+	}
+
+	msg->input_info = out->input_info;
+	msg->source_status = SOURCE_STATUS_OPENED;
+	msg->data_records_count = out->records;
+	msg->templ_records_count = 1;
+
+	out->input_info->sequence_number += out->records;
+	out->buffer = NULL;
+	out->offset = 0;
+	out->records = 0;
+
+	pass_message(conf->ip_config, msg);
+}
+
+/**
+ * \brief Emit aggregated record
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] entry Flow table entry
+ */
+static void aggr_emit(struct aggregator_ip_config *conf, struct aggr_entry *entry)
+{
+	struct aggr_output *out = aggr_get_output(conf, entry->odid, NULL);
+	uint64_t value;
+	uint8_t *ptr;
+	int i;
+
+	if (!out) {
+		return;
+	}
+
+	if (out->buffer && out->offset + conf->rec_length > MSG_MAX_LENGTH) {
+		aggr_output_flush(conf, out);
+	}
+
+	if (!out->buffer) {
+		out->buffer = malloc(MSG_MAX_LENGTH);
+		if (!out->buffer) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return;
+		}
+
+		memcpy(out->buffer + IPFIX_HEADER_LENGTH, conf->tmpl_set, conf->tmpl_set_length);
+		out->offset = IPFIX_HEADER_LENGTH + conf->tmpl_set_length + 4;
+	}
+
+	ptr = out->buffer + out->offset;
+	memcpy(ptr, aggr_key(conf, entry), conf->key_length);
+	ptr += conf->key_length;
+
+	/* Counters, flows, start and end */
+	for (i = 0; i < conf->counter_count + 3; ++i, ptr += 8) {
+		value = htobe64(entry->values[i]);
+		memcpy(ptr, &value, 8);
+	}
+
+	if (conf->sampling > 1) {
+		uint32_t interval = htonl(conf->sampling);
+		memcpy(ptr, &interval, 4);
+	}
+
+	out->offset += conf->rec_length;
+	out->records++;
+}
+
+/**
+ * \brief Check whether entry should be emitted
+ */
+static inline bool aggr_expired(struct aggregator_ip_config *conf, struct aggr_entry *entry)
+{
+	if (conf->window) {
+		return entry->first / conf->window != conf->now / conf->window;
+	}
+
+	return (conf->now - entry->last >= (time_t) conf->inactive)
+		|| (conf->now - entry->first >= (time_t) conf->active);
+}
+
+/**
+ * \brief Reset entry values
+ */
+static inline void aggr_reset(struct aggregator_ip_config *conf, struct aggr_entry *entry)
+{
+	memset(entry->values, 0, (conf->counter_count + 3) * 8);
+	entry->values[conf->counter_count + 1] = UINT64_MAX;
+	entry->first = conf->now;
+}
+
+/**
+ * \brief Remove entry from shard (backward shift deletion)
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] shard Shard
+ * \param[in] idx Index of removed entry
+ */
+static void aggr_remove(struct aggregator_ip_config *conf, struct aggr_shard *shard, uint32_t idx)
+{
+	uint32_t i = idx, j = idx, home;
+	struct aggr_entry *entry;
+
+	for (;;) {
+		j = (j + 1) & shard->mask;
+		entry = aggr_slot(conf, shard, j);
+		if (entry->hash == 0) {
+			break;
+		}
+
+		/* Move entry to the hole if the hole lies between its home and j */
+		home = entry->hash & shard->mask;
+		if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+			memcpy(aggr_slot(conf, shard, i), entry, conf->stride);
+			i = j;
+		}
+	}
+
+	aggr_slot(conf, shard, i)->hash = 0;
+	shard->count--;
+}
+
+/**
+ * \brief Double size of shard
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] shard Shard
+ * \return 0 on success
+ */
+static int aggr_grow(struct aggregator_ip_config *conf, struct aggr_shard *shard)
+{
+	uint32_t i, idx, mask = shard->mask * 2 + 1;
+	uint8_t *slots = calloc((size_t) mask + 1, conf->stride);
+
+	if (!slots) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	for (i = 0; i <= shard->mask; ++i) {
+		struct aggr_entry *entry = aggr_slot(conf, shard, i);
+		if (entry->hash == 0) {
+			continue;
+		}
+
+		idx = entry->hash & mask;
+		while (((struct aggr_entry *) (slots + (size_t) idx * conf->stride))->hash) {
+			idx = (idx + 1) & mask;
+		}
+		memcpy(slots + (size_t) idx * conf->stride, entry, conf->stride);
+	}
+
+	free(shard->slots);
+	shard->slots = slots;
+	shard->mask = mask;
+	return 0;
+}
+
+/**
+ * \brief Add data record into flow entry
+ */
+static inline void aggr_update(struct aggregator_ip_config *conf, struct aggr_plan *plan,
+	struct aggr_entry *entry, uint8_t *rec)
+{
+	uint64_t start, end;
+	int i, offset;
+
+	for (i = 0; i < conf->counter_count; ++i) {
+		offset = aggr_offset(plan, &conf->counters[i], &plan->counters[i], rec);
+		if (offset >= 0) {
+			entry->values[i] += data_read_uint(rec + offset, plan->counters[i].length);
+		}
+	}
+
+	if (plan->start.offset >= 0) {
+		int start_off = plan->start.offset, end_off = plan->end.offset;
+
+		if (plan->variable) {
+			uint16_t id = (plan->time_mult == 1) ? AGGR_START_MSEC : AGGR_START_SEC;
+			start_off = data_record_field_offset(rec, plan->templ, 0, id, NULL);
+			end_off = data_record_field_offset(rec, plan->templ, 0, id + 1, NULL);
+		}
+
+		start = data_read_uint(rec + start_off, plan->start.length) * plan->time_mult;
+		end = data_read_uint(rec + end_off, plan->end.length) * plan->time_mult;
+	} else {
+		start = end = (uint64_t) conf->now * 1000;
+	}
+
+	entry->values[conf->counter_count]++;
+	if (start < entry->values[conf->counter_count + 1]) {
+		entry->values[conf->counter_count + 1] = start;
+	}
+	if (end > entry->values[conf->counter_count + 2]) {
+		entry->values[conf->counter_count + 2] = end;
+	}
+
+	entry->last = conf->now;
+}
+
+/**
+ * \brief Process data record
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Record's length
+ * \param[in] templ Template
+ * \param[in] data Processor's data
+ */
+static void aggr_process_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) rec_len;
+	(void) templ;
+	struct aggr_processor *proc = (struct aggr_processor *) data;
+	struct aggregator_ip_config *conf = proc->conf;
+	struct aggr_plan *plan = proc->plan;
+	struct aggr_entry *entry, *scratch = conf->scratch;
+	struct aggr_shard *shard;
+	uint8_t *key = aggr_key(conf, scratch);
+	uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+	uint32_t idx;
+	int i, offset;
+
+	/* Build flow key */
+	memset(key, 0, conf->key_length);
+	for (i = 0; i < conf->key_count; ++i) {
+		offset = aggr_offset(plan, &conf->keys[i], &plan->keys[i], rec);
+		if (offset < 0) {
+			return;
+		}
+
+		/* Reduced size encoding of integers is right aligned */
+		memcpy(key + conf->keys[i].length - plan->keys[i].length, rec + offset, plan->keys[i].length);
+		key += conf->keys[i].length;
+	}
+
+	key = aggr_key(conf, scratch);
+	for (i = 0; i < conf->key_length; ++i) {
+		hash = (hash ^ key[i]) * 1099511628211ULL;
+	}
+	hash = (hash ^ proc->odid) * 1099511628211ULL;
+	hash |= 1;
+
+	/* Deterministic sampling by flow key */
+	if (conf->sampling > 1 && aggr_mix(hash) % conf->sampling != 0) {
+		conf->sampled_out++;
+		return;
+	}
+
+	shard = &conf->shards[hash >> 60];
+	idx = hash & shard->mask;
+	for (;;) {
+		entry = aggr_slot(conf, shard, idx);
+		if (entry->hash == 0) {
+			break;
+		}
+
+		if (entry->hash == hash && entry->odid == proc->odid
+				&& !memcmp(aggr_key(conf, entry), key, conf->key_length)) {
+			if (aggr_expired(conf, entry)) {
+				aggr_emit(conf, entry);
+				aggr_reset(conf, entry);
+			}
+
+			aggr_update(conf, plan, entry, rec);
+			return;
+		}
+
+		idx = (idx + 1) & shard->mask;
+	}
+
+	/* New flow */
+	scratch->hash = hash;
+	scratch->odid = proc->odid;
+	aggr_reset(conf, scratch);
+	aggr_update(conf, plan, scratch, rec);
+
+	if (conf->shard_limit && shard->count >= conf->shard_limit) {
+		/* Table is full, emit record right away */
+		aggr_emit(conf, scratch);
+		return;
+	}
+
+	if ((shard->count + 1) * 2 > shard->mask + 1) {
+		if (aggr_grow(conf, shard)) {
+			aggr_emit(conf, scratch);
+			return;
+		}
+
+		idx = hash & shard->mask;
+		while (aggr_slot(conf, shard, idx)->hash) {
+			idx = (idx + 1) & shard->mask;
+		}
+	}
+
+	memcpy(aggr_slot(conf, shard, idx), scratch, conf->stride);
+	shard->count++;
+}
+
+/**
+ * \brief Emit and remove expired entries
+ *
+ * Expiration is spread over processed messages: a new round over all shards
+ * starts every second and each message checks a limited number of slots.
+ *
+ * \param[in] conf Plugin configuration
+ */
+static void aggr_expire(struct aggregator_ip_config *conf)
+{
+	uint32_t budget = AGGR_EXPIRE_BUDGET;
+
+	if (!conf->scanning) {
+		if (conf->now == conf->round) {
+			return;
+		}
+
+		conf->scanning = true;
+		conf->round = conf->now;
+		conf->scan_shard = 0;
+		conf->scan_slot = 0;
+	}
+
+	while (budget-- > 0) {
+		struct aggr_shard *shard = &conf->shards[conf->scan_shard];
+
+		if (conf->scan_slot > shard->mask) {
+			conf->scan_slot = 0;
+			if (++conf->scan_shard == AGGR_SHARDS) {
+				conf->scanning = false;
+				return;
+			}
+			continue;
+		}
+
+		struct aggr_entry *entry = aggr_slot(conf, shard, conf->scan_slot);
+		if (entry->hash && aggr_expired(conf, entry)) {
+			aggr_emit(conf, entry);
+			/* Another entry may be shifted to this slot */
+			aggr_remove(conf, shard, conf->scan_slot);
+		} else {
+			conf->scan_slot++;
+		}
+	}
+}
+
+/**
+ * \brief Emit and remove all entries of ODID
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] odid ODID
+ */
+static void aggr_expire_odid(struct aggregator_ip_config *conf, uint32_t odid)
+{
+	uint32_t i;
+	int s;
+
+	for (s = 0; s < AGGR_SHARDS; ++s) {
+		struct aggr_shard *shard = &conf->shards[s];
+
+		for (i = 0; i <= shard->mask; ) {
+			struct aggr_entry *entry = aggr_slot(conf, shard, i);
+			if (entry->hash && entry->odid == odid) {
+				aggr_emit(conf, entry);
+				aggr_remove(conf, shard, i);
+			} else {
+				i++;
+			}
+		}
+	}
+}
+
+int intermediate_process_message(void *config, void *message)
+{
+	struct aggregator_ip_config *conf = (struct aggregator_ip_config *) config;
+	struct ipfix_message *msg = (struct ipfix_message *) message;
+	bool removed[MSG_MAX_DATA_COUPLES];
+	struct aggr_processor proc;
+	struct aggr_plan plan;
+	struct aggr_output *out;
+	uint16_t records = 0;
+	int i, sets = 0;
+
+	conf->now = time(NULL);
+	proc.conf = conf;
+	proc.plan = &plan;
+	proc.odid = msg->input_info->odid;
+
+	if (msg->source_status == SOURCE_STATUS_CLOSED) {
+		/* Emit flows of the source before it is closed */
+		aggr_expire_odid(conf, proc.odid);
+		out = aggr_get_output(conf, proc.odid, NULL);
+		if (out) {
+			aggr_output_flush(conf, out);
+		}
+
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		struct ipfix_template *templ = msg->data_couple[i].data_template;
+
+		removed[i] = false;
+		if (!templ || templ->template_type != TM_TEMPLATE || aggr_make_plan(conf, templ, &plan)) {
+			continue;
+		}
+
+		if (!aggr_get_output(conf, proc.odid, msg->input_info)) {
+			continue;
+		}
+
+		records += data_set_process_records(msg->data_couple[i].data_set, templ, &aggr_process_record, &proc);
+		removed[i] = true;
+		sets++;
+	}
+
+	aggr_expire(conf);
+	for (out = conf->outputs; out; out = out->next) {
+		aggr_output_flush(conf, out);
+	}
+
+	if (sets > 0) {
+		message_remove_data_sets(msg, removed, records);
+	}
+
+	if (msg->source_status == SOURCE_STATUS_OPENED && !msg->data_couple[0].data_set
+			&& !msg->templ_set[0] && !msg->opt_templ_set[0]) {
+		/* Everything was aggregated */
+		drop_message(conf->ip_config, message);
+		return 0;
+	}
+
+	pass_message(conf->ip_config, message);
+	return 0;
+}
+
+int intermediate_close(void *config)
+{
+	struct aggregator_ip_config *conf = (struct aggregator_ip_config *) config;
+	struct aggr_output *out;
+	uint64_t flows = 0;
+	int i;
+
+	for (i = 0; i < AGGR_SHARDS; ++i) {
+		flows += conf->shards[i].count;
+		free(conf->shards[i].slots);
+	}
+
+	if (flows > 0) {
+		MSG_WARNING(msg_module, "%" PRIu64 " aggregated flows were not emitted before shutdown", flows);
+	}
+
+	if (conf->sampled_out > 0) {
+		MSG_INFO(msg_module, "%" PRIu64 " records were not selected by sampling", conf->sampled_out);
+	}
+
+	while (conf->outputs) {
+		out = conf->outputs;
+		conf->outputs = out->next;
+		free(out->buffer);
+		free(out->input_info);
+		free(out);
+	}
+
+	free(conf->scratch);
+	free(conf->templ);
+	free(conf->tmpl_set);
+	free(conf);
+
+	return 0;
+}
+
+/**@}*/
@@ -63,6 +63,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 static char *msg_module = "Anon IP";
 
 #define ANONYMIZATION_TYPE_TRUNCATION    1
@@ -0,0 +1,1491 @@
+/**
+ * \file biflow_ip.c
+ * \brief Intermediate Process stitching unidirectional flows into biflows
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+/**
+ * \defgroup biflowInter Biflow Intermediate Process
+ * \ingroup intermediatePlugins
+ *
+ * This plugin stitches two unidirectional flow records of one conversation
+ * into a biflow record as described in RFC 5103. Records are held in a flow
+ * table keyed by the canonical 5-tuple (lower endpoint first) for a limited
+ * time. When a record of the opposite direction arrives meanwhile, both are
+ * emitted as one record: all fields of the forward record (the one that
+ * started first) followed by reverse fields of the other one, i.e. the same
+ * Information Elements with Reverse PEN 29305. Templates of biflow records are
+ * generated for each pair of forward and reverse templates.
+ *
+ * Records that do not find their counterpart are emitted unchanged when they
+ * leave the table (timeout, table full, another record of the same
+ * direction), unless configured otherwise. Records without flow key, Options
+ * Data and biflows are passed unchanged in the original message.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <ipfixcol.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+/* API version constant */
+IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
+/* module name for MSG_* */
+static const char *msg_module = "biflow";
+
+/** Number of shards of the flow table */
+#define BF_SHARDS           16
+/** Length of flow key */
+#define BF_KEY_LENGTH       40
+/** Records up to this length are stored in the flow table entry */
+#define BF_INLINE_LENGTH    96
+/** End of list of entries */
+#define BF_NONE             UINT32_MAX
+/** Enterprise number of reverse Information Elements (RFC 5103) */
+#define BF_REVERSE_EN       29305
+
+/* Default configuration */
+#define BF_TIMEOUT          10     /* seconds */
+#define BF_MAX_FLOWS        65536
+#define BF_TEMPLATE_ID      65024
+#define BF_TEMPLATE_IDS     256    /* Number of Template IDs of biflow records */
+
+/* Fields of the flow key */
+#define BF_PROTOCOL         4   /* protocolIdentifier */
+#define BF_SRC_PORT         7   /* sourceTransportPort */
+#define BF_SRC_IPV4         8   /* sourceIPv4Address */
+#define BF_DST_PORT         11  /* destinationTransportPort */
+#define BF_DST_IPV4         12  /* destinationIPv4Address */
+#define BF_SRC_IPV6         27  /* sourceIPv6Address */
+#define BF_DST_IPV6         28  /* destinationIPv6Address */
+#define BF_START_SEC        150 /* flowStartSeconds */
+#define BF_START_MSEC       152 /* flowStartMilliseconds */
+
+/** Length of fields of template */
+#define BF_FIELDS_LENGTH(templ) \
+	((templ)->template_length - sizeof(struct ipfix_template) + sizeof(template_ie))
+
+/* Location of a field in data records of one template */
+struct bf_loc {
+	int offset;              /* Offset in the record (-1 = missing) */
+	uint16_t length;         /* Length in the record */
+	uint16_t id;             /* Field ID */
+};
+
+/*
+ * Template of records of one ODID. The plugin keeps its own copy, so that
+ * held records and generated messages do not depend on the Template Manager.
+ */
+struct bf_template {
+	struct ipfix_template *templ;   /* Copy of the template */
+	uint8_t *record;                /* Template Record in network byte order */
+	uint16_t record_length;
+	uint32_t odid;                  /* Observation Domain ID */
+	bool stale;                     /* Replaced by a newer template */
+	bool eligible;                  /* Records contain the flow key */
+	bool variable;                  /* Template has variable-length fields */
+	uint32_t holders;               /* Held records and biflow templates */
+	struct bf_loc src, dst, sport, dport, proto, start;
+	int time_mult;                  /* 1000 for seconds, 1 for milliseconds */
+	uint8_t *reverse;               /* Flags of fields used as reverse fields */
+	uint16_t reverse_count;         /* Number of reverse fields */
+	struct bf_template *next;
+};
+
+/* Template of biflow records of one pair of forward and reverse templates */
+struct bf_pair {
+	struct bf_template *fwd;        /* Template of forward records */
+	struct bf_template *rev;        /* Template of reverse records */
+	struct ipfix_template *templ;   /* Template of biflow records */
+	uint8_t *record;                /* Template Record in network byte order */
+	uint16_t record_length;
+	struct bf_pair *next;
+};
+
+/* Record held in the flow table */
+struct bf_entry {
+	uint64_t hash;           /* Hash of the key and ODID */
+	uint32_t odid;           /* Observation Domain ID */
+	uint32_t prev, next;     /* Order of arrival in shard (free list for unused) */
+	time_t arrival;          /* Time of arrival */
+	uint64_t start;          /* Flow start in milliseconds */
+	struct bf_template *tmpl;
+	uint8_t *record;         /* Copy of the record (data or allocated) */
+	uint16_t length;         /* Length of the record */
+	bool forward;            /* Source endpoint is the first one in the key */
+	uint8_t key[BF_KEY_LENGTH];
+	uint8_t data[BF_INLINE_LENGTH];
+};
+
+/*
+ * Shard of the flow table. Entries are preallocated; the index (open
+ * addressing, linear probing) refers to them by position + 1.
+ */
+struct bf_shard {
+	struct bf_entry *entries;
+	uint32_t *index;
+	uint32_t mask;           /* Size of the index - 1 */
+	uint32_t capacity;       /* Number of entries */
+	uint32_t count;          /* Number of used entries */
+	uint32_t free;           /* First unused entry */
+	uint32_t head, tail;     /* Oldest and newest entry */
+};
+
+/* Message being built for one ODID */
+struct bf_output {
+	uint32_t odid;                  /* Observation Domain ID */
+	struct input_info *input_info;  /* Input info of generated messages */
+	struct ipfix_message *msg;      /* Message being built (NULL = none) */
+	uint16_t offset;                /* Used part of the message */
+	uint16_t records;               /* Number of data records */
+	uint16_t couples;               /* Number of data sets */
+	uint16_t templ_sets;            /* Number of template sets */
+	struct bf_output *next;
+};
+
+/* plugin's configuration structure */
+struct biflow_ip_config {
+	void *ip_config;                /* internal process configuration */
+	uint32_t timeout;               /* Maximal time to wait for counterpart */
+	uint32_t max_flows;             /* Maximal number of held records */
+	bool emit;                      /* Emit records leaving table unpaired */
+	uint16_t template_id;           /* First Template ID of biflow records */
+	uint32_t stat_interval;         /* Interval of statistics messages */
+
+	struct bf_shard shards[BF_SHARDS];
+	struct bf_template *templates;
+	struct bf_pair *pairs;
+	struct bf_output *outputs;
+
+	time_t now;                     /* Time of processed message */
+	time_t collected;               /* Time of the last release of templates */
+	time_t reported;                /* Time of the last statistics message */
+
+	uint64_t stitched;              /* Number of emitted biflow records */
+	uint64_t unpaired;              /* Number of emitted unpaired records */
+	uint64_t evicted;               /* Number of records evicted from full table */
+	uint64_t dropped;               /* Number of unpaired records not emitted */
+};
+
+/* struct for data records processing */
+struct bf_processor {
+	struct biflow_ip_config *conf;
+	struct bf_template *tmpl;
+	struct bf_output *out;
+	uint32_t odid;
+};
+
+/**
+ * \brief Hash of flow key and ODID
+ */
+static inline uint64_t bf_hash(const uint8_t *key, uint32_t odid)
+{
+	uint64_t hash = (odid + 1) * 0x9e3779b97f4a7c15ULL, word;
+	int i;
+
+	for (i = 0; i < BF_KEY_LENGTH; i += 8) {
+		memcpy(&word, key + i, 8);
+		hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 32;
+	}
+
+	return hash | 1;
+}
+
+/**
+ * \brief Check whether IANA Information Element has a reverse counterpart
+ *
+ * Flow key fields are shared by both directions. Identifiers, process
+ * configuration and statistics are not reversible (RFC 5103, section 6.1).
+ */
+static bool bf_reversible(uint16_t id)
+{
+	switch (id) {
+	case BF_PROTOCOL: case BF_SRC_PORT: case BF_SRC_IPV4: case BF_DST_PORT:
+	case BF_DST_IPV4: case BF_SRC_IPV6: case BF_DST_IPV6:
+	/* Identifiers */
+	case 10: case 14: case 137: case 138: case 141: case 142: case 143:
+	case 144: case 145: case 148: case 149:
+	/* Process configuration */
+	case 130: case 131: case 173: case 211: case 212: case 213: case 214:
+	case 215: case 216: case 217:
+	/* Process statistics */
+	case 40: case 41: case 42: case 163: case 164: case 165: case 166:
+	case 167: case 168:
+	/* paddingOctets, biflowDirection */
+	case 210: case 239:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/**
+ * \brief Parse plugin configuration
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] params XML configuration
+ * \return 0 on success
+ */
+static int bf_parse_config(struct biflow_ip_config *conf, char *params)
+{
+	xmlDoc *doc = NULL;
+	xmlNode *root = NULL, *curr = NULL;
+	uint32_t template_id = BF_TEMPLATE_ID;
+	int ret = 0;
+
+	doc = xmlParseDoc(BAD_CAST params);
+	if (!doc) {
+		MSG_ERROR(msg_module, "Cannot parse config xml!");
+		return 1;
+	}
+
+	root = xmlDocGetRootElement(doc);
+	if (!root) {
+		MSG_ERROR(msg_module, "Cannot get document root element!");
+		xmlFreeDoc(doc);
+		return 1;
+	}
+
+	for (curr = root->children; curr != NULL && ret == 0; curr = curr->next) {
+		if (curr->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		char *value = (char *) xmlNodeGetContent(curr);
+		if (!value) {
+			continue;
+		}
+
+		if (!xmlStrcmp(curr->name, (const xmlChar *) "timeout")) {
+			conf->timeout = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "maxFlows")) {
+			conf->max_flows = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "emitOnEviction")) {
+			if (!strcasecmp(value, "yes") || !strcasecmp(value, "true") || !strcmp(value, "1")) {
+				conf->emit = true;
+			} else if (!strcasecmp(value, "no") || !strcasecmp(value, "false") || !strcmp(value, "0")) {
+				conf->emit = false;
+			} else {
+				MSG_ERROR(msg_module, "Invalid value of emitOnEviction: '%s'", value);
+				ret = 1;
+			}
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "templateId")) {
+			template_id = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "statisticsInterval")) {
+			conf->stat_interval = strtoul(value, NULL, 10);
+		}
+
+		xmlFree(value);
+	}
+
+	xmlFreeDoc(doc);
+
+	if (ret) {
+		return ret;
+	}
+
+	if (template_id < 256 || template_id > 65535 - BF_TEMPLATE_IDS + 1) {
+		MSG_ERROR(msg_module, "Invalid template ID %u", template_id);
+		return 1;
+	}
+	conf->template_id = template_id;
+
+	if (conf->max_flows < BF_SHARDS) {
+		conf->max_flows = BF_SHARDS;
+	}
+
+	MSG_INFO(msg_module, "Stitching biflows with timeout %u s, at most %u held records",
+		conf->timeout, conf->max_flows);
+	return 0;
+}
+
+/**
+ * \brief Initialize flow table
+ *
+ * \param[in,out] conf Plugin configuration
+ * \return 0 on success
+ */
+static int bf_init_table(struct biflow_ip_config *conf)
+{
+	uint32_t capacity = (conf->max_flows + BF_SHARDS - 1) / BF_SHARDS, size = 2;
+	uint32_t i;
+	int s;
+
+	while (size < capacity * 2) {
+		size *= 2;
+	}
+
+	for (s = 0; s < BF_SHARDS; ++s) {
+		struct bf_shard *shard = &conf->shards[s];
+
+		shard->entries = calloc(capacity, sizeof(struct bf_entry));
+		shard->index = calloc(size, sizeof(uint32_t));
+		if (!shard->entries || !shard->index) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		for (i = 0; i < capacity; ++i) {
+			shard->entries[i].next = (i + 1 < capacity) ? i + 1 : BF_NONE;
+		}
+
+		shard->mask = size - 1;
+		shard->capacity = capacity;
+		shard->free = 0;
+		shard->head = shard->tail = BF_NONE;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Initialize biflow plugin
+ *
+ * \param[in] params Plugin parameters
+ * \param[in] ip_config Internal process configuration
+ * \param[in] ip_id Source ID into Template Manager
+ * \param[in] template_mgr Template Manager
+ * \param[out] config Plugin configuration
+ * \return 0 if everything OK
+ */
+int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfix_template_mgr *template_mgr, void **config)
+{
+	(void) ip_id;
+	(void) template_mgr;
+	struct biflow_ip_config *conf;
+
+	conf = (struct biflow_ip_config *) calloc(1, sizeof(*conf));
+	if (!conf) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	conf->ip_config = ip_config;
+	conf->timeout = BF_TIMEOUT;
+	conf->max_flows = BF_MAX_FLOWS;
+	conf->emit = true;
+
+	if ((params && bf_parse_config(conf, params)) || bf_init_table(conf)) {
+		intermediate_close(conf);
+		return -1;
+	}
+
+	conf->collected = conf->reported = time(NULL);
+	*config = conf;
+	MSG_INFO(msg_module, "Plugin initialization completed successfully");
+	return 0;
+}
+
+/**
+ * \brief Locate field in template
+ *
+ * \param[in] templ Template
+ * \param[in] id Field ID
+ * \param[in] max Maximal length of the field
+ * \param[out] loc Location of the field
+ * \return true if field is present and has fixed length
+ */
+static bool bf_locate(struct ipfix_template *templ, uint16_t id, uint16_t max, struct bf_loc *loc)
+{
+	struct ipfix_template_row *row;
+	int offset;
+
+	loc->offset = -1;
+	loc->id = id;
+	row = template_get_field(templ, 0, id, &offset);
+	if (!row || row->length == VAR_IE_LENGTH || row->length == 0 || row->length > max) {
+		return false;
+	}
+
+	loc->offset = offset;
+	loc->length = row->length;
+	return true;
+}
+
+/**
+ * \brief Prepare processing of records of template
+ *
+ * Finds flow key fields and fields that can be used as reverse fields.
+ *
+ * \param[in,out] tmpl Template
+ * \return 0 on success
+ */
+static int bf_make_plan(struct bf_template *tmpl)
+{
+	struct ipfix_template *templ = tmpl->templ;
+	uint16_t i, f;
+
+	tmpl->reverse = calloc(templ->field_count ? templ->field_count : 1, 1);
+	if (!tmpl->reverse) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	tmpl->variable = (templ->data_length & 0x80000000);
+	tmpl->eligible = (templ->template_type == TM_TEMPLATE);
+
+	for (i = 0, f = 0; i < templ->field_count; ++i, ++f) {
+		uint16_t id = templ->fields[f].ie.id;
+
+		if (id & 0x8000) {
+			/* Enterprise-specific elements are kept in forward direction only */
+			if (templ->fields[++f].enterprise_number == BF_REVERSE_EN) {
+				/* Already a biflow */
+				tmpl->eligible = false;
+			}
+			continue;
+		}
+
+		if (bf_reversible(id)) {
+			tmpl->reverse[i] = 1;
+			tmpl->reverse_count++;
+		}
+	}
+
+	bf_locate(templ, BF_SRC_PORT, 2, &tmpl->sport);
+	bf_locate(templ, BF_DST_PORT, 2, &tmpl->dport);
+	if (!bf_locate(templ, BF_PROTOCOL, 1, &tmpl->proto)) {
+		tmpl->eligible = false;
+	}
+
+	tmpl->time_mult = 1;
+	if (!bf_locate(templ, BF_START_MSEC, 8, &tmpl->start) || tmpl->start.length != 8) {
+		tmpl->time_mult = 1000;
+		if (!bf_locate(templ, BF_START_SEC, 4, &tmpl->start) || tmpl->start.length != 4) {
+			tmpl->start.offset = -1;
+		}
+	}
+
+	if ((!bf_locate(templ, BF_SRC_IPV4, 4, &tmpl->src) || tmpl->src.length != 4
+			|| !bf_locate(templ, BF_DST_IPV4, 4, &tmpl->dst) || tmpl->dst.length != 4)
+			&& (!bf_locate(templ, BF_SRC_IPV6, 16, &tmpl->src) || tmpl->src.length != 16
+			|| !bf_locate(templ, BF_DST_IPV6, 16, &tmpl->dst) || tmpl->dst.length != 16)) {
+		tmpl->eligible = false;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Free template
+ */
+static void bf_template_free(struct bf_template *tmpl)
+{
+	free(tmpl->reverse);
+	free(tmpl->record);
+	free(tmpl->templ);
+	free(tmpl);
+}
+
+/**
+ * \brief Get plugin's copy of template, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] odid ODID
+ * \param[in] templ Template from Template Manager
+ * \return Template or NULL
+ */
+static struct bf_template *bf_get_template(struct biflow_ip_config *conf,
+	uint32_t odid, struct ipfix_template *templ)
+{
+	struct bf_template *tmpl;
+
+	for (tmpl = conf->templates; tmpl; tmpl = tmpl->next) {
+		if (tmpl->stale || tmpl->odid != odid || tmpl->templ->template_id != templ->template_id) {
+			continue;
+		}
+
+		if (tmpl->templ->template_type == templ->template_type
+				&& tmpl->templ->template_length == templ->template_length
+				&& !memcmp(tmpl->templ->fields, templ->fields, BF_FIELDS_LENGTH(templ))) {
+			return tmpl;
+		}
+
+		/* Template has changed, records held so far keep the old one */
+		tmpl->stale = true;
+		break;
+	}
+
+	tmpl = calloc(1, sizeof(*tmpl));
+	if (!tmpl) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	tmpl->templ = malloc(templ->template_length);
+	if (!tmpl->templ) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(tmpl);
+		return NULL;
+	}
+
+	memcpy(tmpl->templ, templ, templ->template_length);
+	tmpl->templ->references = 0;
+	tmpl->templ->next = NULL;
+	tmpl->odid = odid;
+
+	if (bf_make_plan(tmpl) || !(tmpl->record = template_create_record(tmpl->templ, &tmpl->record_length))) {
+		bf_template_free(tmpl);
+		return NULL;
+	}
+
+	tmpl->next = conf->templates;
+	conf->templates = tmpl;
+	return tmpl;
+}
+
+/**
+ * \brief Get template of biflow records, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] fwd Template of forward record
+ * \param[in] rev Template of reverse record
+ * \return Biflow template or NULL
+ */
+static struct bf_pair *bf_get_pair(struct biflow_ip_config *conf,
+	struct bf_template *fwd, struct bf_template *rev)
+{
+	struct bf_pair *pair;
+	struct ipfix_template_record *rec;
+	uint32_t template_id, last = conf->template_id + BF_TEMPLATE_IDS, length;
+	uint16_t i, f, val;
+	uint8_t *ptr;
+
+	for (pair = conf->pairs; pair; pair = pair->next) {
+		if (pair->fwd == fwd && pair->rev == rev) {
+			return pair;
+		}
+	}
+
+	/* Find unused Template ID */
+	for (template_id = conf->template_id; template_id < last; ++template_id) {
+		for (pair = conf->pairs; pair; pair = pair->next) {
+			if (pair->fwd->odid == fwd->odid && pair->templ->template_id == template_id) {
+				break;
+			}
+		}
+
+		if (!pair) {
+			break;
+		}
+	}
+
+	if (template_id == last) {
+		MSG_WARNING(msg_module, "[%u] No free template ID for biflow records", fwd->odid);
+		return NULL;
+	}
+
+	length = fwd->record_length + rev->reverse_count * 8;
+	if (length > MSG_MAX_LENGTH / 2) {
+		return NULL;
+	}
+
+	pair = calloc(1, sizeof(*pair));
+	if (!pair || !(pair->record = calloc(1, length))) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(pair);
+		return NULL;
+	}
+
+	/* All forward fields followed by reverse fields */
+	memcpy(pair->record, fwd->record, fwd->record_length);
+	rec = (struct ipfix_template_record *) pair->record;
+	rec->template_id = htons(template_id);
+	rec->count = htons(fwd->templ->field_count + rev->reverse_count);
+	ptr = pair->record + fwd->record_length;
+
+	for (i = 0, f = 0; i < rev->templ->field_count; ++i, ++f) {
+		template_ie *ie = &rev->templ->fields[f];
+
+		if (ie->ie.id & 0x8000) {
+			f++;
+		}
+
+		if (!rev->reverse[i]) {
+			continue;
+		}
+
+		uint32_t en = htonl(BF_REVERSE_EN);
+		val = htons(ie->ie.id | 0x8000);
+		memcpy(ptr, &val, 2);
+		val = htons(ie->ie.length);
+		memcpy(ptr + 2, &val, 2);
+		memcpy(ptr + 4, &en, 4);
+		ptr += 8;
+	}
+
+	pair->record_length = length;
+	pair->templ = tm_create_template(pair->record, length, TM_TEMPLATE, fwd->odid);
+	if (!pair->templ) {
+		MSG_ERROR(msg_module, "Unable to create template of biflow records");
+		free(pair->record);
+		free(pair);
+		return NULL;
+	}
+
+	pair->fwd = fwd;
+	pair->rev = rev;
+	fwd->holders++;
+	rev->holders++;
+	pair->next = conf->pairs;
+	conf->pairs = pair;
+
+	MSG_DEBUG(msg_module, "[%u] Biflow template %u for templates %u and %u", fwd->odid,
+		template_id, fwd->templ->template_id, rev->templ->template_id);
+	return pair;
+}
+
+/**
+ * \brief Free templates that are no longer used
+ *
+ * Templates are used by held records and by generated messages that have
+ * not been processed by storage plugins yet (template references).
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] all Free all templates (plugin is closing)
+ */
+static void bf_collect(struct biflow_ip_config *conf, bool all)
+{
+	struct bf_pair **pair_ptr = &conf->pairs, *pair;
+	struct bf_template **tmpl_ptr = &conf->templates, *tmpl;
+
+	while ((pair = *pair_ptr)) {
+		if (all || ((pair->fwd->stale || pair->rev->stale) && pair->templ->references == 0)) {
+			*pair_ptr = pair->next;
+			pair->fwd->holders--;
+			pair->rev->holders--;
+			free(pair->templ);
+			free(pair->record);
+			free(pair);
+		} else {
+			pair_ptr = &pair->next;
+		}
+	}
+
+	while ((tmpl = *tmpl_ptr)) {
+		if (all || (tmpl->stale && tmpl->holders == 0 && tmpl->templ->references == 0)) {
+			*tmpl_ptr = tmpl->next;
+			bf_template_free(tmpl);
+		} else {
+			tmpl_ptr = &tmpl->next;
+		}
+	}
+}
+
+/**
+ * \brief Find output for ODID, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] odid ODID
+ * \param[in] input_info Input info used as a base for generated messages
+ * \return Output or NULL
+ */
+static struct bf_output *bf_get_output(struct biflow_ip_config *conf,
+	uint32_t odid, struct input_info *input_info)
+{
+	struct bf_output *out;
+	size_t size;
+
+	for (out = conf->outputs; out; out = out->next) {
+		if (out->odid == odid) {
+			return out;
+		}
+	}
+
+	if (!input_info) {
+		return NULL;
+	}
+
+	out = calloc(1, sizeof(*out));
+	if (!out) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	size = (input_info->type == SOURCE_TYPE_IPFIX_FILE)
+		? sizeof(struct input_info_file) : sizeof(struct input_info_network);
+	out->input_info = calloc(1, size);
+	if (!out->input_info) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(out);
+		return NULL;
+	}
+
+	memcpy(out->input_info, input_info, size);
+	out->input_info->odid = odid;
+	out->input_info->sequence_number = 0;
+	out->odid = odid;
+	out->next = conf->outputs;
+	conf->outputs = out;
+	return out;
+}
+
+/**
+ * \brief Fill metadata of generated message
+ */
+static void bf_fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	struct ipfix_message *msg = (struct ipfix_message *) data;
+	struct metadata *mdata = &msg->metadata[msg->data_records_count++];
+
+	mdata->record.record = rec;
+	mdata->record.length = rec_len;
+	mdata->record.templ = templ;
+}
+
+/**
+ * \brief Pass message built for one ODID
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] out Output
+ */
+static void bf_output_flush(struct biflow_ip_config *conf, struct bf_output *out)
+{
+	struct ipfix_message *msg = out->msg;
+	int i;
+
+	if (!msg) {
+		return;
+	}
+
+	out->msg = NULL;
+
+	msg->metadata = calloc(out->records, sizeof(struct metadata));
+	if (!msg->metadata) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(msg->pkt_header);
+		free(msg);
+		return;
+	}
+
+	msg->pkt_header->version = htons(IPFIX_VERSION);
+	msg->pkt_header->length = htons(out->offset);
+	msg->pkt_header->export_time = htonl(conf->now);
+	msg->pkt_header->sequence_number = htonl(out->input_info->sequence_number);
+	msg->pkt_header->observation_domain_id = htonl(out->odid);
+
+	for (i = 0; i < out->couples; ++i) {
+		data_set_process_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template,
+			&bf_fill_metadata, msg);
+		tm_template_reference_inc(msg->data_couple[i].data_template);
+	}
+
+	msg->input_info = out->input_info;
+	msg->source_status = SOURCE_STATUS_OPENED;
+	msg->templ_records_count = out->templ_sets;
+
+	out->input_info->sequence_number += out->records;
+	out->offset = 0;
+	out->records = 0;
+	out->couples = 0;
+	out->templ_sets = 0;
+
+	pass_message(conf->ip_config, msg);
+}
+
+/**
+ * \brief Reserve space for data record in message being built
+ *
+ * The template is announced in the message before its first data set.
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] out Output
+ * \param[in] templ Template of the record
+ * \param[in] tmpl_rec Template Record in network byte order
+ * \param[in] tmpl_rec_len Length of the Template Record
+ * \param[in] length Length of the data record
+ * \return Space for the record or NULL
+ */
+static uint8_t *bf_output_reserve(struct biflow_ip_config *conf, struct bf_output *out,
+	struct ipfix_template *templ, const uint8_t *tmpl_rec, uint16_t tmpl_rec_len, uint16_t length)
+{
+	struct ipfix_message *msg = out->msg;
+	struct ipfix_data_set *set;
+	uint8_t *pkt, *ptr;
+	uint32_t needed;
+	bool announced = false;
+	int i;
+
+	if ((uint32_t) IPFIX_HEADER_LENGTH + 8 + tmpl_rec_len + length > MSG_MAX_LENGTH) {
+		return NULL;
+	}
+
+	if (msg && msg->data_couple[out->couples - 1].data_template == templ) {
+		/* Append to the last data set */
+		if ((uint32_t) out->offset + length <= MSG_MAX_LENGTH) {
+			set = msg->data_couple[out->couples - 1].data_set;
+			goto append;
+		}
+
+		bf_output_flush(conf, out);
+		msg = NULL;
+	}
+
+	if (msg) {
+		for (i = 0; i < out->couples && !announced; ++i) {
+			announced = (msg->data_couple[i].data_template == templ);
+		}
+
+		needed = (uint32_t) out->offset + 4 + length + (announced ? 0 : 4 + tmpl_rec_len);
+		if (needed > MSG_MAX_LENGTH || out->couples == MSG_MAX_DATA_COUPLES
+				|| (!announced && out->templ_sets == MSG_MAX_TEMPL_SETS)) {
+			bf_output_flush(conf, out);
+			msg = NULL;
+			announced = false;
+		}
+	}
+
+	if (!msg) {
+		msg = calloc(1, sizeof(struct ipfix_message));
+		pkt = malloc(MSG_MAX_LENGTH);
+		if (!msg || !pkt) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			free(msg);
+			free(pkt);
+			return NULL;
+		}
+
+		msg->pkt_header = (struct ipfix_header *) pkt;
+		out->msg = msg;
+		out->offset = IPFIX_HEADER_LENGTH;
+	}
+
+	pkt = (uint8_t *) msg->pkt_header;
+
+	if (!announced) {
+		struct ipfix_template_set *tset = (struct ipfix_template_set *) (pkt + out->offset);
+
+		tset->header.flowset_id = htons(IPFIX_TEMPLATE_FLOWSET_ID);
+		tset->header.length = htons(4 + tmpl_rec_len);
+		memcpy(&tset->first_record, tmpl_rec, tmpl_rec_len);
+		msg->templ_set[out->templ_sets++] = tset;
+		out->offset += 4 + tmpl_rec_len;
+	}
+
+	set = (struct ipfix_data_set *) (pkt + out->offset);
+	set->header.flowset_id = htons(templ->template_id);
+	set->header.length = htons(4);
+	msg->data_couple[out->couples].data_set = set;
+	msg->data_couple[out->couples].data_template = templ;
+	out->couples++;
+	out->offset += 4;
+
+append:
+	ptr = (uint8_t *) out->msg->pkt_header + out->offset;
+	set->header.length = htons(ntohs(set->header.length) + length);
+	out->offset += length;
+	out->records++;
+	return ptr;
+}
+
+/**
+ * \brief Emit data record unchanged
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] odid ODID
+ * \param[in] tmpl Template of the record
+ * \param[in] rec Data record
+ * \param[in] length Length of the record
+ */
+static void bf_emit_record(struct biflow_ip_config *conf, uint32_t odid,
+	struct bf_template *tmpl, const uint8_t *rec, uint16_t length)
+{
+	struct bf_output *out = bf_get_output(conf, odid, NULL);
+	uint8_t *ptr;
+
+	if (!out) {
+		return;
+	}
+
+	ptr = bf_output_reserve(conf, out, tmpl->templ, tmpl->record, tmpl->record_length, length);
+	if (ptr) {
+		memcpy(ptr, rec, length);
+		conf->unpaired++;
+	}
+}
+
+/**
+ * \brief Copy reverse fields of data record
+ *
+ * \param[in] tmpl Template of the record
+ * \param[in] rec Data record
+ * \param[in] rec_len Length of the record
+ * \param[out] dst Destination (NULL = only compute length)
+ * \return Length of reverse fields or -1 when the record is malformed
+ */
+static int bf_copy_reverse(struct bf_template *tmpl, const uint8_t *rec, uint16_t rec_len, uint8_t *dst)
+{
+	struct ipfix_template *templ = tmpl->templ;
+	uint32_t offset = 0, length = 0, flen;
+	uint16_t i, f;
+
+	for (i = 0, f = 0; i < templ->field_count; ++i, ++f) {
+		flen = templ->fields[f].ie.length;
+		if (templ->fields[f].ie.id & 0x8000) {
+			f++;
+		}
+
+		if (flen == VAR_IE_LENGTH) {
+			/* Length prefix is copied as well */
+			if (offset >= rec_len) {
+				return -1;
+			}
+
+			flen = rec[offset] + 1;
+			if (flen == 256) {
+				if (offset + 3 > rec_len) {
+					return -1;
+				}
+				flen = ((rec[offset + 1] << 8) | rec[offset + 2]) + 3;
+			}
+		}
+
+		if (offset + flen > rec_len) {
+			return -1;
+		}
+
+		if (tmpl->reverse[i]) {
+			if (dst) {
+				memcpy(dst + length, rec + offset, flen);
+			}
+			length += flen;
+		}
+
+		offset += flen;
+	}
+
+	return length;
+}
+
+/**
+ * \brief Emit biflow record
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] odid ODID
+ * \param[in] fwd Template of forward record
+ * \param[in] frec Forward record
+ * \param[in] flen Length of the forward record
+ * \param[in] rev Template of reverse record
+ * \param[in] rrec Reverse record
+ * \param[in] rlen Length of the reverse record
+ * \return true if biflow record was emitted
+ */
+static bool bf_stitch(struct biflow_ip_config *conf, uint32_t odid,
+	struct bf_template *fwd, const uint8_t *frec, uint16_t flen,
+	struct bf_template *rev, const uint8_t *rrec, uint16_t rlen)
+{
+	struct bf_output *out = bf_get_output(conf, odid, NULL);
+	struct bf_pair *pair;
+	uint8_t *ptr;
+	int length;
+
+	if (!out || !(pair = bf_get_pair(conf, fwd, rev))) {
+		return false;
+	}
+
+	length = bf_copy_reverse(rev, rrec, rlen, NULL);
+	if (length < 0 || flen + length > MSG_MAX_LENGTH) {
+		return false;
+	}
+
+	ptr = bf_output_reserve(conf, out, pair->templ, pair->record, pair->record_length, flen + length);
+	if (!ptr) {
+		return false;
+	}
+
+	memcpy(ptr, frec, flen);
+	bf_copy_reverse(rev, rrec, rlen, ptr + flen);
+	conf->stitched++;
+	return true;
+}
+
+/**
+ * \brief Find slot of index referring to entry
+ */
+static uint32_t bf_slot(struct bf_shard *shard, uint32_t idx)
+{
+	uint32_t slot = shard->entries[idx].hash & shard->mask;
+
+	while (shard->index[slot] != idx + 1) {
+		slot = (slot + 1) & shard->mask;
+	}
+
+	return slot;
+}
+
+/**
+ * \brief Remove entry from shard
+ *
+ * The index slot is freed by backward shift deletion, the entry is unlinked
+ * from the order of arrival and its record is released.
+ *
+ * \param[in,out] shard Shard
+ * \param[in] slot Index slot of the entry
+ */
+static void bf_remove(struct bf_shard *shard, uint32_t slot)
+{
+	uint32_t idx = shard->index[slot] - 1, i = slot, j = slot, home;
+	struct bf_entry *entry = &shard->entries[idx];
+
+	for (;;) {
+		j = (j + 1) & shard->mask;
+		if (shard->index[j] == 0) {
+			break;
+		}
+
+		/* Move reference to the hole if the hole lies between its home and j */
+		home = shard->entries[shard->index[j] - 1].hash & shard->mask;
+		if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+			shard->index[i] = shard->index[j];
+			i = j;
+		}
+	}
+	shard->index[i] = 0;
+
+	if (entry->prev != BF_NONE) {
+		shard->entries[entry->prev].next = entry->next;
+	} else {
+		shard->head = entry->next;
+	}
+
+	if (entry->next != BF_NONE) {
+		shard->entries[entry->next].prev = entry->prev;
+	} else {
+		shard->tail = entry->prev;
+	}
+
+	if (entry->record != entry->data) {
+		free(entry->record);
+	}
+
+	entry->tmpl->holders--;
+	entry->tmpl = NULL;
+	entry->record = NULL;
+	entry->next = shard->free;
+	shard->free = idx;
+	shard->count--;
+}
+
+/**
+ * \brief Release held record that has not found its counterpart
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] shard Shard
+ * \param[in] slot Index slot of the entry
+ */
+static void bf_release(struct biflow_ip_config *conf, struct bf_shard *shard, uint32_t slot)
+{
+	struct bf_entry *entry = &shard->entries[shard->index[slot] - 1];
+
+	if (conf->emit) {
+		bf_emit_record(conf, entry->odid, entry->tmpl, entry->record, entry->length);
+	} else {
+		conf->dropped++;
+	}
+
+	bf_remove(shard, slot);
+}
+
+/**
+ * \brief Build canonical flow key of data record
+ *
+ * Endpoints (address, port) are ordered, so that both directions of a
+ * conversation have the same key. IPv4 addresses are stored as IPv4-mapped
+ * IPv6 addresses.
+ *
+ * \param[in] proc Processor
+ * \param[in] rec Data record
+ * \param[out] key Flow key
+ * \param[out] forward Source endpoint is the first one in the key
+ * \param[out] start Flow start in milliseconds
+ * \return 0 on success
+ */
+static int bf_make_key(struct bf_processor *proc, uint8_t *rec, uint8_t *key, bool *forward, uint64_t *start)
+{
+	struct bf_template *tmpl = proc->tmpl;
+	struct bf_loc *locs[] = {&tmpl->src, &tmpl->dst, &tmpl->sport, &tmpl->dport, &tmpl->proto, &tmpl->start};
+	uint8_t *fields[6];
+	uint8_t ep[2][18];
+	int i, offset;
+
+	for (i = 0; i < 6; ++i) {
+		offset = locs[i]->offset;
+		if (offset >= 0 && tmpl->variable) {
+			/* Offsets differ record to record */
+			offset = data_record_field_offset(rec, tmpl->templ, 0, locs[i]->id, NULL);
+		}
+
+		fields[i] = (offset >= 0) ? rec + offset : NULL;
+	}
+
+	if (!fields[0] || !fields[1] || !fields[4]) {
+		return 1;
+	}
+
+	memset(ep, 0, sizeof(ep));
+	for (i = 0; i < 2; ++i) {
+		if (locs[i]->length == 4) {
+			ep[i][10] = ep[i][11] = 0xff;
+			memcpy(ep[i] + 12, fields[i], 4);
+		} else {
+			memcpy(ep[i], fields[i], 16);
+		}
+
+		/* Reduced size encoding is right aligned */
+		if (fields[i + 2]) {
+			memcpy(ep[i] + 18 - locs[i + 2]->length, fields[i + 2], locs[i + 2]->length);
+		}
+	}
+
+	*forward = (memcmp(ep[0], ep[1], 18) <= 0);
+
+	memset(key, 0, BF_KEY_LENGTH);
+	memcpy(key, ep[!*forward], 16);
+	memcpy(key + 16, ep[*forward], 16);
+	memcpy(key + 32, ep[!*forward] + 16, 2);
+	memcpy(key + 34, ep[*forward] + 16, 2);
+	key[36] = *fields[4];
+
+	if (fields[5]) {
+		*start = data_read_uint(fields[5], tmpl->start.length) * tmpl->time_mult;
+	} else {
+		*start = (uint64_t) proc->conf->now * 1000;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Process data record
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Record's length
+ * \param[in] templ Template
+ * \param[in] data Processor's data
+ */
+static void bf_process_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) templ;
+	struct bf_processor *proc = (struct bf_processor *) data;
+	struct biflow_ip_config *conf = proc->conf;
+	struct bf_shard *shard;
+	struct bf_entry *entry;
+	uint8_t key[BF_KEY_LENGTH];
+	uint64_t hash, start;
+	uint32_t slot, idx;
+	bool forward;
+
+	if (bf_make_key(proc, rec, key, &forward, &start)) {
+		bf_emit_record(conf, proc->odid, proc->tmpl, rec, rec_len);
+		return;
+	}
+
+	hash = bf_hash(key, proc->odid);
+	shard = &conf->shards[hash >> 60];
+
+	for (slot = hash & shard->mask; shard->index[slot]; slot = (slot + 1) & shard->mask) {
+		entry = &shard->entries[shard->index[slot] - 1];
+		if (entry->hash != hash || entry->odid != proc->odid || memcmp(entry->key, key, BF_KEY_LENGTH)) {
+			continue;
+		}
+
+		if (entry->forward == forward) {
+			/* Next record of the same direction, the held one stays unpaired */
+			bf_release(conf, shard, slot);
+			break;
+		}
+
+		/* Forward direction is the one that started first */
+		bool stitched = (entry->start <= start)
+			? bf_stitch(conf, proc->odid, entry->tmpl, entry->record, entry->length, proc->tmpl, rec, rec_len)
+			: bf_stitch(conf, proc->odid, proc->tmpl, rec, rec_len, entry->tmpl, entry->record, entry->length);
+
+		if (!stitched) {
+			bf_emit_record(conf, entry->odid, entry->tmpl, entry->record, entry->length);
+			bf_emit_record(conf, proc->odid, proc->tmpl, rec, rec_len);
+		}
+
+		bf_remove(shard, slot);
+		return;
+	}
+
+	if (shard->count == shard->capacity) {
+		/* Table is full, release the oldest record */
+		conf->evicted++;
+		bf_release(conf, shard, bf_slot(shard, shard->head));
+	}
+
+	idx = shard->free;
+	entry = &shard->entries[idx];
+	shard->free = entry->next;
+
+	if (rec_len <= BF_INLINE_LENGTH) {
+		entry->record = entry->data;
+	} else if (!(entry->record = malloc(rec_len))) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		entry->next = shard->free;
+		shard->free = idx;
+		bf_emit_record(conf, proc->odid, proc->tmpl, rec, rec_len);
+		return;
+	}
+
+	memcpy(entry->record, rec, rec_len);
+	memcpy(entry->key, key, BF_KEY_LENGTH);
+	entry->length = rec_len;
+	entry->hash = hash;
+	entry->odid = proc->odid;
+	entry->arrival = conf->now;
+	entry->start = start;
+	entry->forward = forward;
+	entry->tmpl = proc->tmpl;
+	entry->tmpl->holders++;
+
+	entry->prev = shard->tail;
+	entry->next = BF_NONE;
+	if (shard->tail != BF_NONE) {
+		shard->entries[shard->tail].next = idx;
+	} else {
+		shard->head = idx;
+	}
+	shard->tail = idx;
+
+	/* Load factor is at most 0.5, free slot exists */
+	for (slot = hash & shard->mask; shard->index[slot]; slot = (slot + 1) & shard->mask);
+	shard->index[slot] = idx + 1;
+	shard->count++;
+}
+
+/**
+ * \brief Release records waiting longer than timeout
+ *
+ * Records are kept in order of arrival, so only the oldest ones are checked.
+ *
+ * \param[in] conf Plugin configuration
+ */
+static void bf_expire(struct biflow_ip_config *conf)
+{
+	int s;
+
+	for (s = 0; s < BF_SHARDS; ++s) {
+		struct bf_shard *shard = &conf->shards[s];
+
+		while (shard->head != BF_NONE
+				&& conf->now - shard->entries[shard->head].arrival >= (time_t) conf->timeout) {
+			bf_release(conf, shard, bf_slot(shard, shard->head));
+		}
+	}
+}
+
+/**
+ * \brief Release all records of ODID
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] odid ODID
+ */
+static void bf_expire_odid(struct biflow_ip_config *conf, uint32_t odid)
+{
+	uint32_t idx, next;
+	int s;
+
+	for (s = 0; s < BF_SHARDS; ++s) {
+		struct bf_shard *shard = &conf->shards[s];
+
+		for (idx = shard->head; idx != BF_NONE; idx = next) {
+			next = shard->entries[idx].next;
+			if (shard->entries[idx].odid == odid) {
+				bf_release(conf, shard, bf_slot(shard, idx));
+			}
+		}
+	}
+}
+
+/**
+ * \brief Print statistics of stitching
+ */
+static void bf_report(struct biflow_ip_config *conf)
+{
+	uint64_t records = 2 * conf->stitched + conf->unpaired + conf->dropped;
+
+	MSG_INFO(msg_module, "%" PRIu64 " biflows stitched, %" PRIu64 " records unpaired "
+		"(%" PRIu64 " not emitted, %" PRIu64 " evicted from full table), stitch ratio %.1f %%",
+		conf->stitched, conf->unpaired + conf->dropped, conf->dropped, conf->evicted,
+		records ? 200.0 * conf->stitched / records : 0.0);
+}
+
+int intermediate_process_message(void *config, void *message)
+{
+	struct biflow_ip_config *conf = (struct biflow_ip_config *) config;
+	struct ipfix_message *msg = (struct ipfix_message *) message;
+	bool removed[MSG_MAX_DATA_COUPLES];
+	struct bf_processor proc;
+	struct bf_template *tmpl;
+	struct bf_output *out;
+	uint16_t records = 0;
+	int i, sets = 0;
+
+	conf->now = time(NULL);
+	proc.conf = conf;
+	proc.odid = msg->input_info->odid;
+
+	if (msg->source_status == SOURCE_STATUS_CLOSED) {
+		/* Release records of the source before it is closed */
+		bf_expire_odid(conf, proc.odid);
+		out = bf_get_output(conf, proc.odid, NULL);
+		if (out) {
+			bf_output_flush(conf, out);
+		}
+
+		for (tmpl = conf->templates; tmpl; tmpl = tmpl->next) {
+			if (tmpl->odid == proc.odid) {
+				tmpl->stale = true;
+			}
+		}
+
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		struct ipfix_template *templ = msg->data_couple[i].data_template;
+
+		removed[i] = false;
+		if (!templ || templ->template_type != TM_TEMPLATE) {
+			continue;
+		}
+
+		proc.tmpl = bf_get_template(conf, proc.odid, templ);
+		if (!proc.tmpl || !proc.tmpl->eligible || !bf_get_output(conf, proc.odid, msg->input_info)) {
+			continue;
+		}
+
+		records += data_set_process_records(msg->data_couple[i].data_set, templ, &bf_process_record, &proc);
+		removed[i] = true;
+		sets++;
+	}
+
+	bf_expire(conf);
+	for (out = conf->outputs; out; out = out->next) {
+		bf_output_flush(conf, out);
+	}
+
+	if (conf->now != conf->collected) {
+		bf_collect(conf, false);
+		conf->collected = conf->now;
+	}
+
+	if (conf->stat_interval && conf->now - conf->reported >= (time_t) conf->stat_interval) {
+		bf_report(conf);
+		conf->reported = conf->now;
+	}
+
+	if (sets > 0) {
+		message_remove_data_sets(msg, removed, records);
+	}
+
+	if (msg->source_status == SOURCE_STATUS_OPENED && !msg->data_couple[0].data_set
+			&& !msg->templ_set[0] && !msg->opt_templ_set[0]) {
+		/* Everything is held or emitted in generated messages */
+		drop_message(conf->ip_config, message);
+		return 0;
+	}
+
+	pass_message(conf->ip_config, message);
+	return 0;
+}
+
+int intermediate_close(void *config)
+{
+	struct biflow_ip_config *conf = (struct biflow_ip_config *) config;
+	struct bf_output *out;
+	uint64_t held = 0;
+	uint32_t idx;
+	int s;
+
+	for (s = 0; s < BF_SHARDS; ++s) {
+		struct bf_shard *shard = &conf->shards[s];
+
+		held += shard->count;
+		if (shard->entries) {
+			for (idx = shard->head; idx != BF_NONE; idx = shard->entries[idx].next) {
+				if (shard->entries[idx].record != shard->entries[idx].data) {
+					free(shard->entries[idx].record);
+				}
+			}
+		}
+
+		free(shard->entries);
+		free(shard->index);
+	}
+
+	if (held > 0) {
+		MSG_WARNING(msg_module, "%" PRIu64 " held records were not emitted before shutdown", held);
+	}
+
+	if (conf->stitched + conf->unpaired + conf->dropped > 0) {
+		bf_report(conf);
+	}
+
+	while (conf->outputs) {
+		out = conf->outputs;
+		conf->outputs = out->next;
+		if (out->msg) {
+			free(out->msg->pkt_header);
+			free(out->msg);
+		}
+		free(out->input_info);
+		free(out);
+	}
+
+	bf_collect(conf, true);
+	free(conf);
+
+	return 0;
+}
+
+/**@}*/
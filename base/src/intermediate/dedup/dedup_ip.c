@@ -0,0 +1,1425 @@
+/**
+ * \file dedup_ip.c
+ * \brief Intermediate Process removing duplicate flow records of several exporters
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+/**
+ * \defgroup dedupInter Deduplication Intermediate Process
+ * \ingroup intermediatePlugins
+ *
+ * This plugin detects flow records exported by several exporters that observe
+ * the same traffic. Exporters (or their interfaces) configured as one domain
+ * are treated as a single observation point: a record is a duplicate when
+ * another exporter of the domain has recently exported a record with the same
+ * 5-tuple and a close flow start. Duplicates are removed, or all records are
+ * tagged with a flag element that is set for the first observation only.
+ *
+ * Recently seen flows are kept in a hash table split into two generations by
+ * export time; the older generation is discarded as a whole, so the memory is
+ * bounded and no per-flow expiration is needed.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <ipfixcol.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+/* API version constant */
+IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
+/* module name for MSG_* */
+static const char *msg_module = "dedup";
+
+/** Number of generations of the flow table */
+#define DEDUP_GENERATIONS   2
+/** Length of the flow key (addresses, ports, protocol, padding) */
+#define DEDUP_KEY_LENGTH    40
+/** Number of records whose table slots are prefetched in advance */
+#define DEDUP_PIPELINE      8
+/** Maximal number of removed parts of one message */
+#define DEDUP_MAX_RANGES    (MSG_MAX_LENGTH / 2 + 1)
+
+/* Default configuration */
+#define DEDUP_WINDOW        10     /* seconds */
+#define DEDUP_TOLERANCE     1000   /* milliseconds */
+#define DEDUP_MAX_FLOWS     262144
+
+/* Default flag element (CESNET flowFirstObservation) */
+#define DEDUP_FLAG_EN       8057
+#define DEDUP_FLAG_ID       1000
+
+/* Fields of the flow key and flow start */
+#define DEDUP_PROTOCOL      4   /* protocolIdentifier */
+#define DEDUP_SRC_PORT      7   /* sourceTransportPort */
+#define DEDUP_SRC_IPV4      8   /* sourceIPv4Address */
+#define DEDUP_IN_IFACE      10  /* ingressInterface */
+#define DEDUP_DST_PORT      11  /* destinationTransportPort */
+#define DEDUP_DST_IPV4      12  /* destinationIPv4Address */
+#define DEDUP_SRC_IPV6      27  /* sourceIPv6Address */
+#define DEDUP_DST_IPV6      28  /* destinationIPv6Address */
+#define DEDUP_START_SEC     150 /* flowStartSeconds */
+#define DEDUP_START_MSEC    152 /* flowStartMilliseconds */
+
+/* Handling of duplicates */
+enum dedup_mode {
+	DEDUP_DROP,              /* Remove duplicate records */
+	DEDUP_TAG                /* Add flag element to all records */
+};
+
+/* Flow table entry (one cache line) */
+struct dedup_entry {
+	uint64_t hash;           /* Hash of domain and key (0 = empty slot) */
+	uint64_t start;          /* Flow start in milliseconds */
+	uint32_t domain;         /* Deduplication domain */
+	uint32_t observer;       /* Source that exported the record */
+	uint8_t key[DEDUP_KEY_LENGTH];
+};
+
+/* One generation of the flow table (open addressing, linear probing) */
+struct dedup_table {
+	struct dedup_entry *slots;
+	uint32_t mask;           /* Number of slots - 1 */
+	uint32_t count;          /* Number of used slots */
+	uint64_t generation;     /* Export time / window */
+};
+
+/* Member of a domain from configuration */
+struct dedup_member {
+	int family;              /* AF_INET, AF_INET6 or 0 (any exporter) */
+	struct in6_addr addr;    /* Exporter address */
+	int64_t odid;            /* ODID (-1 = any) */
+	int64_t iface;           /* Ingress interface (-1 = any) */
+	uint32_t domain;         /* Index of the domain */
+	struct dedup_member *next;
+};
+
+/* Interface of a source assigned to a domain */
+struct dedup_iface {
+	uint32_t iface;          /* Ingress interface */
+	uint32_t domain;         /* Index of the domain */
+};
+
+/* Source (exporter and ODID) seen by the plugin */
+struct dedup_source {
+	struct input_info *input_info;
+	uint32_t odid;
+	uint32_t observer;       /* Unique number of the source */
+	int64_t domain;          /* Domain of the source (-1 = none) */
+	struct dedup_iface *ifaces; /* Domains of interfaces */
+	int iface_count;
+	struct dedup_source *next;
+};
+
+/* Location of a field in data records of one template */
+struct dedup_loc {
+	int offset;              /* Offset in the record (-1 = missing) */
+	uint16_t id;             /* Field ID */
+	uint16_t length;         /* Length in the record */
+};
+
+/* Processing plan for data records of one template */
+struct dedup_plan {
+	struct ipfix_template *templ;
+	bool variable;           /* Template has variable-length fields */
+	struct dedup_loc src, dst, sport, dport, proto, iface, start;
+	int time_mult;           /* 1000 for seconds, 1 for milliseconds */
+};
+
+/* plugin's configuration structure */
+struct dedup_ip_config {
+	void *ip_config;                /* internal process configuration */
+	uint32_t ip_id;                 /* source ID into Template Manager */
+	struct ipfix_template_mgr *tm;  /* Template Manager */
+
+	enum dedup_mode mode;
+	uint32_t window;                /* Length of a generation in seconds */
+	uint64_t tolerance;             /* Maximal difference of flow starts */
+	uint32_t flag_id;               /* Flag element */
+	uint32_t flag_en;
+
+	struct dedup_member *members;   /* Configured domains */
+	uint32_t domains;               /* Number of domains */
+	struct dedup_source *sources;   /* Known sources */
+	struct dedup_source *last;      /* Source of the previous message */
+	uint32_t observers;             /* Number of sources created */
+
+	struct dedup_table tables[DEDUP_GENERATIONS];
+	int current;                    /* Table of the current generation */
+	uint32_t table_limit;           /* Maximal number of flows in a table */
+	uint64_t clock;                 /* The latest export time */
+
+	struct message_range *ranges;   /* Removed parts of the message */
+	uint32_t range_count;
+
+	uint64_t records;               /* Number of checked records */
+	uint64_t duplicates;            /* Number of duplicates */
+	uint64_t forgotten;             /* Flows not remembered (table full) */
+};
+
+/* Record waiting for lookup in the flow table */
+struct dedup_pending {
+	uint8_t *rec;                   /* Data record in the message */
+	uint16_t length;                /* Record's length */
+	uint8_t *flag;                  /* Flag of the copied record (tag mode) */
+	bool valid;                     /* Record has flow key and domain */
+	uint32_t domain;
+	uint64_t hash;
+	uint64_t start;                 /* Flow start in milliseconds */
+	uint8_t key[DEDUP_KEY_LENGTH];
+};
+
+/* struct for data records processing */
+struct dedup_processor {
+	struct dedup_ip_config *conf;
+	struct dedup_source *source;
+	struct dedup_plan *plan;
+	uint8_t *pkt;                   /* Processed message */
+	uint64_t export_time;           /* Export time in milliseconds */
+
+	struct dedup_pending pending[DEDUP_PIPELINE]; /* Records waiting for lookup */
+	unsigned int head;              /* The oldest pending record */
+	unsigned int count;             /* Number of pending records */
+
+	uint16_t set_records;           /* Records in the processed set */
+	uint16_t set_removed;           /* Records removed from the set */
+	uint16_t set_bytes;             /* Bytes removed from the set */
+	uint16_t removed;               /* Records removed from the message */
+
+	uint8_t *out;                   /* Message being built (tag mode) */
+	uint32_t offset;                /* Used part of out */
+	struct ipfix_template *new_templ; /* Template of tagged records */
+	struct metadata *metadata;      /* Metadata of the records */
+	uint16_t metadata_count;
+	uint16_t metadata_index;
+	struct ipfix_template_key *key_tm; /* Key into Template Manager */
+};
+
+/**
+ * \brief Hash of flow key and domain
+ */
+static inline uint64_t dedup_hash(const uint8_t *key, uint32_t domain)
+{
+	uint64_t hash = (domain + 1) * 0x9e3779b97f4a7c15ULL, word;
+	int i;
+
+	for (i = 0; i < DEDUP_KEY_LENGTH; i += 8) {
+		memcpy(&word, key + i, 8);
+		hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 32;
+	}
+
+	return hash | 1;
+}
+
+/**
+ * \brief Parse one domain from configuration
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] node Domain node
+ * \return 0 on success
+ */
+static int dedup_parse_domain(struct dedup_ip_config *conf, xmlNode *node)
+{
+	xmlNode *curr;
+	int ret = 0;
+
+	for (curr = node->children; curr != NULL && ret == 0; curr = curr->next) {
+		if (curr->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		char *value = (char *) xmlNodeGetContent(curr);
+		if (!value) {
+			continue;
+		}
+
+		struct dedup_member *member = calloc(1, sizeof(*member));
+		if (!member) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			xmlFree(value);
+			return 1;
+		}
+
+		member->odid = -1;
+		member->iface = -1;
+		member->domain = conf->domains;
+
+		if (!xmlStrcmp(curr->name, (const xmlChar *) "odid")) {
+			member->odid = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "exporter")
+				|| !xmlStrcmp(curr->name, (const xmlChar *) "interface")) {
+			char *addr = value;
+			xmlChar *exporter = NULL;
+
+			if (!xmlStrcmp(curr->name, (const xmlChar *) "interface")) {
+				exporter = xmlGetProp(curr, (const xmlChar *) "exporter");
+				if (!exporter) {
+					MSG_ERROR(msg_module, "Interface '%s' without exporter", value);
+					ret = 1;
+				}
+				member->iface = strtoul(value, NULL, 10);
+				addr = (char *) exporter;
+			}
+
+			if (ret == 0) {
+				if (inet_pton(AF_INET, addr, &member->addr) == 1) {
+					member->family = AF_INET;
+				} else if (inet_pton(AF_INET6, addr, &member->addr) == 1) {
+					member->family = AF_INET6;
+				} else {
+					MSG_ERROR(msg_module, "Invalid exporter address '%s'", addr);
+					ret = 1;
+				}
+			}
+
+			xmlFree(exporter);
+		} else {
+			MSG_WARNING(msg_module, "Unknown domain member '%s'", (char *) curr->name);
+			free(member);
+			member = NULL;
+		}
+
+		if (member) {
+			member->next = conf->members;
+			conf->members = member;
+		}
+
+		xmlFree(value);
+	}
+
+	conf->domains++;
+	return ret;
+}
+
+/**
+ * \brief Parse plugin configuration
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] params XML configuration
+ * \return 0 on success
+ */
+static int dedup_parse_config(struct dedup_ip_config *conf, char *params)
+{
+	xmlDoc *doc = NULL;
+	xmlNode *root = NULL, *curr = NULL;
+	uint32_t max_flows = DEDUP_MAX_FLOWS;
+	int ret = 0;
+
+	doc = xmlParseDoc(BAD_CAST params);
+	if (!doc) {
+		MSG_ERROR(msg_module, "Cannot parse config xml!");
+		return 1;
+	}
+
+	root = xmlDocGetRootElement(doc);
+	if (!root) {
+		MSG_ERROR(msg_module, "Cannot get document root element!");
+		xmlFreeDoc(doc);
+		return 1;
+	}
+
+	for (curr = root->children; curr != NULL && ret == 0; curr = curr->next) {
+		if (curr->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		if (!xmlStrcmp(curr->name, (const xmlChar *) "domain")) {
+			ret = dedup_parse_domain(conf, curr);
+			continue;
+		}
+
+		char *value = (char *) xmlNodeGetContent(curr);
+		if (!value) {
+			continue;
+		}
+
+		if (!xmlStrcmp(curr->name, (const xmlChar *) "mode")) {
+			if (!strcasecmp(value, "drop")) {
+				conf->mode = DEDUP_DROP;
+			} else if (!strcasecmp(value, "tag")) {
+				conf->mode = DEDUP_TAG;
+			} else {
+				MSG_ERROR(msg_module, "Unknown mode '%s'", value);
+				ret = 1;
+			}
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "window")) {
+			conf->window = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "tolerance")) {
+			conf->tolerance = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "maxFlows")) {
+			max_flows = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "flagElement")) {
+			ipfix_element_result_t res = get_element_by_name(value, false);
+
+			if (res.count != 1) {
+				MSG_ERROR(msg_module, "Unknown or ambiguous element '%s'", value);
+				ret = 1;
+			} else if (res.result->type != ET_UNSIGNED_8) {
+				MSG_ERROR(msg_module, "Flag element '%s' is not unsigned8", value);
+				ret = 1;
+			} else {
+				conf->flag_id = res.result->id;
+				conf->flag_en = res.result->en;
+			}
+		}
+
+		xmlFree(value);
+	}
+
+	xmlFreeDoc(doc);
+
+	if (ret) {
+		return ret;
+	}
+
+	if (conf->window == 0) {
+		MSG_ERROR(msg_module, "Invalid window");
+		return 1;
+	}
+
+	if (max_flows < DEDUP_GENERATIONS) {
+		MSG_ERROR(msg_module, "Invalid maximal number of flows %u", max_flows);
+		return 1;
+	}
+	conf->table_limit = max_flows / DEDUP_GENERATIONS;
+
+	if (conf->domains == 0) {
+		MSG_INFO(msg_module, "No domain configured; all exporters form one domain");
+	} else {
+		MSG_INFO(msg_module, "Deduplicating records in %u domains", conf->domains);
+	}
+
+	MSG_INFO(msg_module, "Duplicates are %s (window %u s, tolerance %" PRIu64 " ms)",
+		(conf->mode == DEDUP_DROP) ? "removed" : "tagged", conf->window, conf->tolerance);
+
+	return 0;
+}
+
+/**
+ * \brief Initialize flow table
+ *
+ * \param[in,out] conf Plugin configuration
+ * \return 0 on success
+ */
+static int dedup_init_table(struct dedup_ip_config *conf)
+{
+	uint32_t slots = 1;
+	int i;
+
+	/* Load factor at most 1/2 */
+	while (slots < conf->table_limit * 2) {
+		slots <<= 1;
+	}
+
+	for (i = 0; i < DEDUP_GENERATIONS; ++i) {
+		conf->tables[i].slots = calloc(slots, sizeof(struct dedup_entry));
+		if (!conf->tables[i].slots) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+		conf->tables[i].mask = slots - 1;
+	}
+
+	conf->ranges = calloc(DEDUP_MAX_RANGES, sizeof(struct message_range));
+	if (!conf->ranges) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Initialize dedup plugin
+ *
+ * \param[in] params Plugin parameters
+ * \param[in] ip_config Internal process configuration
+ * \param[in] ip_id Source ID into Template Manager
+ * \param[in] template_mgr Template Manager
+ * \param[out] config Plugin configuration
+ * \return 0 if everything OK
+ */
+int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfix_template_mgr *template_mgr, void **config)
+{
+	struct dedup_ip_config *conf;
+
+	conf = (struct dedup_ip_config *) calloc(1, sizeof(*conf));
+	if (!conf) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	conf->ip_config = ip_config;
+	conf->ip_id = ip_id;
+	conf->tm = template_mgr;
+	conf->mode = DEDUP_DROP;
+	conf->window = DEDUP_WINDOW;
+	conf->tolerance = DEDUP_TOLERANCE;
+	conf->flag_id = DEDUP_FLAG_ID;
+	conf->flag_en = DEDUP_FLAG_EN;
+	conf->table_limit = DEDUP_MAX_FLOWS / DEDUP_GENERATIONS;
+
+	if ((params && dedup_parse_config(conf, params)) || dedup_init_table(conf)) {
+		intermediate_close(conf);
+		return -1;
+	}
+
+	*config = conf;
+	MSG_INFO(msg_module, "Plugin initialization completed successfully");
+	return 0;
+}
+
+/**
+ * \brief Check whether member of a domain matches the source
+ */
+static bool dedup_member_match(struct dedup_member *member, struct input_info *info, uint32_t odid)
+{
+	struct input_info_network *net = (struct input_info_network *) info;
+
+	if (member->odid >= 0 && member->odid != odid) {
+		return false;
+	}
+
+	if (member->family == 0) {
+		return true;
+	}
+
+	if (info->type == SOURCE_TYPE_IPFIX_FILE) {
+		return false;
+	}
+
+	if (member->family == AF_INET) {
+		return net->l3_proto == 4 && !memcmp(&net->src_addr.ipv4, &member->addr, 4);
+	}
+
+	return net->l3_proto == 6 && !memcmp(&net->src_addr.ipv6, &member->addr, 16);
+}
+
+/**
+ * \brief Find source of a message, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] info Input info of the message
+ * \param[in] odid ODID of the message
+ * \return Source or NULL
+ */
+static struct dedup_source *dedup_get_source(struct dedup_ip_config *conf,
+	struct input_info *info, uint32_t odid)
+{
+	struct dedup_source *source;
+	struct dedup_member *member;
+
+	if (conf->last && conf->last->input_info == info && conf->last->odid == odid) {
+		return conf->last;
+	}
+
+	for (source = conf->sources; source; source = source->next) {
+		if (source->input_info == info && source->odid == odid) {
+			conf->last = source;
+			return source;
+		}
+	}
+
+	source = calloc(1, sizeof(*source));
+	if (!source) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	source->input_info = info;
+	source->odid = odid;
+	source->observer = conf->observers++;
+	source->domain = (conf->domains == 0) ? 0 : -1;
+
+	for (member = conf->members; member; member = member->next) {
+		if (!dedup_member_match(member, info, odid)) {
+			continue;
+		}
+
+		if (member->iface < 0) {
+			source->domain = member->domain;
+			continue;
+		}
+
+		struct dedup_iface *ifaces = realloc(source->ifaces,
+			(source->iface_count + 1) * sizeof(struct dedup_iface));
+		if (!ifaces) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			continue;
+		}
+
+		ifaces[source->iface_count].iface = member->iface;
+		ifaces[source->iface_count].domain = member->domain;
+		source->ifaces = ifaces;
+		source->iface_count++;
+	}
+
+	if (source->domain >= 0 || source->iface_count > 0) {
+		MSG_INFO(msg_module, "[%u] Source takes part in deduplication", odid);
+	}
+
+	source->next = conf->sources;
+	conf->sources = source;
+	conf->last = source;
+	return source;
+}
+
+/**
+ * \brief Forget closed source
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] info Input info of the source
+ * \param[in] odid ODID of the source
+ */
+static void dedup_remove_source(struct dedup_ip_config *conf, struct input_info *info, uint32_t odid)
+{
+	struct dedup_source **ptr = &conf->sources, *source;
+
+	while ((source = *ptr)) {
+		if (source->input_info == info && source->odid == odid) {
+			*ptr = source->next;
+			free(source->ifaces);
+			free(source);
+			break;
+		}
+		ptr = &source->next;
+	}
+
+	conf->last = NULL;
+}
+
+/**
+ * \brief Move to the generation of the export time
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] export_time Export time of the message
+ */
+static void dedup_advance(struct dedup_ip_config *conf, uint32_t export_time)
+{
+	struct dedup_table *table;
+	uint64_t generation;
+	int i;
+
+	if (export_time <= conf->clock) {
+		return;
+	}
+
+	conf->clock = export_time;
+	generation = export_time / conf->window;
+	table = &conf->tables[conf->current];
+	if (generation == table->generation) {
+		return;
+	}
+
+	if (generation == table->generation + 1) {
+		/* The oldest generation is discarded */
+		conf->current = (conf->current + 1) % DEDUP_GENERATIONS;
+		table = &conf->tables[conf->current];
+		memset(table->slots, 0, ((size_t) table->mask + 1) * sizeof(struct dedup_entry));
+		table->count = 0;
+		table->generation = generation;
+		return;
+	}
+
+	for (i = 0; i < DEDUP_GENERATIONS; ++i) {
+		table = &conf->tables[(conf->current + DEDUP_GENERATIONS - i) % DEDUP_GENERATIONS];
+		memset(table->slots, 0, ((size_t) table->mask + 1) * sizeof(struct dedup_entry));
+		table->count = 0;
+		table->generation = generation - i;
+	}
+}
+
+/**
+ * \brief Locate field in template
+ *
+ * \param[in] templ Template
+ * \param[in] id Field ID
+ * \param[in] max Maximal length of the field
+ * \param[out] loc Location of the field
+ * \return true if field is present and has fixed length
+ */
+static bool dedup_locate(struct ipfix_template *templ, uint16_t id, uint16_t max, struct dedup_loc *loc)
+{
+	struct ipfix_template_row *row;
+	int offset;
+
+	loc->offset = -1;
+	loc->id = id;
+	row = template_get_field(templ, 0, id, &offset);
+	if (!row || row->length == VAR_IE_LENGTH || row->length == 0 || row->length > max) {
+		return false;
+	}
+
+	loc->offset = offset;
+	loc->length = row->length;
+	return true;
+}
+
+/**
+ * \brief Prepare processing of records of given template
+ *
+ * \param[in] templ Template
+ * \param[out] plan Processing plan
+ * \return 0 if records contain the flow key
+ */
+static int dedup_make_plan(struct ipfix_template *templ, struct dedup_plan *plan)
+{
+	plan->templ = templ;
+	plan->variable = (templ->data_length & 0x80000000);
+
+	dedup_locate(templ, DEDUP_SRC_PORT, 2, &plan->sport);
+	dedup_locate(templ, DEDUP_DST_PORT, 2, &plan->dport);
+	dedup_locate(templ, DEDUP_PROTOCOL, 1, &plan->proto);
+	dedup_locate(templ, DEDUP_IN_IFACE, 4, &plan->iface);
+
+	plan->time_mult = 1;
+	if (!dedup_locate(templ, DEDUP_START_MSEC, 8, &plan->start) || plan->start.length != 8) {
+		plan->time_mult = 1000;
+		if (!dedup_locate(templ, DEDUP_START_SEC, 4, &plan->start) || plan->start.length != 4) {
+			plan->start.offset = -1;
+		}
+	}
+
+	if (dedup_locate(templ, DEDUP_SRC_IPV4, 4, &plan->src) && plan->src.length == 4
+			&& dedup_locate(templ, DEDUP_DST_IPV4, 4, &plan->dst) && plan->dst.length == 4) {
+		return 0;
+	}
+
+	if (dedup_locate(templ, DEDUP_SRC_IPV6, 16, &plan->src) && plan->src.length == 16
+			&& dedup_locate(templ, DEDUP_DST_IPV6, 16, &plan->dst) && plan->dst.length == 16) {
+		return 0;
+	}
+
+	/* Records without flow key are never duplicates */
+	plan->src.offset = -1;
+	return 1;
+}
+
+/**
+ * \brief Get field of data record
+ *
+ * \return Pointer to the field or NULL
+ */
+static inline uint8_t *dedup_field(struct dedup_plan *plan, struct dedup_loc *loc, uint8_t *rec)
+{
+	int offset = loc->offset;
+
+	if (offset < 0) {
+		return NULL;
+	}
+
+	if (plan->variable) {
+		/* Offsets differ record to record */
+		offset = data_record_field_offset(rec, plan->templ, 0, loc->id, NULL);
+		if (offset < 0) {
+			return NULL;
+		}
+	}
+
+	return rec + offset;
+}
+
+/**
+ * \brief Build flow key of data record and prefetch its table slots
+ *
+ * \param[in] proc Processor
+ * \param[in,out] pending Record waiting for lookup
+ */
+static void dedup_prepare(struct dedup_processor *proc, struct dedup_pending *pending)
+{
+	struct dedup_ip_config *conf = proc->conf;
+	struct dedup_plan *plan = proc->plan;
+	struct dedup_source *source = proc->source;
+	uint8_t *rec = pending->rec, *key = pending->key, *field;
+	int64_t domain = source->domain;
+	int i;
+
+	pending->valid = false;
+	if (plan->src.offset < 0) {
+		return;
+	}
+
+	if (source->iface_count > 0 && (field = dedup_field(plan, &plan->iface, rec))) {
+		uint32_t iface = data_read_uint(field, plan->iface.length);
+
+		for (i = 0; i < source->iface_count; ++i) {
+			if (source->ifaces[i].iface == iface) {
+				domain = source->ifaces[i].domain;
+				break;
+			}
+		}
+	}
+
+	if (domain < 0) {
+		return;
+	}
+
+	/* Build flow key; IPv4 addresses are stored as IPv4-mapped IPv6 addresses */
+	memset(key, 0, DEDUP_KEY_LENGTH);
+	if (!(field = dedup_field(plan, &plan->src, rec))) {
+		return;
+	}
+	if (plan->src.length == 4) {
+		key[10] = key[11] = 0xff;
+		memcpy(key + 12, field, 4);
+	} else {
+		memcpy(key, field, 16);
+	}
+
+	if (!(field = dedup_field(plan, &plan->dst, rec))) {
+		return;
+	}
+	if (plan->dst.length == 4) {
+		key[26] = key[27] = 0xff;
+		memcpy(key + 28, field, 4);
+	} else {
+		memcpy(key + 16, field, 16);
+	}
+
+	/* Reduced size encoding is right aligned */
+	if ((field = dedup_field(plan, &plan->sport, rec))) {
+		memcpy(key + 34 - plan->sport.length, field, plan->sport.length);
+	}
+	if ((field = dedup_field(plan, &plan->dport, rec))) {
+		memcpy(key + 36 - plan->dport.length, field, plan->dport.length);
+	}
+	if ((field = dedup_field(plan, &plan->proto, rec))) {
+		key[36] = *field;
+	}
+
+	if ((field = dedup_field(plan, &plan->start, rec))) {
+		pending->start = data_read_uint(field, plan->start.length) * plan->time_mult;
+	} else {
+		pending->start = proc->export_time;
+	}
+
+	pending->valid = true;
+	pending->domain = domain;
+	pending->hash = dedup_hash(key, domain);
+
+	/* Table lookups are bound by cache misses; start them early */
+	for (i = 0; i < DEDUP_GENERATIONS; ++i) {
+		struct dedup_table *table = &conf->tables[i];
+		__builtin_prefetch(&table->slots[pending->hash & table->mask], 1);
+	}
+}
+
+/**
+ * \brief Check whether data record is a duplicate and remember its flow
+ *
+ * \param[in] proc Processor
+ * \param[in] pending Prepared record
+ * \return true if another exporter of the domain has already exported the flow
+ */
+static bool dedup_lookup(struct dedup_processor *proc, struct dedup_pending *pending)
+{
+	struct dedup_ip_config *conf = proc->conf;
+	uint32_t observer = proc->source->observer;
+	struct dedup_table *table;
+	struct dedup_entry *entry, *free_slot = NULL;
+	uint64_t hash = pending->hash, start = pending->start;
+	bool seen = false;
+	uint32_t idx;
+	int i;
+
+	if (!pending->valid) {
+		return false;
+	}
+
+	conf->records++;
+
+	/* The current generation first, then the older ones */
+	for (i = 0; i < DEDUP_GENERATIONS; ++i) {
+		table = &conf->tables[(conf->current + DEDUP_GENERATIONS - i) % DEDUP_GENERATIONS];
+		if (table->count == 0) {
+			continue;
+		}
+
+		idx = hash & table->mask;
+		for (entry = &table->slots[idx]; entry->hash; entry = &table->slots[idx]) {
+			if (entry->hash == hash && entry->domain == pending->domain
+					&& (entry->start > start ? entry->start - start : start - entry->start) <= conf->tolerance
+					&& !memcmp(entry->key, pending->key, DEDUP_KEY_LENGTH)) {
+				if (entry->observer != observer) {
+					conf->duplicates++;
+					return true;
+				}
+
+				/* The same exporter reports the flow again */
+				seen = true;
+			}
+
+			idx = (idx + 1) & table->mask;
+		}
+
+		if (i == 0) {
+			free_slot = entry;
+		}
+	}
+
+	if (seen) {
+		return false;
+	}
+
+	table = &conf->tables[conf->current];
+	if (table->count >= conf->table_limit) {
+		conf->forgotten++;
+		return false;
+	}
+
+	if (!free_slot) {
+		/* The current generation is empty */
+		free_slot = &table->slots[hash & table->mask];
+	}
+
+	free_slot->hash = hash;
+	free_slot->start = start;
+	free_slot->domain = pending->domain;
+	free_slot->observer = observer;
+	memcpy(free_slot->key, pending->key, DEDUP_KEY_LENGTH);
+	table->count++;
+	return false;
+}
+
+/**
+ * \brief Add removed part of the message
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] start Offset in the message
+ * \param[in] length Length of the part
+ */
+static inline void dedup_range_add(struct dedup_ip_config *conf, uint16_t start, uint16_t length)
+{
+	if (conf->range_count > 0) {
+		struct message_range *last = &conf->ranges[conf->range_count - 1];
+
+		if (last->start + last->length == start) {
+			last->length += length;
+			return;
+		}
+	}
+
+	conf->ranges[conf->range_count].start = start;
+	conf->ranges[conf->range_count].length = length;
+	conf->range_count++;
+}
+
+/**
+ * \brief Finish the oldest pending record
+ *
+ * Duplicates are recorded as removed parts of the message (drop mode) or
+ * their flag is cleared (tag mode).
+ *
+ * \param[in] proc Processor
+ */
+static void dedup_complete(struct dedup_processor *proc)
+{
+	struct dedup_pending *pending = &proc->pending[proc->head];
+	bool duplicate = dedup_lookup(proc, pending);
+
+	proc->head = (proc->head + 1) % DEDUP_PIPELINE;
+	proc->count--;
+
+	if (pending->flag) {
+		*pending->flag = duplicate ? 0 : 1;
+		return;
+	}
+
+	if (duplicate) {
+		dedup_range_add(proc->conf, pending->rec - proc->pkt, pending->length);
+		proc->set_removed++;
+		proc->set_bytes += pending->length;
+	}
+}
+
+/**
+ * \brief Queue data record for lookup
+ *
+ * \param[in] proc Processor
+ * \param[in] rec Data record
+ * \param[in] rec_len Record's length
+ * \param[in] flag Flag of the copied record (tag mode) or NULL
+ */
+static inline void dedup_queue(struct dedup_processor *proc, uint8_t *rec, int rec_len, uint8_t *flag)
+{
+	struct dedup_pending *pending;
+
+	if (proc->count == DEDUP_PIPELINE) {
+		dedup_complete(proc);
+	}
+
+	pending = &proc->pending[(proc->head + proc->count) % DEDUP_PIPELINE];
+	pending->rec = rec;
+	pending->length = rec_len;
+	pending->flag = flag;
+	dedup_prepare(proc, pending);
+	proc->count++;
+}
+
+/**
+ * \brief Finish all pending records
+ *
+ * \param[in] proc Processor
+ */
+static void dedup_drain(struct dedup_processor *proc)
+{
+	while (proc->count > 0) {
+		dedup_complete(proc);
+	}
+}
+
+/**
+ * \brief Process data record (drop mode)
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Record's length
+ * \param[in] templ Template
+ * \param[in] data Processor's data
+ */
+static void dedup_drop_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) templ;
+	struct dedup_processor *proc = (struct dedup_processor *) data;
+
+	proc->set_records++;
+	dedup_queue(proc, rec, rec_len, NULL);
+}
+
+/**
+ * \brief Remove duplicates from message (drop mode)
+ *
+ * \param[in] proc Processor
+ * \param[in,out] msg IPFIX message
+ * \return true if the message is empty now
+ */
+static bool dedup_drop(struct dedup_processor *proc, struct ipfix_message *msg)
+{
+	struct dedup_ip_config *conf = proc->conf;
+	struct dedup_plan plan;
+	int i;
+
+	proc->plan = &plan;
+	conf->range_count = 0;
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		struct ipfix_template *templ = msg->data_couple[i].data_template;
+		struct ipfix_data_set *set = msg->data_couple[i].data_set;
+		uint32_t first_range = conf->range_count;
+
+		if (!templ || templ->template_type != TM_TEMPLATE || dedup_make_plan(templ, &plan)) {
+			continue;
+		}
+
+		proc->set_records = proc->set_removed = proc->set_bytes = 0;
+		data_set_process_records(set, templ, &dedup_drop_record, proc);
+		dedup_drain(proc);
+		if (proc->set_removed == 0) {
+			continue;
+		}
+
+		proc->removed += proc->set_removed;
+		if (proc->set_removed == proc->set_records) {
+			/* Remove the whole set including padding */
+			conf->range_count = first_range;
+			dedup_range_add(conf, (uint8_t *) set - proc->pkt, ntohs(set->header.length));
+		} else {
+			set->header.length = htons(ntohs(set->header.length) - proc->set_bytes);
+		}
+	}
+
+	/* The plan does not outlive this function */
+	proc->plan = NULL;
+
+	if (conf->range_count == 0) {
+		return false;
+	}
+
+	message_remove_ranges(msg, conf->ranges, conf->range_count, proc->removed);
+	return !msg->data_couple[0].data_set && !msg->templ_set[0] && !msg->opt_templ_set[0];
+}
+
+/**
+ * \brief Add flag element to template record and register the new template
+ *
+ * \param[in] rec Template record
+ * \param[in] rec_len Record's length
+ * \param[in] data Processor's data
+ */
+static void dedup_tag_template(uint8_t *rec, int rec_len, void *data)
+{
+	struct dedup_processor *proc = (struct dedup_processor *) data;
+	struct dedup_ip_config *conf = proc->conf;
+	struct ipfix_template_record *record = (struct ipfix_template_record *) (proc->out + proc->offset);
+	uint16_t count = ntohs(((struct ipfix_template_record *) rec)->count);
+	uint16_t val;
+	uint32_t en;
+
+	memcpy(record, rec, rec_len);
+	proc->offset += rec_len;
+	proc->key_tm->tid = ntohs(record->template_id);
+
+	if (count == 0 || template_record_get_field((struct ipfix_template_record *) rec,
+			conf->flag_en, conf->flag_id, NULL)) {
+		/* Withdrawal, or records already carry the flag */
+		tm_remove_template(conf->tm, proc->key_tm);
+		return;
+	}
+
+	val = htons(conf->flag_en ? (conf->flag_id | 0x8000) : conf->flag_id);
+	memcpy(proc->out + proc->offset, &val, 2);
+	val = htons(1);
+	memcpy(proc->out + proc->offset + 2, &val, 2);
+	proc->offset += 4;
+	rec_len += 4;
+
+	if (conf->flag_en) {
+		en = htonl(conf->flag_en);
+		memcpy(proc->out + proc->offset, &en, 4);
+		proc->offset += 4;
+		rec_len += 4;
+	}
+
+	record->count = htons(count + 1);
+
+	if (tm_get_template(conf->tm, proc->key_tm) == NULL) {
+		if (tm_add_template(conf->tm, record, rec_len, TM_TEMPLATE, proc->key_tm) == NULL) {
+			MSG_ERROR(msg_module, "[%u] Failed to add template to template manager (template ID: %u)",
+				proc->key_tm->odid, proc->key_tm->tid);
+		}
+	} else if (tm_update_template(conf->tm, record, rec_len, TM_TEMPLATE, proc->key_tm) == NULL) {
+		MSG_ERROR(msg_module, "[%u] Failed to update template in template manager (template ID: %u)",
+			proc->key_tm->odid, proc->key_tm->tid);
+	}
+}
+
+/**
+ * \brief Copy data record with the flag element appended (tag mode)
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Record's length
+ * \param[in] templ Template
+ * \param[in] data Processor's data
+ */
+static void dedup_tag_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) templ;
+	struct dedup_processor *proc = (struct dedup_processor *) data;
+	uint8_t *dst = proc->out + proc->offset;
+
+	memcpy(dst, rec, rec_len);
+	proc->offset += rec_len + 1;
+	dedup_queue(proc, rec, rec_len, dst + rec_len);
+
+	if (proc->metadata_index < proc->metadata_count) {
+		struct metadata *mdata = &proc->metadata[proc->metadata_index];
+
+		if (mdata->record.record == rec) {
+			mdata->record.record = dst;
+			mdata->record.length = rec_len + 1;
+			mdata->record.templ = proc->new_templ;
+			proc->metadata_index++;
+		}
+	}
+}
+
+/**
+ * \brief Copy Data Set without changes (tag mode)
+ *
+ * \param[in] proc Processor
+ * \param[in] set Data Set
+ */
+static void dedup_copy_set(struct dedup_processor *proc, struct ipfix_data_set *set)
+{
+	uint16_t length = ntohs(set->header.length);
+	uint8_t *end = (uint8_t *) set + length;
+	uint8_t *dst = proc->out + proc->offset;
+
+	memcpy(dst, set, length);
+	proc->offset += length;
+
+	/* Let metadata of the records point to their new location */
+	while (proc->metadata_index < proc->metadata_count) {
+		struct metadata *mdata = &proc->metadata[proc->metadata_index];
+		uint8_t *rec = (uint8_t *) mdata->record.record;
+
+		if (rec < (uint8_t *) set || rec >= end) {
+			break;
+		}
+
+		mdata->record.record = dst + (rec - (uint8_t *) set);
+		proc->metadata_index++;
+	}
+}
+
+/**
+ * \brief Build message with flag element in all records (tag mode)
+ *
+ * \param[in] proc Processor
+ * \param[in] msg IPFIX message
+ * \return New message, NULL on error
+ */
+static struct ipfix_message *dedup_tag(struct dedup_processor *proc, struct ipfix_message *msg)
+{
+	struct dedup_ip_config *conf = proc->conf;
+	struct ipfix_template *tagged[MSG_MAX_DATA_COUPLES];
+	struct ipfix_message *new_msg;
+	struct dedup_plan plan;
+	uint32_t length = ntohs(msg->pkt_header->length);
+	uint16_t field_len = conf->flag_en ? 8 : 4;
+	int i, j;
+
+	/* Every template record grows by one field, every tagged data record by one byte */
+	for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
+		length += template_set_process_records(msg->templ_set[i], TM_TEMPLATE, NULL, NULL) * field_len;
+	}
+
+	proc->out = malloc(MSG_MAX_LENGTH);
+	new_msg = calloc(1, sizeof(struct ipfix_message));
+	if (!proc->out || !new_msg) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(proc->out);
+		free(new_msg);
+		return NULL;
+	}
+
+	memcpy(proc->out, msg->pkt_header, IPFIX_HEADER_LENGTH);
+	new_msg->pkt_header = (struct ipfix_header *) proc->out;
+	proc->offset = IPFIX_HEADER_LENGTH;
+
+	/* Template sets are rewritten, templates with the flag are registered */
+	for (i = 0, j = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
+		struct ipfix_set_header *header;
+
+		if (length > MSG_MAX_LENGTH) {
+			break;
+		}
+
+		header = (struct ipfix_set_header *) (proc->out + proc->offset);
+		memcpy(header, &msg->templ_set[i]->header, sizeof(*header));
+		proc->offset += sizeof(*header);
+
+		template_set_process_records(msg->templ_set[i], TM_TEMPLATE, &dedup_tag_template, proc);
+		header->length = htons((proc->out + proc->offset) - (uint8_t *) header);
+		new_msg->templ_set[j++] = (struct ipfix_template_set *) header;
+	}
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		struct ipfix_template *templ = msg->data_couple[i].data_template;
+
+		tagged[i] = NULL;
+		if (!templ || templ->template_type != TM_TEMPLATE) {
+			continue;
+		}
+
+		proc->key_tm->tid = templ->template_id;
+		tagged[i] = tm_get_template(conf->tm, proc->key_tm);
+		if (tagged[i]) {
+			length += data_set_records_count(msg->data_couple[i].data_set, templ);
+		}
+	}
+
+	if (length > MSG_MAX_LENGTH) {
+		MSG_WARNING(msg_module, "[%u] Length of IPFIX message with flags exceeds maximum (%u); dropping message",
+			msg->input_info->odid, length);
+		free(proc->out);
+		free(new_msg);
+		return NULL;
+	}
+
+	for (i = 0; i < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[i]; ++i) {
+		uint16_t set_len = ntohs(msg->opt_templ_set[i]->header.length);
+
+		memcpy(proc->out + proc->offset, msg->opt_templ_set[i], set_len);
+		new_msg->opt_templ_set[i] = (struct ipfix_options_template_set *) (proc->out + proc->offset);
+		proc->offset += set_len;
+	}
+
+	proc->plan = &plan;
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		struct ipfix_data_set *set = msg->data_couple[i].data_set;
+		struct ipfix_data_set *new_set = (struct ipfix_data_set *) (proc->out + proc->offset);
+		struct ipfix_template *templ = msg->data_couple[i].data_template;
+
+		new_msg->data_couple[i].data_set = new_set;
+		new_msg->data_couple[i].data_template = tagged[i] ? tagged[i] : templ;
+		if (new_msg->data_couple[i].data_template) {
+			tm_template_reference_inc(new_msg->data_couple[i].data_template);
+		}
+
+		if (!tagged[i]) {
+			dedup_copy_set(proc, set);
+			continue;
+		}
+
+		/* Records without flow key are tagged as first observations */
+		dedup_make_plan(templ, &plan);
+
+		memcpy(new_set, &set->header, sizeof(struct ipfix_set_header));
+		proc->offset += sizeof(struct ipfix_set_header);
+		proc->new_templ = tagged[i];
+		data_set_process_records(set, templ, &dedup_tag_record, proc);
+		dedup_drain(proc);
+		new_set->header.length = htons((proc->out + proc->offset) - (uint8_t *) new_set);
+	}
+	proc->plan = NULL;
+
+	new_msg->pkt_header->length = htons(proc->offset);
+	new_msg->input_info = msg->input_info;
+	new_msg->templ_records_count = msg->templ_records_count;
+	new_msg->opt_templ_records_count = msg->opt_templ_records_count;
+	new_msg->data_records_count = msg->data_records_count;
+	new_msg->source_status = msg->source_status;
+	new_msg->live_profile = msg->live_profile;
+	new_msg->watermark = msg->watermark;
+	new_msg->plugin_id = msg->plugin_id;
+	new_msg->plugin_status = msg->plugin_status;
+	new_msg->metadata = msg->metadata;
+	msg->metadata = NULL;
+
+	return new_msg;
+}
+
+int intermediate_process_message(void *config, void *message)
+{
+	struct dedup_ip_config *conf = (struct dedup_ip_config *) config;
+	struct ipfix_message *msg = (struct ipfix_message *) message;
+	struct ipfix_message *new_msg;
+	struct dedup_processor proc;
+	uint32_t odid = msg->input_info->odid;
+
+	if (msg->source_status == SOURCE_STATUS_CLOSED) {
+		dedup_remove_source(conf, msg->input_info, odid);
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	memset(&proc, 0, sizeof(proc));
+	proc.conf = conf;
+	proc.source = dedup_get_source(conf, msg->input_info, odid);
+	if (!proc.source || (proc.source->domain < 0 && proc.source->iface_count == 0)) {
+		/* Source does not take part in deduplication */
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	proc.pkt = (uint8_t *) msg->pkt_header;
+	proc.export_time = (uint64_t) ntohl(msg->pkt_header->export_time) * 1000;
+	dedup_advance(conf, ntohl(msg->pkt_header->export_time));
+
+	if (conf->mode == DEDUP_DROP) {
+		if (dedup_drop(&proc, msg)) {
+			/* Everything was a duplicate */
+			drop_message(conf->ip_config, message);
+			return 0;
+		}
+
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	/* Templates of different exporters with the same ODID must not collide */
+	proc.key_tm = tm_key_create(odid, conf->ip_id | (proc.source->observer << 16), 0);
+	if (!proc.key_tm) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	proc.metadata = msg->metadata;
+	proc.metadata_count = msg->metadata ? msg->data_records_count : 0;
+	new_msg = dedup_tag(&proc, msg);
+	tm_key_destroy(proc.key_tm);
+
+	drop_message(conf->ip_config, message);
+	if (new_msg) {
+		pass_message(conf->ip_config, new_msg);
+	}
+
+	return 0;
+}
+
+int intermediate_close(void *config)
+{
+	struct dedup_ip_config *conf = (struct dedup_ip_config *) config;
+	struct dedup_member *member;
+	struct dedup_source *source;
+	int i;
+
+	if (conf->records > 0) {
+		MSG_INFO(msg_module, "%" PRIu64 " of %" PRIu64 " checked records were duplicates",
+			conf->duplicates, conf->records);
+	}
+
+	if (conf->forgotten > 0) {
+		MSG_WARNING(msg_module, "%" PRIu64 " flows were not remembered (maxFlows reached)", conf->forgotten);
+	}
+
+	while (conf->members) {
+		member = conf->members;
+		conf->members = member->next;
+		free(member);
+	}
+
+	while (conf->sources) {
+		source = conf->sources;
+		conf->sources = source->next;
+		free(source->ifaces);
+		free(source);
+	}
+
+	for (i = 0; i < DEDUP_GENERATIONS; ++i) {
+		free(conf->tables[i].slots);
+	}
+
+	free(conf->ranges);
+	free(conf);
+
+	return 0;
+}
+
+/**@}*/
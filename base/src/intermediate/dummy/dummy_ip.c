@@ -55,6 +55,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 static char *msg_module = "dummy intermediate process";
 
 /* plugin's configuration structure */
@@ -70,6 +70,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 static const char *msg_module = "filter";
 
 /**
@@ -679,6 +682,7 @@ uint32_t filter_profile_update_input_info(struct filter_profile *profile, struct
 void filter_copy_metainfo(struct ipfix_message *src, struct ipfix_message *dst)
 {
 	dst->live_profile = src->live_profile;
+	dst->watermark = src->watermark;
 	dst->plugin_id = src->plugin_id;
 	dst->plugin_status = src->plugin_status;
 	dst->source_status = src->source_status;
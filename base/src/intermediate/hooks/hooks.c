@@ -65,6 +65,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 /* module name for MSG_* */
 static const char *msg_module = "hooks";
 
@@ -59,6 +59,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 #define ORIGINAL_ODID_FIELD 405
 
 /* module name for MSG_* */
@@ -712,8 +715,10 @@ void data_processor(uint8_t *rec, int rec_len, struct ipfix_template *templ, voi
 	(void) templ;
 
 	memcpy(proc->msg + proc->offset, rec, rec_len);
-	proc->metadata[proc->metadata_index].record.record = proc->msg + proc->offset;
-	proc->metadata[proc->metadata_index].record.length = rec_len;
+	if (proc->metadata) {
+		proc->metadata[proc->metadata_index].record.record = proc->msg + proc->offset;
+		proc->metadata[proc->metadata_index].record.length = rec_len;
+	}
 
 	proc->offset += rec_len;
 	proc->length += rec_len;
@@ -722,7 +727,9 @@ void data_processor(uint8_t *rec, int rec_len, struct ipfix_template *templ, voi
 		memcpy(proc->msg + proc->offset, &(proc->orig_odid), 4);
 		proc->offset += 4;
 		proc->length += 4;
-		proc->metadata[proc->metadata_index].record.length += 4;
+		if (proc->metadata) {
+			proc->metadata[proc->metadata_index].record.length += 4;
+		}
 	}
 
 	proc->metadata_index++;
@@ -893,6 +900,7 @@ int intermediate_process_message(void *config, void *message)
 	proc.trecords = 0;
 	new_msg->pkt_header = (struct ipfix_header *) proc.msg;
 	new_msg->live_profile = msg->live_profile;
+	new_msg->watermark = msg->watermark;
 	new_msg->metadata = msg->metadata;
 	msg->metadata = NULL;
 
@@ -976,7 +984,7 @@ int intermediate_process_message(void *config, void *message)
 		new_msg->data_couple[new_i].data_set->header.flowset_id = htons(new_msg->data_couple[new_i].data_template->template_id);
 		
 		/* Update templates in metadata */
-		while (metadata_index < msg->data_records_count &&
+		while (new_msg->metadata && metadata_index < msg->data_records_count &&
 			   metadata_index < proc.metadata_index &&
 			   new_msg->metadata[metadata_index].record.templ == templ) {
 			new_msg->metadata[metadata_index].record.templ = map->new_templ->templ;
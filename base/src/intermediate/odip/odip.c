@@ -57,6 +57,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 #define ODIP4_FIELD  403
 #define ODIP6_FIELD  404
 #define ODIP4_LENGTH 4
@@ -191,8 +194,10 @@ void data_processor(uint8_t *rec, int rec_len, struct ipfix_template *templ, voi
 
 	/* copy whole data record */
 	memcpy(proc->msg + proc->offset, rec, rec_len);
-	proc->metadata[proc->metadata_index].record.record = (proc->msg + proc->offset);
-	proc->metadata[proc->metadata_index].record.length = rec_len;
+	if (proc->metadata) {
+		proc->metadata[proc->metadata_index].record.record = (proc->msg + proc->offset);
+		proc->metadata[proc->metadata_index].record.length = rec_len;
+	}
 
 	proc->offset += rec_len;
 	proc->length += rec_len;
@@ -209,7 +214,9 @@ void data_processor(uint8_t *rec, int rec_len, struct ipfix_template *templ, voi
 		memcpy(proc->msg + proc->offset, &(proc->info->src_addr), size);
 		proc->offset += size;
 		proc->length += size;
-		proc->metadata[proc->metadata_index].record.length += size;
+		if (proc->metadata) {
+			proc->metadata[proc->metadata_index].record.length += size;
+		}
 	}
 
 	proc->metadata_index++;
@@ -361,7 +368,7 @@ int intermediate_process_message(void *config, void *message)
 		new_msg->data_couple[new_i].data_set->header.flowset_id = htons(new_msg->data_couple[new_i].data_template->template_id);
 
 		/* Update templates in metadata */
-		while (metadata_index < msg->data_records_count
+		while (new_msg->metadata && metadata_index < msg->data_records_count
 			   && metadata_index < proc.metadata_index
 			   && new_msg->metadata[metadata_index].record.templ == templ) {
 			new_msg->metadata[metadata_index].record.templ = new_templ;
@@ -381,6 +388,7 @@ int intermediate_process_message(void *config, void *message)
 	new_msg->data_records_count = msg->data_records_count;
 	new_msg->source_status = msg->source_status;
 	new_msg->live_profile = msg->live_profile;
+	new_msg->watermark = msg->watermark;
 	new_msg->plugin_id = msg->plugin_id;
 	new_msg->plugin_status = msg->plugin_status;
 
@@ -0,0 +1,1150 @@
+/**
+ * \file order_ip.c
+ * \brief Intermediate Process releasing records in order of flow start
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+/**
+ * \defgroup orderInter Order Intermediate Process
+ * \ingroup intermediatePlugins
+ *
+ * This plugin holds data records for a limited time (lateness) and releases
+ * them in order of flow start. Records are kept in a ring of one-second
+ * buckets of each ODID; a bucket is sorted and released when the event time
+ * clock of the ODID passes its end by the lateness. The clock follows export
+ * time of messages and moves on with the system clock between them.
+ *
+ * Generated messages carry a watermark (see ipfix_message::watermark): the
+ * start of the time window of their records. Once the clock passes the end
+ * of a window, all its records have been released and the following window
+ * is announced, by an empty message when there are no records. Storage
+ * plugins use watermarks to close their windows (storage_window_watermark()).
+ *
+ * Records arriving after their bucket was released (late records) and records
+ * too far ahead of the clock are passed at once. Records without flow start
+ * and Options Data are passed unchanged in the original message.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <ipfixcol.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+/* API version constant */
+IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
+/* module name for MSG_* */
+static const char *msg_module = "order";
+
+/* Defaults */
+#define ORD_LATENESS        30      /* seconds */
+#define ORD_WINDOW          300     /* seconds */
+#define ORD_MAX_RECORDS     1000000
+#define ORD_HORIZON         60      /* Seconds ahead of the clock kept in buckets */
+
+/* Flow start fields */
+#define ORD_START_SEC       150 /* flowStartSeconds */
+#define ORD_START_MSEC      152 /* flowStartMilliseconds */
+#define ORD_START_USEC      154 /* flowStartMicroseconds */
+#define ORD_START_NSEC      156 /* flowStartNanoseconds */
+
+/** Seconds between NTP (1900) and Unix (1970) epoch */
+#define ORD_NTP_OFFSET      2208988800ULL
+
+/** Length of fields of template */
+#define ORD_FIELDS_LENGTH(templ) \
+	((templ)->template_length - sizeof(struct ipfix_template) + sizeof(template_ie))
+
+/*
+ * Template of records of one ODID. The plugin keeps its own copy, so that
+ * held records and generated messages do not depend on the Template Manager.
+ */
+struct ord_template {
+	struct ipfix_template *templ;   /* Copy of the template */
+	uint8_t *record;                /* Template Record in network byte order */
+	uint16_t record_length;
+	uint32_t odid;                  /* Observation Domain ID */
+	bool stale;                     /* Replaced by a newer template */
+	bool variable;                  /* Template has variable-length fields */
+	uint32_t holders;               /* Number of held records */
+	int start_offset;               /* Offset of flow start (-1 = missing) */
+	uint16_t start_id;              /* Field ID of flow start */
+	struct ord_template *next;
+};
+
+/* Held record */
+struct ord_entry {
+	uint64_t start;                 /* Flow start in milliseconds */
+	uint32_t seq;                   /* Order of arrival in bucket */
+	uint32_t offset;                /* Offset of the record in bucket data */
+	uint16_t length;                /* Length of the record */
+	struct ord_template *tmpl;
+};
+
+/* Records of one second of flow start */
+struct ord_bucket {
+	struct ord_entry *entries;
+	uint32_t count, capacity;
+	uint8_t *data;                  /* Copies of records */
+	uint32_t used, size;
+};
+
+/* Ordering state and message being built for one ODID */
+struct ord_domain {
+	uint32_t odid;                  /* Observation Domain ID */
+	struct input_info *input_info;  /* Input info of generated messages */
+	struct ord_bucket *buckets;     /* Ring of one-second buckets */
+	uint32_t held;                  /* Number of held records */
+	uint64_t clock;                 /* Event time in milliseconds (0 = unknown) */
+	uint64_t wall;                  /* System clock at the last clock update */
+	uint64_t released;              /* Records starting before were released */
+	uint64_t sent;                  /* Last passed watermark */
+	uint64_t window;                /* Watermark of the message being built */
+	struct ipfix_message *msg;      /* Message being built (NULL = none) */
+	uint16_t offset;                /* Used part of the message */
+	uint16_t records;               /* Number of data records */
+	uint16_t couples;               /* Number of data sets */
+	uint16_t templ_sets;            /* Number of template sets */
+	struct ord_domain *next;
+};
+
+/* plugin's configuration structure */
+struct order_ip_config {
+	void *ip_config;                /* internal process configuration */
+	uint32_t lateness;              /* Maximal delay of records in seconds */
+	uint32_t window;                /* Size of time windows in seconds */
+	uint32_t max_records;           /* Maximal number of held records */
+	bool drop_late;                 /* Drop late records instead of passing them */
+	uint32_t stat_interval;         /* Interval of statistics messages */
+	uint32_t ring;                  /* Number of buckets (power of two) */
+
+	struct ord_template *templates;
+	struct ord_domain *domains;
+	uint64_t held;                  /* Number of held records of all ODIDs */
+
+	time_t now;                     /* Time of processed message */
+	uint64_t wall;                  /* Monotonic time of processed message in ms */
+	time_t collected;               /* Time of the last release of templates */
+	time_t reported;                /* Time of the last statistics message */
+
+	uint64_t ordered;               /* Number of records released in order */
+	uint64_t late;                  /* Number of late records */
+	uint64_t dropped;               /* Number of dropped late records */
+	uint64_t ahead;                 /* Number of records ahead of the clock */
+	uint64_t forced;                /* Number of records released early (buffer full) */
+};
+
+/* struct for data records processing */
+struct ord_processor {
+	struct order_ip_config *conf;
+	struct ord_domain *dom;
+	struct ord_template *tmpl;
+	uint64_t export_time;           /* Export time of the message in ms */
+};
+
+/**
+ * \brief Monotonic time in milliseconds
+ */
+static uint64_t ord_wall(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * \brief Start of the time window of event time
+ */
+static inline uint64_t ord_window_start(const struct order_ip_config *conf, uint64_t time)
+{
+	return time - time % ((uint64_t) conf->window * 1000);
+}
+
+/**
+ * \brief Parse plugin configuration
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] params XML configuration
+ * \return 0 on success
+ */
+static int ord_parse_config(struct order_ip_config *conf, char *params)
+{
+	xmlDoc *doc = NULL;
+	xmlNode *root = NULL, *curr = NULL;
+	int ret = 0;
+
+	doc = xmlParseDoc(BAD_CAST params);
+	if (!doc) {
+		MSG_ERROR(msg_module, "Cannot parse config xml!");
+		return 1;
+	}
+
+	root = xmlDocGetRootElement(doc);
+	if (!root) {
+		MSG_ERROR(msg_module, "Cannot get document root element!");
+		xmlFreeDoc(doc);
+		return 1;
+	}
+
+	for (curr = root->children; curr != NULL && ret == 0; curr = curr->next) {
+		if (curr->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		char *value = (char *) xmlNodeGetContent(curr);
+		if (!value) {
+			continue;
+		}
+
+		if (!xmlStrcmp(curr->name, (const xmlChar *) "lateness")) {
+			conf->lateness = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "windowSize")) {
+			conf->window = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "maxRecords")) {
+			conf->max_records = strtoul(value, NULL, 10);
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "lateRecords")) {
+			if (!strcasecmp(value, "pass")) {
+				conf->drop_late = false;
+			} else if (!strcasecmp(value, "drop")) {
+				conf->drop_late = true;
+			} else {
+				MSG_ERROR(msg_module, "Invalid value of lateRecords: '%s'", value);
+				ret = 1;
+			}
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "statisticsInterval")) {
+			conf->stat_interval = strtoul(value, NULL, 10);
+		}
+
+		xmlFree(value);
+	}
+
+	xmlFreeDoc(doc);
+
+	if (ret) {
+		return ret;
+	}
+
+	if (conf->window == 0) {
+		MSG_ERROR(msg_module, "Invalid window size %u", conf->window);
+		return 1;
+	}
+
+	if (conf->lateness > 86400) {
+		MSG_ERROR(msg_module, "Lateness %u s is longer than one day", conf->lateness);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Initialize order plugin
+ *
+ * \param[in] params Plugin parameters
+ * \param[in] ip_config Internal process configuration
+ * \param[in] ip_id Source ID into Template Manager
+ * \param[in] template_mgr Template Manager
+ * \param[out] config Plugin configuration
+ * \return 0 if everything OK
+ */
+int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfix_template_mgr *template_mgr, void **config)
+{
+	(void) ip_id;
+	(void) template_mgr;
+	struct order_ip_config *conf;
+
+	conf = (struct order_ip_config *) calloc(1, sizeof(*conf));
+	if (!conf) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	conf->ip_config = ip_config;
+	conf->lateness = ORD_LATENESS;
+	conf->window = ORD_WINDOW;
+	conf->max_records = ORD_MAX_RECORDS;
+
+	if (params && ord_parse_config(conf, params)) {
+		intermediate_close(conf);
+		return -1;
+	}
+
+	for (conf->ring = 2; conf->ring < conf->lateness + ORD_HORIZON + 1; conf->ring *= 2);
+
+	MSG_INFO(msg_module, "Ordering records with lateness %u s in windows of %u s, at most %u held records",
+		conf->lateness, conf->window, conf->max_records);
+
+	conf->collected = conf->reported = time(NULL);
+	*config = conf;
+	MSG_INFO(msg_module, "Plugin initialization completed successfully");
+	return 0;
+}
+
+/**
+ * \brief Find flow start field of template
+ *
+ * The most precise of flowStart* fields is used.
+ *
+ * \param[in,out] tmpl Template
+ */
+static void ord_locate_start(struct ord_template *tmpl)
+{
+	static const struct {
+		uint16_t id;
+		uint16_t length;
+	} fields[] = {
+		{ORD_START_MSEC, 8}, {ORD_START_USEC, 8}, {ORD_START_NSEC, 8}, {ORD_START_SEC, 4}
+	};
+	struct ipfix_template_row *row;
+	unsigned int i;
+	int offset;
+
+	tmpl->start_offset = -1;
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+		row = template_get_field(tmpl->templ, 0, fields[i].id, &offset);
+		if (row && row->length == fields[i].length) {
+			tmpl->start_offset = offset;
+			tmpl->start_id = fields[i].id;
+			return;
+		}
+	}
+}
+
+/**
+ * \brief Free template
+ */
+static void ord_template_free(struct ord_template *tmpl)
+{
+	free(tmpl->record);
+	free(tmpl->templ);
+	free(tmpl);
+}
+
+/**
+ * \brief Get plugin's copy of template, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] odid ODID
+ * \param[in] templ Template from Template Manager
+ * \return Template or NULL
+ */
+static struct ord_template *ord_get_template(struct order_ip_config *conf,
+	uint32_t odid, struct ipfix_template *templ)
+{
+	struct ord_template *tmpl;
+
+	for (tmpl = conf->templates; tmpl; tmpl = tmpl->next) {
+		if (tmpl->stale || tmpl->odid != odid || tmpl->templ->template_id != templ->template_id) {
+			continue;
+		}
+
+		if (tmpl->templ->template_type == templ->template_type
+				&& tmpl->templ->template_length == templ->template_length
+				&& !memcmp(tmpl->templ->fields, templ->fields, ORD_FIELDS_LENGTH(templ))) {
+			return tmpl;
+		}
+
+		/* Template has changed, records held so far keep the old one */
+		tmpl->stale = true;
+		break;
+	}
+
+	tmpl = calloc(1, sizeof(*tmpl));
+	if (!tmpl) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	tmpl->templ = malloc(templ->template_length);
+	if (!tmpl->templ) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(tmpl);
+		return NULL;
+	}
+
+	memcpy(tmpl->templ, templ, templ->template_length);
+	tmpl->templ->references = 0;
+	tmpl->templ->next = NULL;
+	tmpl->odid = odid;
+	tmpl->variable = (templ->data_length & 0x80000000);
+	ord_locate_start(tmpl);
+
+	if (!(tmpl->record = template_create_record(tmpl->templ, &tmpl->record_length))) {
+		ord_template_free(tmpl);
+		return NULL;
+	}
+
+	tmpl->next = conf->templates;
+	conf->templates = tmpl;
+	return tmpl;
+}
+
+/**
+ * \brief Free templates that are no longer used
+ *
+ * Templates are used by held records and by generated messages that have
+ * not been processed by storage plugins yet (template references).
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] all Free all templates (plugin is closing)
+ */
+static void ord_collect(struct order_ip_config *conf, bool all)
+{
+	struct ord_template **tmpl_ptr = &conf->templates, *tmpl;
+
+	while ((tmpl = *tmpl_ptr)) {
+		if (all || (tmpl->stale && tmpl->holders == 0 && tmpl->templ->references == 0)) {
+			*tmpl_ptr = tmpl->next;
+			ord_template_free(tmpl);
+		} else {
+			tmpl_ptr = &tmpl->next;
+		}
+	}
+}
+
+/**
+ * \brief Find domain of ODID, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] odid ODID
+ * \param[in] input_info Input info used as a base for generated messages
+ * \return Domain or NULL
+ */
+static struct ord_domain *ord_get_domain(struct order_ip_config *conf,
+	uint32_t odid, struct input_info *input_info)
+{
+	struct ord_domain *dom;
+	size_t size;
+
+	for (dom = conf->domains; dom; dom = dom->next) {
+		if (dom->odid == odid) {
+			return dom;
+		}
+	}
+
+	if (!input_info) {
+		return NULL;
+	}
+
+	dom = calloc(1, sizeof(*dom));
+	if (!dom) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	size = (input_info->type == SOURCE_TYPE_IPFIX_FILE)
+		? sizeof(struct input_info_file) : sizeof(struct input_info_network);
+	dom->input_info = calloc(1, size);
+	dom->buckets = calloc(conf->ring, sizeof(struct ord_bucket));
+	if (!dom->input_info || !dom->buckets) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(dom->input_info);
+		free(dom->buckets);
+		free(dom);
+		return NULL;
+	}
+
+	memcpy(dom->input_info, input_info, size);
+	dom->input_info->odid = odid;
+	dom->input_info->sequence_number = 0;
+	dom->odid = odid;
+	dom->wall = conf->wall;
+	dom->next = conf->domains;
+	conf->domains = dom;
+	return dom;
+}
+
+/**
+ * \brief Fill metadata of generated message
+ */
+static void ord_fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	struct ipfix_message *msg = (struct ipfix_message *) data;
+	struct metadata *mdata = &msg->metadata[msg->data_records_count++];
+
+	mdata->record.record = rec;
+	mdata->record.length = rec_len;
+	mdata->record.templ = templ;
+}
+
+/**
+ * \brief Start a new message of domain
+ *
+ * \param[in,out] dom Domain
+ * \return 0 on success
+ */
+static int ord_message_new(struct ord_domain *dom)
+{
+	struct ipfix_message *msg;
+	uint8_t *pkt;
+
+	msg = calloc(1, sizeof(struct ipfix_message));
+	pkt = malloc(MSG_MAX_LENGTH);
+	if (!msg || !pkt) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(msg);
+		free(pkt);
+		return 1;
+	}
+
+	msg->pkt_header = (struct ipfix_header *) pkt;
+	dom->msg = msg;
+	dom->offset = IPFIX_HEADER_LENGTH;
+	return 0;
+}
+
+/**
+ * \brief Pass message built for one ODID
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] dom Domain
+ */
+static void ord_flush(struct order_ip_config *conf, struct ord_domain *dom)
+{
+	struct ipfix_message *msg = dom->msg;
+	int i;
+
+	if (!msg) {
+		return;
+	}
+
+	dom->msg = NULL;
+
+	if (dom->records > 0) {
+		msg->metadata = calloc(dom->records, sizeof(struct metadata));
+		if (!msg->metadata) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			free(msg->pkt_header);
+			free(msg);
+			return;
+		}
+	}
+
+	msg->pkt_header->version = htons(IPFIX_VERSION);
+	msg->pkt_header->length = htons(dom->offset);
+	msg->pkt_header->export_time = htonl(conf->now);
+	msg->pkt_header->sequence_number = htonl(dom->input_info->sequence_number);
+	msg->pkt_header->observation_domain_id = htonl(dom->odid);
+
+	for (i = 0; i < dom->couples; ++i) {
+		data_set_process_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template,
+			&ord_fill_metadata, msg);
+		tm_template_reference_inc(msg->data_couple[i].data_template);
+	}
+
+	msg->input_info = dom->input_info;
+	msg->source_status = SOURCE_STATUS_OPENED;
+	msg->templ_records_count = dom->templ_sets;
+	msg->watermark = dom->window;
+
+	if (dom->window > dom->sent) {
+		dom->sent = dom->window;
+	}
+
+	dom->input_info->sequence_number += dom->records;
+	dom->offset = 0;
+	dom->records = 0;
+	dom->couples = 0;
+	dom->templ_sets = 0;
+
+	pass_message(conf->ip_config, msg);
+}
+
+/**
+ * \brief Reserve space for data record in message being built
+ *
+ * The template is announced in the message before its first data set.
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] dom Domain
+ * \param[in] tmpl Template of the record
+ * \param[in] length Length of the data record
+ * \return Space for the record or NULL
+ */
+static uint8_t *ord_reserve(struct order_ip_config *conf, struct ord_domain *dom,
+	struct ord_template *tmpl, uint16_t length)
+{
+	struct ipfix_template *templ = tmpl->templ;
+	struct ipfix_data_set *set;
+	uint8_t *pkt, *ptr;
+	uint32_t needed;
+	bool announced = false;
+	int i;
+
+	if ((uint32_t) IPFIX_HEADER_LENGTH + 8 + tmpl->record_length + length > MSG_MAX_LENGTH) {
+		return NULL;
+	}
+
+	if (dom->msg && dom->couples > 0 && dom->msg->data_couple[dom->couples - 1].data_template == templ) {
+		/* Append to the last data set */
+		if ((uint32_t) dom->offset + length <= MSG_MAX_LENGTH) {
+			set = dom->msg->data_couple[dom->couples - 1].data_set;
+			goto append;
+		}
+
+		ord_flush(conf, dom);
+	}
+
+	if (dom->msg) {
+		for (i = 0; i < dom->couples && !announced; ++i) {
+			announced = (dom->msg->data_couple[i].data_template == templ);
+		}
+
+		needed = (uint32_t) dom->offset + 4 + length + (announced ? 0 : 4 + tmpl->record_length);
+		if (needed > MSG_MAX_LENGTH || dom->couples == MSG_MAX_DATA_COUPLES
+				|| (!announced && dom->templ_sets == MSG_MAX_TEMPL_SETS)) {
+			ord_flush(conf, dom);
+			announced = false;
+		}
+	}
+
+	if (!dom->msg && ord_message_new(dom)) {
+		return NULL;
+	}
+
+	pkt = (uint8_t *) dom->msg->pkt_header;
+
+	if (!announced) {
+		struct ipfix_template_set *tset = (struct ipfix_template_set *) (pkt + dom->offset);
+
+		tset->header.flowset_id = htons(IPFIX_TEMPLATE_FLOWSET_ID);
+		tset->header.length = htons(4 + tmpl->record_length);
+		memcpy(&tset->first_record, tmpl->record, tmpl->record_length);
+		dom->msg->templ_set[dom->templ_sets++] = tset;
+		dom->offset += 4 + tmpl->record_length;
+	}
+
+	set = (struct ipfix_data_set *) (pkt + dom->offset);
+	set->header.flowset_id = htons(templ->template_id);
+	set->header.length = htons(4);
+	dom->msg->data_couple[dom->couples].data_set = set;
+	dom->msg->data_couple[dom->couples].data_template = templ;
+	dom->couples++;
+	dom->offset += 4;
+
+append:
+	ptr = (uint8_t *) dom->msg->pkt_header + dom->offset;
+	set->header.length = htons(ntohs(set->header.length) + length);
+	dom->offset += length;
+	dom->records++;
+	return ptr;
+}
+
+/**
+ * \brief Emit data record in message of time window
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] dom Domain
+ * \param[in] tmpl Template of the record
+ * \param[in] rec Data record
+ * \param[in] length Length of the record
+ * \param[in] window Watermark of the message (start of time window)
+ */
+static void ord_emit(struct order_ip_config *conf, struct ord_domain *dom,
+	struct ord_template *tmpl, const uint8_t *rec, uint16_t length, uint64_t window)
+{
+	uint8_t *ptr;
+
+	if (dom->msg && dom->window != window) {
+		ord_flush(conf, dom);
+	}
+
+	dom->window = window;
+	ptr = ord_reserve(conf, dom, tmpl, length);
+	if (ptr) {
+		memcpy(ptr, rec, length);
+	}
+}
+
+/**
+ * \brief Announce time window to storage plugins
+ *
+ * An empty message is passed when no record of the window was released.
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] dom Domain
+ * \param[in] watermark Start of the window
+ */
+static void ord_announce(struct order_ip_config *conf, struct ord_domain *dom, uint64_t watermark)
+{
+	if (dom->msg) {
+		if (dom->window >= watermark) {
+			return;
+		}
+
+		ord_flush(conf, dom);
+	}
+
+	if (watermark <= dom->sent || ord_message_new(dom)) {
+		return;
+	}
+
+	dom->window = watermark;
+	ord_flush(conf, dom);
+}
+
+/**
+ * \brief Compare held records by flow start and order of arrival
+ */
+static int ord_compare(const void *a, const void *b)
+{
+	const struct ord_entry *x = a, *y = b;
+
+	if (x->start != y->start) {
+		return (x->start < y->start) ? -1 : 1;
+	}
+
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+/**
+ * \brief Release records of bucket in order of flow start
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in,out] dom Domain
+ * \param[in,out] bucket Bucket
+ */
+static void ord_release_bucket(struct order_ip_config *conf, struct ord_domain *dom,
+	struct ord_bucket *bucket)
+{
+	uint32_t i;
+
+	if (bucket->count == 0) {
+		return;
+	}
+
+	qsort(bucket->entries, bucket->count, sizeof(struct ord_entry), ord_compare);
+
+	for (i = 0; i < bucket->count; ++i) {
+		struct ord_entry *entry = &bucket->entries[i];
+
+		ord_emit(conf, dom, entry->tmpl, bucket->data + entry->offset, entry->length,
+			ord_window_start(conf, entry->start));
+		entry->tmpl->holders--;
+	}
+
+	dom->held -= bucket->count;
+	conf->held -= bucket->count;
+	conf->ordered += bucket->count;
+	bucket->count = 0;
+	bucket->used = 0;
+}
+
+/**
+ * \brief Release records starting before given time
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in,out] dom Domain
+ * \param[in] until Time in milliseconds aligned to seconds
+ */
+static void ord_release(struct order_ip_config *conf, struct ord_domain *dom, uint64_t until)
+{
+	uint64_t sec;
+
+	if (until <= dom->released) {
+		return;
+	}
+
+	/* Buckets are visited at most once, then all of them are empty */
+	for (sec = dom->released / 1000; sec < until / 1000 && dom->held > 0; ++sec) {
+		ord_release_bucket(conf, dom, &dom->buckets[sec & (conf->ring - 1)]);
+	}
+
+	dom->released = until;
+	ord_announce(conf, dom, ord_window_start(conf, until));
+}
+
+/**
+ * \brief Move event time clock of domain and release records
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in,out] dom Domain
+ * \param[in] export_time Export time of processed message in ms (0 = none)
+ */
+static void ord_tick(struct order_ip_config *conf, struct ord_domain *dom, uint64_t export_time)
+{
+	uint64_t lateness = (uint64_t) conf->lateness * 1000;
+
+	if (dom->clock) {
+		/* Time passes between messages too */
+		dom->clock += conf->wall - dom->wall;
+	}
+
+	dom->wall = conf->wall;
+	if (export_time > dom->clock) {
+		dom->clock = export_time;
+	}
+
+	if (dom->clock <= lateness) {
+		return;
+	}
+
+	if (dom->released == 0) {
+		/* First message, earlier records are late */
+		dom->released = (dom->clock - lateness) / 1000 * 1000;
+		return;
+	}
+
+	ord_release(conf, dom, (dom->clock - lateness) / 1000 * 1000);
+}
+
+/**
+ * \brief Pass record at once, in the message being built
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in,out] dom Domain
+ * \param[in] tmpl Template of the record
+ * \param[in] rec Data record
+ * \param[in] length Length of the record
+ */
+static void ord_pass(struct order_ip_config *conf, struct ord_domain *dom,
+	struct ord_template *tmpl, const uint8_t *rec, uint16_t length)
+{
+	ord_emit(conf, dom, tmpl, rec, length, dom->msg ? dom->window : dom->sent);
+}
+
+/**
+ * \brief Hold record in bucket of its flow start
+ *
+ * \return 0 on success
+ */
+static int ord_hold(struct order_ip_config *conf, struct ord_domain *dom,
+	struct ord_template *tmpl, uint64_t start, const uint8_t *rec, uint16_t length)
+{
+	struct ord_bucket *bucket = &dom->buckets[(start / 1000) & (conf->ring - 1)];
+	struct ord_entry *entry;
+
+	if (bucket->count == bucket->capacity) {
+		uint32_t capacity = bucket->capacity ? bucket->capacity * 2 : 64;
+
+		entry = realloc(bucket->entries, capacity * sizeof(struct ord_entry));
+		if (!entry) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		bucket->entries = entry;
+		bucket->capacity = capacity;
+	}
+
+	if (bucket->used + length > bucket->size) {
+		uint32_t size = bucket->size ? bucket->size : 4096;
+		uint8_t *data;
+
+		while (bucket->used + length > size) {
+			size *= 2;
+		}
+
+		data = realloc(bucket->data, size);
+		if (!data) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		bucket->data = data;
+		bucket->size = size;
+	}
+
+	entry = &bucket->entries[bucket->count];
+	entry->start = start;
+	entry->seq = bucket->count++;
+	entry->offset = bucket->used;
+	entry->length = length;
+	entry->tmpl = tmpl;
+	memcpy(bucket->data + bucket->used, rec, length);
+	bucket->used += length;
+
+	tmpl->holders++;
+	dom->held++;
+	conf->held++;
+	return 0;
+}
+
+/**
+ * \brief Read flow start of data record
+ *
+ * \return Flow start in milliseconds (0 = unknown)
+ */
+static uint64_t ord_record_start(struct ord_template *tmpl, uint8_t *rec)
+{
+	uint64_t value, sec;
+	int offset = tmpl->start_offset;
+
+	if (tmpl->variable) {
+		/* Offsets differ record to record */
+		offset = data_record_field_offset(rec, tmpl->templ, 0, tmpl->start_id, NULL);
+		if (offset < 0) {
+			return 0;
+		}
+	}
+
+	switch (tmpl->start_id) {
+	case ORD_START_SEC:
+		return data_read_uint(rec + offset, 4) * 1000;
+	case ORD_START_MSEC:
+		return data_read_uint(rec + offset, 8);
+	default:
+		/* NTP timestamp */
+		value = data_read_uint(rec + offset, 8);
+		sec = value >> 32;
+		if (sec < ORD_NTP_OFFSET) {
+			return 0;
+		}
+
+		return (sec - ORD_NTP_OFFSET) * 1000 + (((value & 0xffffffff) * 1000) >> 32);
+	}
+}
+
+/**
+ * \brief Process data record
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Length of the record
+ * \param[in] templ Template
+ * \param[in] data Processor
+ */
+static void ord_process_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) templ;
+	struct ord_processor *proc = (struct ord_processor *) data;
+	struct order_ip_config *conf = proc->conf;
+	struct ord_domain *dom = proc->dom;
+	uint64_t start = ord_record_start(proc->tmpl, rec);
+
+	if (start == 0) {
+		start = proc->export_time;
+	}
+
+	if (start < dom->released) {
+		conf->late++;
+		if (conf->drop_late) {
+			conf->dropped++;
+		} else {
+			ord_pass(conf, dom, proc->tmpl, rec, rec_len);
+		}
+		return;
+	}
+
+	if (start / 1000 >= dom->released / 1000 + conf->ring) {
+		/* Bucket of the record is still in use */
+		conf->ahead++;
+		ord_pass(conf, dom, proc->tmpl, rec, rec_len);
+		return;
+	}
+
+	while (conf->held >= conf->max_records && dom->held > 0 && start >= dom->released + 1000) {
+		/* Buffer is full, release the oldest records of the domain */
+		conf->forced += dom->buckets[(dom->released / 1000) & (conf->ring - 1)].count;
+		ord_release(conf, dom, dom->released + 1000);
+	}
+
+	if (conf->held >= conf->max_records || ord_hold(conf, dom, proc->tmpl, start, rec, rec_len)) {
+		conf->forced++;
+		ord_pass(conf, dom, proc->tmpl, rec, rec_len);
+	}
+}
+
+/**
+ * \brief Release all records of domain
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] dom Domain
+ */
+static void ord_release_all(struct order_ip_config *conf, struct ord_domain *dom)
+{
+	uint64_t sec;
+
+	for (sec = dom->released / 1000; dom->held > 0; ++sec) {
+		ord_release_bucket(conf, dom, &dom->buckets[sec & (conf->ring - 1)]);
+	}
+
+	dom->released = sec * 1000;
+	ord_flush(conf, dom);
+}
+
+/**
+ * \brief Print statistics of ordering
+ */
+static void ord_report(struct order_ip_config *conf)
+{
+	MSG_INFO(msg_module, "%" PRIu64 " records released in order (%" PRIu64 " early, buffer full), "
+		"%" PRIu64 " late records (%" PRIu64 " dropped), %" PRIu64 " records ahead of the clock, "
+		"%" PRIu64 " held", conf->ordered, conf->forced, conf->late, conf->dropped, conf->ahead,
+		conf->held);
+}
+
+int intermediate_process_message(void *config, void *message)
+{
+	struct order_ip_config *conf = (struct order_ip_config *) config;
+	struct ipfix_message *msg = (struct ipfix_message *) message;
+	bool removed[MSG_MAX_DATA_COUPLES];
+	struct ord_processor proc;
+	struct ord_template *tmpl;
+	struct ord_domain *dom;
+	uint32_t odid = msg->input_info->odid;
+	uint16_t records = 0;
+	int i, sets = 0;
+
+	conf->now = time(NULL);
+	conf->wall = ord_wall();
+	proc.conf = conf;
+	proc.export_time = (uint64_t) ntohl(msg->pkt_header->export_time) * 1000;
+
+	if (msg->source_status == SOURCE_STATUS_CLOSED) {
+		/* Release records of the source before it is closed */
+		dom = ord_get_domain(conf, odid, NULL);
+		if (dom) {
+			ord_release_all(conf, dom);
+		}
+
+		for (tmpl = conf->templates; tmpl; tmpl = tmpl->next) {
+			if (tmpl->odid == odid) {
+				tmpl->stale = true;
+			}
+		}
+
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	proc.dom = ord_get_domain(conf, odid, msg->input_info);
+	if (proc.dom) {
+		/* Records are compared with the clock of their message */
+		ord_tick(conf, proc.dom, proc.export_time);
+	}
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		struct ipfix_template *templ = msg->data_couple[i].data_template;
+
+		removed[i] = false;
+		if (!proc.dom || !templ || templ->template_type != TM_TEMPLATE) {
+			continue;
+		}
+
+		proc.tmpl = ord_get_template(conf, odid, templ);
+		if (!proc.tmpl || proc.tmpl->start_offset < 0) {
+			continue;
+		}
+
+		records += data_set_process_records(msg->data_couple[i].data_set, templ, &ord_process_record, &proc);
+		removed[i] = true;
+		sets++;
+	}
+
+	for (dom = conf->domains; dom; dom = dom->next) {
+		if (dom != proc.dom) {
+			ord_tick(conf, dom, 0);
+		}
+
+		ord_flush(conf, dom);
+	}
+
+	if (conf->now != conf->collected) {
+		ord_collect(conf, false);
+		conf->collected = conf->now;
+	}
+
+	if (conf->stat_interval && conf->now - conf->reported >= (time_t) conf->stat_interval) {
+		ord_report(conf);
+		conf->reported = conf->now;
+	}
+
+	if (sets > 0) {
+		message_remove_data_sets(msg, removed, records);
+	}
+
+	if (msg->source_status == SOURCE_STATUS_OPENED && !msg->data_couple[0].data_set
+			&& !msg->templ_set[0] && !msg->opt_templ_set[0]) {
+		/* Everything is held or emitted in generated messages */
+		drop_message(conf->ip_config, message);
+		return 0;
+	}
+
+	pass_message(conf->ip_config, message);
+	return 0;
+}
+
+int intermediate_close(void *config)
+{
+	struct order_ip_config *conf = (struct order_ip_config *) config;
+	struct ord_domain *dom;
+	uint32_t b;
+
+	if (conf->held > 0) {
+		MSG_WARNING(msg_module, "%" PRIu64 " held records were not released before shutdown", conf->held);
+	}
+
+	if (conf->ordered + conf->late + conf->ahead > 0) {
+		ord_report(conf);
+	}
+
+	while (conf->domains) {
+		dom = conf->domains;
+		conf->domains = dom->next;
+		if (dom->msg) {
+			free(dom->msg->pkt_header);
+			free(dom->msg);
+		}
+
+		for (b = 0; b < conf->ring; ++b) {
+			free(dom->buckets[b].entries);
+			free(dom->buckets[b].data);
+		}
+
+		free(dom->buckets);
+		free(dom->input_info);
+		free(dom);
+	}
+
+	ord_collect(conf, true);
+	free(conf);
+
+	return 0;
+}
+
+/**@}*/
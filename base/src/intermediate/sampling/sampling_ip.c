@@ -0,0 +1,784 @@
+/**
+ * \file sampling_ip.c
+ * \brief Intermediate Process upscaling counters of sampled flow records
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+/**
+ * \defgroup samplingInter Sampling Intermediate Process
+ * \ingroup intermediatePlugins
+ *
+ * This plugin multiplies packet and octet counters of flow records of sampled
+ * traffic by the sampling rate, so that storage plugins and their queries
+ * work with estimates of the original traffic.
+ *
+ * Sampling configuration is learnt from Options Data Records of each exporter
+ * and Observation Domain: samplingInterval, samplerRandomInterval (NetFlow v9
+ * options), samplingPacketInterval/samplingPacketSpace and
+ * samplingSize/samplingPopulation (PSAMP). Records scoped by samplerId or
+ * selectorId describe one sampler, other records the whole domain. Data
+ * records are matched by their samplerId/selectorId field, records without
+ * it (or of an unknown sampler) use the rate of the domain.
+ *
+ * Counters are rewritten in place, the message is not rebuilt; a value that
+ * does not fit the field (reduced-size encoding) is saturated. Records that
+ * carry the sampling interval themselves are taken as already scaled (as
+ * converted sFlow records are), unless configured otherwise.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <endian.h>
+
+#include <ipfixcol.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+/* API version constant */
+IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
+/* module name for MSG_* */
+static const char *msg_module = "sampling";
+
+/** Size of the table of samplers */
+#define SMP_BUCKETS         256
+
+/* Counters */
+#define SMP_OCTETS          1   /* octetDeltaCount */
+#define SMP_PACKETS         2   /* packetDeltaCount */
+#define SMP_POST_OCTETS     23  /* postOctetDeltaCount */
+#define SMP_POST_PACKETS    24  /* postPacketDeltaCount */
+#define SMP_TOTAL_OCTETS    85  /* octetTotalCount */
+#define SMP_TOTAL_PACKETS   86  /* packetTotalCount */
+#define SMP_MAX_COUNTERS    6
+
+/* Sampling configuration */
+#define SMP_INTERVAL        34  /* samplingInterval */
+#define SMP_SAMPLER_ID      48  /* samplerId (FLOW_SAMPLER_ID) */
+#define SMP_RANDOM_INTERVAL 50  /* samplerRandomInterval */
+#define SMP_SELECTOR_ID     302 /* selectorId */
+#define SMP_PACKET_INTERVAL 305 /* samplingPacketInterval */
+#define SMP_PACKET_SPACE    306 /* samplingPacketSpace */
+#define SMP_SIZE            309 /* samplingSize */
+#define SMP_POPULATION      310 /* samplingPopulation */
+
+/* Sampling configuration of one sampler (or whole domain) */
+struct smp_sampler {
+	uint64_t exporter;              /* Hash of exporter address and port */
+	uint32_t odid;                  /* Observation Domain ID */
+	uint64_t id;                    /* Sampler ID (0 = whole domain) */
+	uint32_t num, den;              /* Counters are multiplied by num / den */
+	struct smp_sampler *next;
+};
+
+/* Location of a field in data records of one template */
+struct smp_field {
+	int offset;                     /* Offset in the record (-1 = missing) */
+	uint16_t length;                /* Length in the record */
+	uint16_t id;                    /* Field ID */
+};
+
+/* Fields of data records of one template */
+struct smp_plan {
+	struct smp_field counters[SMP_MAX_COUNTERS];
+	int counter_count;
+	struct smp_field sampler;       /* samplerId or selectorId */
+	struct smp_field rate;          /* Sampling interval in the record */
+	bool variable;                  /* Template has variable-length fields */
+};
+
+/* plugin's configuration structure */
+struct sampling_ip_config {
+	void *ip_config;                /* internal process configuration */
+	bool inline_raw;                /* Scale records carrying sampling interval */
+	uint32_t stat_interval;         /* Interval of statistics messages */
+
+	struct smp_sampler *samplers[SMP_BUCKETS];
+	uint32_t sampler_count;
+
+	time_t now;                     /* Time of processed message */
+	time_t reported;                /* Time of the last statistics message */
+
+	uint64_t scaled;                /* Number of upscaled records */
+	uint64_t saturated;             /* Number of saturated counters */
+};
+
+/* struct for data records processing */
+struct smp_processor {
+	struct sampling_ip_config *conf;
+	struct ipfix_template *templ;
+	struct smp_plan plan;
+	uint64_t exporter;
+	uint32_t odid;
+	const struct smp_sampler *domain;   /* Sampler of the whole domain */
+	const struct smp_sampler *last;     /* Sampler of the last ID (NULL = unknown) */
+	uint64_t last_id;                   /* Last looked up sampler ID */
+	bool cached;                        /* last and last_id are valid */
+};
+
+/**
+ * \brief Write unsigned integer in network byte order
+ */
+static inline void smp_write_uint(uint8_t *data, uint16_t length, uint64_t value)
+{
+	while (length-- > 0) {
+		data[length] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+/**
+ * \brief Identify exporter by its address and port (or file name)
+ */
+static uint64_t smp_exporter(struct input_info *input_info)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const uint8_t *data;
+	size_t length, i;
+	uint8_t buff[18];
+
+	if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
+		data = (const uint8_t *) ((struct input_info_file *) input_info)->name;
+		length = data ? strlen((const char *) data) : 0;
+	} else {
+		struct input_info_network *input = (struct input_info_network *) input_info;
+
+		memset(buff, 0, sizeof(buff));
+		memcpy(buff, &input->src_addr, (input->l3_proto == 6) ? 16 : 4);
+		memcpy(buff + 16, &input->src_port, 2);
+		data = buff;
+		length = sizeof(buff);
+	}
+
+	/* FNV-1a */
+	for (i = 0; i < length; ++i) {
+		hash = (hash ^ data[i]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * \brief Bucket of sampler in the table
+ */
+static inline uint32_t smp_bucket(uint64_t exporter, uint32_t odid, uint64_t id)
+{
+	uint64_t hash = (exporter ^ ((uint64_t) odid << 32) ^ id) * 0x9e3779b97f4a7c15ULL;
+
+	return hash >> 56;
+}
+
+/**
+ * \brief Find sampler
+ *
+ * \return Sampler or NULL
+ */
+static const struct smp_sampler *smp_find(const struct sampling_ip_config *conf,
+	uint64_t exporter, uint32_t odid, uint64_t id)
+{
+	const struct smp_sampler *smp;
+
+	for (smp = conf->samplers[smp_bucket(exporter, odid, id)]; smp; smp = smp->next) {
+		if (smp->exporter == exporter && smp->odid == odid && smp->id == id) {
+			return smp;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Set sampling rate of sampler, create it when needed
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] exporter Exporter
+ * \param[in] odid ODID
+ * \param[in] id Sampler ID (0 = whole domain)
+ * \param[in] num Numerator of the rate
+ * \param[in] den Denominator of the rate
+ */
+static void smp_update(struct sampling_ip_config *conf, uint64_t exporter,
+	uint32_t odid, uint64_t id, uint32_t num, uint32_t den)
+{
+	struct smp_sampler **head = &conf->samplers[smp_bucket(exporter, odid, id)], *smp;
+
+	for (smp = *head; smp; smp = smp->next) {
+		if (smp->exporter == exporter && smp->odid == odid && smp->id == id) {
+			break;
+		}
+	}
+
+	if (smp && smp->num == num && smp->den == den) {
+		return;
+	}
+
+	if (!smp) {
+		smp = calloc(1, sizeof(*smp));
+		if (!smp) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return;
+		}
+
+		smp->exporter = exporter;
+		smp->odid = odid;
+		smp->id = id;
+		smp->next = *head;
+		*head = smp;
+		conf->sampler_count++;
+	}
+
+	smp->num = num;
+	smp->den = den;
+
+	if (id) {
+		MSG_INFO(msg_module, "[%u] Sampler %" PRIu64 " selects 1 out of %.2f packets", odid, id, (double) num / den);
+	} else {
+		MSG_INFO(msg_module, "[%u] Domain samples 1 out of %.2f packets", odid, (double) num / den);
+	}
+}
+
+/**
+ * \brief Forget samplers of exporter's domain
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] exporter Exporter
+ * \param[in] odid ODID
+ */
+static void smp_forget(struct sampling_ip_config *conf, uint64_t exporter, uint32_t odid)
+{
+	struct smp_sampler **ptr, *smp;
+	int i;
+
+	for (i = 0; i < SMP_BUCKETS; ++i) {
+		ptr = &conf->samplers[i];
+		while ((smp = *ptr)) {
+			if (smp->exporter == exporter && smp->odid == odid) {
+				*ptr = smp->next;
+				free(smp);
+				conf->sampler_count--;
+			} else {
+				ptr = &smp->next;
+			}
+		}
+	}
+}
+
+/**
+ * \brief Parse plugin configuration
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] params XML configuration
+ * \return 0 on success
+ */
+static int smp_parse_config(struct sampling_ip_config *conf, char *params)
+{
+	xmlDoc *doc = NULL;
+	xmlNode *root = NULL, *curr = NULL;
+	int ret = 0;
+
+	doc = xmlParseDoc(BAD_CAST params);
+	if (!doc) {
+		MSG_ERROR(msg_module, "Cannot parse config xml!");
+		return 1;
+	}
+
+	root = xmlDocGetRootElement(doc);
+	if (!root) {
+		MSG_ERROR(msg_module, "Cannot get document root element!");
+		xmlFreeDoc(doc);
+		return 1;
+	}
+
+	for (curr = root->children; curr != NULL && ret == 0; curr = curr->next) {
+		if (curr->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		char *value = (char *) xmlNodeGetContent(curr);
+		if (!value) {
+			continue;
+		}
+
+		if (!xmlStrcmp(curr->name, (const xmlChar *) "inlineInterval")) {
+			if (!strcasecmp(value, "scaled")) {
+				conf->inline_raw = false;
+			} else if (!strcasecmp(value, "raw")) {
+				conf->inline_raw = true;
+			} else {
+				MSG_ERROR(msg_module, "Invalid value of inlineInterval: '%s'", value);
+				ret = 1;
+			}
+		} else if (!xmlStrcmp(curr->name, (const xmlChar *) "statisticsInterval")) {
+			conf->stat_interval = strtoul(value, NULL, 10);
+		}
+
+		xmlFree(value);
+	}
+
+	xmlFreeDoc(doc);
+	return ret;
+}
+
+/**
+ * \brief Initialize sampling plugin
+ *
+ * \param[in] params Plugin parameters
+ * \param[in] ip_config Internal process configuration
+ * \param[in] ip_id Source ID into Template Manager
+ * \param[in] template_mgr Template Manager
+ * \param[out] config Plugin configuration
+ * \return 0 if everything OK
+ */
+int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfix_template_mgr *template_mgr, void **config)
+{
+	(void) ip_id;
+	(void) template_mgr;
+	struct sampling_ip_config *conf;
+
+	conf = (struct sampling_ip_config *) calloc(1, sizeof(*conf));
+	if (!conf) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	conf->ip_config = ip_config;
+
+	if (params && smp_parse_config(conf, params)) {
+		intermediate_close(conf);
+		return -1;
+	}
+
+	conf->reported = time(NULL);
+	*config = conf;
+	MSG_INFO(msg_module, "Plugin initialization completed successfully");
+	return 0;
+}
+
+/**
+ * \brief Get unsigned field of data record
+ *
+ * \param[in] rec Data record
+ * \param[in] templ Template
+ * \param[in] id Field ID
+ * \param[out] value Value of the field
+ * \return true if the record contains the field
+ */
+static bool smp_get(uint8_t *rec, struct ipfix_template *templ, uint16_t id, uint64_t *value)
+{
+	int offset, length;
+
+	offset = data_record_field_offset(rec, templ, 0, id, &length);
+	if (offset < 0 || length < 1 || length > 8) {
+		return false;
+	}
+
+	*value = data_read_uint(rec + offset, length);
+	return true;
+}
+
+/**
+ * \brief Process Options Data Record with sampling configuration
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Length of the record
+ * \param[in] templ Options template
+ * \param[in] data Processor
+ */
+static void smp_process_options(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) rec_len;
+	struct smp_processor *proc = (struct smp_processor *) data;
+	uint64_t id = 0, a, b;
+	uint32_t num, den = 1;
+
+	if (smp_get(rec, templ, SMP_PACKET_INTERVAL, &a) && smp_get(rec, templ, SMP_PACKET_SPACE, &b)) {
+		/* a packets selected, then b packets skipped */
+		num = a + b;
+		den = a;
+	} else if (smp_get(rec, templ, SMP_SIZE, &a) && smp_get(rec, templ, SMP_POPULATION, &b)) {
+		/* a packets selected of b packets */
+		num = b;
+		den = a;
+	} else if (smp_get(rec, templ, SMP_RANDOM_INTERVAL, &a) || smp_get(rec, templ, SMP_INTERVAL, &a)) {
+		num = a;
+	} else {
+		return;
+	}
+
+	if (num == 0 || den == 0 || num < den) {
+		/* No sampling */
+		num = den = 1;
+	}
+
+	if (!smp_get(rec, templ, SMP_SAMPLER_ID, &id)) {
+		smp_get(rec, templ, SMP_SELECTOR_ID, &id);
+	}
+
+	smp_update(proc->conf, proc->exporter, proc->odid, id, num, den);
+}
+
+/**
+ * \brief Check whether Options Template describes sampling configuration
+ */
+static bool smp_options_template(struct ipfix_template *templ)
+{
+	static const uint16_t ids[] = {SMP_INTERVAL, SMP_RANDOM_INTERVAL, SMP_PACKET_INTERVAL, SMP_SIZE};
+	unsigned int i;
+	int offset;
+
+	for (i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+		if (template_get_field(templ, 0, ids[i], &offset)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * \brief Locate unsigned field in template
+ *
+ * \return true if the field is present
+ */
+static bool smp_locate(struct ipfix_template *templ, uint16_t id, struct smp_field *field)
+{
+	struct ipfix_template_row *row;
+	int offset;
+
+	field->offset = -1;
+	field->id = id;
+	row = template_get_field(templ, 0, id, &offset);
+	if (!row || row->length == 0 || row->length > 8) {
+		return false;
+	}
+
+	field->offset = offset;
+	field->length = row->length;
+	return true;
+}
+
+/**
+ * \brief Find counters and sampling fields of template
+ *
+ * \param[in] templ Template
+ * \param[out] plan Fields of the template
+ * \return true if records contain counters
+ */
+static bool smp_make_plan(struct ipfix_template *templ, struct smp_plan *plan)
+{
+	static const uint16_t counters[SMP_MAX_COUNTERS] = {
+		SMP_OCTETS, SMP_PACKETS, SMP_POST_OCTETS, SMP_POST_PACKETS, SMP_TOTAL_OCTETS, SMP_TOTAL_PACKETS
+	};
+	int i;
+
+	plan->counter_count = 0;
+	plan->variable = (templ->data_length & 0x80000000);
+
+	for (i = 0; i < SMP_MAX_COUNTERS; ++i) {
+		if (smp_locate(templ, counters[i], &plan->counters[plan->counter_count])) {
+			plan->counter_count++;
+		}
+	}
+
+	if (!smp_locate(templ, SMP_SAMPLER_ID, &plan->sampler)) {
+		smp_locate(templ, SMP_SELECTOR_ID, &plan->sampler);
+	}
+
+	if (!smp_locate(templ, SMP_INTERVAL, &plan->rate)) {
+		smp_locate(templ, SMP_RANDOM_INTERVAL, &plan->rate);
+	}
+
+	return plan->counter_count > 0;
+}
+
+/**
+ * \brief Get field of data record
+ *
+ * \return Pointer to the field or NULL
+ */
+static inline uint8_t *smp_field_ptr(const struct smp_processor *proc, uint8_t *rec,
+	const struct smp_field *field)
+{
+	int offset = field->offset;
+
+	if (offset >= 0 && proc->plan.variable) {
+		/* Offsets differ record to record */
+		offset = data_record_field_offset(rec, proc->templ, 0, field->id, NULL);
+	}
+
+	return (offset >= 0) ? rec + offset : NULL;
+}
+
+/**
+ * \brief Read counter in network byte order (common lengths without loop)
+ */
+static inline uint64_t smp_read_counter(const uint8_t *data, uint16_t length)
+{
+	uint64_t value64;
+	uint32_t value32;
+
+	switch (length) {
+	case 8:
+		memcpy(&value64, data, 8);
+		return be64toh(value64);
+	case 4:
+		memcpy(&value32, data, 4);
+		return ntohl(value32);
+	default:
+		return data_read_uint(data, length);
+	}
+}
+
+/**
+ * \brief Write counter in network byte order (common lengths without loop)
+ */
+static inline void smp_write_counter(uint8_t *data, uint16_t length, uint64_t value)
+{
+	uint64_t value64;
+	uint32_t value32;
+
+	switch (length) {
+	case 8:
+		value64 = htobe64(value);
+		memcpy(data, &value64, 8);
+		break;
+	case 4:
+		value32 = htonl(value);
+		memcpy(data, &value32, 4);
+		break;
+	default:
+		smp_write_uint(data, length, value);
+	}
+}
+
+/**
+ * \brief Multiply counter by sampling rate
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in,out] ptr Counter
+ * \param[in] length Length of the counter
+ * \param[in] num Numerator of the rate
+ * \param[in] den Denominator of the rate
+ */
+static inline void smp_scale(struct sampling_ip_config *conf, uint8_t *ptr, uint16_t length,
+	uint32_t num, uint32_t den)
+{
+	uint64_t max = (length == 8) ? UINT64_MAX : ((uint64_t) 1 << (8 * length)) - 1;
+	uint64_t value = smp_read_counter(ptr, length);
+
+	if (den == 1) {
+		/* Product of 32-bit values cannot overflow, avoid the division */
+		if ((value <= UINT32_MAX) ? value * num > max : value > max / num) {
+			value = max;
+			conf->saturated++;
+		} else {
+			value *= num;
+		}
+	} else {
+		double scaled = (double) value * num / den;
+
+		if (scaled >= (double) max) {
+			value = max;
+			conf->saturated++;
+		} else {
+			value = (uint64_t) (scaled + 0.5);
+		}
+	}
+
+	smp_write_counter(ptr, length, value);
+}
+
+/**
+ * \brief Process data record
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Length of the record
+ * \param[in] templ Template
+ * \param[in] data Processor
+ */
+static void smp_process_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) rec_len;
+	(void) templ;
+	struct smp_processor *proc = (struct smp_processor *) data;
+	const struct smp_plan *plan = &proc->plan;
+	const struct smp_sampler *smp = proc->domain;
+	uint32_t num, den;
+	uint8_t *ptr;
+	int i;
+
+	if (plan->rate.offset >= 0) {
+		/* Records carry their own rate */
+		ptr = smp_field_ptr(proc, rec, &plan->rate);
+		num = ptr ? data_read_uint(ptr, plan->rate.length) : 1;
+		den = 1;
+	} else {
+		if (plan->sampler.offset >= 0 && (ptr = smp_field_ptr(proc, rec, &plan->sampler))) {
+			uint64_t id = data_read_uint(ptr, plan->sampler.length);
+
+			if (!proc->cached || proc->last_id != id) {
+				proc->last = smp_find(proc->conf, proc->exporter, proc->odid, id);
+				proc->last_id = id;
+				proc->cached = true;
+			}
+
+			if (proc->last) {
+				smp = proc->last;
+			}
+		}
+
+		if (!smp) {
+			return;
+		}
+
+		num = smp->num;
+		den = smp->den;
+	}
+
+	if (num <= den) {
+		return;
+	}
+
+	for (i = 0; i < plan->counter_count; ++i) {
+		ptr = smp_field_ptr(proc, rec, &plan->counters[i]);
+		if (ptr) {
+			smp_scale(proc->conf, ptr, plan->counters[i].length, num, den);
+		}
+	}
+
+	proc->conf->scaled++;
+}
+
+/**
+ * \brief Print statistics of upscaling
+ */
+static void smp_report(struct sampling_ip_config *conf)
+{
+	MSG_INFO(msg_module, "%" PRIu64 " records upscaled (%" PRIu64 " saturated counters), %u known samplers",
+		conf->scaled, conf->saturated, conf->sampler_count);
+}
+
+int intermediate_process_message(void *config, void *message)
+{
+	struct sampling_ip_config *conf = (struct sampling_ip_config *) config;
+	struct ipfix_message *msg = (struct ipfix_message *) message;
+	struct smp_processor proc;
+	int i;
+
+	conf->now = time(NULL);
+	proc.conf = conf;
+	proc.exporter = smp_exporter(msg->input_info);
+	proc.odid = msg->input_info->odid;
+
+	if (msg->source_status == SOURCE_STATUS_CLOSED) {
+		/* Sampling configuration is valid for the session only */
+		smp_forget(conf, proc.exporter, proc.odid);
+		pass_message(conf->ip_config, message);
+		return 0;
+	}
+
+	/* Configuration first, so that it applies to records of the same message */
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		struct ipfix_template *templ = msg->data_couple[i].data_template;
+
+		if (templ && templ->template_type == TM_OPTIONS_TEMPLATE && smp_options_template(templ)) {
+			data_set_process_records(msg->data_couple[i].data_set, templ, &smp_process_options, &proc);
+		}
+	}
+
+	if (conf->sampler_count > 0 || conf->inline_raw) {
+		proc.domain = smp_find(conf, proc.exporter, proc.odid, 0);
+		proc.cached = false;
+
+		for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+			struct ipfix_template *templ = msg->data_couple[i].data_template;
+
+			if (!templ || templ->template_type != TM_TEMPLATE || !smp_make_plan(templ, &proc.plan)) {
+				continue;
+			}
+
+			if (proc.plan.rate.offset >= 0 ? !conf->inline_raw
+					: (!proc.domain && (proc.plan.sampler.offset < 0 || conf->sampler_count == 0))) {
+				/* Already scaled, or nothing is known about sampling */
+				continue;
+			}
+
+			proc.templ = templ;
+			data_set_process_records(msg->data_couple[i].data_set, templ, &smp_process_record, &proc);
+		}
+	}
+
+	if (conf->stat_interval && conf->now - conf->reported >= (time_t) conf->stat_interval) {
+		smp_report(conf);
+		conf->reported = conf->now;
+	}
+
+	pass_message(conf->ip_config, message);
+	return 0;
+}
+
+int intermediate_close(void *config)
+{
+	struct sampling_ip_config *conf = (struct sampling_ip_config *) config;
+	struct smp_sampler *smp;
+	int i;
+
+	if (conf->scaled > 0) {
+		smp_report(conf);
+	}
+
+	for (i = 0; i < SMP_BUCKETS; ++i) {
+		while ((smp = conf->samplers[i])) {
+			conf->samplers[i] = smp->next;
+			free(smp);
+		}
+	}
+
+	free(conf);
+	return 0;
+}
+
+/**@}*/
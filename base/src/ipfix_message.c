@@ -808,19 +808,36 @@ int data_set_records_count(struct ipfix_data_set *data_set, struct ipfix_templat
 
 void message_free_metadata(struct ipfix_message *msg)
 {
-	for (uint16_t i = 0; i < msg->data_records_count; ++i) {
-		/* Free profiles */
-		if (msg->metadata[i].channels) {
-			free(msg->metadata[i].channels);
+	/* Lists of channels are owned by the profile tree */
+	free(msg->metadata);
+}
+
+void message_release(struct ipfix_message *msg)
+{
+	int i;
+
+	free(msg->pkt_header);
+
+	/* Decrement reference on templates */
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		if (msg->data_couple[i].data_template) {
+			tm_template_reference_dec(msg->data_couple[i].data_template);
 		}
 	}
-	
-	/* Free metadata structure */
-	free(msg->metadata);
+
+	if (msg->metadata) {
+		message_free_metadata(msg);
+	}
+
+	free(msg);
 }
 
 struct metadata *message_copy_metadata(struct ipfix_message *src)
 {
+	if (!src->metadata) {
+		return NULL;
+	}
+
 	struct metadata *metadata = calloc(src->data_records_count, sizeof(struct metadata));
 	if (!metadata) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
@@ -835,27 +852,172 @@ struct metadata *message_copy_metadata(struct ipfix_message *src)
 		metadata[i].srcCountry = src->metadata[i].srcCountry;
 		metadata[i].dstCountry = src->metadata[i].dstCountry;
 		metadata[i].record = src->metadata[i].record;
+		metadata[i].channels = src->metadata[i].channels;
+	}
+
+	return metadata;
+}
+
+/**
+ * \brief Get shift of a pointer into the message after removal of ranges
+ *
+ * Pointers must be passed in increasing order for one cursor.
+ *
+ * \param[in] ranges Removed ranges
+ * \param[in] count Number of ranges
+ * \param[in,out] cursor First range that may follow the pointer
+ * \param[in,out] shift Total length of ranges before the cursor
+ * \param[in] offset Offset of the pointer in the message
+ * \return true if the pointer lies in a removed range
+ */
+static inline bool message_range_shift(const struct message_range *ranges, uint32_t count,
+		uint32_t *cursor, uint32_t *shift, uint16_t offset)
+{
+	while (*cursor < count && ranges[*cursor].start + ranges[*cursor].length <= offset) {
+		*shift += ranges[*cursor].length;
+		(*cursor)++;
+	}
+
+	return *cursor < count && ranges[*cursor].start <= offset;
+}
+
+void message_remove_ranges(struct ipfix_message *msg, const struct message_range *ranges,
+		uint32_t count, uint16_t records)
+{
+	uint8_t *pkt = (uint8_t *) msg->pkt_header;
+	uint16_t length = ntohs(msg->pkt_header->length);
+	uint32_t cursor, shift, k;
+	int i, j;
+
+	if (count == 0) {
+		return;
+	}
+
+#define MSG_OFFSET(ptr) ((uint16_t) ((uint8_t *) (ptr) - pkt))
+
+	cursor = shift = 0;
+	for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
+		message_range_shift(ranges, count, &cursor, &shift, MSG_OFFSET(msg->templ_set[i]));
+		msg->templ_set[i] = (void *) ((uint8_t *) msg->templ_set[i] - shift);
+	}
+
+	cursor = shift = 0;
+	for (i = 0; i < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[i]; ++i) {
+		message_range_shift(ranges, count, &cursor, &shift, MSG_OFFSET(msg->opt_templ_set[i]));
+		msg->opt_templ_set[i] = (void *) ((uint8_t *) msg->opt_templ_set[i] - shift);
+	}
 
-		if (src->metadata[i].channels == NULL) {
+	/* Metadata of removed records are dropped */
+	if (msg->metadata) {
+		cursor = shift = 0;
+		for (i = 0, j = 0; i < msg->data_records_count; ++i) {
+			struct metadata *mdata = &msg->metadata[i];
+
+			if (message_range_shift(ranges, count, &cursor, &shift, MSG_OFFSET(mdata->record.record))) {
+				continue;
+			}
+
+			msg->metadata[j] = *mdata;
+			msg->metadata[j].record.record = (uint8_t *) msg->metadata[j].record.record - shift;
+			j++;
+		}
+	}
+
+	cursor = shift = 0;
+	for (i = 0, j = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		if (message_range_shift(ranges, count, &cursor, &shift, MSG_OFFSET(msg->data_couple[i].data_set))) {
+			if (msg->data_couple[i].data_template) {
+				tm_template_reference_dec(msg->data_couple[i].data_template);
+			}
 			continue;
 		}
 
-		uint16_t channels = 0;
-		while (src->metadata[i].channels[channels]) {
-			channels++;
+		msg->data_couple[j] = msg->data_couple[i];
+		msg->data_couple[j].data_set = (void *) ((uint8_t *) msg->data_couple[j].data_set - shift);
+		j++;
+	}
+
+	for (; j < i; ++j) {
+		msg->data_couple[j].data_set = NULL;
+		msg->data_couple[j].data_template = NULL;
+	}
+
+#undef MSG_OFFSET
+
+	/* Move the rest of the packet */
+	uint16_t dst = ranges[0].start;
+	for (k = 0; k < count; ++k) {
+		uint16_t src = ranges[k].start + ranges[k].length;
+		uint16_t end = (k + 1 < count) ? ranges[k + 1].start : length;
+
+		memmove(pkt + dst, pkt + src, end - src);
+		dst += end - src;
+	}
+
+	msg->pkt_header->length = htons(dst);
+	msg->data_records_count -= records;
+}
+
+void message_remove_data_sets(struct ipfix_message *msg, const bool *removed, uint16_t records)
+{
+	struct message_range ranges[MSG_MAX_DATA_COUPLES];
+	uint8_t *pkt = (uint8_t *) msg->pkt_header;
+	uint32_t count = 0;
+	uint16_t start, length;
+	int i;
+
+	/* Data couples are in the order of the packet */
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		if (!removed[i]) {
+			continue;
 		}
 
-		metadata[i].channels = calloc(channels + 1, sizeof(void*));
-		if (!metadata) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			free(metadata);
-			return NULL;
+		start = (uint8_t *) msg->data_couple[i].data_set - pkt;
+		length = ntohs(msg->data_couple[i].data_set->header.length);
+
+		if (count > 0 && ranges[count - 1].start + ranges[count - 1].length == start) {
+			ranges[count - 1].length += length;
+			continue;
 		}
 
-		for (uint16_t index = 0; index < channels; ++index) {
-			metadata[i].channels[index] = src->metadata[i].channels[index];
+		ranges[count].start = start;
+		ranges[count].length = length;
+		count++;
+	}
+
+	message_remove_ranges(msg, ranges, count, records);
+}
+
+uint8_t *template_create_record(struct ipfix_template *templ, uint16_t *length)
+{
+	struct ipfix_template_record *rec;
+	uint8_t *ptr;
+	uint16_t i, f, val;
+
+	*length = 4 + templ->template_length - sizeof(struct ipfix_template) + sizeof(template_ie);
+	rec = calloc(1, *length);
+	if (!rec) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	rec->template_id = htons(templ->template_id);
+	rec->count = htons(templ->field_count);
+	ptr = (uint8_t *) rec + 4;
+
+	for (i = 0, f = 0; i < templ->field_count; ++i, ++f) {
+		val = htons(templ->fields[f].ie.id);
+		memcpy(ptr, &val, 2);
+		val = htons(templ->fields[f].ie.length);
+		memcpy(ptr + 2, &val, 2);
+		ptr += 4;
+
+		if (templ->fields[f].ie.id & 0x8000) {
+			uint32_t en = htonl(templ->fields[++f].enterprise_number);
+			memcpy(ptr, &en, 4);
+			ptr += 4;
 		}
 	}
 
-	return metadata;
+	return (uint8_t *) rec;
 }
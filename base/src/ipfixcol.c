@@ -80,7 +80,7 @@
  */
 
 /** Acceptable command-line parameters (normal) */
-#define OPTSTRING "c:dhv:Vsr:i:S:e:Mp:"
+#define OPTSTRING "c:dhv:Vsr:i:S:e:Mp:w:W:"
 
 /** Acceptable command-line parameters (long) */
 struct option long_opts[] = {
@@ -110,6 +110,12 @@ static char *msg_module = "main";
 /** Ring buffer size */
 int ring_buffer_size = 8192;
 
+/** Spool directory (NULL = spool disabled) */
+char *spool_dir = NULL;
+
+/** Maximal size of the spool of a Data Manager (bytes) */
+uint64_t spool_max_size = 1024ULL << 20;
+
 /**
  * \brief Print program version information
  */
@@ -138,6 +144,8 @@ void help ()
 	printf ("  -S num    Print statistics every \"num\" seconds\n");
 	printf ("  -M        Enable single data manager (all ODIDs have common storage plugins)\n");
 	printf ("  -p file   Path to the pidfile. Without this option, no pidfile is created.\n");
+	printf ("  -w dir    Spool data for slow storage plugins into \"dir\" (default: disabled)\n");
+	printf ("  -W size   Maximal size of the spool of an ODID in MB (default: 1024)\n");
 	printf ("\n");
 }
 
@@ -195,8 +203,10 @@ int main (int argc, char* argv[])
 	void *output_manager_config = NULL;
 	xmlXPathObjectPtr collectors = NULL;
 	int ring_buffer_size = 8192;
+	int spool_size;
 	bool output_odid_merge = false;
 	char *pidfile_path = NULL;
+	char spool_path[PATH_MAX];
 
 	/* parse command line parameters */
 	while ((c = getopt_long(argc, argv, OPTSTRING, long_opts, NULL)) != -1) {
@@ -257,6 +267,19 @@ int main (int argc, char* argv[])
 		case 'p':
 			pidfile_path = optarg;
 			break;
+		case 'w':
+			spool_dir = optarg;
+			break;
+		case 'W':
+			spool_size = strtoi(optarg, 10);
+			if (spool_size == INT_MAX || spool_size <= 0) {
+				MSG_ERROR(msg_module, "No valid spool size provided (%s)", optarg);
+				help();
+				exit(EXIT_FAILURE);
+			}
+
+			spool_max_size = (uint64_t) spool_size << 20;
+			break;
 
 		default:
 			help();
@@ -353,6 +376,12 @@ int main (int argc, char* argv[])
 			
 			MSG_INFO(msg_module, "[%d] New collector process started", config->proc_id);
 		}
+
+		/* Each collector process has its own spool */
+		if (spool_dir) {
+			snprintf(spool_path, PATH_MAX, "%s/%d", spool_dir, i);
+			spool_dir = spool_path;
+		}
 		
 		/* DEBUG - remove this */
 		config->proc_id = getpid();
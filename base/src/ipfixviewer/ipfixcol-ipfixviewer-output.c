@@ -39,13 +39,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
-#include <assert.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <endian.h>
 #include <inttypes.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <libxml/xmlmemory.h>
+#include <libxml/parser.h>
 
 #include "ipfixcol.h"
 
@@ -56,18 +62,72 @@
  * This plugin actually does not store anything anywhere.
  * It just prints out IPFIX data from messages.
  *
+ * Records can be selected by ODID and template ID and written as
+ * a human readable dump, as CSV or as raw IPFIX messages. All output goes
+ * through one large buffer and values are formatted by hand, so the plugin
+ * is not limited by printf().
+ *
  * @{
  */
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 /** Identifier to MSG_* macros */
 static char *msg_module = "ipfixviewer";
 
+/** Size of the output buffer */
+#define VIEWER_BUFFER_SIZE (1024 * 1024)
+/** Space reserved for a line printed by out_printf() */
+#define VIEWER_LINE_MAX 512
+/** Space reserved for a formatted value (except strings and octet arrays) */
+#define VIEWER_VALUE_MAX 128
+/** Maximal number of ODIDs or template IDs in a filter */
+#define VIEWER_FILTER_MAX 64
+/** Seconds between the NTP epoch (1900) and the UNIX epoch (1970) */
+#define VIEWER_NTP_EPOCH 2208988800ULL
+
+/**
+ * \brief Output format
+ */
+enum viewer_format {
+	VIEWER_TEXT,     /**< human readable dump of whole messages */
+	VIEWER_CSV,      /**< one line per data record */
+	VIEWER_IPFIX     /**< raw IPFIX messages */
+};
+
+/**
+ * \brief Template field resolved for formatting
+ */
+struct viewer_field {
+	uint16_t id;                 /**< element ID */
+	uint16_t length;             /**< length from template (may be VAR_IE_LENGTH) */
+	uint32_t en;                 /**< enterprise number */
+	enum ELEMENT_TYPE type;      /**< element data type */
+	const char *name;            /**< element name, NULL if unknown */
+};
+
 struct viewer_config {
-	/* structure so far empty */
-	int empty;
+	enum viewer_format format;   /**< output format */
+	int fd;                      /**< output file descriptor */
+	int error;                   /**< writing has failed */
+	char *buffer;                /**< output buffer */
+	size_t fill;                 /**< bytes in the output buffer */
+
+	uint32_t odids[VIEWER_FILTER_MAX];     /**< selected ODIDs */
+	int odid_cnt;                          /**< number of selected ODIDs */
+	uint32_t templates[VIEWER_FILTER_MAX]; /**< selected template IDs */
+	int template_cnt;                      /**< number of selected templates */
+
+	struct viewer_field *fields; /**< fields of the current template */
+	uint16_t fields_size;        /**< allocated items in fields */
+
+	uint32_t csv_odid;           /**< ODID of the last CSV header */
+	uint16_t csv_template;       /**< template ID of the last CSV header */
+	int csv_header;              /**< a CSV header has been printed */
 };
 
 /* some auxiliary functions for extracting data of exact length */
@@ -76,87 +136,682 @@ struct viewer_config {
 #define read32(ptr) (*((uint32_t *) (ptr)))
 #define read64(ptr) (*((uint64_t *) (ptr)))
 
+/** Two decimal digits of numbers 0 - 99 */
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/** Hexadecimal digits */
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * \brief Write content of the output buffer
+ *
+ * \param[in] conf plugin configuration
+ * \return 0 on success, -1 otherwise
+ */
+static int out_flush(struct viewer_config *conf)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < conf->fill) {
+		ret = write(conf->fd, conf->buffer + done, conf->fill - done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (!conf->error) {
+				MSG_ERROR(msg_module, "Unable to write output: %s", strerror(errno));
+			}
+			conf->error = 1;
+			break;
+		}
+		done += ret;
+	}
+
+	conf->fill = 0;
+	return conf->error ? -1 : 0;
+}
+
+/**
+ * \brief Make room for \p len bytes in the output buffer
+ *
+ * The data are written directly to the returned pointer and confirmed by
+ * out_commit().
+ *
+ * \param[in] conf plugin configuration
+ * \param[in] len number of bytes (at most VIEWER_BUFFER_SIZE)
+ * \return position in the output buffer
+ */
+static inline char *out_reserve(struct viewer_config *conf, size_t len)
+{
+	if (conf->fill + len > VIEWER_BUFFER_SIZE) {
+		out_flush(conf);
+	}
+
+	return conf->buffer + conf->fill;
+}
+
+/**
+ * \brief Confirm data written after out_reserve()
+ *
+ * \param[in] conf plugin configuration
+ * \param[in] end end of the written data
+ */
+static inline void out_commit(struct viewer_config *conf, char *end)
+{
+	conf->fill = end - conf->buffer;
+}
+
+/**
+ * \brief Append bytes to the output buffer
+ */
+static inline void out_bytes(struct viewer_config *conf, const void *data, size_t len)
+{
+	char *p = out_reserve(conf, len);
+
+	memcpy(p, data, len);
+	out_commit(conf, p + len);
+}
+
+/**
+ * \brief Append formatted text to the output buffer
+ *
+ * Meant for message and set headers, lines are cut at VIEWER_LINE_MAX bytes.
+ */
+static void out_printf(struct viewer_config *conf, const char *format, ...)
+{
+	char *p = out_reserve(conf, VIEWER_LINE_MAX);
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = vsnprintf(p, VIEWER_LINE_MAX, format, ap);
+	va_end(ap);
+
+	if (ret < 0) {
+		return;
+	}
+	if (ret >= VIEWER_LINE_MAX) {
+		ret = VIEWER_LINE_MAX - 1;
+	}
+
+	out_commit(conf, p + ret);
+}
+
+/**
+ * \brief Format unsigned decimal number
+ *
+ * \param[out] p output position
+ * \param[in] value number
+ * \return end of the written text
+ */
+static char *fmt_uint(char *p, uint64_t value)
+{
+	char tmp[20];
+	char *t = tmp + sizeof(tmp);
+	unsigned int idx;
+	size_t len;
+
+	while (value >= 100) {
+		idx = (value % 100) * 2;
+		value /= 100;
+		*--t = digit_pairs[idx + 1];
+		*--t = digit_pairs[idx];
+	}
+
+	if (value >= 10) {
+		*--t = digit_pairs[value * 2 + 1];
+		*--t = digit_pairs[value * 2];
+	} else {
+		*--t = '0' + value;
+	}
+
+	len = tmp + sizeof(tmp) - t;
+	memcpy(p, t, len);
+	return p + len;
+}
+
+/**
+ * \brief Format signed decimal number
+ */
+static char *fmt_int(char *p, int64_t value)
+{
+	if (value < 0) {
+		*p++ = '-';
+		return fmt_uint(p, 0 - (uint64_t) value);
+	}
+
+	return fmt_uint(p, value);
+}
+
+/**
+ * \brief Format number with leading zeros
+ *
+ * \param[out] p output position
+ * \param[in] value number lower than 10^width
+ * \param[in] width number of digits
+ * \return end of the written text
+ */
+static char *fmt_pad(char *p, uint32_t value, int width)
+{
+	int i;
+
+	for (i = width - 1; i >= 0; i--) {
+		p[i] = '0' + value % 10;
+		value /= 10;
+	}
+
+	return p + width;
+}
+
+/**
+ * \brief Format octets as a hexadecimal number
+ */
+static char *fmt_hex(char *p, const uint8_t *data, uint16_t len)
+{
+	uint16_t i;
+
+	*p++ = '0';
+	*p++ = 'x';
+	for (i = 0; i < len; i++) {
+		*p++ = hex_digits[data[i] >> 4];
+		*p++ = hex_digits[data[i] & 0x0f];
+	}
+
+	return p;
+}
+
+/**
+ * \brief Format IPv4 address in dotted decimal notation
+ */
+static char *fmt_ipv4(char *p, const uint8_t *data)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (data[i] >= 100) {
+			*p++ = '0' + data[i] / 100;
+			p = fmt_pad(p, data[i] % 100, 2);
+		} else {
+			p = fmt_uint(p, data[i]);
+		}
+		*p++ = '.';
+	}
+
+	return p - 1;
+}
+
+/**
+ * \brief Format IPv6 address in the canonical form (RFC 5952)
+ */
+static char *fmt_ipv6(char *p, const uint8_t *data)
+{
+	uint16_t groups[8];
+	int best_start = -1, best_len = 1;
+	int start, len;
+	int i, shift;
+
+	for (i = 0; i < 8; i++) {
+		groups[i] = (data[2 * i] << 8) | data[2 * i + 1];
+	}
+
+	/* Find the longest run of zero groups */
+	for (i = 0; i < 8; i++) {
+		if (groups[i] != 0) {
+			continue;
+		}
+		for (start = i; i < 8 && groups[i] == 0; i++);
+		len = i - start;
+		if (len > best_len) {
+			best_start = start;
+			best_len = len;
+		}
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (i == best_start) {
+			*p++ = ':';
+			if (i == 0) {
+				*p++ = ':';
+			}
+			i += best_len - 1;
+			continue;
+		}
+
+		for (shift = 12; shift > 0 && !(groups[i] >> shift); shift -= 4);
+		for (; shift >= 0; shift -= 4) {
+			*p++ = hex_digits[(groups[i] >> shift) & 0x0f];
+		}
+		if (i < 7) {
+			*p++ = ':';
+		}
+	}
+
+	return p;
+}
+
+/**
+ * \brief Format MAC address
+ */
+static char *fmt_mac(char *p, const uint8_t *data)
+{
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		*p++ = hex_digits[data[i] >> 4];
+		*p++ = hex_digits[data[i] & 0x0f];
+		*p++ = ':';
+	}
+
+	return p - 1;
+}
+
+/**
+ * \brief Format UTC timestamp as "YYYY-MM-DD hh:mm:ss[.fraction]"
+ *
+ * \param[out] p output position
+ * \param[in] sec seconds since the UNIX epoch
+ * \param[in] frac fraction of the second
+ * \param[in] digits number of digits of the fraction (0 for none)
+ * \return end of the written text
+ */
+static char *fmt_time(char *p, uint64_t sec, uint32_t frac, int digits)
+{
+	/* Days to civil date, see http://howardhinnant.github.io/date_algorithms.html */
+	uint64_t z = sec / 86400 + 719468;
+	uint32_t rem = sec % 86400;
+	uint64_t era = z / 146097;
+	uint32_t doe = z - era * 146097;
+	uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	uint32_t mp = (5 * doy + 2) / 153;
+	uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+	uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+	uint64_t year = yoe + era * 400 + (month <= 2);
+
+	if (year < 10000) {
+		p = fmt_pad(p, year, 4);
+	} else {
+		p = fmt_uint(p, year);
+	}
+	*p++ = '-';
+	p = fmt_pad(p, month, 2);
+	*p++ = '-';
+	p = fmt_pad(p, day, 2);
+	*p++ = ' ';
+	p = fmt_pad(p, rem / 3600, 2);
+	*p++ = ':';
+	p = fmt_pad(p, rem / 60 % 60, 2);
+	*p++ = ':';
+	p = fmt_pad(p, rem % 60, 2);
+
+	if (digits) {
+		*p++ = '.';
+		p = fmt_pad(p, frac, digits);
+	}
+
+	return p;
+}
+
+/**
+ * \brief Format string
+ *
+ * Control characters are replaced by dots. In CSV the string is quoted and
+ * the quotes inside are doubled.
+ *
+ * \param[out] p output position with at least 2 * len + 2 free bytes
+ * \param[in] data string
+ * \param[in] len length of the string
+ * \param[in] csv quote for CSV
+ * \return end of the written text
+ */
+static char *fmt_string(char *p, const uint8_t *data, uint16_t len, int csv)
+{
+	uint16_t i;
+
+	if (csv) {
+		*p++ = '"';
+	}
+
+	for (i = 0; i < len; i++) {
+		if (data[i] < 0x20 || data[i] == 0x7f) {
+			*p++ = '.';
+			continue;
+		}
+		if (csv && data[i] == '"') {
+			*p++ = '"';
+		}
+		*p++ = data[i];
+	}
+
+	if (csv) {
+		*p++ = '"';
+	}
+
+	return p;
+}
+
+/**
+ * \brief Read unsigned integer in network byte order (reduced size encoding)
+ *
+ * \param[in] data field value
+ * \param[in] len length of the field (1 - 8)
+ * \return value of the field
+ */
+static inline uint64_t read_uint(const uint8_t *data, uint16_t len)
+{
+	uint64_t value = 0;
+	uint16_t i;
+
+	switch (len) {
+	case 1:
+		return read8(data);
+	case 2:
+		return ntohs(read16(data));
+	case 4:
+		return ntohl(read32(data));
+	case 8:
+		return be64toh(read64(data));
+	default:
+		for (i = 0; i < len; i++) {
+			value = (value << 8) | data[i];
+		}
+		return value;
+	}
+}
+
+/**
+ * \brief Format value of a data record field
+ *
+ * Values which do not match their data type (e.g. length) are printed
+ * as hexadecimal numbers.
+ *
+ * \param[out] p output position with at least 2 * len + VIEWER_VALUE_MAX free bytes
+ * \param[in] field template field
+ * \param[in] data field value
+ * \param[in] len length of the value
+ * \param[in] csv format for CSV
+ * \return end of the written text
+ */
+static char *fmt_value(char *p, const struct viewer_field *field,
+		const uint8_t *data, uint16_t len, int csv)
+{
+	uint64_t value;
+	uint32_t sec;
+	union {
+		uint32_t u32;
+		uint64_t u64;
+		float f;
+		double d;
+	} fp;
+
+	switch (field->type) {
+	case ET_UNSIGNED_8:
+	case ET_UNSIGNED_16:
+	case ET_UNSIGNED_32:
+	case ET_UNSIGNED_64:
+		if (len == 0 || len > 8) {
+			break;
+		}
+		return fmt_uint(p, read_uint(data, len));
+	case ET_SIGNED_8:
+	case ET_SIGNED_16:
+	case ET_SIGNED_32:
+	case ET_SIGNED_64:
+		if (len == 0 || len > 8) {
+			break;
+		}
+		/* Sign extension of the reduced size encoding */
+		value = read_uint(data, len) << (64 - 8 * len);
+		return fmt_int(p, ((int64_t) value) >> (64 - 8 * len));
+	case ET_FLOAT_32:
+	case ET_FLOAT_64:
+		if (len == 4) {
+			fp.u32 = ntohl(read32(data));
+			return p + snprintf(p, VIEWER_VALUE_MAX, "%.9g", fp.f);
+		} else if (len == 8) {
+			fp.u64 = be64toh(read64(data));
+			return p + snprintf(p, VIEWER_VALUE_MAX, "%.17g", fp.d);
+		}
+		break;
+	case ET_BOOLEAN:
+		if (len != 1 || (data[0] != 1 && data[0] != 2)) {
+			break;
+		}
+		if (data[0] == 1) {
+			memcpy(p, "true", 4);
+			return p + 4;
+		}
+		memcpy(p, "false", 5);
+		return p + 5;
+	case ET_MAC_ADDRESS:
+		if (len != 6) {
+			break;
+		}
+		return fmt_mac(p, data);
+	case ET_STRING:
+		return fmt_string(p, data, len, csv);
+	case ET_DATE_TIME_SECONDS:
+		if (len != 4) {
+			break;
+		}
+		return fmt_time(p, ntohl(read32(data)), 0, 0);
+	case ET_DATE_TIME_MILLISECONDS:
+		if (len != 8) {
+			break;
+		}
+		value = be64toh(read64(data));
+		return fmt_time(p, value / 1000, value % 1000, 3);
+	case ET_DATE_TIME_MICROSECONDS:
+	case ET_DATE_TIME_NANOSECONDS:
+		/* NTP timestamp */
+		if (len != 8) {
+			break;
+		}
+		sec = ntohl(read32(data));
+		if (sec < VIEWER_NTP_EPOCH) {
+			break;
+		}
+		value = ntohl(read32(data + 4));
+		if (field->type == ET_DATE_TIME_MICROSECONDS) {
+			return fmt_time(p, sec - VIEWER_NTP_EPOCH, (value * 1000000) >> 32, 6);
+		}
+		return fmt_time(p, sec - VIEWER_NTP_EPOCH, (value * 1000000000) >> 32, 9);
+	case ET_IPV4_ADDRESS:
+		if (len != 4) {
+			break;
+		}
+		return fmt_ipv4(p, data);
+	case ET_IPV6_ADDRESS:
+		if (len != 16) {
+			break;
+		}
+		return fmt_ipv6(p, data);
+	default:
+		break;
+	}
+
+	return fmt_hex(p, data, len);
+}
+
+/**
+ * \brief Check whether the ODID is selected
+ */
+static inline int viewer_odid_selected(const struct viewer_config *conf, uint32_t odid)
+{
+	int i;
+
+	if (conf->odid_cnt == 0) {
+		return 1;
+	}
+
+	for (i = 0; i < conf->odid_cnt; i++) {
+		if (conf->odids[i] == odid) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Check whether data records of the template are selected
+ *
+ * Templates are selected by the ID used by the exporter.
+ */
+static inline int viewer_template_selected(const struct viewer_config *conf,
+		const struct ipfix_template *template)
+{
+	int i;
+
+	if (!template) {
+		return 0;
+	}
+	if (conf->template_cnt == 0) {
+		return 1;
+	}
+
+	for (i = 0; i < conf->template_cnt; i++) {
+		if (conf->templates[i] == template->original_id) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Resolve template fields for formatting
+ *
+ * Element types are looked up once per data set, not for each record.
+ *
+ * \param[in] conf plugin configuration
+ * \param[in] template template of the data set
+ * \return 0 on success, -1 otherwise
+ */
+static int viewer_resolve_fields(struct viewer_config *conf,
+		const struct ipfix_template *template)
+{
+	const ipfix_element_t *element;
+	struct viewer_field *field;
+	uint16_t count, index;
+
+	if (template->field_count > conf->fields_size) {
+		field = realloc(conf->fields, template->field_count * sizeof(*field));
+		if (!field) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return -1;
+		}
+		conf->fields = field;
+		conf->fields_size = template->field_count;
+	}
+
+	for (count = 0, index = 0; count < template->field_count; ++count, ++index) {
+		field = &conf->fields[count];
+		field->id = template->fields[index].ie.id;
+		field->length = template->fields[index].ie.length;
+		field->en = 0;
+
+		if (field->id & 0x8000) {
+			field->id &= 0x7fff;
+			field->en = template->fields[++index].enterprise_number;
+		}
+
+		element = get_element_by_id(field->id, field->en);
+		field->type = element ? element->type : ET_UNASSIGNED;
+		field->name = element ? element->name : NULL;
+	}
+
+	return 0;
+}
+
 /**
  * \brief Print IPFIX message header
  *
+ * \param[in] conf plugin configuration
  * \param[in] hdr message header structure
  * \return nothing
  */
-static void print_header(struct ipfix_header *hdr)
+static void print_header(struct viewer_config *conf, struct ipfix_header *hdr)
 {
 	time_t time = (time_t) ntohl(hdr->export_time);
 	char *str_time = ctime(&time);
 	str_time[strlen(str_time) - 1] = '\0';
 
-	printf("--------------------------------------------------------------------------------\n");
-	printf("IPFIX Message Header:\n");
-	printf("\tVersion: %u\n", ntohs(hdr->version));
-	printf("\tLength: %u\n", ntohs(hdr->length));
-	printf("\tExport Time: %u (%s)\n", ntohl(hdr->export_time), str_time);
-	printf("\tSequence Number: %u\n", ntohl(hdr->sequence_number));
-	printf("\tObservation Domain ID: %u\n", ntohl(hdr->observation_domain_id));
+	out_printf(conf, "--------------------------------------------------------------------------------\n");
+	out_printf(conf, "IPFIX Message Header:\n");
+	out_printf(conf, "\tVersion: %u\n", ntohs(hdr->version));
+	out_printf(conf, "\tLength: %u\n", ntohs(hdr->length));
+	out_printf(conf, "\tExport Time: %u (%s)\n", ntohl(hdr->export_time), str_time);
+	out_printf(conf, "\tSequence Number: %u\n", ntohl(hdr->sequence_number));
+	out_printf(conf, "\tObservation Domain ID: %u\n", ntohl(hdr->observation_domain_id));
 }
 
 /**
  * \brief Print set header
  *
+ * \param[in] conf plugin configuration
  * \param[in] set_header set header structure
  * \return nothing
  */
-static void print_set_header(struct ipfix_template_set *template_set)
+static void print_set_header(struct viewer_config *conf, struct ipfix_template_set *template_set)
 {
 	struct ipfix_set_header *set_header = (struct ipfix_set_header *) template_set;
 
-	printf("Set Header:\n");
-	printf("\tSet ID: %u", ntohs(set_header->flowset_id));
+	out_printf(conf, "Set Header:\n");
+	out_printf(conf, "\tSet ID: %u", ntohs(set_header->flowset_id));
 
 	switch (ntohs(set_header->flowset_id)) {
 	case (2):
-		printf(" (Template Set)\n");
+		out_printf(conf, " (Template Set)\n");
 		break;
 	case (3):
-		printf(" (Options Template Set)\n");
+		out_printf(conf, " (Options Template Set)\n");
 		break;
 	default:
 		if (ntohs(set_header->flowset_id) >= IPFIX_MIN_RECORD_FLOWSET_ID) {
-			printf(" (Data Set)\n");
+			out_printf(conf, " (Data Set)\n");
 		} else {
-			printf(" (Unknown ID)\n");
+			out_printf(conf, " (Unknown ID)\n");
 		}
 		break;
 	}
 
-	printf("\tLength: %u\n", ntohs(set_header->length));
+	out_printf(conf, "\tLength: %u\n", ntohs(set_header->length));
 }
 
 /**
  * \brief Print template record
  *
+ * \param[in] conf plugin configuration
  * \param[in] rec template record structure
  * \return length of the template in bytes (including header).
  */
-static uint16_t print_template_record(struct ipfix_template_record *rec)
+static uint16_t print_template_record(struct viewer_config *conf, struct ipfix_template_record *rec)
 {
 	uint16_t count = 0;
 	uint16_t offset = 0;
 	uint16_t index;
 
-	printf("Template Record Header:\n");
-	printf("\tTemplate ID: %u\n", ntohs(rec->template_id));
-	printf("\tField Count: %u\n", ntohs(rec->count));
+	out_printf(conf, "Template Record Header:\n");
+	out_printf(conf, "\tTemplate ID: %u\n", ntohs(rec->template_id));
+	out_printf(conf, "\tField Count: %u\n", ntohs(rec->count));
 	offset += 4;    /* template record header */
 
-	printf("Fields:\n");
+	out_printf(conf, "Fields:\n");
 
 	index = count;
 
 	/* print fields */
 	while (count != ntohs(rec->count)) {
-		printf("\tIE ID: %u\t", ntohs(rec->fields[index].ie.id) & 0x7fff);
+		out_printf(conf, "\tIE ID: %u\t", ntohs(rec->fields[index].ie.id) & 0x7fff);
 		if (ntohs(rec->fields[index].ie.length) != VAR_IE_LENGTH) {
-			printf("\tField Length: %u", ntohs(rec->fields[index].ie.length));
+			out_printf(conf, "\tField Length: %u", ntohs(rec->fields[index].ie.length));
 		} else {
-			printf("\tField Length: variable");
+			out_printf(conf, "\tField Length: variable");
 		}
 		offset += 4;
 
@@ -164,11 +819,11 @@ static uint16_t print_template_record(struct ipfix_template_record *rec)
 		if (ntohs(rec->fields[index].ie.id) >> 15) {
 			/* Enterprise number follows */
 			++index;
-			printf(" (PEN:%u)", ntohl(rec->fields[index].enterprise_number));
+			out_printf(conf, " (PEN:%u)", ntohl(rec->fields[index].enterprise_number));
 			offset += 4;
 		}
 
-		printf("\n");
+		out_printf(conf, "\n");
 
 		++index;
 		++count;
@@ -180,32 +835,34 @@ static uint16_t print_template_record(struct ipfix_template_record *rec)
 /**
  * \brief Print options template record
  *
+ * \param[in] conf plugin configuration
  * \param[in] rec options template record structure
  * \return length of the template in bytes (including header)
  */
-static uint16_t print_options_template_record(struct ipfix_options_template_record *rec)
+static uint16_t print_options_template_record(struct viewer_config *conf,
+		struct ipfix_options_template_record *rec)
 {
 	uint16_t count = 0;       /* number of fields processed */
 	uint16_t offset = 0;      /* offset in 'rec' structure (bytes) */
 	uint16_t index;           /* index in rec->fields[] */
 
-	printf("Options Template Record Header:\n");
-	printf("\tTemplate ID: %u\n", ntohs(rec->template_id));
-	printf("\tField Count: %u\n", ntohs(rec->count));
-	printf("\tScope Field Count: %u\n", ntohs(rec->scope_field_count));
+	out_printf(conf, "Options Template Record Header:\n");
+	out_printf(conf, "\tTemplate ID: %u\n", ntohs(rec->template_id));
+	out_printf(conf, "\tField Count: %u\n", ntohs(rec->count));
+	out_printf(conf, "\tScope Field Count: %u\n", ntohs(rec->scope_field_count));
 	offset += 6;              /* size of the Opt. Template Record Header */
 
-	printf("Fields:\n");
+	out_printf(conf, "Fields:\n");
 
 	index = count;
 
 	while (count != ntohs(rec->count)) {
-		printf("\tIE ID: %u\t", ntohs(rec->fields[index].ie.id) & 0x7fff);
+		out_printf(conf, "\tIE ID: %u\t", ntohs(rec->fields[index].ie.id) & 0x7fff);
 		if (ntohs(rec->fields[index].ie.length) != VAR_IE_LENGTH) {
-			printf("\tField Length: %u", ntohs(rec->fields[index].ie.length));
+			out_printf(conf, "\tField Length: %u", ntohs(rec->fields[index].ie.length));
 		} else {
 			/* field has variable length */
-			printf("\tField Length: variable");
+			out_printf(conf, "\tField Length: variable");
 		}
 		offset += 4;
 
@@ -213,11 +870,11 @@ static uint16_t print_options_template_record(struct ipfix_options_template_reco
 		if (ntohs(rec->fields[index].ie.id) >> 15) {
 			/* Enterprise number follows */
 			++index;
-			printf(" (PEN:%u)", ntohl(rec->fields[index].enterprise_number));
+			out_printf(conf, " (PEN:%u)", ntohl(rec->fields[index].enterprise_number));
 			offset += 4;
 		}
 
-		printf("\n");
+		out_printf(conf, "\n");
 
 		++index;
 		++count;
@@ -229,10 +886,11 @@ static uint16_t print_options_template_record(struct ipfix_options_template_reco
 /**
  * \brief Print all template sets in IPFIX message
  *
+ * \param[in] conf plugin configuration
  * \param[in] ipfix_msg IPFIX message
  * \return 0 on success, -1 otherwise
  */
-static int print_template_sets(const struct ipfix_message *ipfix_msg)
+static int print_template_sets(struct viewer_config *conf, const struct ipfix_message *ipfix_msg)
 {
 	uint16_t template_index = 0;
 	struct ipfix_template_set *template_set;
@@ -248,23 +906,23 @@ static int print_template_sets(const struct ipfix_message *ipfix_msg)
 	template_set = ipfix_msg->templ_set[template_index];
 
 	while (template_set) {
-		printf("\n\n");
+		out_printf(conf, "\n\n");
 		offset = 0;
 
 		/* print template set header */
-		print_set_header(template_set);
+		print_set_header(conf, template_set);
 		offset += 4;  /* size of the set header */
 
 		while ((int) ntohs(template_set->header.length) - (int) offset >= 8) {
 			template_record = (struct ipfix_template_record *) (((uint8_t *) template_set) + offset);
 			/* print template record */
-			offset += print_template_record(template_record);
+			offset += print_template_record(conf, template_record);
 		}
 
 		/* compute possible padding */
 		padding = (int) ntohs(template_set->header.length) - (int) offset;
 		if (padding > 0) {
-			printf("Padding: %d\n", padding);
+			out_printf(conf, "Padding: %d\n", padding);
 		}
 
 		/* process next set */
@@ -277,10 +935,11 @@ static int print_template_sets(const struct ipfix_message *ipfix_msg)
 /**
  * \brief Print all options template sets in IPFIX message
  *
+ * \param[in] conf plugin configuration
  * \param[in] ipfix_msg IPFIX message
  * \return 0 on success, -1 otherwise
  */
-static int print_options_template_sets(const struct ipfix_message *ipfix_msg)
+static int print_options_template_sets(struct viewer_config *conf, const struct ipfix_message *ipfix_msg)
 {
 	uint16_t template_index = 0;
 	struct ipfix_options_template_set *template_set;
@@ -295,23 +954,23 @@ static int print_options_template_sets(const struct ipfix_message *ipfix_msg)
 	template_set = ipfix_msg->opt_templ_set[template_index];
 
 	while (template_set) {
-		printf("\n\n");
+		out_printf(conf, "\n\n");
 		offset = 0;
 
 		/* print options template set header */
-		print_set_header((struct ipfix_template_set *) template_set);
+		print_set_header(conf, (struct ipfix_template_set *) template_set);
 		offset += 4;  /* size of the header */
 
 		while ((int) ntohs(template_set->header.length) - (int) offset >= 12) {
 			options_template_record = (struct ipfix_options_template_record *) (((uint8_t *) template_set) + offset);
 			/* print options template record */
-			offset += print_options_template_record(options_template_record);
+			offset += print_options_template_record(conf, options_template_record);
 		}
 
 		/* compute possible padding */
 		padding = (int) ntohs(template_set->header.length) - (int) offset;
 		if (padding > 0) {
-			printf("Padding: %d\n", padding);
+			out_printf(conf, "Padding: %d\n", padding);
 		}
 
 		/* process next set */
@@ -322,107 +981,103 @@ static int print_options_template_sets(const struct ipfix_message *ipfix_msg)
 }
 
 /**
- * \brief Print data record
+ * \brief Get length of a field value
  *
- * \param[in] data_record IPFIX data record
- * \param[in] template corresponding template
- * \return length of the data record
+ * \param[in] field template field
+ * \param[in,out] data position of the field, moved behind the length prefix
+ *                of variable-length fields
+ * \param[in] end end of the data set
+ * \return length of the value, -1 if the field exceeds the data set
  */
-static uint16_t print_data_record(uint8_t *data_record, struct ipfix_template *template)
+static inline int field_length(const struct viewer_field *field, uint8_t **data, const uint8_t *end)
 {
-	int i;
+	uint16_t length = field->length;
+	uint8_t *ptr = *data;
 
-	if (!template) {
-		/* we don't have template for this data set */
-		fprintf(stderr, "ERROR: no template for this data set\n");
-		return 0;
+	if (length == VAR_IE_LENGTH) {
+		if (ptr + 1 > end) {
+			return -1;
+		}
+		length = read8(ptr);
+		ptr += 1;
+
+		if (length == 255) {
+			if (ptr + 2 > end) {
+				return -1;
+			}
+			length = ntohs(read16(ptr));
+			ptr += 2;
+		}
 	}
 
-	uint16_t count = 0;
-	uint16_t offset = 0;
-	uint16_t index;
-	uint16_t length;
-	uint16_t id;
+	if (ptr + length > end) {
+		return -1;
+	}
 
-	index = count;
+	*data = ptr;
+	return length;
+}
 
-	/* print all fields */
-	while (count != template->field_count) {
-		id = template->fields[index].ie.id;
-		printf("\tIE ID: %u", id & 0x7fff);
+/**
+ * \brief Print data record
+ *
+ * \param[in] conf plugin configuration with resolved template fields
+ * \param[in] data_record IPFIX data record
+ * \param[in] end end of the data set
+ * \param[in] template corresponding template
+ * \return length of the data record, 0 if the record is malformed
+ */
+static uint16_t print_data_record(struct viewer_config *conf, uint8_t *data_record,
+		const uint8_t *end, const struct ipfix_template *template)
+{
+	const struct viewer_field *field;
+	uint8_t *data = data_record;
+	uint16_t count;
+	char *p;
+	int length;
+
+	for (count = 0; count < template->field_count; ++count) {
+		field = &conf->fields[count];
+
+		length = field_length(field, &data, end);
+		if (length < 0) {
+			return 0;
+		}
 
-		length = template->fields[index].ie.length;
+		p = out_reserve(conf, 2 * length + VIEWER_VALUE_MAX);
+		memcpy(p, "\tIE ID: ", 8);
+		p = fmt_uint(p + 8, field->id);
 
-		if (id >> 15) {
+		if (field->en) {
 			/* Enterprise Number */
-			printf(" (PEN:%u)\t", template->fields[++index].enterprise_number);
+			memcpy(p, " (PEN:", 6);
+			p = fmt_uint(p + 6, field->en);
+			memcpy(p, ")\t", 2);
+			p += 2;
 		} else {
-			printf("\t\t");
+			memcpy(p, "\t\t", 2);
+			p += 2;
 		}
 
-		switch (length) {
-		case (1):
-			printf("Value: %#x\n", read8(data_record+offset));
-			offset += 1;
-			break;
-		case (2):
-			printf("Value: %#x\n", read16(data_record+offset));
-			offset += 2;
-			break;
-		case (4):
-			printf("Value: %#x\n", read32(data_record+offset));
-			offset += 4;
-			break;
-		case (8):
-			printf("Value: %#" PRIx64 "\n", read64(data_record+offset));
-			offset += 8;
-			break;
-		default:
-			if (length != VAR_IE_LENGTH) {
-				printf("Value: 0x");
-
-				for (i = 0; i < length; i++) {
-					printf("%02x", (data_record+offset)[i]);
-				}
-				printf("\n");
-
-				offset += length;
-			} else {
-				/* variable length */
-				length = read8(data_record+offset);
-				offset += 1;
-
-				if (length == 255) {
-					length = ntohs(read16(data_record+offset));
-					offset += 2;
-				}
-
-				printf("Value: 0x");
-
-				for (i = 0; i < length; i++) {
-					printf("%02x", (data_record+offset)[i]);
-				}
-				printf("\n");
-
-				offset += length;
-			}
-			break;
-		}
+		memcpy(p, "Value: ", 7);
+		p = fmt_value(p + 7, field, data, length, 0);
+		*p++ = '\n';
+		out_commit(conf, p);
 
-		++index;
-		++count;
+		data += length;
 	}
 
-	return offset;
+	return data - data_record;
 }
 
 /**
  * \brief Print all data sets in IPFIX message
  *
+ * \param[in] conf plugin configuration
  * \param[in] ipfix_msg IPFIX message
  * \return 0 on success, -1 otherwise
  */
-static int print_data_sets(const struct ipfix_message *ipfix_msg)
+static int print_data_sets(struct viewer_config *conf, const struct ipfix_message *ipfix_msg)
 {
 	uint16_t data_index = 0;
 	struct ipfix_data_set *data_set;
@@ -431,23 +1086,25 @@ static int print_data_sets(const struct ipfix_message *ipfix_msg)
 	uint16_t counter = 1;
 	uint32_t offset;
 	uint16_t min_record_length;
+	uint16_t record_length;
 	int padding;
 
 	data_set = ipfix_msg->data_couple[data_index].data_set;
 
 	while (data_set) {
-		printf("\n\n");
 		template = ipfix_msg->data_couple[data_index].data_template;
-		if (!template) {
-			/* Data set without template, skip it */
+		if (!viewer_template_selected(conf, template)
+				|| viewer_resolve_fields(conf, template)) {
+			/* Data set without template or not selected, skip it */
 			data_set = ipfix_msg->data_couple[++data_index].data_set;
 			continue;
 		}
+		out_printf(conf, "\n\n");
 		min_record_length = template->data_length;
 		offset = 0;
 		counter = 1;
 
-		print_set_header((struct ipfix_template_set *) data_set);
+		print_set_header(conf, (struct ipfix_template_set *) data_set);
 		offset += 4;  /* size of the header */
 
 		if (min_record_length & 0x8000) {
@@ -458,14 +1115,21 @@ static int print_data_sets(const struct ipfix_message *ipfix_msg)
 		while ((int) ntohs(data_set->header.length) - (int) offset - (int) min_record_length >= 0) {
 			data_record = (((uint8_t *) data_set) + offset);
 			/* print data record */
-			printf("Data Record (#%u):\t\t(network byte order)\n", counter++);
-			offset += print_data_record(data_record, template);
+			out_printf(conf, "Data Record (#%u):\n", counter++);
+			record_length = print_data_record(conf, data_record,
+					((uint8_t *) data_set) + ntohs(data_set->header.length), template);
+			if (record_length == 0) {
+				MSG_WARNING(msg_module, "Malformed data record in data set %u",
+						ntohs(data_set->header.flowset_id));
+				break;
+			}
+			offset += record_length;
 		}
 
 		/* compute possible padding */
 		padding = (int) ntohs(data_set->header.length) - (int) offset;
 		if (padding > 0) {
-			printf("Padding: %d\n", padding);
+			out_printf(conf, "Padding: %d\n", padding);
 		}
 
 		/* process next set */
@@ -475,6 +1139,325 @@ static int print_data_sets(const struct ipfix_message *ipfix_msg)
 	return 0;
 }
 
+/**
+ * \brief Print CSV header for data records of a template
+ *
+ * Columns of unknown elements are named eXidY (enterprise number X,
+ * element ID Y).
+ *
+ * \param[in] conf plugin configuration with resolved template fields
+ * \param[in] template template of the data records
+ */
+static void csv_header(struct viewer_config *conf, const struct ipfix_template *template)
+{
+	const struct viewer_field *field;
+	uint16_t count;
+	size_t len;
+	char *p;
+
+	out_printf(conf, "odid,template");
+
+	for (count = 0; count < template->field_count; ++count) {
+		field = &conf->fields[count];
+
+		if (field->name) {
+			len = strlen(field->name);
+			p = out_reserve(conf, len + 1);
+			*p++ = ',';
+			memcpy(p, field->name, len);
+			p += len;
+		} else {
+			p = out_reserve(conf, VIEWER_VALUE_MAX);
+			memcpy(p, ",e", 2);
+			p = fmt_uint(p + 2, field->en);
+			memcpy(p, "id", 2);
+			p = fmt_uint(p + 2, field->id);
+		}
+		out_commit(conf, p);
+	}
+
+	out_bytes(conf, "\n", 1);
+}
+
+/**
+ * \brief Print all selected data records in IPFIX message as CSV
+ *
+ * A header line is printed whenever the template changes.
+ *
+ * \param[in] conf plugin configuration
+ * \param[in] ipfix_msg IPFIX message
+ * \return 0 on success, -1 otherwise
+ */
+static int csv_data_sets(struct viewer_config *conf, const struct ipfix_message *ipfix_msg)
+{
+	uint32_t odid = ntohl(ipfix_msg->pkt_header->observation_domain_id);
+	uint16_t data_index;
+	struct ipfix_data_set *data_set;
+	struct ipfix_template *template;
+	const struct viewer_field *field;
+	uint8_t *data, *end, *record;
+	uint16_t min_record_length;
+	uint16_t count;
+	char prefix[32];
+	size_t prefix_len;
+	char *p;
+	int length;
+
+	for (data_index = 0; (data_set = ipfix_msg->data_couple[data_index].data_set); ++data_index) {
+		template = ipfix_msg->data_couple[data_index].data_template;
+		if (!viewer_template_selected(conf, template)
+				|| viewer_resolve_fields(conf, template)) {
+			continue;
+		}
+
+		if (!conf->csv_header || conf->csv_odid != odid
+				|| conf->csv_template != template->original_id) {
+			csv_header(conf, template);
+			conf->csv_header = 1;
+			conf->csv_odid = odid;
+			conf->csv_template = template->original_id;
+		}
+
+		/* Columns shared by all records of the set */
+		p = fmt_uint(prefix, odid);
+		*p++ = ',';
+		p = fmt_uint(p, template->original_id);
+		prefix_len = p - prefix;
+
+		min_record_length = template->data_length & 0x7fff;
+		data = ((uint8_t *) data_set) + 4;
+		end = ((uint8_t *) data_set) + ntohs(data_set->header.length);
+
+		while (end - data >= min_record_length && end - data > 0) {
+			record = data;
+
+			for (count = 0; count < template->field_count; ++count) {
+				field = &conf->fields[count];
+
+				length = field_length(field, &data, end);
+				if (length < 0) {
+					break;
+				}
+
+				if (count == 0) {
+					p = out_reserve(conf, prefix_len + 2 * length + VIEWER_VALUE_MAX);
+					memcpy(p, prefix, prefix_len);
+					p += prefix_len;
+				} else {
+					p = out_reserve(conf, 2 * length + VIEWER_VALUE_MAX);
+				}
+
+				*p++ = ',';
+				p = fmt_value(p, field, data, length, 1);
+				out_commit(conf, p);
+
+				data += length;
+			}
+
+			if (count != template->field_count || data == record) {
+				MSG_WARNING(msg_module, "Malformed data record in data set %u",
+						ntohs(data_set->header.flowset_id));
+				out_bytes(conf, "\n", 1);
+				break;
+			}
+
+			out_bytes(conf, "\n", 1);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Write IPFIX message with selected data sets
+ *
+ * Template sets are always kept so that the output can be decoded.
+ * Without template filter the message is copied as it is.
+ *
+ * \param[in] conf plugin configuration
+ * \param[in] ipfix_msg IPFIX message
+ * \return 0 on success, -1 otherwise
+ */
+static int write_ipfix_message(struct viewer_config *conf, const struct ipfix_message *ipfix_msg)
+{
+	struct ipfix_header *header;
+	struct ipfix_set_header *set;
+	uint16_t length = ntohs(ipfix_msg->pkt_header->length);
+	uint16_t index;
+	char *start, *p;
+
+	if (conf->template_cnt == 0) {
+		out_bytes(conf, ipfix_msg->pkt_header, length);
+		return 0;
+	}
+
+	/* The new message is never longer than the original one */
+	start = out_reserve(conf, length);
+	memcpy(start, ipfix_msg->pkt_header, IPFIX_HEADER_LENGTH);
+	p = start + IPFIX_HEADER_LENGTH;
+
+	for (index = 0; ipfix_msg->templ_set[index]; ++index) {
+		set = &ipfix_msg->templ_set[index]->header;
+		memcpy(p, set, ntohs(set->length));
+		p += ntohs(set->length);
+	}
+
+	for (index = 0; ipfix_msg->opt_templ_set[index]; ++index) {
+		set = &ipfix_msg->opt_templ_set[index]->header;
+		memcpy(p, set, ntohs(set->length));
+		p += ntohs(set->length);
+	}
+
+	for (index = 0; ipfix_msg->data_couple[index].data_set; ++index) {
+		if (!viewer_template_selected(conf, ipfix_msg->data_couple[index].data_template)) {
+			continue;
+		}
+		set = &ipfix_msg->data_couple[index].data_set->header;
+		memcpy(p, set, ntohs(set->length));
+		p += ntohs(set->length);
+	}
+
+	/* Nothing to write */
+	if (p == start + IPFIX_HEADER_LENGTH) {
+		return 0;
+	}
+
+	header = (struct ipfix_header *) start;
+	header->length = htons(p - start);
+	out_commit(conf, p);
+
+	return 0;
+}
+
+/**
+ * \brief Parse comma separated list of numbers
+ *
+ * \param[in] str list
+ * \param[out] list parsed numbers
+ * \param[in] max maximal value of a number
+ * \return number of items, -1 on error
+ */
+static int parse_list(const char *str, uint32_t *list, unsigned long max)
+{
+	unsigned long value;
+	char *end;
+	int cnt = 0;
+
+	while (*str) {
+		while (*str == ' ' || *str == ',') {
+			str++;
+		}
+		if (!*str) {
+			break;
+		}
+
+		errno = 0;
+		value = strtoul(str, &end, 10);
+		if (end == str || errno || value > max || cnt == VIEWER_FILTER_MAX) {
+			return -1;
+		}
+		list[cnt++] = value;
+
+		for (str = end; *str == ' '; str++);
+		if (*str && *str != ',') {
+			return -1;
+		}
+	}
+
+	return cnt;
+}
+
+/**
+ * \brief Parse plugin configuration
+ *
+ * \param[in] params XML configuration
+ * \param[in,out] conf plugin configuration
+ * \return 0 on success, -1 otherwise
+ */
+static int parse_config(char *params, struct viewer_config *conf)
+{
+	xmlDocPtr doc;
+	xmlNodePtr cur;
+	char *value;
+	char *path = NULL;
+	int ret = 0;
+
+	conf->fd = STDOUT_FILENO;
+
+	if (!params) {
+		return 0;
+	}
+
+	doc = xmlReadMemory(params, strlen(params), "nobase.xml", NULL, 0);
+	if (doc == NULL) {
+		MSG_ERROR(msg_module, "Plugin configuration not parsed successfully");
+		return -1;
+	}
+
+	cur = xmlDocGetRootElement(doc);
+	if (cur == NULL) {
+		MSG_ERROR(msg_module, "Empty configuration");
+		xmlFreeDoc(doc);
+		return -1;
+	}
+
+	for (cur = cur->xmlChildrenNode; cur && ret == 0; cur = cur->next) {
+		if (cur->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		value = (char *) xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
+		if (!value) {
+			continue;
+		}
+
+		if (!xmlStrcmp(cur->name, (const xmlChar *) "format")) {
+			if (!strcasecmp(value, "text")) {
+				conf->format = VIEWER_TEXT;
+			} else if (!strcasecmp(value, "csv")) {
+				conf->format = VIEWER_CSV;
+			} else if (!strcasecmp(value, "ipfix")) {
+				conf->format = VIEWER_IPFIX;
+			} else {
+				MSG_ERROR(msg_module, "Unknown output format '%s'", value);
+				ret = -1;
+			}
+		} else if (!xmlStrcmp(cur->name, (const xmlChar *) "odid")) {
+			conf->odid_cnt = parse_list(value, conf->odids, UINT32_MAX);
+			if (conf->odid_cnt < 0) {
+				MSG_ERROR(msg_module, "Invalid list of ODIDs '%s'", value);
+				ret = -1;
+			}
+		} else if (!xmlStrcmp(cur->name, (const xmlChar *) "template")) {
+			conf->template_cnt = parse_list(value, conf->templates, UINT16_MAX);
+			if (conf->template_cnt < 0) {
+				MSG_ERROR(msg_module, "Invalid list of template IDs '%s'", value);
+				ret = -1;
+			}
+		} else if (!xmlStrcmp(cur->name, (const xmlChar *) "file")) {
+			free(path);
+			/* "file:" scheme is optional */
+			path = strdup(strncmp(value, "file:", 5) ? value : value + 5);
+		}
+
+		xmlFree(value);
+	}
+
+	xmlFreeDoc(doc);
+
+	if (ret == 0 && path && *path) {
+		conf->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if (conf->fd == -1) {
+			MSG_ERROR(msg_module, "Unable to open output file '%s': %s", path, strerror(errno));
+			ret = -1;
+		}
+	}
+
+	free(path);
+	return ret;
+}
+
 /**
  * \brief Storage plugin initialization.
  *
@@ -487,7 +1470,6 @@ static int print_data_sets(const struct ipfix_message *ipfix_msg)
  */
 int storage_init(char *params, void **config)
 {
-	(void) params;
 	struct viewer_config *conf;
 
 	conf = (struct viewer_config *) calloc(1, sizeof(*conf));
@@ -496,6 +1478,21 @@ int storage_init(char *params, void **config)
 		return -1;
 	}
 
+	if (parse_config(params, conf)) {
+		free(conf);
+		return -1;
+	}
+
+	conf->buffer = malloc(VIEWER_BUFFER_SIZE);
+	if (!conf->buffer) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		if (conf->fd != STDOUT_FILENO) {
+			close(conf->fd);
+		}
+		free(conf);
+		return -1;
+	}
+
 	*config = conf;
 	return 0;
 }
@@ -522,31 +1519,40 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
 	}
 
 	conf = (struct viewer_config *) config;
-	conf->empty = 1; /* just to suppress compiler's warning */
 
-	/* print header */
-	print_header(ipfix_msg->pkt_header);
+	if (!viewer_odid_selected(conf, ntohl(ipfix_msg->pkt_header->observation_domain_id))) {
+		return 0;
+	}
+
+	switch (conf->format) {
+	case VIEWER_CSV:
+		csv_data_sets(conf, ipfix_msg);
+		break;
+	case VIEWER_IPFIX:
+		write_ipfix_message(conf, ipfix_msg);
+		break;
+	default:
+		/* print header */
+		print_header(conf, ipfix_msg->pkt_header);
 
-	print_template_sets(ipfix_msg);
-	print_options_template_sets(ipfix_msg);
-	print_data_sets(ipfix_msg);
+		print_template_sets(conf, ipfix_msg);
+		print_options_template_sets(conf, ipfix_msg);
+		print_data_sets(conf, ipfix_msg);
+		break;
+	}
 
-	return 0;
+	return conf->error ? -1 : 0;
 }
 
 /**
- * \brief This function does nothing in ipfixviewer plugin
- *
- * Just flush all buffers.
+ * \brief Flush the output buffer
  *
  * \param[in] config the plugin specific configuration structure
  * \return 0 on success, negative value otherwise
  */
 int store_now(const void *config)
 {
-	/* nothing to do */
-	(void) config;
-	return 0;
+	return out_flush((struct viewer_config *) config);
 }
 
 /**
@@ -561,8 +1567,17 @@ int store_now(const void *config)
 int storage_close(void **config)
 {
 	struct viewer_config *conf = (struct viewer_config *) *config;
+	int ret;
+
+	ret = out_flush(conf);
+	if (conf->fd != STDOUT_FILENO) {
+		close(conf->fd);
+	}
+
+	free(conf->fields);
+	free(conf->buffer);
 	free(conf);
-	return 0;
+	return ret;
 }
 
 /**@}*/
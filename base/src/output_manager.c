@@ -54,6 +54,7 @@
 #include "configurator.h"
 #include "data_manager.h"
 #include "output_manager.h"
+#include "source_rate.h"
 
 /* MSG_ macros identifiers */
 static const char *msg_module = "output manager";
@@ -419,7 +420,7 @@ static void *output_manager_plugin_thread(void* config)
 		}
 		
 		/* Write data into input queue of Storage Plugins */
-		if (rbuffer_write(data_config->store_queue, msg, data_config->plugins_count) != 0) {
+		if (data_manager_write(data_config, msg) != 0) {
 			MSG_WARNING(msg_module, "[%u] Unable to write into Data Manager input queue; skipping data...", data_config->observation_domain_id);
 			rbuffer_remove_reference(conf->in_queue, index, 1);
 			free(msg);
@@ -828,6 +829,9 @@ static void *statistics_thread(void* config)
 			MSG_ALWAYS(" | %10s %15lu %15lu %15lu", "Total:", packets_total, data_records_total, lost_data_records_total);
 		}
 		
+		/* Print per-source rates and shedding */
+		source_rate_print_stats(stat_out_file, conf->stat_interval);
+
 		/* Print CPU usage by threads */
 		statistics_print_cpu(&(conf->stats), stat_out_file);
 		
@@ -49,6 +49,7 @@
 #include <ipfixcol.h>
 #include <ipfixcol/ipfix_message.h>
 #include "crc.h"
+#include "source_rate.h"
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "preprocessor";
@@ -229,6 +230,10 @@ void preprocessor_set_output_queue(struct ring_buffer *out_queue)
 void preprocessor_set_configurator(configurator *conf)
 {
 	global_config = conf;
+
+	if (conf && source_rate_configure(conf->collector_node) != 0) {
+		MSG_WARNING(msg_module, "Invalid sourceRateLimit configuration; per-source rate limiting disabled");
+	}
 }
 
 /**
@@ -243,13 +248,13 @@ struct ring_buffer *get_preprocessor_output_queue()
  * \brief Compute 32b CRC from input informations 
  * 
  * @param input_info Input informations
- * @return crc32
+ * @return crc32c
  */
 uint32_t preprocessor_compute_crc(struct input_info *input_info)
 {
 	if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
 		struct input_info_file *input_file = (struct input_info_file *) input_info;
-		return crc32(input_file->name, strlen(input_file->name));
+		return crc32c(0, input_file->name, strlen(input_file->name));
 	}
 	
 	struct input_info_network *input = (struct input_info_network *) input_info;
@@ -264,7 +269,7 @@ uint32_t preprocessor_compute_crc(struct input_info *input_info)
 	uint8_t ip_addr_len = strlen(buff);
 	snprintf(buff + ip_addr_len, 5 + 1, "%u", input->src_port);
 
-	return crc32(buff, strlen(buff));
+	return crc32c(0, buff, strlen(buff));
 }
 
 /**
@@ -394,10 +399,12 @@ static int preprocessor_process_one_template(void *tmpl, int max_len, int type,
 }
 
 static int mdata_max = 0;
+static unsigned int mdata_flags = MDATA_ALL;
 
 void fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
 {
 	struct ipfix_message *msg = (struct ipfix_message *) data;
+	struct metadata *mdata;
 	
 	/* Allocate space for metadata */
 	if (mdata_max == 0) {
@@ -425,15 +432,39 @@ void fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void
 		mdata_max *= 2;
 	}
 	
+	mdata = &(msg->metadata[msg->data_records_count]);
+
 	/* Fill metadata */
-	msg->live_profile = (global_config) ? config_get_current_profiles(global_config) : NULL;
-	msg->metadata[msg->data_records_count].record.record = rec;
-	msg->metadata[msg->data_records_count].record.length = rec_len;
-	msg->metadata[msg->data_records_count].record.templ = templ;
+	mdata->record.record = rec;
+	mdata->record.length = rec_len;
+	mdata->record.templ = templ;
 	
 	msg->data_records_count++;
 }
 
+/**
+ * \brief Count data records in a data set without building metadata
+ *
+ * @param[in] data_set Data set
+ * @param[in] templ Data template
+ * @return Number of data records
+ */
+static uint32_t preprocessor_count_records(struct ipfix_data_set *data_set, struct ipfix_template *templ)
+{
+	uint16_t set_len = ntohs(data_set->header.length);
+
+	/* Variable-length elements, records have to be walked */
+	if ((templ->data_length & 0x80000000) || templ->data_length == 0) {
+		return data_set_process_records(data_set, templ, NULL, NULL);
+	}
+
+	if (set_len < sizeof(struct ipfix_set_header)) {
+		return 0;
+	}
+
+	return (set_len - sizeof(struct ipfix_set_header)) / templ->data_length;
+}
+
 /**
  * \brief Process templates
  *
@@ -513,6 +544,11 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 
 	mdata_max = 0;
 
+	/* Metadata required by running plugins; none means records are only counted */
+	mdata_flags = (global_config) ? config_get_metadata(global_config) : MDATA_ALL;
+
+	msg->live_profile = (global_config) ? config_get_current_profiles(global_config) : NULL;
+
 	/* add template to message data_couples */
 	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; i++) {
 		key.tid = ntohs(msg->data_couple[i].data_set->header.flowset_id);
@@ -535,7 +571,12 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 			}
 
 			/* compute sequence number and fill metadata */
-			records_count += data_set_process_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template, fill_metadata, msg);
+			if (mdata_flags) {
+				records_count += data_set_process_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template, fill_metadata, msg);
+			} else {
+				records_count += preprocessor_count_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template);
+				msg->data_records_count = records_count;
+			}
 		}
 	}
 
@@ -548,12 +589,48 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 	 * b) fill metadata WHILE counting data records (using now) (replace data_set_records_count with data_set_process_records and add callback)
 	 *		+ one acces to data sets
 	 *		- needs reallocation
+	 *
+	 * Metadata are built only when some plugin declares it needs them
+	 * (IPFIXCOL_METADATA), otherwise only the number of records is computed.
 	 */
 	
 	/* return number of data records */
 	return msg->data_records_count;
 }
 
+/**
+ * \brief Drop data of processed message, including template references and metadata
+ *
+ * Template sets are kept: the templates are already in the template manager,
+ * so plugins writing raw messages must see them too.
+ *
+ * @param msg IPFIX message
+ * @return true if the whole message was freed
+ */
+static bool preprocessor_shed_msg(struct ipfix_message *msg)
+{
+	bool removed[MSG_MAX_DATA_COUPLES];
+	int i;
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		removed[i] = true;
+	}
+
+	message_remove_data_sets(msg, removed, msg->data_records_count);
+
+	if (msg->metadata) {
+		message_free_metadata(msg);
+		msg->metadata = NULL;
+	}
+
+	if (!msg->templ_set[0] && !msg->opt_templ_set[0]) {
+		message_free(msg);
+		return true;
+	}
+
+	return false;
+}
+
 /**
  * \brief Parse IPFIX message and send it to intermediate plugin or output managers queue
  * 
@@ -565,6 +642,7 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info, int source_status)
 {
 	struct ipfix_message* msg;
+	struct source_rate *src_rate;
 	uint32_t exporter_ip_addr;
 	uint32_t *seqn;
 
@@ -594,6 +672,7 @@ void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info
 		msg->input_info = input_info;
 		msg->source_status = source_status;
 		data_source_info_remove_source(exporter_ip_addr, input_info->odid);
+		source_rate_remove(exporter_ip_addr);
 	} else {
 		if (packet == NULL) {
 			MSG_WARNING(msg_module, "[%u] Received empty IPFIX message", input_info->odid);
@@ -650,6 +729,13 @@ void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info
 		/* Update other input_info variables */
 		++msg->input_info->packets;
 		msg->input_info->data_records += msg->data_records_count;
+
+		/* Shed data of sources exceeding their share of a saturated pipeline */
+		src_rate = source_rate_get(exporter_ip_addr, input_info);
+		if (src_rate && !source_rate_admit(src_rate, msg, preprocessor_out_queue)
+				&& preprocessor_shed_msg(msg)) {
+			return;
+		}
 	}
 
 	/* Send data to the first intermediate plugin */
@@ -665,5 +751,6 @@ void preprocessor_close()
 {
 	/* output queue will be closed by intermediate process or output manager */
 	data_source_info_destroy();
+	source_rate_destroy();
 	return;
 }
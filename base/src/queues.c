@@ -172,6 +172,49 @@ int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uin
 	return ret;
 }
 
+/**
+ * \brief Add new record into the ring buffer if there is space for it.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] record IPFIX message structure to be added into the ring buffer.
+ * @param[in] ref_count Initial refference count - number of reading threads.
+ * @return 0 on success, nonzero when the ring buffer is full or on error.
+ */
+int rbuffer_try_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count)
+{
+	int ret = EXIT_SUCCESS;
+
+	if (rbuffer == NULL || ref_count == 0) {
+		MSG_ERROR(msg_module, "Invalid ring buffer write parameters");
+		return EXIT_FAILURE;
+	}
+
+	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
+		return EXIT_FAILURE;
+	}
+
+	/* Same condition as in rbuffer_write(), but do not wait */
+	if (rbuffer->count + 1 >= rbuffer->size) {
+		ret = EXIT_FAILURE;
+	} else {
+		rbuffer->data[rbuffer->write_offset] = record;
+		rbuffer->data_references[rbuffer->write_offset] = ref_count;
+		rbuffer->write_offset = (rbuffer->write_offset + 1) % rbuffer->size;
+		rbuffer->count++;
+
+		if (pthread_cond_signal(&(rbuffer->cond)) != 0) {
+			MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
+		}
+	}
+
+	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
+	}
+
+	return ret;
+}
+
 /**
  * \brief Get pointer to data in ring buffer - its position is specified by
  * index or by ring buffer's current read offset.
@@ -242,8 +285,6 @@ struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *in
  */
 int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, uint8_t do_free)
 {
-	int i;
-
 	/* atomic rbuffer->data_references[index]--; and check <= 0 */
 	if (__sync_fetch_and_sub(&(rbuffer->data_references[index]), 1) <= 0) {
 		return EXIT_FAILURE;
@@ -260,22 +301,7 @@ int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, ui
 			if (do_free) {
 				/* free the data */
 				if (rbuffer->data[rbuffer->read_offset]) {
-					if (rbuffer->data[rbuffer->read_offset]->pkt_header) {
-						free(rbuffer->data[rbuffer->read_offset]->pkt_header);
-					}
-
-					/* Decrement reference on templates */
-					for (i = 0; i < MSG_MAX_DATA_COUPLES && rbuffer->data[rbuffer->read_offset]->data_couple[i].data_set; ++i) {
-						if (rbuffer->data[rbuffer->read_offset]->data_couple[i].data_template) {
-							tm_template_reference_dec(rbuffer->data[rbuffer->read_offset]->data_couple[i].data_template);
-						}
-					}
-					
-					if (rbuffer->data[rbuffer->read_offset]->metadata) {
-						message_free_metadata(rbuffer->data[rbuffer->read_offset]);
-					}
-					
-					free(rbuffer->data[rbuffer->read_offset]);
+					message_release(rbuffer->data[rbuffer->read_offset]);
 				}
 			}
 
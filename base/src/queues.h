@@ -92,6 +92,18 @@ struct ring_buffer* rbuffer_init(uint16_t size);
  */
 int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count);
 
+/**
+ * \brief Add new record into the ring buffer if there is space for it.
+ *
+ * Unlike rbuffer_write(), the function does not wait for readers.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] record IPFIX message structure to be added into the ring buffer.
+ * @param[in] ref_count Initial refference count - number of reading threads.
+ * @return 0 on success, nonzero when the ring buffer is full or on error.
+ */
+int rbuffer_try_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count);
+
 /**
  * \brief Get pointer to data in ring buffer - its position is specified by
  * index or by ring buffer's current read offset.
@@ -0,0 +1,439 @@
+/**
+ * \file source_rate.c
+ * \brief Per-source rate accounting and load shedding
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "source_rate.h"
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "source rate";
+
+/** Default bucket size in seconds of configured rate */
+#define SOURCE_RATE_DEFAULT_BURST 2
+/** Default queue utilization (%) at which shedding starts */
+#define SOURCE_RATE_DEFAULT_WATERMARK 80
+
+/* Weight of one exporter address */
+struct source_rate_weight {
+	char addr[INET6_ADDRSTRLEN];
+	uint32_t weight;
+	struct source_rate_weight *next;
+};
+
+/* Rate limiting configuration */
+static struct {
+	uint32_t rate;          /**< Records per second per weight unit, 0 = no limit */
+	uint32_t burst;         /**< Bucket size per weight unit */
+	uint32_t watermark;     /**< Queue utilization (%) at which shedding starts */
+	struct source_rate_weight *weights;
+} rate_conf = {0, 0, SOURCE_RATE_DEFAULT_WATERMARK, NULL};
+
+/* List of sources, modified only by the input thread */
+static struct source_rate *sources = NULL;
+/* Last used source; consecutive messages usually come from the same one */
+static struct source_rate *last_source = NULL;
+/* Protects list against concurrent reading by the statistics thread */
+static pthread_mutex_t sources_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \brief Get unsigned number from element content
+ *
+ * \param[in] node XML element
+ * \param[out] value parsed value
+ * \return 0 on success
+ */
+static int source_rate_parse_uint(xmlNode *node, uint32_t *value)
+{
+	char *content = (char *) xmlNodeGetContent(node);
+	char *end = NULL;
+	unsigned long aux;
+
+	if (!content) {
+		return 1;
+	}
+
+	aux = strtoul(content, &end, 10);
+	if (end == content || *end != '\0' || aux > UINT32_MAX) {
+		MSG_ERROR(msg_module, "Invalid value '%s' of element %s", content, (char *) node->name);
+		xmlFree(content);
+		return 1;
+	}
+
+	xmlFree(content);
+	*value = aux;
+	return 0;
+}
+
+/**
+ * \brief Parse &lt;exporter&gt; element with weight of one exporter
+ *
+ * \param[in] node exporter element
+ * \return 0 on success
+ */
+static int source_rate_parse_exporter(xmlNode *node)
+{
+	struct source_rate_weight *weight;
+	char *addr;
+
+	weight = calloc(1, sizeof(struct source_rate_weight));
+	if (!weight) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	weight->weight = 1;
+	for (node = node->children; node; node = node->next) {
+		if (!xmlStrcmp(node->name, (const xmlChar *) "address")) {
+			addr = (char *) xmlNodeGetContent(node);
+			if (addr) {
+				strncpy_safe(weight->addr, addr, INET6_ADDRSTRLEN);
+				xmlFree(addr);
+			}
+		} else if (!xmlStrcmp(node->name, (const xmlChar *) "weight")) {
+			if (source_rate_parse_uint(node, &weight->weight) || weight->weight == 0) {
+				MSG_ERROR(msg_module, "Exporter weight must be a positive number");
+				free(weight);
+				return 1;
+			}
+		}
+	}
+
+	if (weight->addr[0] == '\0') {
+		MSG_ERROR(msg_module, "Missing exporter address in sourceRateLimit configuration");
+		free(weight);
+		return 1;
+	}
+
+	weight->next = rate_conf.weights;
+	rate_conf.weights = weight;
+	return 0;
+}
+
+/**
+ * \brief Parse sourceRateLimit element of the collecting process
+ */
+int source_rate_configure(xmlNode *collector_node)
+{
+	xmlNode *node;
+	int ret = 0;
+
+	if (!collector_node) {
+		return 0;
+	}
+
+	for (node = collector_node->children; node; node = node->next) {
+		if (node->type == XML_ELEMENT_NODE &&
+				!xmlStrcmp(node->name, (const xmlChar *) "sourceRateLimit")) {
+			break;
+		}
+	}
+
+	if (!node) {
+		/* Accounting only */
+		return 0;
+	}
+
+	for (node = node->children; node && !ret; node = node->next) {
+		if (node->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		if (!xmlStrcmp(node->name, (const xmlChar *) "recordsPerSecond")) {
+			ret = source_rate_parse_uint(node, &rate_conf.rate);
+		} else if (!xmlStrcmp(node->name, (const xmlChar *) "burst")) {
+			ret = source_rate_parse_uint(node, &rate_conf.burst);
+		} else if (!xmlStrcmp(node->name, (const xmlChar *) "queueWatermark")) {
+			ret = source_rate_parse_uint(node, &rate_conf.watermark);
+			if (!ret && rate_conf.watermark > 100) {
+				MSG_ERROR(msg_module, "Queue watermark must be in range 0-100 %%");
+				ret = 1;
+			}
+		} else if (!xmlStrcmp(node->name, (const xmlChar *) "exporter")) {
+			ret = source_rate_parse_exporter(node);
+		} else {
+			MSG_WARNING(msg_module, "Unknown element '%s' in sourceRateLimit; ignoring...", (char *) node->name);
+		}
+	}
+
+	if (ret) {
+		rate_conf.rate = 0;
+		return ret;
+	}
+
+	if (rate_conf.burst == 0) {
+		rate_conf.burst = rate_conf.rate * SOURCE_RATE_DEFAULT_BURST;
+	}
+
+	if (rate_conf.rate) {
+		MSG_INFO(msg_module, "Limiting sources to %" PRIu32 " records/s (burst %" PRIu32 ") above %" PRIu32 " %% queue utilization",
+				rate_conf.rate, rate_conf.burst, rate_conf.watermark);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Fill printable source identification and weight of the source
+ *
+ * \param[in] input_info Input information
+ * \param[out] src Source rate structure
+ */
+static void source_rate_fill_name(struct input_info *input_info, struct source_rate *src)
+{
+	struct input_info_network *input = (struct input_info_network *) input_info;
+	char addr[INET6_ADDRSTRLEN];
+	struct source_rate_weight *weight;
+
+	src->weight = 1;
+
+	if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
+		strncpy_safe(src->name, ((struct input_info_file *) input_info)->name, SOURCE_RATE_NAME_LEN);
+		return;
+	}
+
+	if (input->l3_proto == 6) { /* IPv6 */
+		inet_ntop(AF_INET6, &(input->src_addr.ipv6.s6_addr), addr, INET6_ADDRSTRLEN);
+	} else { /* IPv4 */
+		inet_ntop(AF_INET, &(input->src_addr.ipv4.s_addr), addr, INET_ADDRSTRLEN);
+	}
+
+	snprintf(src->name, SOURCE_RATE_NAME_LEN, "%s:%u", addr, input->src_port);
+
+	for (weight = rate_conf.weights; weight; weight = weight->next) {
+		if (!strcmp(weight->addr, addr)) {
+			src->weight = weight->weight;
+			break;
+		}
+	}
+}
+
+/**
+ * \brief Get source rate structure, create new one for unknown source
+ */
+struct source_rate *source_rate_get(uint32_t crc, struct input_info *input_info)
+{
+	struct source_rate *src;
+
+	if (last_source && last_source->crc == crc) {
+		return last_source;
+	}
+
+	for (src = sources; src; src = src->next) {
+		if (src->crc == crc) {
+			last_source = src;
+			return src;
+		}
+	}
+
+	src = calloc(1, sizeof(struct source_rate));
+	if (!src) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	src->crc = crc;
+	source_rate_fill_name(input_info, src);
+	src->tokens = (double) rate_conf.burst * src->weight;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &src->last_refill);
+
+	pthread_mutex_lock(&sources_mutex);
+	src->next = sources;
+	sources = src;
+	pthread_mutex_unlock(&sources_mutex);
+
+	MSG_DEBUG(msg_module, "New source %s with weight %" PRIu32, src->name, src->weight);
+
+	last_source = src;
+	return src;
+}
+
+/**
+ * \brief Refill token bucket according to elapsed time
+ *
+ * \param[in] src Source rate structure
+ */
+static inline void source_rate_refill(struct source_rate *src)
+{
+	struct timespec now;
+	double elapsed, max_tokens;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	elapsed = (now.tv_sec - src->last_refill.tv_sec) + (now.tv_nsec - src->last_refill.tv_nsec) / 1e9;
+	if (elapsed <= 0) {
+		return;
+	}
+
+	src->last_refill = now;
+	src->tokens += elapsed * rate_conf.rate * src->weight;
+
+	max_tokens = (double) rate_conf.burst * src->weight;
+	if (src->tokens > max_tokens) {
+		src->tokens = max_tokens;
+	}
+}
+
+/**
+ * \brief Decide whether the message may enter the pipeline
+ */
+int source_rate_admit(struct source_rate *src, const struct ipfix_message *msg, const struct ring_buffer *queue)
+{
+	uint16_t records = msg->data_records_count;
+
+	if (rate_conf.rate == 0 || records == 0 || msg->source_status != SOURCE_STATUS_OPENED) {
+		src->records += records;
+		return 1;
+	}
+
+	source_rate_refill(src);
+
+	if (src->tokens >= records) {
+		src->tokens -= records;
+		src->records += records;
+		return 1;
+	}
+
+	/* Over the share of the source; shed only when the pipeline is saturated */
+	if ((uint32_t) queue->count * 100 < (uint32_t) queue->size * rate_conf.watermark) {
+		src->tokens = 0;
+		src->records += records;
+		return 1;
+	}
+
+	src->shed_records += records;
+	src->shed_msgs++;
+	return 0;
+}
+
+/**
+ * \brief Remove accounting of closed source
+ */
+void source_rate_remove(uint32_t crc)
+{
+	struct source_rate *src, *prev = NULL;
+
+	pthread_mutex_lock(&sources_mutex);
+	for (src = sources; src; prev = src, src = src->next) {
+		if (src->crc != crc) {
+			continue;
+		}
+
+		if (prev) {
+			prev->next = src->next;
+		} else {
+			sources = src->next;
+		}
+
+		if (last_source == src) {
+			last_source = NULL;
+		}
+
+		free(src);
+		break;
+	}
+	pthread_mutex_unlock(&sources_mutex);
+}
+
+/**
+ * \brief Print per-source statistics
+ */
+void source_rate_print_stats(FILE *stat_out_file, int interval)
+{
+	struct source_rate *src;
+	uint64_t delta_records, delta_shed;
+
+	if (interval <= 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&sources_mutex);
+
+	if (!stat_out_file && sources) {
+		MSG_ALWAYS(" |", NULL);
+		MSG_ALWAYS(" | %-46s %6s %15s %15s %15s %15s", "source", "weight", "data rec.", "shed data rec.",
+				"data records/s", "shed records/s");
+	}
+
+	for (src = sources; src; src = src->next) {
+		delta_records = src->records - src->last_records;
+		delta_shed = src->shed_records - src->last_shed_records;
+
+		if (stat_out_file) {
+			fprintf(stat_out_file, "%s_%s=%" PRIu64 "\n", "SOURCE_DATA_REC", src->name, src->records);
+			fprintf(stat_out_file, "%s_%s=%" PRIu64 "\n", "SOURCE_SHED_DATA_REC", src->name, src->shed_records);
+			fprintf(stat_out_file, "%s_%s=%" PRIu64 "\n", "SOURCE_DATA_REC_SEC", src->name, delta_records / interval);
+			fprintf(stat_out_file, "%s_%s=%" PRIu64 "\n", "SOURCE_SHED_DATA_REC_SEC", src->name, delta_shed / interval);
+		} else {
+			MSG_ALWAYS(" | %-46s %6" PRIu32 " %15" PRIu64 " %15" PRIu64 " %15" PRIu64 " %15" PRIu64,
+					src->name, src->weight, src->records, src->shed_records,
+					delta_records / interval, delta_shed / interval);
+		}
+
+		src->last_records = src->records;
+		src->last_shed_records = src->shed_records;
+	}
+
+	pthread_mutex_unlock(&sources_mutex);
+}
+
+/**
+ * \brief Remove all source rate structures and configuration
+ */
+void source_rate_destroy()
+{
+	struct source_rate *src;
+	struct source_rate_weight *weight;
+
+	pthread_mutex_lock(&sources_mutex);
+	while (sources) {
+		src = sources;
+		sources = sources->next;
+		free(src);
+	}
+	last_source = NULL;
+	pthread_mutex_unlock(&sources_mutex);
+
+	while (rate_conf.weights) {
+		weight = rate_conf.weights;
+		rate_conf.weights = weight->next;
+		free(weight);
+	}
+}
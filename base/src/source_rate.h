@@ -0,0 +1,129 @@
+/**
+ * \file source_rate.h
+ * \brief Per-source rate accounting and load shedding
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef SOURCE_RATE_H_
+#define SOURCE_RATE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <libxml/tree.h>
+
+#include "ipfixcol.h"
+#include "queues.h"
+
+/** Maximal length of the printable source name (address, port and null) */
+#define SOURCE_RATE_NAME_LEN (INET6_ADDRSTRLEN + 6 + 1)
+
+/**
+ * \brief Rate accounting of one flow data source
+ *
+ * Sources are identified by the CRC computed by preprocessor_compute_crc().
+ * Each source owns a token bucket refilled with configured rate multiplied by
+ * the weight of the source.
+ */
+struct source_rate {
+	uint32_t crc;                       /**< CRC of source identification */
+	char name[SOURCE_RATE_NAME_LEN];    /**< Printable source identification */
+	uint32_t weight;                    /**< Weight of the source */
+	double tokens;                      /**< Available records in token bucket */
+	struct timespec last_refill;        /**< Time of the last bucket refill */
+	uint64_t records;                   /**< Data records accepted */
+	uint64_t shed_records;              /**< Data records dropped by shedding */
+	uint64_t shed_msgs;                 /**< Messages dropped by shedding */
+	uint64_t last_records;              /**< Accepted records at last statistics run */
+	uint64_t last_shed_records;         /**< Shed records at last statistics run */
+	struct source_rate *next;           /**< Next source in list */
+};
+
+/**
+ * \brief Parse &lt;sourceRateLimit&gt; element of the collecting process
+ *
+ * Without the element only accounting is done and nothing is shed.
+ *
+ * \param[in] collector_node collectingProcess node of the startup configuration
+ * \return 0 on success, nonzero on error
+ */
+int source_rate_configure(xmlNode *collector_node);
+
+/**
+ * \brief Get accounting structure of source, create it if it does not exist
+ *
+ * \param[in] crc CRC of source identification
+ * \param[in] input_info Input information of the source
+ * \return Source rate structure or NULL on memory error
+ */
+struct source_rate *source_rate_get(uint32_t crc, struct input_info *input_info);
+
+/**
+ * \brief Decide whether the message may enter the pipeline
+ *
+ * The token bucket of the source is refilled and charged with data records of
+ * the message. If the queue utilization is above configured watermark and the
+ * source has exhausted its bucket, data sets of the message are shed; its
+ * template sets still pass. Messages without data records (templates, source
+ * status changes) are never shed.
+ *
+ * \param[in] src Source rate structure
+ * \param[in] msg IPFIX message from the source
+ * \param[in] queue Queue the message is going to be written to
+ * \return 1 if message may pass, 0 if its data have to be dropped
+ */
+int source_rate_admit(struct source_rate *src, const struct ipfix_message *msg, const struct ring_buffer *queue);
+
+/**
+ * \brief Remove accounting of closed source
+ *
+ * \param[in] crc CRC of source identification
+ */
+void source_rate_remove(uint32_t crc);
+
+/**
+ * \brief Print per-source statistics
+ *
+ * \param[in] stat_out_file Statistics file or NULL for console output
+ * \param[in] interval Time since last call in seconds
+ */
+void source_rate_print_stats(FILE *stat_out_file, int interval);
+
+/**
+ * \brief Remove all source rate structures and configuration
+ */
+void source_rate_destroy();
+
+#endif /* SOURCE_RATE_H_ */
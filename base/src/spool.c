@@ -0,0 +1,1467 @@
+/**
+ * \file spool.c
+ * \brief On-disk spool of IPFIX messages for lagging storage plugins
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <ipfixcol.h>
+#include <ipfixcol/profiles.h>
+#include "crc.h"
+#include "spool.h"
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "spool";
+
+/** Magic number of segments and the position file ("IXSP") */
+#define SPOOL_MAGIC   0x50535849
+/** Version of the segment format */
+#define SPOOL_VERSION 3
+/** Alignment of records in segments */
+#define SPOOL_ALIGN   8
+/** Limits of the segment size */
+#define SPOOL_SEGMENT_MIN (1ULL << 20)
+#define SPOOL_SEGMENT_MAX (64ULL << 20)
+/** Read position is saved after this number of messages */
+#define SPOOL_CHECKPOINT 256
+/** Size of the cache of templates written into the current segment */
+#define SPOOL_WCACHE 256
+/** Suffix of segment files */
+#define SPOOL_SUFFIX ".spool"
+/** Flag of a spooled message: metadata follow the packet */
+#define SPOOL_MSG_METADATA 0x1
+/** Flag of a spooled message: records were assigned to profile channels */
+#define SPOOL_MSG_PROFILED 0x2
+
+/** Aligned size of a record with payload of given length */
+#define SPOOL_RECORD_SIZE(len) \
+	((sizeof(struct spool_record_hdr) + (len) + SPOOL_ALIGN - 1) & ~((uint64_t) SPOOL_ALIGN - 1))
+
+/** Type of a record */
+enum spool_record_type {
+	SPOOL_TEMPLATE = 1,   /**< Template snapshot */
+	SPOOL_MESSAGE  = 2    /**< IPFIX message */
+};
+
+/** Header of a segment */
+struct spool_segment_hdr {
+	uint32_t magic;       /**< SPOOL_MAGIC */
+	uint16_t version;     /**< SPOOL_VERSION */
+	uint16_t reserved;
+	uint64_t number;      /**< Number of the segment */
+};
+
+/** Header of a record */
+struct spool_record_hdr {
+	uint32_t length;      /**< Length of the payload */
+	uint32_t crc;         /**< CRC-32C of type, id and the payload */
+	uint16_t type;        /**< enum spool_record_type */
+	uint16_t reserved;
+	uint32_t id;          /**< Template snapshot number (SPOOL_TEMPLATE) */
+};
+
+/** Content of the position file */
+struct spool_position {
+	uint64_t segment;     /**< Segment being read */
+	uint64_t offset;      /**< Offset of the next record to read */
+	uint32_t magic;       /**< SPOOL_MAGIC */
+	uint32_t crc;         /**< CRC-32C of the previous fields */
+};
+
+/** Source of a message (fixed part of the message payload) */
+struct spool_input {
+	uint32_t type;        /**< enum SOURCE_TYPE */
+	uint32_t odid;        /**< Observation Domain ID */
+	uint8_t src_addr[16]; /**< Source address */
+	uint8_t dst_addr[16]; /**< Destination address */
+	uint16_t src_port;    /**< Source port */
+	uint16_t dst_port;    /**< Destination port */
+	uint8_t l3_proto;     /**< IP protocol */
+	uint8_t reserved;
+	uint16_t name_len;    /**< Length of the file name that follows */
+};
+
+/** Header of a message payload */
+struct spool_message {
+	struct spool_input input;
+	uint32_t source_status;           /**< enum SOURCE_STATUS */
+	uint16_t packet_length;           /**< Length of the IPFIX packet */
+	uint16_t couples;                 /**< Number of Data Sets */
+	uint16_t data_records_count;
+	uint16_t templ_records_count;
+	uint16_t opt_templ_records_count;
+	uint16_t flags;                   /**< SPOOL_MSG_* flags */
+	uint64_t watermark;               /**< Watermark of an ordered message */
+};
+
+/** Data Set of a spooled message */
+struct spool_couple {
+	uint32_t offset;      /**< Offset of the Data Set in the packet */
+	uint32_t templ;       /**< Template snapshot number (0 = none) */
+};
+
+/** Metadata of a Data Record of a spooled message */
+struct spool_metadata {
+	uint32_t offset;      /**< Offset of the record in the packet */
+	uint32_t templ;       /**< Template snapshot number (0 = none) */
+	uint16_t length;      /**< Length of the record */
+	uint16_t srcCountry;
+	uint16_t dstCountry;
+	uint16_t reserved;
+	uint32_t srcAS;
+	uint32_t dstAS;
+	char srcName[32];
+	char dstName[32];
+};
+
+/** Template written into the current segment */
+struct spool_wtemplate {
+	const struct ipfix_template *templ; /**< Template of the collector */
+	uint32_t number;                    /**< Snapshot number */
+	uint16_t length;                    /**< Length of the copy */
+	uint8_t *copy;                      /**< Compared part of the template */
+};
+
+/** Template snapshot or input information kept until spool_close() */
+struct spool_keep {
+	struct spool_keep *next;
+	struct spool_input input;  /**< Source (input information only) */
+	char *name;                /**< File name (input information only) */
+	void *data;                /**< Template or input information */
+};
+
+/** Spool */
+struct spool {
+	char *dir;                 /**< Spool directory */
+	int lock_fd;               /**< Locked file in the directory */
+	int pos_fd;                /**< Position file */
+	uint64_t max_size;         /**< Size limit */
+	uint64_t segment_size;     /**< Preferred size of a segment */
+	uint64_t size;             /**< Size of all segments */
+
+	/* Writer */
+	int wfd;                   /**< Segment being written */
+	uint64_t wseg;             /**< Its number */
+	uint64_t woffset;          /**< Its size */
+	uint32_t wtemplates;       /**< Template snapshots written into it */
+	struct spool_wtemplate wcache[SPOOL_WCACHE]; /**< Snapshots written into it */
+	uint8_t *buf;              /**< Record being written */
+	size_t buf_size;           /**< Size of the buffer */
+
+	/* Reader */
+	int rfd;                   /**< Segment being read (-1 = none) */
+	uint64_t rseg;             /**< Its number */
+	uint64_t roffset;          /**< Offset of the next record */
+	uint64_t rlimit;           /**< Size of the segment (unless it is written) */
+	uint64_t rskip;            /**< Messages before this offset were already read */
+	uint8_t *rmap;             /**< Mapped segment */
+	size_t rmap_len;           /**< Length of the mapping */
+	struct ipfix_template **rtemplates; /**< Snapshots of the segment */
+	uint32_t rtemplates_count; /**< Number of snapshots */
+	uint32_t rtemplates_size;  /**< Size of the array */
+	unsigned int reads;        /**< Messages read since the last checkpoint */
+
+	struct spool_keep *templates; /**< Template snapshots of returned messages */
+	struct spool_keep *inputs;    /**< Input information of returned messages */
+};
+
+/**
+ * \brief Compute checksum of a record
+ */
+static uint32_t spool_crc(const struct spool_record_hdr *hdr, const uint8_t *payload)
+{
+	uint32_t crc = crc32c(0, &hdr->type,
+		sizeof(hdr->type) + sizeof(hdr->reserved) + sizeof(hdr->id));
+	return crc32c(crc, payload, hdr->length);
+}
+
+/**
+ * \brief Compose path of a file in the spool directory
+ */
+static void spool_path(const struct spool *spool, char *path, size_t size, const char *name)
+{
+	snprintf(path, size, "%s/%s", spool->dir, name);
+}
+
+/**
+ * \brief Compose path of a segment
+ */
+static void spool_segment_path(const struct spool *spool, char *path, size_t size, uint64_t number)
+{
+	snprintf(path, size, "%s/%016" PRIx64 SPOOL_SUFFIX, spool->dir, number);
+}
+
+/**
+ * \brief Save read position
+ */
+static void spool_checkpoint(struct spool *spool)
+{
+	struct spool_position pos;
+
+	spool->reads = 0;
+	if (spool->pos_fd < 0) {
+		return;
+	}
+
+	memset(&pos, 0, sizeof(pos));
+	pos.segment = spool->rseg;
+	pos.offset = spool->roffset;
+	pos.magic = SPOOL_MAGIC;
+	pos.crc = crc32c(0, &pos, offsetof(struct spool_position, crc));
+
+	if (pwrite(spool->pos_fd, &pos, sizeof(pos), 0) != sizeof(pos)) {
+		MSG_WARNING(msg_module, "Unable to save read position into '%s': %s", spool->dir, strerror(errno));
+	}
+}
+
+/**
+ * \brief Release compared copies of templates written into the segment
+ */
+static void spool_wcache_clear(struct spool *spool)
+{
+	int i;
+
+	for (i = 0; i < SPOOL_WCACHE; ++i) {
+		free(spool->wcache[i].copy);
+	}
+
+	memset(spool->wcache, 0, sizeof(spool->wcache));
+	spool->wtemplates = 0;
+}
+
+/**
+ * \brief Create a new segment for writing
+ *
+ * The previous segment is synchronized to the disk and closed.
+ */
+static int spool_segment_create(struct spool *spool)
+{
+	char path[PATH_MAX];
+	struct spool_segment_hdr hdr;
+	int fd;
+
+	if (spool->wfd >= 0) {
+		if (fdatasync(spool->wfd) != 0) {
+			MSG_WARNING(msg_module, "Unable to synchronize spool segment: %s", strerror(errno));
+		}
+
+		close(spool->wfd);
+		spool->wfd = -1;
+
+		/* The segment being read is complete now */
+		if (spool->rseg == spool->wseg) {
+			spool->rlimit = spool->woffset;
+		}
+	}
+
+	spool_wcache_clear(spool);
+	spool->wseg++;
+	spool->woffset = 0;
+
+	spool_segment_path(spool, path, sizeof(path), spool->wseg);
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0640);
+	if (fd < 0) {
+		MSG_ERROR(msg_module, "Unable to create spool segment '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = SPOOL_MAGIC;
+	hdr.version = SPOOL_VERSION;
+	hdr.number = spool->wseg;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		MSG_ERROR(msg_module, "Unable to write spool segment '%s': %s", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	spool->wfd = fd;
+	spool->woffset = sizeof(hdr);
+	spool->size += sizeof(hdr);
+	return 0;
+}
+
+/**
+ * \brief Make sure that the record buffer is large enough
+ */
+static int spool_buffer(struct spool *spool, size_t size)
+{
+	uint8_t *buf;
+
+	if (size <= spool->buf_size) {
+		return 0;
+	}
+
+	buf = realloc(spool->buf, size);
+	if (!buf) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return -1;
+	}
+
+	spool->buf = buf;
+	spool->buf_size = size;
+	return 0;
+}
+
+/**
+ * \brief Write prepared record (payload is in the buffer after the header)
+ */
+static int spool_write_record(struct spool *spool, uint16_t type, uint32_t id, uint32_t length)
+{
+	struct spool_record_hdr *hdr = (struct spool_record_hdr *) spool->buf;
+	uint64_t size = SPOOL_RECORD_SIZE(length);
+	ssize_t ret;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->length = length;
+	hdr->type = type;
+	hdr->id = id;
+	hdr->crc = spool_crc(hdr, spool->buf + sizeof(*hdr));
+	memset(spool->buf + sizeof(*hdr) + length, 0, size - sizeof(*hdr) - length);
+
+	ret = write(spool->wfd, spool->buf, size);
+	if (ret != (ssize_t) size) {
+		MSG_ERROR(msg_module, "Unable to write into spool '%s': %s", spool->dir,
+				ret < 0 ? strerror(errno) : "short write");
+		/* Do not leave a partial record behind */
+		if (ret > 0 && ftruncate(spool->wfd, spool->woffset) == 0) {
+			lseek(spool->wfd, spool->woffset, SEEK_SET);
+		}
+		return -1;
+	}
+
+	spool->woffset += size;
+	spool->size += size;
+	return 0;
+}
+
+/** Compared part of a template (volatile fields are skipped) */
+#define SPOOL_TEMPLATE_CMP(templ) ((const uint8_t *) &(templ)->template_id)
+#define SPOOL_TEMPLATE_CMP_LEN(templ) \
+	((templ)->template_length - offsetof(struct ipfix_template, template_id))
+
+/**
+ * \brief Get snapshot number of a template, write the snapshot if necessary
+ *
+ * \return Snapshot number, 0 when there is no template, -1 on error
+ */
+static int64_t spool_template(struct spool *spool, const struct ipfix_template *templ)
+{
+	struct spool_wtemplate *entry;
+	uint16_t cmp_len;
+
+	if (!templ) {
+		return 0;
+	}
+
+	if (templ->template_length < offsetof(struct ipfix_template, fields)) {
+		MSG_WARNING(msg_module, "Template %u has invalid length", templ->template_id);
+		return -1;
+	}
+
+	entry = &spool->wcache[((uintptr_t) templ / sizeof(void *)) % SPOOL_WCACHE];
+	cmp_len = SPOOL_TEMPLATE_CMP_LEN(templ);
+	if (entry->templ == templ && entry->length == cmp_len
+			&& memcmp(entry->copy, SPOOL_TEMPLATE_CMP(templ), cmp_len) == 0) {
+		return entry->number;
+	}
+
+	/* Write a new snapshot */
+	if (spool_buffer(spool, SPOOL_RECORD_SIZE(templ->template_length)) != 0) {
+		return -1;
+	}
+
+	memcpy(spool->buf + sizeof(struct spool_record_hdr), templ, templ->template_length);
+	if (spool_write_record(spool, SPOOL_TEMPLATE, spool->wtemplates + 1, templ->template_length) != 0) {
+		return -1;
+	}
+
+	spool->wtemplates++;
+
+	/* Remember it (failure only means that the snapshot may be written again) */
+	free(entry->copy);
+	entry->copy = malloc(cmp_len);
+	if (entry->copy) {
+		memcpy(entry->copy, SPOOL_TEMPLATE_CMP(templ), cmp_len);
+		entry->templ = templ;
+		entry->length = cmp_len;
+		entry->number = spool->wtemplates;
+	} else {
+		entry->templ = NULL;
+	}
+
+	return spool->wtemplates;
+}
+
+/**
+ * \brief Fill source of a message
+ */
+static void spool_input_encode(struct spool_input *input, const struct input_info *info, const char **name)
+{
+	const struct input_info_network *net;
+
+	memset(input, 0, sizeof(*input));
+	*name = NULL;
+	if (!info) {
+		input->type = SOURCE_TYPE_COUNT;
+		return;
+	}
+
+	input->type = info->type;
+	input->odid = info->odid;
+
+	if (info->type == SOURCE_TYPE_IPFIX_FILE) {
+		*name = ((const struct input_info_file *) info)->name;
+		if (*name) {
+			input->name_len = strnlen(*name, UINT16_MAX);
+		}
+		return;
+	}
+
+	net = (const struct input_info_network *) info;
+	memcpy(input->src_addr, &net->src_addr, sizeof(input->src_addr));
+	memcpy(input->dst_addr, &net->dst_addr, sizeof(input->dst_addr));
+	input->src_port = net->src_port;
+	input->dst_port = net->dst_port;
+	input->l3_proto = net->l3_proto;
+}
+
+/**
+ * \brief Get offset of a pointer into the packet
+ *
+ * \return Offset or -1 when the pointer does not point into the packet
+ */
+static int64_t spool_packet_offset(const struct ipfix_message *msg, const void *ptr, size_t length, uint16_t packet_length)
+{
+	const uint8_t *start = (const uint8_t *) msg->pkt_header;
+
+	if ((const uint8_t *) ptr < start || (const uint8_t *) ptr + length > start + packet_length) {
+		return -1;
+	}
+
+	return (const uint8_t *) ptr - start;
+}
+
+/**
+ * \brief Find snapshot number of a template of a Data Set
+ *
+ * \param[in] numbers Snapshot numbers of the Data Sets or NULL
+ * \return Snapshot number (or 1 when numbers is NULL) when found, 0 otherwise
+ */
+static uint32_t spool_couple_template(const struct ipfix_message *msg, uint16_t couples,
+		const uint32_t *numbers, const struct ipfix_template *templ)
+{
+	uint16_t i;
+
+	for (i = 0; i < couples; ++i) {
+		if (msg->data_couple[i].data_template == templ) {
+			return numbers ? numbers[i] : 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Append message to the spool
+ */
+int spool_append(struct spool *spool, struct ipfix_message *msg)
+{
+	struct spool_message hdr;
+	struct spool_couple couple;
+	struct spool_metadata meta;
+	const char *name;
+	uint64_t length, estimate;
+	uint32_t numbers[MSG_MAX_DATA_COUPLES];
+	uint16_t couples, i;
+	uint8_t *p;
+	int64_t ret;
+
+	if (!msg->pkt_header || spool->wfd < 0) {
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	spool_input_encode(&hdr.input, msg->input_info, &name);
+	hdr.source_status = msg->source_status;
+	hdr.packet_length = ntohs(msg->pkt_header->length);
+	hdr.data_records_count = msg->data_records_count;
+	hdr.templ_records_count = msg->templ_records_count;
+	hdr.opt_templ_records_count = msg->opt_templ_records_count;
+	if (msg->metadata) {
+		hdr.flags |= SPOOL_MSG_METADATA;
+		/* Channels are owned by the profile tree, records are matched again on replay */
+		for (i = 0; i < msg->data_records_count; ++i) {
+			if (msg->metadata[i].channels) {
+				hdr.flags |= SPOOL_MSG_PROFILED;
+				break;
+			}
+		}
+	}
+	hdr.watermark = msg->watermark;
+
+	if (hdr.packet_length < IPFIX_HEADER_LENGTH) {
+		return -1;
+	}
+
+	/* Check that everything can be expressed relatively to the packet */
+	estimate = 0;
+	for (couples = 0; couples < MSG_MAX_DATA_COUPLES && msg->data_couple[couples].data_set; ++couples) {
+		if (spool_packet_offset(msg, msg->data_couple[couples].data_set,
+				sizeof(struct ipfix_set_header), hdr.packet_length) < 0) {
+			return -1;
+		}
+		if (msg->data_couple[couples].data_template) {
+			estimate += SPOOL_RECORD_SIZE(msg->data_couple[couples].data_template->template_length);
+		}
+	}
+	hdr.couples = couples;
+
+	if (msg->metadata) {
+		for (i = 0; i < msg->data_records_count; ++i) {
+			if (!msg->metadata[i].record.record) {
+				continue;
+			}
+			if (spool_packet_offset(msg, msg->metadata[i].record.record,
+					msg->metadata[i].record.length, hdr.packet_length) < 0) {
+				return -1;
+			}
+			/* Only templates of the Data Sets are stored */
+			if (msg->metadata[i].record.templ
+					&& spool_couple_template(msg, couples, NULL, msg->metadata[i].record.templ) == 0) {
+				return -1;
+			}
+		}
+	}
+
+	length = sizeof(hdr) + hdr.input.name_len + couples * sizeof(struct spool_couple) + hdr.packet_length;
+	if (msg->metadata) {
+		length += (uint64_t) msg->data_records_count * sizeof(struct spool_metadata);
+	}
+
+	if (length > UINT32_MAX) {
+		return -1;
+	}
+
+	estimate += SPOOL_RECORD_SIZE(length);
+	if (spool->size + estimate > spool->max_size) {
+		/* The message would never fit */
+		return spool_empty(spool) ? -1 : SPOOL_FULL;
+	}
+
+	if (spool->woffset > sizeof(struct spool_segment_hdr) && spool->woffset + estimate > spool->segment_size) {
+		if (spool_segment_create(spool) != 0) {
+			return -1;
+		}
+	}
+
+	/* Template snapshots (before the buffer is filled with the message) */
+	for (i = 0; i < couples; ++i) {
+		ret = spool_template(spool, msg->data_couple[i].data_template);
+		if (ret < 0) {
+			return -1;
+		}
+		numbers[i] = ret;
+	}
+
+	/* Message */
+	if (spool_buffer(spool, SPOOL_RECORD_SIZE(length)) != 0) {
+		return -1;
+	}
+
+	p = spool->buf + sizeof(struct spool_record_hdr);
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+
+	memcpy(p, name, hdr.input.name_len);
+	p += hdr.input.name_len;
+
+	for (i = 0; i < couples; ++i) {
+		couple.offset = spool_packet_offset(msg, msg->data_couple[i].data_set, 0, hdr.packet_length);
+		couple.templ = numbers[i];
+		memcpy(p, &couple, sizeof(couple));
+		p += sizeof(couple);
+	}
+
+	memcpy(p, msg->pkt_header, hdr.packet_length);
+	p += hdr.packet_length;
+
+	if (msg->metadata) {
+		for (i = 0; i < msg->data_records_count; ++i) {
+			memset(&meta, 0, sizeof(meta));
+			if (msg->metadata[i].record.record) {
+				meta.offset = spool_packet_offset(msg, msg->metadata[i].record.record, 0, hdr.packet_length);
+				meta.length = msg->metadata[i].record.length;
+				meta.templ = spool_couple_template(msg, couples, numbers, msg->metadata[i].record.templ);
+			}
+			meta.srcCountry = msg->metadata[i].srcCountry;
+			meta.dstCountry = msg->metadata[i].dstCountry;
+			meta.srcAS = msg->metadata[i].srcAS;
+			meta.dstAS = msg->metadata[i].dstAS;
+			memcpy(meta.srcName, msg->metadata[i].srcName, sizeof(meta.srcName));
+			memcpy(meta.dstName, msg->metadata[i].dstName, sizeof(meta.dstName));
+			memcpy(p, &meta, sizeof(meta));
+			p += sizeof(meta);
+		}
+	}
+
+	if (spool_write_record(spool, SPOOL_MESSAGE, 0, length) != 0) {
+		return -1;
+	}
+
+	message_release(msg);
+	return 0;
+}
+
+/**
+ * \brief Check whether all spooled messages were read
+ */
+int spool_empty(const struct spool *spool)
+{
+	return spool->rseg == spool->wseg && spool->roffset >= spool->woffset;
+}
+
+/**
+ * \brief Size of the spool
+ */
+uint64_t spool_size(const struct spool *spool)
+{
+	return spool->size;
+}
+
+/**
+ * \brief Map the segment being read so that \p end is accessible
+ */
+static int spool_map(struct spool *spool, uint64_t end)
+{
+	size_t len;
+
+	if (end <= spool->rmap_len) {
+		return 0;
+	}
+
+	if (spool->rmap) {
+		munmap(spool->rmap, spool->rmap_len);
+		spool->rmap = NULL;
+		spool->rmap_len = 0;
+	}
+
+	/* The segment being written grows, map it whole at once */
+	len = end > spool->segment_size ? end : spool->segment_size;
+	spool->rmap = mmap(NULL, len, PROT_READ, MAP_SHARED, spool->rfd, 0);
+	if (spool->rmap == MAP_FAILED) {
+		MSG_ERROR(msg_module, "Unable to map spool segment: %s", strerror(errno));
+		spool->rmap = NULL;
+		return -1;
+	}
+
+	madvise(spool->rmap, len, MADV_SEQUENTIAL);
+	spool->rmap_len = len;
+	return 0;
+}
+
+/**
+ * \brief Close the segment being read
+ *
+ * \param[in] remove Delete the segment
+ */
+static void spool_reader_close(struct spool *spool, int remove)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	if (spool->rmap) {
+		munmap(spool->rmap, spool->rmap_len);
+		spool->rmap = NULL;
+		spool->rmap_len = 0;
+	}
+
+	if (spool->rfd >= 0) {
+		if (remove) {
+			if (fstat(spool->rfd, &st) == 0) {
+				spool->size -= st.st_size < (off_t) spool->size ? (uint64_t) st.st_size : spool->size;
+			}
+
+			spool_segment_path(spool, path, sizeof(path), spool->rseg);
+			if (unlink(path) != 0) {
+				MSG_WARNING(msg_module, "Unable to remove spool segment '%s': %s", path, strerror(errno));
+			}
+		}
+
+		close(spool->rfd);
+		spool->rfd = -1;
+	}
+
+	spool->rtemplates_count = 0;
+}
+
+/**
+ * \brief Open segment for reading
+ *
+ * \param[in] number Segment number
+ * \param[in] offset Offset of the first message to read
+ * \return 0 on success, nonzero when the segment cannot be read
+ */
+static int spool_reader_open(struct spool *spool, uint64_t number, uint64_t offset)
+{
+	char path[PATH_MAX];
+	struct spool_segment_hdr hdr;
+	struct stat st;
+
+	spool->rseg = number;
+	spool->roffset = sizeof(hdr);
+	spool->rskip = offset;
+	spool->rlimit = sizeof(hdr);
+
+	spool_segment_path(spool, path, sizeof(path), number);
+	spool->rfd = open(path, O_RDONLY);
+	if (spool->rfd < 0) {
+		if (errno != ENOENT) {
+			MSG_WARNING(msg_module, "Unable to open spool segment '%s': %s", path, strerror(errno));
+		}
+		return -1;
+	}
+
+	if (fstat(spool->rfd, &st) != 0 || pread(spool->rfd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+			|| hdr.magic != SPOOL_MAGIC || hdr.version != SPOOL_VERSION || hdr.number != number) {
+		MSG_WARNING(msg_module, "Invalid spool segment '%s'; skipping...", path);
+		return -1;
+	}
+
+	if (number != spool->wseg) {
+		spool->rlimit = st.st_size;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Move to the next segment, the current one is deleted
+ */
+static void spool_reader_next(struct spool *spool)
+{
+	uint64_t number = spool->rseg;
+
+	spool_reader_close(spool, 1);
+
+	while (number < spool->wseg) {
+		number++;
+		if (spool_reader_open(spool, number, 0) == 0) {
+			break;
+		}
+		spool_reader_close(spool, spool->rfd >= 0 && number != spool->wseg);
+	}
+
+	spool_checkpoint(spool);
+}
+
+/**
+ * \brief Load template snapshot
+ */
+static int spool_load_template(struct spool *spool, const struct spool_record_hdr *hdr, const uint8_t *payload)
+{
+	struct ipfix_template *templ, **array;
+	struct spool_keep *keep;
+	uint32_t size;
+
+	if (hdr->id != spool->rtemplates_count + 1 || hdr->length < offsetof(struct ipfix_template, fields)
+			|| ((const struct ipfix_template *) payload)->template_length != hdr->length) {
+		return -1;
+	}
+
+	if (spool->rtemplates_count == spool->rtemplates_size) {
+		size = spool->rtemplates_size ? spool->rtemplates_size * 2 : 64;
+		array = realloc(spool->rtemplates, size * sizeof(*array));
+		if (!array) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return -1;
+		}
+		spool->rtemplates = array;
+		spool->rtemplates_size = size;
+	}
+
+	size = hdr->length > sizeof(struct ipfix_template) ? hdr->length : sizeof(struct ipfix_template);
+	templ = malloc(size);
+	keep = calloc(1, sizeof(struct spool_keep));
+	if (!templ || !keep) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(templ);
+		free(keep);
+		return -1;
+	}
+
+	memset(templ, 0, size);
+	memcpy(templ, payload, hdr->length);
+	templ->references = 0;
+	templ->next = NULL;
+
+	keep->data = templ;
+	keep->next = spool->templates;
+	spool->templates = keep;
+
+	spool->rtemplates[spool->rtemplates_count++] = templ;
+	return 0;
+}
+
+/**
+ * \brief Get input information of a spooled message
+ */
+static struct input_info *spool_input_decode(struct spool *spool, const struct spool_input *input, const char *name)
+{
+	struct spool_keep *keep;
+	struct input_info_network *net;
+	struct input_info_file *file;
+
+	if (input->type == SOURCE_TYPE_COUNT) {
+		return NULL;
+	}
+
+	for (keep = spool->inputs; keep; keep = keep->next) {
+		if (memcmp(&keep->input, input, sizeof(*input)) == 0
+				&& (input->name_len == 0 || memcmp(keep->name, name, input->name_len) == 0)) {
+			return keep->data;
+		}
+	}
+
+	keep = calloc(1, sizeof(struct spool_keep));
+	if (!keep) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+	keep->input = *input;
+
+	if (input->type == SOURCE_TYPE_IPFIX_FILE) {
+		file = calloc(1, sizeof(struct input_info_file));
+		keep->name = calloc(1, input->name_len + 1);
+		if (!file || !keep->name) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			free(file);
+			free(keep->name);
+			free(keep);
+			return NULL;
+		}
+		memcpy(keep->name, name, input->name_len);
+		file->name = keep->name;
+		keep->data = file;
+	} else {
+		net = calloc(1, sizeof(struct input_info_network));
+		if (!net) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			free(keep);
+			return NULL;
+		}
+		memcpy(&net->src_addr, input->src_addr, sizeof(input->src_addr));
+		memcpy(&net->dst_addr, input->dst_addr, sizeof(input->dst_addr));
+		net->src_port = input->src_port;
+		net->dst_port = input->dst_port;
+		net->l3_proto = input->l3_proto;
+		keep->data = net;
+	}
+
+	((struct input_info *) keep->data)->type = input->type;
+	((struct input_info *) keep->data)->status = SOURCE_STATUS_OPENED;
+	((struct input_info *) keep->data)->odid = input->odid;
+
+	keep->next = spool->inputs;
+	spool->inputs = keep;
+	return keep->data;
+}
+
+/**
+ * \brief Get snapshot by its number
+ *
+ * \return 0 on success, nonzero for invalid number
+ */
+static int spool_snapshot(const struct spool *spool, uint32_t number, struct ipfix_template **templ)
+{
+	if (number > spool->rtemplates_count) {
+		return -1;
+	}
+
+	*templ = number ? spool->rtemplates[number - 1] : NULL;
+	return 0;
+}
+
+/**
+ * \brief Rebuild spooled message
+ *
+ * \param[in] live_profile Current profile tree (can be NULL)
+ * \return Message or NULL on error (the record is skipped)
+ */
+static struct ipfix_message *spool_load_message(struct spool *spool, const struct spool_record_hdr *hdr, const uint8_t *payload,
+		void *live_profile)
+{
+	struct ipfix_message *msg;
+	struct spool_message mhdr;
+	struct spool_couple couple;
+	struct spool_metadata meta;
+	struct ipfix_set_header *set;
+	struct ipfix_template *templ;
+	const char *name;
+	uint8_t *packet, *p;
+	uint64_t length;
+	uint16_t i, set_len;
+	int t_set_count = 0, ot_set_count = 0;
+
+	if (hdr->length < sizeof(mhdr)) {
+		return NULL;
+	}
+
+	memcpy(&mhdr, payload, sizeof(mhdr));
+	length = sizeof(mhdr) + mhdr.input.name_len + mhdr.couples * sizeof(struct spool_couple) + mhdr.packet_length;
+	if (mhdr.flags & SPOOL_MSG_METADATA) {
+		length += (uint64_t) mhdr.data_records_count * sizeof(struct spool_metadata);
+	}
+
+	if (length != hdr->length || mhdr.couples > MSG_MAX_DATA_COUPLES || mhdr.packet_length < IPFIX_HEADER_LENGTH) {
+		return NULL;
+	}
+
+	msg = calloc(1, sizeof(struct ipfix_message));
+	packet = malloc(mhdr.packet_length);
+	if (!msg || !packet) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(msg);
+		free(packet);
+		return NULL;
+	}
+
+	payload += sizeof(mhdr);
+	name = (const char *) payload;
+	payload += mhdr.input.name_len;
+
+	memcpy(packet, payload + mhdr.couples * sizeof(struct spool_couple), mhdr.packet_length);
+	msg->pkt_header = (struct ipfix_header *) packet;
+	msg->input_info = spool_input_decode(spool, &mhdr.input, name);
+	msg->source_status = mhdr.source_status;
+	msg->watermark = mhdr.watermark;
+	msg->plugin_status = PLUGIN_DATA;
+	msg->data_records_count = mhdr.data_records_count;
+	msg->templ_records_count = mhdr.templ_records_count;
+	msg->opt_templ_records_count = mhdr.opt_templ_records_count;
+
+	for (i = 0; i < mhdr.couples; ++i) {
+		memcpy(&couple, payload, sizeof(couple));
+		payload += sizeof(couple);
+
+		if (couple.offset + sizeof(struct ipfix_set_header) > mhdr.packet_length
+				|| spool_snapshot(spool, couple.templ, &templ) != 0) {
+			goto err;
+		}
+		msg->data_couple[i].data_template = templ;
+		msg->data_couple[i].data_set = (struct ipfix_data_set *) (packet + couple.offset);
+	}
+	payload += mhdr.packet_length;
+
+	/* Template Sets are not spooled, find them in the packet */
+	p = packet + IPFIX_HEADER_LENGTH;
+	while (p + sizeof(struct ipfix_set_header) <= packet + mhdr.packet_length) {
+		set = (struct ipfix_set_header *) p;
+		set_len = ntohs(set->length);
+		if (set_len == 0 || p + set_len > packet + mhdr.packet_length) {
+			break;
+		}
+
+		if (ntohs(set->flowset_id) == IPFIX_TEMPLATE_FLOWSET_ID && t_set_count < MSG_MAX_TEMPL_SETS) {
+			msg->templ_set[t_set_count++] = (struct ipfix_template_set *) set;
+		} else if (ntohs(set->flowset_id) == IPFIX_OPTION_FLOWSET_ID && ot_set_count < MSG_MAX_OTEMPL_SETS) {
+			msg->opt_templ_set[ot_set_count++] = (struct ipfix_options_template_set *) set;
+		}
+
+		p += set_len;
+	}
+
+	if ((mhdr.flags & SPOOL_MSG_METADATA) && mhdr.data_records_count > 0) {
+		msg->metadata = calloc(mhdr.data_records_count, sizeof(struct metadata));
+		if (!msg->metadata) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			goto err;
+		}
+
+		for (i = 0; i < mhdr.data_records_count; ++i) {
+			memcpy(&meta, payload, sizeof(meta));
+			payload += sizeof(meta);
+
+			if (meta.length) {
+				if (meta.offset + meta.length > mhdr.packet_length
+						|| spool_snapshot(spool, meta.templ, &templ) != 0) {
+					goto err;
+				}
+				msg->metadata[i].record.templ = templ;
+				msg->metadata[i].record.record = packet + meta.offset;
+				msg->metadata[i].record.length = meta.length;
+			}
+			msg->metadata[i].srcCountry = meta.srcCountry;
+			msg->metadata[i].dstCountry = meta.dstCountry;
+			msg->metadata[i].srcAS = meta.srcAS;
+			msg->metadata[i].dstAS = meta.dstAS;
+			memcpy(msg->metadata[i].srcName, meta.srcName, sizeof(meta.srcName));
+			memcpy(msg->metadata[i].dstName, meta.dstName, sizeof(meta.dstName));
+		}
+	}
+
+	/* Do what the profiler did before the message was spooled, using the current profiles */
+	msg->live_profile = live_profile;
+	if (live_profile && msg->metadata && (mhdr.flags & SPOOL_MSG_PROFILED)) {
+		for (i = 0; i < msg->data_records_count; ++i) {
+			msg->metadata[i].channels = profile_match_data(live_profile, msg, &(msg->metadata[i]));
+		}
+	}
+
+	return msg;
+
+err:
+	free(msg->metadata);
+	free(packet);
+	free(msg);
+	return NULL;
+}
+
+/**
+ * \brief Read the oldest spooled message
+ */
+struct ipfix_message *spool_read(struct spool *spool, void *live_profile)
+{
+	const struct spool_record_hdr *hdr;
+	struct ipfix_message *msg;
+	uint64_t limit, size;
+	int valid;
+
+	while (1) {
+		if (spool->rfd < 0 && spool->rseg == spool->wseg
+				&& spool_reader_open(spool, spool->wseg, spool->roffset) != 0) {
+			MSG_ERROR(msg_module, "Unable to read spool segment %" PRIu64 " of '%s'", spool->rseg, spool->dir);
+			spool_reader_close(spool, 0);
+			spool->roffset = spool->woffset;
+			return NULL;
+		}
+
+		limit = (spool->rseg == spool->wseg) ? spool->woffset : spool->rlimit;
+		if (spool->rfd < 0 || spool->roffset >= limit) {
+			if (spool->rseg >= spool->wseg) {
+				return NULL;
+			}
+			spool_reader_next(spool);
+			continue;
+		}
+
+		/* Validate record */
+		valid = 0;
+		hdr = NULL;
+		if (spool->roffset + sizeof(*hdr) <= limit && spool_map(spool, limit) == 0) {
+			hdr = (const struct spool_record_hdr *) (spool->rmap + spool->roffset);
+			size = SPOOL_RECORD_SIZE(hdr->length);
+			valid = (spool->roffset + size <= limit) && hdr->crc == spool_crc(hdr, (const uint8_t *) (hdr + 1));
+		}
+
+		if (!valid) {
+			MSG_WARNING(msg_module, "Corrupted record in spool segment %" PRIu64 " of '%s'; skipping the rest of the segment",
+					spool->rseg, spool->dir);
+			spool->roffset = limit;
+			return NULL;
+		}
+
+		spool->roffset += size;
+
+		switch (hdr->type) {
+		case SPOOL_TEMPLATE:
+			if (spool_load_template(spool, hdr, (const uint8_t *) (hdr + 1)) != 0) {
+				MSG_WARNING(msg_module, "Invalid template snapshot in spool '%s'", spool->dir);
+			}
+			break;
+		case SPOOL_MESSAGE:
+			if (spool->roffset <= spool->rskip) {
+				/* Read before the last checkpoint */
+				break;
+			}
+
+			msg = spool_load_message(spool, hdr, (const uint8_t *) (hdr + 1), live_profile);
+			if (!msg) {
+				MSG_WARNING(msg_module, "Invalid message in spool '%s'; skipping...", spool->dir);
+				break;
+			}
+
+			if (spool->rseg < spool->wseg && spool->roffset >= spool->rlimit) {
+				/* Release the segment as soon as possible */
+				spool_reader_next(spool);
+			} else if (++spool->reads >= SPOOL_CHECKPOINT) {
+				spool_checkpoint(spool);
+			}
+
+			return msg;
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * \brief Compare segment numbers (for qsort)
+ */
+static int spool_number_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * \brief Find segments in the spool directory
+ *
+ * \param[out] numbers Sorted numbers of segments
+ * \return Number of segments or -1 on error
+ */
+static int spool_scan(const struct spool *spool, uint64_t **numbers)
+{
+	DIR *dir;
+	struct dirent *entry;
+	uint64_t number, *array = NULL, *tmp;
+	int count = 0, size = 0, len;
+	char *end;
+
+	dir = opendir(spool->dir);
+	if (!dir) {
+		MSG_ERROR(msg_module, "Unable to open spool directory '%s': %s", spool->dir, strerror(errno));
+		return -1;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		len = strlen(entry->d_name);
+		if (len != 16 + (int) strlen(SPOOL_SUFFIX) || strcmp(entry->d_name + 16, SPOOL_SUFFIX) != 0) {
+			continue;
+		}
+
+		number = strtoull(entry->d_name, &end, 16);
+		if (end != entry->d_name + 16) {
+			continue;
+		}
+
+		if (count == size) {
+			size = size ? size * 2 : 16;
+			tmp = realloc(array, size * sizeof(uint64_t));
+			if (!tmp) {
+				MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+				free(array);
+				closedir(dir);
+				return -1;
+			}
+			array = tmp;
+		}
+
+		array[count++] = number;
+	}
+
+	closedir(dir);
+	if (count > 0) {
+		qsort(array, count, sizeof(uint64_t), spool_number_cmp);
+	}
+
+	*numbers = array;
+	return count;
+}
+
+/**
+ * \brief Truncate the last segment after its last valid record
+ *
+ * \return Size of the segment, 0 when it was removed
+ */
+static uint64_t spool_recover(const struct spool *spool, uint64_t number)
+{
+	char path[PATH_MAX];
+	const struct spool_segment_hdr *shdr;
+	const struct spool_record_hdr *hdr;
+	struct stat st;
+	uint8_t *map = NULL;
+	uint64_t offset = 0, size;
+	int fd;
+
+	spool_segment_path(spool, path, sizeof(path), number);
+	fd = open(path, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		MSG_WARNING(msg_module, "Unable to open spool segment '%s': %s", path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return 0;
+	}
+
+	if (st.st_size >= (off_t) sizeof(*shdr)) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+		}
+	}
+
+	if (map) {
+		shdr = (const struct spool_segment_hdr *) map;
+		if (shdr->magic == SPOOL_MAGIC && shdr->version == SPOOL_VERSION && shdr->number == number) {
+			offset = sizeof(*shdr);
+			while (offset + sizeof(*hdr) <= (uint64_t) st.st_size) {
+				hdr = (const struct spool_record_hdr *) (map + offset);
+				size = SPOOL_RECORD_SIZE(hdr->length);
+				if (offset + size > (uint64_t) st.st_size || hdr->crc != spool_crc(hdr, (const uint8_t *) (hdr + 1))) {
+					break;
+				}
+				offset += size;
+			}
+		}
+		munmap(map, st.st_size);
+	}
+
+	if (offset == 0) {
+		MSG_WARNING(msg_module, "Invalid spool segment '%s'; removing...", path);
+		close(fd);
+		unlink(path);
+		return 0;
+	}
+
+	if (offset < (uint64_t) st.st_size) {
+		MSG_WARNING(msg_module, "Spool segment '%s' was not completed; truncating %" PRIu64 " bytes",
+				path, (uint64_t) st.st_size - offset);
+		if (ftruncate(fd, offset) != 0) {
+			MSG_WARNING(msg_module, "Unable to truncate spool segment '%s': %s", path, strerror(errno));
+		}
+	}
+
+	close(fd);
+	return offset;
+}
+
+/**
+ * \brief Open spool directory and recover its content
+ */
+struct spool *spool_open(const char *dir, uint64_t max_size)
+{
+	struct spool *spool;
+	struct spool_position pos;
+	struct stat st;
+	char path[PATH_MAX];
+	uint64_t *numbers = NULL, first, last;
+	int count, i;
+
+	spool = calloc(1, sizeof(struct spool));
+	if (!spool) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	spool->lock_fd = spool->pos_fd = spool->wfd = spool->rfd = -1;
+	spool->max_size = max_size < SPOOL_SEGMENT_MIN ? SPOOL_SEGMENT_MIN : max_size;
+	spool->segment_size = spool->max_size / 8;
+	if (spool->segment_size < SPOOL_SEGMENT_MIN) {
+		spool->segment_size = SPOOL_SEGMENT_MIN;
+	} else if (spool->segment_size > SPOOL_SEGMENT_MAX) {
+		spool->segment_size = SPOOL_SEGMENT_MAX;
+	}
+
+	spool->dir = strdup(dir);
+	if (!spool->dir) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		goto err;
+	}
+
+	/* One process per directory */
+	spool_path(spool, path, sizeof(path), "lock");
+	if (storage_mkdir(path) != 0) {
+		goto err;
+	}
+
+	spool->lock_fd = open(path, O_RDWR | O_CREAT, 0640);
+	if (spool->lock_fd < 0 || flock(spool->lock_fd, LOCK_EX | LOCK_NB) != 0) {
+		MSG_ERROR(msg_module, "Unable to lock spool directory '%s': %s", dir, strerror(errno));
+		goto err;
+	}
+
+	/* Read position of the previous run */
+	memset(&pos, 0, sizeof(pos));
+	spool_path(spool, path, sizeof(path), "position");
+	spool->pos_fd = open(path, O_RDWR | O_CREAT, 0640);
+	if (spool->pos_fd < 0) {
+		MSG_ERROR(msg_module, "Unable to open '%s': %s", path, strerror(errno));
+		goto err;
+	}
+
+	if (pread(spool->pos_fd, &pos, sizeof(pos), 0) != sizeof(pos) || pos.magic != SPOOL_MAGIC
+			|| pos.crc != crc32c(0, &pos, offsetof(struct spool_position, crc))) {
+		memset(&pos, 0, sizeof(pos));
+	}
+
+	count = spool_scan(spool, &numbers);
+	if (count < 0) {
+		goto err;
+	}
+
+	/* Remove segments that were read completely */
+	first = last = 0;
+	for (i = 0; i < count; ++i) {
+		spool_segment_path(spool, path, sizeof(path), numbers[i]);
+		if (numbers[i] < pos.segment) {
+			unlink(path);
+			continue;
+		}
+
+		if (i == count - 1) {
+			st.st_size = spool_recover(spool, numbers[i]);
+			if (st.st_size == 0) {
+				continue;
+			}
+		} else if (stat(path, &st) != 0) {
+			continue;
+		}
+
+		if (!first) {
+			first = numbers[i];
+		}
+		last = numbers[i];
+		spool->size += st.st_size;
+	}
+
+	free(numbers);
+
+	/* Write into a new segment */
+	spool->wseg = (last > pos.segment) ? last : pos.segment;
+	if (spool_segment_create(spool) != 0) {
+		goto err;
+	}
+
+	if (!first) {
+		first = spool->wseg;
+	}
+
+	if (spool_reader_open(spool, first, first == pos.segment ? pos.offset : 0) != 0) {
+		spool_reader_close(spool, 0);
+	}
+
+	if (!spool_empty(spool)) {
+		MSG_INFO(msg_module, "Spool '%s' contains %" PRIu64 " bytes of unprocessed data", dir, spool->size);
+	}
+
+	return spool;
+
+err:
+	spool_close(spool);
+	return NULL;
+}
+
+/**
+ * \brief Release all data of the spool
+ */
+static void spool_free(struct spool *spool)
+{
+	struct spool_keep *keep;
+
+	spool_wcache_clear(spool);
+	free(spool->buf);
+	free(spool->rtemplates);
+
+	while (spool->templates) {
+		keep = spool->templates;
+		spool->templates = keep->next;
+		free(keep->data);
+		free(keep);
+	}
+
+	while (spool->inputs) {
+		keep = spool->inputs;
+		spool->inputs = keep->next;
+		free(keep->data);
+		free(keep->name);
+		free(keep);
+	}
+
+	free(spool->dir);
+	free(spool);
+}
+
+/**
+ * \brief Close spool
+ */
+void spool_close(struct spool *spool)
+{
+	char path[PATH_MAX];
+
+	if (!spool) {
+		return;
+	}
+
+	if (spool->wfd >= 0 && spool_empty(spool)) {
+		/* Nothing to replay, leave the directory clean */
+		spool_reader_close(spool, 0);
+		close(spool->wfd);
+		spool->wfd = -1;
+
+		spool_segment_path(spool, path, sizeof(path), spool->wseg);
+		unlink(path);
+		if (spool->pos_fd >= 0 && ftruncate(spool->pos_fd, 0) != 0) {
+			MSG_WARNING(msg_module, "Unable to reset read position of '%s': %s", spool->dir, strerror(errno));
+		}
+	} else if (spool->wfd >= 0) {
+		if (fdatasync(spool->wfd) != 0) {
+			MSG_WARNING(msg_module, "Unable to synchronize spool segment: %s", strerror(errno));
+		}
+		close(spool->wfd);
+		spool->wfd = -1;
+
+		spool_checkpoint(spool);
+		spool_reader_close(spool, 0);
+		MSG_INFO(msg_module, "Spool '%s' keeps %" PRIu64 " bytes for the next run", spool->dir, spool->size);
+	}
+
+	if (spool->pos_fd >= 0) {
+		close(spool->pos_fd);
+	}
+
+	if (spool->lock_fd >= 0) {
+		close(spool->lock_fd);
+	}
+
+	spool_free(spool);
+}
@@ -0,0 +1,152 @@
+/**
+ * \file spool.h
+ * \brief On-disk spool of IPFIX messages for lagging storage plugins
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+#include <stdint.h>
+
+#include "ipfixcol.h"
+
+/**
+ * \defgroup spool Write-ahead spool
+ *
+ * Append-only log of IPFIX messages placed between the Output Manager and
+ * the storage plugins of a Data Manager. When the queue of the storage
+ * plugins is full, messages are appended to the spool instead of blocking
+ * the collector and they are replayed in order as soon as the plugins catch
+ * up. Messages left in the spool when the collector stops (or crashes) are
+ * replayed when the Data Manager of the same ODID is created again.
+ *
+ * The spool consists of segment files in one directory. Each segment starts
+ * with a header and contains records, each protected by CRC32:
+ *   - template snapshots, referenced by messages of the same segment,
+ *   - messages: input information, raw IPFIX packet, Data Set offsets with
+ *     template references and metadata.
+ *
+ * Lists of profile channels are owned by the profile tree, which can be
+ * reloaded or gone when a message is replayed. Only the fact that the records
+ * were profiled is stored; their channels are matched again against the
+ * current profile tree on replay, as the profiler would do.
+ *
+ * Segments are written sequentially and read through mmap(). A segment is
+ * deleted when all its messages were replayed. The read position is
+ * checkpointed into the "position" file, so only few messages are replayed
+ * twice after a crash. All values are in host byte order, the spool is not
+ * meant to be moved between machines.
+ *
+ * The spool is not thread safe; callers serialize access to it.
+ *
+ * @{
+ */
+
+/** spool_append() return code: size limit of the spool reached */
+#define SPOOL_FULL 1
+
+/** Spool (opaque) */
+struct spool;
+
+/**
+ * \brief Open spool directory and recover its content
+ *
+ * Segments left by a previous run are validated; a partially written record
+ * at the end of the last segment is truncated.
+ *
+ * \param[in] dir Spool directory (created when it does not exist)
+ * \param[in] max_size Maximal size of the spool in bytes
+ * \return Spool or NULL on error
+ */
+struct spool *spool_open(const char *dir, uint64_t max_size);
+
+/**
+ * \brief Append message to the spool
+ *
+ * On success, the message is released (including references of its
+ * templates) and must not be used anymore.
+ *
+ * \param[in] spool Spool
+ * \param[in] msg IPFIX message
+ * \return 0 on success, SPOOL_FULL when the size limit was reached, negative
+ * value when the message cannot be spooled (it is left untouched)
+ */
+int spool_append(struct spool *spool, struct ipfix_message *msg);
+
+/**
+ * \brief Check whether all spooled messages were read
+ * \param[in] spool Spool
+ * \return Nonzero when there is nothing to read
+ */
+int spool_empty(const struct spool *spool);
+
+/**
+ * \brief Read the oldest spooled message
+ *
+ * Templates and input information of the message are owned by the spool and
+ * stay valid until spool_close(). The message itself is released like any
+ * other message in the storage queue.
+ *
+ * The message gets \p live_profile as its profile tree. When its records were
+ * assigned to profile channels before spooling, they are matched against it
+ * again.
+ *
+ * \param[in] spool Spool
+ * \param[in] live_profile Current profile tree (can be NULL)
+ * \return Message or NULL when there is nothing to read or a corrupted
+ * segment was skipped
+ */
+struct ipfix_message *spool_read(struct spool *spool, void *live_profile);
+
+/**
+ * \brief Size of the spool
+ * \param[in] spool Spool
+ * \return Size of all segments in bytes
+ */
+uint64_t spool_size(const struct spool *spool);
+
+/**
+ * \brief Close spool
+ *
+ * Unread messages stay on the disk.
+ *
+ * \param[in] spool Spool
+ */
+void spool_close(struct spool *spool);
+
+/**@}*/
+
+#endif /* SPOOL_H_ */
@@ -55,6 +55,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 /** Identifier to MSG_* macros */
 static char *msg_module = "dummy storage";
 
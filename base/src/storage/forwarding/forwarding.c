@@ -62,6 +62,9 @@
 // API version constant
 IPFIXCOL_API_VERSION
 
+// Metadata required by the plugin
+IPFIXCOL_METADATA(MDATA_NONE);
+
 // Module identification
 static const char* msg_module= "forwarding";
 
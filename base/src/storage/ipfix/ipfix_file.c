@@ -61,15 +61,40 @@
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "ipfixcol.h"
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 /** Identifier to MSG_* macros */
 static char *msg_module = "ipfix storage";
 
+/** Size of a write buffer */
+#define IPFIX_CHUNK_SIZE (1024 * 1024)
+/** Number of write buffers */
+#define IPFIX_CHUNK_COUNT 4
+
+struct ipfix_config;
+
+/**
+ * \brief Write buffer
+ *
+ * Messages are copied into the current buffer, which is handed over to the
+ * asynchronous write layer when it is full. The plugin continues with the
+ * next buffer meanwhile.
+ */
+struct ipfix_chunk {
+	struct ipfix_config *conf;  /**< plugin configuration */
+	unsigned int index;         /**< index of the registered buffer */
+	uint8_t *data;              /**< buffer */
+	int busy;                   /**< buffer is being written */
+};
+
 /**
  * \struct ipfix_config
  *
@@ -82,8 +107,146 @@ struct ipfix_config {
 	                             * file */
 	xmlChar *xml_file;          /**< URI from XML configuration file */
 	char *file;                 /**< actual path where to store messages */
+
+	struct storage_io *io;      /**< asynchronous write layer */
+	struct ipfix_chunk chunks[IPFIX_CHUNK_COUNT]; /**< write buffers */
+	unsigned int current;       /**< buffer being filled */
+	size_t fill;                /**< bytes in the current buffer */
+	off_t offset;               /**< file offset of the current buffer */
+	int error;                  /**< a write has failed */
+	pthread_mutex_t mutex;      /**< protects busy flags and error */
+	pthread_cond_t cond;        /**< signals a written buffer */
 };
 
+/**
+ * \brief Completion of a buffer write
+ *
+ * \param[in] result bytes written or negative errno
+ * \param[in] user written buffer
+ */
+static void chunk_written(int result, void *user)
+{
+	struct ipfix_chunk *chunk = (struct ipfix_chunk *) user;
+	struct ipfix_config *conf = chunk->conf;
+
+	pthread_mutex_lock(&conf->mutex);
+	if (result < 0) {
+		conf->error = -result;
+	}
+	chunk->busy = 0;
+	pthread_cond_signal(&conf->cond);
+	pthread_mutex_unlock(&conf->mutex);
+}
+
+/**
+ * \brief Hand the current buffer over to the write layer and switch to the next one
+ *
+ * \param[in] conf output plugin config structure
+ * \return 0 on success, negative value otherwise
+ */
+static int chunk_flush(struct ipfix_config *conf)
+{
+	struct ipfix_chunk *chunk = &conf->chunks[conf->current];
+	int error;
+
+	if (conf->fill == 0) {
+		return 0;
+	}
+
+	chunk->busy = 1;
+	if (storage_io_write_fixed(conf->io, conf->fd, chunk->index, chunk->data,
+			conf->fill, conf->offset, chunk_written, chunk) != 0) {
+		chunk->busy = 0;
+		MSG_ERROR(msg_module, "Error while writing into the output file");
+		return -1;
+	}
+
+	conf->offset += conf->fill;
+	conf->fill = 0;
+	conf->current = (conf->current + 1) % IPFIX_CHUNK_COUNT;
+
+	/* Wait until the next buffer is written */
+	chunk = &conf->chunks[conf->current];
+	pthread_mutex_lock(&conf->mutex);
+	while (chunk->busy) {
+		pthread_cond_wait(&conf->cond, &conf->mutex);
+	}
+	error = conf->error;
+	conf->error = 0;
+	pthread_mutex_unlock(&conf->mutex);
+
+	if (error) {
+		MSG_ERROR(msg_module, "Error while writing into the output file: %s", strerror(error));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Prepare write buffers and the asynchronous write layer
+ *
+ * \param[in] conf output plugin config structure
+ * \return 0 on success, negative value otherwise
+ */
+static int chunks_init(struct ipfix_config *conf)
+{
+	struct iovec iov[IPFIX_CHUNK_COUNT];
+	int i;
+
+	conf->io = storage_io_create(IPFIX_CHUNK_COUNT * 2, 1, 0);
+	if (!conf->io) {
+		return -1;
+	}
+
+	for (i = 0; i < IPFIX_CHUNK_COUNT; i++) {
+		conf->chunks[i].data = malloc(IPFIX_CHUNK_SIZE);
+		if (!conf->chunks[i].data) {
+			MSG_ERROR(msg_module, "Not enough memory (%s:%d)", __FILE__, __LINE__);
+			goto err;
+		}
+		conf->chunks[i].conf = conf;
+		conf->chunks[i].index = i;
+		iov[i].iov_base = conf->chunks[i].data;
+		iov[i].iov_len = IPFIX_CHUNK_SIZE;
+	}
+
+	if (storage_io_register_buffers(conf->io, iov, IPFIX_CHUNK_COUNT) != 0) {
+		goto err;
+	}
+
+	pthread_mutex_init(&conf->mutex, NULL);
+	pthread_cond_init(&conf->cond, NULL);
+	return 0;
+
+err:
+	storage_io_destroy(conf->io);
+	conf->io = NULL;
+	while (i-- > 0) {
+		free(conf->chunks[i].data);
+	}
+	return -1;
+}
+
+/**
+ * \brief Write all buffers and release them with the write layer
+ *
+ * \param[in] conf output plugin config structure
+ */
+static void chunks_free(struct ipfix_config *conf)
+{
+	int i;
+
+	chunk_flush(conf);
+	storage_io_destroy(conf->io);
+
+	for (i = 0; i < IPFIX_CHUNK_COUNT; i++) {
+		free(conf->chunks[i].data);
+	}
+	pthread_cond_destroy(&conf->cond);
+	pthread_mutex_destroy(&conf->mutex);
+}
+
 
 /**
  * \brief Open/create output file
@@ -99,6 +262,8 @@ static int prepare_output_file(struct ipfix_config *config)
 	config->fcounter += 1;
 	/* byte counter */
 	config->bcounter = 0;
+	config->offset = 0;
+	config->fill = 0;
 
 
 	fd = open(config->file, O_WRONLY | O_CREAT | O_TRUNC,
@@ -230,6 +395,11 @@ int storage_init(char *params, void **config)
 	strftime(conf->file+strlen((char *) conf->file), 14, ".%y%m%d%H%M%S", &tm);
 	/* conf->file now looks like: "/path/to/file.1109131509" */
 
+	if (chunks_init(conf) != 0) {
+		goto err_init;
+	}
+
+	conf->fd = -1;
 	prepare_output_file(conf);
 
 	/* we don't need this xml tree anymore */
@@ -259,31 +429,23 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
                  const struct ipfix_template_mgr *template_mgr)
 {
 	(void) template_mgr;
-	ssize_t count = 0;
-	uint16_t wbytes = 0;
 	struct ipfix_config *conf;
 	conf = (struct ipfix_config *) config;
+	uint16_t length = ntohs(ipfix_msg->pkt_header->length);
 
-	/* write IPFIX message into an output file */
-	while (wbytes < ntohs(ipfix_msg->pkt_header->length)) {
-		count = write(conf->fd, (ipfix_msg->pkt_header)+wbytes,
-		              ntohs(ipfix_msg->pkt_header->length)-wbytes);
-		if (count == -1) {
-			if (errno == EINTR) {
-				/* interrupted by signal, try again */
-				break;
-			} else {
-				/* serious error occurs */
-				MSG_ERROR(msg_module, "Error while writing into the "
-				                        "output file");
-				return -1;
-			}
-		} else {
-			wbytes += count;
-		}
+	if (conf->fd == -1) {
+		return -1;
 	}
 
-	conf->bcounter += wbytes;
+	/* copy IPFIX message into the write buffer */
+	if (conf->fill + length > IPFIX_CHUNK_SIZE && chunk_flush(conf) != 0) {
+		return -1;
+	}
+
+	memcpy(conf->chunks[conf->current].data + conf->fill, ipfix_msg->pkt_header, length);
+	conf->fill += length;
+
+	conf->bcounter += length;
 
 	return 0;
 }
@@ -301,7 +463,17 @@ int store_now(const void *config)
 	struct ipfix_config *conf;
 	conf = (struct ipfix_config *) config;
 
-	fsync(conf->fd);
+	if (conf->fd == -1) {
+		return 0;
+	}
+
+	if (chunk_flush(conf) != 0) {
+		return -1;
+	}
+
+	/* fsync is started after the buffers are written */
+	storage_io_fsync(conf->io, conf->fd, NULL, NULL);
+	storage_io_submit(conf->io);
 
 	return 0;
 }
@@ -321,7 +493,10 @@ int storage_close(void **config)
 	struct ipfix_config *conf;
 	conf = (struct ipfix_config *) *config;
 
-	close_output_file(conf);
+	chunks_free(conf);
+	if (conf->fd != -1) {
+		close_output_file(conf);
+	}
 
 	if (conf->bcounter == 0) {
 		/* current output file is empty, get rid of it */
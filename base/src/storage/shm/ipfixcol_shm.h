@@ -0,0 +1,241 @@
+/**
+ * \file storage/shm/ipfixcol_shm.h
+ * \brief Shared memory ring of the shm storage plugin and its client library
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef IPFIXCOL_SHM_H
+#define IPFIXCOL_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \defgroup shmRing Shared memory ring
+ * \ingroup shmStoragePlugin
+ *
+ * The collector (single writer) appends entries to a ring in a POSIX shared
+ * memory object. Readers map the object read-only and follow the writer on
+ * their own; the writer never waits for them and does not know about them.
+ *
+ * Sequence protocol:
+ *   -# The writer sets \c reserve to the end of the entry it is going to write
+ *      (including padding at the end of the ring).
+ *   -# The writer copies the entry into the ring.
+ *   -# The writer sets \c head to the same value, which publishes the entry.
+ *
+ * Positions are 64-bit byte offsets that never wrap; an offset in the ring is
+ * position modulo capacity. A reader at position \c pos may use entries below
+ * \c head. Data it has read are intact if \c reserve - \c pos is not larger
+ * than the capacity after reading; otherwise the writer has overtaken it.
+ *
+ * All headers are in host byte order, data sets are raw (network byte order).
+ *
+ * @{
+ */
+
+/** Magic number of the shared memory object ("IXSH") */
+#define IPFIXCOL_SHM_MAGIC   0x48535849
+/** Version of the shared memory layout */
+#define IPFIXCOL_SHM_VERSION 1
+/** Size of the object header; the ring starts at this offset */
+#define IPFIXCOL_SHM_HDR_SIZE 4096
+/** Alignment of entries in the ring */
+#define IPFIXCOL_SHM_ALIGN   8
+
+/** Writer state */
+enum IPFIXCOL_SHM_STATE {
+	IPFIXCOL_SHM_RUNNING = 1,   /**< Writer is publishing entries */
+	IPFIXCOL_SHM_CLOSED  = 2    /**< Writer has finished; reattach later */
+};
+
+/** Type of an entry */
+enum IPFIXCOL_SHM_TYPE {
+	IPFIXCOL_SHM_PAD      = 0,  /**< Skip to the end of the ring */
+	IPFIXCOL_SHM_TEMPLATE = 1,  /**< Template descriptor (struct ipfixcol_shm_template) */
+	IPFIXCOL_SHM_DATA     = 2   /**< Raw IPFIX Data Set including its header */
+};
+
+/**
+ * \brief Header of the shared memory object
+ */
+struct ipfixcol_shm_header {
+	uint32_t magic;              /**< IPFIXCOL_SHM_MAGIC, written last */
+	uint16_t version;            /**< IPFIXCOL_SHM_VERSION */
+	uint16_t state;              /**< enum IPFIXCOL_SHM_STATE */
+	uint64_t capacity;           /**< Size of the ring (power of two) */
+	uint64_t instance;           /**< Identification of the writer run */
+	uint8_t  _pad1[40];
+
+	volatile uint64_t reserve;   /**< End of the entry being written */
+	uint8_t  _pad2[56];
+
+	volatile uint64_t head;      /**< End of the last published entry */
+	uint8_t  _pad3[56];
+};
+
+/**
+ * \brief Header of an entry in the ring
+ */
+struct ipfixcol_shm_entry {
+	uint32_t length;             /**< Length of the payload */
+	uint16_t type;               /**< enum IPFIXCOL_SHM_TYPE */
+	uint16_t template_id;        /**< Template ID */
+	uint32_t odid;               /**< Observation Domain ID */
+	uint32_t source;             /**< Identification of the exporter */
+	uint32_t export_time;        /**< Export time of the IPFIX message */
+	uint32_t sequence;           /**< Sequence number of the IPFIX message */
+	uint8_t  payload[];          /**< Entry payload */
+};
+
+/**
+ * \brief Field of a template descriptor
+ */
+struct ipfixcol_shm_field {
+	uint16_t id;                 /**< Information Element ID (without E bit) */
+	uint16_t length;             /**< Field length (65535 = variable) */
+	uint32_t enterprise;         /**< Enterprise Number (0 = IANA) */
+};
+
+/**
+ * \brief Template descriptor (payload of IPFIXCOL_SHM_TEMPLATE entry)
+ *
+ * Descriptors are published before the first Data Set of the template and
+ * again whenever the template changes or half of the ring has passed since
+ * the last publication, so readers that attach later learn them as well.
+ */
+struct ipfixcol_shm_template {
+	uint16_t field_count;        /**< Number of fields */
+	uint16_t scope_field_count;  /**< Number of scope fields (Options Template) */
+	uint16_t options;            /**< 1 for Options Template, 0 otherwise */
+	uint16_t reserved;
+	struct ipfixcol_shm_field fields[];
+};
+
+/** Total size of an entry in the ring */
+#define IPFIXCOL_SHM_ENTRY_SIZE(payload_len) \
+	(((sizeof(struct ipfixcol_shm_entry) + (payload_len)) + IPFIXCOL_SHM_ALIGN - 1) \
+		& ~((uint64_t) IPFIXCOL_SHM_ALIGN - 1))
+
+/**
+ * \brief Reader of the shared memory ring (client library)
+ */
+typedef struct ipfixcol_shm_reader ipfixcol_shm_reader_t;
+
+/**
+ * \brief Attach to a ring
+ *
+ * The object is mapped read-only and reading starts at the current head, i.e.
+ * only entries published after attaching are returned.
+ *
+ * \param[in] name Name of the shared memory object (e.g. "/ipfixcol")
+ * \return Reader or NULL (errno is set)
+ */
+ipfixcol_shm_reader_t *ipfixcol_shm_attach(const char *name);
+
+/**
+ * \brief Detach from a ring
+ * \param[in] reader Reader
+ */
+void ipfixcol_shm_detach(ipfixcol_shm_reader_t *reader);
+
+/**
+ * \brief Get the next entry
+ *
+ * The entry points directly into the shared memory (zero copy). After the
+ * entry has been processed, ipfixcol_shm_valid() tells whether the writer
+ * overwrote it meanwhile. Template descriptors are cached by the reader and
+ * can be found with ipfixcol_shm_find_template().
+ *
+ * \param[in] reader Reader
+ * \param[out] entry Entry
+ * \return 1 on success, 0 when there is no new entry, -1 when the writer has
+ * closed the ring (detach and attach again).
+ */
+int ipfixcol_shm_next(ipfixcol_shm_reader_t *reader,
+	const struct ipfixcol_shm_entry **entry);
+
+/**
+ * \brief Wait for a new entry
+ * \param[in] reader Reader
+ * \param[in] timeout Maximal time to wait in microseconds
+ * \return 1 when an entry is available, 0 on timeout, -1 when the writer has
+ * closed the ring
+ */
+int ipfixcol_shm_wait(ipfixcol_shm_reader_t *reader, unsigned int timeout);
+
+/**
+ * \brief Check that the last entry was not overwritten while it was used
+ * \param[in] reader Reader
+ * \return Nonzero when the entry is intact
+ */
+int ipfixcol_shm_valid(const ipfixcol_shm_reader_t *reader);
+
+/**
+ * \brief Number of bytes skipped because the reader was overtaken
+ * \param[in] reader Reader
+ */
+uint64_t ipfixcol_shm_lost(const ipfixcol_shm_reader_t *reader);
+
+/**
+ * \brief Find a descriptor of the template of a Data Set entry
+ * \param[in] reader Reader
+ * \param[in] entry Data Set entry
+ * \return Cached descriptor or NULL when it has not been seen yet
+ */
+const struct ipfixcol_shm_template *ipfixcol_shm_find_template(
+	const ipfixcol_shm_reader_t *reader, const struct ipfixcol_shm_entry *entry);
+
+/**
+ * \brief Get length of a Data Record
+ * \param[in] tmpl Template descriptor
+ * \param[in] rec Beginning of the record
+ * \param[in] max Maximal length (remaining part of the Data Set)
+ * \return Length of the record or 0 when it does not fit
+ */
+size_t ipfixcol_shm_record_length(const struct ipfixcol_shm_template *tmpl,
+	const uint8_t *rec, size_t max);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IPFIXCOL_SHM_H */
@@ -0,0 +1,362 @@
+/**
+ * \file storage/shm/shm_client.c
+ * \brief Client library reading the shared memory ring of the shm storage plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ipfixcol_shm.h"
+
+/** Number of buckets of the template cache */
+#define TMPLT_BUCKETS 1024
+
+/** Cached template descriptor */
+struct tmplt_item {
+	struct tmplt_item *next;               /**< Next item in the bucket */
+	uint32_t source;                       /**< Exporter identification */
+	uint32_t odid;                         /**< Observation Domain ID */
+	uint16_t template_id;                  /**< Template ID */
+	struct ipfixcol_shm_template desc;     /**< Copy of the descriptor */
+};
+
+/** Reader of the ring */
+struct ipfixcol_shm_reader {
+	const struct ipfixcol_shm_header *hdr; /**< Mapped header */
+	const uint8_t *ring;                   /**< Mapped ring */
+	size_t map_size;                       /**< Size of the mapping */
+	uint64_t capacity;                     /**< Size of the ring */
+	uint64_t position;                     /**< Position of the next entry */
+	uint64_t current;                      /**< Position of the last entry */
+	uint64_t lost;                         /**< Bytes skipped */
+	struct tmplt_item *tmplts[TMPLT_BUCKETS]; /**< Template cache */
+};
+
+/**
+ * \brief Bucket of the template cache
+ */
+static unsigned int tmplt_bucket(uint32_t source, uint32_t odid, uint16_t template_id)
+{
+	return (source ^ (odid * 31) ^ (template_id * 65599U)) % TMPLT_BUCKETS;
+}
+
+/**
+ * \brief Store copy of a template descriptor
+ *
+ * \param[in,out] reader Reader
+ * \param[in] entry Template entry
+ * \return 0 on success, nonzero when the descriptor is damaged or allocation fails
+ */
+static int tmplt_store(struct ipfixcol_shm_reader *reader, const struct ipfixcol_shm_entry *entry)
+{
+	const struct ipfixcol_shm_template *desc = (const struct ipfixcol_shm_template *) entry->payload;
+	unsigned int bucket = tmplt_bucket(entry->source, entry->odid, entry->template_id);
+	struct tmplt_item **prev, *item;
+
+	if (entry->length < sizeof(*desc) || entry->length - sizeof(*desc)
+			< desc->field_count * sizeof(struct ipfixcol_shm_field)) {
+		return 1;
+	}
+
+	item = malloc(offsetof(struct tmplt_item, desc) + entry->length);
+	if (!item) {
+		return 1;
+	}
+
+	item->source = entry->source;
+	item->odid = entry->odid;
+	item->template_id = entry->template_id;
+	memcpy(&item->desc, desc, entry->length);
+
+	/* Copy must be complete before it is trusted */
+	__sync_synchronize();
+	if (reader->hdr->reserve - reader->current > reader->capacity) {
+		free(item);
+		return 1;
+	}
+
+	/* Replace the previous descriptor */
+	for (prev = &reader->tmplts[bucket]; *prev; prev = &(*prev)->next) {
+		if ((*prev)->source == item->source && (*prev)->odid == item->odid
+				&& (*prev)->template_id == item->template_id) {
+			struct tmplt_item *old = *prev;
+			item->next = old->next;
+			*prev = item;
+			free(old);
+			return 0;
+		}
+	}
+
+	item->next = reader->tmplts[bucket];
+	reader->tmplts[bucket] = item;
+	return 0;
+}
+
+ipfixcol_shm_reader_t *ipfixcol_shm_attach(const char *name)
+{
+	struct ipfixcol_shm_reader *reader;
+	const struct ipfixcol_shm_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	if ((size_t) st.st_size < IPFIXCOL_SHM_HDR_SIZE) {
+		close(fd);
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	hdr = (const struct ipfixcol_shm_header *) map;
+	__sync_synchronize();
+	if (hdr->magic != IPFIXCOL_SHM_MAGIC) {
+		/* Writer has not finished initialization yet */
+		munmap(map, st.st_size);
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	if (hdr->version != IPFIXCOL_SHM_VERSION
+			|| hdr->capacity + IPFIXCOL_SHM_HDR_SIZE > (uint64_t) st.st_size) {
+		munmap(map, st.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	reader = calloc(1, sizeof(*reader));
+	if (!reader) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	reader->hdr = hdr;
+	reader->ring = (const uint8_t *) map + IPFIXCOL_SHM_HDR_SIZE;
+	reader->map_size = st.st_size;
+	reader->capacity = hdr->capacity;
+	reader->position = hdr->head;
+	reader->current = reader->position;
+	return reader;
+}
+
+void ipfixcol_shm_detach(ipfixcol_shm_reader_t *reader)
+{
+	unsigned int i;
+
+	if (!reader) {
+		return;
+	}
+
+	for (i = 0; i < TMPLT_BUCKETS; i++) {
+		struct tmplt_item *item = reader->tmplts[i];
+		while (item) {
+			struct tmplt_item *next = item->next;
+			free(item);
+			item = next;
+		}
+	}
+
+	munmap((void *) reader->hdr, reader->map_size);
+	free(reader);
+}
+
+int ipfixcol_shm_next(ipfixcol_shm_reader_t *reader,
+	const struct ipfixcol_shm_entry **entry)
+{
+	const struct ipfixcol_shm_entry *cur;
+	uint64_t head, offset, size;
+	uint32_t length;
+	uint16_t type;
+
+	for (;;) {
+		head = reader->hdr->head;
+		__sync_synchronize();
+
+		if (reader->position == head) {
+			return (reader->hdr->state == IPFIXCOL_SHM_CLOSED) ? -1 : 0;
+		}
+
+		if (head - reader->position > reader->capacity) {
+			/* Overtaken by the writer */
+			reader->lost += head - reader->position;
+			reader->position = head;
+			continue;
+		}
+
+		offset = reader->position & (reader->capacity - 1);
+		if (reader->capacity - offset < sizeof(struct ipfixcol_shm_entry)) {
+			/* Implicit padding at the end of the ring */
+			reader->position += reader->capacity - offset;
+			continue;
+		}
+
+		cur = (const struct ipfixcol_shm_entry *) (reader->ring + offset);
+		length = cur->length;
+		type = cur->type;
+
+		/* Header must be read before it is validated */
+		__sync_synchronize();
+		if (reader->hdr->reserve - reader->position > reader->capacity) {
+			continue;
+		}
+
+		size = IPFIXCOL_SHM_ENTRY_SIZE(length);
+		if (size > reader->capacity - offset) {
+			/* Damaged entry, skip to the end of the ring */
+			reader->position += reader->capacity - offset;
+			continue;
+		}
+
+		reader->current = reader->position;
+		reader->position += size;
+
+		if (type == IPFIXCOL_SHM_PAD) {
+			continue;
+		}
+
+		if (type == IPFIXCOL_SHM_TEMPLATE) {
+			tmplt_store(reader, cur);
+			continue;
+		}
+
+		*entry = cur;
+		return 1;
+	}
+}
+
+int ipfixcol_shm_wait(ipfixcol_shm_reader_t *reader, unsigned int timeout)
+{
+	struct timespec step = {0, 100000};
+	unsigned int waited = 0;
+
+	for (;;) {
+		if (reader->hdr->head != reader->position) {
+			return 1;
+		}
+
+		if (reader->hdr->state == IPFIXCOL_SHM_CLOSED) {
+			return -1;
+		}
+
+		if (waited >= timeout) {
+			return 0;
+		}
+
+		nanosleep(&step, NULL);
+		waited += step.tv_nsec / 1000;
+	}
+}
+
+int ipfixcol_shm_valid(const ipfixcol_shm_reader_t *reader)
+{
+	__sync_synchronize();
+	return reader->hdr->reserve - reader->current <= reader->capacity;
+}
+
+uint64_t ipfixcol_shm_lost(const ipfixcol_shm_reader_t *reader)
+{
+	return reader->lost;
+}
+
+const struct ipfixcol_shm_template *ipfixcol_shm_find_template(
+	const ipfixcol_shm_reader_t *reader, const struct ipfixcol_shm_entry *entry)
+{
+	const struct tmplt_item *item;
+
+	item = reader->tmplts[tmplt_bucket(entry->source, entry->odid, entry->template_id)];
+	for (; item; item = item->next) {
+		if (item->source == entry->source && item->odid == entry->odid
+				&& item->template_id == entry->template_id) {
+			return &item->desc;
+		}
+	}
+
+	return NULL;
+}
+
+size_t ipfixcol_shm_record_length(const struct ipfixcol_shm_template *tmpl,
+	const uint8_t *rec, size_t max)
+{
+	size_t offset = 0;
+	uint16_t i, length;
+
+	for (i = 0; i < tmpl->field_count; i++) {
+		length = tmpl->fields[i].length;
+
+		if (length == 65535) {
+			/* Variable-length field */
+			if (offset + 1 > max) {
+				return 0;
+			}
+
+			length = rec[offset++];
+			if (length == 255) {
+				if (offset + 2 > max) {
+					return 0;
+				}
+				length = (rec[offset] << 8) | rec[offset + 1];
+				offset += 2;
+			}
+		}
+
+		offset += length;
+		if (offset > max) {
+			return 0;
+		}
+	}
+
+	return offset;
+}
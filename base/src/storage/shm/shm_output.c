@@ -0,0 +1,484 @@
+/**
+ * \file storage/shm/shm_output.c
+ * \brief Storage plugin publishing Data Sets into a shared memory ring
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+/**
+ * \defgroup shmStoragePlugin Storage plugin publishing data to shared memory
+ * \ingroup storagePlugins
+ *
+ * Raw Data Sets and descriptors of their templates are appended to a ring in
+ * POSIX shared memory. Local consumers map the ring read-only via the
+ * libipfixcol-shm client library, see \ref shmRing.
+ *
+ * @{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libxml/xmlmemory.h>
+#include <libxml/parser.h>
+
+#include <ipfixcol.h>
+#include "ipfixcol_shm.h"
+
+/* API version constant */
+IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "shm storage";
+
+/** Default name of the shared memory object */
+#define SHM_DEF_NAME "/ipfixcol"
+/** Default size of the ring in MiB */
+#define SHM_DEF_SIZE 64
+/** Number of published templates remembered by the writer */
+#define SHM_TMPLT_SLOTS 4096
+
+/** Template published to the ring */
+struct shm_tmplt {
+	const struct ipfix_template *tmplt; /**< Template (NULL = empty slot) */
+	time_t first_transmission;          /**< Detects reused addresses */
+	uint32_t source;                    /**< Exporter identification */
+	uint32_t odid;                      /**< Observation Domain ID */
+	uint16_t template_id;               /**< Template ID */
+	uint64_t position;                  /**< Position of the last publication */
+};
+
+/** Plugin configuration */
+struct shm_config {
+	char *name;                         /**< Name of the object */
+	int fd;                             /**< Shared memory object */
+	size_t map_size;                    /**< Size of the mapping */
+	struct ipfixcol_shm_header *hdr;    /**< Mapped header */
+	uint8_t *ring;                      /**< Mapped ring */
+	uint64_t mask;                      /**< Capacity - 1 */
+	uint64_t position;                  /**< Writer position (== hdr->head) */
+	struct shm_tmplt *tmplts;           /**< Published templates */
+	uint8_t *buffer;                    /**< Buffer for template descriptors */
+};
+
+/**
+ * \brief Parse plugin configuration
+ *
+ * \param[in] params XML configuration
+ * \param[out] name Name of the object
+ * \param[out] size Size of the ring in MiB
+ * \return 0 on success, nonzero else.
+ */
+static int shm_parse_config(char *params, char **name, uint64_t *size)
+{
+	xmlDocPtr doc;
+	xmlNodePtr cur;
+	xmlChar *value;
+
+	doc = xmlReadMemory(params, strlen(params), "nobase.xml", NULL, 0);
+	if (doc == NULL) {
+		MSG_ERROR(msg_module, "Plugin configuration parsing failed");
+		return 1;
+	}
+
+	cur = xmlDocGetRootElement(doc);
+	if (cur == NULL || xmlStrcmp(cur->name, (const xmlChar *) "fileWriter")) {
+		MSG_ERROR(msg_module, "Root node != fileWriter");
+		xmlFreeDoc(doc);
+		return 1;
+	}
+
+	for (cur = cur->xmlChildrenNode; cur != NULL; cur = cur->next) {
+		if (cur->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+
+		value = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
+		if (!value) {
+			continue;
+		}
+
+		if (!xmlStrcmp(cur->name, (const xmlChar *) "name")) {
+			free(*name);
+			*name = strdup((char *) value);
+		} else if (!xmlStrcmp(cur->name, (const xmlChar *) "size")) {
+			*size = strtoul((char *) value, NULL, 10);
+		}
+
+		xmlFree(value);
+	}
+
+	xmlFreeDoc(doc);
+
+	if (*name == NULL || (*name)[0] != '/') {
+		MSG_ERROR(msg_module, "Name of the shared memory object must start with '/'");
+		return 1;
+	}
+
+	if (*size == 0) {
+		MSG_ERROR(msg_module, "Invalid size of the ring");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Create and map the shared memory object
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] size Requested size of the ring in MiB
+ * \return 0 on success, nonzero else.
+ */
+static int shm_create(struct shm_config *conf, uint64_t size)
+{
+	uint64_t capacity = 1024 * 1024;
+	void *map;
+
+	/* Round up to power of two so offsets can be masked */
+	while (capacity < size * 1024 * 1024) {
+		capacity <<= 1;
+	}
+
+	conf->fd = shm_open(conf->name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (conf->fd == -1) {
+		MSG_ERROR(msg_module, "Unable to create shared memory object '%s' (%s)",
+			conf->name, strerror(errno));
+		return 1;
+	}
+
+	conf->map_size = IPFIXCOL_SHM_HDR_SIZE + capacity;
+	if (ftruncate(conf->fd, conf->map_size) == -1) {
+		MSG_ERROR(msg_module, "Unable to resize shared memory object (%s)", strerror(errno));
+		goto err_unlink;
+	}
+
+	map = mmap(NULL, conf->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, conf->fd, 0);
+	if (map == MAP_FAILED) {
+		MSG_ERROR(msg_module, "Unable to map shared memory object (%s)", strerror(errno));
+		goto err_unlink;
+	}
+
+	conf->hdr = (struct ipfixcol_shm_header *) map;
+	conf->ring = (uint8_t *) map + IPFIXCOL_SHM_HDR_SIZE;
+	conf->mask = capacity - 1;
+	conf->position = 0;
+
+	conf->hdr->version = IPFIXCOL_SHM_VERSION;
+	conf->hdr->state = IPFIXCOL_SHM_RUNNING;
+	conf->hdr->capacity = capacity;
+	conf->hdr->instance = ((uint64_t) time(NULL) << 32) | (uint32_t) getpid();
+	conf->hdr->reserve = 0;
+	conf->hdr->head = 0;
+
+	/* Readers check the magic number, so it is written last */
+	__sync_synchronize();
+	conf->hdr->magic = IPFIXCOL_SHM_MAGIC;
+
+	MSG_INFO(msg_module, "Publishing to '%s' (ring of %" PRIu64 " bytes)", conf->name, capacity);
+	return 0;
+
+err_unlink:
+	close(conf->fd);
+	shm_unlink(conf->name);
+	return 1;
+}
+
+/**
+ * \brief Append an entry to the ring
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] entry Entry header (length and type are filled in)
+ * \param[in] payload Payload
+ * \param[in] length Length of the payload
+ */
+static void shm_publish(struct shm_config *conf, struct ipfixcol_shm_entry *entry,
+	const void *payload, uint32_t length)
+{
+	uint64_t capacity = conf->mask + 1;
+	uint64_t size = IPFIXCOL_SHM_ENTRY_SIZE(length);
+	uint64_t pos = conf->position;
+	uint64_t offset = pos & conf->mask;
+	uint64_t pad = 0;
+
+	if (size > capacity / 2) {
+		MSG_WARNING(msg_module, "Entry of %u bytes does not fit into the ring", length);
+		return;
+	}
+
+	if (offset + size > capacity) {
+		/* Entry does not fit into the rest of the ring */
+		pad = capacity - offset;
+	}
+
+	/* Announce the area being overwritten */
+	conf->hdr->reserve = pos + pad + size;
+	__sync_synchronize();
+
+	if (pad >= sizeof(struct ipfixcol_shm_entry)) {
+		struct ipfixcol_shm_entry *pad_entry = (struct ipfixcol_shm_entry *) (conf->ring + offset);
+		memset(pad_entry, 0, sizeof(*pad_entry));
+		pad_entry->type = IPFIXCOL_SHM_PAD;
+		pad_entry->length = pad - sizeof(struct ipfixcol_shm_entry);
+	}
+
+	pos += pad;
+	entry->length = length;
+	memcpy(conf->ring + (pos & conf->mask), entry, sizeof(*entry));
+	memcpy(conf->ring + (pos & conf->mask) + sizeof(*entry), payload, length);
+
+	/* Publish the entry */
+	__sync_synchronize();
+	conf->position = pos + size;
+	conf->hdr->head = conf->position;
+}
+
+/**
+ * \brief Compute identification of the exporter
+ *
+ * \param[in] input Input information of the message
+ * \return Hash of the exporter address and port (0 for files)
+ */
+static uint32_t shm_source_id(const struct input_info *input)
+{
+	const struct input_info_network *net;
+	const uint8_t *addr;
+	uint32_t hash = 2166136261U; /* FNV-1a */
+	size_t i, len;
+
+	if (input->type == SOURCE_TYPE_IPFIX_FILE) {
+		return 0;
+	}
+
+	net = (const struct input_info_network *) input;
+	addr = (const uint8_t *) &net->src_addr;
+	len = (net->l3_proto == 6) ? 16 : 4;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ addr[i]) * 16777619U;
+	}
+
+	hash = (hash ^ (net->src_port & 0xff)) * 16777619U;
+	hash = (hash ^ (net->src_port >> 8)) * 16777619U;
+	return hash;
+}
+
+/**
+ * \brief Publish template descriptor if readers may not know it
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] hdr Entry header of the data set
+ * \param[in] tmplt Template
+ */
+static void shm_check_template(struct shm_config *conf,
+	const struct ipfixcol_shm_entry *hdr, const struct ipfix_template *tmplt)
+{
+	uint32_t idx = (hdr->source ^ (hdr->odid * 31) ^ (hdr->template_id * 65599U)) % SHM_TMPLT_SLOTS;
+	struct shm_tmplt *slot = &conf->tmplts[idx];
+	uint64_t capacity = conf->mask + 1;
+
+	if (slot->tmplt == tmplt && slot->first_transmission == tmplt->first_transmission
+			&& slot->source == hdr->source && slot->odid == hdr->odid
+			&& slot->template_id == hdr->template_id
+			&& conf->position - slot->position < capacity / 2) {
+		/* Published recently */
+		return;
+	}
+
+	/* Build the descriptor */
+	struct ipfixcol_shm_template *desc = (struct ipfixcol_shm_template *) conf->buffer;
+	uint16_t i = 0, count;
+
+	desc->scope_field_count = tmplt->scope_field_count;
+	desc->options = (tmplt->template_type == TM_OPTIONS_TEMPLATE);
+	desc->reserved = 0;
+
+	for (count = 0; count < tmplt->field_count; count++) {
+		const template_ie *field = &tmplt->fields[i++];
+		struct ipfixcol_shm_field *out = &desc->fields[count];
+
+		out->id = field->ie.id & 0x7FFF;
+		out->length = field->ie.length;
+		out->enterprise = 0;
+		if (field->ie.id & 0x8000) {
+			/* Enterprise number follows */
+			out->enterprise = tmplt->fields[i++].enterprise_number;
+		}
+	}
+	desc->field_count = count;
+
+	struct ipfixcol_shm_entry entry = *hdr;
+	entry.type = IPFIXCOL_SHM_TEMPLATE;
+	shm_publish(conf, &entry, desc, sizeof(*desc) + count * sizeof(struct ipfixcol_shm_field));
+
+	slot->tmplt = tmplt;
+	slot->first_transmission = tmplt->first_transmission;
+	slot->source = hdr->source;
+	slot->odid = hdr->odid;
+	slot->template_id = hdr->template_id;
+	slot->position = conf->position;
+}
+
+/**
+ * \brief Storage plugin initialization.
+ *
+ * \param[in] params parameters for this storage plugin
+ * \param[out] config the plugin specific configuration structure
+ * \return 0 on success, nonzero else.
+ */
+int storage_init(char *params, void **config)
+{
+	struct shm_config *conf;
+	uint64_t size = SHM_DEF_SIZE;
+
+	conf = calloc(1, sizeof(*conf));
+	if (!conf) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	conf->name = strdup(SHM_DEF_NAME);
+	if (shm_parse_config(params, &conf->name, &size)) {
+		goto err_conf;
+	}
+
+	conf->tmplts = calloc(SHM_TMPLT_SLOTS, sizeof(struct shm_tmplt));
+	/* Descriptor of the largest possible template */
+	conf->buffer = malloc(sizeof(struct ipfixcol_shm_template)
+		+ (MSG_MAX_LENGTH / 4) * sizeof(struct ipfixcol_shm_field));
+	if (!conf->tmplts || !conf->buffer) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		goto err_conf;
+	}
+
+	if (shm_create(conf, size)) {
+		goto err_conf;
+	}
+
+	*config = conf;
+	return 0;
+
+err_conf:
+	free(conf->buffer);
+	free(conf->tmplts);
+	free(conf->name);
+	free(conf);
+	return 1;
+}
+
+/**
+ * \brief Publish Data Sets of the message
+ *
+ * \param[in] config the plugin specific configuration structure
+ * \param[in] ipfix_msg IPFIX message
+ * \param[in] template_mgr template manager
+ * \return 0 on success, nonzero else.
+ */
+int store_packet(void *config, const struct ipfix_message *ipfix_msg,
+	const struct ipfix_template_mgr *template_mgr)
+{
+	(void) template_mgr;
+	struct shm_config *conf = (struct shm_config *) config;
+	struct ipfixcol_shm_entry entry;
+	int i;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.type = IPFIXCOL_SHM_DATA;
+	entry.odid = ntohl(ipfix_msg->pkt_header->observation_domain_id);
+	entry.source = shm_source_id(ipfix_msg->input_info);
+	entry.export_time = ntohl(ipfix_msg->pkt_header->export_time);
+	entry.sequence = ntohl(ipfix_msg->pkt_header->sequence_number);
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && ipfix_msg->data_couple[i].data_set; i++) {
+		const struct ipfix_template *tmplt = ipfix_msg->data_couple[i].data_template;
+		const struct ipfix_data_set *set = ipfix_msg->data_couple[i].data_set;
+
+		if (tmplt == NULL) {
+			/* Data without template cannot be interpreted by readers */
+			continue;
+		}
+
+		entry.type = IPFIXCOL_SHM_DATA;
+		entry.template_id = tmplt->template_id;
+		shm_check_template(conf, &entry, tmplt);
+		shm_publish(conf, &entry, set, ntohs(set->header.length));
+	}
+
+	return 0;
+}
+
+int store_now(const void *config)
+{
+	(void) config;
+	return 0;
+}
+
+/**
+ * \brief Remove storage plugin.
+ *
+ * Readers are told that the ring is closed and the object is removed. Readers
+ * that are still attached keep their mapping until they detach.
+ *
+ * \param[in] config the plugin specific configuration structure
+ * \return 0 on success, nonzero else.
+ */
+int storage_close(void **config)
+{
+	struct shm_config *conf = (struct shm_config *) *config;
+
+	conf->hdr->state = IPFIXCOL_SHM_CLOSED;
+	__sync_synchronize();
+
+	munmap(conf->hdr, conf->map_size);
+	close(conf->fd);
+	shm_unlink(conf->name);
+
+	free(conf->buffer);
+	free(conf->tmplts);
+	free(conf->name);
+	free(conf);
+	*config = NULL;
+	return 0;
+}
+
+/**@}*/
@@ -0,0 +1,1022 @@
+/**
+ * \file storage_io.c
+ * \brief Asynchronous file writes for storage plugins
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __has_include
+# if __has_include(<linux/io_uring.h>)
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#  if defined(__NR_io_uring_setup) && defined(IO_URING_OP_SUPPORTED)
+#   define STORAGE_IO_HAVE_URING 1
+#  endif
+# endif
+#endif
+
+#include <ipfixcol.h>
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "storage io";
+
+/** Number of threads of the fallback backend */
+#define STORAGE_IO_THREADS 2
+
+/** Largest part of a write submitted at once */
+#define STORAGE_IO_MAX_CHUNK (1U << 30)
+
+/** Type of a request */
+enum storage_io_type {
+	STORAGE_IO_WRITE,
+	STORAGE_IO_WRITE_FIXED,
+	STORAGE_IO_FSYNC,
+	STORAGE_IO_WAKEUP
+};
+
+/**
+ * \brief Request
+ */
+struct storage_io_req {
+	int type;                            /**< enum storage_io_type */
+	int fd;                              /**< File descriptor */
+	unsigned int index;                  /**< Registered buffer */
+	const uint8_t *buf;                  /**< Data */
+	size_t len;                          /**< Length of the data */
+	size_t done;                         /**< Bytes written so far */
+	off_t offset;                        /**< File offset */
+	storage_io_cb cb;                    /**< Completion callback */
+	void *user;                          /**< User data of the callback */
+	struct storage_io_req *next;         /**< Next request in a list */
+	struct storage_io_req *merged;       /**< fsync requests merged into this one */
+};
+
+/**
+ * \brief Thread of the fallback backend
+ *
+ * Requests for a file descriptor are always executed by the same thread in
+ * order of submission, which keeps fsync behind preceding writes.
+ */
+struct storage_io_worker {
+	struct storage_io *io;               /**< Layer */
+	pthread_t thread;                    /**< Thread */
+	pthread_cond_t cond;                 /**< Signals new request or termination */
+	struct storage_io_req *head;         /**< First queued request */
+	struct storage_io_req *tail;         /**< Last queued request */
+};
+
+#ifdef STORAGE_IO_HAVE_URING
+/**
+ * \brief io_uring instance
+ */
+struct storage_io_ring {
+	int fd;                              /**< io_uring file descriptor */
+	pthread_t thread;                    /**< Completion thread */
+	void *sq_ptr;                        /**< Mapped submission ring */
+	size_t sq_size;                      /**< Size of the submission ring mapping */
+	void *cq_ptr;                        /**< Mapped completion ring */
+	size_t cq_size;                      /**< Size of the completion ring mapping */
+	struct io_uring_sqe *sqes;           /**< Submission queue entries */
+	size_t sqes_size;                    /**< Size of the entries mapping */
+	unsigned int *sq_tail;               /**< Tail of the submission ring */
+	unsigned int *sq_mask;               /**< Mask of the submission ring */
+	unsigned int *sq_array;              /**< Indexes of entries */
+	unsigned int *cq_head;               /**< Head of the completion ring */
+	unsigned int *cq_tail;               /**< Tail of the completion ring */
+	unsigned int *cq_mask;               /**< Mask of the completion ring */
+	struct io_uring_cqe *cqes;           /**< Completion queue entries */
+	unsigned int to_submit;              /**< Entries not passed to the kernel yet */
+};
+#endif
+
+/**
+ * \brief Asynchronous write layer
+ */
+struct storage_io {
+	int backend;                         /**< enum storage_io_backend */
+	unsigned int depth;                  /**< Maximal number of used requests */
+	unsigned int batch;                  /**< Buffered requests triggering submission */
+
+	pthread_mutex_t mutex;               /**< Protects everything below */
+	pthread_cond_t cond;                 /**< Signals completion of a request */
+	struct storage_io_req *reqs;         /**< All requests */
+	struct storage_io_req *free;         /**< Unused requests */
+	unsigned int used;                   /**< Requests buffered or in flight */
+	struct storage_io_req *pending;      /**< Buffered requests */
+	struct storage_io_req *pending_tail; /**< Last buffered request */
+	unsigned int pending_count;          /**< Number of buffered requests */
+	struct iovec *buffers;               /**< Registered buffers */
+	unsigned int buffer_count;           /**< Number of registered buffers */
+	int stop;                            /**< Terminate threads */
+
+	struct storage_io_worker workers[STORAGE_IO_THREADS]; /**< Fallback backend */
+#ifdef STORAGE_IO_HAVE_URING
+	struct storage_io_ring ring;         /**< io_uring backend */
+#endif
+};
+
+/**
+ * \brief Finish a request and all requests merged into it
+ *
+ * Callbacks are called without the lock held.
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] req Request
+ * \param[in] result Result passed to callbacks
+ */
+static void storage_io_complete(struct storage_io *io, struct storage_io_req *req, int result)
+{
+	struct storage_io_req *aux, *last = req;
+	unsigned int count = 1;
+
+	if (req->cb) {
+		req->cb(result, req->user);
+	}
+	for (aux = req->merged; aux; aux = aux->next) {
+		if (aux->cb) {
+			aux->cb(result, aux->user);
+		}
+		last->next = aux;
+		last = aux;
+		count++;
+	}
+
+	pthread_mutex_lock(&io->mutex);
+	last->next = io->free;
+	io->free = req;
+	io->used -= count;
+	pthread_cond_broadcast(&io->cond);
+	pthread_mutex_unlock(&io->mutex);
+}
+
+/**
+ * \brief Result of a finished write
+ *
+ * \param[in] req Request
+ * \return Number of bytes written
+ */
+static int storage_io_written(const struct storage_io_req *req)
+{
+	return (req->len > INT32_MAX) ? INT32_MAX : (int) req->len;
+}
+
+/*
+ * Fallback backend: pool of threads
+ */
+
+/**
+ * \brief Execute a request synchronously
+ *
+ * \param[in] req Request
+ * \return Result of the request
+ */
+static int storage_io_execute(struct storage_io_req *req)
+{
+	ssize_t ret;
+
+	if (req->type == STORAGE_IO_FSYNC) {
+		return (fsync(req->fd) == 0) ? 0 : -errno;
+	}
+
+	while (req->done < req->len) {
+		ret = pwrite(req->fd, req->buf + req->done, req->len - req->done,
+				req->offset + req->done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		if (ret == 0) {
+			return -EIO;
+		}
+		req->done += ret;
+	}
+
+	return storage_io_written(req);
+}
+
+/**
+ * \brief Thread of the fallback backend
+ *
+ * \param[in] arg Worker
+ * \return NULL
+ */
+static void *storage_io_worker_thread(void *arg)
+{
+	struct storage_io_worker *worker = (struct storage_io_worker *) arg;
+	struct storage_io *io = worker->io;
+	struct storage_io_req *req;
+	int result;
+
+	pthread_mutex_lock(&io->mutex);
+	for (;;) {
+		while (!worker->head && !io->stop) {
+			pthread_cond_wait(&worker->cond, &io->mutex);
+		}
+		if (!worker->head) {
+			break;
+		}
+
+		req = worker->head;
+		worker->head = req->next;
+		if (!worker->head) {
+			worker->tail = NULL;
+		}
+		pthread_mutex_unlock(&io->mutex);
+
+		result = storage_io_execute(req);
+		storage_io_complete(io, req, result);
+
+		pthread_mutex_lock(&io->mutex);
+	}
+	pthread_mutex_unlock(&io->mutex);
+
+	return NULL;
+}
+
+/**
+ * \brief Pass a request to the thread of its file descriptor (locked)
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] req Request
+ */
+static void storage_io_threads_submit(struct storage_io *io, struct storage_io_req *req)
+{
+	struct storage_io_worker *worker = &io->workers[(unsigned int) req->fd % STORAGE_IO_THREADS];
+
+	req->next = NULL;
+	if (worker->tail) {
+		worker->tail->next = req;
+	} else {
+		worker->head = req;
+	}
+	worker->tail = req;
+	pthread_cond_signal(&worker->cond);
+}
+
+/**
+ * \brief Start the fallback backend
+ *
+ * \param[in] io Asynchronous write layer
+ * \return 0 on success, nonzero else.
+ */
+static int storage_io_threads_start(struct storage_io *io)
+{
+	int i;
+
+	for (i = 0; i < STORAGE_IO_THREADS; i++) {
+		io->workers[i].io = io;
+		pthread_cond_init(&io->workers[i].cond, NULL);
+		if (pthread_create(&io->workers[i].thread, NULL, storage_io_worker_thread, &io->workers[i]) != 0) {
+			MSG_ERROR(msg_module, "Unable to create I/O thread");
+			pthread_cond_destroy(&io->workers[i].cond);
+			break;
+		}
+	}
+
+	if (i == STORAGE_IO_THREADS) {
+		return 0;
+	}
+
+	/* Stop threads started so far */
+	pthread_mutex_lock(&io->mutex);
+	io->stop = 1;
+	for (int j = 0; j < i; j++) {
+		pthread_cond_signal(&io->workers[j].cond);
+	}
+	pthread_mutex_unlock(&io->mutex);
+
+	while (i-- > 0) {
+		pthread_join(io->workers[i].thread, NULL);
+		pthread_cond_destroy(&io->workers[i].cond);
+	}
+	return 1;
+}
+
+/**
+ * \brief Stop the fallback backend
+ *
+ * \param[in] io Asynchronous write layer
+ */
+static void storage_io_threads_stop(struct storage_io *io)
+{
+	int i;
+
+	pthread_mutex_lock(&io->mutex);
+	io->stop = 1;
+	for (i = 0; i < STORAGE_IO_THREADS; i++) {
+		pthread_cond_signal(&io->workers[i].cond);
+	}
+	pthread_mutex_unlock(&io->mutex);
+
+	for (i = 0; i < STORAGE_IO_THREADS; i++) {
+		pthread_join(io->workers[i].thread, NULL);
+		pthread_cond_destroy(&io->workers[i].cond);
+	}
+}
+
+/*
+ * io_uring backend
+ */
+
+#ifdef STORAGE_IO_HAVE_URING
+/**
+ * \brief Put a request into the submission ring (locked)
+ *
+ * The ring is never full, because it has at least as many entries as there
+ * are requests and a request occupies at most one entry at a time.
+ *
+ * \param[in] ring io_uring instance
+ * \param[in] req Request
+ */
+static void storage_io_ring_prepare(struct storage_io_ring *ring, struct storage_io_req *req)
+{
+	unsigned int tail = *ring->sq_tail;
+	unsigned int index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	size_t len;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = req->fd;
+	sqe->user_data = (uint64_t) (uintptr_t) req;
+
+	switch (req->type) {
+	case STORAGE_IO_WRITE:
+	case STORAGE_IO_WRITE_FIXED:
+		len = req->len - req->done;
+		if (len > STORAGE_IO_MAX_CHUNK) {
+			len = STORAGE_IO_MAX_CHUNK;
+		}
+		sqe->opcode = (req->type == STORAGE_IO_WRITE) ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED;
+		sqe->addr = (uint64_t) (uintptr_t) (req->buf + req->done);
+		sqe->len = len;
+		sqe->off = req->offset + req->done;
+		sqe->buf_index = req->index;
+		break;
+	case STORAGE_IO_FSYNC:
+		/* Start only after all previously submitted requests have completed */
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->flags = IOSQE_IO_DRAIN;
+		break;
+	default:
+		sqe->opcode = IORING_OP_NOP;
+		sqe->fd = -1;
+		break;
+	}
+
+	ring->sq_array[index] = index;
+	__sync_synchronize();
+	*ring->sq_tail = tail + 1;
+	ring->to_submit++;
+}
+
+/**
+ * \brief Pass prepared entries to the kernel (locked)
+ *
+ * \param[in] ring io_uring instance
+ * \return 0 on success, nonzero else.
+ */
+static int storage_io_ring_enter(struct storage_io_ring *ring)
+{
+	int ret;
+
+	while (ring->to_submit > 0) {
+		__sync_synchronize();
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+				continue;
+			}
+			MSG_ERROR(msg_module, "Unable to submit I/O requests: %s", strerror(errno));
+			return 1;
+		}
+		ring->to_submit -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Handle a completion queue entry
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] req Request
+ * \param[in] res Result of the entry
+ */
+static void storage_io_ring_handle(struct storage_io *io, struct storage_io_req *req, int res)
+{
+	if (req->type == STORAGE_IO_FSYNC) {
+		storage_io_complete(io, req, res);
+		return;
+	}
+
+	if (res < 0) {
+		storage_io_complete(io, req, res);
+		return;
+	}
+	if (res == 0) {
+		storage_io_complete(io, req, -EIO);
+		return;
+	}
+
+	req->done += res;
+	if (req->done < req->len) {
+		/* Short write, continue with the rest */
+		pthread_mutex_lock(&io->mutex);
+		storage_io_ring_prepare(&io->ring, req);
+		storage_io_ring_enter(&io->ring);
+		pthread_mutex_unlock(&io->mutex);
+		return;
+	}
+
+	storage_io_complete(io, req, storage_io_written(req));
+}
+
+/**
+ * \brief Completion thread of the io_uring backend
+ *
+ * \param[in] arg Asynchronous write layer
+ * \return NULL
+ */
+static void *storage_io_ring_thread(void *arg)
+{
+	struct storage_io *io = (struct storage_io *) arg;
+	struct storage_io_ring *ring = &io->ring;
+	struct io_uring_cqe *cqe;
+	struct storage_io_req *req;
+	unsigned int head;
+	int res, stop = 0;
+
+	while (!stop) {
+		if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+				&& errno != EINTR) {
+			MSG_ERROR(msg_module, "Unable to wait for I/O completions: %s", strerror(errno));
+			usleep(1000);
+		}
+
+		head = *ring->cq_head;
+		__sync_synchronize();
+		while (head != *ring->cq_tail) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			req = (struct storage_io_req *) (uintptr_t) cqe->user_data;
+			res = cqe->res;
+			head++;
+			__sync_synchronize();
+			*ring->cq_head = head;
+
+			if (req->type == STORAGE_IO_WAKEUP) {
+				stop = 1;
+				continue;
+			}
+			storage_io_ring_handle(io, req, res);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Check that the kernel supports all operations
+ *
+ * \param[in] fd io_uring file descriptor
+ * \return Nonzero when supported
+ */
+static int storage_io_ring_probe(int fd)
+{
+	static const int ops[] = {IORING_OP_NOP, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, IORING_OP_FSYNC};
+	struct io_uring_probe *probe;
+	size_t size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	int ret = 1;
+
+	probe = calloc(1, size);
+	if (!probe) {
+		return 0;
+	}
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		free(probe);
+		return 0;
+	}
+
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			ret = 0;
+		}
+	}
+
+	free(probe);
+	return ret;
+}
+
+/**
+ * \brief Release io_uring resources
+ *
+ * \param[in] ring io_uring instance
+ */
+static void storage_io_ring_free(struct storage_io_ring *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_size);
+	}
+	if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED) {
+		munmap(ring->sq_ptr, ring->sq_size);
+	}
+	close(ring->fd);
+}
+
+/**
+ * \brief Start the io_uring backend
+ *
+ * \param[in] io Asynchronous write layer
+ * \return 0 on success, nonzero when io_uring is not available
+ */
+static int storage_io_ring_start(struct storage_io *io)
+{
+	struct storage_io_ring *ring = &io->ring;
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, io->depth, &params);
+	if (ring->fd < 0) {
+		MSG_INFO(msg_module, "io_uring not available (%s); using threads", strerror(errno));
+		return 1;
+	}
+
+	if (!storage_io_ring_probe(ring->fd)) {
+		MSG_INFO(msg_module, "io_uring does not support required operations; using threads");
+		close(ring->fd);
+		return 1;
+	}
+
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_size > ring->sq_size) {
+			ring->sq_size = ring->cq_size;
+		}
+		ring->cq_size = ring->sq_size;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		goto err;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			goto err;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		goto err;
+	}
+
+	ring->sq_tail = (unsigned int *) ((uint8_t *) ring->sq_ptr + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *) ((uint8_t *) ring->sq_ptr + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) ((uint8_t *) ring->sq_ptr + params.sq_off.array);
+	ring->cq_head = (unsigned int *) ((uint8_t *) ring->cq_ptr + params.cq_off.head);
+	ring->cq_tail = (unsigned int *) ((uint8_t *) ring->cq_ptr + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *) ((uint8_t *) ring->cq_ptr + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((uint8_t *) ring->cq_ptr + params.cq_off.cqes);
+
+	if (pthread_create(&ring->thread, NULL, storage_io_ring_thread, io) != 0) {
+		MSG_ERROR(msg_module, "Unable to create I/O completion thread");
+		goto err;
+	}
+
+	return 0;
+
+err:
+	MSG_WARNING(msg_module, "Unable to set up io_uring; using threads");
+	storage_io_ring_free(ring);
+	memset(ring, 0, sizeof(*ring));
+	return 1;
+}
+
+/**
+ * \brief Stop the io_uring backend (no requests may be in flight)
+ *
+ * \param[in] io Asynchronous write layer
+ */
+static void storage_io_ring_stop(struct storage_io *io)
+{
+	struct storage_io_req wakeup;
+
+	memset(&wakeup, 0, sizeof(wakeup));
+	wakeup.type = STORAGE_IO_WAKEUP;
+
+	pthread_mutex_lock(&io->mutex);
+	storage_io_ring_prepare(&io->ring, &wakeup);
+	storage_io_ring_enter(&io->ring);
+	pthread_mutex_unlock(&io->mutex);
+
+	pthread_join(io->ring.thread, NULL);
+	storage_io_ring_free(&io->ring);
+}
+#endif /* STORAGE_IO_HAVE_URING */
+
+/*
+ * Common part
+ */
+
+/**
+ * \brief Submit buffered requests (locked)
+ *
+ * \param[in] io Asynchronous write layer
+ * \return 0 on success, nonzero else.
+ */
+static int storage_io_submit_locked(struct storage_io *io)
+{
+	struct storage_io_req *req, *next;
+
+	req = io->pending;
+	io->pending = io->pending_tail = NULL;
+	io->pending_count = 0;
+
+	for (; req; req = next) {
+		next = req->next;
+#ifdef STORAGE_IO_HAVE_URING
+		if (io->backend == STORAGE_IO_BACKEND_URING) {
+			storage_io_ring_prepare(&io->ring, req);
+			continue;
+		}
+#endif
+		storage_io_threads_submit(io, req);
+	}
+
+#ifdef STORAGE_IO_HAVE_URING
+	if (io->backend == STORAGE_IO_BACKEND_URING) {
+		return storage_io_ring_enter(&io->ring);
+	}
+#endif
+	return 0;
+}
+
+/**
+ * \brief Get an unused request, wait when all are used (locked)
+ *
+ * \param[in] io Asynchronous write layer
+ * \return Request
+ */
+static struct storage_io_req *storage_io_get(struct storage_io *io)
+{
+	struct storage_io_req *req;
+
+	while (!io->free) {
+		if (io->pending) {
+			/* Buffered requests could never complete otherwise */
+			storage_io_submit_locked(io);
+		}
+		pthread_cond_wait(&io->cond, &io->mutex);
+	}
+
+	req = io->free;
+	io->free = req->next;
+	io->used++;
+
+	memset(req, 0, sizeof(*req));
+	return req;
+}
+
+/**
+ * \brief Buffer a request and submit the batch when it is full (locked)
+ *
+ * \param[in] io Asynchronous write layer
+ * \param[in] req Request
+ * \return 0 on success, nonzero else.
+ */
+static int storage_io_enqueue(struct storage_io *io, struct storage_io_req *req)
+{
+	req->next = NULL;
+	if (io->pending_tail) {
+		io->pending_tail->next = req;
+	} else {
+		io->pending = req;
+	}
+	io->pending_tail = req;
+
+	if (++io->pending_count >= io->batch) {
+		return storage_io_submit_locked(io);
+	}
+	return 0;
+}
+
+/**
+ * \brief Create asynchronous write layer
+ */
+struct storage_io *storage_io_create(unsigned int depth, unsigned int batch, int flags)
+{
+	struct storage_io *io;
+	unsigned int i;
+
+	io = calloc(1, sizeof(*io));
+	if (!io) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	io->depth = depth ? depth : STORAGE_IO_DEPTH;
+	io->batch = batch ? batch : STORAGE_IO_BATCH;
+	if (io->batch > io->depth) {
+		io->batch = io->depth;
+	}
+
+	io->reqs = calloc(io->depth, sizeof(*io->reqs));
+	if (!io->reqs) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(io);
+		return NULL;
+	}
+	for (i = 0; i < io->depth; i++) {
+		io->reqs[i].next = io->free;
+		io->free = &io->reqs[i];
+	}
+
+	pthread_mutex_init(&io->mutex, NULL);
+	pthread_cond_init(&io->cond, NULL);
+
+	io->backend = STORAGE_IO_BACKEND_THREADS;
+#ifdef STORAGE_IO_HAVE_URING
+	if (!(flags & STORAGE_IO_NO_URING) && storage_io_ring_start(io) == 0) {
+		io->backend = STORAGE_IO_BACKEND_URING;
+	}
+#else
+	(void) flags;
+#endif
+
+	if (io->backend == STORAGE_IO_BACKEND_THREADS && storage_io_threads_start(io) != 0) {
+		pthread_cond_destroy(&io->cond);
+		pthread_mutex_destroy(&io->mutex);
+		free(io->reqs);
+		free(io);
+		return NULL;
+	}
+
+	MSG_DEBUG(msg_module, "Using %s (depth %u, batch %u)",
+		(io->backend == STORAGE_IO_BACKEND_URING) ? "io_uring" : "threads", io->depth, io->batch);
+	return io;
+}
+
+/**
+ * \brief Get backend of the layer
+ */
+int storage_io_backend(const struct storage_io *io)
+{
+	return io->backend;
+}
+
+/**
+ * \brief Register buffers for storage_io_write_fixed()
+ */
+int storage_io_register_buffers(struct storage_io *io, const struct iovec *iov, unsigned int count)
+{
+	int ret = 0;
+
+	if (!iov || count == 0) {
+		return 1;
+	}
+
+	pthread_mutex_lock(&io->mutex);
+	if (io->buffers || io->used > 0) {
+		pthread_mutex_unlock(&io->mutex);
+		MSG_ERROR(msg_module, "Buffers can be registered only once and without pending requests");
+		return 1;
+	}
+
+	io->buffers = calloc(count, sizeof(*iov));
+	if (!io->buffers) {
+		pthread_mutex_unlock(&io->mutex);
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+	memcpy(io->buffers, iov, count * sizeof(*iov));
+	io->buffer_count = count;
+
+#ifdef STORAGE_IO_HAVE_URING
+	if (io->backend == STORAGE_IO_BACKEND_URING
+			&& syscall(__NR_io_uring_register, io->ring.fd, IORING_REGISTER_BUFFERS, iov, count) < 0) {
+		MSG_ERROR(msg_module, "Unable to register I/O buffers: %s", strerror(errno));
+		free(io->buffers);
+		io->buffers = NULL;
+		io->buffer_count = 0;
+		ret = 1;
+	}
+#endif
+
+	pthread_mutex_unlock(&io->mutex);
+	return ret;
+}
+
+/**
+ * \brief Request a write at a given file offset
+ */
+int storage_io_write(struct storage_io *io, int fd, const void *buf, size_t len,
+		off_t offset, storage_io_cb cb, void *user)
+{
+	struct storage_io_req *req;
+	int ret;
+
+	if (fd < 0 || (!buf && len > 0) || offset < 0) {
+		return 1;
+	}
+
+	pthread_mutex_lock(&io->mutex);
+	req = storage_io_get(io);
+	req->type = STORAGE_IO_WRITE;
+	req->fd = fd;
+	req->buf = buf;
+	req->len = len;
+	req->offset = offset;
+	req->cb = cb;
+	req->user = user;
+	ret = storage_io_enqueue(io, req);
+	pthread_mutex_unlock(&io->mutex);
+
+	return ret;
+}
+
+/**
+ * \brief Request a write from a registered buffer
+ */
+int storage_io_write_fixed(struct storage_io *io, int fd, unsigned int index,
+		const void *buf, size_t len, off_t offset, storage_io_cb cb, void *user)
+{
+	struct storage_io_req *req;
+	const uint8_t *base;
+	int ret;
+
+	if (fd < 0 || offset < 0 || index >= io->buffer_count) {
+		return 1;
+	}
+
+	base = io->buffers[index].iov_base;
+	if ((const uint8_t *) buf < base
+			|| (const uint8_t *) buf + len > base + io->buffers[index].iov_len) {
+		MSG_ERROR(msg_module, "Data do not lie in registered buffer %u", index);
+		return 1;
+	}
+
+	pthread_mutex_lock(&io->mutex);
+	req = storage_io_get(io);
+	req->type = STORAGE_IO_WRITE_FIXED;
+	req->fd = fd;
+	req->index = index;
+	req->buf = buf;
+	req->len = len;
+	req->offset = offset;
+	req->cb = cb;
+	req->user = user;
+	ret = storage_io_enqueue(io, req);
+	pthread_mutex_unlock(&io->mutex);
+
+	return ret;
+}
+
+/**
+ * \brief Request fsync of a file descriptor
+ */
+int storage_io_fsync(struct storage_io *io, int fd, storage_io_cb cb, void *user)
+{
+	struct storage_io_req *req, *aux, *last = NULL;
+	int ret = 0;
+
+	if (fd < 0) {
+		return 1;
+	}
+
+	pthread_mutex_lock(&io->mutex);
+	req = storage_io_get(io);
+	req->type = STORAGE_IO_FSYNC;
+	req->fd = fd;
+	req->cb = cb;
+	req->user = user;
+
+	/* Find the last buffered request for the descriptor */
+	for (aux = io->pending; aux; aux = aux->next) {
+		if (aux->fd == fd) {
+			last = aux;
+		}
+	}
+
+	if (last && last->type == STORAGE_IO_FSYNC) {
+		/* Merge into the buffered fsync */
+		req->next = last->merged;
+		last->merged = req;
+	} else {
+		ret = storage_io_enqueue(io, req);
+	}
+	pthread_mutex_unlock(&io->mutex);
+
+	return ret;
+}
+
+/**
+ * \brief Submit buffered requests
+ */
+int storage_io_submit(struct storage_io *io)
+{
+	int ret;
+
+	pthread_mutex_lock(&io->mutex);
+	ret = storage_io_submit_locked(io);
+	pthread_mutex_unlock(&io->mutex);
+
+	return ret;
+}
+
+/**
+ * \brief Submit buffered requests and wait until all requests complete
+ */
+int storage_io_flush(struct storage_io *io)
+{
+	int ret;
+
+	pthread_mutex_lock(&io->mutex);
+	ret = storage_io_submit_locked(io);
+	while (ret == 0 && io->used > 0) {
+		pthread_cond_wait(&io->cond, &io->mutex);
+	}
+	pthread_mutex_unlock(&io->mutex);
+
+	return ret;
+}
+
+/**
+ * \brief Complete all requests and destroy the layer
+ */
+void storage_io_destroy(struct storage_io *io)
+{
+	if (!io) {
+		return;
+	}
+
+	storage_io_flush(io);
+
+#ifdef STORAGE_IO_HAVE_URING
+	if (io->backend == STORAGE_IO_BACKEND_URING) {
+		storage_io_ring_stop(io);
+	} else
+#endif
+	{
+		storage_io_threads_stop(io);
+	}
+
+	pthread_cond_destroy(&io->cond);
+	pthread_mutex_destroy(&io->mutex);
+	free(io->buffers);
+	free(io->reqs);
+	free(io);
+}
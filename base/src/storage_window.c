@@ -0,0 +1,381 @@
+/**
+ * \file storage_window.c
+ * \brief Preparation of storage time windows ahead of their start
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <ipfixcol.h>
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "storage window";
+
+/** Mode of created directories */
+#define STORAGE_DIR_MODE (S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)
+
+/**
+ * \brief Time window helper
+ */
+struct storage_window {
+	pthread_t thread;                    /**< Preparing thread */
+	pthread_mutex_t mutex;               /**< Protects everything below */
+	pthread_cond_t cond;                 /**< Signals switch or termination */
+
+	uint32_t size;                       /**< Window size in seconds */
+	uint32_t lead;                       /**< Preparation in advance (seconds) */
+	storage_window_prepare_cb prepare;   /**< Prepare callback */
+	storage_window_release_cb release;   /**< Release callback */
+	void *user;                          /**< User data of callbacks */
+
+	time_t current;                      /**< Start of window used by plugin */
+	void *ready;                         /**< Resources of the next window */
+	int prepared;                        /**< Next window is prepared */
+	int published;                       /**< Next window has started (atomic) */
+	int stop;                            /**< Terminate the thread */
+
+	/* Used only by the storage thread */
+	time_t watermark;                    /**< Event time (0 = system clock) */
+	int rewind;                          /**< First watermark is before current */
+};
+
+/**
+ * \brief Wait until given time, switch or termination
+ *
+ * \param[in] win Time window helper (locked)
+ * \param[in] until Absolute time
+ */
+static void storage_window_wait(struct storage_window *win, time_t until)
+{
+	struct timespec ts;
+
+	ts.tv_sec = until;
+	ts.tv_nsec = 0;
+	pthread_cond_timedwait(&win->cond, &win->mutex, &ts);
+}
+
+/**
+ * \brief Thread preparing next windows
+ *
+ * \param[in] arg Time window helper
+ * \return NULL
+ */
+static void *storage_window_thread(void *arg)
+{
+	struct storage_window *win = (struct storage_window *) arg;
+	time_t next;
+	void *ready;
+
+	pthread_mutex_lock(&win->mutex);
+	while (!win->stop) {
+		next = win->current + win->size;
+
+		if (!win->prepared) {
+			if (time(NULL) < next - (time_t) win->lead) {
+				storage_window_wait(win, next - win->lead);
+				continue;
+			}
+
+			/* Directories and files are created without the lock */
+			pthread_mutex_unlock(&win->mutex);
+			ready = win->prepare(next, win->user);
+			pthread_mutex_lock(&win->mutex);
+
+			if (win->current + (time_t) win->size != next) {
+				/* Switched by watermark meanwhile, window is not the next one */
+				if (ready && win->release) {
+					win->release(ready, win->user);
+				}
+				continue;
+			}
+
+			win->ready = ready;
+			win->prepared = 1;
+			continue;
+		}
+
+		if (!win->published) {
+			if (time(NULL) < next) {
+				storage_window_wait(win, next);
+				continue;
+			}
+
+			__atomic_store_n(&win->published, 1, __ATOMIC_RELEASE);
+		}
+
+		/* Wait for the storage thread to take the window */
+		pthread_cond_wait(&win->cond, &win->mutex);
+	}
+	pthread_mutex_unlock(&win->mutex);
+
+	return NULL;
+}
+
+/**
+ * \brief Start preparing time windows
+ */
+struct storage_window *storage_window_create(time_t start, uint32_t size,
+		uint32_t lead, storage_window_prepare_cb prepare,
+		storage_window_release_cb release, void *user)
+{
+	struct storage_window *win;
+
+	if (size == 0 || prepare == NULL) {
+		MSG_ERROR(msg_module, "Invalid time window configuration");
+		return NULL;
+	}
+
+	win = calloc(1, sizeof(struct storage_window));
+	if (!win) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	win->size = size;
+	win->lead = (lead < size) ? lead : size;
+	win->prepare = prepare;
+	win->release = release;
+	win->user = user;
+	win->current = start;
+
+	if (pthread_mutex_init(&win->mutex, NULL) != 0) {
+		MSG_ERROR(msg_module, "Mutex initialization failed");
+		free(win);
+		return NULL;
+	}
+
+	if (pthread_cond_init(&win->cond, NULL) != 0) {
+		MSG_ERROR(msg_module, "Condition variable initialization failed");
+		pthread_mutex_destroy(&win->mutex);
+		free(win);
+		return NULL;
+	}
+
+	if (pthread_create(&win->thread, NULL, storage_window_thread, win) != 0) {
+		MSG_ERROR(msg_module, "Unable to create thread preparing time windows");
+		pthread_cond_destroy(&win->cond);
+		pthread_mutex_destroy(&win->mutex);
+		free(win);
+		return NULL;
+	}
+
+	return win;
+}
+
+/**
+ * \brief Switch to the next time window if its boundary has passed
+ */
+int storage_window_switch(struct storage_window *win, time_t *start,
+		void **prepared)
+{
+	time_t now, steps;
+
+	if (win->watermark) {
+		/* Event time; switch when all records of the window were delivered */
+		if (!win->rewind && win->watermark < win->current + (time_t) win->size) {
+			return 0;
+		}
+	} else if (!__atomic_load_n(&win->published, __ATOMIC_ACQUIRE)) {
+		/* Fast path; the flag is only set by the thread */
+		return 0;
+	}
+
+	pthread_mutex_lock(&win->mutex);
+	if (win->watermark) {
+		now = win->watermark;
+		steps = (now >= win->current) ? (now - win->current) / win->size
+			: -((win->current - now + win->size - 1) / win->size);
+
+		win->rewind = 0;
+		if (steps == 0) {
+			/* Watermark caught up with the current window meanwhile */
+			pthread_mutex_unlock(&win->mutex);
+			return 0;
+		}
+
+		*start = win->current + steps * win->size;
+		*prepared = (steps == 1) ? win->ready : NULL;
+		if (steps != 1 && win->ready && win->release) {
+			/* Prepared window is not the one of the watermark */
+			win->release(win->ready, win->user);
+		}
+	} else {
+		*start = win->current + win->size;
+		*prepared = win->ready;
+
+		now = time(NULL);
+		if (now >= *start + (time_t) win->size) {
+			/* Plugin was idle, prepared window is already over */
+			if (*prepared && win->release) {
+				win->release(*prepared, win->user);
+			}
+
+			*prepared = NULL;
+			*start += ((now - *start) / win->size) * win->size;
+		}
+	}
+
+	win->current = *start;
+	win->ready = NULL;
+	win->prepared = 0;
+	__atomic_store_n(&win->published, 0, __ATOMIC_RELEASE);
+	pthread_cond_signal(&win->cond);
+	pthread_mutex_unlock(&win->mutex);
+
+	return 1;
+}
+
+/**
+ * \brief Pass watermark of a message to the helper
+ */
+void storage_window_watermark(struct storage_window *win, uint64_t watermark)
+{
+	time_t wm = (time_t) (watermark / 1000);
+
+	if (!win || watermark == 0 || wm <= win->watermark) {
+		return;
+	}
+
+	if (!win->watermark) {
+		MSG_INFO(msg_module, "Switching time windows by watermarks");
+		win->rewind = (wm < win->current);
+	}
+
+	win->watermark = wm;
+}
+
+/**
+ * \brief Stop the background thread and release unused resources
+ */
+void storage_window_destroy(struct storage_window *win)
+{
+	if (!win) {
+		return;
+	}
+
+	pthread_mutex_lock(&win->mutex);
+	win->stop = 1;
+	pthread_cond_signal(&win->cond);
+	pthread_mutex_unlock(&win->mutex);
+
+	pthread_join(win->thread, NULL);
+
+	if (win->ready && win->release) {
+		win->release(win->ready, win->user);
+	}
+
+	pthread_cond_destroy(&win->cond);
+	pthread_mutex_destroy(&win->mutex);
+	free(win);
+}
+
+/**
+ * \brief Create directory and all its missing parents
+ *
+ * \param[in,out] dir Directory path (temporarily modified)
+ * \return 0 on success, nonzero else.
+ */
+static int storage_mkdir_r(char *dir)
+{
+	char *slash;
+	int ret;
+
+	if (dir[0] == '\0') {
+		/* Root directory */
+		return 0;
+	}
+
+	/* Usually only the last directory is missing */
+	if (mkdir(dir, STORAGE_DIR_MODE) == 0 || errno == EEXIST) {
+		return 0;
+	}
+
+	if (errno != ENOENT || (slash = strrchr(dir, '/')) == NULL) {
+		MSG_ERROR(msg_module, "Failed to create directory '%s' (%s)", dir, strerror(errno));
+		return 1;
+	}
+
+	*slash = '\0';
+	ret = storage_mkdir_r(dir);
+	*slash = '/';
+	if (ret) {
+		return ret;
+	}
+
+	/* Directory may be created concurrently by another thread */
+	if (mkdir(dir, STORAGE_DIR_MODE) != 0 && errno != EEXIST) {
+		MSG_ERROR(msg_module, "Failed to create directory '%s' (%s)", dir, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Create all directories on the path
+ */
+int storage_mkdir(const char *path)
+{
+	char *dir, *slash;
+	int ret;
+
+	dir = strdup(path);
+	if (!dir) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	/* Strip the file name */
+	slash = strrchr(dir, '/');
+	if (!slash) {
+		free(dir);
+		return 0;
+	}
+
+	/* Remove all trailing slashes */
+	while (slash > dir && *(slash - 1) == '/') {
+		slash--;
+	}
+	*slash = '\0';
+
+	ret = storage_mkdir_r(dir);
+	free(dir);
+	return ret;
+}
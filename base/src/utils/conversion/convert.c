@@ -49,6 +49,7 @@
 #ifdef ENABLE_SFLOW
 #include "sflow.h"
 #include "sflowtool.h"
+#include "sflow_ipfix.h"
 #endif
 
 #define NETFLOW_V5_VERSION 5
@@ -141,6 +142,13 @@ static uint8_t inserted = 0;
 static uint8_t plugin = UDP_PLUGIN;
 static uint32_t buff_len = 0;
 
+#ifdef ENABLE_SFLOW
+/* sFlow templates were sent (without template lifetime configuration) */
+static uint8_t sflow_inserted = 0;
+/* Copy of received sFlow datagram, the packet buffer is used for output */
+static uint8_t *sflow_datagram = NULL;
+#endif
+
 /**
  * \struct input_info_list
  * \brief  List structure for input info
@@ -204,6 +212,14 @@ int convert_init(int in_plugin, int len)
 		templates.templ[i] = 0;
 	}
 
+#ifdef ENABLE_SFLOW
+	sflow_datagram = malloc(len);
+	if (sflow_datagram == NULL) {
+		free(templates.templ);
+		return 1;
+	}
+#endif
+
 	/* Fill in static variables */
 	buff_len = len;
 	plugin = in_plugin;
@@ -240,7 +256,54 @@ int templates_realloc()
 void convert_close()
 {
 	free(templates.templ);
+#ifdef ENABLE_SFLOW
+	free(sflow_datagram);
+	sflow_datagram = NULL;
+#endif
+}
+
+#ifdef ENABLE_SFLOW
+/**
+ * \brief Decide whether sFlow templates should be sent with the next message
+ *
+ * Follows the same template refresh rules as Netflow v5 conversion.
+ *
+ * \param[in] export_time Export time of the message
+ * \return Non-zero if templates should be inserted
+ */
+static int sflow_templates_needed(uint32_t export_time)
+{
+	if (plugin != UDP_PLUGIN || info_list == NULL
+			|| (info_list->info.template_life_packet == NULL && info_list->info.template_life_time == NULL)) {
+		if (sflow_inserted) {
+			return 0;
+		}
+
+		sflow_inserted = 1;
+		return 1;
+	}
+
+	uint32_t last = 0;
+	if (info_list->info.template_life_packet != NULL) {
+		if (info_list->packets_sent == strtol(info_list->info.template_life_packet, NULL, 10)) {
+			last = export_time;
+		}
+	}
+
+	if ((last == 0) && (info_list->info.template_life_time != NULL)) {
+		last = info_list->last_sent + strtol(info_list->info.template_life_time, NULL, 10);
+		info_list->packets_sent++;
+	}
+
+	if (last <= export_time) {
+		info_list->last_sent = export_time;
+		info_list->packets_sent = 1;
+		return 1;
+	}
+
+	return 0;
 }
+#endif
 
 /**
  * \brief Inserts Template Set into packet and updates input_info
@@ -947,9 +1010,29 @@ int convert_packet(char **packet, ssize_t *len, uint16_t max_len, char *input_in
 			break; }
 
 		/* sFlow packet */
-		default:
+		default: {
 #ifdef ENABLE_SFLOW
-			/* Conversion from sflow to Netflow v5-like IPFIX packet */
+			/* sFlow v5 is converted directly to IPFIX */
+			struct sflow_ipfix_params params;
+			params.export_time = (uint32_t) time(NULL);
+			params.sequence_number = ipfix_seq_no[SF_SEQ_NO];
+			params.with_templates = 0;
+
+			if (*len > 0 && (uint32_t) *len <= buff_len) {
+				memcpy(sflow_datagram, *packet, *len);
+				params.with_templates = sflow_templates_needed(params.export_time);
+
+				int ret = sflow_to_ipfix(sflow_datagram, *len, (uint8_t *) *packet, buff_len, &params);
+				if (ret >= 0) {
+					*len = ret;
+					ipfix_seq_no[SF_SEQ_NO] += params.records;
+					return 0;
+				} else if (ret != SFLOW_IPFIX_UNSUPPORTED) {
+					return CONVERSION_ERROR;
+				}
+			}
+
+			/* Older versions: conversion to Netflow v5-like IPFIX packet */
 			uint16_t flow_sample_count = Process_sflow(*packet, *len);
 
 			/* Observation domain ID is unknown */
@@ -968,7 +1051,7 @@ int convert_packet(char **packet, ssize_t *len, uint16_t max_len, char *input_in
 			/* Conversion error */
 			return CONVERSION_ERROR;
 #endif
-			break;
+			break; }
 	}
 
 	header->version = htons(IPFIX_VERSION);
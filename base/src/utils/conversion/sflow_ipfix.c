@@ -0,0 +1,932 @@
+/**
+ * \file sflow_ipfix.c
+ * \brief Direct conversion of sFlow v5 datagrams to IPFIX messages
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <ipfixcol.h>
+#include <string.h>
+
+#include "convert.h"
+#include "sflow_ipfix.h"
+
+/** sFlow datagram version */
+#define SFLOW_VERSION 5
+
+/** sFlow address types */
+#define SFLOW_ADDR_IPV4 1
+#define SFLOW_ADDR_IPV6 2
+
+/** sFlow sample types (enterprise 0) */
+#define SFLOW_FLOW_SAMPLE              1
+#define SFLOW_COUNTERS_SAMPLE          2
+#define SFLOW_FLOW_SAMPLE_EXPANDED     3
+#define SFLOW_COUNTERS_SAMPLE_EXPANDED 4
+
+/** sFlow flow record types (enterprise 0) */
+#define SFLOW_FLOW_HEADER    1
+#define SFLOW_FLOW_ETHERNET  2
+#define SFLOW_FLOW_IPV4      3
+#define SFLOW_FLOW_IPV6      4
+#define SFLOW_FLOW_SWITCH    1001
+#define SFLOW_FLOW_ROUTER    1002
+#define SFLOW_FLOW_GATEWAY   1003
+
+/** sFlow counter record types (enterprise 0) */
+#define SFLOW_COUNTERS_GENERIC 1
+
+/** Header protocols of sampled header record */
+#define SFLOW_HEADER_ETHERNET 1
+#define SFLOW_HEADER_IPV4     11
+#define SFLOW_HEADER_IPV6     12
+
+/** Sizes of fixed parts of structures */
+#define SFLOW_FLOW_SAMPLE_LEN              32
+#define SFLOW_FLOW_SAMPLE_EXPANDED_LEN     44
+#define SFLOW_COUNTERS_SAMPLE_LEN          12
+#define SFLOW_COUNTERS_SAMPLE_EXPANDED_LEN 16
+#define SFLOW_COUNTERS_GENERIC_LEN         88
+
+/** Lengths of converted records */
+#define FLOW4_RECORD_LEN    90
+#define FLOW6_RECORD_LEN    126
+#define COUNTERS_RECORD_LEN 96
+
+/** Number of fields in converted records */
+#define FLOW_FIELDS     24
+#define COUNTERS_FIELDS 20
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "sflow";
+
+/**
+ * \brief Template field
+ */
+struct field {
+	uint16_t id;         /**< Element ID */
+	uint16_t length;     /**< Element length */
+	uint32_t enterprise; /**< Enterprise number (0 for IANA) */
+};
+
+/** Fields of IPv4 flow records (order of the record) */
+static const struct field flow4_fields[FLOW_FIELDS] = {
+	{8, 4, 0},   /* sourceIPv4Address */
+	{12, 4, 0},  /* destinationIPv4Address */
+	{15, 4, 0},  /* ipNextHopIPv4Address */
+	{10, 4, 0},  /* ingressInterface */
+	{14, 4, 0},  /* egressInterface */
+	{2, 8, 0},   /* packetDeltaCount */
+	{1, 8, 0},   /* octetDeltaCount */
+	{152, 8, 0}, /* flowStartMilliseconds */
+	{153, 8, 0}, /* flowEndMilliseconds */
+	{7, 2, 0},   /* sourceTransportPort */
+	{11, 2, 0},  /* destinationTransportPort */
+	{6, 1, 0},   /* tcpControlBits */
+	{4, 1, 0},   /* protocolIdentifier */
+	{5, 1, 0},   /* ipClassOfService */
+	{192, 1, 0}, /* ipTTL */
+	{16, 4, 0},  /* bgpSourceAsNumber */
+	{17, 4, 0},  /* bgpDestinationAsNumber */
+	{9, 1, 0},   /* sourceIPv4PrefixLength */
+	{13, 1, 0},  /* destinationIPv4PrefixLength */
+	{58, 2, 0},  /* vlanId */
+	{59, 2, 0},  /* postVlanId */
+	{56, 6, 0},  /* sourceMacAddress */
+	{80, 6, 0},  /* destinationMacAddress */
+	{34, 4, 0},  /* samplingInterval */
+};
+
+/** Fields of IPv6 flow records (order of the record) */
+static const struct field flow6_fields[FLOW_FIELDS] = {
+	{27, 16, 0}, /* sourceIPv6Address */
+	{28, 16, 0}, /* destinationIPv6Address */
+	{62, 16, 0}, /* ipNextHopIPv6Address */
+	{10, 4, 0},  /* ingressInterface */
+	{14, 4, 0},  /* egressInterface */
+	{2, 8, 0},   /* packetDeltaCount */
+	{1, 8, 0},   /* octetDeltaCount */
+	{152, 8, 0}, /* flowStartMilliseconds */
+	{153, 8, 0}, /* flowEndMilliseconds */
+	{7, 2, 0},   /* sourceTransportPort */
+	{11, 2, 0},  /* destinationTransportPort */
+	{6, 1, 0},   /* tcpControlBits */
+	{4, 1, 0},   /* protocolIdentifier */
+	{5, 1, 0},   /* ipClassOfService */
+	{192, 1, 0}, /* ipTTL (hop limit) */
+	{16, 4, 0},  /* bgpSourceAsNumber */
+	{17, 4, 0},  /* bgpDestinationAsNumber */
+	{29, 1, 0},  /* sourceIPv6PrefixLength */
+	{30, 1, 0},  /* destinationIPv6PrefixLength */
+	{58, 2, 0},  /* vlanId */
+	{59, 2, 0},  /* postVlanId */
+	{56, 6, 0},  /* sourceMacAddress */
+	{80, 6, 0},  /* destinationMacAddress */
+	{34, 4, 0},  /* samplingInterval */
+};
+
+/** Fields of interface counter records (order of the record) */
+static const struct field counters_fields[COUNTERS_FIELDS] = {
+	{1, 4, SFLOW_IPFIX_ENTERPRISE},  /* ifIndex */
+	{2, 4, SFLOW_IPFIX_ENTERPRISE},  /* ifType */
+	{3, 8, SFLOW_IPFIX_ENTERPRISE},  /* ifSpeed */
+	{4, 4, SFLOW_IPFIX_ENTERPRISE},  /* ifDirection */
+	{5, 4, SFLOW_IPFIX_ENTERPRISE},  /* ifStatus */
+	{6, 8, SFLOW_IPFIX_ENTERPRISE},  /* ifInOctets */
+	{7, 4, SFLOW_IPFIX_ENTERPRISE},  /* ifInUcastPkts */
+	{8, 4, SFLOW_IPFIX_ENTERPRISE},  /* ifInMulticastPkts */
+	{9, 4, SFLOW_IPFIX_ENTERPRISE},  /* ifInBroadcastPkts */
+	{10, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifInDiscards */
+	{11, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifInErrors */
+	{12, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifInUnknownProtos */
+	{13, 8, SFLOW_IPFIX_ENTERPRISE}, /* ifOutOctets */
+	{14, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifOutUcastPkts */
+	{15, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifOutMulticastPkts */
+	{16, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifOutBroadcastPkts */
+	{17, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifOutDiscards */
+	{18, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifOutErrors */
+	{19, 4, SFLOW_IPFIX_ENTERPRISE}, /* ifPromiscuousMode */
+	{323, 8, 0},                     /* observationTimeMilliseconds */
+};
+
+/**
+ * \brief Decoded flow sample
+ */
+struct flow {
+	uint8_t ip_version;   /**< 4 or 6, 0 when no IP header was found */
+	uint8_t src[16];      /**< Source address */
+	uint8_t dst[16];      /**< Destination address */
+	uint8_t next_hop[16]; /**< Next hop address (same family as src/dst) */
+	uint32_t in_if;       /**< Input interface */
+	uint32_t out_if;      /**< Output interface */
+	uint32_t length;      /**< Length of the IP packet */
+	uint32_t sampling;    /**< Sampling rate */
+	uint16_t src_port;    /**< Source port */
+	uint16_t dst_port;    /**< Destination port (ICMP type and code) */
+	uint8_t tcp_flags;    /**< TCP flags */
+	uint8_t protocol;     /**< IP protocol */
+	uint8_t tos;          /**< Type of service/traffic class */
+	uint8_t ttl;          /**< TTL/hop limit */
+	uint32_t src_as;      /**< Source AS */
+	uint32_t dst_as;      /**< Destination AS */
+	uint8_t src_mask;     /**< Source prefix length */
+	uint8_t dst_mask;     /**< Destination prefix length */
+	uint16_t vlan;        /**< Incoming VLAN */
+	uint16_t post_vlan;   /**< Outgoing VLAN */
+	uint8_t src_mac[6];   /**< Source MAC address */
+	uint8_t dst_mac[6];   /**< Destination MAC address */
+};
+
+/**
+ * \brief Output buffer with currently open Data Set
+ */
+struct writer {
+	uint8_t *pos;     /**< Write position */
+	uint8_t *end;     /**< End of the buffer */
+	uint8_t *set;     /**< Header of the open set (NULL if none) */
+	uint16_t set_id;  /**< ID of the open set */
+	uint32_t records; /**< Number of written records */
+};
+
+/* Unaligned big-endian access */
+static inline uint16_t get16(const uint8_t *p)
+{
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline uint64_t get64(const uint8_t *p)
+{
+	return ((uint64_t) get32(p) << 32) | get32(p + 4);
+}
+
+static inline uint8_t *put8(uint8_t *p, uint8_t v)
+{
+	*p = v;
+	return p + 1;
+}
+
+static inline uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+	return p + 2;
+}
+
+static inline uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return p + 4;
+}
+
+static inline uint8_t *put64(uint8_t *p, uint64_t v)
+{
+	put32(p, v >> 32);
+	return put32(p + 4, v);
+}
+
+static inline uint8_t *put_bytes(uint8_t *p, const uint8_t *src, size_t len)
+{
+	memcpy(p, src, len);
+	return p + len;
+}
+
+/**
+ * \brief Get length of sFlow address (including type)
+ *
+ * \param[in] p Address
+ * \param[in] len Remaining length
+ * \return Length of the address or 0 if it is invalid
+ */
+static size_t address_len(const uint8_t *p, size_t len)
+{
+	if (len < 4) {
+		return 0;
+	}
+
+	switch (get32(p)) {
+	case SFLOW_ADDR_IPV4:
+		return (len >= 8) ? 8 : 0;
+	case SFLOW_ADDR_IPV6:
+		return (len >= 20) ? 20 : 0;
+	default:
+		/* Unknown address has no value */
+		return 4;
+	}
+}
+
+/**
+ * \brief Decode transport header
+ */
+static void decode_l4(struct flow *flow, const uint8_t *p, size_t len)
+{
+	switch (flow->protocol) {
+	case 6: /* TCP */
+		if (len >= 14) {
+			flow->tcp_flags = p[13];
+		}
+		/* Fall through */
+	case 17:  /* UDP */
+	case 132: /* SCTP */
+		if (len >= 4) {
+			flow->src_port = get16(p);
+			flow->dst_port = get16(p + 2);
+		}
+		break;
+	case 1:  /* ICMP */
+	case 58: /* ICMPv6 */
+		if (len >= 2) {
+			flow->dst_port = get16(p);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * \brief Decode IPv4 header
+ */
+static void decode_ipv4(struct flow *flow, const uint8_t *p, size_t len)
+{
+	if (len < 20 || (p[0] >> 4) != 4) {
+		return;
+	}
+
+	size_t ihl = (p[0] & 0x0f) * 4;
+
+	flow->ip_version = 4;
+	flow->tos = p[1];
+	flow->ttl = p[8];
+	flow->protocol = p[9];
+	memcpy(flow->src, p + 12, 4);
+	memcpy(flow->dst, p + 16, 4);
+
+	/* Only the first fragment has transport header */
+	if ((get16(p + 6) & 0x1fff) == 0 && ihl >= 20 && len > ihl) {
+		decode_l4(flow, p + ihl, len - ihl);
+	}
+}
+
+/**
+ * \brief Decode IPv6 header (with extension headers)
+ */
+static void decode_ipv6(struct flow *flow, const uint8_t *p, size_t len)
+{
+	if (len < 40 || (p[0] >> 4) != 6) {
+		return;
+	}
+
+	flow->ip_version = 6;
+	flow->tos = (uint8_t) ((p[0] << 4) | (p[1] >> 4));
+	flow->ttl = p[7];
+	memcpy(flow->src, p + 8, 16);
+	memcpy(flow->dst, p + 24, 16);
+
+	uint8_t next = p[6];
+	size_t off = 40;
+
+	/* Skip extension headers */
+	for (;;) {
+		if (next == 0 || next == 43 || next == 60) {
+			/* Hop-by-hop, routing, destination options */
+			if (len < off + 8) {
+				break;
+			}
+
+			next = p[off];
+			off += (p[off + 1] + 1) * 8;
+		} else if (next == 44) {
+			/* Fragment - only the first one has transport header */
+			if (len < off + 8 || (get16(p + off + 2) & 0xfff8) != 0) {
+				flow->protocol = p[off];
+				return;
+			}
+
+			next = p[off];
+			off += 8;
+		} else {
+			break;
+		}
+	}
+
+	flow->protocol = next;
+	if (len > off) {
+		decode_l4(flow, p + off, len - off);
+	}
+}
+
+/**
+ * \brief Decode sampled packet header
+ */
+static void decode_header(struct flow *flow, const uint8_t *p, size_t len)
+{
+	uint32_t protocol = get32(p);
+	uint32_t frame_len = get32(p + 4);
+	uint32_t stripped = get32(p + 8);
+	uint32_t header_len = get32(p + 12);
+
+	if (header_len > len - 16) {
+		return;
+	}
+
+	const uint8_t *h = p + 16;
+	size_t off = 0;
+	uint16_t type;
+
+	switch (protocol) {
+	case SFLOW_HEADER_ETHERNET:
+		if (header_len < 14) {
+			return;
+		}
+
+		memcpy(flow->dst_mac, h, 6);
+		memcpy(flow->src_mac, h + 6, 6);
+		type = get16(h + 12);
+		off = 14;
+
+		/* 802.1Q and 802.1ad tags, outer VLAN is reported */
+		while ((type == 0x8100 || type == 0x88a8) && header_len >= off + 4) {
+			if (flow->vlan == 0) {
+				flow->vlan = get16(h + off) & 0x0fff;
+			}
+
+			type = get16(h + off + 2);
+			off += 4;
+		}
+		break;
+	case SFLOW_HEADER_IPV4:
+		type = 0x0800;
+		break;
+	case SFLOW_HEADER_IPV6:
+		type = 0x86dd;
+		break;
+	default:
+		return;
+	}
+
+	if (type == 0x0800) {
+		decode_ipv4(flow, h + off, header_len - off);
+	} else if (type == 0x86dd) {
+		decode_ipv6(flow, h + off, header_len - off);
+	} else {
+		return;
+	}
+
+	/* Bytes from the start of IP header */
+	if (frame_len > stripped + off) {
+		flow->length = frame_len - stripped - off;
+	}
+}
+
+/**
+ * \brief Decode extended gateway record
+ */
+static void decode_gateway(struct flow *flow, const uint8_t *p, size_t len)
+{
+	size_t addr_len = address_len(p, len);
+	if (addr_len == 0 || len < addr_len + 16) {
+		return;
+	}
+
+	p += addr_len;
+	len -= addr_len;
+
+	/* as, src_as, src_peer_as, number of path segments */
+	flow->src_as = get32(p + 4);
+	uint32_t segments = get32(p + 12);
+	p += 16;
+	len -= 16;
+
+	/* Destination AS is the last AS of the path */
+	for (uint32_t i = 0; i < segments && len >= 8; ++i) {
+		uint32_t count = get32(p + 4);
+		if (count > (len - 8) / 4) {
+			return;
+		}
+
+		if (count > 0) {
+			flow->dst_as = get32(p + 8 + (count - 1) * 4);
+		}
+
+		p += 8 + count * 4;
+		len -= 8 + count * 4;
+	}
+}
+
+/**
+ * \brief Decode one flow record of a flow sample
+ */
+static void decode_flow_record(struct flow *flow, uint32_t type, const uint8_t *p, size_t len)
+{
+	size_t addr_len;
+
+	switch (type) {
+	case SFLOW_FLOW_HEADER:
+		if (len >= 16) {
+			decode_header(flow, p, len);
+		}
+		break;
+	case SFLOW_FLOW_ETHERNET:
+		if (len >= 24) {
+			flow->length = get32(p);
+			memcpy(flow->src_mac, p + 4, 6);
+			memcpy(flow->dst_mac, p + 12, 6);
+		}
+		break;
+	case SFLOW_FLOW_IPV4:
+		if (len >= 32) {
+			flow->ip_version = 4;
+			flow->length = get32(p);
+			flow->protocol = get32(p + 4);
+			memcpy(flow->src, p + 8, 4);
+			memcpy(flow->dst, p + 12, 4);
+			flow->src_port = get32(p + 16);
+			flow->dst_port = get32(p + 20);
+			flow->tcp_flags = get32(p + 24);
+			flow->tos = get32(p + 28);
+		}
+		break;
+	case SFLOW_FLOW_IPV6:
+		if (len >= 56) {
+			flow->ip_version = 6;
+			flow->length = get32(p);
+			flow->protocol = get32(p + 4);
+			memcpy(flow->src, p + 8, 16);
+			memcpy(flow->dst, p + 24, 16);
+			flow->src_port = get32(p + 40);
+			flow->dst_port = get32(p + 44);
+			flow->tcp_flags = get32(p + 48);
+			flow->tos = get32(p + 52);
+		}
+		break;
+	case SFLOW_FLOW_SWITCH:
+		if (len >= 16) {
+			flow->vlan = get32(p);
+			flow->post_vlan = get32(p + 8);
+		}
+		break;
+	case SFLOW_FLOW_ROUTER:
+		addr_len = address_len(p, len);
+		if (addr_len == 0 || len < addr_len + 8) {
+			break;
+		}
+
+		if (addr_len == 8) {
+			memcpy(flow->next_hop, p + 4, 4);
+		} else if (addr_len == 20) {
+			memcpy(flow->next_hop, p + 4, 16);
+		}
+
+		flow->src_mask = get32(p + addr_len);
+		flow->dst_mask = get32(p + addr_len + 4);
+		break;
+	case SFLOW_FLOW_GATEWAY:
+		decode_gateway(flow, p, len);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * \brief Close open Data Set
+ */
+static void writer_close_set(struct writer *w)
+{
+	if (w->set) {
+		put16(w->set + 2, (uint16_t) (w->pos - w->set));
+		w->set = NULL;
+	}
+}
+
+/**
+ * \brief Reserve space for a record
+ *
+ * Consecutive records with the same template share one Data Set.
+ *
+ * \return Pointer to the record or NULL if the buffer is full
+ */
+static uint8_t *writer_record(struct writer *w, uint16_t template_id, size_t len)
+{
+	int new_set = (w->set == NULL || w->set_id != template_id);
+	size_t need = len + (new_set ? sizeof(struct ipfix_set_header) : 0);
+
+	if ((size_t) (w->end - w->pos) < need) {
+		return NULL;
+	}
+
+	if (new_set) {
+		writer_close_set(w);
+		w->set = w->pos;
+		w->set_id = template_id;
+		put16(w->pos, template_id);
+		w->pos += sizeof(struct ipfix_set_header);
+	}
+
+	uint8_t *rec = w->pos;
+	w->pos += len;
+	w->records++;
+	return rec;
+}
+
+/**
+ * \brief Write one template record
+ */
+static uint8_t *write_template(uint8_t *p, uint16_t id, const struct field *fields, uint16_t count)
+{
+	p = put16(p, id);
+	p = put16(p, count);
+
+	for (uint16_t i = 0; i < count; ++i) {
+		if (fields[i].enterprise) {
+			p = put16(p, fields[i].id | 0x8000);
+			p = put16(p, fields[i].length);
+			p = put32(p, fields[i].enterprise);
+		} else {
+			p = put16(p, fields[i].id);
+			p = put16(p, fields[i].length);
+		}
+	}
+
+	return p;
+}
+
+/**
+ * \brief Write Template Set with all templates
+ *
+ * \return 0 on success, 1 if the buffer is too small
+ */
+static int write_templates(struct writer *w)
+{
+	size_t len = sizeof(struct ipfix_set_header) + 3 * 4 + 2 * FLOW_FIELDS * 4
+			+ COUNTERS_FIELDS * 4;
+
+	for (int i = 0; i < COUNTERS_FIELDS; ++i) {
+		if (counters_fields[i].enterprise) {
+			len += 4;
+		}
+	}
+
+	if ((size_t) (w->end - w->pos) < len) {
+		return 1;
+	}
+
+	uint8_t *p = w->pos;
+	p = put16(p, IPFIX_TEMPLATE_FLOWSET_ID);
+	p = put16(p, len);
+	p = write_template(p, SFLOW_IPFIX_FLOW4_TEMPLATE, flow4_fields, FLOW_FIELDS);
+	p = write_template(p, SFLOW_IPFIX_FLOW6_TEMPLATE, flow6_fields, FLOW_FIELDS);
+	p = write_template(p, SFLOW_IPFIX_COUNTERS_TEMPLATE, counters_fields, COUNTERS_FIELDS);
+
+	w->pos = p;
+	return 0;
+}
+
+/**
+ * \brief Write flow record
+ *
+ * \return 0 on success, 1 if the buffer is full
+ */
+static int write_flow(struct writer *w, const struct flow *flow, uint64_t time_ms)
+{
+	int ipv6 = (flow->ip_version == 6);
+	uint8_t *p = writer_record(w, ipv6 ? SFLOW_IPFIX_FLOW6_TEMPLATE : SFLOW_IPFIX_FLOW4_TEMPLATE,
+			ipv6 ? FLOW6_RECORD_LEN : FLOW4_RECORD_LEN);
+	if (p == NULL) {
+		return 1;
+	}
+
+	size_t addr = ipv6 ? 16 : 4;
+	p = put_bytes(p, flow->src, addr);
+	p = put_bytes(p, flow->dst, addr);
+	p = put_bytes(p, flow->next_hop, addr);
+	p = put32(p, flow->in_if);
+	p = put32(p, flow->out_if);
+
+	/* Counters are scaled by sampling rate */
+	p = put64(p, flow->sampling);
+	p = put64(p, (uint64_t) flow->sampling * flow->length);
+	p = put64(p, time_ms);
+	p = put64(p, time_ms);
+	p = put16(p, flow->src_port);
+	p = put16(p, flow->dst_port);
+	p = put8(p, flow->tcp_flags);
+	p = put8(p, flow->protocol);
+	p = put8(p, flow->tos);
+	p = put8(p, flow->ttl);
+	p = put32(p, flow->src_as);
+	p = put32(p, flow->dst_as);
+	p = put8(p, flow->src_mask);
+	p = put8(p, flow->dst_mask);
+	p = put16(p, flow->vlan);
+	p = put16(p, flow->post_vlan);
+	p = put_bytes(p, flow->src_mac, 6);
+	p = put_bytes(p, flow->dst_mac, 6);
+	put32(p, flow->sampling);
+
+	return 0;
+}
+
+/**
+ * \brief Convert flow sample
+ *
+ * \return 0 on success, 1 if the buffer is full
+ */
+static int convert_flow_sample(struct writer *w, int expanded, const uint8_t *p, size_t len,
+		uint64_t time_ms)
+{
+	struct flow flow;
+	uint32_t in, out, count;
+
+	memset(&flow, 0, sizeof(flow));
+
+	if (expanded) {
+		if (len < SFLOW_FLOW_SAMPLE_EXPANDED_LEN) {
+			return 0;
+		}
+
+		flow.sampling = get32(p + 12);
+		in = (get32(p + 24) == 0) ? get32(p + 28) : 0;
+		out = (get32(p + 32) == 0) ? get32(p + 36) : 0;
+		count = get32(p + 40);
+		p += SFLOW_FLOW_SAMPLE_EXPANDED_LEN;
+		len -= SFLOW_FLOW_SAMPLE_EXPANDED_LEN;
+	} else {
+		if (len < SFLOW_FLOW_SAMPLE_LEN) {
+			return 0;
+		}
+
+		/* Format of the interface in 2 most significant bits */
+		flow.sampling = get32(p + 8);
+		in = get32(p + 20);
+		in = (in >> 30) ? 0 : in;
+		out = get32(p + 24);
+		out = (out >> 30) ? 0 : out;
+		count = get32(p + 28);
+		p += SFLOW_FLOW_SAMPLE_LEN;
+		len -= SFLOW_FLOW_SAMPLE_LEN;
+	}
+
+	flow.in_if = in;
+	flow.out_if = out;
+
+	for (uint32_t i = 0; i < count && len >= 8; ++i) {
+		uint32_t type = get32(p);
+		uint32_t rec_len = get32(p + 4);
+
+		if (rec_len > len - 8) {
+			break;
+		}
+
+		decode_flow_record(&flow, type, p + 8, rec_len);
+
+		rec_len = (rec_len + 3) & ~3u;
+		if (rec_len > len - 8) {
+			break;
+		}
+
+		p += 8 + rec_len;
+		len -= 8 + rec_len;
+	}
+
+	if (flow.ip_version == 0) {
+		return 0;
+	}
+
+	return write_flow(w, &flow, time_ms);
+}
+
+/**
+ * \brief Convert generic interface counters
+ *
+ * \return 0 on success, 1 if the buffer is full
+ */
+static int write_counters(struct writer *w, const uint8_t *c, uint64_t time_ms)
+{
+	uint8_t *p = writer_record(w, SFLOW_IPFIX_COUNTERS_TEMPLATE, COUNTERS_RECORD_LEN);
+	if (p == NULL) {
+		return 1;
+	}
+
+	/* Layout of the record follows the sFlow structure, 88 bytes */
+	memcpy(p, c, SFLOW_COUNTERS_GENERIC_LEN);
+	put64(p + SFLOW_COUNTERS_GENERIC_LEN, time_ms);
+
+	return 0;
+}
+
+/**
+ * \brief Convert counter sample
+ *
+ * \return 0 on success, 1 if the buffer is full
+ */
+static int convert_counters_sample(struct writer *w, int expanded, const uint8_t *p, size_t len,
+		uint64_t time_ms)
+{
+	size_t hdr_len = expanded ? SFLOW_COUNTERS_SAMPLE_EXPANDED_LEN : SFLOW_COUNTERS_SAMPLE_LEN;
+	if (len < hdr_len) {
+		return 0;
+	}
+
+	uint32_t count = get32(p + hdr_len - 4);
+	p += hdr_len;
+	len -= hdr_len;
+
+	for (uint32_t i = 0; i < count && len >= 8; ++i) {
+		uint32_t type = get32(p);
+		uint32_t rec_len = get32(p + 4);
+
+		if (rec_len > len - 8) {
+			break;
+		}
+
+		if (type == SFLOW_COUNTERS_GENERIC && rec_len >= SFLOW_COUNTERS_GENERIC_LEN) {
+			if (write_counters(w, p + 8, time_ms)) {
+				return 1;
+			}
+		}
+
+		rec_len = (rec_len + 3) & ~3u;
+		if (rec_len > len - 8) {
+			break;
+		}
+
+		p += 8 + rec_len;
+		len -= 8 + rec_len;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Convert sFlow v5 datagram to IPFIX message
+ */
+int sflow_to_ipfix(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max,
+		struct sflow_ipfix_params *params)
+{
+	params->records = 0;
+
+	if (in_len < 8 || get32(in) != SFLOW_VERSION) {
+		return SFLOW_IPFIX_UNSUPPORTED;
+	}
+
+	/* Agent address */
+	size_t addr_len = address_len(in + 4, in_len - 4);
+	if (addr_len <= 4 || in_len < 4 + addr_len + 16) {
+		return CONVERSION_ERROR;
+	}
+
+	const uint8_t *p = in + 4 + addr_len;
+	uint32_t sub_agent = get32(p);
+	uint32_t samples = get32(p + 12);
+	p += 16;
+
+	size_t len = in_len - (p - in);
+	uint64_t time_ms = (uint64_t) params->export_time * 1000;
+
+	if (out_max > UINT16_MAX) {
+		out_max = UINT16_MAX;
+	}
+
+	if (out_max < IPFIX_HEADER_LENGTH) {
+		return CONVERSION_ERROR;
+	}
+
+	struct writer w = {out + IPFIX_HEADER_LENGTH, out + out_max, NULL, 0, 0};
+
+	if (params->with_templates && write_templates(&w)) {
+		return CONVERSION_ERROR;
+	}
+
+	for (uint32_t i = 0; i < samples && len >= 8; ++i) {
+		uint32_t type = get32(p);
+		uint32_t sample_len = get32(p + 4);
+
+		if (sample_len > len - 8) {
+			MSG_DEBUG(msg_module, "Truncated sample in datagram from sub-agent %u", sub_agent);
+			break;
+		}
+
+		int full = 0;
+		switch (type) {
+		case SFLOW_FLOW_SAMPLE:
+		case SFLOW_FLOW_SAMPLE_EXPANDED:
+			full = convert_flow_sample(&w, type == SFLOW_FLOW_SAMPLE_EXPANDED,
+					p + 8, sample_len, time_ms);
+			break;
+		case SFLOW_COUNTERS_SAMPLE:
+		case SFLOW_COUNTERS_SAMPLE_EXPANDED:
+			full = convert_counters_sample(&w, type == SFLOW_COUNTERS_SAMPLE_EXPANDED,
+					p + 8, sample_len, time_ms);
+			break;
+		default:
+			break;
+		}
+
+		if (full) {
+			MSG_DEBUG(msg_module, "Output buffer is full, %u samples dropped", samples - i);
+			break;
+		}
+
+		sample_len = (sample_len + 3) & ~3u;
+		if (sample_len > len - 8) {
+			break;
+		}
+
+		p += 8 + sample_len;
+		len -= 8 + sample_len;
+	}
+
+	writer_close_set(&w);
+
+	/* Message header */
+	uint16_t total = (uint16_t) (w.pos - out);
+	struct ipfix_header *header = (struct ipfix_header *) out;
+	header->version = htons(IPFIX_VERSION);
+	header->length = htons(total);
+	header->export_time = htonl(params->export_time);
+	header->sequence_number = htonl(params->sequence_number);
+	header->observation_domain_id = htonl(sub_agent);
+
+	params->records = w.records;
+	return total;
+}
@@ -0,0 +1,88 @@
+/**
+ * \file sflow_ipfix.h
+ * \brief Direct conversion of sFlow v5 datagrams to IPFIX messages
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef SFLOW_IPFIX_H
+#define SFLOW_IPFIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Datagram is not sFlow version 5 */
+#define SFLOW_IPFIX_UNSUPPORTED -2
+
+/** Template IDs of converted records */
+#define SFLOW_IPFIX_FLOW4_TEMPLATE    256
+#define SFLOW_IPFIX_FLOW6_TEMPLATE    257
+#define SFLOW_IPFIX_COUNTERS_TEMPLATE 258
+
+/** Private Enterprise Number of InMon Corp. (sFlow counters) */
+#define SFLOW_IPFIX_ENTERPRISE 4300
+
+/**
+ * \brief Parameters and results of one conversion
+ */
+struct sflow_ipfix_params {
+	uint32_t export_time;     /**< Export time of the IPFIX message (seconds) */
+	uint32_t sequence_number; /**< Sequence number of the IPFIX message */
+	int with_templates;       /**< Insert Template Set before data */
+	uint32_t records;         /**< [out] Number of converted Data Records */
+};
+
+/**
+ * \brief Convert sFlow v5 datagram to IPFIX message
+ *
+ * Flow samples are converted to IPv4 or IPv6 flow records, generic interface
+ * counter samples to counter records. Everything is decoded in a single pass
+ * and written straight into the output buffer, other sample and record types
+ * are skipped.
+ *
+ * The function keeps no state, so it can be used for any number of sources
+ * and threads at once. Input and output buffers must not overlap.
+ *
+ * \param[in] in sFlow datagram
+ * \param[in] in_len Length of the datagram
+ * \param[out] out Output buffer for the IPFIX message
+ * \param[in] out_max Size of the output buffer
+ * \param[in,out] params Conversion parameters
+ * \return Length of the IPFIX message, SFLOW_IPFIX_UNSUPPORTED for other
+ * sFlow versions or CONVERSION_ERROR for malformed datagrams
+ */
+int sflow_to_ipfix(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_max,
+		struct sflow_ipfix_params *params);
+
+#endif /* SFLOW_IPFIX_H */
@@ -56,6 +56,8 @@
 
 /** Default number of preallocated elements in auxiliary structures */
 #define ELEM_DEF_COUNT (32)
+/** Max. number of displacements tried per bucket before the table grows */
+#define ELEM_HASH_TRIES (1U << 16)
 
 /** Default XPath expression for elements in XML file (ipfix-elements.xml) */
 #define ELEM_XML_XPATH "/ipfix-elements/element"
@@ -324,6 +326,234 @@ static bool elem_duplication_check(const struct elem_groups *groups)
 	return duplicity;
 }
 
+/**
+ * \brief Element prepared for insertion into the perfect hash table
+ */
+struct elem_hash_item {
+	uint64_t key;                  /**< Key of the element                    */
+	uint64_t bucket;               /**< Bucket of the key                     */
+	const ipfix_element_t *elem;   /**< Element                               */
+};
+
+/**
+ * \brief Bucket of keys (range in the sorted array of items)
+ */
+struct elem_hash_bucket {
+	unsigned int start;            /**< Index of the first item               */
+	unsigned int count;            /**< Number of items                       */
+};
+
+/**
+ * \brief Comparsion function for items (by bucket)
+ */
+static int cmp_hash_items(const void *i1, const void *i2)
+{
+	const struct elem_hash_item *item1 = i1;
+	const struct elem_hash_item *item2 = i2;
+
+	if (item1->bucket == item2->bucket) {
+		return 0;
+	}
+
+	return (item1->bucket < item2->bucket) ? -1 : 1;
+}
+
+/**
+ * \brief Comparsion function for buckets (the largest first)
+ */
+static int cmp_hash_buckets(const void *b1, const void *b2)
+{
+	const struct elem_hash_bucket *bucket1 = b1;
+	const struct elem_hash_bucket *bucket2 = b2;
+
+	if (bucket1->count == bucket2->count) {
+		return 0;
+	}
+
+	return (bucket1->count > bucket2->count) ? -1 : 1;
+}
+
+/**
+ * \brief Get the smallest power of two greater or equal to \p value
+ */
+static uint64_t elem_pow2(uint64_t value)
+{
+	uint64_t result = 1;
+	while (result < value) {
+		result <<= 1;
+	}
+
+	return result;
+}
+
+/**
+ * \brief Try to place all keys of the buckets into the perfect hash table
+ *
+ * Buckets are processed from the largest one. For each bucket, the first
+ * displacement that maps all its keys to empty slots is used.
+ * \param[in,out] hash    Lookup table (slots and displacements allocated)
+ * \param[in]     items   Items sorted by bucket
+ * \param[in]     buckets Buckets sorted by size
+ * \param[in]     count   Number of buckets
+ * \return 0 on success. Otherwise (some displacement not found) returns
+ * non-zero value.
+ */
+static int elem_hash_place(struct elem_hash *hash,
+	const struct elem_hash_item *items, const struct elem_hash_bucket *buckets,
+	unsigned int count)
+{
+	for (unsigned int i = 0; i < count && buckets[i].count > 0; ++i) {
+		const struct elem_hash_item *first = &items[buckets[i].start];
+		uint32_t disp;
+		unsigned int placed = 0;
+
+		for (disp = 1; disp < ELEM_HASH_TRIES; ++disp) {
+			for (placed = 0; placed < buckets[i].count; ++placed) {
+				struct elem_hash_slot *slot = &hash->slots[
+					elem_hash_mix(first[placed].key, disp) & hash->slot_mask];
+				if (slot->key != 0) {
+					break;
+				}
+
+				slot->key = first[placed].key;
+				slot->elem = first[placed].elem;
+			}
+
+			if (placed == buckets[i].count) {
+				break;
+			}
+
+			// Collision -> remove keys placed with this displacement
+			while (placed-- > 0) {
+				hash->slots[elem_hash_mix(first[placed].key, disp)
+					& hash->slot_mask].key = 0;
+			}
+		}
+
+		if (disp == ELEM_HASH_TRIES) {
+			return 1;
+		}
+
+		hash->disp[first->bucket] = disp;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Make a lookup table of elements by Element ID and Enterprise ID
+ *
+ * \warning Groups of elements must be sorted by elem_sort() and checked for
+ *   duplicities first.
+ * \param[in,out] groups Structure with groups of IPFIX elements.
+ * \return 0 on success. Otherwiser returns non-zero value.
+ */
+static int elem_make_hash(struct elem_groups *groups)
+{
+	struct elem_hash *hash = &groups->hash;
+	unsigned int count = 0;
+
+	// Direct index of IANA elements and a count of enterprise elements
+	for (unsigned int i = 0; i < groups->elem_used; ++i) {
+		const struct elem_en_group *aux_grp = groups->groups[i];
+		if (aux_grp->en_id != 0) {
+			count += aux_grp->elem_used;
+			continue;
+		}
+
+		if (aux_grp->elem_used == 0) {
+			continue;
+		}
+
+		hash->iana_size = aux_grp->elements[aux_grp->elem_used - 1]->id + 1U;
+		hash->iana = calloc(hash->iana_size, sizeof(*hash->iana));
+		if (!hash->iana) {
+			MSG_ERROR(msg_module, "CALLOC FAILED! (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		for (unsigned int y = 0; y < aux_grp->elem_used; ++y) {
+			hash->iana[aux_grp->elements[y]->id] = aux_grp->elements[y];
+		}
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	// Split enterprise elements into buckets (2 keys per bucket on average)
+	const uint64_t bucket_cnt = elem_pow2((count + 1) / 2);
+	struct elem_hash_item *items = calloc(count, sizeof(*items));
+	struct elem_hash_bucket *buckets = calloc(bucket_cnt, sizeof(*buckets));
+	if (!items || !buckets) {
+		MSG_ERROR(msg_module, "CALLOC FAILED! (%s:%d)", __FILE__, __LINE__);
+		free(items);
+		free(buckets);
+		return 1;
+	}
+
+	hash->bucket_mask = bucket_cnt - 1;
+	for (unsigned int index = 0, i = 0; i < groups->elem_used; ++i) {
+		const struct elem_en_group *aux_grp = groups->groups[i];
+		if (aux_grp->en_id == 0) {
+			continue;
+		}
+
+		for (unsigned int y = 0; y < aux_grp->elem_used; ++y) {
+			const ipfix_element_t *elem = aux_grp->elements[y];
+			struct elem_hash_item *item = &items[index++];
+
+			item->key = ELEM_HASH_KEY(elem->id, elem->en);
+			item->bucket = elem_hash_mix(item->key, 0) & hash->bucket_mask;
+			item->elem = elem;
+		}
+	}
+
+	qsort(items, count, sizeof(*items), cmp_hash_items);
+	for (unsigned int i = 0; i < count; ++i) {
+		struct elem_hash_bucket *bucket = &buckets[items[i].bucket];
+		if (bucket->count++ == 0) {
+			bucket->start = i;
+		}
+	}
+
+	qsort(buckets, bucket_cnt, sizeof(*buckets), cmp_hash_buckets);
+
+	// Find displacements, grow the table if it is too crowded
+	int ret = 1;
+	for (uint64_t slot_cnt = elem_pow2(count); slot_cnt <= 16 * elem_pow2(count);
+			slot_cnt *= 2) {
+		hash->slot_mask = slot_cnt - 1;
+		hash->slots = calloc(slot_cnt, sizeof(*hash->slots));
+		hash->disp = calloc(bucket_cnt, sizeof(*hash->disp));
+		if (!hash->slots || !hash->disp) {
+			MSG_ERROR(msg_module, "CALLOC FAILED! (%s:%d)", __FILE__, __LINE__);
+			break;
+		}
+
+		if (elem_hash_place(hash, items, buckets, bucket_cnt) == 0) {
+			ret = 0;
+			break;
+		}
+
+		free(hash->slots);
+		free(hash->disp);
+		hash->slots = NULL;
+		hash->disp = NULL;
+	}
+
+	if (ret != 0) {
+		free(hash->slots);
+		free(hash->disp);
+		hash->slots = NULL;
+		hash->disp = NULL;
+	}
+
+	free(items);
+	free(buckets);
+	return ret;
+}
+
 /**
  * \brief Make indexes of elements' names
  * 
@@ -554,6 +784,12 @@ int elements_load(int file_descriptor, struct elem_groups *ipfix_groups)
 		// Duplication found
 		return 1;
 	}
+
+	if (elem_make_hash(ipfix_groups)) {
+		MSG_ERROR(msg_module, "Failed to build a lookup table of IPFIX "
+			"elements.");
+		return 1;
+	}
 	
 	// All elements successfully loaded
 	MSG_INFO(msg_module, "Description of %u IPFIX elements loaded.", count);
@@ -587,6 +823,9 @@ void elements_destroy(struct elem_groups *ipfix_groups)
 	
 	free(ipfix_groups->groups);
 	free(ipfix_groups->name_index);
+	free(ipfix_groups->hash.iana);
+	free(ipfix_groups->hash.disp);
+	free(ipfix_groups->hash.slots);
 	free(ipfix_groups);
 }
 
@@ -57,6 +57,35 @@ struct elem_en_group {
 	ipfix_element_t **name_index;  /**< Same as "elements" but sorted by name */
 };
 
+/** Key of an element in the lookup table                                  */
+#define ELEM_HASH_KEY(_id_, _en_) (((uint64_t) (_en_) << 16) | (uint16_t) (_id_))
+
+/**
+ * \brief Slot of the perfect hash table
+ */
+struct elem_hash_slot {
+	uint64_t key;                  /**< Key (0 = empty slot)                  */
+	const ipfix_element_t *elem;   /**< Element                               */
+};
+
+/**
+ * \brief Lookup table of elements by Element ID and Enterprise ID
+ *
+ * IANA elements are directly indexed by their ID. Enterprise elements are
+ * stored in a perfect hash table ("hash and displace"): a key is first hashed
+ * to a bucket and the displacement of the bucket selects a hash function,
+ * which maps all keys of the bucket to distinct slots. Any lookup touches at
+ * most one displacement and one slot.
+ */
+struct elem_hash {
+	const ipfix_element_t **iana;  /**< IANA elements indexed by ID           */
+	unsigned int iana_size;        /**< Size of the IANA array                */
+	uint32_t *disp;                /**< Displacements of buckets              */
+	uint64_t bucket_mask;          /**< Number of buckets - 1                 */
+	struct elem_hash_slot *slots;  /**< Slots of the perfect hash table       */
+	uint64_t slot_mask;            /**< Number of slots - 1                   */
+};
+
 /**
  * \brief Structure for handling groups of IPFIX elements
  */
@@ -68,6 +97,8 @@ struct elem_groups {
 	// Do not free content of the array below!
 	ipfix_element_t **name_index;  /**< Array of all elements sorted by name  */
 	unsigned int name_count;       /**< Size of the array sorted by name      */
+
+	struct elem_hash hash;         /**< Lookup table by IDs                   */
 };
 
 // Create structures for elements
@@ -80,6 +111,47 @@ int elements_load(int file_descriptor, struct elem_groups *ipfix_groups);
 void elements_destroy(struct elem_groups *ipfix_groups);
 
 
+/**
+ * \brief Hash function of the lookup table
+ * \param[in] key  Key (see #ELEM_HASH_KEY)
+ * \param[in] seed Seed (displacement)
+ */
+static inline uint64_t elem_hash_mix(uint64_t key, uint64_t seed)
+{
+	key ^= seed * 0x9E3779B97F4A7C15ULL;
+	key ^= key >> 33;
+	key *= 0xFF51AFD7ED558CCDULL;
+	key ^= key >> 33;
+	key *= 0xC4CEB9FE1A85EC53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/**
+ * \brief Find an element in the lookup table
+ * \param[in] hash Lookup table
+ * \param[in] id   Element ID
+ * \param[in] en   Enterprise ID
+ * \return Pointer to the element or NULL.
+ */
+static inline const ipfix_element_t *elem_hash_find(const struct elem_hash *hash,
+	uint16_t id, uint32_t en)
+{
+	if (en == 0) {
+		return (id < hash->iana_size) ? hash->iana[id] : NULL;
+	}
+
+	if (!hash->slots) {
+		return NULL;
+	}
+
+	const uint64_t key = ELEM_HASH_KEY(id, en);
+	const uint32_t disp = hash->disp[elem_hash_mix(key, 0) & hash->bucket_mask];
+	const struct elem_hash_slot *slot =
+		&hash->slots[elem_hash_mix(key, disp) & hash->slot_mask];
+	return (slot->key == key) ? slot->elem : NULL;
+}
+
 // Comparsion function for groups of elements
 int cmp_groups(const void *g1, const void *g2);
 
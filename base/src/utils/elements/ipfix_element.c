@@ -37,7 +37,7 @@
  *
  */
 
-#include <stdlib.h> // bsearch
+#include <stdlib.h> // bsearch (by name)
 #include <string.h> // strchr
 
 #include <ipfixcol.h>
@@ -91,30 +91,14 @@ static const struct elem_en_group *get_en_group_by_id(uint32_t en)
  */
 const ipfix_element_t *get_element_by_id(uint16_t id, uint32_t en)
 {
-	// Find the group
-	const struct elem_en_group *group = get_en_group_by_id(en);
-	if (!group) {
-		// Group not found
-		return NULL;
-	}
-	
-	// Find the element
-	ipfix_element_t el_key;
-	const ipfix_element_t *el_key_p;
-	const ipfix_element_t **elem_pp;
-	
-	el_key.id = id;
-	el_key_p = &el_key;
-	
-	elem_pp = bsearch(&el_key_p, group->elements, group->elem_used,
-		sizeof(ipfix_element_t *), cmp_elem_by_id);
-	if (!elem_pp) {
-		// Element not found in the group
+	// Get a pointer to the main structure
+	const struct elem_groups *groups = elem_coll_get();
+	if (!groups) {
+		// Not initialized
 		return NULL;
 	}
-	
-	// Suceess
-	return *elem_pp;
+
+	return elem_hash_find(&groups->hash, id, en);
 }
 
 /**
@@ -49,6 +49,7 @@
 #include <sys/ioctl.h>
 #include <linux/sockios.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <siso.h>
 
@@ -79,7 +80,28 @@ do { \
 	} \
 } while (0)
 
-static int stop = 0;
+static volatile sig_atomic_t stop = 0;
+
+/**
+ * \brief Sending parameters common for all destinations
+ */
+struct send_params {
+	int     loops;       /**< How many times the file should be sent         */
+	double  realtime_s;  /**< Real-time speed-up (0 = disabled)              */
+};
+
+/**
+ * \brief Destination (one sending thread)
+ */
+struct destination {
+	const char *ip;                   /**< Destination address               */
+	const char *port;                 /**< Destination port                  */
+	sisoconf   *sender;               /**< Connection                        */
+	reader_t   *reader;               /**< Input file                        */
+	const struct send_params *params; /**< Sending parameters                */
+	pthread_t   thread;               /**< Sending thread                    */
+	bool        running;              /**< The thread has been started       */
+};
 
 /**
  * \brief Print usage
@@ -91,7 +113,9 @@ void usage()
 	printf("  -h         Show this help\n");
 	printf("  -i path    IPFIX input file\n");
 	printf("  -d ip      Destination IP address (default: %s)\n", DEFAULT_IP);
+	printf("             Comma separated list for multiple destinations\n");
 	printf("  -p port    Destination port number (default: %s)\n", DEFAULT_PORT);
+	printf("             Comma separated list for multiple destinations\n");
 	printf("  -t type    Connection type (UDP, TCP or SCTP) (default: UDP)\n");
 	printf("  -c         Precache input file (for performance tests)\n");
 	printf("  -n num     How many times the file should be sent (default: infinity)\n");
@@ -101,6 +125,9 @@ void usage()
 	printf("  -R num     Real-time sending\n");
 	printf("             Allow speed-up sending 'num' times (realtime: 1.0)\n");
 	printf("\n");
+	printf("The file is sent to every combination of the addresses and ports\n");
+	printf("concurrently. Speed limits apply to each destination separately.\n");
+	printf("\n");
 }
 
 void handler(int signal)
@@ -110,6 +137,94 @@ void handler(int signal)
 	stop = 1;
 }
 
+/**
+ * \brief Split a comma separated list
+ *
+ * The \p list is modified (commas are replaced by terminating characters).
+ * \param[in,out] list  List of items
+ * \param[out]    cnt   Number of items
+ * \return On success returns a new array of pointers to the items. Otherwise
+ *   returns NULL.
+ */
+static char **
+split_list(char *list, size_t *cnt)
+{
+	size_t max = 1;
+	for (const char *ptr = list; *ptr != '\0'; ++ptr) {
+		if (*ptr == ',') {
+			++max;
+		}
+	}
+
+	char **items = calloc(max, sizeof(*items));
+	if (!items) {
+		ERR_MEM;
+		return NULL;
+	}
+
+	char *save_ptr = NULL;
+	char *item;
+	*cnt = 0;
+	for (item = strtok_r(list, ",", &save_ptr); item != NULL;
+			item = strtok_r(NULL, ",", &save_ptr)) {
+		items[(*cnt)++] = item;
+	}
+
+	if (*cnt == 0) {
+		free(items);
+		return NULL;
+	}
+
+	return items;
+}
+
+/**
+ * \brief Send the file to one destination
+ * \param[in] arg Destination
+ * \return NULL
+ */
+static void *
+destination_thread(void *arg)
+{
+	struct destination *dst = (struct destination *) arg;
+	const struct send_params *params = dst->params;
+	int i, ret;
+
+	/* Send packets */
+	for (i = 0; !stop && (params->loops == INFINITY_LOOPS || i < params->loops); ++i) {
+		reader_rewind(dst->reader);
+		if (params->realtime_s > 0.0) {
+			// Real-time sending
+			ret = send_packets_realtime(dst->sender, dst->reader,
+				params->realtime_s);
+		} else {
+			// Speed limitation sending
+			ret = send_packets_limit(dst->sender, dst->reader);
+		}
+
+		if (ret != 0) {
+			// Error
+			fprintf(stderr, "Sending to %s:%s failed.\n", dst->ip, dst->port);
+			break;
+		}
+	}
+
+	/* Make sure that all packets are delivered before socket closes */
+	int socket_fd = siso_get_socket(dst->sender);
+	int not_sent = 0;
+	while (!stop && ioctl(socket_fd, SIOCOUTQ, &not_sent) != -1) {
+		if (not_sent <= 0) {
+			break;
+		}
+
+		/* Wait */
+		struct timespec sleep_time = {0, FLUSHER_TIME};
+		nanosleep(&sleep_time, NULL);
+	}
+
+	return NULL;
+}
+
 /**
  * \brief Main function
  */
@@ -121,10 +236,9 @@ int main(int argc, char** argv)
 
 	char   *input = NULL;
 	char   *speed = NULL;
-	int     loops =   INFINITY_LOOPS;
 	int     packets_s = 0;
-	double  realtime_s = 0.0;
 	bool    precache = false;
+	struct send_params params = {INFINITY_LOOPS, 0.0};
 
 	if (argc == 1) {
 		usage();
@@ -154,7 +268,7 @@ int main(int argc, char** argv)
 			precache = true;
 			break;
 		case 'n':
-			loops = atoi(optarg);
+			params.loops = atoi(optarg);
 			break;
 		case 's':
 			speed = optarg;
@@ -163,7 +277,7 @@ int main(int argc, char** argv)
 			packets_s = atoi(optarg);
 			break;
 		case 'R':
-			realtime_s = atof(optarg);
+			params.realtime_s = atof(optarg);
 			break;
 		default:
 			fprintf(stderr, "Unknown option.\n");
@@ -172,7 +286,7 @@ int main(int argc, char** argv)
 	}
 
 	/* Parameters check */
-	if (loops < 0 && loops != INFINITY_LOOPS) {
+	if (params.loops < 0 && params.loops != INFINITY_LOOPS) {
 		fprintf(stderr, "Invalid value of replay loops\n");
 		return 1;
 	}
@@ -182,12 +296,12 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	if (realtime_s < 0.0) {
+	if (params.realtime_s < 0.0) {
 		fprintf(stderr, "Invalid value of the real-time sending.\n");
 		return 1;
 	}
 
-	if ((speed != NULL || packets_s != 0) && realtime_s > 0) {
+	if ((speed != NULL || packets_s != 0) && params.realtime_s > 0) {
 		fprintf(stderr, "Combination of real-time sending and speed limitation "
 			"is not permitted.\n");
 		return 1;
@@ -195,70 +309,101 @@ int main(int argc, char** argv)
 
 	/* Check whether everything is set */
 	CHECK_SET(input, "Input file");
-	signal(SIGINT, handler);
 
-	/* Get collector's address */
-	sisoconf *sender = siso_create();
-	if (!sender) {
-		fprintf(stderr, "Memory allocation error\n");
+	/* Prepare destinations (every combination of addresses and ports) */
+	size_t ip_cnt, port_cnt;
+	char **ips = split_list(ip, &ip_cnt);
+	char **ports = split_list(port, &port_cnt);
+	if (!ips || !ports) {
+		fprintf(stderr, "Invalid destination address or port.\n");
+		free(ips);
+		free(ports);
 		return 1;
 	}
 
-	/* Prepare an input file */
-	reader_t *reader = reader_create(input, precache);
-	if (!reader) {
-		siso_destroy(sender);
+	size_t dst_cnt = ip_cnt * port_cnt;
+	struct destination *dsts = calloc(dst_cnt, sizeof(*dsts));
+	if (!dsts) {
+		ERR_MEM;
+		free(ips);
+		free(ports);
 		return 1;
 	}
 
-	/* Create connection */
-	int ret = siso_create_connection(sender, ip, port, type);
-	if (ret != SISO_OK) {
-		fprintf(stderr, "Network error: %s\n", siso_get_last_err(sender));
-		siso_destroy(sender);
-		reader_destroy(reader);
-		return 1;
-	}
+	int ret = 0;
+	size_t i;
+	for (i = 0; i < dst_cnt; ++i) {
+		struct destination *dst = &dsts[i];
+		dst->ip = ips[i / port_cnt];
+		dst->port = ports[i % port_cnt];
+		dst->params = &params;
 
-	/* Set max. speed */
-	if (speed) {
-		siso_set_speed_str(sender, speed);
-	}
+		/* Get collector's address */
+		dst->sender = siso_create();
+		if (!dst->sender) {
+			fprintf(stderr, "Memory allocation error\n");
+			ret = 1;
+			break;
+		}
 
-	/* Send packets */
-	int i;
-	for (i = 0; !stop && (loops == INFINITY_LOOPS || i < loops); ++i) {
-		reader_rewind(reader);
-		if (realtime_s > 0.0) {
-			// Real-time sending
-			ret = send_packets_realtime(sender, reader, realtime_s);
+		/* Prepare an input file (preloaded packets are shared) */
+		if (i > 0 && precache) {
+			dst->reader = reader_clone(dsts[0].reader);
 		} else {
-			// Speed limitation sending
-			ret = send_packets_limit(sender, reader, packets_s);
+			dst->reader = reader_create(input, precache);
 		}
 
-		if (ret != 0) {
-			// Error
+		if (!dst->reader) {
+			ret = 1;
 			break;
 		}
+
+		/* Create connection */
+		if (siso_create_connection(dst->sender, dst->ip, dst->port, type)
+				!= SISO_OK) {
+			fprintf(stderr, "Network error (%s:%s): %s\n", dst->ip, dst->port,
+				siso_get_last_err(dst->sender));
+			ret = 1;
+			break;
+		}
+
+		/* Set max. speed */
+		if (speed) {
+			siso_set_speed_str(dst->sender, speed);
+		}
+
+		siso_set_packet_rate(dst->sender, packets_s);
 	}
 
-	/* Free resources */
-	reader_destroy(reader);
+	signal(SIGINT, handler);
 
-	/* Make sure that all packets are delivered before socket closes */
-	int socket_fd = siso_get_socket(sender);
-	int not_sent = 0;
-	while (!stop && ioctl(socket_fd, SIOCOUTQ, &not_sent) != -1) {
-		if (not_sent <= 0) {
+	/* Send packets */
+	for (i = 0; ret == 0 && i < dst_cnt; ++i) {
+		if (pthread_create(&dsts[i].thread, NULL, destination_thread,
+				&dsts[i]) != 0) {
+			fprintf(stderr, "Unable to start a sending thread.\n");
+			sender_stop();
+			stop = 1;
 			break;
 		}
 
-		/* Wait */
-		struct timespec sleep_time = {0, FLUSHER_TIME};
-		nanosleep(&sleep_time, NULL);
+		dsts[i].running = true;
+	}
+
+	/* Free resources (clones of the reader must be destroyed first) */
+	for (i = dst_cnt; i-- > 0; ) {
+		if (dsts[i].running) {
+			pthread_join(dsts[i].thread, NULL);
+		}
+
+		reader_destroy(dsts[i].reader);
+		if (dsts[i].sender) {
+			siso_destroy(dsts[i].sender);
+		}
 	}
 
-	siso_destroy(sender);
-	return 0;
+	free(dsts);
+	free(ips);
+	free(ports);
+	return ret;
 }
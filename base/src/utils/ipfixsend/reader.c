@@ -59,6 +59,7 @@ struct reader_internal {
 	FILE *file;          /**< Input file                                     */
 	size_t next_id;      /**< Index of next packet                           */
 	bool is_preloaded;   /**< Is the whole file preloaded                    */
+	bool is_clone;       /**< Preloaded packets belong to another reader     */
 
 	struct ipfix_header **packets_preload;   /**< Preloaded packets          */
 	uint8_t packet_single[MAX_PACKET_SIZE];  /**< Internal buffer            */
@@ -113,6 +114,27 @@ reader_create(const char *file, bool preload)
 }
 
 
+// Create a new packet reader sharing preloaded packets
+reader_t *
+reader_clone(const reader_t *reader)
+{
+	if (!reader->is_preloaded) {
+		fprintf(stderr, "Only a preloaded reader can be cloned.\n");
+		return NULL;
+	}
+
+	reader_t *new_reader = calloc(1, sizeof(*new_reader));
+	if (!new_reader) {
+		ERR_MEM;
+		return NULL;
+	}
+
+	new_reader->is_preloaded = true;
+	new_reader->is_clone = true;
+	new_reader->packets_preload = reader->packets_preload;
+	return new_reader;
+}
+
 // Destroy a packet reader
 void
 reader_destroy(reader_t *reader)
@@ -121,7 +143,7 @@ reader_destroy(reader_t *reader)
 		return;
 	}
 
-	if (reader->is_preloaded) {
+	if (reader->is_preloaded && !reader->is_clone) {
 		reader_free_preloaded_packets(reader->packets_preload);
 	}
 
@@ -351,6 +373,13 @@ reader_free_preloaded_packets(struct ipfix_header **packets)
 }
 
 
+// Is the whole file preloaded
+bool
+reader_is_preloaded(const reader_t *reader)
+{
+	return reader->is_preloaded;
+}
+
 // Rewind file (go to the beginning of a file)
 void
 reader_rewind(reader_t *reader)
@@ -66,6 +66,18 @@ typedef struct reader_internal reader_t;
 reader_t *
 reader_create(const char *file, bool preload);
 
+/**
+ * \brief Create a new packet reader sharing preloaded packets of another one
+ *
+ * The new reader has its own position in the file. The original reader MUST
+ * be destroyed after all its clones.
+ * \param[in] reader  Pointer to the preloaded packet reader
+ * \return On success returns a new pointer to instance of the reader. Otherwise
+ *   (the reader is not preloaded, memory allocation error) returns NULL.
+ */
+reader_t *
+reader_clone(const reader_t *reader);
+
 /**
  * \brief Destroy a packet reader
  * \param[in] reader   Pointer to the packet reader
@@ -73,6 +85,17 @@ reader_create(const char *file, bool preload);
 void
 reader_destroy(reader_t *reader);
 
+/**
+ * \brief Check whether the whole file is preloaded
+ *
+ * Packets returned by a preloaded reader stay valid until the reader is
+ * destroyed, i.e. they are not overwritten by reading of next packets.
+ * \param[in] reader Pointer to the packet reader
+ * \return True or false
+ */
+bool
+reader_is_preloaded(const reader_t *reader);
+
 /**
  * \brief Rewind file (go to the beginning of a file)
  * \param[in] reader Pointer to the packet reader
@@ -39,6 +39,7 @@
  */
 
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <netdb.h>
@@ -47,6 +48,7 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #include <sys/time.h>
@@ -68,8 +70,12 @@
 // 1 second in nanoseconds
 #define NANO_SEC 1000000000L
 
-static int stop_sending = 0;
-static struct timeval begin = {0};
+// Max. number of packets passed to the sender at once
+#define BATCH_MAX 32
+// Size of the buffer for batched packets of a non-preloaded file
+#define BATCH_BUFFER (4 * 65536)
+
+static volatile sig_atomic_t stop_sending = 0;
 
 void sender_stop()
 {
@@ -97,77 +103,91 @@ long timeval_diff(const struct timeval *start, const struct timeval *end)
 		+ (end->tv_usec - start->tv_usec);
 }
 
+/**
+ * \brief Pass buffered packets to the sender
+ */
+static int send_batch(sisoconf *sender, const struct iovec *batch,
+	unsigned int cnt)
+{
+	if (siso_send_batch(sender, batch, cnt) != SISO_OK) {
+		fprintf(stderr, "Network error: %s\n", siso_get_last_err(sender));
+		return 1;
+	}
+
+	return 0;
+}
+
 /**
  * \brief Send all packets from array with speed limitation
  */
-int send_packets_limit(sisoconf *sender, reader_t *reader, int packets_s)
+int send_packets_limit(sisoconf *sender, reader_t *reader)
 {
 	enum READER_STATUS status;
 	struct ipfix_header *pkt_data;
-	struct timeval end;
-	struct timespec sleep_time = {0};
-
-	/* These must be static variables - local would be rewrited with each call
-	 * of send_packets */
-	static int pkts_from_begin = 0;
-	static double time_per_pkt = 0.0; // [ms]
-
-	if (begin.tv_sec == 0) {
-		/* Absolutely first packet */
-		gettimeofday(&begin, NULL);
-		time_per_pkt = 1000000.0 / packets_s; // [micro seconds]
+	uint16_t pkt_size;
+
+	struct iovec batch[BATCH_MAX];
+	unsigned int batch_cnt = 0;
+
+	/* Packets of a non-preloaded file are overwritten by the reader */
+	uint8_t *buffer = NULL;
+	size_t buffer_used = 0;
+	int ret = 0;
+
+	if (!reader_is_preloaded(reader)) {
+		buffer = malloc(BATCH_BUFFER);
+		if (!buffer) {
+			ERR_MEM;
+			return 1;
+		}
 	}
 
 	while (stop_sending == 0) {
-		status = reader_get_next_packet(reader, &pkt_data, NULL);
+		status = reader_get_next_packet(reader, &pkt_data, &pkt_size);
 		if (status == READER_EOF) {
 			break;
 		} else if (status == READER_ERROR) {
-			return 1;
+			ret = 1;
+			break;
 		}
 
-		/* send packet */
-		int ret = send_packet(sender, pkt_data);
-		if (ret != SISO_OK) {
-			fprintf(stderr, "Network error: %s\n", siso_get_last_err(sender));
-			return 1;
-		}
+		if (buffer) {
+			if (buffer_used + pkt_size > BATCH_BUFFER) {
+				ret = send_batch(sender, batch, batch_cnt);
+				if (ret != 0) {
+					break;
+				}
 
-		pkts_from_begin++;
-		if (packets_s <= 0) {
-			/* Limit for packets/s is not enabled */
-			continue;
-		}
+				batch_cnt = 0;
+				buffer_used = 0;
+			}
 
-		/* Calculate expected time of sending next packet */
-		gettimeofday(&end, NULL);
-		long elapsed = timeval_diff(&begin, &end);
-		if (elapsed < 0) {
-			/* Should be never negative. Just for sure... */
-			elapsed = pkts_from_begin * time_per_pkt;
+			memcpy(buffer + buffer_used, pkt_data, pkt_size);
+			pkt_data = (struct ipfix_header *) (buffer + buffer_used);
+			buffer_used += pkt_size;
 		}
 
-		long next_start = pkts_from_begin * time_per_pkt;
-		long diff = next_start - elapsed;
-
-		if (diff >= MICRO_SEC) {
-			diff = MICRO_SEC - 1;
+		batch[batch_cnt].iov_base = pkt_data;
+		batch[batch_cnt].iov_len = pkt_size;
+		if (++batch_cnt < BATCH_MAX) {
+			continue;
 		}
 
-		/* Sleep */
-		if (diff > 0) {
-			sleep_time.tv_nsec = diff * 1000L;
-			nanosleep(&sleep_time, NULL);
+		ret = send_batch(sender, batch, batch_cnt);
+		if (ret != 0) {
+			break;
 		}
 
-		if (pkts_from_begin >= packets_s) {
-			/* Restart counter */
-			gettimeofday(&begin, NULL);
-			pkts_from_begin = 0;
-		}
+		batch_cnt = 0;
+		buffer_used = 0;
 	};
 
-	return 0;
+	if (ret == 0 && stop_sending == 0) {
+		ret = send_batch(sender, batch, batch_cnt);
+	}
+
+	free(buffer);
+	return ret;
 }
 
 /**
@@ -46,13 +46,15 @@
 
 /**
  * \brief Send all packets from array with speed limitation
- * 
+ *
+ * Packets are passed to the sender in batches. Speed limits (bytes/s and
+ * packets/s) are configured on the sender (see siso_set_speed_str() and
+ * siso_set_packet_rate()).
  * \param[in] sender    sisoconf object
  * \param[in] reader    Input file
- * \param[in] packets_s packets/s limit
  * \return On succes returns 0. Otherwise returns nonzero value.
  */
-int send_packets_limit(sisoconf *sender, reader_t *reader, int packets_s);
+int send_packets_limit(sisoconf *sender, reader_t *reader);
 
 /**
  * \brief Send all packets from array with real-time simulation
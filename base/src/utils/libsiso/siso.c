@@ -37,6 +37,10 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sendmmsg() */
+#endif
+
 #include "siso.h"
 
 #include <stdbool.h>
@@ -48,8 +52,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
-#include <sys/time.h>
 #include <time.h>
 
 #include <fcntl.h>
@@ -64,6 +68,13 @@
 #define SISO_UDP_MAX 65000
 #define SISO_MIN(_frst_, _scnd_) ((_frst_) > (_scnd_) ? (_scnd_) : (_frst_))
 
+/** Max. number of messages passed to the kernel by one system call */
+#define SISO_BATCH_MAX 64
+/** Capacity of a token bucket (1/SISO_PACE_DIV of a second of traffic) */
+#define SISO_PACE_DIV 100
+/** 1 second in nanoseconds */
+#define SISO_NSEC 1000000000ULL
+
 /**
 * \brief Accepted connection types
 */
@@ -96,6 +107,19 @@ static const char *siso_sc_types[] = {
 	"UDP", "TCP", "SCTP"
 };
 
+/**
+ * \brief Token bucket for pacing of transfers
+ *
+ * Tokens are consumed without reading the clock as long as there are enough
+ * of them. The bucket is refilled (and the clock read) only when it runs dry.
+ * The balance can become negative; the debt is paid by sleeping.
+ */
+struct siso_bucket {
+	uint64_t rate;              /**< tokens per second (0 = unlimited) */
+	double tokens;              /**< available tokens */
+	uint64_t last;              /**< time of the last refill [ns] */
+};
+
 /**
  * \brief Main sisolib structure
  */
@@ -104,9 +128,8 @@ struct sisoconf_s {
 	enum siso_conn_type type;   /**< UDP/TCP/SCTP */
 	struct addrinfo *servinfo;  /**< server information */
 	int sockfd;                 /**< socket descriptor */
-	uint64_t max_speed;         /**< max sending speed */
-	uint64_t act_speed;         /**< actual speed */
-	struct timeval begin, end;  /**< start/end time for limited transfers */
+	struct siso_bucket bytes;   /**< speed limit (bytes/s) */
+	struct siso_bucket packets; /**< speed limit (packets/s) */
 };
 
 /**
@@ -159,12 +182,125 @@ enum siso_conn_type siso_decode_type(sisoconf *conf, const char *type)
 	return SISO_ERR;
 }
 
+/**
+ * \brief Get monotonic time in nanoseconds
+ */
+static uint64_t siso_time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * SISO_NSEC + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * \brief Set rate of a token bucket (0 = unlimited) and empty it
+ */
+static void siso_bucket_set(struct siso_bucket *bucket, uint64_t rate)
+{
+	bucket->rate = rate;
+	bucket->tokens = 0.0;
+	bucket->last = 0;
+}
+
+/**
+ * \brief Check if a token bucket can pay \p cnt tokens right now
+ */
+static inline bool siso_bucket_ready(const struct siso_bucket *bucket, uint64_t cnt)
+{
+	return bucket->rate == 0 || bucket->tokens >= (double) cnt;
+}
+
+/**
+ * \brief Add tokens earned since the last refill
+ */
+static void siso_bucket_refill(struct siso_bucket *bucket, uint64_t now)
+{
+	if (bucket->rate == 0) {
+		return;
+	}
+
+	double burst = (double) bucket->rate / SISO_PACE_DIV;
+	if (burst < 1.0) {
+		burst = 1.0;
+	}
+
+	if (bucket->last == 0) {
+		/* First transfer */
+		bucket->tokens = burst;
+	} else if (now > bucket->last) {
+		bucket->tokens += (double) (now - bucket->last) * bucket->rate / SISO_NSEC;
+		if (bucket->tokens > burst) {
+			bucket->tokens = burst;
+		}
+	}
+
+	bucket->last = now;
+}
+
+/**
+ * \brief Take tokens from a bucket
+ * \return Time to sleep until the debt is paid [ns]
+ */
+static uint64_t siso_bucket_take(struct siso_bucket *bucket, uint64_t cnt)
+{
+	if (bucket->rate == 0) {
+		return 0;
+	}
+
+	bucket->tokens -= (double) cnt;
+	if (bucket->tokens >= 0.0) {
+		return 0;
+	}
+
+	return (uint64_t) (-bucket->tokens * SISO_NSEC / bucket->rate);
+}
+
+/**
+ * \brief Check if data can be sent without waiting
+ */
+static inline bool siso_pace_ready(const sisoconf *conf, uint64_t bytes)
+{
+	return siso_bucket_ready(&conf->bytes, bytes)
+		&& siso_bucket_ready(&conf->packets, 1);
+}
+
+/**
+ * \brief Apply speed limits to one message
+ *
+ * The clock is read only when one of the buckets runs dry, i.e. at most
+ * SISO_PACE_DIV times per second regardless of the message rate.
+ */
+static void siso_pace(sisoconf *conf, uint64_t bytes)
+{
+	if (siso_pace_ready(conf, bytes)) {
+		siso_bucket_take(&conf->bytes, bytes);
+		siso_bucket_take(&conf->packets, 1);
+		return;
+	}
+
+	uint64_t now = siso_time_ns();
+	siso_bucket_refill(&conf->bytes, now);
+	siso_bucket_refill(&conf->packets, now);
+
+	uint64_t wait_bytes = siso_bucket_take(&conf->bytes, bytes);
+	uint64_t wait_pkts  = siso_bucket_take(&conf->packets, 1);
+	uint64_t wait = (wait_bytes > wait_pkts) ? wait_bytes : wait_pkts;
+	if (wait == 0) {
+		return;
+	}
+
+	struct timespec sleep_time;
+	sleep_time.tv_sec  = wait / SISO_NSEC;
+	sleep_time.tv_nsec = wait % SISO_NSEC;
+	while (nanosleep(&sleep_time, &sleep_time) == -1 && errno == EINTR);
+}
+
 /**
  * Getters
  */
 inline int siso_get_socket(sisoconf *conf)		{ return conf->sockfd; }
 inline int siso_get_conn_type(sisoconf *conf)   { return conf->type; }
-inline uint64_t siso_get_speed(sisoconf *conf)  { return conf->max_speed; }
+inline uint64_t siso_get_speed(sisoconf *conf)  { return conf->bytes.rate; }
 inline const char *siso_get_last_err(sisoconf *conf){ return conf->last_error; }
 
 // Check if a destination is connected
@@ -178,7 +314,8 @@ int siso_is_connected(const sisoconf *conf)
  */
 void siso_unlimit_speed(sisoconf* conf)
 {
-	conf->max_speed = 0;
+	siso_bucket_set(&conf->bytes, 0);
+	siso_bucket_set(&conf->packets, 0);
 }
 
 /**
@@ -186,21 +323,23 @@ void siso_unlimit_speed(sisoconf* conf)
  */
 void siso_set_speed(sisoconf* conf, uint32_t limit, enum siso_units units)
 {
-	conf->max_speed = limit;
+	uint64_t max_speed = limit;
 	
 	switch (units) {
 	case SU_KBYTE:
-		conf->max_speed *= 1024;
+		max_speed *= 1024;
 		break;
 	case SU_MBYTE:
-		conf->max_speed *= 1024 * 1024;
+		max_speed *= 1024 * 1024;
 		break;
 	case SU_GBYTE:
-		conf->max_speed *= 1024 * 1024 * 1024;
+		max_speed *= 1024 * 1024 * 1024;
 		break;
 	default:
 		break;
 	}
+
+	siso_bucket_set(&conf->bytes, max_speed);
 }
 
 /**
@@ -208,22 +347,32 @@ void siso_set_speed(sisoconf* conf, uint32_t limit, enum siso_units units)
  */
 void siso_set_speed_str(sisoconf* conf, const char* limit)
 {
-	conf->max_speed = strtoul(limit, NULL, 10);
+	uint64_t max_speed = strtoul(limit, NULL, 10);
 	char last = limit[strlen(limit) - 1];
 	
 	switch (last) {
 	case 'k': case 'K':
-		conf->max_speed *= 1024;
+		max_speed *= 1024;
 		break;
 	case 'm': case 'M':
-		conf->max_speed *= 1024 * 1024;
+		max_speed *= 1024 * 1024;
 		break;
 	case 'g': case 'G':
-		conf->max_speed *= 1024 * 1024 * 1024;
+		max_speed *= 1024 * 1024 * 1024;
 		break;
 	default:
 		break;
 	}
+
+	siso_bucket_set(&conf->bytes, max_speed);
+}
+
+/**
+ * \brief Set packet rate limit
+ */
+void siso_set_packet_rate(sisoconf *conf, uint64_t packets)
+{
+	siso_bucket_set(&conf->packets, packets);
 }
 
 /**
@@ -364,6 +513,9 @@ int siso_send(sisoconf *conf, const char *data, ssize_t length)
 	
 	/* Size of remaining data */
 	ssize_t todo = length;
+
+	/* check speed limit */
+	siso_pace(conf, length);
 	
 	while (todo > 0) {
 		/* Send data */
@@ -382,7 +534,7 @@ int siso_send(sisoconf *conf, const char *data, ssize_t length)
 
 		/* Check for errors */
 		if (sent_now == -1) {
-			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
 				// Connection broken, close...
 				conf->last_error = PERROR_LAST;
 				siso_close_connection(conf);
@@ -396,25 +548,140 @@ int siso_send(sisoconf *conf, const char *data, ssize_t length)
 		/* Skip sent data */
 		ptr  += sent_now;
 		todo -= sent_now;
-		
-		/* check speed limit */
-		conf->act_speed += sent_now;
-		if (conf->max_speed && conf->act_speed >= conf->max_speed) {
-			gettimeofday(&(conf->end), NULL);
-			
-			/* Should sleep? */
-			double elapsed = conf->end.tv_usec - conf->begin.tv_usec;
-			if (elapsed < 1000000.0) {
-				usleep(1000000.0 - elapsed);
-				gettimeofday(&(conf->end), NULL);
+	}
+
+	return SISO_OK;
+}
+
+/**
+ * \brief Send messages as separate datagrams (UDP) or SCTP messages
+ *
+ * All messages are passed to the kernel by sendmmsg().
+ */
+static int siso_send_mmsg(sisoconf *conf, const struct iovec *msgs, unsigned int cnt)
+{
+	struct mmsghdr hdrs[SISO_BATCH_MAX];
+	memset(hdrs, 0, cnt * sizeof(*hdrs));
+
+	unsigned int i;
+	for (i = 0; i < cnt; ++i) {
+		hdrs[i].msg_hdr.msg_iov = (struct iovec *) &msgs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	unsigned int done = 0;
+	while (done < cnt) {
+		int ret = sendmmsg(conf->sockfd, hdrs + done, cnt - done, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				// Connection broken, close...
+				conf->last_error = PERROR_LAST;
+				siso_close_connection(conf);
+				return SISO_ERR;
 			}
-			
-			/* reinit values */
-			conf->begin = conf->end;
-			conf->act_speed = 0;
+
+			continue;
 		}
-		
+
+		done += ret;
 	}
 
 	return SISO_OK;
 }
+
+/**
+ * \brief Send messages as one stream (TCP)
+ *
+ * The messages are gathered by a single sendmsg() (like writev(), but without
+ * SIGPIPE). Partially written messages are resumed.
+ */
+static int siso_send_stream(sisoconf *conf, const struct iovec *msgs, unsigned int cnt)
+{
+	struct iovec iov[SISO_BATCH_MAX];
+	memcpy(iov, msgs, cnt * sizeof(*iov));
+
+	struct msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = iov;
+	hdr.msg_iovlen = cnt;
+
+	while (hdr.msg_iovlen > 0) {
+		ssize_t sent_now = sendmsg(conf->sockfd, &hdr, MSG_NOSIGNAL);
+		if (sent_now == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				// Connection broken, close...
+				conf->last_error = PERROR_LAST;
+				siso_close_connection(conf);
+				return SISO_ERR;
+			}
+
+			continue;
+		}
+
+		/* Skip sent data */
+		while (hdr.msg_iovlen > 0 && (size_t) sent_now >= hdr.msg_iov->iov_len) {
+			sent_now -= hdr.msg_iov->iov_len;
+			hdr.msg_iov++;
+			hdr.msg_iovlen--;
+		}
+
+		if (hdr.msg_iovlen > 0) {
+			hdr.msg_iov->iov_base = (char *) hdr.msg_iov->iov_base + sent_now;
+			hdr.msg_iov->iov_len -= sent_now;
+		}
+	}
+
+	return SISO_OK;
+}
+
+/**
+ * \brief Pass a group of (already paced) messages to the kernel
+ */
+static int siso_send_group(sisoconf *conf, const struct iovec *msgs, unsigned int cnt)
+{
+	if (cnt == 0) {
+		return SISO_OK;
+	}
+
+	switch (conf->type) {
+	case SC_UDP:
+	case SC_SCTP:
+		return siso_send_mmsg(conf, msgs, cnt);
+	case SC_TCP:
+		return siso_send_stream(conf, msgs, cnt);
+	default:
+		conf->last_error = siso_messages[SISO_ERR_TYPE];
+		return SISO_ERR;
+	}
+}
+
+/**
+ * \brief Send multiple messages
+ */
+int siso_send_batch(sisoconf *conf, const struct iovec *msgs, unsigned int count)
+{
+	CHECK_PTR(conf);
+
+	unsigned int first = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		if (conf->type == SC_UDP && msgs[i].iov_len > SISO_UDP_MAX) {
+			/* Oversized datagram, must be split */
+			CHECK_RETVAL(siso_send_group(conf, msgs + first, i - first));
+			CHECK_RETVAL(siso_send(conf, msgs[i].iov_base, msgs[i].iov_len));
+			first = i + 1;
+			continue;
+		}
+
+		/* Send what is already paid for before waiting for the limiter */
+		if (i - first == SISO_BATCH_MAX || !siso_pace_ready(conf, msgs[i].iov_len)) {
+			CHECK_RETVAL(siso_send_group(conf, msgs + first, i - first));
+			first = i;
+		}
+
+		siso_pace(conf, msgs[i].iov_len);
+	}
+
+	return siso_send_group(conf, msgs + first, count - first);
+}
@@ -46,6 +46,7 @@ extern "C" {
     
 #include <inttypes.h>
 #include <sys/types.h>
+#include <sys/uio.h>
     
     #define SISO_OK  0
     #define SISO_ERR 1
@@ -141,6 +142,16 @@ extern "C" {
      * @param limit speed limit (with optional suffix K,M,G)
      */
     void siso_set_speed_str(sisoconf* conf, const char* limit);
+
+    /**
+     * \brief Set max. packet rate
+     *
+     * Works together with the speed limit, the stricter one applies.
+     *
+     * @param conf sisoconf configuration
+     * @param packets packets/s limit (0 = unlimited)
+     */
+    void siso_set_packet_rate(sisoconf *conf, uint64_t packets);
     
     /**
      * \brief Create new connection
@@ -187,6 +198,22 @@ extern "C" {
      */
     int siso_send(sisoconf *conf, const char *data, ssize_t length);
 
+    /**
+     * \brief Send multiple messages
+     *
+     * Each vector is one whole message. UDP and SCTP messages are passed to
+     * the kernel in groups by sendmmsg() (one datagram/SCTP message each),
+     * TCP messages are gathered into a single write. Speed limits are applied
+     * per message, but the clock is read only when the limiter runs dry.
+     * When the #SISO_ERR is returned, than the connection is broken and must
+     * be reinitialized using siso_reconnect()
+     * @param conf sisoconf configuration
+     * @param msgs array of messages
+     * @param count number of messages
+     * @return SISO_OK or SISO_ERR and sets error message (see siso_get_last_err for details)
+     */
+    int siso_send_batch(sisoconf *conf, const struct iovec *msgs, unsigned int count);
+
 #ifdef	__cplusplus
 }
 #endif
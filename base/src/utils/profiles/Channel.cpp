@@ -235,31 +235,21 @@ void Channel::match(ipfix_message* msg, metadata* mdata, std::vector<Channel *>&
 
 void Channel::match(struct match_data *data)
 {
-	if (m_filter && !filter_fits_node(m_filter->root, data->msg, &(data->mdata->record))) {
+	const size_t word = m_index / 64;
+	const uint64_t bit = UINT64_C(1) << (m_index % 64);
+
+	/* Already evaluated via another source */
+	if (data->visited[word] & bit) {
 		return;
 	}
 
-	if (data->channelsMax == 0) {
-		data->channelsMax = 5;
-		data->channels = (void**) calloc(data->channelsMax, sizeof(void*));
-		if (data->channels == NULL) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-			return;
-		}
-	} else if (data->channelsCounter == data->channelsMax) {
-		data->channels = (void**) realloc(data->channels, sizeof(void*) * data->channelsMax * 2);
-		if (data->channels == NULL) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-			return;
-		}
-
-		memset(&(data->channels[data->channelsMax]), 0, sizeof(void*) * data->channelsMax);
+	data->visited[word] |= bit;
 
-		data->channelsMax *= 2;
+	if (m_filter && !filter_fits_node(m_filter->root, data->msg, &(data->mdata->record))) {
+		return;
 	}
 
-	data->channels[data->channelsCounter++] = (void*) this;
-
+	data->matched[word] |= bit;
 
 	for (auto& child: m_listeners) {
 		child->match(data);
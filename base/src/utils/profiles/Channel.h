@@ -88,6 +88,20 @@ public:
      * \return channel's ID (unique within all channels)
      */
 	channel_id_t getId() { return m_id; }
+
+	/**
+	 * \brief Get channel's index
+	 *
+	 * \return position of the channel within its profile tree
+	 */
+	uint32_t getIndex() { return m_index; }
+
+	/**
+	 * \brief Set channel's index
+	 *
+	 * \param[in] index position of the channel within its profile tree
+	 */
+	void setIndex(uint32_t index) { m_index = index; }
 	
 	/**
 	 * \brief Get channel profile
@@ -160,10 +174,19 @@ public:
      */
 	void match(struct ipfix_message *msg, struct metadata *mdata, std::vector<Channel *>& channels);
 
+	/**
+	 * \brief Match channel with data record and mark it into bitsets
+	 *
+	 * Each channel is evaluated at most once per data record, even when it
+	 * is reachable from several matching sources.
+	 *
+	 * \param[in,out] data matching context
+	 */
 	void match(struct match_data *data);
 private:
 
 	channel_id_t m_id;			/**< Channel ID */
+	uint32_t m_index{};			/**< Index within the profile tree */
 	std::string m_name;			/**< Channel name */
 	std::string m_pathName;		/**< path name */
 
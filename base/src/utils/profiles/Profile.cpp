@@ -38,13 +38,32 @@
  */
 
 #include <algorithm>
+#include <cstring>
 
 #include "Profile.h"
 #include "Channel.h"
 
+static const char *msg_module = "profiles";
+
 /* Numer of profiles (ID for new profiles) */
 profile_id_t Profile::profiles_cnt = 1;
 
+/* Number of indexed profile trees (IDs of trees in per-thread caches) */
+std::atomic<uint64_t> Profile::trees_cnt{0};
+
+/* Size of per-thread cache of interned lists (power of two) */
+#define MATCH_CACHE_SIZE 64
+
+/**
+ * Entry of per-thread cache of interned lists
+ */
+struct match_cache_entry {
+	uint64_t tree{0};		/**< ID of profile tree, 0 for empty entry */
+	uint64_t hash{0};		/**< Hash of the bitset */
+	std::vector<uint64_t> bits{};	/**< Bitset of matching channels */
+	void **channels{NULL};		/**< Interned list */
+};
+
 /**
  * Constructor
  */
@@ -67,6 +86,11 @@ Profile::~Profile()
 	for (auto& p: m_children) {
 		delete p;
 	}
+
+	/* Remove interned lists of matching channels */
+	for (auto& item: m_matchLists) {
+		free(item.second.channels);
+	}
 }
 
 /**
@@ -162,3 +186,136 @@ void Profile::match(struct match_data *data)
 		channel->match(data);
 	}
 }
+
+/**
+ * Assign indexes to all channels in the tree
+ */
+void Profile::indexChannels()
+{
+	m_treeChannels.clear();
+	m_treeId = ++trees_cnt;
+
+	std::vector<Profile *> stack{this};
+	while (!stack.empty()) {
+		Profile *p = stack.back();
+		stack.pop_back();
+
+		for (auto& ch: p->m_channels) {
+			ch->setIndex(m_treeChannels.size());
+			m_treeChannels.push_back(ch);
+		}
+
+		for (auto& child: p->m_children) {
+			stack.push_back(child);
+		}
+	}
+}
+
+/**
+ * Find or create interned list of channels
+ */
+void **Profile::internList(const uint64_t *bits, size_t words)
+{
+	/* FNV-1a over bitset words */
+	uint64_t hash = UINT64_C(14695981039346656037);
+	for (size_t i = 0; i < words; ++i) {
+		hash = (hash ^ bits[i]) * UINT64_C(1099511628211);
+	}
+
+	/* Lists of a tree never change, so a cached one can be used without lock */
+	static thread_local match_cache_entry cache[MATCH_CACHE_SIZE];
+	match_cache_entry &entry = cache[hash & (MATCH_CACHE_SIZE - 1)];
+
+	if (entry.tree == m_treeId && entry.hash == hash && entry.bits.size() == words
+			&& memcmp(entry.bits.data(), bits, words * sizeof(uint64_t)) == 0) {
+		return entry.channels;
+	}
+
+	void **channels = internListLocked(bits, words, hash);
+	if (channels != NULL) {
+		entry.tree = m_treeId;
+		entry.hash = hash;
+		entry.bits.assign(bits, bits + words);
+		entry.channels = channels;
+	}
+
+	return channels;
+}
+
+/**
+ * Find or create interned list of channels in the shared table
+ */
+void **Profile::internListLocked(const uint64_t *bits, size_t words, uint64_t hash)
+{
+	std::lock_guard<std::mutex> lock(m_matchMutex);
+
+	auto range = m_matchLists.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (memcmp(it->second.bits.data(), bits, words * sizeof(uint64_t)) == 0) {
+			return it->second.channels;
+		}
+	}
+
+	/* New combination of channels */
+	size_t count = 0;
+	for (size_t i = 0; i < words; ++i) {
+		count += __builtin_popcountll(bits[i]);
+	}
+
+	void **channels = (void **) calloc(count + 1, sizeof(void *));
+	if (channels == NULL) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	size_t pos = 0;
+	for (size_t i = 0; i < words; ++i) {
+		uint64_t word = bits[i];
+		while (word) {
+			channels[pos++] = m_treeChannels[i * 64 + __builtin_ctzll(word)];
+			word &= word - 1;
+		}
+	}
+
+	m_matchLists.emplace(hash, match_list{std::vector<uint64_t>(bits, bits + words), channels});
+	return channels;
+}
+
+/**
+ * Match profile and return interned list of channels
+ */
+void **Profile::matchData(struct ipfix_message *msg, struct metadata *mdata)
+{
+	Profile *root = this;
+	while (root->m_parent) {
+		root = root->m_parent;
+	}
+
+	const size_t words = (root->m_treeChannels.size() + 63) / 64;
+	if (words == 0) {
+		return NULL;
+	}
+
+	/* Scratch bitsets are reused for all records processed by a thread */
+	static thread_local std::vector<uint64_t> scratch;
+	scratch.assign(2 * words, 0);
+
+	struct match_data data;
+	data.msg = msg;
+	data.mdata = mdata;
+	data.matched = scratch.data();
+	data.visited = scratch.data() + words;
+
+	match(&data);
+
+	bool empty = true;
+	for (size_t i = 0; i < words && empty; ++i) {
+		empty = (data.matched[i] == 0);
+	}
+
+	if (empty) {
+		return NULL;
+	}
+
+	return root->internList(data.matched, words);
+}
@@ -42,6 +42,9 @@
 
 #include <string>
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 #include <ipfixcol/profiles.h>
 #include "profiles_internal.h"
@@ -183,8 +186,57 @@ public:
 	void match(struct ipfix_message *msg, struct metadata *mdata, std::vector<Channel *>& channels);
 
 	void match(struct match_data *data);
+
+	/**
+	 * \brief Assign tree-wide indexes to all channels
+	 *
+	 * Must be called on the root profile once the tree is complete.
+	 */
+	void indexChannels();
+
+	/**
+	 * \brief Match profile with data record and return the list of channels
+	 *
+	 * Lists are interned in the root profile: each distinct set of matching
+	 * channels is allocated only once and lives as long as the profile tree.
+	 *
+	 * \param[in] msg IPFIX message
+	 * \param[in] mdata Data record's metadata
+	 * \return NULL-terminated list of matching channels or NULL
+	 */
+	void **matchData(struct ipfix_message *msg, struct metadata *mdata);
 private:
 
+	/**
+	 * \brief Interned list of matching channels
+	 */
+	struct match_list {
+		std::vector<uint64_t> bits;	/**< Bitset of matching channels */
+		void **channels;			/**< NULL-terminated list of channels */
+	};
+
+	/**
+	 * \brief Find or create interned list for a bitset of channels
+	 *
+	 * Lists are looked up in a per-thread cache first; the lock is taken
+	 * only when a list is not cached by the thread yet.
+	 *
+	 * \param[in] bits Bitset of matching channels
+	 * \param[in] words Number of words in the bitset
+	 * \return NULL-terminated list of channels
+	 */
+	void **internList(const uint64_t *bits, size_t words);
+
+	/**
+	 * \brief Find or create interned list under the lock
+	 *
+	 * \param[in] bits Bitset of matching channels
+	 * \param[in] words Number of words in the bitset
+	 * \param[in] hash Hash of the bitset
+	 * \return NULL-terminated list of channels
+	 */
+	void **internListLocked(const uint64_t *bits, size_t words, uint64_t hash);
+
 	Profile *m_parent{NULL};	/**< Parent profile */
 
 	profile_id_t m_id{};		/**< Profile ID */
@@ -196,8 +248,14 @@ private:
 
 	profilesVec m_children{};	/**< Children */
 	channelsVec m_channels{};	/**< Channels */
+
+	channelsVec m_treeChannels{};	/**< All channels in the tree (root only) */
+	std::unordered_multimap<uint64_t, match_list> m_matchLists{}; /**< Interned lists (root only) */
+	std::mutex m_matchMutex{};	/**< Lock for interned lists */
+	uint64_t m_treeId{};		/**< Unique ID of indexed tree (root only) */
 	
 	static profile_id_t profiles_cnt;	/**< Total number of profiles */
+	static std::atomic<uint64_t> trees_cnt;	/**< Number of indexed trees */
 };
 
 #endif	/* PROFILE_H */
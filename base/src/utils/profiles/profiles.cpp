@@ -619,6 +619,7 @@ Profile *process_profile_xml(const char *filename)
 	}	
 
 	rootProfile->updatePathName();
+	rootProfile->indexChannels();
 	return rootProfile;
 }
 
@@ -714,33 +715,7 @@ void *profile_get_channel(void *profile, uint16_t index)
 void **profile_match_data(void *profile, struct ipfix_message *msg, struct metadata *mdata)
 {
 	Profile *p = (Profile *) profile;
-
-	/* Fill data structure */
-	struct match_data data;
-	data.msg = msg;
-	data.mdata = mdata;
-	data.channels = NULL;
-	data.channelsCounter = 0;
-	data.channelsMax = 0;
-
-	/* Find matching channels */
-	p->match(&data);
-	if (data.channels == NULL || data.channelsCounter == 0) {
-		return NULL;
-	}
-
-	/* Add terminating NULL pointer */
-	if (data.channelsCounter == data.channelsMax) {
-		data.channels = (void**) realloc(data.channels, sizeof(void*) * (data.channelsCounter + 1));
-		if (data.channels == NULL) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-			return NULL;
-		}
-	}
-
-	data.channels[data.channelsCounter] = NULL;
-
-	return data.channels;
+	return p->matchData(msg, mdata);
 }
 
 /**
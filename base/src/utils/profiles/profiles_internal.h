@@ -51,9 +51,8 @@ extern "C" {
 struct match_data {
 	struct ipfix_message *msg;
 	struct metadata *mdata;
-	void **channels;
-	uint16_t channelsCounter;
-	uint16_t channelsMax;
+	uint64_t *matched;	/**< Bitset of matching channels (by channel index) */
+	uint64_t *visited;	/**< Bitset of already evaluated channels */
 };
 
 /* ID types can by changed here */
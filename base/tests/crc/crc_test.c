@@ -0,0 +1,173 @@
+/**
+ * \file crc_test.c
+ * \brief Cross-validation and benchmark of CRC implementations
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../src/crc.h"
+
+#define BUFF_LEN 65536
+#define BENCH_BYTES (256UL << 20)
+
+static int errors = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check '%s' failed\n", __FILE__, __LINE__, #cond); \
+		errors++; \
+	} \
+} while (0)
+
+static uint8_t buffer[BUFF_LEN + 16];
+
+/* CRC-32 by the original byte-at-a-time table */
+static uint32_t ref_ieee(const uint8_t *buf, size_t len)
+{
+	DWORD crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < len; ++i) {
+		crc = updateCRC32(buf[i], crc);
+	}
+	return (uint32_t) ~crc;
+}
+
+/* CRC-32C bit by bit */
+static uint32_t ref_castagnoli(const uint8_t *buf, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < len; ++i) {
+		crc ^= buf[i];
+		for (int k = 0; k < 8; ++k) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78U : crc >> 1;
+		}
+	}
+	return ~crc;
+}
+
+typedef uint32_t (*ref_func)(const uint8_t *, size_t);
+
+/* Compare all implementations with the reference (lengths, alignments, chaining) */
+static void test_type(enum crc_type type, ref_func ref, uint32_t check)
+{
+	const struct crc_impl *impl;
+
+	for (impl = crc_implementations(type); impl->name != NULL; ++impl) {
+		CHECK(impl->func(0, "123456789", 9) == check);
+		CHECK(impl->func(0, buffer, 0) == 0);
+
+		for (size_t len = 0; len < 600; ++len) {
+			for (size_t off = 0; off < 16; ++off) {
+				uint32_t expected = ref(buffer + off, len);
+				if (impl->func(0, buffer + off, len) != expected) {
+					fprintf(stderr, "%s: len %zu, offset %zu\n", impl->name, len, off);
+					errors++;
+				}
+
+				size_t split = (len * off) / 16;
+				uint32_t crc = impl->func(0, buffer + off, split);
+				CHECK(impl->func(crc, buffer + off + split, len - split) == expected);
+			}
+		}
+
+		CHECK(impl->func(0, buffer, BUFF_LEN) == ref(buffer, BUFF_LEN));
+	}
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Throughput of all implementations and the original CRC-32 for several sizes */
+static void benchmark()
+{
+	static const size_t sizes[] = {16, 64, 1500, BUFF_LEN};
+	static const char *types[] = {"crc32", "crc32c"};
+	struct timespec start;
+	volatile uint32_t sink = 0;
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		size_t rounds = BENCH_BYTES / sizes[s] / (sizes[s] < 1500 ? 8 : 1);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < rounds / 8; ++i) {
+			sink += ref_ieee(buffer, sizes[s]);
+		}
+		printf("%6zu B  crc32  %-8s %8.2f GB/s\n", sizes[s], "original",
+			(rounds / 8) * sizes[s] / elapsed(&start) / 1e9);
+
+		for (int type = 0; type < CRC_TYPE_COUNT; ++type) {
+			const struct crc_impl *impl;
+			for (impl = crc_implementations(type); impl->name != NULL; ++impl) {
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				for (size_t i = 0; i < rounds; ++i) {
+					sink += impl->func(0, buffer, sizes[s]);
+				}
+				printf("%6zu B  %-6s %-8s %8.2f GB/s\n", sizes[s], types[type],
+					impl->name, rounds * sizes[s] / elapsed(&start) / 1e9);
+			}
+		}
+	}
+
+	(void) sink;
+}
+
+int main(int argc, char **argv)
+{
+	srand(1);
+	for (size_t i = 0; i < sizeof(buffer); ++i) {
+		buffer[i] = rand();
+	}
+
+	test_type(CRC_IEEE, ref_ieee, 0xCBF43926U);
+	test_type(CRC_CASTAGNOLI, ref_castagnoli, 0xE3069283U);
+	CHECK((uint32_t) crc32((char *) buffer, 1000) == ref_ieee(buffer, 1000));
+	CHECK(crc32c(0, buffer, 1000) == ref_castagnoli(buffer, 1000));
+
+	printf("crc32:  %s\n", crc_implementations(CRC_IEEE)->name);
+	printf("crc32c: %s\n", crc_implementations(CRC_CASTAGNOLI)->name);
+
+	if (argc < 2 || strcmp(argv[1], "-n") != 0) {
+		benchmark();
+	}
+
+	printf("%s\n", errors ? "FAILED" : "OK");
+	return errors != 0;
+}
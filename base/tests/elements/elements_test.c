@@ -0,0 +1,162 @@
+/**
+ * \file elements_test.c
+ * \brief Test and benchmark of the lookup of IPFIX elements by ID
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ipfixcol.h>
+#include "../../src/utils/elements/collection.h"
+#include "../../src/utils/elements/element.h"
+
+#define DEFAULT_FILE "../../config/ipfix-elements.xml"
+#define ITERATIONS 200
+
+static int errors = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check '%s' failed\n", __FILE__, __LINE__, #cond); \
+		errors++; \
+	} \
+} while (0)
+
+/* Lookup by binary search over groups and elements (previous implementation) */
+static const ipfix_element_t *bsearch_by_id(const struct elem_groups *groups,
+	uint16_t id, uint32_t en)
+{
+	struct elem_en_group grp_key;
+	struct elem_en_group *grp_key_p = &grp_key;
+	struct elem_en_group **grp_pp;
+
+	grp_key.en_id = en;
+	grp_pp = bsearch(&grp_key_p, groups->groups, groups->elem_used,
+		sizeof(struct elem_en_group *), cmp_groups);
+	if (!grp_pp) {
+		return NULL;
+	}
+
+	ipfix_element_t el_key;
+	const ipfix_element_t *el_key_p = &el_key;
+	const ipfix_element_t **elem_pp;
+
+	el_key.id = id;
+	elem_pp = bsearch(&el_key_p, (*grp_pp)->elements, (*grp_pp)->elem_used,
+		sizeof(ipfix_element_t *), cmp_elem_by_id);
+	return elem_pp ? *elem_pp : NULL;
+}
+
+/* Every known element must be found, everything else must not */
+static void test_lookup(const struct elem_groups *groups)
+{
+	for (unsigned int i = 0; i < groups->name_count; ++i) {
+		const ipfix_element_t *elem = groups->name_index[i];
+		CHECK(get_element_by_id(elem->id, elem->en) == elem);
+		CHECK(get_element_by_id(elem->id, elem->en + 1) ==
+			bsearch_by_id(groups, elem->id, elem->en + 1));
+		CHECK(get_element_by_id(elem->id ^ 0x4000, elem->en) ==
+			bsearch_by_id(groups, elem->id ^ 0x4000, elem->en));
+	}
+
+	for (uint32_t en = 0; en < 50000; en += 7) {
+		for (uint32_t id = 0; id < 1024; id += 13) {
+			CHECK(get_element_by_id(id, en) == bsearch_by_id(groups, id, en));
+		}
+	}
+
+	CHECK(get_element_by_id(0xFFFF, 0) == NULL);
+	CHECK(get_element_by_id(1, 0xFFFFFFFF) == NULL);
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Compare the lookup table with the binary search */
+static void benchmark(const struct elem_groups *groups)
+{
+	struct timespec start;
+	unsigned long found = 0;
+	unsigned long lookups = (unsigned long) ITERATIONS * groups->name_count;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ITERATIONS; ++i) {
+		for (unsigned int y = 0; y < groups->name_count; ++y) {
+			const ipfix_element_t *elem = groups->name_index[y];
+			found += bsearch_by_id(groups, elem->id, elem->en) != NULL;
+		}
+	}
+	double old = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ITERATIONS; ++i) {
+		for (unsigned int y = 0; y < groups->name_count; ++y) {
+			const ipfix_element_t *elem = groups->name_index[y];
+			found += get_element_by_id(elem->id, elem->en) != NULL;
+		}
+	}
+	double hash = elapsed(&start);
+
+	printf("binary search: %.1f ns/lookup\n", old * 1e9 / lookups);
+	printf("lookup table:  %.1f ns/lookup (%lu found)\n", hash * 1e9 / lookups, found);
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = (argc > 1 && strcmp(argv[1], "-n") != 0) ? argv[1] : DEFAULT_FILE;
+	bool bench = !(argc > 1 && strcmp(argv[argc - 1], "-n") == 0);
+
+	CHECK(get_element_by_id(1, 0) == NULL);
+	if (elem_coll_reload(file) <= 0) {
+		fprintf(stderr, "Unable to load '%s'\n", file);
+		return 1;
+	}
+
+	const struct elem_groups *groups = elem_coll_get();
+	test_lookup(groups);
+	if (bench) {
+		benchmark(groups);
+	}
+
+	elem_coll_destroy();
+	printf("%s\n", errors ? "FAILED" : "OK");
+	return errors != 0;
+}
@@ -0,0 +1,384 @@
+/**
+ * \file sampling_test.c
+ * \brief Test and benchmark of the sampling intermediate plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <ipfixcol.h>
+
+#define ITERATIONS 20000
+#define BENCH_RECORDS 1000
+
+/* Data records: octetDeltaCount (8), packetDeltaCount (4), samplerId (1) */
+#define REC_LEN 13
+/* Data records: octetDeltaCount (8), samplingInterval (4) */
+#define INLINE_LEN 12
+
+static int errors = 0;
+static int passed = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check '%s' failed\n", __FILE__, __LINE__, #cond); \
+		errors++; \
+	} \
+} while (0)
+
+/* Functions of the Intermediate Process API provided by the collector */
+int pass_message(void *config, struct ipfix_message *message)
+{
+	(void) config;
+	(void) message;
+	passed++;
+	return 0;
+}
+
+int drop_message(void *config, struct ipfix_message *message)
+{
+	(void) config;
+	(void) message;
+	return 0;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t value)
+{
+	value = htons(value);
+	memcpy(p, &value, 2);
+	return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(p, &value, 4);
+	return p + 4;
+}
+
+static uint8_t *put64(uint8_t *p, uint64_t value)
+{
+	p = put32(p, value >> 32);
+	return put32(p, value & 0xffffffff);
+}
+
+static uint64_t get(const uint8_t *p, int length)
+{
+	uint64_t value = 0;
+
+	while (length-- > 0) {
+		value = (value << 8) | *p++;
+	}
+
+	return value;
+}
+
+/* Create template from (ID, length) pairs */
+static struct ipfix_template *make_template(uint16_t id, int type, int scope, const uint16_t *fields, int count)
+{
+	uint8_t buff[256], *p = buff;
+
+	p = put16(p, id);
+	p = put16(p, count);
+	if (type == TM_OPTIONS_TEMPLATE) {
+		p = put16(p, scope);
+	}
+
+	for (int i = 0; i < count; ++i) {
+		p = put16(p, fields[2 * i]);
+		p = put16(p, fields[2 * i + 1]);
+	}
+
+	return tm_create_template(buff, p - buff, type, 1);
+}
+
+/* Data set with records */
+struct set {
+	uint8_t data[BENCH_RECORDS * REC_LEN + 4];
+	uint8_t *end;
+};
+
+static void set_init(struct set *set, uint16_t id)
+{
+	set->end = put16(set->data, id) + 2;
+}
+
+static struct ipfix_data_set *set_done(struct set *set)
+{
+	put16(set->data + 2, set->end - set->data);
+	return (struct ipfix_data_set *) set->data;
+}
+
+/* Build message of data sets */
+static void make_message(struct ipfix_message *msg, struct input_info_network *info,
+	struct ipfix_data_set **sets, struct ipfix_template **templs, int count)
+{
+	static struct ipfix_header header;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->pkt_header = &header;
+	msg->input_info = (struct input_info *) info;
+	msg->source_status = SOURCE_STATUS_OPENED;
+
+	for (int i = 0; i < count; ++i) {
+		msg->data_couple[i].data_set = sets[i];
+		msg->data_couple[i].data_template = templs[i];
+	}
+}
+
+static struct ipfix_template *t_data, *t_inline, *t_sampler, *t_domain, *t_psamp;
+
+static void make_templates(void)
+{
+	const uint16_t data[] = {1, 8, 2, 4, 48, 1};
+	const uint16_t inl[] = {1, 8, 34, 4};
+	const uint16_t sampler[] = {48, 1, 34, 4};
+	const uint16_t domain[] = {143, 4, 34, 4};
+	const uint16_t psamp[] = {302, 8, 305, 4, 306, 4};
+
+	t_data = make_template(256, TM_TEMPLATE, 0, data, 3);
+	t_inline = make_template(257, TM_TEMPLATE, 0, inl, 2);
+	t_sampler = make_template(258, TM_OPTIONS_TEMPLATE, 1, sampler, 2);
+	t_domain = make_template(259, TM_OPTIONS_TEMPLATE, 1, domain, 2);
+	t_psamp = make_template(260, TM_OPTIONS_TEMPLATE, 1, psamp, 3);
+}
+
+static uint8_t *add_record(struct set *set, uint64_t octets, uint32_t packets, uint8_t sampler)
+{
+	uint8_t *rec = set->end;
+
+	set->end = put64(set->end, octets);
+	set->end = put32(set->end, packets);
+	*set->end++ = sampler;
+	return rec;
+}
+
+/* Rates learnt from Options Data and applied to data records */
+static void test_scaling(void)
+{
+	struct input_info_network info, other;
+	struct ipfix_message msg;
+	struct ipfix_data_set *sets[4];
+	struct ipfix_template *templs[4];
+	struct set opts, dom, psamp, data, inl;
+	uint8_t *a, *b, *c, *d, *e;
+	void *config;
+
+	memset(&info, 0, sizeof(info));
+	info.type = SOURCE_TYPE_UDP;
+	info.l3_proto = 4;
+	info.src_addr.ipv4.s_addr = htonl(0x0a000001);
+	info.src_port = 4739;
+	info.odid = 1;
+	other = info;
+	other.src_addr.ipv4.s_addr = htonl(0x0a000002);
+
+	CHECK(intermediate_init(NULL, NULL, 0, NULL, &config) == 0);
+
+	/* Sampler 5: 1 of 100, domain: 1 of 10, selector 9: 1 + 99 skipped */
+	set_init(&opts, 258);
+	*opts.end++ = 5;
+	opts.end = put32(opts.end, 100);
+	set_init(&dom, 259);
+	dom.end = put32(dom.end, 1);
+	dom.end = put32(dom.end, 10);
+	set_init(&psamp, 260);
+	psamp.end = put64(psamp.end, 9);
+	psamp.end = put32(psamp.end, 1);
+	psamp.end = put32(psamp.end, 99);
+
+	set_init(&data, 256);
+	a = add_record(&data, 1000, 2, 5);
+	b = add_record(&data, 1000, 2, 7);
+	c = add_record(&data, 1000, 0x10000000, 5);
+	d = add_record(&data, 1000, 3, 9);
+
+	/* Data before options in the message */
+	sets[0] = set_done(&data);
+	sets[1] = set_done(&opts);
+	sets[2] = set_done(&dom);
+	sets[3] = set_done(&psamp);
+	templs[0] = t_data;
+	templs[1] = t_sampler;
+	templs[2] = t_domain;
+	templs[3] = t_psamp;
+	make_message(&msg, &info, sets, templs, 4);
+	CHECK(intermediate_process_message(config, &msg) == 0);
+
+	CHECK(get(a, 8) == 100000 && get(a + 8, 4) == 200);
+	CHECK(get(b, 8) == 10000 && get(b + 8, 4) == 20);
+	CHECK(get(c, 8) == 100000 && get(c + 8, 4) == 0xffffffff);
+	CHECK(get(d, 8) == 100000 && get(d + 8, 4) == 300);
+
+	/* Records carrying the interval are already scaled */
+	set_init(&inl, 257);
+	e = inl.end;
+	inl.end = put64(inl.end, 1000);
+	inl.end = put32(inl.end, 50);
+	sets[0] = set_done(&inl);
+	templs[0] = t_inline;
+	make_message(&msg, &info, sets, templs, 1);
+	CHECK(intermediate_process_message(config, &msg) == 0);
+	CHECK(get(e, 8) == 1000);
+
+	/* Other exporter has no sampling configuration */
+	set_init(&data, 256);
+	a = add_record(&data, 1000, 2, 5);
+	sets[0] = set_done(&data);
+	templs[0] = t_data;
+	make_message(&msg, &other, sets, templs, 1);
+	CHECK(intermediate_process_message(config, &msg) == 0);
+	CHECK(get(a, 8) == 1000 && get(a + 8, 4) == 2);
+
+	/* Configuration is forgotten with the session */
+	make_message(&msg, &info, sets, templs, 0);
+	msg.source_status = SOURCE_STATUS_CLOSED;
+	CHECK(intermediate_process_message(config, &msg) == 0);
+	make_message(&msg, &info, sets, templs, 1);
+	CHECK(intermediate_process_message(config, &msg) == 0);
+	CHECK(get(a, 8) == 1000 && get(a + 8, 4) == 2);
+
+	CHECK(passed == 5);
+	intermediate_close(config);
+
+	/* Interval in records is applied when configured */
+	CHECK(intermediate_init("<sampling><inlineInterval>raw</inlineInterval></sampling>", NULL, 0, NULL, &config) == 0);
+	sets[0] = set_done(&inl);
+	templs[0] = t_inline;
+	make_message(&msg, &info, sets, templs, 1);
+	CHECK(intermediate_process_message(config, &msg) == 0);
+	CHECK(get(e, 8) == 50000 && get(e + 8, 4) == 50);
+	intermediate_close(config);
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void noop(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	(void) templ;
+	*(uint64_t *) data += rec[rec_len - 1];
+}
+
+/* Time per record of walking records and of upscaling them */
+static void benchmark(void)
+{
+	static struct set data, opts;
+	static uint8_t copy[sizeof(data.data)];
+	struct input_info_network info;
+	struct ipfix_message msg;
+	struct ipfix_data_set *sets[2];
+	struct ipfix_template *templs[2] = {t_sampler, t_data};
+	struct timespec start;
+	uint64_t sum = 0;
+	void *config;
+	int i;
+
+	memset(&info, 0, sizeof(info));
+	info.type = SOURCE_TYPE_UDP;
+	info.odid = 1;
+
+	set_init(&opts, 258);
+	*opts.end++ = 5;
+	opts.end = put32(opts.end, 2);
+	set_init(&data, 256);
+	for (i = 0; i < BENCH_RECORDS; ++i) {
+		add_record(&data, 1000 + i, 1 + i, (i % 4) ? 5 : 6);
+	}
+
+	sets[0] = set_done(&opts);
+	sets[1] = set_done(&data);
+	memcpy(copy, data.data, sizeof(copy));
+
+	/* Records are restored in every iteration, so that counters do not saturate */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ITERATIONS; ++i) {
+		memcpy(data.data, copy, sizeof(copy));
+		data_set_process_records(sets[1], t_data, &noop, &sum);
+	}
+	double walk = elapsed(&start);
+
+	CHECK(intermediate_init(NULL, NULL, 0, NULL, &config) == 0);
+	make_message(&msg, &info, sets + 1, templs + 1, 1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ITERATIONS; ++i) {
+		memcpy(data.data, copy, sizeof(copy));
+		intermediate_process_message(config, &msg);
+	}
+	double unknown = elapsed(&start);
+
+	make_message(&msg, &info, sets, templs, 1);
+	intermediate_process_message(config, &msg);
+	make_message(&msg, &info, sets + 1, templs + 1, 1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ITERATIONS; ++i) {
+		memcpy(data.data, copy, sizeof(copy));
+		intermediate_process_message(config, &msg);
+	}
+	double scaled = elapsed(&start);
+	intermediate_close(config);
+
+	double records = (double) ITERATIONS * BENCH_RECORDS;
+	printf("walk records:     %.1f ns/record (%lu)\n", walk * 1e9 / records, (unsigned long) sum);
+	printf("no sampling:      %.1f ns/record\n", unknown * 1e9 / records);
+	printf("upscale counters: %.1f ns/record\n", scaled * 1e9 / records);
+}
+
+int main(int argc, char **argv)
+{
+	bool bench = !(argc > 1 && strcmp(argv[1], "-n") == 0);
+
+	verbose = ICMSG_ERROR;
+	make_templates();
+	test_scaling();
+	if (bench) {
+		benchmark();
+	}
+
+	free(t_data);
+	free(t_inline);
+	free(t_sampler);
+	free(t_domain);
+	free(t_psamp);
+	printf("%s\n", errors ? "FAILED" : "OK");
+	return errors != 0;
+}
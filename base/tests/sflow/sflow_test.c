@@ -0,0 +1,356 @@
+/**
+ * \file sflow_test.c
+ * \brief Test and benchmark of sFlow v5 to IPFIX conversion
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <ipfixcol.h>
+#include "../../src/utils/conversion/convert.h"
+#include "../../src/utils/conversion/sflow_ipfix.h"
+
+/* Netflow v5-like conversion of the original sflowtool port */
+uint16_t Process_sflow(void *packet, ssize_t packet_len);
+
+#define BUFF_LEN 10000
+#define ITERATIONS 500000
+
+#define TEMPLATES_LEN (4 + 100 + 100 + 160)
+#define FLOW4_LEN 90
+#define FLOW6_LEN 126
+#define COUNTERS_LEN 96
+
+static int errors = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check '%s' failed\n", __FILE__, __LINE__, #cond); \
+		errors++; \
+	} \
+} while (0)
+
+/* Datagram builder */
+static uint8_t datagram[2048];
+static size_t dlen;
+
+static void w32(uint32_t v)
+{
+	v = htonl(v);
+	memcpy(datagram + dlen, &v, 4);
+	dlen += 4;
+}
+
+static void wbytes(const void *data, size_t len)
+{
+	memcpy(datagram + dlen, data, len);
+	dlen += len;
+	while (dlen % 4) {
+		datagram[dlen++] = 0;
+	}
+}
+
+/* Start of a length-prefixed structure, returns position of the length */
+static size_t wopen(uint32_t tag)
+{
+	w32(tag);
+	w32(0);
+	return dlen - 4;
+}
+
+static void wclose(size_t pos)
+{
+	uint32_t v = htonl(dlen - pos - 4);
+	memcpy(datagram + pos, &v, 4);
+}
+
+static uint32_t r32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+static uint16_t r16(const uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, 2);
+	return ntohs(v);
+}
+
+static uint64_t r64(const uint8_t *p)
+{
+	return ((uint64_t) r32(p) << 32) | r32(p + 4);
+}
+
+static const uint8_t generic_counters[88] = {
+	0, 0, 0, 3,                 /* ifIndex */
+	0, 0, 0, 6,                 /* ifType */
+	0, 0, 0, 0, 0x3b, 0x9a, 0xca, 0x00, /* ifSpeed */
+	0, 0, 0, 1,                 /* ifDirection */
+	0, 0, 0, 3,                 /* ifStatus */
+	0, 0, 0, 0x1c, 0xbe, 0x99, 0x1a, 0x14, /* ifInOctets */
+	0, 0, 1, 0, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4, 0, 0, 0, 5, 0, 0, 0, 6,
+	0, 0, 0, 0, 0, 0, 0x10, 0, /* ifOutOctets */
+	0, 0, 2, 0, 0, 0, 0, 7, 0, 0, 0, 8, 0, 0, 0, 9, 0, 0, 0, 10,
+	0, 0, 0, 0,                 /* ifPromiscuousMode */
+};
+
+/* Build datagram with IPv4 and IPv6 flow samples and a counter sample */
+static void build_datagram()
+{
+	size_t sample, record;
+
+	dlen = 0;
+	w32(5);             /* version */
+	w32(1);             /* agent address type */
+	w32(0x0a000001);    /* agent address */
+	w32(7);             /* sub-agent ID */
+	w32(1);             /* sequence number */
+	w32(1000);          /* uptime */
+	w32(4);             /* number of samples */
+
+	/* Flow sample: Ethernet + 802.1Q + IPv4 + TCP header */
+	sample = wopen(1);
+	w32(1); w32(3); w32(100); w32(1000); w32(0); w32(3); w32(5); w32(4);
+
+	static const uint8_t header4[58] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+		0x81, 0x00, 0x00, 0x64, 0x08, 0x00,
+		0x45, 0x10, 0x00, 0x3c, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,
+		192, 168, 1, 1, 192, 168, 1, 2,
+		0x04, 0xd2, 0x00, 0x50, 0, 0, 0, 1, 0, 0, 0, 0, 0x50, 0x12, 0xff, 0xff, 0, 0, 0, 0
+	};
+	record = wopen(1);
+	w32(1); w32(82); w32(4); w32(sizeof(header4));
+	wbytes(header4, sizeof(header4));
+	wclose(record);
+
+	record = wopen(1001);
+	w32(100); w32(0); w32(200); w32(0);
+	wclose(record);
+
+	record = wopen(1002);
+	w32(1); w32(0x0a0000fe); w32(24); w32(16);
+	wclose(record);
+
+	record = wopen(1003);
+	w32(1); w32(0x0a0000fe); w32(65000); w32(64512); w32(64513);
+	w32(1); w32(2); w32(3); w32(100); w32(200); w32(300);
+	w32(0); w32(100);
+	wclose(record);
+	wclose(sample);
+
+	/* Expanded flow sample: IPv6 + UDP header */
+	sample = wopen(3);
+	w32(2); w32(0); w32(4); w32(50); w32(500); w32(0); w32(0); w32(4); w32(0); w32(6); w32(1);
+
+	static const uint8_t header6[48] = {
+		0x60, 0x20, 0x00, 0x00, 0x00, 0x08, 17, 32,
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2,
+		0x14, 0xe9, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00
+	};
+	record = wopen(1);
+	w32(12); w32(100); w32(0); w32(sizeof(header6));
+	wbytes(header6, sizeof(header6));
+	wclose(record);
+	wclose(sample);
+
+	/* Counter sample with generic interface counters */
+	sample = wopen(2);
+	w32(3); w32(3); w32(1);
+	record = wopen(1);
+	wbytes(generic_counters, sizeof(generic_counters));
+	wclose(record);
+	wclose(sample);
+
+	/* Unknown sample is skipped */
+	sample = wopen((4300 << 12) | 1);
+	w32(0xdeadbeef);
+	wclose(sample);
+}
+
+static void test_conversion()
+{
+	static uint8_t out[BUFF_LEN];
+	struct sflow_ipfix_params params = {1000000, 42, 1, 0};
+
+	int len = sflow_to_ipfix(datagram, dlen, out, sizeof(out), &params);
+	CHECK(len == IPFIX_HEADER_LENGTH + TEMPLATES_LEN + 4 + FLOW4_LEN + 4 + FLOW6_LEN + 4 + COUNTERS_LEN);
+	CHECK(params.records == 3);
+	if (len <= 0) {
+		return;
+	}
+
+	CHECK(r16(out) == IPFIX_VERSION);
+	CHECK(r16(out + 2) == len);
+	CHECK(r32(out + 4) == 1000000);
+	CHECK(r32(out + 8) == 42);
+	CHECK(r32(out + 12) == 7);
+
+	/* Template Set */
+	const uint8_t *p = out + IPFIX_HEADER_LENGTH;
+	CHECK(r16(p) == IPFIX_TEMPLATE_FLOWSET_ID);
+	CHECK(r16(p + 2) == TEMPLATES_LEN);
+	CHECK(r16(p + 4) == SFLOW_IPFIX_FLOW4_TEMPLATE);
+	CHECK(r16(p + 104) == SFLOW_IPFIX_FLOW6_TEMPLATE);
+	CHECK(r16(p + 204) == SFLOW_IPFIX_COUNTERS_TEMPLATE);
+	CHECK(r16(p + 208) == (0x8000 | 1));
+	CHECK(r32(p + 212) == SFLOW_IPFIX_ENTERPRISE);
+	p += TEMPLATES_LEN;
+
+	/* IPv4 flow */
+	CHECK(r16(p) == SFLOW_IPFIX_FLOW4_TEMPLATE);
+	CHECK(r16(p + 2) == 4 + FLOW4_LEN);
+	const uint8_t *r = p + 4;
+	CHECK(r32(r) == 0xc0a80101);
+	CHECK(r32(r + 4) == 0xc0a80102);
+	CHECK(r32(r + 8) == 0x0a0000fe);
+	CHECK(r32(r + 12) == 3);
+	CHECK(r32(r + 16) == 5);
+	CHECK(r64(r + 20) == 100);
+	CHECK(r64(r + 28) == 100 * 60);
+	CHECK(r64(r + 36) == 1000000000ULL);
+	CHECK(r16(r + 52) == 1234);
+	CHECK(r16(r + 54) == 80);
+	CHECK(r[56] == 0x12);
+	CHECK(r[57] == 6);
+	CHECK(r[58] == 0x10);
+	CHECK(r[59] == 64);
+	CHECK(r32(r + 60) == 64512);
+	CHECK(r32(r + 64) == 300);
+	CHECK(r[68] == 24);
+	CHECK(r[69] == 16);
+	CHECK(r16(r + 70) == 100);
+	CHECK(r16(r + 72) == 200);
+	CHECK(memcmp(r + 74, "\x66\x77\x88\x99\xaa\xbb", 6) == 0);
+	CHECK(memcmp(r + 80, "\x00\x11\x22\x33\x44\x55", 6) == 0);
+	CHECK(r32(r + 86) == 100);
+	p += 4 + FLOW4_LEN;
+
+	/* IPv6 flow */
+	CHECK(r16(p) == SFLOW_IPFIX_FLOW6_TEMPLATE);
+	r = p + 4;
+	CHECK(r32(r) == 0x20010db8 && r32(r + 12) == 1);
+	CHECK(r32(r + 16) == 0x20010db8 && r32(r + 28) == 2);
+	CHECK(r32(r + 48) == 4);
+	CHECK(r32(r + 52) == 6);
+	CHECK(r64(r + 56) == 50);
+	CHECK(r64(r + 64) == 50 * 100);
+	CHECK(r16(r + 88) == 5353);
+	CHECK(r16(r + 90) == 53);
+	CHECK(r[93] == 17);
+	CHECK(r[94] == 0x02);
+	CHECK(r[95] == 32);
+	p += 4 + FLOW6_LEN;
+
+	/* Counters */
+	CHECK(r16(p) == SFLOW_IPFIX_COUNTERS_TEMPLATE);
+	CHECK(memcmp(p + 4, generic_counters, sizeof(generic_counters)) == 0);
+	CHECK(r64(p + 4 + 88) == 1000000000ULL);
+
+	/* Without templates and with too small buffer only the first flow fits */
+	params.with_templates = 0;
+	len = sflow_to_ipfix(datagram, dlen, out, IPFIX_HEADER_LENGTH + 4 + FLOW4_LEN + 4, &params);
+	CHECK(len == IPFIX_HEADER_LENGTH + 4 + FLOW4_LEN);
+	CHECK(params.records == 1);
+
+	/* Truncated datagrams must not be read beyond their end */
+	for (size_t cut = 0; cut < dlen; ++cut) {
+		uint8_t *copy = malloc(cut + 1);
+		memcpy(copy, datagram, cut);
+		len = sflow_to_ipfix(copy, cut, out, sizeof(out), &params);
+		CHECK(len == CONVERSION_ERROR || len == SFLOW_IPFIX_UNSUPPORTED || len >= IPFIX_HEADER_LENGTH);
+		free(copy);
+	}
+
+	/* Other versions are left to the original conversion */
+	uint32_t version = htonl(4);
+	memcpy(datagram, &version, 4);
+	CHECK(sflow_to_ipfix(datagram, dlen, out, sizeof(out), &params) == SFLOW_IPFIX_UNSUPPORTED);
+	version = htonl(5);
+	memcpy(datagram, &version, 4);
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Compare direct conversion with the Netflow v5-like path */
+static void benchmark()
+{
+	static uint8_t buffer[BUFF_LEN], out[BUFF_LEN];
+	struct sflow_ipfix_params params = {1000000, 0, 0, 0};
+	struct timespec start;
+	unsigned long records = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ITERATIONS; ++i) {
+		memcpy(buffer, datagram, dlen);
+		records += Process_sflow(buffer, dlen);
+	}
+	double old = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ITERATIONS; ++i) {
+		memcpy(buffer, datagram, dlen);
+		sflow_to_ipfix(buffer, dlen, out, sizeof(out), &params);
+		records += params.records;
+	}
+	double direct = elapsed(&start);
+
+	printf("Netflow v5 path: %.0f ns/datagram\n", old * 1e9 / ITERATIONS);
+	printf("direct path:     %.0f ns/datagram (%lu records)\n", direct * 1e9 / ITERATIONS, records);
+}
+
+int main(int argc, char **argv)
+{
+	build_datagram();
+	test_conversion();
+
+	if (argc < 2 || strcmp(argv[1], "-n") != 0) {
+		benchmark();
+	}
+
+	printf("%s\n", errors ? "FAILED" : "OK");
+	return errors != 0;
+}
@@ -0,0 +1,287 @@
+/**
+ * \file spool_test.c
+ * \brief Test of the write-ahead spool
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <ipfixcol.h>
+#include "../../src/spool.h"
+
+#define MAX_SIZE (2 << 20) // Size limit of the spool (two segments)
+#define RECORDS 3          // Data Records in a message
+
+static const char *dir = "/dev/shm/spool_test"; // tmpfs by default
+
+static struct ipfix_template *templ;
+static struct input_info_network info;
+static int errors = 0;
+
+/* Profile trees before spooling and on replay with their lists of channels */
+static int old_profile, profile;
+static void *old_channels[1], *channels[1];
+
+/* Functions of the collector used by the spool */
+void message_release(struct ipfix_message *msg)
+{
+	if (msg->data_couple[0].data_template->references > 0) {
+		msg->data_couple[0].data_template->references--;
+	}
+	free(msg->pkt_header);
+	free(msg->metadata);
+	free(msg);
+}
+
+void **profile_match_data(void *p, struct ipfix_message *msg, struct metadata *mdata)
+{
+	return (p == &profile && msg->live_profile == &profile && mdata->record.record) ? channels : NULL;
+}
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check '%s' failed\n", __FILE__, __LINE__, #cond); \
+		errors++; \
+	} \
+} while (0)
+
+/* Message with a Data Set of RECORDS records and an empty Template Set;
+ * metadata: 0 = none, 1 = without channels, 2 = profiled */
+static struct ipfix_message *create_message(uint32_t seq, int metadata)
+{
+	int len = IPFIX_HEADER_LENGTH + 4 + RECORDS * 12 + 4;
+	uint8_t *packet = calloc(1, len), *data = packet + IPFIX_HEADER_LENGTH;
+	struct ipfix_header *header = (struct ipfix_header *) packet;
+	struct ipfix_set_header *set;
+	struct ipfix_message *msg;
+	int i;
+
+	header->version = htons(IPFIX_VERSION);
+	header->length = htons(len);
+	header->sequence_number = htonl(seq);
+
+	set = (struct ipfix_set_header *) data;
+	set->flowset_id = htons(256);
+	set->length = htons(4 + RECORDS * 12);
+	for (i = 0; i < RECORDS; i++) {
+		memcpy(data + 4 + 12 * i, &seq, sizeof(seq));
+	}
+
+	set = (struct ipfix_set_header *) (data + 4 + RECORDS * 12);
+	set->flowset_id = htons(IPFIX_TEMPLATE_FLOWSET_ID);
+	set->length = htons(4);
+
+	msg = calloc(1, sizeof(struct ipfix_message));
+	msg->pkt_header = header;
+	msg->input_info = (struct input_info *) &info;
+	msg->source_status = SOURCE_STATUS_OPENED;
+	msg->data_records_count = RECORDS;
+	msg->data_couple[0].data_set = (struct ipfix_data_set *) data;
+	msg->data_couple[0].data_template = templ;
+	templ->references++;
+
+	if (metadata) {
+		msg->metadata = calloc(RECORDS, sizeof(struct metadata));
+		for (i = 0; i < RECORDS; i++) {
+			msg->metadata[i].record.record = data + 4 + 12 * i;
+			msg->metadata[i].record.length = 12;
+			msg->metadata[i].record.templ = templ;
+			msg->metadata[i].srcAS = seq;
+			if (metadata == 2) {
+				msg->metadata[i].channels = old_channels;
+			}
+		}
+		msg->live_profile = &old_profile;
+	}
+
+	return msg;
+}
+
+/* Check replayed message, return its sequence number */
+static uint32_t check_message(struct ipfix_message *msg)
+{
+	uint32_t seq = ntohl(msg->pkt_header->sequence_number);
+	struct ipfix_template *snapshot = msg->data_couple[0].data_template;
+
+	CHECK(snapshot && snapshot != templ && snapshot->template_id == 256 && snapshot->references == 0);
+	CHECK(memcmp(msg->data_couple[0].data_set->records + 12 * (RECORDS - 1), &seq, sizeof(seq)) == 0);
+	CHECK(msg->templ_set[0] && ntohs(msg->templ_set[0]->header.flowset_id) == IPFIX_TEMPLATE_FLOWSET_ID);
+	CHECK(msg->input_info && msg->input_info->odid == info.odid
+			&& ((struct input_info_network *) msg->input_info)->src_port == info.src_port);
+	if (msg->metadata) {
+		CHECK(msg->metadata[RECORDS - 1].srcAS == seq);
+		CHECK(msg->metadata[RECORDS - 1].record.templ == snapshot);
+		CHECK(msg->metadata[0].record.record == msg->data_couple[0].data_set->records);
+		/* Channels are matched against the current profiles */
+		CHECK(msg->metadata[RECORDS - 1].channels == ((seq % 3 == 2) ? channels : NULL));
+	}
+	CHECK(msg->live_profile == &profile);
+
+	free(msg->pkt_header);
+	free(msg->metadata);
+	free(msg);
+	return seq;
+}
+
+/* Replay the whole spool, messages first..last are expected */
+static void replay(uint32_t first, uint32_t last)
+{
+	struct spool *spool = spool_open(dir, MAX_SIZE);
+	struct ipfix_message *msg;
+	uint32_t expected = first;
+
+	CHECK(spool != NULL);
+	if (!spool) {
+		return;
+	}
+
+	while (!spool_empty(spool)) {
+		msg = spool_read(spool, &profile);
+		if (msg) {
+			CHECK(check_message(msg) == expected);
+			expected++;
+		}
+	}
+
+	CHECK(expected == last + 1);
+	printf("Replayed %u messages\n", expected - first);
+	spool_close(spool);
+}
+
+/* Spool is filled, partly read and closed; the rest is replayed later */
+static void test_restart(void)
+{
+	struct spool *spool = spool_open(dir, MAX_SIZE);
+	struct ipfix_message *msg;
+	uint32_t count = 0, i;
+	int ret;
+
+	CHECK(spool != NULL);
+	if (!spool) {
+		return;
+	}
+
+	/* Second spool in the same directory is refused */
+	CHECK(spool_open(dir, MAX_SIZE) == NULL);
+
+	while ((ret = spool_append(spool, msg = create_message(count, count % 3))) == 0) {
+		count++;
+	}
+	CHECK(ret == SPOOL_FULL);
+	CHECK(templ->references == 1);
+	free(msg->pkt_header);
+	free(msg->metadata);
+	free(msg);
+	templ->references = 0;
+	printf("Spooled %u messages (%llu bytes)\n", count, (unsigned long long) spool_size(spool));
+
+	for (i = 0; i < count / 2; i++) {
+		msg = spool_read(spool, &profile);
+		CHECK(msg && check_message(msg) == i);
+	}
+
+	/* Space of read segments is released */
+	CHECK(spool_append(spool, create_message(count, 0)) == 0);
+	spool_close(spool);
+
+	replay(count / 2, count);
+}
+
+/* Collector crashes while writing a record */
+static void test_crash(void)
+{
+	struct spool *spool;
+	char cmd[1024];
+	pid_t pid;
+	int i;
+
+	pid = fork();
+	if (pid == 0) {
+		spool = spool_open(dir, MAX_SIZE);
+		if (!spool) {
+			_exit(1);
+		}
+		for (i = 0; i < 5000; i++) {
+			spool_append(spool, create_message(i, 0));
+		}
+		for (i = 0; i < 1000; i++) {
+			check_message(spool_read(spool, &profile));
+		}
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+
+	/* Last record is incomplete */
+	snprintf(cmd, sizeof(cmd), "truncate -s -20 $(ls %s/*.spool | tail -n 1)", dir);
+	CHECK(system(cmd) == 0);
+
+	/* Messages after the last checkpoint are replayed again */
+	replay(1000 / 256 * 256, 4998);
+}
+
+int main(int argc, char **argv)
+{
+	char cmd[1024];
+
+	if (argc > 1) {
+		dir = argv[1];
+	}
+
+	templ = calloc(1, sizeof(struct ipfix_template) + 2 * sizeof(template_ie));
+	templ->template_id = 256;
+	templ->field_count = 3;
+	templ->template_length = sizeof(struct ipfix_template) + 2 * sizeof(template_ie);
+	templ->data_length = 12;
+
+	info.type = SOURCE_TYPE_UDP;
+	info.odid = 7;
+	info.src_port = 4739;
+
+	test_restart();
+	test_crash();
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0) {
+		errors++;
+	}
+	free(templ);
+
+	printf("%s\n", errors ? "FAILED" : "OK");
+	return errors != 0;
+}
@@ -0,0 +1,220 @@
+/**
+ * \file storage_io_test.c
+ * \brief Test of asynchronous file writes
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ipfixcol.h>
+
+#define WRITE_COUNT 10000 // Number of writes per run
+#define WRITE_SIZE 1000   // Size of one write
+#define CHUNK_COUNT 4     // Number of registered buffers
+
+static const char *path = "/dev/shm/storage_io_test"; // tmpfs by default
+
+static volatile long written = 0;
+static volatile long fsyncs = 0;
+static volatile long errors = 0;
+
+static void write_done(int result, void *user)
+{
+	if (result != (int) (uintptr_t) user) {
+		__sync_fetch_and_add(&errors, 1);
+		return;
+	}
+	__sync_fetch_and_add(&written, result);
+}
+
+static void fsync_done(int result, void *user)
+{
+	(void) user;
+	if (result != 0) {
+		__sync_fetch_and_add(&errors, 1);
+		return;
+	}
+	__sync_fetch_and_add(&fsyncs, 1);
+}
+
+/* Byte at given file offset */
+static uint8_t pattern(off_t offset)
+{
+	return (uint8_t) ((offset * 7) ^ (offset >> 9));
+}
+
+static int check_file(int fd, off_t size)
+{
+	uint8_t buf[4096];
+	off_t pos = 0;
+	ssize_t ret;
+
+	if (lseek(fd, 0, SEEK_END) != size) {
+		fprintf(stderr, "Unexpected file size\n");
+		return 1;
+	}
+
+	while ((ret = pread(fd, buf, sizeof(buf), pos)) > 0) {
+		for (ssize_t i = 0; i < ret; i++) {
+			if (buf[i] != pattern(pos + i)) {
+				fprintf(stderr, "Wrong data at offset %ld\n", (long) (pos + i));
+				return 1;
+			}
+		}
+		pos += ret;
+	}
+
+	return pos != size;
+}
+
+static int run(int flags)
+{
+	struct storage_io *io;
+	uint8_t *data, *chunks;
+	struct iovec iov[CHUNK_COUNT];
+	off_t offset = 0;
+	int fd, i, ret;
+
+	written = fsyncs = errors = 0;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		perror("open");
+		return 1;
+	}
+
+	io = storage_io_create(16, 4, flags);
+	if (!io) {
+		close(fd);
+		return 1;
+	}
+	printf("Backend: %s\n", storage_io_backend(io) == STORAGE_IO_BACKEND_URING ? "io_uring" : "threads");
+
+	/* Plain writes of a buffer that stays valid until completion */
+	data = malloc((size_t) WRITE_COUNT * WRITE_SIZE);
+	chunks = malloc(CHUNK_COUNT * WRITE_SIZE);
+	for (i = 0; i < WRITE_COUNT * WRITE_SIZE; i++) {
+		data[i] = pattern(i);
+	}
+
+	for (i = 0; i < WRITE_COUNT; i++) {
+		if (storage_io_write(io, fd, data + offset, WRITE_SIZE, offset, write_done,
+				(void *) (uintptr_t) WRITE_SIZE) != 0) {
+			errors++;
+		}
+		offset += WRITE_SIZE;
+
+		/* Repeated fsyncs are merged while buffered */
+		if (i % 1000 == 999) {
+			storage_io_fsync(io, fd, fsync_done, NULL);
+			storage_io_fsync(io, fd, fsync_done, NULL);
+		}
+	}
+
+	/* Writes from registered buffers, each reused only after its completion */
+	for (i = 0; i < CHUNK_COUNT; i++) {
+		iov[i].iov_base = chunks + i * WRITE_SIZE;
+		iov[i].iov_len = WRITE_SIZE;
+	}
+	if (storage_io_register_buffers(io, iov, CHUNK_COUNT) != 0) {
+		/* Requests are pending, registration has to wait for flush */
+		storage_io_flush(io);
+		if (storage_io_register_buffers(io, iov, CHUNK_COUNT) != 0) {
+			errors++;
+		}
+	}
+
+	for (i = 0; i < CHUNK_COUNT * 100; i++) {
+		uint8_t *chunk = chunks + (i % CHUNK_COUNT) * WRITE_SIZE;
+
+		if (i >= CHUNK_COUNT && i % CHUNK_COUNT == 0) {
+			storage_io_flush(io);
+		}
+		for (int j = 0; j < WRITE_SIZE; j++) {
+			chunk[j] = pattern(offset + j);
+		}
+		if (storage_io_write_fixed(io, fd, i % CHUNK_COUNT, chunk, WRITE_SIZE, offset,
+				write_done, (void *) (uintptr_t) WRITE_SIZE) != 0) {
+			errors++;
+		}
+		offset += WRITE_SIZE;
+	}
+
+	/* Buffer outside registered range is refused */
+	if (storage_io_write_fixed(io, fd, 0, data, WRITE_SIZE, 0, write_done, NULL) == 0) {
+		errors++;
+	}
+
+	storage_io_fsync(io, fd, fsync_done, NULL);
+	storage_io_destroy(io);
+
+	ret = errors != 0;
+	if (written != offset) {
+		fprintf(stderr, "Written %ld of %ld bytes\n", written, (long) offset);
+		ret = 1;
+	}
+	if (fsyncs != WRITE_COUNT / 1000 * 2 + 1) {
+		fprintf(stderr, "Completed %ld fsyncs\n", fsyncs);
+		ret = 1;
+	}
+	if (check_file(fd, offset) != 0) {
+		ret = 1;
+	}
+
+	close(fd);
+	unlink(path);
+	free(data);
+	free(chunks);
+
+	printf("%s\n", ret ? "FAILED" : "OK");
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+
+	if (argc > 1) {
+		path = argv[1];
+	}
+
+	ret |= run(0);
+	ret |= run(STORAGE_IO_NO_URING);
+
+	return ret;
+}
@@ -50,6 +50,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_RECORDS);
+
 /* Identifier for verbose macros */
 static const char *msg_module = "dhcp";
 
@@ -319,8 +322,8 @@ int intermediate_process_message(void* config, void* message)
 	struct ipfix_message *msg = (struct ipfix_message *) message;
 	struct metadata *mdata;
 	
-	/* Process each data record */
-	for (int i = 0; i < msg->data_records_count; ++i) {
+	/* Process each data record (no metadata before the plugin was loaded) */
+	for (int i = 0; msg->metadata && i < msg->data_records_count; ++i) {
 		mdata = &(msg->metadata[i]);
 
 		/* Replace MACs from database */
@@ -73,6 +73,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 uint32_t input_calculate_crc32(struct input_info *input)
 {
     if (input->type == SOURCE_TYPE_IPFIX_FILE) {
@@ -306,14 +309,167 @@ int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfi
 }
 
 /**
- *  \brief Initialize intermediate Plugin
+ * \brief Retrieves OD statistics for a tuple of ODID and exporter IP address.
  *
- * \param[in] params configuration xml for the plugin
- * \param[in] ip_config configuration structure of corresponding intermediate process
- * \param[in] ip_id source ID into template manager for creating templates
- * \param[in] template_mgr collector's Template Manager
- * \param[out] config configuration structure
- * \return 0 on success, negative value otherwise
+ * \param[in] conf Plugin configuration
+ * \param[in] odid Observation Domain ID
+ * \param[in] exporter_ip_addr_crc CRC32 of exporter IP address
+ * \return OD statistics if available, NULL otherwise
+ */
+static struct od_stats_elem_t *od_stats_find(struct httpfieldmerge_config *conf, uint32_t odid, uint32_t exporter_ip_addr_crc)
+{
+    struct od_stats_key_t od_stats_key;
+    struct od_stats_elem_t *od_stat;
+
+    memset(&od_stats_key, 0, sizeof(od_stats_key));
+    od_stats_key.od_id = odid;
+    od_stats_key.exporter_ip_addr_crc = exporter_ip_addr_crc;
+
+    HASH_FIND(hh, conf->od_stats, &od_stats_key.od_id, conf->od_stats_key_len, od_stat);
+    return od_stat;
+}
+
+/**
+ * \brief Retrieves the rewritten template that corresponds to a template received from
+ * the exporter.
+ *
+ * The mapping is cached per tuple of ODID, exporter IP address and template ID, such
+ * that the template manager has to be queried only once after (re)definition of a template.
+ *
+ * \param[in] proc Processing structure
+ * \param[in] templ Template received from the exporter
+ * \return Rewritten template, or 'templ' in case template was not modified by this plugin
+ */
+static struct ipfix_template *templ_stats_mapping(struct httpfieldmerge_processor *proc, struct ipfix_template *templ)
+{
+    struct httpfieldmerge_config *conf = proc->plugin_conf;
+    struct templ_stats_key_t templ_stats_key;
+    struct templ_stats_elem_t *templ_stats;
+
+    memset(&templ_stats_key, 0, sizeof(templ_stats_key));
+    templ_stats_key.od_id = proc->odid;
+    templ_stats_key.exporter_ip_addr_crc = proc->exporter_ip_addr_crc;
+    templ_stats_key.templ_id = templ->template_id;
+
+    HASH_FIND(hh, conf->templ_stats, &templ_stats_key.od_id, conf->templ_stats_key_len, templ_stats);
+    if (templ_stats == NULL || templ_stats->http_fields_pen == 0 || templ_stats->http_fields_pen == TARGET_PEN) {
+        return templ;
+    }
+
+    if (templ_stats->templ == NULL) {
+        proc->key->tid = templ->template_id;
+        templ_stats->templ = tm_get_template(conf->tm, proc->key);
+        if (templ_stats->templ == NULL) {
+            /* Assume that template was not modified by this plugin if new template was not registered in template manager */
+            return templ;
+        }
+    }
+
+    return templ_stats->templ;
+}
+
+/**
+ * \brief Forgets cached template mappings of an Observation Domain.
+ *
+ * Templates of an ODID are removed from the template manager once the last source
+ * with that ODID has been closed, so cached pointers must not be used anymore.
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] odid Observation Domain ID
+ */
+static void templ_stats_invalidate(struct httpfieldmerge_config *conf, uint32_t odid)
+{
+    struct templ_stats_elem_t *templ_stats, *templ_tmp;
+    HASH_ITER(hh, conf->templ_stats, templ_stats, templ_tmp) {
+        if (templ_stats->od_id == odid) {
+            templ_stats->templ = NULL;
+        }
+    }
+}
+
+/**
+ * \brief Replaces templates of data sets by rewritten templates, without touching
+ * the data records.
+ *
+ * Data sets remain in the original packet buffer, so the costs are proportional to the
+ * number of data sets rather than the number of data records. Metadata of the records
+ * are updated to point to the new templates.
+ *
+ * \param[in] proc Processing structure
+ * \param[in,out] msg IPFIX message
+ */
+static void share_data_sets(struct httpfieldmerge_processor *proc, struct ipfix_message *msg)
+{
+    struct ipfix_template *templ, *new_templ;
+    uint8_t *set_end = NULL;
+    uint16_t i, modified = 0;
+    uint32_t rec;
+
+    for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+        templ = msg->data_couple[i].data_template;
+
+        /* Skip processing in case there is no template available for this data set. This may
+         * be caused by a problem in a previous intermediate plugin.
+         */
+        if (!templ) {
+            continue;
+        }
+
+        new_templ = templ_stats_mapping(proc, templ);
+        if (new_templ == templ) {
+            continue;
+        }
+
+        /* Move the reference from the original template to the new one */
+        new_templ->last_message = templ->last_message;
+        new_templ->last_transmission = templ->last_transmission;
+        tm_template_reference_inc(new_templ);
+        tm_template_reference_dec(templ);
+
+        msg->data_couple[i].data_template = new_templ;
+        msg->data_couple[i].data_set->header.flowset_id = htons(new_templ->template_id);
+        ++modified;
+    }
+
+    if (modified == 0 || msg->metadata == NULL) {
+        return;
+    }
+
+    /* Metadata have been filled in the order of data sets, so they can be matched
+     * with data couples in a single pass
+     */
+    i = 0;
+    for (rec = 0; rec < msg->data_records_count; ++rec) {
+        uint8_t *rec_ptr = (uint8_t *) msg->metadata[rec].record.record;
+
+        while (i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set) {
+            set_end = (uint8_t *) msg->data_couple[i].data_set + ntohs(msg->data_couple[i].data_set->header.length);
+            if (rec_ptr >= (uint8_t *) msg->data_couple[i].data_set && rec_ptr < set_end) {
+                break;
+            }
+
+            ++i;
+        }
+
+        if (i == MSG_MAX_DATA_COUPLES || msg->data_couple[i].data_set == NULL) {
+            break;
+        }
+
+        msg->metadata[rec].record.templ = msg->data_couple[i].data_template;
+    }
+}
+
+/**
+ * \brief Process IPFIX message
+ *
+ * Templates are always rewritten within the original message, since only IE IDs and PENs
+ * are replaced. Data sets are shared with the original message, unless the data records
+ * of the exporter have to be modified as well (Cisco, ntop); a new message is composed
+ * only in that case.
+ *
+ * \param[in] config Plugin configuration
+ * \param[in] message IPFIX message
+ * \return 0 on success, nonzero otherwise
  */
 int intermediate_process_message(void *config, void *message)
 {
@@ -321,7 +477,7 @@ int intermediate_process_message(void *config, void *message)
     struct httpfieldmerge_processor proc;
     struct ipfix_message *msg, *new_msg;
     struct ipfix_template *templ, *new_templ;
-    uint16_t prev_offset;
+    struct od_stats_elem_t *od_stat;
     uint32_t tsets = 0, otsets = 0;
     uint16_t i, new_i;
 
@@ -331,6 +487,7 @@ int intermediate_process_message(void *config, void *message)
     /* Check whether source was closed */
     if (msg->source_status == SOURCE_STATUS_CLOSED) {
         // MSG_WARNING(msg_module, "Source closed; skipping IPFIX message...");
+        templ_stats_invalidate(conf, msg->input_info->odid);
         pass_message(conf->ip_config, msg);
         return 0;
     }
@@ -360,119 +517,94 @@ int intermediate_process_message(void *config, void *message)
         return 0;
     }
 
-    /* Allocate memory for new message */
-    uint16_t new_msg_length = old_msg_length;
-    proc.allocated_msg_len = new_msg_length;
-    proc.msg = calloc(1, new_msg_length);
-    if (!proc.msg) {
-        MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-        return 1;
-    }
-
-    /* Allocate memory for new IPFIX message */
-    new_msg = calloc(1, sizeof(struct ipfix_message));
-    if (!new_msg) {
-        MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-        free(proc.msg);
-        return 1;
-    }
-
-    /* Copy original IPFIX header */
-    memcpy(proc.msg, msg->pkt_header, IPFIX_HEADER_LENGTH);
-    new_msg->pkt_header = (struct ipfix_header *) proc.msg;
-    proc.offset = IPFIX_HEADER_LENGTH;
-
     /* Calculate CRC32 of exporter IP address */
     uint32_t exporter_ip_addr_crc = input_calculate_crc32(msg->input_info);
 
     /* Initialize processing structure */
+    memset(&proc, 0, sizeof(proc));
     proc.exporter_ip_addr_crc = exporter_ip_addr_crc;
     proc.odid = msg->input_info->odid;
     proc.key = tm_key_create(msg->input_info->odid, exporter_ip_addr_crc, 0); /* Template ID (0) will be overwritten in a later stage */
     proc.plugin_conf = config;
 
-    /* Process template sets */
+    /* Process template sets; template records are rewritten within the original message */
     proc.type = TM_TEMPLATE;
     for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
         if (i == 0) {
             MSG_DEBUG(msg_module, "[%u] Processing template sets...", msg->input_info->odid);
         }
 
-        prev_offset = proc.offset;
-
         /* Determine IP versions used within each template set and store result in hashmap. Also,
          * determine exporter PEN based on presence of certain enterprise-specific IEs.
          */
         template_set_process_records(msg->templ_set[i], proc.type, &templates_stat_processor, (void *) &proc);
 
-        /* Prepare OD statistics hashmap lookup key */
-        struct od_stats_key_t *od_stats_key = calloc(1, proc.plugin_conf->od_stats_key_len);
-        if (!od_stats_key) {
-            MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-            free(proc.key);
-            free(proc.msg);
-            free(new_msg);
-            return 1;
+        /* Process template set records; select processor based on PEN */
+        od_stat = od_stats_find(conf, proc.odid, exporter_ip_addr_crc);
+        if (od_stat != NULL && od_stat->tset_proc != NULL) {
+            template_set_process_records(msg->templ_set[i], proc.type, od_stat->tset_proc, (void *) &proc);
         }
+    }
 
-        /* Set key values */
-        od_stats_key->od_id = proc.odid;
-        od_stats_key->exporter_ip_addr_crc = exporter_ip_addr_crc;
+    /* Data records are left untouched for most vendors, so only templates have to be replaced */
+    od_stat = od_stats_find(conf, proc.odid, exporter_ip_addr_crc);
+    if (od_stat == NULL || od_stat->dset_proc == NULL) {
+        share_data_sets(&proc, msg);
+        free(proc.key);
 
-        /* Retrieve OD statistics from hashmap */
-        struct od_stats_elem_t *od_stat;
-        HASH_FIND(hh, proc.plugin_conf->od_stats, &od_stats_key->od_id, proc.plugin_conf->od_stats_key_len, od_stat);
-        if (od_stat == NULL || od_stat->tset_proc == NULL) {
-            /* Copy full template set to new message */
-            uint16_t set_len = ntohs(msg->templ_set[i]->header.length);
-            memcpy(proc.msg + proc.offset, msg->templ_set[i], set_len);
-            proc.offset += set_len;
-            proc.length = set_len;
-        } else {
-            /* Add template set header, and update offset and length */
-            memcpy(proc.msg + proc.offset, &(msg->templ_set[i]->header), sizeof(struct ipfix_set_header));
-            proc.offset += 4;
-            proc.length = 4;
-
-            /* Process template set records; select processor based on PEN */
-            template_set_process_records(msg->templ_set[i], proc.type, od_stat->tset_proc, (void *) &proc);
-        }
+        pass_message(conf->ip_config, msg);
+        return 0;
+    }
 
-        free(od_stats_key);
+    /* Allocate memory for new message */
+    uint16_t new_msg_length = old_msg_length;
+    proc.allocated_msg_len = new_msg_length;
+    proc.msg = calloc(1, new_msg_length);
+    if (!proc.msg) {
+        MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+        free(proc.key);
+        return 1;
+    }
+
+    /* Allocate memory for new IPFIX message */
+    new_msg = calloc(1, sizeof(struct ipfix_message));
+    if (!new_msg) {
+        MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+        free(proc.key);
+        free(proc.msg);
+        return 1;
+    }
+
+    /* Copy original IPFIX header */
+    memcpy(proc.msg, msg->pkt_header, IPFIX_HEADER_LENGTH);
+    new_msg->pkt_header = (struct ipfix_header *) proc.msg;
+    proc.offset = IPFIX_HEADER_LENGTH;
 
-        /* Check whether a new template set was added by template record processor */
-        if (proc.offset == prev_offset + 4) { /* No new template set record was added */
-            proc.offset = prev_offset;
-        } else { /* New template set was added; add it to data structure as well */
-            new_msg->templ_set[tsets] = (struct ipfix_template_set *) ((uint8_t *) proc.msg + prev_offset);
-            new_msg->templ_set[tsets]->header.length = htons(proc.length);
-            tsets++;
+    /* Copy (already rewritten) template sets */
+    for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
+        uint16_t set_len = ntohs(msg->templ_set[i]->header.length);
+        if (set_len <= sizeof(struct ipfix_set_header)) {
+            continue;
         }
+
+        memcpy(proc.msg + proc.offset, msg->templ_set[i], set_len);
+        new_msg->templ_set[tsets++] = (struct ipfix_template_set *) ((uint8_t *) proc.msg + proc.offset);
+        proc.offset += set_len;
     }
 
     /* Demarcate end of templates in set */
     new_msg->templ_set[tsets] = NULL;
 
     /* Process option template sets; only copy existing records */
-    // MSG_DEBUG(msg_module, "Processing option template sets...");
-    proc.type = TM_OPTIONS_TEMPLATE;
     for (i = 0; i < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[i]; ++i) {
-        prev_offset = proc.offset;
-
-        /* Copy full option template set to new message */
         uint16_t set_len = ntohs(msg->opt_templ_set[i]->header.length);
+        if (set_len <= sizeof(struct ipfix_set_header)) {
+            continue;
+        }
+
         memcpy(proc.msg + proc.offset, msg->opt_templ_set[i], set_len);
+        new_msg->opt_templ_set[otsets++] = (struct ipfix_options_template_set *) ((uint8_t *) proc.msg + proc.offset);
         proc.offset += set_len;
-        proc.length = set_len;
-
-        /* Check whether a new options template set was added by 'other_template_rec_processor' */
-        if (proc.offset == prev_offset + 4) {
-            proc.offset = prev_offset;
-        } else { /* New options template set was added; add it to data structure as well */
-            new_msg->opt_templ_set[otsets] = (struct ipfix_options_template_set *) ((uint8_t *) proc.msg + prev_offset);
-            new_msg->opt_templ_set[otsets]->header.length = htons(proc.length);
-            otsets++;
-        }
     }
 
     /* Demarcate end of option templates in set */
@@ -493,13 +625,7 @@ int intermediate_process_message(void *config, void *message)
             continue;
         }
 
-        proc.key->tid = templ->template_id;
-        new_templ = tm_get_template(conf->tm, proc.key);
-        if (!new_templ) {
-            // MSG_ERROR(msg_module, "Could not retrieve template from template manager (ODID: %u, IP ID: %u, template ID: %u)", info->odid, conf->ip_id, templ->template_id);
-            /* Assume that template was not modified by this plugin if new template was not registered in template manager */
-            new_templ = templ;
-        }
+        new_templ = templ_stats_mapping(&proc, templ);
 
         /* Add data set header, and update offset and length */
         memcpy(proc.msg + proc.offset, &(msg->data_couple[i].data_set->header), sizeof(struct ipfix_set_header));
@@ -515,35 +641,8 @@ int intermediate_process_message(void *config, void *message)
         new_templ->last_transmission = templ->last_transmission;
         tm_template_reference_inc(new_templ);
 
-        /* Prepare OD statistics hashmap lookup key */
-        struct od_stats_key_t *od_stats_key = calloc(1, proc.plugin_conf->od_stats_key_len);
-        if (!od_stats_key) {
-            MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-            free(proc.key);
-            free(proc.msg);
-            free(new_msg);
-            return 1;
-        }
-
-        /* Set key values */
-        od_stats_key->od_id = proc.odid;
-        od_stats_key->exporter_ip_addr_crc = exporter_ip_addr_crc;
-
-        /* Retrieve OD statistics from hashmap */
-        struct od_stats_elem_t *od_stat;
-        HASH_FIND(hh, proc.plugin_conf->od_stats, &od_stats_key->od_id, proc.plugin_conf->od_stats_key_len, od_stat);
-        if (od_stat == NULL || od_stat->tset_proc == NULL) {
-            /* Add all data records (leaving it untouched), and update offset and length */
-            uint16_t total_recs_len = ntohs(msg->data_couple[i].data_set->header.length) - sizeof(struct ipfix_set_header);
-            memcpy(proc.msg + proc.offset, msg->data_couple[i].data_set->records, total_recs_len);
-            proc.offset += total_recs_len;
-            proc.length += total_recs_len;
-        } else {
-            /* Process template set records; select processor based on PEN */
-            data_set_process_records(msg->data_couple[i].data_set, new_templ, od_stat->dset_proc, (void *) &proc);
-        }
-
-        free(od_stats_key);
+        /* Process data set records; processor was selected based on PEN */
+        data_set_process_records(msg->data_couple[i].data_set, new_templ, od_stat->dset_proc, (void *) &proc);
 
         new_msg->data_couple[new_i].data_set->header.length = htons(proc.length);
         new_msg->data_couple[new_i].data_set->header.flowset_id = htons(new_msg->data_couple[new_i].data_template->template_id);
@@ -575,6 +674,7 @@ int intermediate_process_message(void *config, void *message)
     new_msg->data_records_count = msg->data_records_count;
     new_msg->source_status = msg->source_status;
     new_msg->live_profile = msg->live_profile;
+    new_msg->watermark = msg->watermark;
     new_msg->plugin_id = msg->plugin_id;
     new_msg->plugin_status = msg->plugin_status;
     new_msg->metadata = msg->metadata;
@@ -98,6 +98,7 @@ struct templ_stats_elem_t {
     UT_hash_handle hh;              /* Hash handle for internal hash functioning */
     uint32_t http_fields_pen;       /* Exporter PEN in case template contains HTTP-related fields */
     int http_fields_pen_determined; /* Indicates whether the PEN belonging to HTTP-related has been determined before */
+    struct ipfix_template *templ;   /* Rewritten template in template manager (cached mapping; NULL if unknown) */
     uint32_t od_id;                 /* Hash key - component 1 */
     uint32_t exporter_ip_addr_crc;  /* Hash key - component 2 */
     uint16_t templ_id;              /* Hash key - component 3 */
@@ -96,10 +96,6 @@ void cisco_template_rec_processor(uint8_t *rec, int rec_len, void *data)
 
     /* Don't process options template records */
     if (proc->type == TM_OPTIONS_TEMPLATE) {
-        /* Copy record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         return;
     }
 
@@ -124,11 +120,6 @@ void cisco_template_rec_processor(uint8_t *rec, int rec_len, void *data)
                 templ_stats_key->exporter_ip_addr_crc,
                 templ_stats_key->templ_id);
 
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
-
         free(templ_stats_key);
         return;
     }
@@ -140,10 +131,6 @@ void cisco_template_rec_processor(uint8_t *rec, int rec_len, void *data)
      *      - Template already uses the unified set of HTTP IEs
      */
     if (templ_stats->http_fields_pen == 0 || templ_stats->http_fields_pen == TARGET_PEN) {
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         return;
     }
 
@@ -162,10 +149,6 @@ void cisco_template_rec_processor(uint8_t *rec, int rec_len, void *data)
     if (http_field_count != 4) {
         MSG_WARNING(msg_module, "Template record features unexpected number of instances of field e%uid12235 (expected: %d, actual: %d)", CISCO_PEN, 4, http_field_count);
 
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, new_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         free(new_rec);
         return;
     }
@@ -232,20 +215,22 @@ void cisco_template_rec_processor(uint8_t *rec, int rec_len, void *data)
     proc->key->tid = templ_id;
     if (tm_get_template(proc->plugin_conf->tm, proc->key) == NULL) {
         MSG_DEBUG(msg_module, "[%u] Adding template ID %u to template manager", proc->key->odid, templ_id);
-        if (tm_add_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
+        templ_stats->templ = tm_add_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key);
+        if (templ_stats->templ == NULL) {
             MSG_ERROR(msg_module, "[%u] Failed to add template to template manager (template ID: %u)", proc->key->odid, proc->key->tid);
         }
     } else {
         MSG_DEBUG(msg_module, "[%u] Updating template ID %u in template manager", proc->key->odid, templ_id);
-        if (tm_update_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
+        templ_stats->templ = tm_update_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key);
+        if (templ_stats->templ == NULL) {
             MSG_ERROR(msg_module, "[%u] Failed to update template in template manager (template ID: %u)", proc->key->odid, proc->key->tid);
         }
     }
 
-    /* Add new record to message */
-    memcpy(proc->msg + proc->offset, new_rec, rec_len);
-    proc->offset += rec_len;
-    proc->length += rec_len;
+    /* Rewrite record in the original message; only IE IDs and PENs have changed,
+     * so the record length remains the same
+     */
+    memcpy(old_rec, new_rec, rec_len);
 
     free(new_rec);
 }
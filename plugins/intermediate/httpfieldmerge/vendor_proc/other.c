@@ -197,10 +197,6 @@ void other_template_rec_processor(uint8_t *rec, int rec_len, void *data)
 
     /* Don't process options template records */
     if (proc->type == TM_OPTIONS_TEMPLATE) {
-        /* Copy record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         return;
     }
 
@@ -225,11 +221,6 @@ void other_template_rec_processor(uint8_t *rec, int rec_len, void *data)
                 templ_stats_key->exporter_ip_addr_crc,
                 templ_stats_key->templ_id);
 
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
-
         free(templ_stats_key);
         return;
     }
@@ -242,10 +233,6 @@ void other_template_rec_processor(uint8_t *rec, int rec_len, void *data)
      *      - Template already uses the unified set of HTTP IEs
      */
     if (templ_stats->http_fields_pen == 0 || templ_stats->http_fields_pen == TARGET_PEN) {
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         return;
     }
 
@@ -349,48 +336,21 @@ void other_template_rec_processor(uint8_t *rec, int rec_len, void *data)
     proc->key->tid = templ_id;
 
     if (tm_get_template(proc->plugin_conf->tm, proc->key) == NULL) {
-        if (tm_add_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
+        templ_stats->templ = tm_add_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key);
+        if (templ_stats->templ == NULL) {
             MSG_ERROR(msg_module, "[%u] Failed to add template to template manager (template ID: %u)", proc->key->odid, proc->key->tid);
         }
     } else {
-        if (tm_update_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
+        templ_stats->templ = tm_update_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key);
+        if (templ_stats->templ == NULL) {
             MSG_ERROR(msg_module, "[%u] Failed to update template in template manager (template ID: %u)", proc->key->odid, proc->key->tid);
         }
     }
 
-    /* Add new record to message */
-    memcpy(proc->msg + proc->offset, new_rec, rec_len);
-    proc->offset += rec_len;
-    proc->length += rec_len;
+    /* Rewrite record in the original message; only IE IDs and PENs have changed,
+     * so the record length remains the same
+     */
+    memcpy(old_rec, new_rec, rec_len);
 
     free(new_rec);
 }
-
-/**
- * \brief Processing of data records
- *
- * \param[in] rec Pointer to data record
- * \param[in] rec_len Data record length
- * \param[in] templ IPFIX template corresponding to the data record
- * \param[in] data Any-type data structure (here: httpfieldmerge_processor)
- */
-void other_data_rec_processor(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
-{
-    struct httpfieldmerge_processor *proc = (struct httpfieldmerge_processor *) data;
-    (void) templ;
-
-    /* Check whether we will exceed the allocated memory boundary */
-    if (proc->offset + rec_len > proc->allocated_msg_len) {
-        proc->allocated_msg_len = proc->allocated_msg_len + 100;
-        proc->msg = realloc(proc->msg, proc->allocated_msg_len);
-        if (!proc->msg) {
-            MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-            return;
-        }
-    }
-
-    /* Copy original data record */
-    memcpy(proc->msg + proc->offset, rec, rec_len);
-    proc->offset += rec_len;
-    proc->length += rec_len;
-}
@@ -76,14 +76,4 @@
  */
 void other_template_rec_processor(uint8_t *rec, int rec_len, void *data);
 
-/**
- * \brief Processing of data records
- *
- * \param[in] rec Pointer to data record
- * \param[in] rec_len Data record length
- * \param[in] templ IPFIX template corresponding to the data record
- * \param[in] data Any-type data structure (here: httpfieldmerge_processor)
- */
-void other_data_rec_processor(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data);
-
 #endif /* HTTPFIELDMERGE_PROCESSORS_OTHER_H_ */
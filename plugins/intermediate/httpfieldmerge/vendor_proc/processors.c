@@ -94,7 +94,8 @@ tset_callback_f pen_to_template_set_processor(uint32_t pen)
  * PEN.
  *
  * \param[in] pen IANA Private Enterprise Number
- * \return Reference to field processor function if supplied PEN is known, NULL otherwise
+ * \return Reference to field processor function if data records of the supplied PEN have
+ * to be modified, NULL otherwise
  */
 dset_callback_f pen_to_data_set_processor(uint32_t pen)
 {
@@ -106,7 +107,9 @@ dset_callback_f pen_to_data_set_processor(uint32_t pen)
         case NTOP_PEN:      proc = &ntop_data_rec_processor;
                             break;
 
-        default:            proc = &other_data_rec_processor;
+        default:            /* Data records are not modified; data sets are shared
+                             * with the original IPFIX message
+                             */
                             break;
     }
 
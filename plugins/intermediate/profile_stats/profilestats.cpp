@@ -44,6 +44,9 @@ extern "C" {
 
 // API version constant
 IPFIXCOL_API_VERSION
+
+// Metadata required by the plugin
+IPFIXCOL_METADATA(MDATA_RECORDS | MDATA_CHANNELS);
 }
 
 #include <rrd.h>
@@ -679,8 +682,8 @@ int intermediate_process_message(void* config, void* message)
 	stats_data *profileStats, *channelStats;
 	std::string profile_dir,   channel_dir;
 
-	// Go through all data records
-	for (uint16_t i = 0; i < msg->data_records_count; ++i) {
+	// Go through all data records (no metadata before the plugin was loaded)
+	for (uint16_t i = 0; msg->metadata && i < msg->data_records_count; ++i) {
 		struct metadata *mdata = &(msg->metadata[i]);
 		conf->update_id++;
 
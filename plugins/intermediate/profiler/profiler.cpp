@@ -43,6 +43,9 @@ extern "C" {
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_RECORDS | MDATA_CHANNELS);
 }
 
 #include <libxml/parser.h>
@@ -299,7 +302,7 @@ int intermediate_process_message(void* config, void* message)
 	plugin_conf *conf = reinterpret_cast<plugin_conf *>(config);
 	struct ipfix_message *msg = reinterpret_cast<struct ipfix_message *>(message);
 	
-	if (msg->data_records_count == 0) {
+	if (msg->data_records_count == 0 || !msg->metadata) {
 		pass_message(conf->ip_config, msg);
 		return 0;
 	}
@@ -75,6 +75,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 /* Identifier for MSG_* macros */
 static char *msg_module = "proxy";
 
@@ -1384,6 +1387,7 @@ int intermediate_process_message(void *config, void *message)
     new_msg->data_records_count = msg->data_records_count;
     new_msg->source_status = msg->source_status;
     new_msg->live_profile = msg->live_profile;
+    new_msg->watermark = msg->watermark;
     new_msg->plugin_id = msg->plugin_id;
     new_msg->plugin_status = msg->plugin_status;
     new_msg->metadata = msg->metadata;
@@ -42,12 +42,16 @@ extern "C" {
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_RECORDS);
 }
 
 #include <libxml2/libxml/xpath.h>
 #include <libxml2/libxml/parser.h>
 #include <libxml2/libxml/tree.h>
 #include <rrd.h>
+#include <rrd_client.h>
 #include <sys/stat.h>
 
 #include "stats.h"
@@ -56,6 +60,7 @@ IPFIXCOL_API_VERSION;
 #include <sstream>
 #include <vector>
 #include <stdexcept>
+#include <chrono>
 
 /* Identifier for verbose macros */
 static const char *msg_module = "stats";
@@ -121,6 +126,11 @@ void process_startup_xml(plugin_conf *conf, char *params)
 			aux_char = xmlNodeListGetString(doc, node->children, 1);
 			conf->interval = atoi((const char *) aux_char);
 			xmlFree(aux_char);
+		} else if (!xmlStrcmp(node->name, (const xmlChar *) "daemon")) {
+			/* Address of rrdcached */
+			aux_char = xmlNodeListGetString(doc, node->children, 1);
+			conf->daemon = (const char *) aux_char;
+			xmlFree(aux_char);
 		}
 	}
 	
@@ -129,86 +139,31 @@ void process_startup_xml(plugin_conf *conf, char *params)
 		xmlFreeDoc(doc);
 		throw std::invalid_argument("Path to RRD files must be set!");
 	}
-	
-	/* Free resources */
-	xmlFreeDoc(doc);
-}
 
-/**
- * \brief Plugin initialization
- *
- * \param[in] params xml configuration
- * \param[in] ip_config	intermediate process config
- * \param[in] ip_id	intermediate process ID for template manager
- * \param[in] template_mgr template manager
- * \param[out] config config storage
- * \return 0 on success
- */
-int intermediate_init(char* params, void* ip_config, uint32_t ip_id, ipfix_template_mgr* template_mgr, void** config)
-{	
-	/* Suppress compiler warning */
-	(void) ip_id; (void) template_mgr;
-	
-	if (!params) {
-		MSG_ERROR(msg_module, "Missing plugin configuration");
-		return 1;
+	if (conf->interval == 0) {
+		xmlFreeDoc(doc);
+		throw std::invalid_argument("Interval must be greater than zero!");
 	}
 	
-	try {
-		/* Create configuration */
-		plugin_conf *conf = new plugin_conf;
-		
-		/* Process params */
-		process_startup_xml(conf, params);
-
-
-		/* Create RRD template */
-		for (uint16_t i = 0; i < fields.size(); ++i) {
-			if (i > 0) {
-				conf->templ += ":";
-			}
-			conf->templ += fields[i];
-		}
-
-		/* Save configuration */
-		conf->ip_config = ip_config;
-		*config = conf;
-		
-	} catch (std::exception &e) {
-		*config = NULL;
-		MSG_ERROR(msg_module, "%s", e.what());
-		return 1;
-	}
-
-	MSG_DEBUG(msg_module, "initialized");
-	return 0;
+	/* Free resources */
+	xmlFreeDoc(doc);
 }
 
 /**
  * \brief Create new RRD database
  *
  * \param[in] conf plugin configuration
- * \param[in] file path to RRD file
- * \return stats_data structure
+ * \param[in] stats stats data with path to RRD file
+ * \param[in] now current time
+ * \return true on success
  */
-stats_data *stats_rrd_create(plugin_conf *conf, std::string file)
+bool stats_rrd_create(plugin_conf *conf, stats_data *stats, uint64_t now)
 {
-	/* Create stats counters */
-	stats_data *stats = new stats_data;
-	stats->file = file;
-	stats->last = time(NULL);
-
-	for (int group = 0; group < GROUPS; ++group) {
-		for (int field = 0; field < PROTOCOLS_PER_GROUP; ++field) {
-			stats->fields[group][field] = 0;
-		}
-	}
-
 	/* Create file */
 	struct stat sts;
-	if (!(stat(file.c_str(), &sts) == -1 && errno == ENOENT)) {
+	if (!(stat(stats->file.c_str(), &sts) == -1 && errno == ENOENT)) {
 		/* File already exists */
-		return stats;
+		return true;
 	}
 
 	char buffer[64];
@@ -216,22 +171,6 @@ stats_data *stats_rrd_create(plugin_conf *conf, std::string file)
 	/* Create arguments field */
 	std::vector<std::string> argv{};
 
-	/* Create file */
-	argv.push_back("create");
-	argv.push_back(file);
-
-	/*
-	 * Set start time
-	 * time is decreased by conf->interval because it is not possible to
-	 * update the RRD for the next step time.
-	 */
-	snprintf(buffer, 64, "--start=%lu", stats->last - conf->interval);
-	argv.push_back(buffer);
-
-	/* Set interval */
-	snprintf(buffer, 64, "--step=%d", conf->interval);
-	argv.push_back(buffer);
-
 	/* Add all fields */
 	for (auto field: fields) {
 		snprintf(buffer, 64, "DS:%s:ABSOLUTE:%u:U:U", field, conf->interval * 2); /* datasource definition, wait 2x the interval for data */
@@ -248,22 +187,25 @@ stats_data *stats_rrd_create(plugin_conf *conf, std::string file)
 	argv.push_back("RRA:MAX:0.5:24:2160");
 	argv.push_back("RRA:MAX:0.5:288:1825");
 
-
 	/* Create C style argv */
-	const char **c_argv = new const char*[argv.size()];
-	for (u_int16_t i = 0; i < argv.size(); ++i) {
-		c_argv[i] = argv[i].c_str();
+	std::vector<const char *> c_argv;
+	for (auto& arg: argv) {
+		c_argv.push_back(arg.c_str());
 	}
 
-	/* Create RRD database */
-	if (rrd_create(argv.size(), (char **) c_argv)) {
+	/*
+	 * Create RRD database
+	 * start time is decreased by conf->interval because it is not possible to
+	 * update the RRD for the next step time.
+	 */
+	if (rrd_create_r(stats->file.c_str(), conf->interval, now - conf->interval,
+			c_argv.size(), c_argv.data())) {
 		MSG_ERROR(msg_module, "Create RRD DB Error: %s", rrd_get_error());
 		rrd_clear_error();
-		delete stats;
-		return NULL;
+		return false;
 	}
 
-	return stats;
+	return true;
 }
 
 /**
@@ -274,7 +216,7 @@ stats_data *stats_rrd_create(plugin_conf *conf, std::string file)
  * \param[in] fields stats fields
  * \return counters converted to string
  */
-std::string stats_counters_to_string(uint64_t last, uint64_t fields[GROUPS][PROTOCOLS_PER_GROUP])
+std::string stats_counters_to_string(uint64_t last, std::atomic<uint64_t> fields[GROUPS][PROTOCOLS_PER_GROUP])
 {
 	std::stringstream ss;
 
@@ -294,11 +236,8 @@ std::string stats_counters_to_string(uint64_t last, uint64_t fields[GROUPS][PROT
 				ss << ":";
 			}
 
-			/* Add field */
-			ss << fields[group][field];
-
-			/* Reset counter */
-			fields[group][field] = 0;
+			/* Add field and reset counter */
+			ss << fields[group][field].exchange(0, std::memory_order_relaxed);
 		}
 	}
 
@@ -306,39 +245,43 @@ std::string stats_counters_to_string(uint64_t last, uint64_t fields[GROUPS][PROT
 }
 
 /**
- * \brief Update RRD stats file
+ * \brief Write pending updates to RRD stats file
  *
+ * All pending values are written by a single update. If rrdcached is used,
+ * the update is sent to the daemon instead of the file.
+ *
+ * \param[in] conf plugin configuration
  * \param[in] stats Stats data
- * \param[in] templ RRD template
+ * \return true on success
  */
-void stats_update(stats_data *stats, std::string templ)
+bool stats_update(plugin_conf *conf, stats_data *stats)
 {
-	std::vector<std::string> argv;
-
-	/* Set RRD file */
-	argv.push_back("update");
-	argv.push_back(stats->file);
-
-	/* Set template */
-	argv.push_back("--template");
-	argv.push_back(templ);
-
-	/* Add counters */
-	argv.push_back(stats_counters_to_string(stats->last, stats->fields));
+	if (stats->pending.empty()) {
+		return true;
+	}
 
 	/* Create C style argv */
-	const char **c_argv = new const char*[argv.size()];
-	for (u_int16_t i = 0; i < argv.size(); ++i) {
-		c_argv[i] = argv[i].c_str();
+	std::vector<const char *> c_argv;
+	for (auto& value: stats->pending) {
+		c_argv.push_back(value.c_str());
 	}
 
-	/* Update database */
-	if (rrd_update(argv.size(), (char **) c_argv)) {
+	/* Update database (values follow order of data sources) */
+	int ret;
+	if (!conf->daemon.empty()) {
+		ret = rrdc_update(stats->file.c_str(), c_argv.size(), c_argv.data());
+	} else {
+		ret = rrd_update_r(stats->file.c_str(), conf->templ.c_str(), c_argv.size(), c_argv.data());
+	}
+
+	if (ret) {
 		MSG_ERROR(msg_module, "RRD Insert Error: %s", rrd_get_error());
 		rrd_clear_error();
+		return false;
 	}
 
-	delete[] c_argv;
+	stats->pending.clear();
+	return true;
 }
 
 /**
@@ -377,27 +320,173 @@ std::string stats_create_file(std::string path, uint32_t odid)
 }
 
 /**
- * \brief Find or create RRD stats file for given ODID
+ * \brief Take counters of all ODIDs and write them to RRD files
+ *
+ * Runs in the writer thread. Files of new ODIDs are created here, values
+ * that cannot be written are kept and written together with the next ones.
+ *
+ * \param[in] conf plugin configuration
+ */
+void stats_flush_counters(plugin_conf *conf)
+{
+	uint64_t now = time(NULL);
+
+	/* (Re)connect to rrdcached */
+	if (!conf->daemon.empty() && !rrdc_is_connected(conf->daemon.c_str())) {
+		if (rrdc_connect(conf->daemon.c_str())) {
+			MSG_ERROR(msg_module, "Unable to connect to rrdcached '%s': %s",
+				conf->daemon.c_str(), rrd_get_error());
+			rrd_clear_error();
+		}
+	}
+
+	for (stats_data *stats = conf->list.load(std::memory_order_acquire); stats; stats = stats->next) {
+		if (!stats->created) {
+			/* Counters are kept until the file is created */
+			stats->file = stats_create_file(conf->path, stats->odid);
+			stats->created = stats_rrd_create(conf, stats, now);
+			if (!stats->created) {
+				continue;
+			}
+		}
+
+		/* RRD accepts only one update per second */
+		stats->last = (now > stats->last) ? now : stats->last + 1;
+		stats->pending.push_back(stats_counters_to_string(stats->last, stats->fields));
+
+		if (stats->pending.size() > MAX_PENDING_UPDATES) {
+			MSG_WARNING(msg_module, "Dropping %lu old updates of %s",
+				stats->pending.size() - MAX_PENDING_UPDATES, stats->file.c_str());
+			stats->pending.erase(stats->pending.begin(),
+				stats->pending.end() - MAX_PENDING_UPDATES);
+		}
+
+		if (!stats_update(conf, stats) && !conf->daemon.empty()) {
+			/* Reconnect next time */
+			rrdc_disconnect();
+		}
+	}
+}
+
+/**
+ * \brief RRD writer thread
+ *
+ * Writes counters at the end of each interval and once more when stopped.
+ *
+ * \param[in] conf plugin configuration
+ */
+void stats_writer(plugin_conf *conf)
+{
+	std::unique_lock<std::mutex> lock(conf->mutex);
+
+	while (true) {
+		/* Wait for the end of current interval */
+		time_t next = (time(NULL) / conf->interval + 1) * conf->interval;
+		while (!conf->stop && time(NULL) < next) {
+			conf->cond.wait_until(lock, std::chrono::system_clock::from_time_t(next));
+		}
+
+		lock.unlock();
+		stats_flush_counters(conf);
+		lock.lock();
+
+		if (conf->stop) {
+			break;
+		}
+	}
+
+	if (!conf->daemon.empty()) {
+		rrdc_disconnect();
+	}
+}
+
+/**
+ * \brief Plugin initialization
+ *
+ * \param[in] params xml configuration
+ * \param[in] ip_config	intermediate process config
+ * \param[in] ip_id	intermediate process ID for template manager
+ * \param[in] template_mgr template manager
+ * \param[out] config config storage
+ * \return 0 on success
+ */
+int intermediate_init(char* params, void* ip_config, uint32_t ip_id, ipfix_template_mgr* template_mgr, void** config)
+{	
+	/* Suppress compiler warning */
+	(void) ip_id; (void) template_mgr;
+	
+	if (!params) {
+		MSG_ERROR(msg_module, "Missing plugin configuration");
+		return 1;
+	}
+	
+	plugin_conf *conf = NULL;
+	try {
+		/* Create configuration */
+		conf = new plugin_conf;
+		
+		/* Process params */
+		process_startup_xml(conf, params);
+
+
+		/* Create RRD template */
+		for (uint16_t i = 0; i < fields.size(); ++i) {
+			if (i > 0) {
+				conf->templ += ":";
+			}
+			conf->templ += fields[i];
+		}
+
+		/* Save configuration */
+		conf->ip_config = ip_config;
+
+		/* Start RRD writer */
+		conf->writer = std::thread(stats_writer, conf);
+		*config = conf;
+		
+	} catch (std::exception &e) {
+		delete conf;
+		*config = NULL;
+		MSG_ERROR(msg_module, "%s", e.what());
+		return 1;
+	}
+
+	MSG_DEBUG(msg_module, "initialized");
+	return 0;
+}
+
+/**
+ * \brief Find or create stats data for given ODID
+ *
+ * New stats are published to the writer thread, which creates the RRD file.
  *
  * \param[in] conf plugin's configuration
  * \param[in] odid Observation Domain ID
  * \return stats data
  */
-stats_data *stats_get_rrd_file(plugin_conf *conf, uint32_t odid)
+stats_data *stats_get_data(plugin_conf *conf, uint32_t odid)
 {
-	stats_data *stats = conf->stats[odid];
-
-	if (stats) {
-		/* RRD stats found */
-		return stats;
+	/* Most messages come from the same ODID as the previous one */
+	if (conf->last_stats && conf->last_stats->odid == odid) {
+		return conf->last_stats;
 	}
 
-	/* Create new RRD file */
-	std::string file = stats_create_file(conf->path, odid);
+	stats_data *&stats = conf->stats[odid];
+	if (!stats) {
+		stats = new stats_data;
+		stats->odid = odid;
+		for (int group = 0; group < GROUPS; ++group) {
+			for (int field = 0; field < PROTOCOLS_PER_GROUP; ++field) {
+				stats->fields[group][field].store(0, std::memory_order_relaxed);
+			}
+		}
 
-	stats = stats_rrd_create(conf, file);
-	conf->stats[odid] = stats;
+		/* Only this thread adds items */
+		stats->next = conf->list.load(std::memory_order_relaxed);
+		conf->list.store(stats, std::memory_order_release);
+	}
 
+	conf->last_stats = stats;
 	return stats;
 }
 
@@ -453,10 +542,10 @@ uint64_t stats_field_val(ipfix_record *rec, int field_id)
 /**
  * \brief Update stats counters
  *
- * \param[in] stats stats data
+ * \param[in,out] fields local stats counters
  * \param[in] mdata Data record's metadata
  */
-void stats_update_counters(stats_data *stats, metadata *mdata)
+void stats_update_counters(uint64_t fields[GROUPS][PROTOCOLS_PER_GROUP], metadata *mdata)
 {
 	/* Get stats values  */
 	uint64_t packets = stats_field_val(&(mdata->record), PACKETS_ID);
@@ -466,37 +555,14 @@ void stats_update_counters(stats_data *stats, metadata *mdata)
 	enum st_protocol proto = stats_get_proto(&(mdata->record));
 
 	/* Update total stats */
-	stats->fields[PACKETS][TOTAL]	+= packets;
-	stats->fields[TRAFFIC][TOTAL]	+= traffic;
-	stats->fields[FLOWS][TOTAL]		+= 1;
+	fields[PACKETS][TOTAL]	+= packets;
+	fields[TRAFFIC][TOTAL]	+= traffic;
+	fields[FLOWS][TOTAL]	+= 1;
 
 	/* Update protocol's stats */
-	stats->fields[PACKETS][proto]	+= packets;
-	stats->fields[TRAFFIC][proto]	+= traffic;
-	stats->fields[FLOWS][proto]		+= 1;
-}
-
-/**
- * \brief Update RRD files if interval passed
- *
- * \param[in] conf plugin config
- * \param[in] force ignore interval, always update files
- */
-void stats_flush_counters(plugin_conf *conf, bool force = false)
-{
-	/* Update stats */
-	uint64_t now = time(NULL);
-	for (auto st: conf->stats) {
-		/* Some pointers can be NULL after unsuccessfull creation */
-		if (!st.second) {
-			continue;
-		}
-
-		if (force || ((st.second->last / conf->interval + 1) * conf->interval <= now)) {
-			stats_update(st.second, conf->templ);
-			st.second->last = now;
-		}
-	}
+	fields[PACKETS][proto]	+= packets;
+	fields[TRAFFIC][proto]	+= traffic;
+	fields[FLOWS][proto]	+= 1;
 }
 
 /**
@@ -512,32 +578,29 @@ int intermediate_process_message(void* config, void* message)
 	struct ipfix_message *msg = reinterpret_cast<struct ipfix_message *>(message);
 
 	/* Catch closing message */
-	if (msg->source_status == SOURCE_STATUS_CLOSED) {
+	if (msg->source_status == SOURCE_STATUS_CLOSED || msg->data_records_count == 0 || !msg->metadata) {
 		pass_message(conf->ip_config, msg);
 		return 0;
 	}
 
-	/* Update counters */
-	stats_flush_counters(conf);
-
-	/* Process message */
-	stats_data *stats = stats_get_rrd_file(conf, htonl(msg->pkt_header->observation_domain_id));
-	if (!stats) {
-		/* Error occured */
-		goto err;
+	/* Count message locally */
+	uint64_t fields[GROUPS][PROTOCOLS_PER_GROUP] = {};
+	for (uint16_t i = 0; i < msg->data_records_count; ++i) {
+		stats_update_counters(fields, &(msg->metadata[i]));
 	}
 
-	/* Update counters */
-	for (uint16_t i = 0; i < msg->data_records_count; ++i) {
-		stats_update_counters(stats, &(msg->metadata[i]));
+	/* Add counters to the ODID stats */
+	stats_data *stats = stats_get_data(conf, htonl(msg->pkt_header->observation_domain_id));
+	for (int group = 0; group < GROUPS; ++group) {
+		for (int field = 0; field < PROTOCOLS_PER_GROUP; ++field) {
+			if (fields[group][field]) {
+				stats->fields[group][field].fetch_add(fields[group][field], std::memory_order_relaxed);
+			}
+		}
 	}
 
 	pass_message(conf->ip_config, msg);
 	return 0;
-
-err:
-	pass_message(conf->ip_config, msg);
-	return 1;
 }
 
 /**
@@ -551,8 +614,17 @@ int intermediate_close(void *config)
 	MSG_DEBUG(msg_module, "CLOSING");
 	plugin_conf *conf = static_cast<plugin_conf*>(config);
 	
-	/* Force update counters */
-	stats_flush_counters(conf, true);
+	/* Stop writer, it writes remaining counters */
+	{
+		std::lock_guard<std::mutex> lock(conf->mutex);
+		conf->stop = true;
+	}
+	conf->cond.notify_one();
+	conf->writer.join();
+
+	for (auto st: conf->stats) {
+		delete st.second;
+	}
 
 	/* Destroy configuration */
 	delete conf;
@@ -3,10 +3,18 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /* Default stats interval */
 #define DEFAULT_INTERVAL 300
 
+/* Maximal number of RRD updates kept for a file that cannot be written */
+#define MAX_PENDING_UPDATES 64
+
 /* Fields identifiers */
 #define TRAFFIC_ID	1
 #define PACKETS_ID	2
@@ -42,11 +50,18 @@ enum ipfix_groups {
 
 /**
  * Stats data per ODID
+ *
+ * Counters are incremented by the intermediate thread and read and reset by
+ * the writer thread, everything else belongs to the writer thread.
  */
 struct stats_data {
-	uint64_t last;		/**< Time of last update */
-	std::string file;	/**< Path to RRD file */
-	uint64_t fields[GROUPS][PROTOCOLS_PER_GROUP];	/**< Stats fields per group */
+	uint32_t odid;		/**< Observation Domain ID */
+	uint64_t last{0};	/**< Time of last update */
+	bool created{false};	/**< RRD file exists */
+	std::string file{};	/**< Path to RRD file */
+	std::vector<std::string> pending{};	/**< Updates not written yet */
+	std::atomic<uint64_t> fields[GROUPS][PROTOCOLS_PER_GROUP];	/**< Stats fields per group */
+	stats_data *next{NULL};	/**< Next item in the list of all stats */
 };
 
 /**
@@ -59,7 +74,15 @@ struct plugin_conf {
 	uint32_t interval;      /**< Statistics interval */
 	void *ip_config;		/**< intermediate process config */
 	std::string templ;		/**< RRD template */
+	std::string daemon;		/**< Address of rrdcached (empty for direct updates) */
 	std::map<uint32_t, stats_data*> stats;	/**< RRD stats per ODID */
+	stats_data *last_stats{NULL};	/**< Stats of the last message */
+
+	std::atomic<stats_data*> list{NULL};	/**< All stats, read by the writer */
+	std::thread writer;		/**< RRD writer thread */
+	std::mutex mutex;		/**< Lock for stop flag */
+	std::condition_variable cond;	/**< Wakes up the writer when closing */
+	bool stop{false};		/**< Writer should stop */
 };
 
 
@@ -48,12 +48,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <endian.h>
 
 #include "timestampfieldmerge.h"
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 // void print_mem_addr(uint8_t *p, uint16_t len)
 // {
 //     char *addr;
@@ -94,9 +98,6 @@ void template_rec_stat_processor(uint8_t *rec, int rec_len, void *data)
             return;
         }
 
-        templ_stats->start_time_field_id = 0;
-        templ_stats->end_time_field_id = 0;
-        templ_stats->sysuptime_field_id = 0;
         templ_stats->od_id = proc->odid;
         templ_stats->ip_id = proc->plugin_conf->ip_id;
         templ_stats->template_id = template_id;
@@ -105,6 +106,11 @@ void template_rec_stat_processor(uint8_t *rec, int rec_len, void *data)
         HASH_ADD(hh, proc->plugin_conf->templ_stats, od_id, proc->plugin_conf->templ_stats_key_len, templ_stats);
     }
 
+    /* Template may have been redefined, so start from scratch */
+    templ_stats->start_time_field_id = 0;
+    templ_stats->end_time_field_id = 0;
+    templ_stats->sysuptime_field_id = 0;
+
     struct ipfix_entity field;
 
     /* Check for flowStartMilliseconds, e0id152 */
@@ -139,13 +145,106 @@ void template_rec_stat_processor(uint8_t *rec, int rec_len, void *data)
     /* Check for systemInitTimeMilliseconds, e0id160 */
     field = (struct ipfix_entity) systemInitTimeMilliseconds;
     if (template_record_get_field(record, field.pen, field.element_id, NULL) != NULL) {
-        templ_stats->end_time_field_id = field.element_id;
+        templ_stats->sysuptime_field_id = field.element_id;
+    }
+}
+
+/**
+ * \brief Checks whether a template field is a timestamp that is converted by this plugin
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] field_id Field ID, including enterprise bit
+ * \param[in] field_len Field length
+ * \return Nonzero if field must be converted, 0 otherwise
+ */
+static int is_converted_field(struct plugin_config *conf, uint16_t field_id, uint16_t field_len)
+{
+    return field_len == BYTES_4
+            && (field_id == conf->field_flowStartSysUpTime.element_id
+            || field_id == conf->field_flowEndSysUpTime.element_id);
+}
+
+/**
+ * \brief Compiles the transformation plan of data records for a template record
+ *
+ * Adjacent fixed-length fields are merged into a single copy step, so records
+ * are converted by a few straight-line copies without any per-field lookups.
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] record Original template record
+ * \param[in] rec_len Template record length
+ * \return Plan, or NULL if records do not have to be modified (or in case of an error)
+ */
+static struct templ_plan *plan_compile(struct plugin_config *conf, struct ipfix_template_record *record, int rec_len)
+{
+    struct templ_plan *plan;
+    struct plan_step *step = NULL;
+    uint16_t field_count = ntohs(record->count);
+    uint16_t count, index, field_id, field_len;
+    int32_t offset = 0;
+    int fixed = 1;
+
+    plan = calloc(1, sizeof(struct templ_plan) + field_count * sizeof(struct plan_step));
+    if (!plan) {
+        MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    plan->sysinit_offset = -1;
+
+    for (count = index = 0; count < field_count
+            && (uint8_t *) &record->fields[index + 1] - (uint8_t *) record <= rec_len; ++count, ++index) {
+        field_id = ntohs(record->fields[index].ie.id);
+        field_len = ntohs(record->fields[index].ie.length);
+
+        /* PEN comes just after the IE, before the next IE; skip it */
+        if (field_id & 0x8000) {
+            ++index;
+        }
+
+        if (field_id == conf->field_systemInitTimeMilliseconds.element_id && field_len == BYTES_8) {
+            plan->has_sysinit = 1;
+            if (fixed) {
+                plan->sysinit_offset = offset;
+            }
+        }
+
+        if (is_converted_field(conf, field_id, field_len)) {
+            step = &plan->steps[plan->step_count++];
+            step->type = PLAN_TIME;
+            plan->time_count++;
+            offset += BYTES_4;
+        } else if (field_len == VAR_IE_LENGTH) {
+            step = &plan->steps[plan->step_count++];
+            step->type = PLAN_VAR;
+            fixed = 0;
+        } else {
+            /* Extend previous copy run if possible */
+            if (step == NULL || step->type != PLAN_COPY) {
+                step = &plan->steps[plan->step_count++];
+                step->type = PLAN_COPY;
+            }
+
+            step->length += field_len;
+            offset += field_len;
+        }
+    }
+
+    if (plan->time_count == 0) {
+        free(plan);
+        return NULL;
     }
+
+    plan->src_length = fixed ? offset : -1;
+    return plan;
 }
 
 /**
  * \brief Processing of template records and option template records
  *
+ * Template records are rewritten within the original message, since only field IDs and
+ * lengths change; the length of the template record itself remains the same.
+ *
  * \param[in] rec Pointer to template record
  * \param[in] rec_len Template record length
  * \param[in] data Any-type data structure (here: processor)
@@ -153,19 +252,14 @@ void template_rec_stat_processor(uint8_t *rec, int rec_len, void *data)
 void template_rec_processor(uint8_t *rec, int rec_len, void *data)
 {
     struct processor *proc = (struct processor *) data;
-    struct ipfix_template_record *old_rec = (struct ipfix_template_record *) rec;
-    struct ipfix_template_record *new_rec;
+    struct ipfix_template_record *record = (struct ipfix_template_record *) rec;
 
     /* Don't process options template records */
     if (proc->type == TM_OPTIONS_TEMPLATE) {
-        /* Copy record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         return;
     }
 
-    uint16_t template_id = ntohs(old_rec->template_id);
+    uint16_t template_id = ntohs(record->template_id);
     MSG_DEBUG(msg_module, "> [template_rec_processor] Old template ID: %u", template_id);
 
     /* Set key values */
@@ -178,47 +272,40 @@ void template_rec_processor(uint8_t *rec, int rec_len, void *data)
     HASH_FIND(hh, proc->plugin_conf->templ_stats, &proc->templ_stats_key->od_id, proc->plugin_conf->templ_stats_key_len, templ_stats);
     if (templ_stats == NULL) {
         MSG_ERROR(msg_module, "Could not find key '%u' in hashmap; using original template", template_id);
-
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         return;
     }
 
+    /* Forget plan of a previous definition of this template */
+    free(templ_stats->plan);
+    templ_stats->plan = NULL;
+
     /* Skip further processing if template does not feature any of the timestamp fields
      * that require processing */
     if (templ_stats->start_time_field_id != proc->plugin_conf->field_flowStartSysUpTime.element_id
             && templ_stats->end_time_field_id != proc->plugin_conf->field_flowEndSysUpTime.element_id) {
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, old_rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
         return;
     }
 
-    /* Copy original template record; BYTES_4 is because target timestamps are
-     * 8 bytes in size instead of 4 bytes */
-    new_rec = calloc(1, rec_len + (2 * BYTES_4));
-    if (!new_rec) {
-        MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+    /* Compile plan based on the original template record */
+    templ_stats->plan = plan_compile(proc->plugin_conf, record, rec_len);
+    if (templ_stats->plan == NULL) {
         return;
     }
 
-    memcpy(new_rec, old_rec, rec_len);
-
     /* Find timestamp fields and replace them; iterate over all fields in template record */
     uint16_t count = 0, index = 0;
     uint16_t field_id;
-    while (count < ntohs(new_rec->count)
-            && (uint8_t *) &new_rec->fields[index] - (uint8_t *) new_rec < rec_len) {
-        field_id = ntohs(new_rec->fields[index].ie.id);
-        if (field_id == proc->plugin_conf->field_flowStartSysUpTime.element_id) {
-            new_rec->fields[index].ie.id = htons((struct ipfix_entity) flowStartMilliseconds.element_id);
-            new_rec->fields[index].ie.length = htons(BYTES_8);
-        } else if (field_id == proc->plugin_conf->field_flowEndSysUpTime.element_id) {
-            new_rec->fields[index].ie.id = htons((struct ipfix_entity) flowEndMilliseconds.element_id);
-            new_rec->fields[index].ie.length = htons(BYTES_8);
+    while (count < ntohs(record->count)
+            && (uint8_t *) &record->fields[index] - (uint8_t *) record < rec_len) {
+        field_id = ntohs(record->fields[index].ie.id);
+        if (is_converted_field(proc->plugin_conf, field_id, ntohs(record->fields[index].ie.length))) {
+            if (field_id == proc->plugin_conf->field_flowStartSysUpTime.element_id) {
+                record->fields[index].ie.id = htons(proc->plugin_conf->field_flowStartMilliseconds.element_id);
+            } else {
+                record->fields[index].ie.id = htons(proc->plugin_conf->field_flowEndMilliseconds.element_id);
+            }
+
+            record->fields[index].ie.length = htons(BYTES_8);
         }
 
         /* PEN comes just after the IE, before the next IE; skip it */
@@ -235,164 +322,168 @@ void template_rec_processor(uint8_t *rec, int rec_len, void *data)
     MSG_DEBUG(msg_module, "> [template_rec_processor] New template ID: %u", template_id);
 
     if (tm_get_template(proc->plugin_conf->tm, proc->key) == NULL) {
-        if (tm_add_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
+        if (tm_add_template(proc->plugin_conf->tm, (void *) record, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
             MSG_ERROR(msg_module, "[%u] Failed to add template to template manager (template ID: %u)", proc->key->odid, proc->key->tid);
         }
     } else {
-        if (tm_update_template(proc->plugin_conf->tm, (void *) new_rec, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
+        if (tm_update_template(proc->plugin_conf->tm, (void *) record, TEMPL_MAX_LEN, proc->type, proc->key) == NULL) {
             MSG_ERROR(msg_module, "[%u] Failed to update template in template manager (template ID: %u)", proc->key->odid, proc->key->tid);
         }
     }
-
-    /* Add new record to message */
-    memcpy(proc->msg + proc->offset, new_rec, rec_len);
-    proc->offset += rec_len;
-    proc->length += rec_len;
-
-    free(new_rec);
 }
 
 /**
  * \brief Processing of data records
  *
+ * Applies the transformation plan of the data set (proc->plan) to a data record
+ * and appends the result to the new message.
+ *
  * \param[in] rec Pointer to data record
  * \param[in] rec_len Data record length
+ * \param[in] templ Original template of the data record
  * \param[in] data Any-type data structure (here: processor)
  */
 void data_rec_processor(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
 {
     struct processor *proc = (struct processor *) data;
-    (void) templ;
+    struct templ_plan *plan = proc->plan;
+    int new_rec_len = rec_len + plan->time_count * BYTES_4;
 
     /* Check whether we will exceed the allocated memory boundary */
-    if (proc->offset + rec_len > proc->allocated_msg_len) {
+    if (proc->offset + new_rec_len > proc->allocated_msg_len) {
         MSG_ERROR(msg_module, "Not enough memory allocated for processing full message (allocated: %u, current offset: %u)",
                 proc->allocated_msg_len, proc->offset);
         return;
     }
 
-    /* Get structure from hashmap that provides information about current template */
-    uint16_t template_id = templ->template_id;
-
-    /* Set key values */
-    proc->templ_stats_key->od_id = proc->odid;
-    proc->templ_stats_key->ip_id = proc->plugin_conf->ip_id;
-    proc->templ_stats_key->template_id = template_id;
-
-    /* Retrieve statistics from hashmap */
-    struct templ_stats_elem_t *templ_stats;
-    HASH_FIND(hh, proc->plugin_conf->templ_stats, &proc->templ_stats_key->od_id, proc->plugin_conf->templ_stats_key_len, templ_stats);
-    if (templ_stats == NULL) {
-        MSG_ERROR(msg_module, "Could not find key '%u' in hashmap; using original template", template_id);
-
-        /* Copy existing record to new message */
-        memcpy(proc->msg + proc->offset, rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
-        return;
-    }
+    /* Calculate absolute flow record start and end times based on sysUpTime or collector
+     * system time, depending on availability of systemInitTimeMilliseconds field
+     */
+    uint64_t sysinit_time = 0;
+    int use_sysinit = 0;
+    if (plan->has_sysinit) {
+        int sysinit_offset = plan->sysinit_offset, sysinit_len = BYTES_8;
+        if (sysinit_offset < 0) {
+            sysinit_offset = data_record_field_offset(rec, templ,
+                    proc->plugin_conf->field_systemInitTimeMilliseconds.pen,
+                    proc->plugin_conf->field_systemInitTimeMilliseconds.element_id,
+                    &sysinit_len);
+        }
 
-    /* Skip further processing if template does not feature any of the timestamp fields
-     * that require processing */
-    if (templ_stats->start_time_field_id != proc->plugin_conf->field_flowStartSysUpTime.element_id
-            && templ_stats->end_time_field_id != proc->plugin_conf->field_flowEndSysUpTime.element_id) {
-        /* Copy original data record */
-        memcpy(proc->msg + proc->offset, rec, rec_len);
-        proc->offset += rec_len;
-        proc->length += rec_len;
-        return;
+        if (sysinit_offset >= 0 && sysinit_len == BYTES_8) {
+            memcpy(&sysinit_time, rec + sysinit_offset, BYTES_8);
+            sysinit_time = be64toh(sysinit_time);
+            use_sysinit = 1;
+        }
     }
 
-    MSG_DEBUG(msg_module, "----- Data record (ptr: %p) -----", rec);
-    MSG_DEBUG(msg_module, "Old rec_len: %u", rec_len);
-
-    uint8_t len_spec_bytes; /* Number of bytes used to indicate length of variable-length fields */
-    uint16_t count, field_id, field_len, index, offset = 0, prev_offset;
-    for (count = index = 0; count < proc->orig_templ->field_count; ++count, ++index) {
-        field_id = proc->orig_templ->fields[index].ie.id;
-        field_len = proc->orig_templ->fields[index].ie.length;
-        len_spec_bytes = 0;
-
-        /* Current field is enterprise-specific */
-        if (field_id >> 15) {
-            /* Enterprise number */
-            field_id &= 0x7FFF;
-            ++index;
-        }
+    uint8_t *src = rec, *dst = proc->msg + proc->offset;
+    uint16_t i, len, var_len;
+    uint32_t sysuptime;
+    uint64_t abs_time;
+
+    for (i = 0; i < plan->step_count; ++i) {
+        switch (plan->steps[i].type) {
+            case PLAN_COPY:
+                len = plan->steps[i].length;
+                memcpy(dst, src, len);
+                src += len;
+                dst += len;
+                break;
 
-        prev_offset = offset;
+            case PLAN_VAR:
+                len = *src + 1;
+                if (*src == 255) {
+                    memcpy(&var_len, src + 1, sizeof(var_len));
+                    len = ntohs(var_len) + 3;
+                }
 
-        switch (field_len) {
-            case (1):
-            case (2):
-            case (4):
-            case (8):
-                offset += field_len;
+                memcpy(dst, src, len);
+                src += len;
+                dst += len;
                 break;
-            default:
-                if (field_len == VAR_IE_LENGTH) {
-                    field_len = *((uint8_t *) (rec + offset));
-                    len_spec_bytes += 1;
-                    offset += 1;
-
-                    if (field_len == 255) {
-                        field_len = ntohs(*((uint16_t *) (rec + offset)));
-                        len_spec_bytes += 2;
-                        offset += 2;
-                    }
-
-                    offset += field_len;
+
+            case PLAN_TIME:
+                if (use_sysinit) {
+                    memcpy(&sysuptime, src, BYTES_4);
+                    abs_time = sysinit_time + ntohl(sysuptime);
                 } else {
-                    offset += field_len;
+                    /* proc->time is seconds since UNIX epoch, so converted to milliseconds */
+                    abs_time = proc->time; // * 1000; FIXME
                 }
 
+                /* Store absolute flow record start/end time in record, in place of flowStartSysUpTime/flowEndSysUpTime */
+                abs_time = htobe64(abs_time);
+                memcpy(dst, &abs_time, BYTES_8);
+                src += BYTES_4;
+                dst += BYTES_8;
                 break;
-        }
 
-        /* Calculate absolute flow record start and end times based on sysUpTime or collector
-         * system time, depending on availability of systemInitTimeMilliseconds field
-         */
-        int sysUpTime_field_offset, sysUpTime_field_len;
-        uint64_t *sysUpTime;
-        uint64_t abs_time;
-        if (field_id == proc->plugin_conf->field_flowStartSysUpTime.element_id
-                || field_id == proc->plugin_conf->field_flowEndSysUpTime.element_id) {
-            /* Retrieve sysUpTime; either from data field or approximated by collector system time */
-            if (templ_stats->sysuptime_field_id == proc->plugin_conf->field_systemInitTimeMilliseconds.element_id) {
-                sysUpTime_field_offset = data_record_field_offset(rec, proc->orig_templ,
-                        proc->plugin_conf->field_systemInitTimeMilliseconds.pen,
-                        proc->plugin_conf->field_systemInitTimeMilliseconds.element_id,
-                        &sysUpTime_field_len);
-                message_get_data((uint8_t **) &sysUpTime, rec + sysUpTime_field_offset, sysUpTime_field_len);
-
-                /* Calculate absolute flow record start/end time */
-                abs_time = *sysUpTime + ntohl(*((uint32_t *) (rec + offset)));
-
-                free(sysUpTime);
-            } else {
-                /* proc->time is seconds since UNIX epoch, so converted to milliseconds */
-                abs_time = proc->time; // * 1000; FIXME
-            }
+            default:
+                break;
+        }
+    }
 
-            /* Store absolute flow record start/end time in record, in place of flowStartSysUpTime/flowEndSysUpTime */
-            MSG_DEBUG(msg_module, "    > Setting absolute start time: %u (proc->time: %u)", abs_time, proc->time);
-            message_set_data(proc->msg + proc->offset, (uint8_t *) &abs_time,
-                    proc->plugin_conf->field_flowStartMilliseconds.length);
+    /* Let metadata of the record point to its new location */
+    if (proc->metadata_index < proc->metadata_count
+            && proc->metadata[proc->metadata_index].record.record == rec) {
+        proc->metadata[proc->metadata_index].record.record = proc->msg + proc->offset;
+        proc->metadata[proc->metadata_index].record.length = new_rec_len;
+        proc->metadata[proc->metadata_index].record.templ = proc->new_templ;
+        proc->metadata_index++;
+    }
 
-            proc->offset += proc->plugin_conf->field_flowStartMilliseconds.length;
-            proc->length += proc->plugin_conf->field_flowStartMilliseconds.length;
+    proc->offset += new_rec_len;
+    proc->length += new_rec_len;
+}
 
-            /* Add difference between 'new' and 'old' field lengths, in bytes */
-            MSG_DEBUG(msg_module, "    > Increasing rec_len by %u bytes", proc->plugin_conf->field_flowStartMilliseconds.length - field_len);
-            rec_len += proc->plugin_conf->field_flowStartMilliseconds.length - field_len;
-        } else {
-            memcpy(proc->msg + proc->offset, rec + prev_offset, field_len + (offset - prev_offset));
-            proc->offset += field_len;
-            proc->length += field_len;
+/**
+ * \brief Copies data records that are not modified by this plugin to the new message
+ *
+ * \param[in] proc Processing structure
+ * \param[in] data_set Original data set
+ */
+static void data_set_copy(struct processor *proc, struct ipfix_data_set *data_set)
+{
+    uint16_t total_recs_len = ntohs(data_set->header.length) - sizeof(struct ipfix_set_header);
+    uint8_t *recs_end = data_set->records + total_recs_len;
+    uint8_t *new_recs = proc->msg + proc->offset;
+
+    memcpy(new_recs, data_set->records, total_recs_len);
+    proc->offset += total_recs_len;
+    proc->length += total_recs_len;
+
+    /* Let metadata of the records point to their new location */
+    while (proc->metadata_index < proc->metadata_count) {
+        struct metadata *mdata = &proc->metadata[proc->metadata_index];
+        uint8_t *rec = (uint8_t *) mdata->record.record;
+        if (rec < data_set->records || rec >= recs_end) {
+            break;
         }
+
+        mdata->record.record = new_recs + (rec - data_set->records);
+        mdata->record.templ = proc->new_templ;
+        proc->metadata_index++;
     }
+}
+
+/**
+ * \brief Retrieves the transformation plan of a template
+ *
+ * \param[in] proc Processing structure
+ * \param[in] templ Original template
+ * \return Plan, or NULL if data records of the template are not modified
+ */
+static struct templ_plan *plan_lookup(struct processor *proc, struct ipfix_template *templ)
+{
+    struct templ_stats_elem_t *templ_stats;
+
+    proc->templ_stats_key->od_id = proc->odid;
+    proc->templ_stats_key->ip_id = proc->plugin_conf->ip_id;
+    proc->templ_stats_key->template_id = templ->template_id;
 
-    MSG_DEBUG(msg_module, "New rec_len: %u", rec_len);
+    HASH_FIND(hh, proc->plugin_conf->templ_stats, &proc->templ_stats_key->od_id, proc->plugin_conf->templ_stats_key_len, templ_stats);
+    return templ_stats ? templ_stats->plan : NULL;
 }
 
 /**
@@ -459,7 +550,7 @@ int intermediate_process_message(void *config, void *message)
     struct ipfix_message *msg, *new_msg;
     struct ipfix_template *templ, *new_templ;
     struct input_info_network *info;
-    uint16_t prev_offset;
+    struct templ_plan *plans[MSG_MAX_DATA_COUPLES];
     uint32_t tsets = 0, otsets = 0;
     uint16_t i, new_i;
 
@@ -499,17 +590,74 @@ int intermediate_process_message(void *config, void *message)
         return 0;
     }
 
-    /* As an estimate for the new message size, we take the old message size and
-     * allocate an additional 4 bytes for every record, assuming that we have to
-     * 'upgrade' sysUpTimes (4 bytes) to flow*Milliseconds (8 bytes)
+    /* Initialize processing structure */
+    memset(&proc, 0, sizeof(proc));
+    proc.odid = msg->input_info->odid;
+    proc.key = tm_key_create(info->odid, conf->ip_id, 0); /* Template ID (0) will be overwritten in a later stage */
+    proc.plugin_conf = config;
+    proc.time = time(NULL);
+    proc.metadata = msg->metadata;
+    proc.metadata_count = msg->metadata ? msg->data_records_count : 0;
+
+    proc.templ_stats_key = calloc(1, proc.plugin_conf->templ_stats_key_len);
+    if (!proc.templ_stats_key) {
+        MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+        free(proc.key);
+        return 1;
+    }
+
+    /* Process template sets; template records are rewritten within the original message
+     * and transformation plans are compiled for templates with timestamps to convert
+     */
+    MSG_DEBUG(msg_module, "[%u] Processing template sets...", msg->input_info->odid);
+    proc.type = TM_TEMPLATE;
+    for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
+        /* Determine IP versions used within each template set and store result in hashmap. Also,
+         * determine exporter PEN based on presence of certain enterprise-specific IEs.
+         */
+        template_set_process_records(msg->templ_set[i], proc.type, &template_rec_stat_processor, (void *) &proc);
+
+        /* Process all template set records */
+        template_set_process_records(msg->templ_set[i], proc.type, &template_rec_processor, (void *) &proc);
+    }
+
+    /* Every converted timestamp extends a record by 4 bytes, so the exact length of the
+     * new message is known in advance
      */
-    uint16_t new_msg_length = old_msg_length + (msg->data_records_count * BYTES_4);
+    uint32_t new_msg_length = old_msg_length;
+    for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+        templ = msg->data_couple[i].data_template;
+        plans[i] = templ ? plan_lookup(&proc, templ) : NULL;
+        if (plans[i] == NULL) {
+            continue;
+        }
+
+        uint32_t records;
+        if (plans[i]->src_length > 0) {
+            records = (ntohs(msg->data_couple[i].data_set->header.length) - sizeof(struct ipfix_set_header)) / plans[i]->src_length;
+        } else {
+            records = data_set_process_records(msg->data_couple[i].data_set, templ, NULL, NULL);
+        }
+
+        new_msg_length += records * plans[i]->time_count * BYTES_4;
+    }
+
+    if (new_msg_length > MSG_MAX_LENGTH) {
+        MSG_WARNING(msg_module, "[%u] Length of IPFIX message after conversion exceeds maximum (%u); dropping message",
+                msg->input_info->odid, new_msg_length);
+        free(proc.key);
+        free(proc.templ_stats_key);
+        drop_message(conf->ip_config, message);
+        return 0;
+    }
 
     /* Allocate memory for new message */
     proc.allocated_msg_len = new_msg_length;
     proc.msg = calloc(1, new_msg_length);
     if (!proc.msg) {
         MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+        free(proc.key);
+        free(proc.templ_stats_key);
         return 1;
     }
 
@@ -517,6 +665,8 @@ int intermediate_process_message(void *config, void *message)
     new_msg = calloc(1, sizeof(struct ipfix_message));
     if (!new_msg) {
         MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+        free(proc.key);
+        free(proc.templ_stats_key);
         free(proc.msg);
         return 1;
     }
@@ -526,72 +676,31 @@ int intermediate_process_message(void *config, void *message)
     new_msg->pkt_header = (struct ipfix_header *) proc.msg;
     proc.offset = IPFIX_HEADER_LENGTH;
 
-    /* Initialize processing structure */
-    proc.odid = msg->input_info->odid;
-    proc.key = tm_key_create(info->odid, conf->ip_id, 0); /* Template ID (0) will be overwritten in a later stage */
-    proc.plugin_conf = config;
-    proc.time = time(NULL);
-
-    proc.templ_stats_key = calloc(1, proc.plugin_conf->templ_stats_key_len);
-    if (!proc.templ_stats_key) {
-        MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-        free(proc.msg);
-        free(new_msg);
-        return 1;
-    }
-
-    /* Process template sets */
-    MSG_DEBUG(msg_module, "[%u] Processing template sets...", msg->input_info->odid);
-    proc.type = TM_TEMPLATE;
+    /* Copy (already rewritten) template sets */
     for (i = 0; i < MSG_MAX_TEMPL_SETS && msg->templ_set[i]; ++i) {
-        prev_offset = proc.offset;
-
-        /* Determine IP versions used within each template set and store result in hashmap. Also,
-         * determine exporter PEN based on presence of certain enterprise-specific IEs.
-         */
-        template_set_process_records(msg->templ_set[i], proc.type, &template_rec_stat_processor, (void *) &proc);
-
-        /* Add template set header, and update offset and length */
-        memcpy(proc.msg + proc.offset, &(msg->templ_set[i]->header), 4);
-        proc.offset += 4;
-        proc.length = 4;
-
-        /* Process all template set records */
-        template_set_process_records(msg->templ_set[i], proc.type, &template_rec_processor, (void *) &proc);
-
-        /* Check whether a new template set was added by 'template_rec_processor' */
-        if (proc.offset == prev_offset + 4) { /* No new template set record was added */
-            proc.offset = prev_offset;
-        } else { /* New template set was added; add it to data structure as well */
-            new_msg->templ_set[tsets] = (struct ipfix_template_set *) ((uint8_t *) proc.msg + prev_offset);
-            new_msg->templ_set[tsets]->header.length = htons(proc.length);
-            tsets++;
+        uint16_t set_len = ntohs(msg->templ_set[i]->header.length);
+        if (set_len <= sizeof(struct ipfix_set_header)) {
+            continue;
         }
+
+        memcpy(proc.msg + proc.offset, msg->templ_set[i], set_len);
+        new_msg->templ_set[tsets++] = (struct ipfix_template_set *) ((uint8_t *) proc.msg + proc.offset);
+        proc.offset += set_len;
     }
 
     /* Demarcate end of templates in set */
     new_msg->templ_set[tsets] = NULL;
 
     /* Process option template sets; only copy existing records */
-    // MSG_DEBUG(msg_module, "Processing option template sets...");
-    proc.type = TM_OPTIONS_TEMPLATE;
     for (i = 0; i < MSG_MAX_OTEMPL_SETS && msg->opt_templ_set[i]; ++i) {
-        prev_offset = proc.offset;
-
-        /* Copy full option template set to new message */
         uint16_t set_len = ntohs(msg->opt_templ_set[i]->header.length);
+        if (set_len <= sizeof(struct ipfix_set_header)) {
+            continue;
+        }
+
         memcpy(proc.msg + proc.offset, msg->opt_templ_set[i], set_len);
+        new_msg->opt_templ_set[otsets++] = (struct ipfix_options_template_set *) ((uint8_t *) proc.msg + proc.offset);
         proc.offset += set_len;
-        proc.length = set_len;
-
-        /* Check whether a new options template set was added by 'template_rec_processor' */
-        if (proc.offset == prev_offset + 4) {
-            proc.offset = prev_offset;
-        } else { /* New options template set was added; add it to data structure as well */
-            new_msg->opt_templ_set[otsets] = (struct ipfix_options_template_set *) ((uint8_t *) proc.msg + prev_offset);
-            new_msg->opt_templ_set[otsets]->header.length = htons(proc.length);
-            otsets++;
-        }
     }
 
     /* Demarcate end of option templates in set */
@@ -609,20 +718,22 @@ int intermediate_process_message(void *config, void *message)
             continue;
         }
 
-        /* Save reference to original template. This is necessary for decoding data records
-         * when the accompanying template record has already been modified.
-         */
-        proc.orig_templ = templ;
-
         /* Retrieve update template based on (new) template ID */
-        proc.key->tid = templ->template_id;
-        new_templ = tm_get_template(conf->tm, proc.key);
+        proc.plan = plans[i];
+        new_templ = NULL;
+        if (proc.plan) {
+            proc.key->tid = templ->template_id;
+            new_templ = tm_get_template(conf->tm, proc.key);
+        }
+
         if (!new_templ) {
-            // MSG_ERROR(msg_module, "Could not retrieve template from template manager (ODID: %u, IP ID: %u, template ID: %u)", info->odid, conf->ip_id, templ->template_id);
-            /* Assume that template was not modified by this plugin if new template was not registered in template manager */
+            /* Data records are not modified if new template was not registered in template manager */
+            proc.plan = NULL;
             new_templ = templ;
         }
 
+        proc.new_templ = new_templ;
+
         /* Add data set header, and update offset and length */
         memcpy(proc.msg + proc.offset, &(msg->data_couple[i].data_set->header), sizeof(struct ipfix_set_header));
         proc.offset += sizeof(struct ipfix_set_header);
@@ -637,11 +748,14 @@ int intermediate_process_message(void *config, void *message)
         new_templ->last_transmission = templ->last_transmission;
         tm_template_reference_inc(new_templ);
 
-        /* Process template set records; select processor based on PEN */
-        /* Note: we have to use the old/original template here, since data records
-         * are at this stage still using the old structure
-         */
-        data_set_process_records(msg->data_couple[i].data_set, templ, &data_rec_processor, (void *) &proc);
+        if (proc.plan) {
+            /* Note: we have to use the old/original template here, since data records
+             * are at this stage still using the old structure
+             */
+            data_set_process_records(msg->data_couple[i].data_set, templ, &data_rec_processor, (void *) &proc);
+        } else {
+            data_set_copy(&proc, msg->data_couple[i].data_set);
+        }
 
         new_msg->data_couple[new_i].data_set->header.length = htons(proc.length);
         new_msg->data_couple[new_i].data_set->header.flowset_id = htons(new_msg->data_couple[new_i].data_template->template_id);
@@ -673,6 +787,7 @@ int intermediate_process_message(void *config, void *message)
     new_msg->data_records_count = msg->data_records_count;
     new_msg->source_status = msg->source_status;
     new_msg->live_profile = msg->live_profile;
+    new_msg->watermark = msg->watermark;
     new_msg->plugin_id = msg->plugin_id;
     new_msg->plugin_status = msg->plugin_status;
     new_msg->metadata = msg->metadata;
@@ -701,6 +816,7 @@ int intermediate_close(void *config)
     struct templ_stats_elem_t *current_templ_stats, *templ_tmp;
     HASH_ITER(hh, conf->templ_stats, current_templ_stats, templ_tmp) {
         HASH_DEL(conf->templ_stats, current_templ_stats);
+        free(current_templ_stats->plan);
         free(current_templ_stats);
     }
 
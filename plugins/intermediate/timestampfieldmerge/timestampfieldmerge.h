@@ -73,11 +73,35 @@ struct ipfix_entity {
 #define flowStartMilliseconds       { 0, 152, 8 }
 #define flowEndMilliseconds         { 0, 153, 8 }
 
+/* Types of steps in a transformation plan */
+enum plan_step_type {
+    PLAN_COPY,                          /* Copy a run of fixed-length fields */
+    PLAN_VAR,                           /* Copy a variable-length field, including its length prefix */
+    PLAN_TIME                           /* Convert a 4-byte sysUpTime-based timestamp to an 8-byte absolute timestamp */
+};
+
+/* Step of a transformation plan */
+struct plan_step {
+    uint16_t type;                      /* Step type (enum plan_step_type) */
+    uint16_t length;                    /* Length of the copied run (PLAN_COPY only) */
+};
+
+/* Transformation of data records of one template, compiled when the template arrives */
+struct templ_plan {
+    int32_t src_length;                 /* Length of original records, or -1 if the template contains variable-length fields */
+    int32_t sysinit_offset;             /* Offset of systemInitTimeMilliseconds, or -1 if it is not at a fixed offset */
+    int has_sysinit;                    /* Indicates whether records contain systemInitTimeMilliseconds */
+    uint16_t time_count;                /* Number of converted timestamps; every one extends a record by 4 bytes */
+    uint16_t step_count;                /* Number of steps */
+    struct plan_step steps[];           /* Steps to be applied to every record, in order */
+};
+
 struct templ_stats_elem_t {
     UT_hash_handle hh;                  /* Hash handle for internal hash functioning */
     uint16_t start_time_field_id;       /* Field ID of start time field that must be converted */
     uint16_t end_time_field_id;         /* Field ID of end time field that must be converted */
     uint16_t sysuptime_field_id;        /* Field ID of system uptime field that should be used in conversion */
+    struct templ_plan *plan;            /* Transformation plan of data records (NULL if records are not modified) */
     uint32_t od_id;                     /* Hash key - component 1 */
     uint32_t ip_id;                     /* Hash key - component 2 */
     uint16_t template_id;               /* Hash key - component 3 */
@@ -120,8 +144,12 @@ struct processor {
     
     struct plugin_config *plugin_conf;          /* Pointer to plugin_config, such that we don't have to store some pointers twice */
     struct ipfix_template_key *key;             /* Stores the key of a newly added template within the template manager */
-    struct ipfix_template *orig_templ;          /* Pointer to original template */
+    struct ipfix_template *new_templ;           /* Template of the data set in the new message */
+    struct templ_plan *plan;                    /* Transformation plan of the data set being processed */
     struct templ_stats_key_t *templ_stats_key;  /* Pointer to templ_stats key */
+
+    struct metadata *metadata;                  /* Metadata of the processed message */
+    uint16_t metadata_count, metadata_index;    /* Number of metadata entries and index of the next one to update */
 };
 
 #endif /* TIMESTAMPFIELDMERGE_H_ */
@@ -60,6 +60,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_RECORDS | MDATA_ENRICH);
+
 /* Identifier for verbose macros */
 static const char *msg_module = "uid";
 
@@ -327,8 +330,8 @@ int intermediate_process_message(void* config, void* message)
 	
 	struct metadata *mdata;
 	
-	/* Process each data record */
-	for (int i = 0; i < msg->data_records_count; ++i) {
+	/* Process each data record (no metadata before the plugin was loaded) */
+	for (int i = 0; msg->metadata && i < msg->data_records_count; ++i) {
 		mdata = &(msg->metadata[i]);
 
 		uint32_t flowStart = get_flow_start(&(msg->metadata->record));
@@ -42,6 +42,7 @@
 
 extern "C" {
 	#include <semaphore.h>
+	#include <pthread.h>
 }
 
 #include <string>
@@ -49,6 +50,35 @@ extern "C" {
 #include <vector>
 
 #include "fastbit.h"
+#include "flat_hash.h"
+
+struct od_info;
+class template_table;
+
+/* Binary identification of observation domain (exporter address and ODID) */
+struct od_key {
+	uint64_t addr[2];
+	uint32_t odid;
+	uint8_t l3_proto;
+
+	bool operator==(const od_key &other) const {
+		return addr[0] == other.addr[0] && addr[1] == other.addr[1]
+				&& odid == other.odid && l3_proto == other.l3_proto;
+	}
+};
+
+struct od_key_hash {
+	size_t operator()(const od_key &key) const {
+		flat_hash_u64 hash;
+		return hash(key.addr[0] ^ (key.addr[1] * 31) ^ ((uint64_t) key.odid << 8) ^ key.l3_proto);
+	}
+};
+
+/* Lookup of observation domains by exporter address and ODID */
+typedef flat_hash<od_key, struct od_info, od_key_hash> od_index_t;
+
+/* Lookup of template tables by (od_info::id << 16 | template ID) */
+typedef flat_hash<uint64_t, template_table, flat_hash_u64> table_index_t;
 
 struct fastbit_config {
 	/* Stores information on templates per flow data source (identified by
@@ -58,6 +88,13 @@ struct fastbit_config {
 			std::map<uint32_t, /* ODID */
 					struct od_info>*> *od_infos;
 
+	/* Flat indexes of od_infos and their template tables */
+	od_index_t *od_index;
+	table_index_t *table_index;
+
+	/* Number of observation domains, used to assign od_info::id */
+	uint32_t od_count;
+
 	/* Stores elements that should be indexed */
 	std::vector<std::string> *index_en_id;
 
@@ -74,8 +111,6 @@ struct fastbit_config {
 	 */
 	int records_window;
 
-	bool new_dir; /* Is current directory a new one? */
-
 	/* Holds type of name strategy for storage directory rotation */
 	enum name_type dump_name;
 
@@ -85,6 +120,12 @@ struct fastbit_config {
 	/* Current window directory */
 	std::string window_dir;
 
+	/* sys_dir with time expanded for current window */
+	std::string window_sys_dir;
+
+	/* Incremented on each window change; invalidates paths in od_info */
+	uint32_t window_gen;
+
 	/* User prefix for storage directory */
 	std::string prefix;
 
@@ -112,6 +153,13 @@ struct fastbit_config {
 
 	/* semaphore for index building thread */
 	sem_t sem;
+
+	/* Preparation of next window directories (NULL = disabled) */
+	struct storage_window *window;
+
+	/* Known exporters and ODIDs, read by the preparing thread */
+	std::vector<std::pair<std::string, uint32_t> > *sources;
+	pthread_mutex_t sources_mutex;
 };
 
 #endif /* CONFIG_STRUCT_H_ */
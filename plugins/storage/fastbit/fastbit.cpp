@@ -43,6 +43,9 @@ extern "C" {
 
 	/* API version constant */
 	IPFIXCOL_API_VERSION;
+
+	/* Metadata required by the plugin */
+	IPFIXCOL_METADATA(MDATA_NONE);
 }
 
 #include <pthread.h>
@@ -50,6 +53,7 @@ extern "C" {
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include <map>
@@ -177,19 +181,54 @@ void *reorder_index(void *config)
 	return NULL;
 }
 
-std::string generate_path(struct fastbit_config *config, std::string exporter_ip_addr, uint32_t odid)
+/**
+ * \brief Generates window directory name for the time naming strategy
+ *
+ * @param conf Plugin configuration data structure
+ * @param window Start of the window
+ * @return Window directory name
+ */
+std::string time_window_name(struct fastbit_config *conf, time_t window)
 {
-	struct tm *timeinfo = localtime(&(config->last_flush));
+	char formated_time[17];
+	struct tm timeinfo;
+
+	localtime_r(&window, &timeinfo);
+	strftime(formated_time, 17, "%Y%m%d%H%M%S", &timeinfo);
+	return conf->prefix + std::string(formated_time) + "/";
+}
+
+/**
+ * \brief Expands time in storage path template
+ *
+ * @param config Plugin configuration data structure
+ * @param window Start of the window
+ * @return sys_dir with expanded time
+ */
+std::string expand_sys_dir(struct fastbit_config *config, time_t window)
+{
+	struct tm timeinfo;
 	const int ft_size = 1000;
 	char formated_time[ft_size];
-	std::string path;
 
-	std::stringstream ss;
-	ss << odid;
-	std::string odid_str = ss.str();
+	localtime_r(&window, &timeinfo);
+	strftime(formated_time, ft_size, (config->sys_dir).c_str(), &timeinfo);
+	return std::string(formated_time);
+}
 
-	strftime(formated_time, ft_size, (config->sys_dir).c_str(), timeinfo);
-	path = std::string(formated_time);
+/**
+ * \brief Generates path of observation domain from expanded storage path template
+ *
+ * @param sys_dir Storage path template with expanded time
+ * @param exporter_ip_addr Exporter IP address, as String
+ * @param odid Observation domain ID
+ * @param window_dir Window directory name
+ * @return Directory for storing data of the observation domain
+ */
+std::string generate_path(const std::string &sys_dir, const std::string &exporter_ip_addr, uint32_t odid,
+		const std::string &window_dir)
+{
+	std::string path = sys_dir;
 
 	size_t pos = 0;
 	while ((pos = path.find("%E", pos)) != std::string::npos) {
@@ -198,13 +237,32 @@ std::string generate_path(struct fastbit_config *config, std::string exporter_ip
 
 	pos = 0;
 	while ((pos = path.find("%o", pos)) != std::string::npos) {
-		path.replace(pos, 2, odid_str);
+		std::stringstream ss;
+		ss << odid;
+		path.replace(pos, 2, ss.str());
 	}
 
-	path += config->window_dir;
+	path += window_dir;
 	return path;
 }
 
+std::string generate_path(struct fastbit_config *config, std::string exporter_ip_addr, uint32_t odid)
+{
+	/* Time part of the path is cached for the whole window */
+	return generate_path(config->window_sys_dir, exporter_ip_addr, odid, config->window_dir);
+}
+
+/**
+ * \brief Starts new window generation; paths of observation domains are regenerated on their next use
+ *
+ * @param conf Plugin configuration data structure
+ */
+void update_window_path(struct fastbit_config *conf)
+{
+	conf->window_sys_dir = expand_sys_dir(conf, conf->last_flush);
+	conf->window_gen++;
+}
+
 void update_window_name(struct fastbit_config *conf)
 {
 	static int flushed = 1;
@@ -219,11 +277,38 @@ void update_window_name(struct fastbit_config *conf)
 		ss.str("");
 		flushed++;
 	} else {
-		char formated_time[17];
-		struct tm *timeinfo = localtime(&(conf->last_flush));
-		strftime(formated_time, 17, "%Y%m%d%H%M%S", timeinfo);
-		conf->window_dir = conf->prefix + std::string(formated_time) + "/";
+		conf->window_dir = time_window_name(conf, conf->last_flush);
 	}
+
+	update_window_path(conf);
+}
+
+/**
+ * \brief Creates window directories of all known exporters and ODIDs
+ *
+ * Runs on a background thread ahead of the window start.
+ *
+ * @param start Start of the window
+ * @param user Plugin configuration data structure
+ * @return Always NULL, only directories are prepared
+ */
+void *prepare_window_dirs(time_t start, void *user)
+{
+	struct fastbit_config *conf = (struct fastbit_config *) user;
+	std::vector<std::pair<std::string, uint32_t> > sources;
+
+	pthread_mutex_lock(&(conf->sources_mutex));
+	sources = *(conf->sources);
+	pthread_mutex_unlock(&(conf->sources_mutex));
+
+	std::string sys_dir = expand_sys_dir(conf, start);
+	std::string window_dir = time_window_name(conf, start);
+	for (size_t i = 0; i < sources.size(); i++) {
+		std::string path = generate_path(sys_dir, sources[i].first, sources[i].second, window_dir);
+		storage_mkdir(path.c_str());
+	}
+
+	return NULL;
 }
 
 /**
@@ -473,40 +558,50 @@ int storage_init(char *params, void **config)
 		return 1;
 	}
 
+	c->od_index = new od_index_t;
+	c->table_index = new table_index_t;
+	c->od_count = 0;
+	c->window_gen = 0;
+
 	/* Parse configuration xml and updated configure structure according to it */
 	if (process_startup_xml(params, c)) {
 		MSG_ERROR(msg_module, "Unable to parse plugin configuration");
 		return 1;
 	}
+
+	/* Prepare paths of the first window */
+	update_window_path(c);
 	
-	/* On startup we expect to write to new directory */
-	c->new_dir = true;
+	c->sources = new std::vector<std::pair<std::string, uint32_t> >;
+	pthread_mutex_init(&(c->sources_mutex), NULL);
+
+	/* Directories of following windows can be predicted only for time based rotation */
+	c->window = NULL;
+	if (c->dump_name == TIME && c->time_window > 0 && c->records_window == 0) {
+		c->window = storage_window_create(c->last_flush, c->time_window, STORAGE_WINDOW_LEAD,
+				prepare_window_dirs, NULL, c);
+		if (c->window == NULL) {
+			MSG_WARNING(msg_module, "Window directories will be created synchronously");
+		}
+	}
+
 	return 0;
 }
 
-extern "C"
-int store_packet(void *config, const struct ipfix_message *ipfix_msg,
-		const struct ipfix_template_mgr *template_mgr)
+/**
+ * \brief Adds new observation domain to data structures
+ *
+ * @param conf Plugin configuration data structure
+ * @param input Input information of the message
+ * @param odid Observation domain ID
+ * @return Observation domain information
+ */
+struct od_info *add_od_info(struct fastbit_config *conf, struct input_info_network *input, uint32_t odid)
 {
-	(void) template_mgr;
-	std::map<uint16_t, template_table*>::iterator table;
-	struct fastbit_config *conf = (struct fastbit_config *) config;
-	std::map<uint16_t, template_table*> *templates = NULL;
-	std::map<uint16_t, template_table*> *old_templates = NULL; /* Templates to be removed */
-
 	std::map<std::string, std::map<uint32_t, od_info>*> *od_infos = conf->od_infos;
 	std::map<std::string, std::map<uint32_t, od_info>*>::iterator exporter_it;
 	std::map<uint32_t, od_info>::iterator odid_it;
 
-	static int rcnt = 0;
-
-	uint16_t template_id;
-	uint32_t odid = ntohl(ipfix_msg->pkt_header->observation_domain_id);
-	struct input_info_network *input = (struct input_info_network *) ipfix_msg->input_info;
-
-	int rc_flows = 0;
-	uint64_t rc_flows_sum = 0;
-
 	char exporter_ip_addr_tmp[INET6_ADDRSTRLEN];
 	if (input->l3_proto == 6) { /* IPv6 */
 		ipv6_addr_non_canonical(exporter_ip_addr_tmp, &(input->src_addr.ipv6));
@@ -534,79 +629,144 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
 		/* Add new ODID to data structure (under exporter) */
 		od_info new_odid;
 		new_odid.exporter_ip_addr = exporter_ip_addr;
-		new_odid.path = generate_path(conf, exporter_ip_addr, odid);
+		new_odid.id = ++conf->od_count;
+		/* Path is generated on first use */
+		new_odid.window = conf->window_gen - 1;
 
 		exporter_it->second->insert(std::make_pair(odid, new_odid));
 		odid_it = exporter_it->second->find(odid);
+
+		pthread_mutex_lock(&(conf->sources_mutex));
+		conf->sources->push_back(std::make_pair(exporter_ip_addr, odid));
+		pthread_mutex_unlock(&(conf->sources_mutex));
 	}
 
-	templates = &(odid_it->second.template_info);
+	return &(odid_it->second);
+}
 
-	/* Process all datasets in message */
-	int i;
-	for (i = 0 ; i < MSG_MAX_DATA_COUPLES && ipfix_msg->data_couple[i].data_set; i++) {	
-		if (ipfix_msg->data_couple[i].data_template == NULL) {
-			/* Skip data couples without templates */
-			continue;
-		}
+/**
+ * \brief Returns template table for the template, creates or replaces it if necessary
+ *
+ * @param conf Plugin configuration data structure
+ * @param od Observation domain information
+ * @param odid Observation domain ID
+ * @param tmpl Template of data sets
+ * @return Template table or NULL when the template cannot be parsed
+ */
+template_table *get_table(struct fastbit_config *conf, struct od_info *od, uint32_t odid, struct ipfix_template *tmpl)
+{
+	uint16_t template_id = tmpl->template_id;
+	uint64_t key = ((uint64_t) od->id << 16) | template_id;
+	std::map<uint16_t, template_table*> *templates = &(od->template_info);
 
-		template_id = ipfix_msg->data_couple[i].data_template->template_id;
+	template_table *table = conf->table_index->find(key);
+	if (table != NULL && tmpl->first_transmission <= table->get_first_transmission()) {
+		return table;
+	}
 
-		/* If template (ID) is unknown, add it to the template map */
-		if ((table = templates->find(template_id)) == templates->end()) {
-			MSG_DEBUG(msg_module, "Received new template: %hu", template_id);
-			template_table *table_tmp = new template_table(template_id, conf->buff_size);
-			if (table_tmp->parse_template(ipfix_msg->data_couple[i].data_template, conf) != 0) {
-				/* Template cannot be parsed, skip data set */
-				delete table_tmp;
-				continue;
-			}
-			
-			templates->insert(std::pair<uint16_t, template_table*>(template_id, table_tmp));
-			table = templates->find(template_id);
-		} else {
-			/* Check template time. On reception of a new template it is crucial to rewrite the old one. */
-			if (ipfix_msg->data_couple[i].data_template->first_transmission > table->second->get_first_transmission()) {
-				MSG_DEBUG(msg_module, "Received new template with already used template ID: %hu", template_id);
+	if (table == NULL) {
+		MSG_DEBUG(msg_module, "Received new template: %hu", template_id);
+	} else {
+		/* On reception of a new template it is crucial to rewrite the old one. */
+		MSG_DEBUG(msg_module, "Received new template with already used template ID: %hu", template_id);
+
+		/* Flush data of the old template */
+		std::map<uint16_t, template_table*> old_templates;
+		old_templates.insert(std::make_pair(template_id, table));
+		flush_data(conf, od->exporter_ip_addr, odid, &old_templates, false);
+
+		/* Remove rewritten template */
+		templates->erase(template_id);
+		conf->table_index->erase(key);
+		delete table;
+	}
 
-				/* Init map for old template if necessary */
-				if (old_templates == NULL) {
-					old_templates = new std::map<uint16_t,template_table*>;
-				}
+	table = new template_table(template_id, conf->buff_size);
+	if (table->parse_template(tmpl, conf) != 0) {
+		/* Template cannot be parsed, skip data set */
+		delete table;
+		return NULL;
+	}
+
+	templates->insert(std::pair<uint16_t, template_table*>(template_id, table));
+	conf->table_index->insert(key, table);
+	return table;
+}
 
-				/* Store old template */
-				old_templates->insert(std::pair<uint16_t, template_table*>(table->first, table->second));
+extern "C"
+int store_packet(void *config, const struct ipfix_message *ipfix_msg,
+		const struct ipfix_template_mgr *template_mgr)
+{
+	(void) template_mgr;
+	struct fastbit_config *conf = (struct fastbit_config *) config;
 
-				/* Flush data */
-				flush_data(conf, exporter_ip_addr, odid, old_templates, false);
+	static int rcnt = 0;
 
-				/* Remove rewritten template */
-				delete table->second;
-				delete old_templates;
-				old_templates = NULL;
+	/* Records of ordered messages belong to the window of the watermark */
+	storage_window_watermark(conf->window, ipfix_msg->watermark);
 
-				/* Remove old template from current list */
-				templates->erase(table);
+	uint32_t odid = ntohl(ipfix_msg->pkt_header->observation_domain_id);
+	struct input_info_network *input = (struct input_info_network *) ipfix_msg->input_info;
 
-				/* Add the new template */
-				template_table *table_tmp = new template_table(template_id, conf->buff_size);
-				if (table_tmp->parse_template(ipfix_msg->data_couple[i].data_template, conf) != 0) {
-					/* Template cannot be parsed; skip data set */
-					delete table_tmp;
-					continue;
-				}
+	int rc_flows = 0;
+	uint64_t rc_flows_sum = 0;
 
-				templates->insert(std::pair<uint16_t, template_table*>(template_id, table_tmp));
-				table = templates->find(template_id);
-				/* New template was created; create new directory if necessary */
-			}
+	/* Find observation domain by binary exporter address and ODID */
+	struct od_key key;
+	memset(&key, 0, sizeof(key));
+	if (input->l3_proto == 6) { /* IPv6 */
+		memcpy(key.addr, &(input->src_addr.ipv6), sizeof(key.addr));
+	} else { /* IPv4 */
+		key.addr[0] = input->src_addr.ipv4.s_addr;
+	}
+	key.odid = odid;
+	key.l3_proto = input->l3_proto;
+
+	struct od_info *od = conf->od_index->find(key);
+	if (od == NULL) {
+		od = add_od_info(conf, input, odid);
+		conf->od_index->insert(key, od);
+	}
+
+	/* Path is generated once per observation domain and window */
+	bool new_dir = false;
+	if (od->window != conf->window_gen) {
+		od->path = generate_path(conf, od->exporter_ip_addr, odid);
+		od->window = conf->window_gen;
+		new_dir = true;
+	}
+
+	/* Process all datasets in message */
+	int i = 0;
+	while (i < MSG_MAX_DATA_COUPLES && ipfix_msg->data_couple[i].data_set) {
+		struct ipfix_template *tmpl = ipfix_msg->data_couple[i].data_template;
+
+		/* Coalesce consecutive data sets with the same template */
+		int first = i;
+		do {
+			i++;
+		} while (i < MSG_MAX_DATA_COUPLES && ipfix_msg->data_couple[i].data_set
+				&& ipfix_msg->data_couple[i].data_template == tmpl);
+
+		if (tmpl == NULL) {
+			/* Skip data couples without templates */
+			continue;
 		}
 
-		/* Check whether data has to be flushed before storing data record */
+		template_table *table = get_table(conf, od, odid, tmpl);
+		if (table == NULL) {
+			continue;
+		}
+
+		/* Check whether data has to be flushed before storing data records */
 		bool flush_records = conf->records_window > 0 && rcnt > conf->records_window;
 		bool flush_time = false;
 		time_t now;
-		if (conf->time_window > 0) {
+		void *prepared;
+		if (conf->window != NULL) {
+			/* Directories of the new window are already created */
+			flush_time = storage_window_switch(conf->window, &now, &prepared);
+		} else if (conf->time_window > 0) {
 			time(&now);
 			flush_time = difftime(now, conf->last_flush) > conf->time_window;
 		}
@@ -618,6 +778,9 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
 			/* Time management differs between flush policies (records vs. time) */
 			if (flush_records) {
 				time(&(conf->last_flush));
+			} else if (conf->window != NULL) {
+				/* Start of the new window */
+				conf->last_flush = now;
 			} else if (flush_time) {
 				while (difftime(now, conf->last_flush) > conf->time_window) {
 					conf->last_flush = conf->last_flush + conf->time_window;
@@ -626,32 +789,29 @@ int store_packet(void *config, const struct ipfix_message *ipfix_msg,
 
 			/* Update window name and path */
 			update_window_name(conf);
-			odid_it->second.path = generate_path(conf, exporter_ip_addr, (*odid_it).first);
+			od->path = generate_path(conf, od->exporter_ip_addr, odid);
+			od->window = conf->window_gen;
 
 			rcnt = 0;
-			conf->new_dir = true;
+			new_dir = true;
 		}
 
-		/* Store this data record */
-		rc_flows = (*table).second->store(ipfix_msg->data_couple[i].data_set, odid_it->second.path, conf->new_dir);
+		/* Store data records of all coalesced data sets */
+		rc_flows = table->store(ipfix_msg, first, i - first, od->path, new_dir);
 		if (rc_flows >= 0) {
 			rc_flows_sum += rc_flows;
 			rcnt += rc_flows;
 		} else {
 			/* No need for showing error message here, since it is already done 
 			 * by store() in case of an error */
-			// MSG_ERROR(msg_module, "An error occurred during FastBit table store; no records were stored");
 		}
 	}
 
-	/* We've told all tables that the directory has changed */
-	conf->new_dir = false;
-
 	if (rc_flows_sum) {
-		odid_it->second.flow_watch.add_flows(rc_flows_sum);
+		od->flow_watch.add_flows(rc_flows_sum);
 	}
 
-	odid_it->second.flow_watch.update_seq_no(ntohl(ipfix_msg->pkt_header->sequence_number));
+	od->flow_watch.update_seq_no(ntohl(ipfix_msg->pkt_header->sequence_number));
 	return 0;
 }
 
@@ -674,6 +834,9 @@ int storage_close(void **config)
 	std::map<uint16_t, template_table*> *templates;
 	std::map<uint16_t, template_table*>::iterator table;
 
+	/* Stop preparing window directories */
+	storage_window_destroy(conf->window);
+
 	/* Iterate over all exporters and ODIDs, flush data and release templates */
 	for (exporter_it = od_infos->begin(); exporter_it != od_infos->end(); ++exporter_it) {
 		for (odid_it = exporter_it->second->begin(); odid_it != exporter_it->second->end(); ++odid_it) {
@@ -693,6 +856,10 @@ int storage_close(void **config)
 	delete od_infos;
 	delete conf->index_en_id;
 	delete conf->dirs;
+	delete conf->sources;
+	delete conf->od_index;
+	delete conf->table_index;
+	pthread_mutex_destroy(&(conf->sources_mutex));
 	delete conf;
 	return 0;
 }
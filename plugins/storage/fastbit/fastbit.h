@@ -86,6 +86,12 @@ struct od_info {
 	/* Directory for storing data for this observation domain */
 	std::string path;
 
+	/* Window generation the path belongs to */
+	uint32_t window;
+
+	/* Unique number of the observation domain (part of template table keys) */
+	uint32_t id;
+
 	/* FlowWatch for monitoring statistics */
 	FlowWatch flow_watch;
 };
@@ -201,16 +201,11 @@ int template_table::dir_check(std::string path, bool new_dir)
 	return 0;
 }
 
-int template_table::store(ipfix_data_set *data_set, std::string path, bool new_dir)
+int template_table::store(const struct ipfix_message *msg, int first, int count, const std::string &path, bool new_dir)
 {
-	uint8_t *data = data_set->records;
 	uint16_t element_size = 0;
 	uint32_t record_cnt = 0;
 
-	if (data == NULL) {
-		return 0;
-	}
-
 	/* When opening new directory, go back to original name (duplicity should be gone) */
 	if (new_dir && this->_orig_name[0] != '\0') {
 		if (this->_rows_in_window > this->_rows_count) {
@@ -225,38 +220,46 @@ int template_table::store(ipfix_data_set *data_set, std::string path, bool new_d
 		this->_new_dir = true;
 	}
 
-	/* Count how many records data_set contains */
-	uint16_t data_size = (ntohs(data_set->header.length) - (sizeof(struct ipfix_set_header)));
-	uint16_t read_data = 0;
-	while (read_data < data_size) {
-		if ((data_size - read_data) < _min_record_size) {
-			break;
-		}
-
-		record_cnt++;
+	for (int i = first; i < first + count; i++) {
+		struct ipfix_data_set *data_set = msg->data_couple[i].data_set;
+		uint8_t *data = data_set->records;
 
-		for (el_it = elements.begin(); el_it != elements.end() && read_data < data_size; ++el_it) {
-			element_size = (*el_it)->fill(data);
-			data += element_size;
-			read_data += element_size;
-		}
+		/* Count how many records data_set contains */
+		uint16_t data_size = (ntohs(data_set->header.length) - (sizeof(struct ipfix_set_header)));
+		uint16_t read_data = 0;
+		while (read_data < data_size) {
+			if ((data_size - read_data) < _min_record_size) {
+				break;
+			}
 
-		_rows_count++;
-		if (_rows_count >= _buff_size) {
-			_rows_in_window += _rows_count;
+			record_cnt++;
 
-			if (this->dir_check(path + _name, this->_new_dir) != 0) {
-				return -1;
+			for (el_it = elements.begin(); el_it != elements.end() && read_data < data_size; ++el_it) {
+				element_size = (*el_it)->fill(data);
+				data += element_size;
+				read_data += element_size;
 			}
 
-			for (el_it = elements.begin(); el_it != elements.end(); ++el_it) {
-				(*el_it)->flush(path + _name);
-			}
+			_rows_count++;
+			if (_rows_count >= _buff_size) {
+				_rows_in_window += _rows_count;
+
+				std::string dir = path + _name;
+				if (this->dir_check(dir, this->_new_dir) != 0) {
+					return -1;
+				}
 
-			/* Update -part.txt so that the data is ready for processing */
-			this->update_part(path + _name);
-			_rows_count = 0;
-			_rows_in_window = 0;
+				/* dir_check may rename the table */
+				dir = path + _name;
+				for (el_it = elements.begin(); el_it != elements.end(); ++el_it) {
+					(*el_it)->flush(dir);
+				}
+
+				/* Update -part.txt so that the data is ready for processing */
+				this->update_part(dir);
+				_rows_count = 0;
+				_rows_in_window = 0;
+			}
 		}
 	}
 
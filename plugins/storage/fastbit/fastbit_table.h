@@ -93,15 +93,18 @@ public:
 	int parse_template(struct ipfix_template *tmp, struct fastbit_config *config);
 
 	/**
-	 * \brief Parse data_set and store its data in memory
+	 * \brief Parse consecutive data sets and store their data in memory
 	 *
 	 * If memory usage is about to exceed memory limit, data is flushed to disk.
 	 *
-	 * @param data_set ipfixcol data set
+	 * @param msg ipfixcol message
+	 * @param first index of the first data couple
+	 * @param count number of data couples (all described by this template)
 	 * @param path path to direcotry where should be data flushed
 	 * @param new_dir does the path lead to new directory?
+	 * @return number of stored records or -1 on error
 	 */
-	int store(ipfix_data_set *data_set, std::string path, bool new_dir);
+	int store(const struct ipfix_message *msg, int first, int count, const std::string &path, bool new_dir);
 
 	int update_part(std::string path);
 
@@ -0,0 +1,188 @@
+/**
+ * \file flat_hash.h
+ * \brief Open addressing hash table with integer-like keys
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef FLAT_HASH_H_
+#define FLAT_HASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+/* Hash of 64-bit integer (Fibonacci hashing) */
+struct flat_hash_u64 {
+	size_t operator()(uint64_t key) const {
+		return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+	}
+};
+
+/* Hash table with linear probing stored in one array. Values are pointers
+ * owned by someone else, NULL marks an empty slot.
+ */
+template <typename Key, typename Value, typename Hash>
+class flat_hash
+{
+private:
+	struct slot {
+		Key key;
+		Value *value;
+	};
+
+	std::vector<slot> _slots;
+	size_t _mask;
+	size_t _count;
+	Hash _hash;
+
+	void grow()
+	{
+		std::vector<slot> old;
+		old.swap(_slots);
+
+		_slots.resize(old.size() * 2);
+		_mask = _slots.size() - 1;
+		_count = 0;
+
+		for (size_t i = 0; i < old.size(); i++) {
+			if (old[i].value != NULL) {
+				insert(old[i].key, old[i].value);
+			}
+		}
+	}
+
+public:
+	/**
+	 * \brief Constructor
+	 *
+	 * @param capacity Initial capacity (power of two)
+	 */
+	flat_hash(size_t capacity = 64): _slots(capacity), _mask(capacity - 1), _count(0)
+	{
+		for (size_t i = 0; i < _slots.size(); i++) {
+			_slots[i].value = NULL;
+		}
+	}
+
+	/**
+	 * \brief Find value by key
+	 *
+	 * @param key Key
+	 * @return Value or NULL when the key is not present
+	 */
+	Value *find(const Key &key) const
+	{
+		size_t idx = _hash(key) & _mask;
+
+		while (_slots[idx].value != NULL) {
+			if (_slots[idx].key == key) {
+				return _slots[idx].value;
+			}
+
+			idx = (idx + 1) & _mask;
+		}
+
+		return NULL;
+	}
+
+	/**
+	 * \brief Insert new item or replace value of existing key
+	 *
+	 * @param key Key
+	 * @param value Value (must not be NULL)
+	 */
+	void insert(const Key &key, Value *value)
+	{
+		/* Keep load factor under 1/2 */
+		if ((_count + 1) * 2 > _slots.size()) {
+			grow();
+		}
+
+		size_t idx = _hash(key) & _mask;
+		while (_slots[idx].value != NULL) {
+			if (_slots[idx].key == key) {
+				_slots[idx].value = value;
+				return;
+			}
+
+			idx = (idx + 1) & _mask;
+		}
+
+		_slots[idx].key = key;
+		_slots[idx].value = value;
+		_count++;
+	}
+
+	/**
+	 * \brief Remove item
+	 *
+	 * Following items of the cluster are shifted back, so no tombstones are needed.
+	 *
+	 * @param key Key
+	 */
+	void erase(const Key &key)
+	{
+		size_t idx = _hash(key) & _mask;
+
+		while (_slots[idx].value != NULL && !(_slots[idx].key == key)) {
+			idx = (idx + 1) & _mask;
+		}
+
+		if (_slots[idx].value == NULL) {
+			return;
+		}
+
+		_slots[idx].value = NULL;
+		_count--;
+
+		size_t next = (idx + 1) & _mask;
+		while (_slots[next].value != NULL) {
+			size_t home = _hash(_slots[next].key) & _mask;
+
+			/* Move the item when the hole lies between its home and its slot */
+			if ((next > idx && (home <= idx || home > next))
+					|| (next < idx && home <= idx && home > next)) {
+				_slots[idx] = _slots[next];
+				_slots[next].value = NULL;
+				idx = next;
+			}
+
+			next = (next + 1) & _mask;
+		}
+	}
+};
+
+#endif /* FLAT_HASH_H_ */
@@ -4,6 +4,9 @@ extern "C" {
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
 }
 
 #include <libxml/parser.h>
@@ -40,16 +40,12 @@
 #include "File.h"
 #include <stdexcept>
 #include <string>
-#include <vector>
+#include <algorithm>
 
 #include <cstring>
 #include <cerrno>
 #include <cstdio>
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
 
 #define DEF_WINDOW_SIZE (300)
 #define DEF_WINDOW_ALIGN (true)
@@ -123,44 +119,51 @@ File::File(const pugi::xpath_node &config)
 		}
 	}
 
-	// Prepare a configuration of the thread for changing time windows
-	_thread = new thread_ctx_t;
-	_thread->new_file = NULL;
-	_thread->new_file_ready = false;
-	_thread->stop = false;
+	// Records are written asynchronously from a set of buffers
+	_io = storage_io_create(_CHUNK_COUNT * 2, 1, 0);
+	if (!_io) {
+		throw std::runtime_error("Failed to create an asynchronous write "
+			"layer.");
+	}
+
+	for (unsigned int i = 0; i < _CHUNK_COUNT; ++i) {
+		_chunks[i].file = this;
+		_chunks[i].data = new char[_CHUNK_SIZE];
+		_chunks[i].busy = false;
+	}
 
-	_thread->storage_path = path;
-	_thread->file_prefix = prefix;
-	_thread->window_size = w_size;
-	time(&_thread->window_time);
+	_current = 0;
+	_fill = 0;
+	_fill_time = 0;
+	_offset = 0;
+	_error = 0;
+
+	// Prepare a configuration of time windows
+	_ctx = new window_ctx_t;
+	_ctx->storage_path = path;
+	_ctx->file_prefix = prefix;
+	time(&_window_time);
 
 	if (w_align) {
 		// Window alignment
-		_thread->window_time = (_thread->window_time / _thread->window_size) *
-			_thread->window_size;
+		_window_time = (_window_time / w_size) * w_size;
 	}
 
 	// Create directory & first file
-	FILE *new_file = file_create(_thread->storage_path, _thread->file_prefix,
-		_thread->window_time);
-	if (!new_file) {
-		delete _thread;
+	_file = file_create(_ctx->storage_path, _ctx->file_prefix, _window_time);
+	if (!_file) {
+		delete _ctx;
+		chunks_free();
 		throw std::runtime_error("Failed to create a time window file.");
 	}
 
-	_file = new_file;
-
-	if (pthread_mutex_init(&_thread->mutex, NULL) != 0) {
-		fclose(_file);
-		delete _thread;
-		throw std::runtime_error("Mutex initialization failed");
-	}
-
-	if (pthread_create(&_thread->thread, NULL, &File::thread_window,
-			_thread) != 0) {
+	// Files of following windows are created in advance
+	_window = storage_window_create(_window_time, w_size, STORAGE_WINDOW_LEAD,
+		&File::window_prepare, &File::window_release, _ctx);
+	if (!_window) {
 		fclose(_file);
-		pthread_mutex_destroy(&_thread->mutex);
-		delete _thread;
+		delete _ctx;
+		chunks_free();
 		throw std::runtime_error("Failed to start a thread for changing time "
 			"windows.");
 	}
@@ -173,99 +176,207 @@ File::File(const pugi::xpath_node &config)
  */
 File::~File()
 {
-	if (_file) {
-		fclose(_file);
+	// Stop preparation first, it uses the context
+	storage_window_destroy(_window);
+
+	file_close();
+	chunks_free();
+	delete _ctx;
+}
+
+/**
+ * \brief Release write buffers and the write layer
+ *
+ * All requests are completed first.
+ */
+void File::chunks_free()
+{
+	storage_io_destroy(_io);
+
+	for (unsigned int i = 0; i < _CHUNK_COUNT; ++i) {
+		delete[] _chunks[i].data;
 	}
+}
 
-	if (_thread) {
-		_thread->stop = true;
-		pthread_join(_thread->thread, NULL);
-		pthread_mutex_destroy(&_thread->mutex);
+/**
+ * \brief Completion of a buffer write (runs on a thread of the write layer)
+ * \param[in] result Bytes written or negative errno value
+ * \param[in] user Written buffer
+ */
+void File::chunk_written(int result, void *user)
+{
+	chunk_t *chunk = (chunk_t *) user;
+	File *file = chunk->file;
 
-		if (_thread->new_file) {
-			fclose(_thread->new_file);
-		}
+	std::lock_guard<std::mutex> lock(file->_mutex);
+	if (result < 0) {
+		file->_error = -result;
+	}
+	chunk->busy = false;
+	file->_cond.notify_one();
+}
+
+/**
+ * \brief Hand the current buffer over to the write layer and switch to the
+ * next one
+ *
+ * Waits only when the next buffer has not been written yet.
+ * \return On success returns 0. Otherwise returns non-zero value.
+ */
+int File::chunk_flush()
+{
+	chunk_t *chunk = &_chunks[_current];
+	int error;
+
+	if (_fill == 0) {
+		return 0;
+	}
 
-		delete _thread;
+	chunk->busy = true;
+	if (storage_io_write(_io, fileno(_file), chunk->data, _fill, _offset,
+			&File::chunk_written, chunk) != 0) {
+		chunk->busy = false;
+		_fill = 0;
+		MSG_ERROR(msg_module, "Failed to write records to a file.");
+		return 1;
+	}
+
+	_offset += _fill;
+	_fill = 0;
+	_current = (_current + 1) % _CHUNK_COUNT;
+
+	// Wait until the next buffer is written
+	chunk = &_chunks[_current];
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cond.wait(lock, [chunk] { return !chunk->busy; });
+		error = _error;
+		_error = 0;
 	}
+
+	if (error) {
+		MSG_ERROR(msg_module, "Failed to write records to a file (%s).",
+			strerror(error));
+		return 1;
+	}
+
+	return 0;
 }
 
 /**
- * \brief Thread function for changing time windows
- * \param[in,out] context Thread configuration
- * \return Nothing
+ * \brief Write all buffered records and close the current file
  */
-void *File::thread_window(void *context)
+void File::file_close()
 {
-	thread_ctx_t *ctx = (thread_ctx_t *) context;
-	MSG_DEBUG(msg_module, "Thread started...");
-
-	while(!ctx->stop) {
-		// Sleep
-		struct timespec tim;
-		tim.tv_sec = 0;
-		tim.tv_nsec = 100000000L; // 0.1 sec
-		nanosleep(&tim, NULL);
-
-		// Get current time
-		time_t now;
-		time(&now);
-
-		if (difftime(now, ctx->window_time) <= ctx->window_size) {
-			continue;
-		}
+	if (!_file) {
+		return;
+	}
 
-		// New time window
-		pthread_mutex_lock(&ctx->mutex);
-		if (ctx->new_file) {
-			fclose(ctx->new_file);
-			ctx->new_file = NULL;
-		}
+	chunk_flush();
+	// The descriptor must stay open until all its writes are completed
+	storage_io_flush(_io);
+	fclose(_file);
 
-		ctx->window_time += ctx->window_size;
-		FILE *file = file_create(ctx->storage_path, ctx->file_prefix,
-			ctx->window_time);
-		if (!file) {
-			MSG_ERROR(msg_module, "Failed to create a time window file.");
-		}
+	_file = NULL;
+	_offset = 0;
+}
+
+/**
+ * \brief Create a file of the next time window (runs on a background thread)
+ * \param[in] start Start of the time window
+ * \param[in] context Window configuration
+ * \return Pointer to the file or NULL
+ */
+void *File::window_prepare(time_t start, void *context)
+{
+	window_ctx_t *ctx = (window_ctx_t *) context;
 
-		// Null pointer is also valid...
-		ctx->new_file = file;
-		ctx->new_file_ready = true;
-		pthread_mutex_unlock(&ctx->mutex);
+	FILE *file = file_create(ctx->storage_path, ctx->file_prefix, start);
+	if (!file) {
+		MSG_ERROR(msg_module, "Failed to create a time window file.");
 	}
 
-	MSG_DEBUG(msg_module, "Thread terminated.");
-	return NULL;
+	return file;
 }
 
 /**
- * \brief Store a record to a file
- * \param[in] record JSON record
+ * \brief Close a file of a time window that was never used
+ * \param[in] prepared File
+ * \param[in] context Window configuration
  */
-void File::ProcessDataRecord(const std::string &record)
+void File::window_release(void *prepared, void *context)
+{
+	(void) context;
+	fclose((FILE *) prepared);
+}
+
+/**
+ * \brief Change the time window when needed
+ *
+ * A partly filled buffer is written too when its records are older than
+ * _CHUNK_MAX_AGE, so the output of a slow exporter does not wait for the
+ * end of the window.
+ */
+void File::window_switch()
 {
 	// Should we change a time window
-	if (_thread->new_file_ready) {
+	void *prepared;
+	if (storage_window_switch(_window, &_window_time, &prepared)) {
 		// Close old time window
-		if (_file) {
-			fclose(_file);
-		}
+		file_close();
 
 		// Get new time window
-		pthread_mutex_lock(&_thread->mutex);
-		_file = _thread->new_file;
-		_thread->new_file = NULL;
-		_thread->new_file_ready = false;
-		pthread_mutex_unlock(&_thread->mutex);
+		_file = (FILE *) prepared;
+		if (!_file) {
+			// The window was not prepared in advance
+			_file = file_create(_ctx->storage_path, _ctx->file_prefix,
+				_window_time);
+		}
+	} else if (_fill > 0 && time(NULL) - _fill_time >= _CHUNK_MAX_AGE) {
+		chunk_flush();
 	}
+}
 
+/**
+ * \brief Pass watermark of a message; the window is closed as soon as all
+ * its records have been delivered
+ * \param[in] watermark Watermark
+ */
+void File::ProcessWatermark(uint64_t watermark)
+{
+	storage_window_watermark(_window, watermark);
+	window_switch();
+}
+
+/**
+ * \brief Store a record to a file
+ * \param[in] record JSON record
+ */
+void File::ProcessDataRecord(const std::string &record)
+{
+	window_switch();
 	if (!_file) {
 		return;
 	}
 
-	// Store the record
-	fwrite(record.c_str(), record.size(), 1, _file);
+	// Copy the record into write buffers
+	const char *data = record.c_str();
+	size_t size = record.size();
+
+	while (size > 0) {
+		if (_fill == _CHUNK_SIZE) {
+			chunk_flush();
+		}
+		if (_fill == 0) {
+			_fill_time = time(NULL);
+		}
+
+		size_t part = std::min(size, _CHUNK_SIZE - _fill);
+		memcpy(_chunks[_current].data + _fill, data, part);
+		_fill += part;
+		data += part;
+		size -= part;
+	}
 }
 
 /**
@@ -296,79 +407,6 @@ int File::dir_name(const time_t &tm, const std::string &tmplt, std::string &dir)
 	return 0;
 }
 
-/**
- * \brief Create a directory for a time window
- *
- * \warning Directory must ends with '/'. Otherwise only directories before last
- * symbol '/' will be created.
- * \param[in] path Directory path
- * \return On success returns 0. Otherwise returns non-zero value.
- */
-int File::dir_create(const std::string &path)
-{
-	const mode_t mask = S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH;
-
-	if (path.empty()) {
-		return 1;
-	}
-
-	std::string tmp = path;
-	std::size_t pos = std::string::npos;
-	std::vector<std::string> mkdir_todo;
-	bool stop = 0;
-
-	// Try to create directories from the end
-	while (!stop && (pos = tmp.find_last_of('/', pos)) != std::string::npos) {
-		// Try to create a directory
-		std::string aux_str = tmp.substr(0, pos + 1);
-		if (aux_str == "/") {
-			// Root
-			MSG_ERROR(msg_module, "Failed to create a storage directory '%s'.",
-				path.c_str());
-			return 1;
-		}
-
-		// Create a directory
-		if (mkdir(aux_str.c_str(), mask) == 0) {
-			// Directory created
-			break;
-		} else {
-			// Failed to create the directory
-			switch(errno) {
-			case EEXIST:
-				// Directory already exists
-				stop = 1;
-				break;
-			case ENOENT:
-				// Parent directory is missing
-				mkdir_todo.push_back(aux_str);
-				pos--;
-				continue;
-			default:
-				// Other errors
-				MSG_ERROR(msg_module, "Failed to create a directory %s (%s).",
-					aux_str.c_str(), strerror(errno));
-				return 1;
-			}
-		}
-	}
-
-	// Create remaining directories
-	while (!mkdir_todo.empty()) {
-		std::string aux_str = mkdir_todo.back();
-		mkdir_todo.pop_back();
-
-		if (mkdir(aux_str.c_str(), mask) != 0) {
-			// Failed to create directory
-			MSG_ERROR(msg_module, "Failed to create a directory %s (%s).",
-					aux_str.c_str(), strerror(errno));
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
 /**
  * \brief Create a file for a time window
  *
@@ -400,7 +438,7 @@ FILE *File::file_create(const std::string &tmplt, const std::string &prefix,
 		return NULL;
 	}
 
-	if (dir_create(directory) != 0) {
+	if (storage_mkdir(directory.c_str()) != 0) {
 		return NULL;
 	}
 
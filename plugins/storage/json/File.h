@@ -45,8 +45,12 @@
 #include <string>
 #include <ctime>
 #include <cstdio>
+#include <mutex>
+#include <condition_variable>
 
-#include <pthread.h>
+extern "C" {
+#include <ipfixcol/storage.h>
+}
 
 /**
  * \brief The class for file output interface
@@ -59,41 +63,85 @@ public:
 
 	// Store a record to the file
 	void ProcessDataRecord(const std::string &record);
+	// Switch time windows by watermarks
+	void ProcessWatermark(uint64_t watermark);
 
 	// Get a directory path for a time window
 	static int dir_name(const time_t &tm, const std::string &tmplt,
 		std::string &dir);
-	// Create a directory for a time window
-	static int dir_create(const std::string &path);
 	// Create a file for a time window
 	static FILE *file_create(const std::string &tmplt, const std::string &prefix,
 				const time_t &tm);
 private:
 	/** Minimal window size */
 	const unsigned int _WINDOW_MIN_SIZE = 60; // seconds
+	/** Size of a write buffer */
+	static const size_t _CHUNK_SIZE = 1024 * 1024;
+	/** Number of write buffers */
+	static const unsigned int _CHUNK_COUNT = 4;
+	/** Maximal age of records in a partly filled buffer */
+	static const time_t _CHUNK_MAX_AGE = 1; // seconds
 
-	/** Configuration of a thread */
-	typedef struct thread_ctx_s {
-		pthread_t thread;            /**< Thread                     */
-		pthread_mutex_t mutex;       /**< Data mutex                 */
-		bool stop;                   /**< Stop flag for temination   */
+	/**
+	 * \brief Write buffer
+	 *
+	 * Records are copied into the current buffer, which is handed over to
+	 * the asynchronous write layer when it is full.
+	 */
+	typedef struct chunk_s {
+		File *file;                  /**< Owner of the buffer        */
+		char *data;                  /**< Buffer                     */
+		bool busy;                   /**< Buffer is being written    */
+	} chunk_t;
 
-		unsigned int window_size;    /**< Size of a time window      */
-		time_t window_time;          /**< Current time window        */
+	/** Configuration of time windows shared with the preparing thread */
+	typedef struct window_ctx_s {
 		std::string storage_path;    /**< Storage path (template)    */
 		std::string file_prefix;     /**< File prefix                */
-
-		FILE *new_file;              /**< New file                   */
-		bool new_file_ready;         /**< New file flag              */
-	} thread_ctx_t;
+	} window_ctx_t;
 
 	/** File descritor */
 	FILE *_file;
-	/** Thread for changing time windows */
-	thread_ctx_t *_thread;
+	/** Start of the current time window */
+	time_t _window_time;
+	/** Configuration of time windows */
+	window_ctx_t *_ctx;
+	/** Preparation of time windows in advance */
+	struct storage_window *_window;
+
+	/** Asynchronous write layer */
+	struct storage_io *_io;
+	/** Write buffers */
+	chunk_t _chunks[_CHUNK_COUNT];
+	/** Buffer being filled */
+	unsigned int _current;
+	/** Bytes in the current buffer */
+	size_t _fill;
+	/** Time of the first record in the current buffer */
+	time_t _fill_time;
+	/** File offset of the current buffer */
+	off_t _offset;
+	/** A write has failed (errno value) */
+	int _error;
+	/** Protects busy flags and the error */
+	std::mutex _mutex;
+	/** Signals a written buffer */
+	std::condition_variable _cond;
+
+	// Change the time window when needed
+	void window_switch();
+	// Write all buffered records and close the current file
+	void file_close();
+	// Release write buffers and the write layer
+	void chunks_free();
+	// Hand the current buffer over to the write layer
+	int chunk_flush();
+	// Completion of a buffer write
+	static void chunk_written(int result, void *user);
 
-	// Window changer
-	static void *thread_window(void *context);
+	// Window preparation callbacks
+	static void *window_prepare(time_t start, void *context);
+	static void window_release(void *prepared, void *context);
 };
 
 #endif // FILE_H
@@ -100,8 +100,15 @@ void Storage::sendData() const
  */
 void Storage::storeDataSets(const ipfix_message* ipfix_msg, struct json_conf * config)
 {
-	/* Iterate through all data records */
-	for (int i = 0; i < ipfix_msg->data_records_count; ++i) {
+	/* Records of ordered messages belong to the window of the watermark */
+	if (ipfix_msg->watermark) {
+		for (Output *output: outputs) {
+			output->ProcessWatermark(ipfix_msg->watermark);
+		}
+	}
+
+	/* Iterate through all data records (no metadata before the plugin was loaded) */
+	for (int i = 0; ipfix_msg->metadata && i < ipfix_msg->data_records_count; ++i) {
 		storeDataRecord(&(ipfix_msg->metadata[i]), config);
 	}
 }
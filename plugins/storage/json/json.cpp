@@ -44,6 +44,9 @@ extern "C" {
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_ALL);
 }
 
 #include <cstring>
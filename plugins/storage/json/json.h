@@ -46,6 +46,7 @@ extern "C" {
 }
 
 #include <string>
+#include <cstdint>
 #include "pugixml/pugixml.hpp"
 
 // Class prototype
@@ -72,6 +73,8 @@ public:
 	virtual ~Output() {}
 
 	virtual void ProcessDataRecord(const std::string& record) = 0;
+	// Watermark of a message from an ordering stage (ipfix_message::watermark)
+	virtual void ProcessWatermark(uint64_t watermark) { (void) watermark; }
 };
 
 #endif // JSON_H
@@ -51,6 +51,9 @@
 // API version constant
 IPFIXCOL_API_VERSION;
 
+// Metadata required by the plugin
+IPFIXCOL_METADATA(MDATA_RECORDS | MDATA_CHANNELS);
+
 // Module identification
 static const char* msg_module= "lnfstore";
 
@@ -301,6 +304,7 @@ struct conf_params *process_startup_xml(const char *params)
 	if (cnf->window_time == 0) {
 		MSG_WARNING(msg_module, "Time windows is not set. Using default value"
 			"(300 seconds).");
+		cnf->window_time = 300;
 	}
 
 	xmlFreeDoc(doc);
@@ -358,7 +362,11 @@ int store_packet (void *config, const struct ipfix_message *ipfix_msg,
 	(void) template_mgr;
 	struct lnfstore_conf *conf = (struct lnfstore_conf *) config;
 	
-	for (int i = 0; i < ipfix_msg->data_records_count; i++)
+	/* Records of ordered messages belong to the window of the watermark */
+	store_watermark(conf, ipfix_msg->watermark);
+
+	/* No metadata in messages built before the plugin was loaded */
+	for (int i = 0; ipfix_msg->metadata && i < ipfix_msg->data_records_count; i++)
 	{
 		store_record(&(ipfix_msg->metadata[i]), conf);
 	}
@@ -381,6 +389,7 @@ int storage_close (void **config)
 	
 	/* Destroy configuration */
 	lnf_rec_free(conf->rec_ptr);
+	storage_window_destroy(conf->window);
 	close_storage_files(conf);
 
 	if (conf->profiles_ptr) {
@@ -73,6 +73,12 @@ typedef struct profile_file_s {
 	lnf_file_t *file;
 } profile_file_t;
 
+/** \brief File of a time window opened in advance */
+typedef struct prepared_file_s {
+	lnf_file_t *file;
+	char *path;
+} prepared_file_t;
+
 /**
  * \brief Configuration of the plugin instantion
  */
@@ -83,6 +89,7 @@ struct lnfstore_conf
 	uint8_t buffer[BUFF_SIZE];       /**< Buffer for record conversion    */
 	lnf_rec_t *rec_ptr;              /**< Converted record */
 	time_t window_start;             /**< Start of current window         */
+	struct storage_window *window;   /**< Preparation of next windows     */
 
 	lnf_file_t *file_ptr;            /**< Storage (for no profiler mode)  */
 
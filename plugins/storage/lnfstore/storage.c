@@ -68,39 +68,6 @@ int cmp_profile_file(const void* m1, const void* m2)
 	return (val1->address < val2->address) ? (-1) : (1);
 }
 
-int mkdir_hierarchy(const char* path)
-{
-	struct stat s;
-	char* pos = NULL;
-	char* realp = NULL;
-	unsigned subs_len = 0;
-	while ((pos = strchr(path + subs_len + 1, '/')) != NULL ) {
-		subs_len = pos - path;
-		int status;
-		bool failed = false;
-		realp = strndup(path, subs_len);
-try_again:
-		status = stat(realp, &s);
-		if (status == -1) {
-			if (ENOENT == errno) {
-				if (mkdir(realp, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH)) {
-					if (!failed) {
-						failed = true;
-						goto try_again;
-					}
-					MSG_ERROR(msg_module, "Failed to create directory: %s", realp);
-					return 1;
-				}
-			}
-		} else if (!S_ISDIR(s.st_mode)) {
-			MSG_ERROR(msg_module, "Failed to create directory, %s is file", realp);
-			return 2;
-		}
-		free(realp);
-	}
-	return 0;
-}
-
 /**
  * \brief Fill new record
  * \param[in] mdata IPFIX record
@@ -156,10 +123,16 @@ int fill_record(const struct metadata *mdata, lnf_rec_t *record, uint8_t *buffer
     return added;
 }
 
-char *create_file_name(struct lnfstore_conf *conf)
+/**
+ * \brief Create a file name (relative to a storage directory) of a window
+ * \param[in] params Plugin parameters
+ * \param[in] start Start of the window
+ * \return Dynamically allocated name or NULL
+ */
+char *create_file_name(const struct conf_params *params, time_t start)
 {
 	struct tm gm;
-	if (gmtime_r(&conf->window_start, &gm) == NULL) {
+	if (gmtime_r(&start, &gm) == NULL) {
 		MSG_ERROR(msg_module, "Failed to convert time to UTC.");
 		return NULL;
 	}
@@ -175,13 +148,13 @@ char *create_file_name(struct lnfstore_conf *conf)
 
 	char file_suffix[1024];
 	length = strftime(file_suffix, sizeof(file_suffix),
-		conf->params->file_suffix, &gm);
+		params->file_suffix, &gm);
 	if (length == 0) {
 		MSG_ERROR(msg_module, "Failed to fill file path template (suffix).");
 		return NULL;
 	}
 
-	length = strlen(time_path) + strlen(conf->params->file_prefix)
+	length = strlen(time_path) + strlen(params->file_prefix)
 		+ strlen(file_suffix) + 1;
 
 	char *file_name = (char *) malloc(length * sizeof(char));
@@ -191,87 +164,132 @@ char *create_file_name(struct lnfstore_conf *conf)
 		return NULL;
 	}
 
-	snprintf(file_name, length, "%s%s%s", time_path, conf->params->file_prefix,
+	snprintf(file_name, length, "%s%s%s", time_path, params->file_prefix,
 		file_suffix);
 	return file_name;
 }
 
-int open_storage_files(struct lnfstore_conf *conf)
+/**
+ * \brief Create a directory hierarchy and open a file in a storage directory
+ * \param[in] params Plugin parameters
+ * \param[in] dir Storage directory
+ * \param[in] file_str File name (relative to the directory)
+ * \param[out] path Full path of the file (can be NULL). Must be freed.
+ * \return Opened file or NULL
+ */
+lnf_file_t *open_file(const struct conf_params *params, const char *dir,
+	const char *file_str, char **path)
 {
-	// Prepare filename(s)
-	char *file_str = create_file_name(conf);
-	if (!file_str) {
-		return 1;
+	size_t size = strlen(file_str) + strlen(dir) + 2; // '/' + '\0'
+	char *total_path = (char *) malloc(size * sizeof(char));
+	if (!total_path) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
+			__FILE__, __LINE__);
+		return NULL;
+	}
+
+	snprintf(total_path, size, "%s/%s", dir, file_str);
+	if (storage_mkdir(total_path) != 0) {
+		free(total_path);
+		return NULL;
 	}
 
-	size_t file_len = strlen(file_str);
 	unsigned int flags = LNF_WRITE;
-	if (conf->params->compress) {
+	if (params->compress) {
 		flags |= LNF_COMP;
 	}
 
+	lnf_file_t *file = NULL;
+	int status = lnf_open(&file, total_path, flags, params->file_ident);
+	if (status != LNF_OK) {
+		MSG_ERROR(msg_module, "Failed to create new file '%s'", total_path);
+		file = NULL;
+	}
+
+	if (path && file) {
+		*path = total_path;
+	} else {
+		free(total_path);
+	}
+
+	return file;
+}
+
+int open_storage_files(struct lnfstore_conf *conf)
+{
+	// Prepare filename(s)
+	char *file_str = create_file_name(conf->params, conf->window_start);
+	if (!file_str) {
+		return 1;
+	}
+
 	if (conf->params->profiles) {
 		// With profiler
 		for (int i = 0; i < conf->profiles_size; ++i) {
 			profile_file_t *profile = &conf->profiles_ptr[i];
 
 			const char *dir = profile_get_directory(profile->address);
-			size_t size = file_len + strlen(dir) + 2; // '/' + '\0'
-
-			char *total_path = (char *) malloc(size * sizeof(char));
-			if (!total_path) {
-				MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
-					__FILE__, __LINE__);
-				continue;
-			}
-
-			snprintf(total_path, size, "%s/%s", dir, file_str);
-			if (mkdir_hierarchy(total_path) != 0) {
-				free(total_path);
-				continue;
-			}
-
-			int status = lnf_open(&profile->file, total_path, flags,
-				conf->params->file_ident);
-			if (status != LNF_OK) {
-				MSG_ERROR(msg_module, "Failed to create new file '%s'",
-					total_path);
-				profile->file = NULL;
-			}
-
-			free(total_path);
+			profile->file = open_file(conf->params, dir, file_str, NULL);
 		}
 	} else {
 		// Without profiler
-		size_t size = file_len + strlen(conf->params->storage_path) + 2; // '/' + '\0'
-		char *total_path = (char *) malloc(size *sizeof(char));
-		if (!total_path) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
-				__FILE__, __LINE__);
-			free(file_str);
-			return 1;
-		}
+		conf->file_ptr = open_file(conf->params, conf->params->storage_path,
+			file_str, NULL);
+	}
 
-		snprintf(total_path, size, "%s/%s", conf->params->storage_path, file_str);
-		if (mkdir_hierarchy(total_path) != 0) {
-			free(total_path);
-			free(file_str);
-			return 1;
-		}
+	free(file_str);
+	return 0;
+}
 
-		int status = lnf_open(&conf->file_ptr, total_path, flags,
-			conf->params->file_ident);
-		if (status != LNF_OK) {
-			MSG_ERROR(msg_module, "Failed to create new file '%s'",
-				total_path);
-			conf->file_ptr = NULL;
-		}
+/**
+ * \brief Pre-open a file of the next window (runs on a background thread)
+ * \param[in] start Start of the window
+ * \param[in] user Plugin parameters
+ * \return Prepared file or NULL
+ */
+void *prepare_window_file(time_t start, void *user)
+{
+	const struct conf_params *params = (const struct conf_params *) user;
 
-		free(total_path);
+	char *file_str = create_file_name(params, start);
+	if (!file_str) {
+		return NULL;
+	}
+
+	prepared_file_t *prepared = calloc(1, sizeof(prepared_file_t));
+	if (!prepared) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)",
+			__FILE__, __LINE__);
+		free(file_str);
+		return NULL;
 	}
 
+	prepared->file = open_file(params, params->storage_path, file_str,
+		&prepared->path);
 	free(file_str);
-	return 0;
+
+	if (!prepared->file) {
+		free(prepared);
+		return NULL;
+	}
+
+	return prepared;
+}
+
+/**
+ * \brief Close and remove a pre-opened file that was never used
+ * \param[in] prepared Prepared file
+ * \param[in] user Plugin parameters
+ */
+void release_window_file(void *prepared, void *user)
+{
+	(void) user;
+	prepared_file_t *file = (prepared_file_t *) prepared;
+
+	lnf_close(file->file);
+	unlink(file->path);
+	free(file->path);
+	free(file);
 }
 
 void close_storage_files(struct lnfstore_conf *conf)
@@ -321,6 +339,43 @@ void new_window(time_t now, struct lnfstore_conf *conf)
 	open_storage_files(conf);
 
 	MSG_INFO(msg_module, "New time window created.");
+
+	if (conf->params->profiles || conf->window) {
+		return;
+	}
+
+	// Files of following windows are opened in advance
+	conf->window = storage_window_create(conf->window_start,
+		conf->params->window_time, STORAGE_WINDOW_LEAD, prepare_window_file,
+		release_window_file, conf->params);
+	if (!conf->window) {
+		MSG_WARNING(msg_module, "Files of time windows will be opened "
+			"synchronously.");
+	}
+}
+
+/**
+ * \brief Swap files at the beginning of a window prepared in advance
+ * \param[in,out] conf Plugin configuration
+ * \param[in] start Start of the window
+ * \param[in] prepared Pre-opened file or NULL
+ */
+void switch_window(struct lnfstore_conf *conf, time_t start, void *prepared)
+{
+	close_storage_files(conf);
+	conf->window_start = start;
+
+	if (prepared) {
+		prepared_file_t *file = (prepared_file_t *) prepared;
+		conf->file_ptr = file->file;
+		free(file->path);
+		free(file);
+	} else {
+		// Preparation failed or the window is over
+		open_storage_files(conf);
+	}
+
+	MSG_INFO(msg_module, "New time window created.");
 }
 
 
@@ -484,6 +539,28 @@ void store_to_profiles(struct lnfstore_conf *conf, void **channels)
 }
 
 
+/**
+ * \brief Switch time windows by watermark of an ordered message
+ *
+ * Files of a window are closed as soon as all its records were delivered.
+ * \param[in,out] conf Plugin configuration
+ * \param[in] watermark Watermark of the message
+ */
+void store_watermark(struct lnfstore_conf *conf, uint64_t watermark)
+{
+	time_t start;
+	void *prepared;
+
+	if (!conf->window || !watermark) {
+		return;
+	}
+
+	storage_window_watermark(conf->window, watermark);
+	if (storage_window_switch(conf->window, &start, &prepared)) {
+		switch_window(conf, start, prepared);
+	}
+}
+
 void store_record(const struct metadata *mdata, struct lnfstore_conf *conf)
 {
 	if (conf->params->profiles && !mdata->channels) {
@@ -502,9 +579,17 @@ void store_record(const struct metadata *mdata, struct lnfstore_conf *conf)
 	}
 
 	// Decide whether close files and create new time window
-	time_t now = time(NULL);
-	if (difftime(now, conf->window_start) > conf->params->window_time) {
-		new_window(now, conf);
+	if (conf->window) {
+		time_t start;
+		void *prepared;
+		if (storage_window_switch(conf->window, &start, &prepared)) {
+			switch_window(conf, start, prepared);
+		}
+	} else {
+		time_t now = time(NULL);
+		if (difftime(now, conf->window_start) > conf->params->window_time) {
+			new_window(now, conf);
+		}
 	}
 
 	// Store record
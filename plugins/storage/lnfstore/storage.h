@@ -47,6 +47,9 @@
 // Store a record
 void store_record(const struct metadata* mdata, struct lnfstore_conf *conf);
 
+// Switch time windows by watermark of an ordered message
+void store_watermark(struct lnfstore_conf *conf, uint64_t watermark);
+
 // Close all output files
 void close_storage_files(struct lnfstore_conf *conf);
 
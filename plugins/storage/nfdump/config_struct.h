@@ -44,6 +44,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <pthread.h>
 
 #include "nfstore.h"
 #include "record_map.h"
@@ -79,6 +80,19 @@ struct nfdumpConfig{
 	/* time of last flush (used for time based rotation,
 	 * name is based on start of interval not its end!) */
 	time_t lastFlush;
+
+	/* preparation of next windows in advance (NULL = synchronous) */
+	struct storage_window *window;
+
+	/* known observation ids, read by the preparing thread */
+	std::vector<uint32_t> *oids;
+	pthread_mutex_t oidsMutex;
+};
+
+/* file of a window opened in advance */
+struct PreparedFile{
+	std::string path;
+	FILE *f;
 };
 
 #endif /* CONFIG_STRUCT_H_ */
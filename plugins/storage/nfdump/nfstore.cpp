@@ -44,6 +44,9 @@ extern "C" {
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
 }
 
 #include <pthread.h>
@@ -54,6 +57,7 @@ IPFIXCOL_API_VERSION;
 #include <time.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <unistd.h>
 #include <lzo/lzoconf.h>
 
 #include <map>
@@ -68,8 +72,17 @@ IPFIXCOL_API_VERSION;
 #include "config_struct.h"
 #include "nfstore.h"
 
-std::string DirHierarchy(struct nfdumpConfig *config, uint32_t oid){
-	struct tm * timeinfo;
+std::string WindowName(struct nfdumpConfig *config, time_t window){
+	struct tm timeinfo;
+	char formatedTime[15];
+
+	localtime_r(&window, &timeinfo);
+	strftime(formatedTime,15,"%Y%m%d%H%M",&timeinfo);
+	return config->prefix + std::string(formatedTime);
+}
+
+std::string DirHierarchy(struct nfdumpConfig *config, uint32_t oid, time_t window){
+	struct tm timeinfo;
 
 	const int ft_size = 1000;
 	char formated_time[ft_size];
@@ -79,67 +92,94 @@ std::string DirHierarchy(struct nfdumpConfig *config, uint32_t oid){
 	std::stringstream ss;
 	std::string domain_id;
 
-	timeinfo = localtime(&(config->lastFlush));
+	localtime_r(&window, &timeinfo);
 
 	ss << oid;
 	domain_id = ss.str();
 
-	strftime(formated_time,ft_size,(config->sysDir).c_str(),timeinfo);
+	strftime(formated_time,ft_size,(config->sysDir).c_str(),&timeinfo);
 
 	dir = std::string(formated_time);
 	while ((o_loc = dir.find ( "%o", o_loc)) != std::string::npos){
 		dir.replace (o_loc, 2, domain_id);
 	}
 
-	dir+= config->windowDir;
+	dir+= WindowName(config, window);
 	return dir;
 }
 
-int DirCheck_r(std::string path){
-	size_t pos;
-	if(mkdir(path.c_str(), 0777) != 0){
-		if(errno == EEXIST) //dir already exists
-			return 0;
-		if(errno == ENOENT){ //check parent directory
-			pos = path.find_last_of("/\\");
-			if(pos == std::string::npos){
-				MSG_ERROR(MSG_MODULE,"Error while creating directory: %s",path.c_str());
-				return 1;
-			}
-			DirCheck_r(path.substr(0,pos));
-			//try create dir again
-			if(mkdir(path.c_str(),0777) != 0){
-				MSG_ERROR(MSG_MODULE,"Error while creating directory: %s",path.c_str());
-				return 1;
-			}
-			return 0;
+std::string DirHierarchy(struct nfdumpConfig *config, uint32_t oid){
+	return DirHierarchy(config, oid, config->lastFlush);
+}
+
+void updateFileName(struct nfdumpConfig *conf){
+	// change window directory name!
+	conf->windowDir = WindowName(conf, conf->lastFlush);
+}
+
+/* open files of the next window for all known observation ids
+ * (runs on a background thread) */
+void *prepareWindow(time_t window, void *user){
+	struct nfdumpConfig *conf = (struct nfdumpConfig *) user;
+	std::map<uint32_t,PreparedFile> *prepared = new std::map<uint32_t,PreparedFile>;
+	std::vector<uint32_t> oids;
+
+	pthread_mutex_lock(&conf->oidsMutex);
+	oids = *conf->oids;
+	pthread_mutex_unlock(&conf->oidsMutex);
+
+	for(size_t i = 0; i < oids.size(); i++){
+		PreparedFile file;
+		file.path = DirHierarchy(conf, oids[i], window);
+		if(storage_mkdir(file.path.c_str()) != 0){
+			continue;
 		}
-		//other error
-		MSG_ERROR(MSG_MODULE,"Error while creating directory: %s",path.c_str());
-		return 1;
+		file.f = fopen(file.path.c_str(),"w+");
+		if(file.f == NULL){
+			MSG_ERROR(MSG_MODULE,"Can't create file: \"%s\"",file.path.c_str());
+			continue;
+		}
+		(*prepared)[oids[i]] = file;
 	}
-	return 0;
+	return prepared;
 }
 
-int DirCheck(std::string path){
-	size_t pos;
-	pos = path.find_last_of("/\\");
-		if(pos == std::string::npos){
-			MSG_ERROR(MSG_MODULE,"Error while creating directory: %s",path.c_str());
-			return 1;
-		}
-	return DirCheck_r(path.substr(0,pos));
+/* close and remove files that were never used */
+void releaseWindow(void *prepared, void *){
+	std::map<uint32_t,PreparedFile> *files = (std::map<uint32_t,PreparedFile> *) prepared;
+	std::map<uint32_t,PreparedFile>::iterator it;
+
+	for(it = files->begin(); it != files->end(); it++){
+		fclose(it->second.f);
+		unlink(it->second.path.c_str());
+	}
+	delete files;
 }
 
+/* close files of all observation ids and create files of the new window */
+void switchWindow(struct nfdumpConfig *conf, void *prepared){
+	std::map<uint32_t,NfdumpFile*>::iterator files_it;
+	std::map<uint32_t,PreparedFile> *ready = (std::map<uint32_t,PreparedFile> *) prepared;
+	std::map<uint32_t,PreparedFile>::iterator ready_it;
+	std::string file_path;
 
-void updateFileName(struct nfdumpConfig *conf){
-	struct tm * timeinfo;
-	char formatedTime[15];
+	updateFileName(conf);
 
-	// change window directory name!
-	timeinfo = localtime ( &(conf->lastFlush));
-	strftime(formatedTime,15,"%Y%m%d%H%M",timeinfo);
-	conf->windowDir = conf->prefix + std::string(formatedTime);
+	for(files_it = conf->files->begin(); files_it!=conf->files->end();files_it++){
+		files_it->second->closeFile();
+		if(ready != NULL && (ready_it = ready->find(files_it->first)) != ready->end()){
+			files_it->second->newFile(ready_it->second.f, conf);
+			ready->erase(ready_it);
+			continue;
+		}
+		file_path = DirHierarchy(conf,files_it->first);
+		storage_mkdir(file_path.c_str());
+		files_it->second->newFile(file_path, conf);
+	}
+
+	if(ready != NULL){
+		releaseWindow(ready, NULL);
+	}
 }
 
 
@@ -239,11 +279,21 @@ int storage_init (char *params, void **config){
 		return 1;
 	}
 
+	c->oids = new std::vector<uint32_t>;
+	pthread_mutex_init(&c->oidsMutex, NULL);
+
 	/* parse configuration xml and updated configure structure according to it */
 	if(processStartupXML(params, c)){
 		MSG_ERROR(MSG_MODULE, "Unable to parse configuration xml!");
 		return 1;
 	}
+
+	/* files of following windows are opened in advance */
+	c->window = storage_window_create(c->lastFlush, c->timeWindow,
+			STORAGE_WINDOW_LEAD, prepareWindow, releaseWindow, c);
+	if(c->window == NULL){
+		MSG_WARNING(MSG_MODULE, "Files of time windows will be created synchronously");
+	}
 	return 0;
 }
 
@@ -259,19 +309,21 @@ int store_packet (void *config,	const struct ipfix_message *ipfix_msg,
 	uint32_t oid = -1;
 
 	//should we create new window?
-	time ( &rawtime );
-	if(difftime(rawtime,conf->lastFlush) > conf->timeWindow){
-		conf->lastFlush = conf->lastFlush + conf->timeWindow;
-		while(difftime(rawtime,conf->lastFlush) > conf->timeWindow){
-			conf->lastFlush = conf->lastFlush + conf->timeWindow;
+	if(conf->window != NULL){
+		void *prepared;
+		//records of ordered messages belong to the window of the watermark
+		storage_window_watermark(conf->window, ipfix_msg->watermark);
+		if(storage_window_switch(conf->window, &conf->lastFlush, &prepared)){
+			switchWindow(conf, prepared);
 		}
-		updateFileName(conf);
-
-		for(files_it = conf->files->begin(); files_it!=conf->files->end();files_it++){
-			files_it->second->closeFile();
-			file_path = DirHierarchy(conf,files_it->first);
-			DirCheck(file_path);
-			files_it->second->newFile(file_path, conf);
+	} else {
+		time ( &rawtime );
+		if(difftime(rawtime,conf->lastFlush) > conf->timeWindow){
+			conf->lastFlush = conf->lastFlush + conf->timeWindow;
+			while(difftime(rawtime,conf->lastFlush) > conf->timeWindow){
+				conf->lastFlush = conf->lastFlush + conf->timeWindow;
+			}
+			switchWindow(conf, NULL);
 		}
 	}
 
@@ -282,10 +334,14 @@ int store_packet (void *config,	const struct ipfix_message *ipfix_msg,
 		MSG_DEBUG(MSG_MODULE,"Received new observation id: %hu", oid);
 		file_tmp = new NfdumpFile();
 		file_path = DirHierarchy(conf,oid);
-		DirCheck(file_path);
+		storage_mkdir(file_path.c_str());
 		file_tmp->newFile(file_path, conf);
 		(*conf->files)[oid] = file_tmp;
 		files_it = conf->files->find(oid);
+
+		pthread_mutex_lock(&conf->oidsMutex);
+		conf->oids->push_back(oid);
+		pthread_mutex_unlock(&conf->oidsMutex);
 	}
 
 	unsigned int recFlows;
@@ -306,6 +362,8 @@ int storage_close (void **config){
 	struct nfdumpConfig *conf = (struct nfdumpConfig *) (*config);
 	std::map<uint32_t,NfdumpFile*>::iterator files_it;
 
+	/* stop preparing thread before the structures are freed */
+	storage_window_destroy(conf->window);
 
 	for(files_it = conf->files->begin(); files_it!=conf->files->end();files_it++){
 		files_it->second->closeFile();
@@ -313,6 +371,8 @@ int storage_close (void **config){
 	}
 
 	delete conf->files;
+	delete conf->oids;
+	pthread_mutex_destroy(&conf->oidsMutex);
 	delete conf;
 
 	return 0;
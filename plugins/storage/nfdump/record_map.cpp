@@ -195,11 +195,18 @@ void BlockHeader::compress(char *buffer, uint *bufferUsed){ //TODO
 
 int NfdumpFile::newFile(std::string name, struct nfdumpConfig* conf){
 	MSG_DEBUG(MSG_MODULE,"Creating new file: \"%s\"",name.c_str());
-	f_ = fopen(name.c_str(),"w+");
-	if(f_ == NULL){
+	FILE *f = fopen(name.c_str(),"w+");
+	if(f == NULL){
+		f_ = NULL;
 		MSG_ERROR(MSG_MODULE,"Can't create file: \"%s\"",name.c_str());
 		return -1;
 	}
+	return newFile(f, conf);
+}
+
+/* use file opened in advance */
+int NfdumpFile::newFile(FILE *f, struct nfdumpConfig* conf){
+	f_ = f;
 	//create header
 	fileHeader_.newHeader(f_,conf);
 	//create stats
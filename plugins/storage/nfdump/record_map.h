@@ -151,6 +151,7 @@ class NfdumpFile{
 	unsigned int bufferUsed_;
 public:
 	int newFile(std::string name, struct nfdumpConfig* conf);
+	int newFile(FILE *f, struct nfdumpConfig* conf);
 	void updateFile(bool compression = false);
 	unsigned int bufferPtk(const struct data_template_couple dtcouple[]);
 	void checkSQNumber(unsigned int SQ, unsigned int recFlows);
@@ -0,0 +1,465 @@
+/**
+ * \file Column.cpp
+ * \brief Column builders of the Parquet/Arrow storage plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+extern "C" {
+#include <ipfixcol/ipfix.h>
+}
+
+#include <endian.h>
+#include <string.h>
+
+#include <stdexcept>
+
+#include "Column.h"
+
+/** Seconds between 1900-01-01 (NTP era) and 1970-01-01 */
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+void arrowCheck(const arrow::Status &status)
+{
+	if (!status.ok()) {
+		throw std::runtime_error(status.ToString());
+	}
+}
+
+Column::Column(const std::string &name, const std::shared_ptr<arrow::DataType> &type, bool dictionary):
+	arrowField(arrow::field(name, type)), dict(dictionary)
+{
+}
+
+/**
+ * \brief Read unsigned integer of reduced size encoding
+ *
+ * \param[in] data Value in network byte order
+ * \param[in] length Length of the value (1 - 8)
+ * \return Host order value
+ */
+static inline uint64_t readUnsigned(const uint8_t *data, uint16_t length)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (length) {
+	case 1:
+		return data[0];
+	case 2:
+		memcpy(&v16, data, sizeof(v16));
+		return be16toh(v16);
+	case 4:
+		memcpy(&v32, data, sizeof(v32));
+		return be32toh(v32);
+	case 8:
+		memcpy(&v64, data, sizeof(v64));
+		return be64toh(v64);
+	default:
+		v64 = 0;
+		for (uint16_t i = 0; i < length; i++) {
+			v64 = (v64 << 8) | data[i];
+		}
+		return v64;
+	}
+}
+
+/**
+ * \brief Column of fixed width values
+ *
+ * \tparam ArrowType Arrow type of the column
+ */
+template <typename ArrowType>
+class FixedColumn : public Column
+{
+protected:
+	typedef typename arrow::TypeTraits<ArrowType>::BuilderType Builder;
+
+	Builder builder;
+
+public:
+	FixedColumn(const std::string &name, const std::shared_ptr<arrow::DataType> &type, bool dictionary):
+		Column(name, type, dictionary), builder(type, arrow::default_memory_pool())
+	{
+	}
+
+	void reserve(int64_t rows)
+	{
+		arrowCheck(builder.Reserve(rows));
+	}
+
+	void appendNull()
+	{
+		builder.UnsafeAppendNull();
+	}
+
+	std::shared_ptr<arrow::Array> finish()
+	{
+		std::shared_ptr<arrow::Array> array;
+		arrowCheck(builder.Finish(&array));
+		return array;
+	}
+};
+
+/** \brief Unsigned integers and IPv4 addresses */
+template <typename ArrowType>
+class UnsignedColumn : public FixedColumn<ArrowType>
+{
+	typedef typename ArrowType::c_type CType;
+
+public:
+	UnsignedColumn(const std::string &name, bool dictionary):
+		FixedColumn<ArrowType>(name, arrow::TypeTraits<ArrowType>::type_singleton(), dictionary)
+	{
+	}
+
+	void append(const uint8_t *data, uint16_t length)
+	{
+		if (length == 0 || length > sizeof(CType)) {
+			this->builder.UnsafeAppendNull();
+			return;
+		}
+
+		this->builder.UnsafeAppend((CType) readUnsigned(data, length));
+	}
+};
+
+/** \brief Signed integers */
+template <typename ArrowType>
+class SignedColumn : public FixedColumn<ArrowType>
+{
+	typedef typename ArrowType::c_type CType;
+
+public:
+	SignedColumn(const std::string &name, bool dictionary):
+		FixedColumn<ArrowType>(name, arrow::TypeTraits<ArrowType>::type_singleton(), dictionary)
+	{
+	}
+
+	void append(const uint8_t *data, uint16_t length)
+	{
+		if (length == 0 || length > sizeof(CType)) {
+			this->builder.UnsafeAppendNull();
+			return;
+		}
+
+		/* Sign extension of reduced size encoding */
+		int shift = 64 - 8 * length;
+		int64_t value = (int64_t) (readUnsigned(data, length) << shift) >> shift;
+		this->builder.UnsafeAppend((CType) value);
+	}
+};
+
+/** \brief Floating point numbers (float64 may use reduced size encoding) */
+template <typename ArrowType>
+class FloatColumn : public FixedColumn<ArrowType>
+{
+	typedef typename ArrowType::c_type CType;
+
+public:
+	FloatColumn(const std::string &name, bool dictionary):
+		FixedColumn<ArrowType>(name, arrow::TypeTraits<ArrowType>::type_singleton(), dictionary)
+	{
+	}
+
+	void append(const uint8_t *data, uint16_t length)
+	{
+		uint32_t v32;
+		uint64_t v64;
+		float f;
+		double d;
+
+		if (length == sizeof(float)) {
+			v32 = (uint32_t) readUnsigned(data, length);
+			memcpy(&f, &v32, sizeof(f));
+			this->builder.UnsafeAppend((CType) f);
+		} else if (length == sizeof(double)) {
+			v64 = readUnsigned(data, length);
+			memcpy(&d, &v64, sizeof(d));
+			this->builder.UnsafeAppend((CType) d);
+		} else {
+			this->builder.UnsafeAppendNull();
+		}
+	}
+};
+
+/** \brief Booleans (RFC 7011: true = 1, false = 2) */
+class BooleanColumn : public FixedColumn<arrow::BooleanType>
+{
+public:
+	BooleanColumn(const std::string &name, bool dictionary):
+		FixedColumn<arrow::BooleanType>(name, arrow::boolean(), dictionary)
+	{
+	}
+
+	void append(const uint8_t *data, uint16_t length)
+	{
+		if (length != 1 || (data[0] != 1 && data[0] != 2)) {
+			builder.UnsafeAppendNull();
+			return;
+		}
+
+		builder.UnsafeAppend(data[0] == 1);
+	}
+};
+
+/** \brief Timestamps of all IPFIX precisions */
+class TimestampColumn : public FixedColumn<arrow::TimestampType>
+{
+	enum ELEMENT_TYPE type;
+
+public:
+	TimestampColumn(const std::string &name, enum ELEMENT_TYPE type, bool dictionary):
+		FixedColumn<arrow::TimestampType>(name, arrow::timestamp(unit(type), "UTC"), dictionary),
+		type(type)
+	{
+	}
+
+	static arrow::TimeUnit::type unit(enum ELEMENT_TYPE type)
+	{
+		switch (type) {
+		case ET_DATE_TIME_SECONDS:
+			return arrow::TimeUnit::SECOND;
+		case ET_DATE_TIME_MILLISECONDS:
+			return arrow::TimeUnit::MILLI;
+		case ET_DATE_TIME_MICROSECONDS:
+			return arrow::TimeUnit::MICRO;
+		default:
+			return arrow::TimeUnit::NANO;
+		}
+	}
+
+	void append(const uint8_t *data, uint16_t length)
+	{
+		uint64_t value, sec, frac;
+
+		switch (type) {
+		case ET_DATE_TIME_SECONDS:
+			if (length != 4) {
+				break;
+			}
+
+			builder.UnsafeAppend(readUnsigned(data, length));
+			return;
+		case ET_DATE_TIME_MILLISECONDS:
+			if (length != 8) {
+				break;
+			}
+
+			builder.UnsafeAppend(readUnsigned(data, length));
+			return;
+		case ET_DATE_TIME_MICROSECONDS:
+		case ET_DATE_TIME_NANOSECONDS:
+			if (length != 8) {
+				break;
+			}
+
+			/* NTP timestamp: seconds since 1900 and fraction of a second */
+			value = readUnsigned(data, length);
+			sec = (value >> 32) - NTP_UNIX_OFFSET;
+			frac = value & 0xFFFFFFFF;
+			if (type == ET_DATE_TIME_MICROSECONDS) {
+				/* The lowest 11 bits of the fraction are ignored (RFC 7011) */
+				frac &= 0xFFFFF800;
+				builder.UnsafeAppend(sec * 1000000 + ((frac * 1000000) >> 32));
+			} else {
+				builder.UnsafeAppend(sec * 1000000000 + ((frac * 1000000000) >> 32));
+			}
+			return;
+		default:
+			break;
+		}
+
+		builder.UnsafeAppendNull();
+	}
+};
+
+/** \brief MAC and IPv6 addresses */
+class FixedBinaryColumn : public FixedColumn<arrow::FixedSizeBinaryType>
+{
+	uint16_t width;
+
+public:
+	FixedBinaryColumn(const std::string &name, uint16_t width, bool dictionary):
+		FixedColumn<arrow::FixedSizeBinaryType>(name, arrow::fixed_size_binary(width), dictionary),
+		width(width)
+	{
+	}
+
+	void append(const uint8_t *data, uint16_t length)
+	{
+		if (length != width) {
+			builder.UnsafeAppendNull();
+			return;
+		}
+
+		builder.UnsafeAppend(data);
+	}
+};
+
+/**
+ * \brief Strings and octet arrays
+ *
+ * \tparam ArrowType arrow::StringType or arrow::BinaryType
+ */
+template <typename ArrowType>
+class VariableColumn : public Column
+{
+	typedef typename arrow::TypeTraits<ArrowType>::BuilderType Builder;
+
+	Builder builder;
+	bool trim;
+
+public:
+	VariableColumn(const std::string &name, bool trim, bool dictionary):
+		Column(name, arrow::TypeTraits<ArrowType>::type_singleton(), dictionary), trim(trim)
+	{
+	}
+
+	void reserve(int64_t rows)
+	{
+		arrowCheck(builder.Reserve(rows));
+	}
+
+	void append(const uint8_t *data, uint16_t length)
+	{
+		/* Fixed length strings are padded with zeros */
+		if (trim) {
+			const uint8_t *end = (const uint8_t *) memchr(data, 0, length);
+			if (end != NULL) {
+				length = end - data;
+			}
+		}
+
+		arrowCheck(builder.Append(data, length));
+	}
+
+	void appendNull()
+	{
+		builder.UnsafeAppendNull();
+	}
+
+	std::shared_ptr<arrow::Array> finish()
+	{
+		std::shared_ptr<arrow::Array> array;
+		arrowCheck(builder.Finish(&array));
+		return array;
+	}
+};
+
+bool Column::lowCardinality(enum ELEMENT_TYPE type)
+{
+	switch (type) {
+	case ET_UNSIGNED_8:
+	case ET_UNSIGNED_16:
+	case ET_SIGNED_8:
+	case ET_SIGNED_16:
+	case ET_BOOLEAN:
+	case ET_STRING:
+		return true;
+	default:
+		return false;
+	}
+}
+
+std::unique_ptr<Column> Column::create(const std::string &name, enum ELEMENT_TYPE type,
+		uint16_t length, bool dictionary)
+{
+	Column *column;
+
+	switch (type) {
+	case ET_UNSIGNED_8:
+		column = new UnsignedColumn<arrow::UInt8Type>(name, dictionary);
+		break;
+	case ET_UNSIGNED_16:
+		column = new UnsignedColumn<arrow::UInt16Type>(name, dictionary);
+		break;
+	case ET_UNSIGNED_32:
+	case ET_IPV4_ADDRESS:
+		column = new UnsignedColumn<arrow::UInt32Type>(name, dictionary);
+		break;
+	case ET_UNSIGNED_64:
+		column = new UnsignedColumn<arrow::UInt64Type>(name, dictionary);
+		break;
+	case ET_SIGNED_8:
+		column = new SignedColumn<arrow::Int8Type>(name, dictionary);
+		break;
+	case ET_SIGNED_16:
+		column = new SignedColumn<arrow::Int16Type>(name, dictionary);
+		break;
+	case ET_SIGNED_32:
+		column = new SignedColumn<arrow::Int32Type>(name, dictionary);
+		break;
+	case ET_SIGNED_64:
+		column = new SignedColumn<arrow::Int64Type>(name, dictionary);
+		break;
+	case ET_FLOAT_32:
+		column = new FloatColumn<arrow::FloatType>(name, dictionary);
+		break;
+	case ET_FLOAT_64:
+		column = new FloatColumn<arrow::DoubleType>(name, dictionary);
+		break;
+	case ET_BOOLEAN:
+		column = new BooleanColumn(name, dictionary);
+		break;
+	case ET_DATE_TIME_SECONDS:
+	case ET_DATE_TIME_MILLISECONDS:
+	case ET_DATE_TIME_MICROSECONDS:
+	case ET_DATE_TIME_NANOSECONDS:
+		column = new TimestampColumn(name, type, dictionary);
+		break;
+	case ET_MAC_ADDRESS:
+		column = new FixedBinaryColumn(name, 6, dictionary);
+		break;
+	case ET_IPV6_ADDRESS:
+		column = new FixedBinaryColumn(name, 16, dictionary);
+		break;
+	case ET_STRING:
+		column = new VariableColumn<arrow::StringType>(name, length != VAR_IE_LENGTH, dictionary);
+		break;
+	case ET_UNASSIGNED:
+		/* Unknown elements are stored as numbers when possible (as FastBit does) */
+		if (length != VAR_IE_LENGTH && length > 0 && length <= 8) {
+			column = new UnsignedColumn<arrow::UInt64Type>(name, dictionary);
+			break;
+		}
+		/* Fall through */
+	default:
+		column = new VariableColumn<arrow::BinaryType>(name, false, dictionary);
+		break;
+	}
+
+	return std::unique_ptr<Column>(column);
+}
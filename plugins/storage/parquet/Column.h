@@ -0,0 +1,127 @@
+/**
+ * \file Column.h
+ * \brief Column builders of the Parquet/Arrow storage plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef COLUMN_H
+#define COLUMN_H
+
+extern "C" {
+#include <ipfixcol/ipfix_element.h>
+}
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include <arrow/api.h>
+
+/**
+ * \brief Column of a table
+ *
+ * Converts values of one Information Element from their IPFIX encoding
+ * and appends them to an Arrow array builder. Space for a whole row group
+ * is reserved in advance, so fixed width values are appended without any
+ * checks.
+ */
+class Column
+{
+public:
+	/**
+	 * \brief Create column for an Information Element
+	 *
+	 * \param[in] name Column name
+	 * \param[in] type Type of the element (ET_UNASSIGNED when unknown)
+	 * \param[in] length Field length in template (VAR_IE_LENGTH = variable)
+	 * \param[in] dictionary Dictionary encode the column in Parquet files
+	 * \return New column
+	 */
+	static std::unique_ptr<Column> create(const std::string &name, enum ELEMENT_TYPE type,
+			uint16_t length, bool dictionary);
+
+	/**
+	 * \brief Check whether the element type is worth dictionary encoding
+	 *
+	 * \param[in] type Type of the element
+	 * \return True for types with usually low cardinality
+	 */
+	static bool lowCardinality(enum ELEMENT_TYPE type);
+
+	virtual ~Column() {}
+
+	/**
+	 * \brief Reserve space for values of a row group
+	 * \param[in] rows Number of values
+	 */
+	virtual void reserve(int64_t rows) = 0;
+
+	/**
+	 * \brief Append value
+	 * \param[in] data Value in IPFIX encoding
+	 * \param[in] length Length of the value
+	 */
+	virtual void append(const uint8_t *data, uint16_t length) = 0;
+
+	/** \brief Append missing value */
+	virtual void appendNull() = 0;
+
+	/**
+	 * \brief Build array of the appended values and reset the builder
+	 * \return Arrow array
+	 */
+	virtual std::shared_ptr<arrow::Array> finish() = 0;
+
+	/** \brief Arrow field of the column */
+	const std::shared_ptr<arrow::Field> &field() const { return arrowField; }
+
+	/** \brief Whether the column is dictionary encoded */
+	bool dictionary() const { return dict; }
+
+protected:
+	Column(const std::string &name, const std::shared_ptr<arrow::DataType> &type, bool dictionary);
+
+	std::shared_ptr<arrow::Field> arrowField;
+	bool dict;
+};
+
+/**
+ * \brief Throw exception when Arrow operation failed
+ * \param[in] status Status of the operation
+ */
+void arrowCheck(const arrow::Status &status);
+
+#endif // COLUMN_H
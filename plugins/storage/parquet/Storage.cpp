@@ -0,0 +1,537 @@
+/**
+ * \file Storage.cpp
+ * \brief Storage of flow records in Parquet/Arrow files
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+extern "C" {
+#include <ipfixcol.h>
+}
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "Storage.h"
+
+static const char *msg_module = "parquet storage";
+
+/** Padding Information Element (paddingOctets) */
+#define IE_PADDING 210
+
+/**
+ * \brief Column name of an Information Element
+ *
+ * \param[in] en Enterprise number
+ * \param[in] id Element ID
+ * \param[out] type Type of the element
+ * \return Name from the element catalogue or eXidY for unknown elements
+ */
+static std::string elementName(uint32_t en, uint16_t id, enum ELEMENT_TYPE *type)
+{
+	const ipfix_element_t *elem = get_element_by_id(id, en);
+	if (elem != NULL) {
+		*type = elem->type;
+		return elem->name;
+	}
+
+	std::stringstream ss;
+	ss << "e" << en << "id" << id;
+	*type = ET_UNASSIGNED;
+	return ss.str();
+}
+
+bool Storage::DomainKey::operator<(const DomainKey &other) const
+{
+	return memcmp(this, &other, sizeof(*this)) < 0;
+}
+
+Storage::Storage(const struct parquet_conf *conf):
+	conf(conf), windowStart(conf->windowStart), window(0), windowHelper(NULL)
+{
+	/* Columns of the unified schema are known in advance */
+	for (const element_key &key: conf->fields) {
+		ColumnSpec spec;
+		spec.name = elementName(key.first, key.second, &spec.type);
+		spec.length = VAR_IE_LENGTH;
+		spec.dictionary = conf->dictionaryAuto ? Column::lowCardinality(spec.type)
+				: conf->dictionary.count(key) > 0;
+		unifiedColumns.push_back(spec);
+	}
+
+	if (conf->timeWindow > 0) {
+		windowHelper = storage_window_create(windowStart, conf->timeWindow, STORAGE_WINDOW_LEAD,
+				prepareWindow, NULL, this);
+		if (windowHelper == NULL) {
+			MSG_WARNING(msg_module, "Window directories will be created synchronously");
+		}
+	}
+}
+
+Storage::~Storage()
+{
+	storage_window_destroy(windowHelper);
+	closeAll();
+}
+
+/**
+ * \brief Expand storage path template of an observation domain
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] start Start of the window
+ * \param[in] exporter Exporter IP address
+ * \param[in] odid Observation Domain ID
+ * \return Directory of the window (ends with '/')
+ */
+std::string Storage::directory(const struct parquet_conf *conf, time_t start,
+		const std::string &exporter, uint32_t odid)
+{
+	struct tm timeinfo;
+	char buffer[1000];
+
+	localtime_r(&start, &timeinfo);
+	if (strftime(buffer, sizeof(buffer), conf->path.c_str(), &timeinfo) == 0) {
+		buffer[0] = '\0';
+	}
+
+	std::string path = buffer;
+	size_t pos = 0;
+	while ((pos = path.find("%E", pos)) != std::string::npos) {
+		path.replace(pos, 2, exporter);
+	}
+
+	std::stringstream ss;
+	ss << odid;
+	pos = 0;
+	while ((pos = path.find("%o", pos)) != std::string::npos) {
+		path.replace(pos, 2, ss.str());
+	}
+
+	return path;
+}
+
+/**
+ * \brief Create directories of all known observation domains
+ *
+ * Runs on a background thread ahead of the window start.
+ *
+ * \param[in] start Start of the window
+ * \param[in] user Storage
+ * \return Always NULL, only directories are prepared
+ */
+void *Storage::prepareWindow(time_t start, void *user)
+{
+	Storage *storage = (Storage *) user;
+	std::vector<std::pair<std::string, uint32_t> > sources;
+
+	storage->sourcesMutex.lock();
+	sources = storage->sources;
+	storage->sourcesMutex.unlock();
+
+	for (const auto &source: sources) {
+		storage_mkdir(directory(storage->conf, start, source.first, source.second).c_str());
+	}
+
+	return NULL;
+}
+
+Storage::Domain &Storage::getDomain(const struct ipfix_message *msg)
+{
+	struct input_info_network *input = (struct input_info_network *) msg->input_info;
+	char addr[INET6_ADDRSTRLEN] = "file";
+
+	DomainKey key;
+	memset(&key, 0, sizeof(key));
+	key.odid = ntohl(msg->pkt_header->observation_domain_id);
+	if (input->type != SOURCE_TYPE_IPFIX_FILE) {
+		key.l3_proto = input->l3_proto;
+		if (input->l3_proto == 6) { /* IPv6 */
+			memcpy(key.addr, &(input->src_addr.ipv6), sizeof(key.addr));
+		} else { /* IPv4 */
+			key.addr[0] = input->src_addr.ipv4.s_addr;
+		}
+	}
+
+	auto it = domains.find(key);
+	if (it != domains.end()) {
+		return it->second;
+	}
+
+	if (input->type != SOURCE_TYPE_IPFIX_FILE) {
+		if (input->l3_proto == 6) {
+			inet_ntop(AF_INET6, &(input->src_addr.ipv6), addr, sizeof(addr));
+		} else {
+			inet_ntop(AF_INET, &(input->src_addr.ipv4), addr, sizeof(addr));
+		}
+	}
+
+	Domain &domain = domains[key];
+	domain.exporter = addr;
+	domain.odid = key.odid;
+	domain.window = window - 1;
+
+	sourcesMutex.lock();
+	sources.push_back(std::make_pair(domain.exporter, domain.odid));
+	sourcesMutex.unlock();
+
+	MSG_INFO(msg_module, "New observation domain %u of exporter %s", domain.odid, addr);
+	return domain;
+}
+
+void Storage::buildPlan(Plan &plan, const struct ipfix_template *tmpl)
+{
+	plan.fields.clear();
+	plan.missing.clear();
+	plan.columns.clear();
+	plan.minLength = 0;
+	plan.variable = false;
+
+	std::vector<bool> used(unifiedColumns.size(), false);
+	std::set<std::string> names;
+
+	const template_ie *field = tmpl->fields;
+	for (int i = 0; i < tmpl->field_count; i++, field++) {
+		Field f;
+		f.length = field->ie.length;
+		f.column = -1;
+
+		uint16_t id = field->ie.id & 0x7FFF;
+		uint32_t en = 0;
+		if (field->ie.id & 0x8000) {
+			/* Enterprise number follows the field */
+			field++;
+			en = field->enterprise_number;
+		}
+
+		if (f.length == VAR_IE_LENGTH) {
+			plan.variable = true;
+			plan.minLength += 1;
+		} else {
+			plan.minLength += f.length;
+		}
+
+		if (conf->unified) {
+			for (size_t c = 0; c < conf->fields.size(); c++) {
+				if (!used[c] && conf->fields[c] == element_key(en, id)) {
+					used[c] = true;
+					f.column = c;
+					break;
+				}
+			}
+		} else if (id != IE_PADDING || en != 0) {
+			ColumnSpec spec;
+			spec.name = elementName(en, id, &spec.type);
+			spec.length = f.length;
+			spec.dictionary = conf->dictionaryAuto ? Column::lowCardinality(spec.type)
+					: conf->dictionary.count(element_key(en, id)) > 0;
+
+			/* Column names must be unique */
+			std::string name = spec.name;
+			for (int n = 2; names.count(spec.name) > 0; n++) {
+				std::stringstream ss;
+				ss << name << "_" << n;
+				spec.name = ss.str();
+			}
+			names.insert(spec.name);
+
+			f.column = plan.columns.size();
+			plan.columns.push_back(spec);
+		}
+
+		plan.fields.push_back(f);
+	}
+
+	for (size_t c = 0; c < used.size(); c++) {
+		if (!used[c]) {
+			plan.missing.push_back(c);
+		}
+	}
+}
+
+Storage::Plan &Storage::getPlan(Domain &domain, const struct ipfix_template *tmpl)
+{
+	/* Template fields follow the fixed part of the structure */
+	size_t fieldsLength = tmpl->template_length - offsetof(struct ipfix_template, fields);
+	const char *fields = (const char *) tmpl->fields;
+
+	Plan &plan = domain.plans[tmpl->template_id];
+	if (plan.layout.size() == fieldsLength && memcmp(plan.layout.data(), fields, fieldsLength) == 0) {
+		return plan;
+	}
+
+	if (!plan.layout.empty()) {
+		/* Template ID was reused with different fields; start a new file */
+		MSG_DEBUG(msg_module, "Template %hu of ODID %u changed", tmpl->template_id, domain.odid);
+		plan.table.reset();
+	}
+
+	plan.layout.assign(fields, fieldsLength);
+	buildPlan(plan, tmpl);
+	return plan;
+}
+
+/**
+ * \brief Create table in the directory of an observation domain
+ *
+ * \param[in] domain Observation domain
+ * \param[in] specs Columns of the table
+ * \param[in] suffix Suffix of the file name (template ID)
+ * \return New table
+ */
+std::unique_ptr<Table> Storage::createTable(Domain &domain, const std::vector<ColumnSpec> &specs,
+		const std::string &suffix)
+{
+	if (domain.window != window) {
+		domain.dir = directory(conf, windowStart, domain.exporter, domain.odid);
+		domain.window = window;
+		if (storage_mkdir(domain.dir.c_str()) != 0) {
+			throw std::runtime_error("Unable to create directory " + domain.dir);
+		}
+	}
+
+	struct tm timeinfo;
+	char formated_time[17];
+	localtime_r(&windowStart, &timeinfo);
+	strftime(formated_time, sizeof(formated_time), "%Y%m%d%H%M%S", &timeinfo);
+
+	/* Do not overwrite files of a redefined template or a previous run */
+	std::string base = domain.dir + conf->prefix + formated_time + suffix;
+	std::string ext = conf->arrow ? ".arrow" : ".parquet";
+	std::string path = base + ext;
+	struct stat st;
+	for (int n = 1; stat(path.c_str(), &st) == 0 || stat((path + ".part").c_str(), &st) == 0; n++) {
+		std::stringstream ss;
+		ss << base << "-" << n << ext;
+		path = ss.str();
+	}
+
+	std::vector<std::unique_ptr<Column> > columns;
+	for (const ColumnSpec &spec: specs) {
+		columns.push_back(Column::create(spec.name, spec.type, spec.length, spec.dictionary));
+	}
+
+	return std::unique_ptr<Table>(new Table(path, std::move(columns), conf));
+}
+
+Table &Storage::getTable(Domain &domain, Plan &plan, uint16_t templateId)
+{
+	if (conf->unified) {
+		if (!domain.unified) {
+			domain.unified = createTable(domain, unifiedColumns, "");
+		}
+
+		return *domain.unified;
+	}
+
+	if (!plan.table) {
+		std::stringstream ss;
+		ss << "_" << templateId;
+		plan.table = createTable(domain, plan.columns, ss.str());
+	}
+
+	return *plan.table;
+}
+
+/**
+ * \brief Get length of a Data Record with variable length fields
+ *
+ * \param[in] fields Template fields
+ * \param[in] rec Beginning of the record
+ * \param[in] max Remaining length of the Data Set
+ * \return Record length or 0 when the record does not fit
+ */
+size_t Storage::recordLength(const std::vector<Field> &fields, const uint8_t *rec, size_t max)
+{
+	size_t length = 0;
+
+	for (const Field &f: fields) {
+		size_t fieldLength = f.length;
+		if (fieldLength == VAR_IE_LENGTH) {
+			if (length + 1 > max) {
+				return 0;
+			}
+
+			fieldLength = rec[length++];
+			if (fieldLength == 255) {
+				if (length + 2 > max) {
+					return 0;
+				}
+
+				fieldLength = ntohs(*((uint16_t *) (rec + length)));
+				length += 2;
+			}
+		}
+
+		length += fieldLength;
+		if (length > max) {
+			return 0;
+		}
+	}
+
+	return length;
+}
+
+void Storage::storeRecords(Plan &plan, Table &table, const struct ipfix_data_set *set)
+{
+	const uint8_t *ptr = set->records;
+	const uint8_t *end = (const uint8_t *) set + ntohs(set->header.length);
+
+	while (plan.minLength > 0 && (size_t) (end - ptr) >= plan.minLength) {
+		size_t length = plan.minLength;
+		if (plan.variable) {
+			length = recordLength(plan.fields, ptr, end - ptr);
+			if (length == 0) {
+				MSG_WARNING(msg_module, "Malformed Data Record; skipping rest of the Data Set");
+				break;
+			}
+		}
+
+		const uint8_t *data = ptr;
+		for (const Field &f: plan.fields) {
+			uint16_t fieldLength = f.length;
+			if (fieldLength == VAR_IE_LENGTH) {
+				fieldLength = *data++;
+				if (fieldLength == 255) {
+					fieldLength = ntohs(*((uint16_t *) data));
+					data += 2;
+				}
+			}
+
+			if (f.column >= 0) {
+				table.column(f.column).append(data, fieldLength);
+			}
+			data += fieldLength;
+		}
+
+		for (size_t column: plan.missing) {
+			table.column(column).appendNull();
+		}
+
+		table.recordAdded();
+		ptr += length;
+	}
+}
+
+/**
+ * \brief Close tables of the finished window
+ */
+void Storage::rotate()
+{
+	bool next = false;
+	time_t now;
+	void *prepared;
+
+	if (windowHelper != NULL) {
+		next = storage_window_switch(windowHelper, &now, &prepared);
+	} else if (conf->timeWindow > 0) {
+		time(&now);
+		next = difftime(now, windowStart) >= conf->timeWindow;
+		if (next) {
+			while (difftime(now, windowStart) >= conf->timeWindow) {
+				windowStart += conf->timeWindow;
+			}
+			now = windowStart;
+		}
+	}
+
+	if (!next) {
+		return;
+	}
+
+	closeAll();
+	windowStart = now;
+	window++;
+}
+
+void Storage::closeAll()
+{
+	for (auto &domain: domains) {
+		for (auto &plan: domain.second.plans) {
+			plan.second.table.reset();
+		}
+		domain.second.unified.reset();
+	}
+}
+
+void Storage::flush()
+{
+	for (auto &domain: domains) {
+		for (auto &plan: domain.second.plans) {
+			if (plan.second.table) {
+				plan.second.table->flush();
+			}
+		}
+
+		if (domain.second.unified) {
+			domain.second.unified->flush();
+		}
+	}
+}
+
+void Storage::storeDataSets(const struct ipfix_message *msg)
+{
+	/* Records of ordered messages belong to the window of the watermark */
+	storage_window_watermark(windowHelper, msg->watermark);
+	rotate();
+
+	Domain &domain = getDomain(msg);
+
+	for (int i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; i++) {
+		const struct ipfix_template *tmpl = msg->data_couple[i].data_template;
+		if (tmpl == NULL) {
+			/* Skip data couples without templates */
+			continue;
+		}
+
+		/* Options data do not fit the unified schema */
+		if (conf->unified && tmpl->template_type != TM_TEMPLATE) {
+			continue;
+		}
+
+		Plan &plan = getPlan(domain, tmpl);
+		if (!conf->unified && plan.columns.empty()) {
+			continue;
+		}
+
+		Table &table = getTable(domain, plan, tmpl->template_id);
+		storeRecords(plan, table, msg->data_couple[i].data_set);
+	}
+}
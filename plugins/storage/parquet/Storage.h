@@ -0,0 +1,161 @@
+/**
+ * \file Storage.h
+ * \brief Storage of flow records in Parquet/Arrow files
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+extern "C" {
+#include <ipfixcol/storage.h>
+}
+
+#include <stdint.h>
+#include <time.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "parquet.h"
+#include "Table.h"
+
+/**
+ * \brief Storage of Data Records into tables of observation domains
+ *
+ * In the per-template schema, each template of an observation domain has its
+ * own table with one column per template field. In the unified schema, all
+ * templates of an observation domain share one table with configured columns;
+ * fields that a template does not contain are null.
+ */
+class Storage
+{
+public:
+	/**
+	 * \brief Constructor
+	 * \param[in] conf Plugin configuration
+	 */
+	Storage(const struct parquet_conf *conf);
+
+	/**
+	 * \brief Destructor; closes all tables
+	 */
+	~Storage();
+
+	/**
+	 * \brief Store Data Records of an IPFIX message
+	 * \param[in] msg IPFIX message
+	 */
+	void storeDataSets(const struct ipfix_message *msg);
+
+	/**
+	 * \brief Write pending records of all tables
+	 */
+	void flush();
+
+private:
+	/** \brief Column definition */
+	struct ColumnSpec {
+		std::string name;
+		enum ELEMENT_TYPE type;
+		uint16_t length;
+		bool dictionary;
+	};
+
+	/** \brief Template field and its column (-1 = skipped) */
+	struct Field {
+		int column;
+		uint16_t length;
+	};
+
+	/** \brief Mapping of a template to table columns */
+	struct Plan {
+		std::string layout;              /**< Template fields (for change detection) */
+		std::vector<Field> fields;       /**< Fields in record order */
+		std::vector<size_t> missing;     /**< Columns not present in the template */
+		std::vector<ColumnSpec> columns; /**< Columns of the per-template table */
+		size_t minLength;                /**< Length of the record (minimal if variable) */
+		bool variable;                   /**< Template has variable length fields */
+		std::unique_ptr<Table> table;    /**< Per-template table */
+	};
+
+	/** \brief Binary identification of an observation domain */
+	struct DomainKey {
+		uint32_t addr[4];
+		uint32_t odid;
+		uint8_t l3_proto;
+
+		bool operator<(const DomainKey &other) const;
+	};
+
+	/** \brief Observation domain */
+	struct Domain {
+		std::string exporter;            /**< Exporter IP address */
+		uint32_t odid;                   /**< Observation Domain ID */
+		std::string dir;                 /**< Directory of the current window */
+		uint32_t window;                 /**< Window of the directory */
+		std::map<uint16_t, Plan> plans;  /**< Plans by template ID */
+		std::unique_ptr<Table> unified;  /**< Table of the unified schema */
+	};
+
+	Domain &getDomain(const struct ipfix_message *msg);
+	Plan &getPlan(Domain &domain, const struct ipfix_template *tmpl);
+	void buildPlan(Plan &plan, const struct ipfix_template *tmpl);
+	Table &getTable(Domain &domain, Plan &plan, uint16_t templateId);
+	std::unique_ptr<Table> createTable(Domain &domain, const std::vector<ColumnSpec> &specs,
+			const std::string &suffix);
+	static size_t recordLength(const std::vector<Field> &fields, const uint8_t *rec, size_t max);
+	void storeRecords(Plan &plan, Table &table, const struct ipfix_data_set *set);
+	void rotate();
+	void closeAll();
+
+	static std::string directory(const struct parquet_conf *conf, time_t start,
+			const std::string &exporter, uint32_t odid);
+	static void *prepareWindow(time_t start, void *user);
+
+	const struct parquet_conf *conf;
+	std::map<DomainKey, Domain> domains;
+	std::vector<ColumnSpec> unifiedColumns;  /**< Columns of the unified schema */
+	time_t windowStart;                      /**< Start of the current window */
+	uint32_t window;                         /**< Number of the current window */
+	struct storage_window *windowHelper;     /**< Preparation of window directories */
+	std::mutex sourcesMutex;                 /**< Protects sources */
+	std::vector<std::pair<std::string, uint32_t> > sources; /**< Known domains */
+};
+
+#endif // STORAGE_H
@@ -0,0 +1,173 @@
+/**
+ * \file Table.cpp
+ * \brief Output file of the Parquet/Arrow storage plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "Table.h"
+
+static const char *msg_module = "parquet storage";
+
+Table::Table(const std::string &path, std::vector<std::unique_ptr<Column> > &&columns,
+		const struct parquet_conf *conf):
+	path(path), tmpPath(path + ".part"), columns(std::move(columns)),
+	rows(0), rowGroupSize(conf->rowGroupSize), total(0), closed(false)
+{
+	std::vector<std::shared_ptr<arrow::Field> > fields;
+	for (const auto &col: this->columns) {
+		fields.push_back(col->field());
+	}
+	schema = arrow::schema(fields);
+
+	auto file = arrow::io::FileOutputStream::Open(tmpPath);
+	arrowCheck(file.status());
+	sink = *file;
+
+	if (conf->arrow) {
+		/* Arrow IPC supports only LZ4 frame and ZSTD buffer compression */
+		arrow::ipc::IpcWriteOptions options = arrow::ipc::IpcWriteOptions::Defaults();
+		if (conf->compression == arrow::Compression::LZ4_FRAME
+				|| conf->compression == arrow::Compression::ZSTD) {
+			auto codec = arrow::util::Codec::Create(conf->compression);
+			arrowCheck(codec.status());
+			options.codec = std::move(*codec);
+		}
+
+		auto writer = arrow::ipc::MakeFileWriter(sink, schema, options);
+		arrowCheck(writer.status());
+		ipcWriter = *writer;
+	} else {
+		parquet::WriterProperties::Builder props;
+		props.compression(conf->compression);
+		props.max_row_group_length(rowGroupSize);
+
+		/* Dictionary pages pay off only for low cardinality columns */
+		props.disable_dictionary();
+		for (const auto &col: this->columns) {
+			if (col->dictionary()) {
+				props.enable_dictionary(col->field()->name());
+			}
+		}
+
+		/* Keep Arrow types (unsigned integers, time zones) for readers */
+		std::shared_ptr<parquet::ArrowWriterProperties> arrowProps =
+				parquet::ArrowWriterProperties::Builder().store_schema()->build();
+
+		auto writer = parquet::arrow::FileWriter::Open(*schema, arrow::default_memory_pool(),
+				sink, props.build(), arrowProps);
+		arrowCheck(writer.status());
+		parquetWriter = std::move(*writer);
+	}
+
+	reserve();
+	MSG_DEBUG(msg_module, "Opened %s (%lu columns)", tmpPath.c_str(), this->columns.size());
+}
+
+Table::~Table()
+{
+	try {
+		close();
+	} catch (std::exception &e) {
+		MSG_ERROR(msg_module, "Unable to close %s: %s", tmpPath.c_str(), e.what());
+	}
+}
+
+void Table::reserve()
+{
+	for (auto &col: columns) {
+		col->reserve(rowGroupSize);
+	}
+}
+
+void Table::flush()
+{
+	if (rows == 0 || closed) {
+		return;
+	}
+
+	std::vector<std::shared_ptr<arrow::Array> > arrays;
+	arrays.reserve(columns.size());
+	for (auto &col: columns) {
+		arrays.push_back(col->finish());
+	}
+
+	if (parquetWriter) {
+		std::shared_ptr<arrow::Table> table = arrow::Table::Make(schema, arrays, rows);
+		arrowCheck(parquetWriter->WriteTable(*table, rows));
+	} else {
+		std::shared_ptr<arrow::RecordBatch> batch = arrow::RecordBatch::Make(schema, rows, arrays);
+		arrowCheck(ipcWriter->WriteRecordBatch(*batch));
+	}
+
+	total += rows;
+	rows = 0;
+	reserve();
+}
+
+void Table::close()
+{
+	if (closed) {
+		return;
+	}
+
+	flush();
+	closed = true;
+
+	if (parquetWriter) {
+		arrowCheck(parquetWriter->Close());
+	} else {
+		arrowCheck(ipcWriter->Close());
+	}
+	arrowCheck(sink->Close());
+
+	/* Files without records are useless */
+	if (total == 0) {
+		unlink(tmpPath.c_str());
+		return;
+	}
+
+	if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+		throw std::runtime_error("Unable to rename " + tmpPath + ": " + strerror(errno));
+	}
+
+	MSG_DEBUG(msg_module, "Closed %s (%lu records)", path.c_str(), total);
+}
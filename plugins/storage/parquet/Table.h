@@ -0,0 +1,128 @@
+/**
+ * \file Table.h
+ * \brief Output file of the Parquet/Arrow storage plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <parquet/arrow/writer.h>
+
+#include "parquet.h"
+#include "Column.h"
+
+/**
+ * \brief Table stored in one Parquet (or Arrow IPC) file
+ *
+ * Records are appended column by column into Arrow builders. When a row
+ * group is complete, the columns are turned into a record batch and written
+ * as one Parquet row group (Arrow IPC record batch). The file is written
+ * under a temporary name and renamed when the table is closed, so readers
+ * never see incomplete files.
+ */
+class Table
+{
+public:
+	/**
+	 * \brief Create file of the table
+	 *
+	 * \param[in] path Path of the file
+	 * \param[in] columns Columns of the table
+	 * \param[in] conf Plugin configuration
+	 */
+	Table(const std::string &path, std::vector<std::unique_ptr<Column> > &&columns,
+			const struct parquet_conf *conf);
+
+	/**
+	 * \brief Destructor; closes the file
+	 */
+	~Table();
+
+	/** \brief Number of columns */
+	size_t size() const { return columns.size(); }
+
+	/** \brief Column of the table */
+	Column &column(size_t index) { return *columns[index]; }
+
+	/**
+	 * \brief Finish record whose values were appended to all columns
+	 */
+	void recordAdded()
+	{
+		if (++rows >= rowGroupSize) {
+			flush();
+		}
+	}
+
+	/**
+	 * \brief Write pending records as a row group
+	 */
+	void flush();
+
+	/**
+	 * \brief Write pending records and close the file
+	 */
+	void close();
+
+	/** \brief Path of the file */
+	const std::string &getPath() const { return path; }
+
+private:
+	void reserve();
+
+	std::string path;
+	std::string tmpPath;
+	std::vector<std::unique_ptr<Column> > columns;
+	std::shared_ptr<arrow::Schema> schema;
+	std::shared_ptr<arrow::io::FileOutputStream> sink;
+	std::unique_ptr<parquet::arrow::FileWriter> parquetWriter;
+	std::shared_ptr<arrow::ipc::RecordBatchWriter> ipcWriter;
+	int64_t rows;          /**< Records in the current row group */
+	int64_t rowGroupSize;  /**< Records per row group */
+	uint64_t total;        /**< Records written to the file */
+	bool closed;
+};
+
+#endif // TABLE_H
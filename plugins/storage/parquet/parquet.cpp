@@ -0,0 +1,284 @@
+/**
+ * \file parquet.cpp
+ * \brief Storage plugin writing flow records into Parquet/Arrow files
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+extern "C" {
+#include <ipfixcol.h>
+#include <ipfixcol/utils.h>
+
+/* API version constant */
+IPFIXCOL_API_VERSION;
+
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+}
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <stdexcept>
+#include "pugixml.hpp"
+
+#include "parquet.h"
+#include "Storage.h"
+
+static const char *msg_module = "parquet storage";
+
+/** Default number of records in a row group */
+#define DEFAULT_ROW_GROUP_SIZE 131072
+
+/** Default length of the time window in seconds */
+#define DEFAULT_TIME_WINDOW 300
+
+/**
+ * \brief Parse list of elements
+ *
+ * \param[in] nodes Nodes with "enterprise" and "id" attributes
+ * \return Elements
+ */
+static std::vector<element_key> parse_elements(const pugi::xpath_node_set &nodes)
+{
+	std::vector<element_key> elements;
+
+	for (pugi::xpath_node_set::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+		std::string en = it->node().attribute("enterprise").value();
+		std::string id = it->node().attribute("id").value();
+		if (en.empty()) {
+			en = "0";
+		}
+
+		int en_int = strtoi(en.c_str(), 10);
+		int id_int = strtoi(id.c_str(), 10);
+		if (en_int == INT_MAX || id_int == INT_MAX || id_int < 0 || id_int > 0x7FFF) {
+			throw std::invalid_argument("Invalid enterprise or field ID (enterprise ID: "
+					+ en + ", field ID: " + id + ")");
+		}
+
+		elements.push_back(element_key(en_int, id_int));
+	}
+
+	return elements;
+}
+
+/**
+ * \brief Check whether configuration value means "yes"
+ */
+static bool is_true(const std::string &value)
+{
+	return strcasecmp(value.c_str(), "yes") == 0 || strcasecmp(value.c_str(), "true") == 0
+			|| value == "1";
+}
+
+void process_startup_xml(struct parquet_conf *conf, char *params)
+{
+	pugi::xml_document doc;
+	pugi::xml_parse_result result = doc.load(params);
+
+	if (!result) {
+		throw std::invalid_argument(std::string("Error when parsing parameters: ") + result.description());
+	}
+
+	pugi::xml_node ie = doc.select_single_node("fileWriter").node();
+
+	/* Storage path */
+	conf->path = ie.child_value("path");
+	if (conf->path.empty()) {
+		throw std::invalid_argument("Storage path is not specified");
+	}
+	if (conf->path.at(conf->path.size() - 1) != '/') {
+		conf->path += "/";
+	}
+
+	/* Output file format */
+	std::string format = ie.child_value("format");
+	if (format.empty() || strcasecmp(format.c_str(), "parquet") == 0) {
+		conf->arrow = false;
+	} else if (strcasecmp(format.c_str(), "arrow") == 0) {
+		conf->arrow = true;
+	} else {
+		throw std::invalid_argument("Unknown format \"" + format + "\"");
+	}
+
+	/* Schema of tables */
+	std::string schema = ie.child_value("schema");
+	if (schema.empty() || strcasecmp(schema.c_str(), "template") == 0) {
+		conf->unified = false;
+	} else if (strcasecmp(schema.c_str(), "unified") == 0) {
+		conf->unified = true;
+		conf->fields = parse_elements(doc.select_nodes("fileWriter/fields/element"));
+		if (conf->fields.empty()) {
+			throw std::invalid_argument("Unified schema requires list of fields");
+		}
+	} else {
+		throw std::invalid_argument("Unknown schema \"" + schema + "\"");
+	}
+
+	/* Dictionary encoded columns (chosen by element type when not specified) */
+	conf->dictionaryAuto = !ie.child("dictionary");
+	std::vector<element_key> dictionary = parse_elements(doc.select_nodes("fileWriter/dictionary/element"));
+	conf->dictionary.insert(dictionary.begin(), dictionary.end());
+
+	/* Row group size */
+	std::string rowGroupSize = ie.child_value("rowGroupSize");
+	conf->rowGroupSize = DEFAULT_ROW_GROUP_SIZE;
+	if (!rowGroupSize.empty()) {
+		conf->rowGroupSize = atoll(rowGroupSize.c_str());
+		if (conf->rowGroupSize <= 0) {
+			throw std::invalid_argument("Invalid row group size \"" + rowGroupSize + "\"");
+		}
+	}
+
+	/* Compression (Arrow IPC files support only LZ4 and ZSTD) */
+	std::string compression = ie.child_value("compression");
+	if (compression.empty()) {
+		compression = conf->arrow ? "none" : "snappy";
+	}
+
+	if (strcasecmp(compression.c_str(), "none") == 0) {
+		conf->compression = arrow::Compression::UNCOMPRESSED;
+	} else if (strcasecmp(compression.c_str(), "zstd") == 0) {
+		conf->compression = arrow::Compression::ZSTD;
+	} else if (strcasecmp(compression.c_str(), "lz4") == 0) {
+		conf->compression = conf->arrow ? arrow::Compression::LZ4_FRAME : arrow::Compression::LZ4;
+	} else if (!conf->arrow && strcasecmp(compression.c_str(), "snappy") == 0) {
+		conf->compression = arrow::Compression::SNAPPY;
+	} else if (!conf->arrow && strcasecmp(compression.c_str(), "gzip") == 0) {
+		conf->compression = arrow::Compression::GZIP;
+	} else {
+		throw std::invalid_argument("Unsupported compression \"" + compression + "\"");
+	}
+
+	/* Time windows */
+	pugi::xml_node interval = ie.child("dumpInterval");
+	std::string timeWindow = interval.child_value("timeWindow");
+	conf->timeWindow = timeWindow.empty() ? DEFAULT_TIME_WINDOW : atoi(timeWindow.c_str());
+
+	time(&(conf->windowStart));
+	if (conf->timeWindow > 0 && is_true(interval.child_value("timeAlignment"))) {
+		/* operators '/' and '*' are used for round down time to time window */
+		conf->windowStart = (conf->windowStart / conf->timeWindow) * conf->timeWindow;
+	}
+
+	conf->prefix = ie.child("namingStrategy").child_value("prefix");
+}
+
+/* plugin inicialization */
+extern "C"
+int storage_init(char *params, void **config)
+{
+	struct parquet_conf *conf = NULL;
+
+	try {
+		/* Create configuration */
+		conf = new struct parquet_conf;
+		conf->storage = NULL;
+
+		/* Process params */
+		process_startup_xml(conf, params);
+
+		/* Create storage */
+		conf->storage = new Storage(conf);
+
+		/* Save configuration */
+		*config = conf;
+	} catch (std::exception &e) {
+		*config = NULL;
+		MSG_ERROR(msg_module, "%s", e.what());
+
+		/* Free allocated memory */
+		if (conf != NULL) {
+			delete conf->storage;
+			delete conf;
+		}
+
+		return 1;
+	}
+
+	MSG_DEBUG(msg_module, "initialized");
+	return 0;
+}
+
+extern "C"
+int store_packet(void *config, const struct ipfix_message *ipfix_msg,
+	const struct ipfix_template_mgr *template_mgr)
+{
+	(void) template_mgr;
+	struct parquet_conf *conf = (struct parquet_conf *) config;
+
+	try {
+		conf->storage->storeDataSets(ipfix_msg);
+	} catch (std::exception &e) {
+		MSG_ERROR(msg_module, "%s", e.what());
+		return 1;
+	}
+
+	return 0;
+}
+
+extern "C"
+int store_now(const void *config)
+{
+	struct parquet_conf *conf = (struct parquet_conf *) config;
+
+	try {
+		conf->storage->flush();
+	} catch (std::exception &e) {
+		MSG_ERROR(msg_module, "%s", e.what());
+		return 1;
+	}
+
+	return 0;
+}
+
+extern "C"
+int storage_close(void **config)
+{
+	MSG_DEBUG(msg_module, "CLOSING");
+	struct parquet_conf *conf = (struct parquet_conf *) *config;
+
+	/* Destroy storage (closes all files) */
+	delete conf->storage;
+
+	/* Destroy configuration */
+	delete conf;
+
+	*config = NULL;
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * \file parquet.h
+ * \brief Parquet/Arrow storage plugin configuration
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef PARQUET_H
+#define PARQUET_H
+
+extern "C" {
+#include <ipfixcol/verbose.h>
+}
+
+#include <stdint.h>
+#include <time.h>
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <arrow/util/compression.h>
+
+/** Identification of an Information Element (enterprise number, element ID) */
+typedef std::pair<uint32_t, uint16_t> element_key;
+
+class Storage;
+
+/**
+ * \brief Parquet plugin configuration
+ */
+struct parquet_conf {
+	std::string path;            /**< Storage path template (strftime, %o, %E) */
+	std::string prefix;          /**< Prefix of file names */
+	bool arrow;                  /**< Write Arrow IPC files instead of Parquet */
+	bool unified;                /**< One schema for all templates of a domain */
+	std::vector<element_key> fields;     /**< Columns of the unified schema */
+	bool dictionaryAuto;         /**< Choose dictionary encoded columns by type */
+	std::set<element_key> dictionary;    /**< Dictionary encoded columns */
+	int64_t rowGroupSize;        /**< Number of records in a row group/batch */
+	arrow::Compression::type compression; /**< Compression codec */
+	uint32_t timeWindow;         /**< Length of the time window (0 = no rotation) */
+	time_t windowStart;          /**< Start of the first window */
+	Storage *storage;
+};
+
+#endif // PARQUET_H
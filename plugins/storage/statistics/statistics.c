@@ -58,6 +58,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 /** Default interval for statistics*/
 #define DEFAULT_INTERVAL 300
 
@@ -58,6 +58,9 @@
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
+/* Metadata required by the plugin */
+IPFIXCOL_METADATA(MDATA_NONE);
+
 // Global variables
 uint8_t INIT_COUNT = 0;  // Number of running instances of plugin
 
@@ -0,0 +1,109 @@
+#!/usr/bin/env bash
+
+# fbitconvert test tool
+#
+# Converts sample nfcapd files sequentially (one file after another with
+# --jobs=1) and concurrently (--jobs=N) and compares number of rows stored for
+# each template. Windows and table names differ between the runs, the data must not.
+#
+# Copyright (C) 2015 CESNET, z.s.p.o.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in
+#    the documentation and/or other materials provided with the
+#    distribution.
+# 3. Neither the name of the Company nor the names of its contributors
+#    may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# ALTERNATIVELY, provided that this notice is retained in full, this
+# product may be distributed under the terms of the GNU General Public
+# License (GPL) version 2 or later, in which case the provisions
+# of the GPL apply INSTEAD OF those given above.
+#
+# This software is provided ``as is, and any express or implied
+# warranties, including, but not limited to, the implied warranties of
+# merchantability and fitness for a particular purpose are disclaimed.
+# In no event shall the company or contributors be liable for any
+# direct, indirect, incidental, special, exemplary, or consequential
+# damages (including, but not limited to, procurement of substitute
+# goods or services; loss of use, data, or profits; or business
+# interruption) however caused and on any theory of liability, whether
+# in contract, strict liability, or tort (including negligence or
+# otherwise) arising in any way out of the use of this software, even
+# if advised of the possibility of such damage.
+#
+
+function usage()
+{
+	echo -e "Usage: $0 '/path/to/nfcapd.*' [jobs]"
+	echo -e "\nThe fbitconvert script is taken from ../src or \$FBITCONVERT."
+	exit 1
+}
+
+if [ $# -lt 1 ] || [ "$1" = "-h" ]; then
+	usage
+fi
+
+SOURCE="$1"
+JOBS="${2:-4}"
+
+if [ -z "$FBITCONVERT" ]; then
+	if [ -x "../src/fbitconvert" ]; then
+		FBITCONVERT="$PWD/../src/fbitconvert"
+	else
+		FBITCONVERT="fbitconvert"
+	fi
+fi
+
+OUTPUT=`mktemp -d "${TMPDIR:-/tmp}/fbitconvert_test.XXXXXX"`
+trap 'rm -rf "$OUTPUT"' EXIT
+
+# Print "<template id> <rows>" for all tables in the storage directory
+function rows()
+{
+	find "$1" -name -part.txt | while read -r part; do
+		local table=`basename "$(dirname "$part")"`
+		# renamed tables (256a, 256b, ...) hold data of the same template
+		echo "${table%%[a-z]*} `sed -n 's/^Number_of_rows *= *//p' "$part"`"
+	done | awk '{ rows[$1] += $2 } END { for (t in rows) print t, rows[t] }' | sort -n
+}
+
+echo "Converting sequentially..."
+for file in $SOURCE; do
+	if ! "$FBITCONVERT" --source="$file" --path="$OUTPUT/seq/" --jobs=1 > "$OUTPUT/seq.log" 2>&1; then
+		cat "$OUTPUT/seq.log"
+		echo "FAIL"
+		exit 1
+	fi
+done
+
+echo "Converting with $JOBS jobs..."
+if ! "$FBITCONVERT" --source="$SOURCE" --path="$OUTPUT/par/" --jobs="$JOBS" > "$OUTPUT/par.log" 2>&1; then
+	cat "$OUTPUT/par.log"
+	echo "FAIL"
+	exit 1
+fi
+
+rows "$OUTPUT/seq" > "$OUTPUT/seq.rows"
+rows "$OUTPUT/par" > "$OUTPUT/par.rows"
+
+if [ ! -s "$OUTPUT/seq.rows" ]; then
+	echo "No data converted"
+	echo "FAIL"
+	exit 1
+fi
+
+if ! diff "$OUTPUT/seq.rows" "$OUTPUT/par.rows"; then
+	echo "FAIL"
+	exit 1
+fi
+
+echo "Rows per template: `tr '\n' ' ' < "$OUTPUT/seq.rows"`"
+echo "OK"
+exit 0
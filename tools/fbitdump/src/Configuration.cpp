@@ -61,12 +61,15 @@
 static const char *msg_module = "configuration";
 
 /** Acceptable command-line parameters (normal) */
-#define OPTSTRING "hVlaA::r:f:n:c:D:N::s:qeIM:m::R:o:v:Zt:i::d::C:Tp:SOP:"
+#define OPTSTRING "hVlaA::r:f:n:c:D:N::s:qeIM:m::R:o:v:Zt:i::d::C:Tp:SOP:k:W:u::"
 
 /** Acceptable command-line parameters (long) */
 struct option long_opts[] = {
 	{ "help",    no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
+	{ "cache",   required_argument, NULL, 'k' },
+	{ "workload", required_argument, NULL, 'W' },
+	{ "tune-indexes", optional_argument, NULL, 'u' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -340,6 +343,27 @@ int Configuration::init(int argc, char *argv[])
 			
 			this->aggregateFilter = optarg;
 			break;
+		case 'k': /* Cache of partial aggregation results */
+			if (optarg == NULL || optarg == std::string("")) {
+				throw std::invalid_argument("-k requires a path to cache directory, empty string given");
+			}
+			this->cacheDir = optarg;
+			break;
+		case 'W': /* Workload file */
+			if (optarg == NULL || optarg == std::string("")) {
+				throw std::invalid_argument("-W requires a path to workload file, empty string given");
+			}
+			this->workloadFile = optarg;
+			break;
+		case 'u': /* Build indexes according to workload */
+			this->tuneIndexes = true;
+			if (optarg != NULL) {
+				this->tuneBudget = Utils::strtoi(optarg, 10);
+				if (this->tuneBudget < 0 || this->tuneBudget == INT_MAX) {
+					throw std::invalid_argument("-u requires a non-negative number of seconds");
+				}
+			}
+			break;
 		default:
 			help();
 			return 1;
@@ -347,6 +371,10 @@ int Configuration::init(int argc, char *argv[])
 		}
 	}
 
+	if (this->tuneIndexes && this->workloadFile.empty()) {
+		throw std::invalid_argument("-u requires a workload file specified by -W");
+	}
+
 	if (this->pipe_name == std::string("") ) {
 		this->pipe_name = "/var/tmp/expiredaemon-queue";
 	}
@@ -779,6 +807,26 @@ bool Configuration::getTemplateInfo() const
 	return this->templateInfo;
 }
 
+std::string Configuration::getCacheDir() const
+{
+	return this->cacheDir;
+}
+
+const std::string &Configuration::getWorkloadFile() const
+{
+	return this->workloadFile;
+}
+
+bool Configuration::getTuneIndexes() const
+{
+	return this->tuneIndexes;
+}
+
+int Configuration::getTuneBudget() const
+{
+	return this->tuneBudget;
+}
+
 void Configuration::processmOption(std::string &order)
 {
 	std::string::size_type pos;
@@ -869,6 +917,11 @@ void Configuration::help() const
 	<< "  -O              Print available output formats" << std::endl
 	<< "  -l              Print plugin list" << std::endl
 	<< "  -P <filter>     Post-aggregation filter (only supported with -A, containing columns in aggregated table only)" << std::endl
+	<< "  -k <dir>, --cache=<dir>   Cache partial aggregation results of each part in <dir> and reuse them" << std::endl
+	<< "                  for parts that have not changed since (only with sum, min, max and count aggregations)" << std::endl
+	<< "  -W <file>, --workload=<file>   Record columns used by filter in workload file" << std::endl
+	<< "  -u[<seconds>], --tune-indexes[=<seconds>]   Build indexes chosen by workload file (-W) on parts older" << std::endl
+	<< "                  than 10 minutes, stop after given CPU time (default 300, 0 for no limit)" << std::endl
 	;
 }
 
@@ -879,7 +932,7 @@ bool Configuration::getOptionm() const
 
 Configuration::Configuration(): maxRecords(0), plainLevel(0), aggregate(false), quiet(false),
 		optm(false), orderColumn(NULL), resolver(NULL), statistics(false), orderAsc(true), extendedStats(false),
-		createIndexes(false), deleteIndexes(false), configFile(CONFIG_XML), templateInfo(false)
+		createIndexes(false), deleteIndexes(false), configFile(CONFIG_XML), templateInfo(false), tuneIndexes(false), tuneBudget(300)
 {}
 
 void Configuration::pushCheckDir(std::string &dir, std::vector<std::string> &list)
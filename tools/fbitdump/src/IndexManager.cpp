@@ -38,9 +38,31 @@
  */
 
 #include "IndexManager.h"
+#include "Verbose.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace fbitdump {
 
+/** Minimal number of queries using a column to index it */
+#define WORKLOAD_MIN_QUERIES 3
+/** Minimal share of recorded queries using a column to index it */
+#define WORKLOAD_MIN_SHARE 0.05
+/** Counters are halved when this number of queries is recorded, so recent workload prevails */
+#define WORKLOAD_DECAY 10000
+/** Parts modified in last COLD_PART_AGE seconds may still be written, they are skipped */
+#define COLD_PART_AGE 600
+
+/** Index for columns compared for equality */
+static const char *equalityIndex = "<binning none/><encoding equality/>";
+/** Index for columns used in range predicates */
+static const char *rangeIndex = "<binning precision=2/><encoding interval-equality/>";
+
 void IndexManager::deleteIndexes(Configuration &conf, TableManager &tm)
 {
 	ibis::partList parts = tm.getParts();
@@ -82,4 +104,206 @@ void IndexManager::createIndexes(Configuration &conf, TableManager &tm)
 	}
 }
 
+uint64_t IndexManager::loadWorkload(const std::string &file, workloadMap &workload)
+{
+	std::ifstream in(file.c_str());
+	std::string key, column;
+	uint64_t queries = 0;
+	ColumnUsage usage;
+
+	if (!in.good()) {
+		return 0;
+	}
+
+	in >> key >> queries;
+	if (in.fail() || key != "queries") {
+		std::cerr << "Invalid workload file " << file << ", ignoring its content" << std::endl;
+		return 0;
+	}
+
+	while (in >> column >> usage.equality >> usage.range) {
+		workload[column] = usage;
+	}
+
+	return queries;
+}
+
+void IndexManager::parseFilter(const std::string &filter, workloadMap &workload)
+{
+	stringSet equality, range;
+	size_t pos = 0;
+
+	/* look for column names (eXidY or eXidYpZ) */
+	while ((pos = filter.find('e', pos)) != std::string::npos) {
+		size_t start = pos++;
+		if (start > 0 && (isalnum(filter[start - 1]) || filter[start - 1] == '_')) {
+			continue;
+		}
+
+		size_t end = start + 1;
+		while (end < filter.length() && isdigit(filter[end])) {
+			end++;
+		}
+		if (end == start + 1 || filter.compare(end, 2, "id") != 0) {
+			continue;
+		}
+		end += 2;
+		if (end == filter.length() || !isdigit(filter[end])) {
+			continue;
+		}
+		while (end < filter.length() && (isdigit(filter[end]) || filter[end] == 'p')) {
+			end++;
+		}
+		if (end < filter.length() && (isalpha(filter[end]) || filter[end] == '_')) {
+			continue;
+		}
+
+		std::string column = filter.substr(start, end - start);
+		pos = end;
+
+		/* classify the predicate by the operator following the column */
+		while (end < filter.length() && filter[end] == ' ') {
+			end++;
+		}
+		std::string op = filter.substr(end, 3);
+		std::transform(op.begin(), op.end(), op.begin(), ::tolower);
+		if ((op[0] == '=') || op.compare(0, 3, "in ") == 0 || op.compare(0, 3, "in(") == 0) {
+			equality.insert(column);
+		} else {
+			range.insert(column);
+		}
+	}
+
+	/* each query is counted once per column */
+	for (auto column: equality) {
+		workload[column].equality++;
+	}
+	for (auto column: range) {
+		workload[column].range++;
+	}
+}
+
+const char *IndexManager::chooseIndex(const ColumnUsage &usage, uint64_t queries)
+{
+	uint64_t used = usage.equality + usage.range;
+
+	if (used < WORKLOAD_MIN_QUERIES || used < WORKLOAD_MIN_SHARE * queries) {
+		return NULL;
+	}
+
+	return (usage.equality >= usage.range) ? equalityIndex : rangeIndex;
+}
+
+void IndexManager::recordWorkload(Configuration &conf, const Filter &filter)
+{
+	const std::string &file = conf.getWorkloadFile();
+	std::string tmp = file + ".tmp" + std::to_string(getpid());
+	workloadMap workload;
+
+	uint64_t queries = loadWorkload(file, workload) + 1;
+	parseFilter(filter.getFilter(), workload);
+
+	if (queries >= WORKLOAD_DECAY) {
+		queries /= 2;
+		for (workloadMap::iterator it = workload.begin(); it != workload.end();) {
+			it->second.equality /= 2;
+			it->second.range /= 2;
+			if (it->second.equality == 0 && it->second.range == 0) {
+				it = workload.erase(it);
+			} else {
+				it++;
+			}
+		}
+	}
+
+	/* replace the file at once, concurrent queries must not see it partially written */
+	std::ofstream out(tmp.c_str());
+	out << "queries " << queries << "\n";
+	for (auto item: workload) {
+		out << item.first << " " << item.second.equality << " " << item.second.range << "\n";
+	}
+	out.close();
+
+	if (out.fail() || rename(tmp.c_str(), file.c_str()) != 0) {
+		std::cerr << "Cannot write workload file " << file << std::endl;
+		unlink(tmp.c_str());
+	}
+}
+
+void IndexManager::tuneIndexes(Configuration &conf, TableManager &tm)
+{
+	ibis::partList parts = tm.getParts();
+	std::map<std::string, const char *> indexes;
+	workloadMap workload;
+	clock_t budget = (clock_t) conf.getTuneBudget() * CLOCKS_PER_SEC;
+	time_t now = time(NULL);
+	size_t done = 0, hot = 0;
+
+	uint64_t queries = loadWorkload(conf.getWorkloadFile(), workload);
+	if (queries == 0) {
+		std::cerr << "No queries recorded in workload file " << conf.getWorkloadFile() << std::endl;
+		return;
+	}
+
+	/* choose indexes */
+	for (auto item: workload) {
+		const char *spec = chooseIndex(item.second, queries);
+		if (spec != NULL) {
+			indexes[item.first] = spec;
+			std::cout << "Column " << item.first << " used by " << item.second.equality << "/"
+				<< item.second.range << " (equality/range) of " << queries << " queries: " << spec << std::endl;
+		}
+	}
+
+	if (indexes.empty()) {
+		std::cout << "No column is used often enough to be indexed" << std::endl;
+		return;
+	}
+
+	/* run in background, do not slow down the collector */
+	if (nice(19) == -1) {
+		MSG_DEBUG("IndexManager", "Cannot lower process priority");
+	}
+
+	for (ibis::partList::iterator partIt = parts.begin(); partIt != parts.end(); partIt++, done++) {
+		std::string dir = (*partIt)->currentDataDir();
+		struct stat st;
+
+		if (budget > 0 && clock() >= budget) {
+			std::cout << "CPU time budget spent, " << parts.size() - done << " part(s) left for next run" << std::endl;
+			break;
+		}
+
+		/* the part may still be written */
+		if (stat((dir + "/-part.txt").c_str(), &st) != 0 || now - st.st_mtime < COLD_PART_AGE) {
+			hot++;
+			continue;
+		}
+
+		ibis::table *table = NULL;
+		for (auto column: (*partIt)->columnNames()) {
+			std::map<std::string, const char *>::const_iterator it = indexes.find(column);
+			if (it == indexes.end() || access((dir + "/" + column + ".idx").c_str(), F_OK) == 0) {
+				continue;
+			}
+
+			if (table == NULL) {
+				std::cout << "Building indexes on part " << dir << " ... ";
+				table = ibis::table::create(**partIt);
+			}
+			table->buildIndex(column, it->second);
+			std::cout << column << " ";
+		}
+
+		if (table != NULL) {
+			std::cout << std::endl;
+			delete table;
+		}
+	}
+
+	if (hot > 0) {
+		std::cout << "Skipped " << hot << " recently modified part(s)" << std::endl;
+	}
+}
+
 } /* end of fbitdump namespace */
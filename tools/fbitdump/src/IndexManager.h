@@ -42,9 +42,22 @@
 
 #include "Configuration.h"
 #include "TableManager.h"
+#include "Filter.h"
+#include <map>
 
 namespace fbitdump {
 
+/**
+ * \brief Number of queries that used a column in filter
+ */
+struct ColumnUsage {
+	uint64_t equality;	/**< Queries comparing the column for equality (=, in) */
+	uint64_t range;		/**< Queries with other predicates on the column (<, >, between, ...) */
+};
+
+/** Usage of columns in filters, indexed by column name */
+typedef std::map<std::string, ColumnUsage> workloadMap;
+
 class IndexManager
 {
 public:
@@ -67,6 +80,57 @@ public:
 	 * @param tm TableManager with created parts to process
 	 */
 	static void createIndexes(Configuration &conf, TableManager &tm);
+
+	/**
+	 * \brief Record columns used by filter in workload file
+	 *
+	 * Each query increments counters of columns used in its filter,
+	 * split by the predicate type
+	 *
+	 * @param conf Configuration class that specifies workload file
+	 * @param filter Filter of current query
+	 */
+	static void recordWorkload(Configuration &conf, const Filter &filter);
+
+	/**
+	 * \brief Build indexes chosen by recorded workload on cold parts
+	 *
+	 * Columns used by large enough share of recorded queries are indexed,
+	 * equality encoded indexes are built for columns compared mostly for
+	 * equality, binned interval-equality indexes otherwise. Parts modified
+	 * recently are skipped, processing stops when CPU time budget is spent.
+	 *
+	 * @param conf Configuration class that specifies workload file and budget
+	 * @param tm TableManager with created parts to process
+	 */
+	static void tuneIndexes(Configuration &conf, TableManager &tm);
+
+private:
+	/**
+	 * \brief Load workload file
+	 *
+	 * @param file Path to workload file
+	 * @param workload Usage of columns
+	 * @return Number of recorded queries (0 when the file does not exist)
+	 */
+	static uint64_t loadWorkload(const std::string &file, workloadMap &workload);
+
+	/**
+	 * \brief Add usage of columns by one filter to workload
+	 *
+	 * @param filter FastBit filter string
+	 * @param workload Usage of columns to update
+	 */
+	static void parseFilter(const std::string &filter, workloadMap &workload);
+
+	/**
+	 * \brief Choose index specification for a column
+	 *
+	 * @param usage Usage of the column
+	 * @param queries Number of recorded queries
+	 * @return FastBit index specification or NULL when index is not worth building
+	 */
+	static const char *chooseIndex(const ColumnUsage &usage, uint64_t queries);
 };
 
 } /* end of fbitdump namespace */
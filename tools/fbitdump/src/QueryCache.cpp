@@ -0,0 +1,315 @@
+/**
+ * \file QueryCache.cpp
+ * \brief Class caching partial aggregation results of table parts
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <fastbit/ibis.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "QueryCache.h"
+#include "Utils.h"
+#include "Verbose.h"
+
+namespace fbitdump {
+
+/** Name of the file with identification of cached result */
+static const char *stampFile = "fbitdump-cache.txt";
+
+/**
+ * \brief 64-bit FNV-1a hash of a string
+ *
+ * @param str String to hash
+ * @return Hash
+ */
+static uint64_t hashString(const std::string &str)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (auto ch: str) {
+		hash ^= (unsigned char) ch;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * \brief Remove directory with files (fastbit parts are flat)
+ *
+ * @param path Path to the directory
+ */
+static void removeDir(const std::string &path)
+{
+	DIR *dir = opendir(path.c_str());
+	if (dir == NULL) {
+		return;
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (std::string(ent->d_name) == "." || std::string(ent->d_name) == "..") {
+			continue;
+		}
+		unlink((path + "/" + ent->d_name).c_str());
+	}
+
+	closedir(dir);
+	rmdir(path.c_str());
+}
+
+QueryCache::QueryCache(const std::string &dir): dir(dir), usable(false), hits(0), misses(0)
+{
+	struct stat st;
+
+	Utils::sanitizePath(this->dir);
+
+	if (stat(this->dir.c_str(), &st) != 0) {
+		mkdir(this->dir.c_str(), 0755);
+	}
+
+	if (stat(this->dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && access(this->dir.c_str(), W_OK) == 0) {
+		this->usable = true;
+	} else {
+		std::cerr << "Cannot use cache directory " << this->dir << ", results will not be cached" << std::endl;
+	}
+}
+
+bool QueryCache::isUsable() const
+{
+	return this->usable;
+}
+
+std::string QueryCache::mergeSelect(const std::string &select)
+{
+	std::string merge;
+	std::string item;
+	std::istringstream ss(select);
+
+	/* items are separated by ", " and have form "func(col) as alias" or "col as alias" */
+	while (std::getline(ss, item, ',')) {
+		size_t start = item.find_first_not_of(' ');
+		size_t as = item.rfind(" as ");
+		if (start == std::string::npos || as == std::string::npos) {
+			return "";
+		}
+
+		std::string alias = item.substr(as + 4);
+		std::string expr = item.substr(start, as - start);
+		size_t paren = expr.find('(');
+
+		if (!merge.empty()) {
+			merge += ", ";
+		}
+
+		if (paren == std::string::npos) {
+			/* column to aggregate by */
+			merge += alias;
+			continue;
+		}
+
+		std::string func = expr.substr(0, paren);
+		if (func == "sum" || func == "count") {
+			merge += "sum(" + alias + ") as " + alias;
+		} else if (func == "min" || func == "max") {
+			merge += func + "(" + alias + ") as " + alias;
+		} else {
+			/* e.g. avg cannot be computed from partial results */
+			return "";
+		}
+	}
+
+	return merge;
+}
+
+bool QueryCache::getStamp(ibis::part *part, const std::string &query, Stamp &stamp) const
+{
+	struct stat st;
+
+	stamp.source = part->currentDataDir();
+	stamp.query = query;
+	stamp.rows = part->nRows();
+
+	if (stat((stamp.source + "/-part.txt").c_str(), &st) != 0) {
+		return false;
+	}
+
+	stamp.mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	stamp.size = st.st_size;
+
+	return true;
+}
+
+bool QueryCache::readStamp(const std::string &entry, Stamp &stamp, uint64_t &resultRows) const
+{
+	std::ifstream in((entry + stampFile).c_str());
+	std::string key;
+	size_t queryLength = 0;
+
+	if (!in.good()) {
+		return false;
+	}
+
+	/* query may contain new lines, it is stored with its length at the end */
+	in >> key >> stamp.source >> key >> stamp.mtime >> key >> stamp.size
+		>> key >> stamp.rows >> key >> resultRows >> key >> queryLength;
+	if (in.fail() || in.get() != '\n') {
+		return false;
+	}
+
+	stamp.query.resize(queryLength);
+	in.read(&stamp.query[0], queryLength);
+
+	return !in.fail();
+}
+
+uint64_t QueryCache::store(ibis::part *part, const std::string &select, const Filter &filter,
+		const std::string &entry, const Stamp &stamp)
+{
+	std::string tmp = entry.substr(0, entry.length() - 1) + ".tmp" + std::to_string(getpid());
+	std::string name = entry.substr(this->dir.length(), entry.length() - this->dir.length() - 1);
+
+	removeDir(tmp);
+	if (mkdir(tmp.c_str(), 0755) != 0) {
+		throw std::runtime_error("Cannot create cache entry " + tmp);
+	}
+
+	/* perform the query on the table part */
+	ibis::table *table = ibis::table::create(*part);
+	ibis::table *result = table->select(select.c_str(), filter.getFilter().c_str());
+	delete table;
+
+	uint64_t rows = result ? result->nRows() : 0;
+	if (rows > 0 && result->backup(tmp.c_str(), ("c" + name).c_str(), "fbitdump query cache") < 0) {
+		delete result;
+		removeDir(tmp);
+		throw std::runtime_error("Cannot store cache entry " + tmp);
+	}
+	delete result;
+
+	/*
+	 * The stamp was taken before the query; when the part has changed meanwhile,
+	 * the entry does not match the part on next use and is computed again
+	 */
+	std::ofstream out((tmp + "/" + stampFile).c_str());
+	out << "source " << stamp.source << "\n"
+		<< "mtime " << stamp.mtime << "\n"
+		<< "size " << stamp.size << "\n"
+		<< "rows " << stamp.rows << "\n"
+		<< "result " << rows << "\n"
+		<< "query " << stamp.query.length() << "\n"
+		<< stamp.query;
+	out.close();
+
+	removeDir(entry);
+	if (out.fail() || rename(tmp.c_str(), entry.c_str()) != 0) {
+		removeDir(tmp);
+		throw std::runtime_error("Cannot store cache entry " + entry);
+	}
+
+	return rows;
+}
+
+ibis::part *QueryCache::open(const std::string &entry)
+{
+	ibis::part *part = new ibis::part(entry.c_str(), true);
+
+	if (part->nRows() == 0) {
+		delete part;
+		return NULL;
+	}
+
+	this->partials.push_back(part);
+	return part;
+}
+
+ibis::part *QueryCache::getPartial(ibis::part *part, const std::string &select, const Filter &filter)
+{
+	Stamp stamp, cached;
+	uint64_t resultRows;
+	std::string query = select + "\n" + filter.getFilter();
+	std::stringstream entry;
+
+	if (!this->usable) {
+		throw std::runtime_error("Cache directory " + this->dir + " is not usable");
+	}
+
+	bool stamped = getStamp(part, query, stamp);
+	entry << this->dir << std::hex << hashString(stamp.source + "\n" + query) << "/";
+
+	/* the part path and query are compared as well to rule out hash collisions */
+	if (stamped && readStamp(entry.str(), cached, resultRows)
+			&& cached.source == stamp.source && cached.query == stamp.query
+			&& cached.mtime == stamp.mtime && cached.size == stamp.size && cached.rows == stamp.rows) {
+		if (resultRows == 0) {
+			this->hits++;
+			return NULL;
+		}
+
+		ibis::part *partial = open(entry.str());
+		if (partial != NULL) {
+			this->hits++;
+			return partial;
+		}
+	}
+
+	this->misses++;
+	if (!stamped) {
+		/* store the result with a stamp that never matches */
+		stamp.mtime = -1;
+	}
+
+	if (store(part, select, filter, entry.str(), stamp) == 0) {
+		return NULL;
+	}
+
+	return open(entry.str());
+}
+
+QueryCache::~QueryCache()
+{
+	for (ibis::partList::const_iterator it = this->partials.begin(); it != this->partials.end(); it++) {
+		delete *it;
+	}
+
+	MSG_INFO("QueryCache", "%lu part(s) read from cache, %lu part(s) queried", (unsigned long) this->hits, (unsigned long) this->misses);
+}
+
+} /* end of fbitdump namespace */
@@ -0,0 +1,176 @@
+/**
+ * \file QueryCache.h
+ * \brief Header of class caching partial aggregation results of table parts
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef QUERYCACHE_H_
+#define QUERYCACHE_H_
+
+#include "typedefs.h"
+#include "Filter.h"
+
+namespace fbitdump {
+
+/**
+ * \brief Persistent cache of partial aggregation results
+ *
+ * Result of the select with aggregation functions (see
+ * Table::createFunctionsSelect()) is computed for each table part separately
+ * and stored as a fastbit part in the cache directory. Next query with the
+ * same select and filter reads the stored result instead of the table part,
+ * so only parts that are new or have changed since (e.g. the part currently
+ * written by the collector) are queried again.
+ *
+ * An entry is identified by hash of the part path, select and filter and
+ * is valid as long as the "-part.txt" file of the table part has the same
+ * modification time and size. Partial results are merged by mergeSelect(),
+ * therefore only aggregation functions that can be merged (sum, min, max
+ * and count) are cacheable.
+ */
+class QueryCache
+{
+public:
+	/**
+	 * \brief Class constructor
+	 *
+	 * Creates the cache directory when it does not exist
+	 *
+	 * @param dir Cache directory
+	 */
+	QueryCache(const std::string &dir);
+
+	/**
+	 * \brief Check whether the cache directory can be used
+	 *
+	 * @return true when the cache directory exists
+	 */
+	bool isUsable() const;
+
+	/**
+	 * \brief Create select that merges partial results of given select
+	 *
+	 * Sums and counts are summed, minimums and maximums are merged by the
+	 * same function, other columns are aggregated by.
+	 *
+	 * @param select Select with aggregation functions ("func(col) as alias, ...")
+	 * @return Merging select or empty string when the select cannot be merged
+	 */
+	static std::string mergeSelect(const std::string &select);
+
+	/**
+	 * \brief Return partial result of select over one table part
+	 *
+	 * Uses the cached result when it is valid, otherwise the select is
+	 * performed and its result is stored in the cache.
+	 *
+	 * @param part Table part
+	 * @param select Select with aggregation functions
+	 * @param filter Filter to use
+	 * @return Part with the partial result or NULL when the result is empty.
+	 * The part is owned by the cache.
+	 */
+	ibis::part *getPartial(ibis::part *part, const std::string &select, const Filter &filter);
+
+	/**
+	 * \brief Class destructor
+	 *
+	 * Deletes parts returned by getPartial()
+	 */
+	~QueryCache();
+
+private:
+	/**
+	 * \brief Identification of table part content
+	 */
+	struct Stamp {
+		std::string source;	/**< Path to table part */
+		std::string query;	/**< Select and filter */
+		int64_t mtime;		/**< Modification time of "-part.txt" (ns) */
+		int64_t size;		/**< Size of "-part.txt" */
+		uint64_t rows;		/**< Number of rows in table part */
+	};
+
+	/**
+	 * \brief Get identification of table part content
+	 *
+	 * @param part Table part
+	 * @param query Select and filter
+	 * @param stamp Resulting identification
+	 * @return true on success
+	 */
+	bool getStamp(ibis::part *part, const std::string &query, Stamp &stamp) const;
+
+	/**
+	 * \brief Read stamp of cached result
+	 *
+	 * @param entry Path to cache entry
+	 * @param stamp Resulting identification
+	 * @param resultRows Number of rows of cached result
+	 * @return true when the entry exists and is readable
+	 */
+	bool readStamp(const std::string &entry, Stamp &stamp, uint64_t &resultRows) const;
+
+	/**
+	 * \brief Compute partial result and store it as new cache entry
+	 *
+	 * @param part Table part
+	 * @param select Select with aggregation functions
+	 * @param filter Filter to use
+	 * @param entry Path to cache entry
+	 * @param stamp Identification of table part content before the query
+	 * @return Number of rows of the result
+	 */
+	uint64_t store(ibis::part *part, const std::string &select, const Filter &filter,
+			const std::string &entry, const Stamp &stamp);
+
+	/**
+	 * \brief Open part with cached result
+	 *
+	 * @param entry Path to cache entry
+	 * @return Opened part or NULL
+	 */
+	ibis::part *open(const std::string &entry);
+
+	std::string dir;	/**< Cache directory (ends with '/') */
+	bool usable;		/**< Cache directory exists */
+	ibis::partList partials;	/**< Opened parts with cached results */
+	uint64_t hits;		/**< Number of parts answered from cache */
+	uint64_t misses;	/**< Number of parts queried */
+};
+
+} /* end of fbitdump namespace */
+
+#endif /* QUERYCACHE_H_ */
@@ -124,7 +124,7 @@ columnVector Table::getColumnsByNames(const columnVector columns, const stringSe
 	return cols;
 }
 
-void Table::aggregateWithFunctions(const columnVector& aggregateColumns, const columnVector& summaryColumns, const Filter& filter)
+std::string Table::createFunctionsSelect(const columnVector& aggregateColumns, const columnVector& summaryColumns, bool &flows)
 {
 	stringSet cols;
 	
@@ -142,7 +142,7 @@ void Table::aggregateWithFunctions(const columnVector& aggregateColumns, const c
 	}
 	
 	/* Create select clause */
-	bool flows = false;
+	flows = false;
 	std::string select;
 	for (auto name: cols) {
 		int begin = name.find_first_of('(') + 1;
@@ -158,12 +158,31 @@ void Table::aggregateWithFunctions(const columnVector& aggregateColumns, const c
 	/* Add aggregation */
 	select += "count(*) as flows, ";
 
-	select = select.substr(0, select.length() - 1);
+	return select.substr(0, select.length() - 2);
+}
+
+void Table::aggregateWithFunctions(const columnVector& aggregateColumns, const columnVector& summaryColumns, const Filter& filter)
+{
+	bool flows;
+	std::string select = createFunctionsSelect(aggregateColumns, summaryColumns, flows);
 	
 	/* Create table */
 	queueQuery(select.c_str(), filter);
 	
 	/* Aggregate created table */
+	aggregateAliases(aggregateColumns, summaryColumns, flows);
+}
+
+void Table::aggregatePartials(const columnVector& aggregateColumns, const columnVector& summaryColumns, const std::string &select, bool flows)
+{
+	/* Partial results are already filtered */
+	queueQuery(select, emptyFilter);
+	
+	aggregateAliases(aggregateColumns, summaryColumns, flows);
+}
+
+void Table::aggregateAliases(const columnVector& aggregateColumns, const columnVector& summaryColumns, bool flows)
+{
 	columnVector aCols, sCols;
 	for (auto col: aggregateColumns) {
 		if (col->getSemantics() != "flows") {
@@ -111,6 +111,30 @@ public:
 	 * @param filter Filter to use
 	 */
         void aggregateWithFunctions(const columnVector &aggregateColumns, const columnVector &summaryColumns, const Filter &filter);
+
+        /**
+	 * \brief Run query that merges partial aggregation results
+	 *
+	 * The table must be created from parts holding results of the select
+	 * returned by createFunctionsSelect(), the select must merge them
+	 * (see QueryCache::mergeSelect())
+	 *
+	 * @param aggregateColumns vector of columns to aggregate by
+	 * @param summaryColumns vector of columns to summarize
+	 * @param select Select merging the partial results
+	 * @param flows true when flows are required
+	 */
+        void aggregatePartials(const columnVector &aggregateColumns, const columnVector &summaryColumns, const std::string &select, bool flows);
+
+        /**
+	 * \brief Create select with aggregation functions used by aggregateWithFunctions()
+	 *
+	 * @param aggregateColumns vector of columns to aggregate by
+	 * @param summaryColumns vector of columns to summarize
+	 * @param flows Set to true when flows are required
+	 * @return select clause
+	 */
+        static std::string createFunctionsSelect(const columnVector &aggregateColumns, const columnVector &summaryColumns, bool &flows);
         
         /**
 	 * \brief Run query that filters data in this table
@@ -196,6 +220,15 @@ private:
 	 */
 	void queueQuery(std::string select, const Filter &filter);
 
+	/**
+	 * \brief Aggregate result of the select with aggregation functions by column aliases
+	 *
+	 * @param aggregateColumns vector of columns to aggregate by
+	 * @param summaryColumns vector of columns to summarize
+	 * @param flows true when flows are required
+	 */
+	void aggregateAliases(const columnVector &aggregateColumns, const columnVector &summaryColumns, bool flows);
+
         /**
          * \brief Create select clause from column vector
          * 
@@ -39,6 +39,7 @@
 
 #include "TableManager.h"
 #include <algorithm>
+#include <stdexcept>
 #include <fastbit/ibis.h>
 
 namespace fbitdump {
@@ -222,8 +223,6 @@ void TableManager::aggregate(columnVector aggregateColumns, columnVector summary
 
 		/* create table for each partList */
 		if (!outerIter->empty() || aggregateColumns.empty()) {
-			table = new Table(pList);
-
 			columnVector aggCols;
 			for (auto col: aggregateColumns) {
 				bool isThere = true;
@@ -239,9 +238,16 @@ void TableManager::aggregate(columnVector aggregateColumns, columnVector summary
 			}
 
 			/* aggregate the table, use only present aggregation columns */
-			table->aggregateWithFunctions(aggCols, summaryColumns, filter);
-			table->orderBy(this->orderColumns, this->orderAsc);
-			this->tables.push_back(table);
+			if (this->cache == NULL || !this->aggregateCached(pList, aggCols, summaryColumns, filter, table)) {
+				table = new Table(pList);
+				table->aggregateWithFunctions(aggCols, summaryColumns, filter);
+			}
+
+			/* no part has matching records */
+			if (table != NULL) {
+				table->orderBy(this->orderColumns, this->orderAsc);
+				this->tables.push_back(table);
+			}
 		}
 
 		/* and clear the part list */
@@ -250,6 +256,39 @@ void TableManager::aggregate(columnVector aggregateColumns, columnVector summary
 	}
 }
 
+bool TableManager::aggregateCached(ibis::partList &pList, const columnVector &aggregateColumns,
+		const columnVector &summaryColumns, Filter &filter, Table *&table)
+{
+	bool flows;
+	std::string select = Table::createFunctionsSelect(aggregateColumns, summaryColumns, flows);
+	std::string merge = QueryCache::mergeSelect(select);
+	ibis::partList partials;
+
+	/* partial results cannot be merged (e.g. avg is used) */
+	if (merge.empty() || !this->cache->isUsable()) {
+		return false;
+	}
+
+	try {
+		for (auto part: pList) {
+			ibis::part *partial = this->cache->getPartial(part, select, filter);
+			if (partial != NULL) {
+				partials.push_back(partial);
+			}
+		}
+	} catch (std::runtime_error &e) {
+		std::cerr << e.what() << ", not using cache" << std::endl;
+		return false;
+	}
+
+	table = NULL;
+	if (!partials.empty()) {
+		table = new Table(partials);
+		table->aggregatePartials(aggregateColumns, summaryColumns, merge, flows);
+	}
+
+	return true;
+}
 
 void TableManager::postAggregateFilter(Filter& filter)
 {
@@ -342,7 +381,7 @@ uint64_t TableManager::getInitRows() const
 	return ret;
 }
 
-TableManager::TableManager(Configuration &conf): conf(conf), orderAsc(false), tableSummary(NULL)
+TableManager::TableManager(Configuration &conf): conf(conf), orderAsc(false), tableSummary(NULL), cache(NULL)
 {
 	ibis::part *part;
 	const stringVector partsNames = this->conf.getPartsNames();
@@ -366,6 +405,11 @@ TableManager::TableManager(Configuration &conf): conf(conf), orderAsc(false), ta
 		}
 	}
 
+	/* partial aggregation results are cached only on request */
+	if (!conf.getCacheDir().empty()) {
+		this->cache = new QueryCache(conf.getCacheDir());
+	}
+
 	/* create order by string list if necessary */
 	if (conf.getOptionm()) {
 		this->orderColumns.insert(conf.getOrderByColumn()->getSelectName());
@@ -415,6 +459,11 @@ TableManager::~TableManager()
 	if (this->tableSummary != NULL) {
 		delete this->tableSummary;
 	}
+
+	/* cached parts are used by the tables */
+	if (this->cache != NULL) {
+		delete this->cache;
+	}
 }
 
 }  // namespace fbitdump
@@ -46,6 +46,7 @@
 #include "Table.h"
 #include "TableManagerCursor.h"
 #include "TableSummary.h"
+#include "QueryCache.h"
 #include "Utils.h"
 /**
  * \brief Namespace of the fbitdump utility
@@ -161,12 +162,26 @@ public:
 
 private:
 
+	/**
+	 * \brief Aggregate parts using cached partial results
+	 *
+	 * @param pList Parts with same aggregation columns
+	 * @param aggregateColumns Columns to aggregate by (present in parts)
+	 * @param summaryColumns Columns to summarize
+	 * @param filter Filter
+	 * @param table Resulting table, NULL when no part has matching records
+	 * @return false when the query cannot be answered from cache
+	 */
+	bool aggregateCached(ibis::partList &pList, const columnVector &aggregateColumns,
+			const columnVector &summaryColumns, Filter &filter, Table *&table);
+
 	Configuration &conf;		/**< Program configuration */
 	ibis::partList parts;		/**< List of loaded table parts */
 	tableVector tables;			/**< List of managed tables */
 	stringSet orderColumns; 	/**< String list of order by columns */
 	bool orderAsc;				/**< Same as in Configuration, true when columns are to be sorted in increasing order */
 	TableSummary *tableSummary;	/**< Table summary, created on demand */
+	QueryCache *cache;			/**< Cache of partial aggregation results, NULL when disabled */
 };
 
 }  // namespace fbitdump
@@ -149,6 +149,22 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		/* check whether to build indexes according to workload */
+		if (conf.getTuneIndexes()) {
+			Utils::printStatus("Building indexes according to workload");
+
+			IndexManager::tuneIndexes(conf, tm);
+			if (access (conf.pipe_name.c_str(), F_OK ) == 0 ) {
+				ibis::partList parts = tm.getParts();
+				pipe.open( conf.pipe_name.c_str() );
+
+				for (ibis::partList::iterator partIt = parts.begin(); partIt != parts.end(); partIt++) {
+					pipe << (*partIt)->currentDataDir() << "\n";
+				}
+				pipe.close();
+			}
+		}
+
 		/* check whether to print template information */
 		if (conf.getTemplateInfo()) {
 			Utils::printStatus("Printing templates");
@@ -157,7 +173,12 @@ int main(int argc, char *argv[])
 		}
 
 		/* index manipulation and template info are separate tasks, exclusive with flow printing */
-		if (!conf.getDeleteIndexes() && !conf.getCreateIndexes() && !conf.getTemplateInfo()) {
+		if (!conf.getDeleteIndexes() && !conf.getCreateIndexes() && !conf.getTuneIndexes() && !conf.getTemplateInfo()) {
+			/* record columns used by the query for index selection */
+			if (!conf.getWorkloadFile().empty()) {
+				IndexManager::recordWorkload(conf, filter);
+			}
+
 			/* do the work */
 			if (conf.getAggregate()) {
 				Utils::printStatus("Aggregating tables");